@@ -16,15 +16,82 @@ CallEstablishedTrigger = voip_ns.class_('CallEstablishedTrigger', automation.Tri
 CallEndedTrigger = voip_ns.class_('CallEndedTrigger', automation.Trigger)
 ReadyTrigger = voip_ns.class_('ReadyTrigger', automation.Trigger)
 NotReadyTrigger = voip_ns.class_('NotReadyTrigger', automation.Trigger)
+IncomingCallTrigger = voip_ns.class_('IncomingCallTrigger', automation.Trigger.template(cg.std_string))
+CallMissedTrigger = voip_ns.class_('CallMissedTrigger', automation.Trigger.template(cg.std_string))
 
 CONFIG_SCHEMA = cv.Schema({
     cv.GenerateID(): cv.declare_id(Voip),
     cv.Required('sip_ip'): cv.string,
     cv.Required('sip_user'): cv.string,
     cv.Required('sip_pass'): cv.string,
-    cv.Optional('codec', default=0): cv.int_,
+    # 0 = PCMU, 1 = PCMA, 2 = G.726-32 (G.721), 3 = G.726-24, 4 = G.726-40, 5 = G.722 (wideband with
+    # 16 kHz microphone and speaker)
+    cv.Optional('codec', default=0): cv.int_range(min=0, max=5),
+    # first of the three RTP payload types offered for the ADPCM codecs (G726-32, -24, -40; dynamic
+    # range, RFC 3551)
+    cv.Optional('adpcm_payload_type', default=96): cv.int_range(min=96, max=125),
+    # calls held at the same time; the newest one is on the speaker and microphone
+    cv.Optional('max_calls', default=1): cv.int_range(min=1, max=8),
+    # mix all calls and the device into one conference: everybody hears everybody else
+    cv.Optional('conference', default=False): cv.boolean,
+    # local RTP ports announced in the SDP, one even port per call from rtp_port to rtp_port_max
+    # (default: twice the ports needed, so a port is not reused right after its call)
+    cv.Optional('rtp_port', default=1234): cv.port,
+    cv.Optional('rtp_port_max'): cv.port,
+    # packetization we ask the far end for; longer frames mean fewer packets and less airtime
+    cv.Optional('ptime', default='20ms'): cv.All(cv.positive_time_period_milliseconds,
+                                                 cv.Range(min=cv.TimePeriod(milliseconds=10),
+                                                          max=cv.TimePeriod(milliseconds=60))),
+    # discontinuous transmission: offer comfort noise (RFC 3389) and send no audio while nobody
+    # speaks, only a noise level now and then; needs the far end to take CN
+    cv.Optional('dtx', default=False): cv.boolean,
+    # remove the speaker's echo from the microphone (speakerphone). tail: echo path covered; delay:
+    # the speaker's and microphone's buffering in front of it; cpu_budget: share of a core the
+    # adaptation may take, less of the tail is adapted per sample beyond it
+    cv.Optional('echo_cancellation'): cv.Schema({
+        cv.Optional('tail', default='64ms'): cv.All(cv.positive_time_period_milliseconds,
+                                                    cv.Range(min=cv.TimePeriod(milliseconds=8),
+                                                             max=cv.TimePeriod(milliseconds=256))),
+        cv.Optional('delay', default='0ms'): cv.All(cv.positive_time_period_milliseconds,
+                                                    cv.Range(max=cv.TimePeriod(milliseconds=500))),
+        cv.Optional('cpu_budget', default='25%'): cv.All(cv.percentage, cv.Range(min=0.01)),
+        # attenuate what the linear canceller leaves while only the far end talks
+        cv.Optional('suppressor', default=True): cv.boolean,
+    }),
+    # steady background noise (fans, traffic, hum) in the microphone turned down by up to
+    # max_attenuation dB, after the echo canceller; adds 10 ms of delay
+    cv.Optional('noise_suppression'): cv.Schema({
+        cv.Optional('max_attenuation', default=15): cv.float_range(min=0, max=30),
+    }),
+    # the rates the I2S microphone and speaker are set to; anything but 8000 Hz is resampled to and
+    # from the 8 kHz of the call. A resampled microphone's words: 16, or 32 for 24-bit samples
+    cv.Optional('mic_sample_rate', default=8000): cv.one_of(8000, 16000, 48000, int=True),
+    cv.Optional('mic_bits_per_sample', default=16): cv.one_of(16, 32, int=True),
+    cv.Optional('speaker_sample_rate', default=8000): cv.one_of(8000, 16000, 48000, int=True),
     cv.Optional('mic_gain', default=2): cv.int_,
     cv.Optional('amp_gain', default=6): cv.int_,
+    # automatic gain control on the microphone after mic_gain: quiet talkers up, loud ones down to
+    # target_level (the peak envelope), never more than max_gain; below noise_gate the gain holds
+    cv.Optional('auto_gain'): cv.Schema({
+        cv.Optional('target_level', default=-12): cv.float_range(min=-30, max=0),
+        cv.Optional('max_gain', default=20): cv.float_range(min=0, max=40),
+        cv.Optional('noise_gate', default=-55): cv.float_range(min=-90, max=-20),
+        cv.Optional('attack', default='10ms'): cv.All(cv.positive_time_period_milliseconds,
+                                                      cv.Range(max=cv.TimePeriod(milliseconds=1000))),
+        cv.Optional('release', default='500ms'): cv.All(cv.positive_time_period_milliseconds,
+                                                        cv.Range(max=cv.TimePeriod(milliseconds=10000))),
+        # peaks above it are turned down instead of clipped
+        cv.Optional('limit', default=-1): cv.float_range(min=-20, max=0),
+    }),
+    # amp_gain through a limiter: the speaker's peaks are turned down to limit (dBFS) instead of
+    # clipping, and come back up within release
+    cv.Optional('speaker_limiter'): cv.Schema({
+        cv.Optional('limit', default=-1): cv.float_range(min=-20, max=0),
+        cv.Optional('release', default='100ms'): cv.All(cv.positive_time_period_milliseconds,
+                                                        cv.Range(max=cv.TimePeriod(milliseconds=10000))),
+    }),
+    cv.Optional('jitter_min_delay', default='40ms'): cv.positive_time_period_milliseconds,
+    cv.Optional('jitter_max_delay', default='200ms'): cv.positive_time_period_milliseconds,
     cv.Required('mic_id'): cv.use_id(I2SAudioMicrophone),
     cv.Required('speaker_id'): cv.use_id(I2SAudioSpeaker),
     # readiness is now an automation event instead of a binary sensor
@@ -43,21 +110,106 @@ CONFIG_SCHEMA = cv.Schema({
     cv.Optional('on_not_ready'): automation.validate_automation({
         cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(NotReadyTrigger),
     }),
+    cv.Optional('on_incoming_call'): automation.validate_automation({
+        cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(IncomingCallTrigger),
+    }),
+    cv.Optional('on_call_missed'): automation.validate_automation({
+        cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(CallMissedTrigger),
+    }),
+    # register at sip_ip so that incoming calls reach the device; the binding is refreshed before it
+    # expires
+    cv.Optional('register', default=True): cv.boolean,
+    cv.Optional('register_expires', default='600s'): cv.All(cv.positive_time_period_seconds,
+                                                             cv.Range(min=cv.TimePeriod(seconds=60),
+                                                                      max=cv.TimePeriod(seconds=86400))),
+    # answer incoming calls without waiting for id(voip).answer()
+    cv.Optional('auto_answer', default=False): cv.boolean,
     cv.Optional('start_on_boot', default=False): cv.boolean,
+    # run RTP RX/TX in a dedicated FreeRTOS task instead of the main loop
+    cv.Optional('media_task'): cv.Schema({
+        cv.Optional('core', default=1): cv.int_range(min=-1, max=1),
+        cv.Optional('priority', default=18): cv.int_range(min=1, max=24),
+        cv.Optional('period', default='10ms'): cv.All(cv.positive_time_period_milliseconds,
+                                                      cv.Range(min=cv.TimePeriod(milliseconds=1),
+                                                               max=cv.TimePeriod(milliseconds=20))),
+    }),
 }).extend(cv.COMPONENT_SCHEMA)
 
+
+def _validate_jitter_delays(config):
+    if config['jitter_max_delay'] < config['jitter_min_delay']:
+        raise cv.Invalid("jitter_max_delay must not be smaller than jitter_min_delay")
+    return config
+
+
+def _validate_ptime(config):
+    if config['ptime'].total_milliseconds % 10 != 0:
+        raise cv.Invalid("ptime must be a multiple of 10ms")
+    return config
+
+
+def _validate_conference(config):
+    if config['conference'] and config['max_calls'] < 2:
+        raise cv.Invalid("conference needs max_calls of at least 2")
+    return config
+
+
+def _validate_rtp_ports(config):
+    first = config['rtp_port']
+    last = config.get('rtp_port_max', first + 4 * config['max_calls'] - 1)
+    # RTP uses the even ports (RFC 3550 section 11)
+    ports = len(range(first + first % 2, last + 1, 2))
+    if ports < config['max_calls']:
+        raise cv.Invalid(f"rtp_port..rtp_port_max holds {ports} even ports, max_calls needs {config['max_calls']}")
+    if ports > 32:
+        raise cv.Invalid("rtp_port..rtp_port_max must not hold more than 32 even ports")
+    config['rtp_port_max'] = last
+    return config
+
+
+CONFIG_SCHEMA = cv.All(CONFIG_SCHEMA, _validate_jitter_delays, _validate_ptime, _validate_rtp_ports,
+                       _validate_conference)
+
 async def to_code(config):
     var = cg.new_Pvariable(config[CONF_ID])
     cg.add(var.init(config['sip_ip'], config['sip_user'], config['sip_pass']))
+    cg.add(var.set_dynamic_payload_type(config['adpcm_payload_type']))
     cg.add(var.set_codec(config['codec']))
+    cg.add(var.set_max_calls(config['max_calls']))
+    cg.add(var.set_conference(config['conference']))
+    cg.add(var.set_rtp_ports(config['rtp_port'], config['rtp_port_max']))
+    cg.add(var.set_registration(config['register'], config['register_expires'].total_seconds))
+    cg.add(var.set_auto_answer(config['auto_answer']))
+    cg.add(var.set_ptime(config['ptime'].total_milliseconds))
+    cg.add(var.set_dtx(config['dtx']))
+    cg.add(var.set_mic_sample_rate(config['mic_sample_rate'], config['mic_bits_per_sample']))
+    cg.add(var.set_speaker_sample_rate(config['speaker_sample_rate']))
     cg.add(var.set_mic_gain(config['mic_gain']))
     cg.add(var.set_amp_gain(config['amp_gain']))
+    if 'noise_suppression' in config:
+        cg.add(var.set_noise_suppression(config['noise_suppression']['max_attenuation']))
+    if 'auto_gain' in config:
+        agc = config['auto_gain']
+        cg.add(var.set_mic_agc(agc['target_level'], agc['max_gain'], agc['noise_gate'],
+                               agc['attack'].total_milliseconds, agc['release'].total_milliseconds, agc['limit']))
+    if 'speaker_limiter' in config:
+        limiter = config['speaker_limiter']
+        cg.add(var.set_speaker_limiter(limiter['limit'], limiter['release'].total_milliseconds))
+    cg.add(var.set_jitter_buffer_delay(config['jitter_min_delay'].total_milliseconds,
+                                       config['jitter_max_delay'].total_milliseconds))
     mic = await cg.get_variable(config['mic_id'])
     speaker = await cg.get_variable(config['speaker_id'])
     cg.add(var.set_mic(mic))
     cg.add(var.set_speaker(speaker))
     # Deprecated: no ready_sensor_id - use on_ready/on_not_ready automations
     # removed default_dial_number config option
+    if 'echo_cancellation' in config:
+        aec = config['echo_cancellation']
+        cg.add(var.set_echo_canceller(aec['tail'].total_milliseconds, aec['delay'].total_milliseconds,
+                                      aec['cpu_budget'], aec['suppressor']))
+    if 'media_task' in config:
+        media = config['media_task']
+        cg.add(var.set_media_task(media['core'], media['priority'], media['period'].total_milliseconds))
     if 'start_on_boot' in config and config['start_on_boot']:
         cg.add(var.set_start_on_boot(True))
     # PA output control removed; automations (on_call_established/on_call_ended) should manage amplifier
@@ -77,5 +229,11 @@ async def to_code(config):
     for conf in config.get('on_not_ready', []):
         trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
         await automation.build_automation(trigger, [], conf)
+    for conf in config.get('on_incoming_call', []):
+        trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
+        await automation.build_automation(trigger, [(cg.std_string, 'caller')], conf)
+    for conf in config.get('on_call_missed', []):
+        trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
+        await automation.build_automation(trigger, [(cg.std_string, 'caller')], conf)
     # Expose beep helper via lambda (no codegen needed) - users can call id(my_voip).play_beep_ms(200)
     await cg.register_component(var, config)
\ No newline at end of file
@@ -0,0 +1,85 @@
+#include "adpcm.h"
+
+namespace esphome {
+namespace voip {
+
+namespace {
+// code words handed to the G.726 core per call, kept on the stack
+constexpr size_t CHUNK = 40;
+}  // namespace
+
+AdpcmCodec::AdpcmCodec(uint8_t bits) : bits_(4) {
+  this->set_bits(bits);
+  this->reset_encoder();
+  this->reset_decoder();
+}
+
+void AdpcmCodec::set_bits(uint8_t bits) { this->bits_ = (bits == 3 || bits == 5) ? bits : 4; }
+
+const char *AdpcmCodec::get_encoding_name() const {
+  switch (this->bits_) {
+    case 3:
+      return "G726-24";
+    case 5:
+      return "G726-40";
+    default:
+      return "G726-32";
+  }
+}
+
+void AdpcmCodec::reset_encoder() { g726::init_state(&this->enc_state_); }
+
+void AdpcmCodec::reset_decoder() { g726::init_state(&this->dec_state_); }
+
+size_t AdpcmCodec::encode(const int16_t *pcm, size_t n, uint8_t *out) {
+  uint8_t codes[CHUNK];
+  uint32_t acc = 0;
+  int acc_bits = 0;
+  size_t bytes = 0;
+  while (n > 0) {
+    size_t k = n < CHUNK ? n : CHUNK;
+    g726::encode_block(&this->enc_state_, this->bits_, pcm, codes, k);
+    for (size_t i = 0; i < k; i++) {
+      acc |= (uint32_t)codes[i] << acc_bits;
+      acc_bits += this->bits_;
+      while (acc_bits >= 8) {
+        out[bytes++] = (uint8_t)acc;
+        acc >>= 8;
+        acc_bits -= 8;
+      }
+    }
+    pcm += k;
+    n -= k;
+  }
+  if (acc_bits > 0)
+    out[bytes++] = (uint8_t)acc;
+  return bytes;
+}
+
+size_t AdpcmCodec::decode(const uint8_t *in, size_t len, int16_t *out, size_t max_samples) {
+  const uint32_t mask = (1u << this->bits_) - 1;
+  uint8_t codes[CHUNK];
+  size_t pending = 0;
+  uint32_t acc = 0;
+  int acc_bits = 0;
+  size_t samples = 0;
+  for (size_t i = 0; i < len && samples + pending < max_samples; i++) {
+    acc |= (uint32_t)in[i] << acc_bits;
+    acc_bits += 8;
+    while (acc_bits >= this->bits_ && samples + pending < max_samples) {
+      codes[pending++] = (uint8_t)(acc & mask);
+      acc >>= this->bits_;
+      acc_bits -= this->bits_;
+      if (pending == CHUNK) {
+        g726::decode_block(&this->dec_state_, this->bits_, codes, out + samples, pending);
+        samples += pending;
+        pending = 0;
+      }
+    }
+  }
+  g726::decode_block(&this->dec_state_, this->bits_, codes, out + samples, pending);
+  return samples + pending;
+}
+
+}  // namespace voip
+}  // namespace esphome
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "g726.h"
+
+namespace esphome {
+namespace voip {
+
+// G.726 ADPCM (G.721 at 32 kbit/s, G.723 at 24 and 40 kbit/s) for one call.
+//
+// Encoder and decoder keep separate g726::State instances, reset at the start of every stream. RTP
+// payloads use the RFC 3551 section 4.5.4 packing: code words are packed LSB first, the first sample
+// in the least significant bits of the first octet, spilling into the next octet where needed.
+class AdpcmCodec {
+ public:
+  // bits per code word: 3 = G726-24, 4 = G726-32, 5 = G726-40
+  explicit AdpcmCodec(uint8_t bits = 4);
+
+  void set_bits(uint8_t bits);
+  uint8_t get_bits() const { return this->bits_; }
+  // encoding name for the SDP rtpmap attribute, e.g. "G726-32"
+  const char *get_encoding_name() const;
+
+  void reset_encoder();
+  void reset_decoder();
+
+  static size_t packed_size(size_t samples, uint8_t bits) { return (samples * bits + 7) / 8; }
+  // Encodes n 16-bit samples into out, returns the number of bytes written
+  size_t encode(const int16_t *pcm, size_t n, uint8_t *out);
+  // Decodes len payload bytes, writes at most max_samples samples, returns the number written
+  size_t decode(const uint8_t *in, size_t len, int16_t *out, size_t max_samples);
+
+ protected:
+  uint8_t bits_;
+  g726::State enc_state_;
+  g726::State dec_state_;
+};
+
+}  // namespace voip
+}  // namespace esphome
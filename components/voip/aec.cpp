@@ -0,0 +1,344 @@
+#include "aec.h"
+#include <cmath>
+#include <cstring>
+#include <new>
+
+namespace esphome {
+namespace voip {
+
+namespace {
+
+const uint32_t SAMPLE_RATE_HZ = 8000;
+// the reference FIFO holds the delay plus this much audio handed over ahead of the microphone
+const size_t FIFO_SLACK = 1024;
+// weights are Q24: an echo path may be louder than the reference by up to 128 times
+const int WEIGHT_BITS = 24;
+// NLMS step size (Q15) of the background filter until it has seen ADAPTED_BLOCKS of far-end audio,
+// and the most it gets afterwards
+const int32_t STEP_Q15 = 16384;
+const uint32_t ADAPTED_BLOCKS = 100;
+// the background adapts while the reference under the window is above about -70 dBov
+const int64_t FAR_MIN_POWER = 100;
+// the adaptation sees reference and error through 1 - 0.9 z^-1 (Q15), which flattens the spectrum
+// of speech and lets the weak high formants converge as fast as the strong low ones
+const int32_t PREEMPHASIS_Q15 = 29491;
+// regularisation of the NLMS normalisation, per tap
+const int64_t REGULARIZATION = 256;
+// an echo estimate below this mean square leaves the leakage and the suppressor alone
+const float ECHO_MIN_POWER = 4.0f;
+// the leakage estimate is smoothed per block by LEAK_RATE times the echo to error ratio, at most
+// LEAK_RATE_MAX, and rises by at most LEAK_RISE per block
+const float LEAK_RATE = 0.02f;
+const float LEAK_RATE_MAX = 0.01f;
+const float LEAK_RISE = 1.05f;
+const float MIN_LEAKAGE = 0.005f;
+// the residual is assumed this much louder than the average leakage (4.8 dB)
+const float OVERSUBTRACTION = 3.0f;
+
+int16_t saturate(int32_t v) { return (int16_t)(v > 32767 ? 32767 : (v < -32768 ? -32768 : v)); }
+
+// far beyond int16, but small enough that block energies of a run-away filter do not overflow
+const int64_t OUTPUT_LIMIT = 1 << 20;
+
+int32_t filter_output(int64_t acc) {
+  acc = (acc + ((int64_t)1 << (WEIGHT_BITS - 1))) >> WEIGHT_BITS;
+  return (int32_t)(acc > OUTPUT_LIMIT ? OUTPUT_LIMIT : (acc < -OUTPUT_LIMIT ? -OUTPUT_LIMIT : acc));
+}
+
+}  // namespace
+
+bool EchoCanceller::configure(uint32_t tail_ms, uint32_t delay_ms) {
+  if (tail_ms == 0 || tail_ms > MAX_TAIL_MS || delay_ms > MAX_DELAY_MS)
+    return false;
+  size_t taps = (tail_ms * (SAMPLE_RATE_HZ / 1000) + SEGMENT - 1) / SEGMENT * SEGMENT;
+  this->taps_ = 0;
+  this->foreground_.reset(new (std::nothrow) int32_t[taps]);
+  this->background_.reset(new (std::nothrow) int32_t[taps]);
+  this->history_len_ = taps + BLOCK;
+  this->history_.reset(new (std::nothrow) int16_t[this->history_len_]);
+  this->whitened_.reset(new (std::nothrow) int16_t[this->history_len_]);
+  this->delay_samples_ = delay_ms * (SAMPLE_RATE_HZ / 1000);
+  this->fifo_size_ = this->delay_samples_ + FIFO_SLACK;
+  this->fifo_.reset(new (std::nothrow) int16_t[this->fifo_size_]);
+  if (!this->foreground_ || !this->background_ || !this->history_ || !this->whitened_ || !this->fifo_)
+    return false;
+  this->taps_ = taps;
+  this->update_segments_ = taps / SEGMENT;
+  this->reset();
+  return true;
+}
+
+void EchoCanceller::reset() {
+  if (this->taps_ == 0)
+    return;
+  memset(this->foreground_.get(), 0, sizeof(int32_t) * this->taps_);
+  memset(this->background_.get(), 0, sizeof(int32_t) * this->taps_);
+  memset(this->history_.get(), 0, sizeof(int16_t) * this->history_len_);
+  memset(this->whitened_.get(), 0, sizeof(int16_t) * this->history_len_);
+  this->history_pos_ = this->taps_;
+  this->window_energy_ = 0;
+  this->whitened_energy_ = 0;
+  this->last_error_ = 0;
+  this->update_pos_ = 0;
+  this->fifo_read_ = 0;
+  this->fifo_fill_ = 0;
+  this->fifo_aligned_ = false;
+  this->leakage_ = 1.0f;
+  this->gain_ = 1.0f;
+  this->far_mic_power_ = 0.0f;
+  this->far_error_power_ = 0.0f;
+  this->gain_fast_ = this->gain_slow_ = this->var_fast_ = this->var_slow_ = 0.0f;
+  this->echo_avg_ = this->error_avg_ = 0.0f;
+  this->leak_cross_ = this->leak_echo_ = 0.0f;
+  this->adapted_blocks_ = 0;
+  this->step_q15_ = STEP_Q15;
+}
+
+void EchoCanceller::realign() {
+  if (this->fifo_aligned_)
+    this->realignments_++;
+  this->fifo_aligned_ = false;
+  this->fifo_fill_ = 0;
+}
+
+void EchoCanceller::set_update_segments(size_t segments) {
+  size_t all = this->get_segments();
+  this->update_segments_ = segments < 1 ? 1 : (segments > all ? all : segments);
+}
+
+size_t EchoCanceller::get_memory_size() const {
+  return this->taps_ * 2 * sizeof(int32_t) + (this->history_len_ * 2 + this->fifo_size_) * sizeof(int16_t);
+}
+
+void EchoCanceller::playback(const int16_t *pcm, size_t n) {
+  if (this->taps_ == 0)
+    return;
+  if (this->fifo_aligned_ && this->fifo_fill_ + n > this->fifo_size_) {
+    // the microphone has stalled: start over rather than drift away from the echo
+    this->realignments_++;
+    this->fifo_aligned_ = false;
+  }
+  if (!this->fifo_aligned_) {
+    // the reference waits delay_ms for its echo
+    memset(this->fifo_.get(), 0, sizeof(int16_t) * this->delay_samples_);
+    this->fifo_read_ = 0;
+    this->fifo_fill_ = this->delay_samples_;
+    this->fifo_aligned_ = true;
+  }
+  if (n > this->fifo_size_ - this->fifo_fill_) {
+    pcm += n - (this->fifo_size_ - this->fifo_fill_);
+    n = this->fifo_size_ - this->fifo_fill_;
+  }
+  size_t write = (this->fifo_read_ + this->fifo_fill_) % this->fifo_size_;
+  size_t first = n < this->fifo_size_ - write ? n : this->fifo_size_ - write;
+  memcpy(this->fifo_.get() + write, pcm, sizeof(int16_t) * first);
+  memcpy(this->fifo_.get(), pcm + first, sizeof(int16_t) * (n - first));
+  this->fifo_fill_ += n;
+}
+
+int16_t EchoCanceller::pop_reference_() {
+  if (this->fifo_fill_ == 0) {
+    // nothing played: silence, and the next playback is aligned afresh
+    if (this->fifo_aligned_) {
+      this->fifo_aligned_ = false;
+      this->realignments_++;
+    }
+    return 0;
+  }
+  int16_t x = this->fifo_[this->fifo_read_];
+  this->fifo_read_ = this->fifo_read_ + 1 == this->fifo_size_ ? 0 : this->fifo_read_ + 1;
+  this->fifo_fill_--;
+  return x;
+}
+
+void EchoCanceller::capture(int16_t *pcm, size_t n) {
+  if (this->taps_ == 0)
+    return;
+  while (n > 0) {
+    size_t step = n < BLOCK ? n : BLOCK;
+    this->process_block_(pcm, step);
+    pcm += step;
+    n -= step;
+  }
+}
+
+void EchoCanceller::process_block_(int16_t *pcm, size_t n) {
+  const size_t taps = this->taps_;
+  int32_t *fg = this->foreground_.get();
+  int32_t *bg = this->background_.get();
+  const size_t segments = taps / SEGMENT;
+  int64_t mic_energy = 0, fg_energy = 0, bg_energy = 0, echo_energy = 0, diff_energy = 0;
+  bool far_active = false;
+  for (size_t i = 0; i < n; i++) {
+    if (this->history_pos_ == this->history_len_) {
+      memmove(this->history_.get(), this->history_.get() + this->history_len_ - taps, sizeof(int16_t) * taps);
+      memmove(this->whitened_.get(), this->whitened_.get() + this->history_len_ - taps, sizeof(int16_t) * taps);
+      this->history_pos_ = taps;
+    }
+    int16_t x = this->pop_reference_();
+    int16_t *h = this->history_.get() + this->history_pos_;
+    this->window_energy_ += (int32_t)x * x - (int32_t)h[-(int)taps] * h[-(int)taps];
+    // halved so that it fits; the NLMS step does not depend on the scale
+    int16_t *w = this->whitened_.get() + this->history_pos_;
+    int16_t xw = (int16_t)(((int32_t)x * 32768 - (int32_t)h[-1] * PREEMPHASIS_Q15) >> 16);
+    this->whitened_energy_ += (int32_t)xw * xw - (int32_t)w[-(int)taps] * w[-(int)taps];
+    *h = x;
+    *w = xw;
+    this->history_pos_++;
+    const int16_t *window = h + 1 - taps;
+    const int16_t *whitened = w + 1 - taps;
+
+    int64_t acc_fg = 0, acc_bg = 0;
+    for (size_t k = 0; k < taps; k++) {
+      acc_fg += (int64_t)fg[k] * window[k];
+      acc_bg += (int64_t)bg[k] * window[k];
+    }
+    int32_t d = pcm[i];
+    int32_t echo = filter_output(acc_fg);
+    int64_t e_fg = (int64_t)d - echo;
+    int64_t e_bg = (int64_t)d - filter_output(acc_bg);
+    pcm[i] = saturate((int32_t)e_fg);
+    mic_energy += (int64_t)d * d;
+    fg_energy += e_fg * e_fg;
+    bg_energy += e_bg * e_bg;
+    echo_energy += (int64_t)echo * echo;
+    diff_energy += (e_fg - e_bg) * (e_fg - e_bg);
+
+    int32_t error = (int32_t)(e_bg > 65535 ? 65535 : (e_bg < -65535 ? -65535 : e_bg));
+    int64_t e = ((int64_t)error * 32768 - (int64_t)this->last_error_ * PREEMPHASIS_Q15) >> 16;
+    this->last_error_ = error;
+    if (this->window_energy_ <= (int64_t)taps * FAR_MIN_POWER)
+      continue;
+    far_active = true;
+    // NLMS on the whitened signals: w += mu e x / |x|^2, as s = mu e 2^40 / |x|^2 and
+    // w += s x / 2^16 in Q24
+    int64_t norm = this->whitened_energy_ + (int64_t)taps * REGULARIZATION;
+    int64_t s = ((int64_t)this->step_q15_ * e * ((int64_t)1 << 25)) / norm;
+    for (size_t u = 0; u < this->update_segments_; u++) {
+      size_t base = this->update_pos_ * SEGMENT;
+      for (size_t k = base; k < base + SEGMENT; k++)
+        bg[k] += (int32_t)((s * whitened[k]) >> 16);
+      this->update_pos_ = this->update_pos_ + 1 == segments ? 0 : this->update_pos_ + 1;
+    }
+  }
+
+  this->compare_filters_(fg_energy, bg_energy, diff_energy);
+
+  float echo = (float)echo_energy / n, error = (float)fg_energy / n;
+  if (far_active) {
+    this->far_mic_power_ += ((float)mic_energy / n - this->far_mic_power_) * 0.05f;
+    this->far_error_power_ += (error - this->far_error_power_) * 0.05f;
+    if (this->adapted_blocks_ < ADAPTED_BLOCKS)
+      this->adapted_blocks_++;
+    if (echo > ECHO_MIN_POWER)
+      this->estimate_leakage_(echo, error);
+  }
+  this->suppress_(pcm, n, echo, error, far_active);
+}
+
+void EchoCanceller::estimate_leakage_(float echo, float error) {
+  // As in Speex: the leakage is how much of the echo estimate's power variations show up in the
+  // error's, so near-end speech, which varies on its own, hardly moves it. The estimate learns
+  // slower the more the error exceeds the echo.
+  float echo_dev = echo - this->echo_avg_, error_dev = error - this->error_avg_;
+  this->echo_avg_ += (echo - this->echo_avg_) * 0.5f;
+  this->error_avg_ += (error - this->error_avg_) * 0.5f;
+  float rate = LEAK_RATE * echo < LEAK_RATE_MAX * error ? LEAK_RATE * echo / error : LEAK_RATE_MAX;
+  this->leak_cross_ += (echo_dev * error_dev - this->leak_cross_) * rate;
+  this->leak_echo_ += (echo_dev * echo_dev - this->leak_echo_) * rate;
+  if (this->leak_echo_ < 1.0f)
+    this->leak_echo_ = 1.0f;
+  float leakage = this->leak_cross_ / this->leak_echo_;
+  leakage = leakage < MIN_LEAKAGE ? MIN_LEAKAGE : (leakage > 1.0f ? 1.0f : leakage);
+  // one block where the far and the near end start talking together must not undo the estimate
+  this->leakage_ = leakage < this->leakage_ * LEAK_RISE ? leakage : this->leakage_ * LEAK_RISE;
+
+  // The step follows the share of residual echo in the error: large while the path is being
+  // learned or changed, and near zero while the near end talks, which is what keeps the
+  // background from learning its speech.
+  if (this->adapted_blocks_ < ADAPTED_BLOCKS)
+    return;
+  float ratio = OVERSUBTRACTION * this->leakage_ * echo / error;
+  ratio = ratio > 1.0f ? 1.0f : ratio;
+  this->step_q15_ = (int32_t)(ratio * STEP_Q15);
+}
+
+void EchoCanceller::compare_filters_(int64_t fg_energy, int64_t bg_energy, int64_t diff_energy) {
+  // The two-path test of Speex: the background must beat the foreground by more than the two
+  // filters' outputs differ, on this block or on average over the last few. While the near end
+  // talks the background fits some of its speech and cancels "better", but only by drifting far
+  // from the foreground, so it does not take over; once it ran off it is put back.
+  // the floor of the difference keeps two silent filters from swapping on rounding
+  float fg = (float)fg_energy, diff = (float)diff_energy + 1000.0f;
+  float gain = fg - (float)bg_energy;
+  this->gain_fast_ = 0.6f * this->gain_fast_ + 0.4f * gain;
+  this->gain_slow_ = 0.85f * this->gain_slow_ + 0.15f * gain;
+  this->var_fast_ = 0.36f * this->var_fast_ + 0.16f * fg * diff;
+  this->var_slow_ = 0.7225f * this->var_slow_ + 0.0225f * fg * diff;
+  bool take_over = gain * fabsf(gain) > fg * diff ||
+                   this->gain_fast_ * fabsf(this->gain_fast_) > 0.5f * this->var_fast_ ||
+                   this->gain_slow_ * fabsf(this->gain_slow_) > 0.25f * this->var_slow_;
+  bool put_back = -gain * fabsf(gain) > 4.0f * fg * diff ||
+                  -this->gain_fast_ * fabsf(this->gain_fast_) > 4.0f * this->var_fast_ ||
+                  -this->gain_slow_ * fabsf(this->gain_slow_) > 4.0f * this->var_slow_;
+  if (!take_over && !put_back)
+    return;
+  if (take_over) {
+    memcpy(this->foreground_.get(), this->background_.get(), sizeof(int32_t) * this->taps_);
+    this->foreground_updates_++;
+  } else {
+    memcpy(this->background_.get(), this->foreground_.get(), sizeof(int32_t) * this->taps_);
+    this->background_resets_++;
+  }
+  this->gain_fast_ = this->gain_slow_ = this->var_fast_ = this->var_slow_ = 0.0f;
+}
+
+void EchoCanceller::suppress_(int16_t *pcm, size_t n, float echo, float error, bool far_active) {
+  float target = 1.0f;
+  if (far_active && echo > ECHO_MIN_POWER) {
+    if (this->suppressor_ && error > 0.0f) {
+      float power = 1.0f - OVERSUBTRACTION * this->leakage_ * echo / error;
+      const float floor = powf(10.0f, SUPPRESSION_FLOOR_DB / 10.0f);
+      target = sqrtf(power < floor ? floor : power);
+    }
+  }
+  float from = this->gain_;
+  // down at once, up within a few blocks so that a word after the echo is not clipped
+  this->gain_ = target < this->gain_ ? target : this->gain_ + (target - this->gain_) * 0.5f;
+  if (from >= 0.9999f && this->gain_ >= 0.9999f)
+    return;
+  // ramp over the block, Q15
+  int32_t g0 = (int32_t)(from * 32768.0f), g1 = (int32_t)(this->gain_ * 32768.0f);
+  const int32_t len = (int32_t)n;
+  for (int32_t i = 0; i < len; i++) {
+    int32_t g = g0 + (g1 - g0) * (i + 1) / len;
+    pcm[i] = saturate((pcm[i] * g) >> 15);
+  }
+}
+
+float EchoCanceller::get_erle_db() const {
+  if (this->far_error_power_ <= 0.0f || this->far_mic_power_ <= 0.0f)
+    return 0.0f;
+  return 10.0f * log10f(this->far_mic_power_ / this->far_error_power_);
+}
+
+float EchoCanceller::get_suppression_db() const { return 20.0f * log10f(this->gain_ > 1e-6f ? this->gain_ : 1e-6f); }
+
+uint32_t EchoCanceller::get_echo_delay_ms() const {
+  if (this->taps_ == 0)
+    return 0;
+  size_t best = 0;
+  int32_t peak = 0;
+  for (size_t k = 0; k < this->taps_; k++) {
+    int32_t a = this->foreground_[k] < 0 ? -this->foreground_[k] : this->foreground_[k];
+    if (a > peak) {
+      peak = a;
+      best = k;
+    }
+  }
+  // the last tap of the window is the newest reference sample
+  return (uint32_t)((this->taps_ - 1 - best + this->delay_samples_) * 1000 / SAMPLE_RATE_HZ);
+}
+
+}  // namespace voip
+}  // namespace esphome
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace esphome {
+namespace voip {
+
+// Acoustic echo canceller for a speakerphone at 8 kHz: removes from the microphone what the speaker
+// played of the far end, so callers do not hear themselves.
+//
+// The speaker's audio goes in through playback() as it is handed to the speaker, the microphone's
+// through capture() in the same media context. A FIFO holds the reference for delay_ms (the I2S
+// playout and capture latency) before it meets the microphone; the adaptive filter covers the
+// echo path from there on, tail_ms long. Both run in 10 ms blocks of any frame length.
+//
+// The linear stage is a fixed-point NLMS filter (int32 Q24 weights, int64 accumulation) in two
+// copies, after the two-path scheme of Speex. The background filter adapts on every sample, on a
+// pre-emphasised reference so that speech converges evenly across its spectrum; the foreground
+// filter produces the output and takes over the background's weights only when they cancel better
+// by more than the two differ, and hands its own back when the background ran off. The step size
+// follows the estimated share of residual echo in the error, which falls to nearly nothing while
+// the near end talks (double talk), so no separate double-talk detector is needed. The background
+// adapts update_segments of its 16-tap segments per sample in turn, which bounds the CPU time;
+// filtering always covers the whole tail.
+//
+// The residual echo suppressor then attenuates what the linear stage leaves: per block, the
+// residual is estimated from the echo estimate and the filter's leakage (how much the echo
+// estimate's power variations show in the error) and the block is scaled down accordingly, to at
+// most SUPPRESSION_FLOOR_DB. Near-end speech stands out of the residual and passes.
+class EchoCanceller {
+ public:
+  static const size_t BLOCK = 80;  // 10 ms
+  static const size_t SEGMENT = 16;
+  static const uint32_t MAX_TAIL_MS = 256;
+  static const uint32_t MAX_DELAY_MS = 500;
+  static const int SUPPRESSION_FLOOR_DB = -30;
+
+  // Allocates the filters and the reference FIFO; false if there is not enough memory or the
+  // lengths are out of range. Adapts the whole filter per sample until set_update_segments().
+  bool configure(uint32_t tail_ms, uint32_t delay_ms);
+  // Forgets the echo path and the reference
+  void reset();
+  // Starts the reference over at delay_ms and keeps the echo path, for when the microphone's
+  // backlog was dropped and the two no longer line up
+  void realign();
+  void set_suppressor(bool enabled) { this->suppressor_ = enabled; }
+  // segments of the background filter adapted per sample, 1..get_segments()
+  void set_update_segments(size_t segments);
+  size_t get_update_segments() const { return this->update_segments_; }
+  size_t get_segments() const { return this->taps_ / SEGMENT; }
+  size_t get_memory_size() const;
+
+  // The far end's audio as it goes to the speaker
+  void playback(const int16_t *pcm, size_t n);
+  // The microphone's audio, echo removed in place
+  void capture(int16_t *pcm, size_t n);
+
+  // linear echo return loss enhancement while the far end talks, dB
+  float get_erle_db() const;
+  // attenuation of the suppressor on the last block, dB
+  float get_suppression_db() const;
+  // strongest tap of the echo path: the delay from speaker to microphone, reference FIFO included
+  uint32_t get_echo_delay_ms() const;
+  // times the foreground took the background's weights, and the other way round
+  uint32_t get_foreground_updates() const { return this->foreground_updates_; }
+  uint32_t get_background_resets() const { return this->background_resets_; }
+  // times the reference FIFO ran empty or over and was re-aligned to delay_ms
+  uint32_t get_realignments() const { return this->realignments_; }
+
+ protected:
+  void process_block_(int16_t *pcm, size_t n);
+  void compare_filters_(int64_t fg_energy, int64_t bg_energy, int64_t diff_energy);
+  void estimate_leakage_(float echo, float error);
+  void suppress_(int16_t *pcm, size_t n, float echo, float error, bool far_active);
+  int16_t pop_reference_();
+
+  size_t taps_ = 0;
+  std::unique_ptr<int32_t[]> foreground_;
+  std::unique_ptr<int32_t[]> background_;
+  // reference history: the filter window slides over it, oldest first; shifted once per block
+  std::unique_ptr<int16_t[]> history_;
+  size_t history_len_ = 0;
+  size_t history_pos_ = 0;
+  // the same through the pre-emphasis, for the adaptation
+  std::unique_ptr<int16_t[]> whitened_;
+  // energy of the reference under the window, plain and whitened
+  int64_t window_energy_ = 0;
+  int64_t whitened_energy_ = 0;
+  int32_t last_error_ = 0;
+  size_t update_segments_ = 0;
+  size_t update_pos_ = 0;
+
+  // reference FIFO
+  std::unique_ptr<int16_t[]> fifo_;
+  size_t fifo_size_ = 0;
+  size_t fifo_read_ = 0;
+  size_t fifo_fill_ = 0;
+  size_t delay_samples_ = 0;
+  bool fifo_aligned_ = false;
+
+  // what the background gains over the foreground and its spread, smoothed over 2 and 6 blocks
+  float gain_fast_ = 0.0f;
+  float gain_slow_ = 0.0f;
+  float var_fast_ = 0.0f;
+  float var_slow_ = 0.0f;
+
+  bool suppressor_ = true;
+  // NLMS step of the background, Q15
+  int32_t step_q15_ = 0;
+  uint32_t adapted_blocks_ = 0;
+  // power ratio of residual to echo estimate, from the covariance of their power around a short
+  // average; and the suppressor's gain
+  float echo_avg_ = 0.0f;
+  float error_avg_ = 0.0f;
+  float leak_cross_ = 0.0f;
+  float leak_echo_ = 0.0f;
+  float leakage_ = 1.0f;
+  float gain_ = 1.0f;
+  // smoothed microphone and error power while the far end talks
+  float far_mic_power_ = 0.0f;
+  float far_error_power_ = 0.0f;
+
+  uint32_t foreground_updates_ = 0;
+  uint32_t background_resets_ = 0;
+  uint32_t realignments_ = 0;
+};
+
+}  // namespace voip
+}  // namespace esphome
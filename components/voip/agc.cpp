@@ -0,0 +1,144 @@
+#include "agc.h"
+#include <cmath>
+
+namespace esphome {
+namespace voip {
+
+namespace {
+
+const float SUBBLOCK_MS = 2.0f;
+// the peak meter falls by 20 dB in 1.7 s, like an IEC 60268-10 type I programme meter
+const int32_t METER_DECAY_Q15 = 32679;
+const float MAX_FIXED_GAIN = 32.0f;
+
+int32_t amplitude(float dbfs) {
+  float v = 32768.0f * std::pow(10.0f, dbfs / 20.0f);
+  return v >= 32767.0f ? 32767 : (v < 1.0f ? 1 : (int32_t)std::lrint(v));
+}
+
+int32_t gain_q15(float db) { return (int32_t)std::lrint(32768.0f * std::pow(10.0f, db / 20.0f)); }
+
+// share of the way an envelope moves per subblock to settle within ms
+int32_t coefficient_q15(uint32_t ms) {
+  if (ms == 0)
+    return 32767;
+  int32_t c = (int32_t)std::lrint(32768.0f * (1.0f - std::exp(-SUBBLOCK_MS / ms)));
+  return c < 1 ? 1 : (c > 32767 ? 32767 : c);
+}
+
+float q15_db(int32_t v) { return v > 0 ? 20.0f * std::log10(v / 32768.0f) : -96.0f; }
+
+}  // namespace
+
+void GainControl::set_fixed_gain(float gain) {
+  if (gain < 0.0f)
+    gain = 0.0f;
+  if (gain > MAX_FIXED_GAIN)
+    gain = MAX_FIXED_GAIN;
+  this->fixed_q15_ = (int32_t)std::lrint(gain * 32768.0f);
+}
+
+void GainControl::set_agc(float target_dbfs, float max_gain_db, float gate_dbfs) {
+  this->agc_ = true;
+  this->target_ = amplitude(target_dbfs);
+  this->max_gain_q15_ = gain_q15(max_gain_db);
+  this->min_gain_q15_ = gain_q15((float)MIN_GAIN_DB);
+  this->gate_ = amplitude(gate_dbfs);
+  this->reset();
+}
+
+void GainControl::set_limiter(float limit_dbfs) { this->limit_ = amplitude(limit_dbfs); }
+
+void GainControl::set_envelope(uint32_t attack_ms, uint32_t release_ms) {
+  this->attack_q15_ = coefficient_q15(attack_ms);
+  this->release_q15_ = coefficient_q15(release_ms);
+}
+
+void GainControl::reset() {
+  // an envelope at the target starts the AGC at unity gain
+  this->envelope_ = this->target_ << 8;
+  this->agc_q15_ = 32768;
+  this->limiter_q15_ = 32768;
+  this->applied_q15_ = this->fixed_q15_;
+  this->meter_ = 0;
+}
+
+void GainControl::process(int16_t *pcm, size_t n) {
+  while (n > 0) {
+    size_t m = n < SUBBLOCK ? n : SUBBLOCK;
+    this->process_subblock_(pcm, m);
+    pcm += m;
+    n -= m;
+  }
+}
+
+void GainControl::process_subblock_(int16_t *pcm, size_t n) {
+  int32_t peak = 0;
+  for (size_t i = 0; i < n; i++) {
+    int32_t a = pcm[i] < 0 ? -(int32_t)pcm[i] : pcm[i];
+    peak = a > peak ? a : peak;
+  }
+
+  // the level the AGC and the gate see is after the fixed gain
+  int32_t level = (int32_t)(((int64_t)peak * this->fixed_q15_) >> 15);
+  if (this->agc_ && level > this->gate_) {
+    int32_t target = level << 8;
+    int32_t c = target > this->envelope_ ? this->attack_q15_ : this->release_q15_;
+    this->envelope_ += (int32_t)(((int64_t)(target - this->envelope_) * c) >> 15);
+    if (this->envelope_ < 256)
+      this->envelope_ = 256;
+    int64_t gain = ((int64_t)this->target_ << 23) / this->envelope_;
+    if (gain > this->max_gain_q15_)
+      gain = this->max_gain_q15_;
+    if (gain < this->min_gain_q15_)
+      gain = this->min_gain_q15_;
+    this->agc_q15_ = (int32_t)gain;
+  }
+
+  int32_t pre = (int32_t)(((int64_t)this->fixed_q15_ * this->agc_q15_) >> 15);
+  // the highest gain that keeps this subblock under the limit; the ramp is held below it
+  int32_t cap = INT32_MAX;
+  if (this->limit_ != 0) {
+    int32_t limiter = 32768;
+    int64_t out_peak = ((int64_t)peak * pre) >> 15;
+    if (out_peak > this->limit_)
+      limiter = (int32_t)(((int64_t)this->limit_ << 15) / out_peak);
+    if (limiter < this->limiter_q15_) {
+      this->limiter_q15_ = limiter;
+    } else {
+      // rounded up, so that the release reaches unity
+      this->limiter_q15_ += (int32_t)(((int64_t)(limiter - this->limiter_q15_) * this->release_q15_ + 32767) >> 15);
+    }
+    if (peak != 0)
+      cap = (int32_t)(((int64_t)this->limit_ << 15) / peak);
+  }
+  int32_t total = (int32_t)(((int64_t)pre * this->limiter_q15_) >> 15);
+
+  int32_t step = (total - this->applied_q15_) / (int32_t)n;
+  int32_t g = this->applied_q15_;
+  int32_t out_peak = 0;
+  for (size_t i = 0; i < n; i++) {
+    g += step;
+    int32_t gi = g < cap ? g : cap;
+    int32_t v = (int32_t)(((int64_t)pcm[i] * gi) >> 15);
+    v = v > 32767 ? 32767 : (v < -32768 ? -32768 : v);
+    pcm[i] = (int16_t)v;
+    int32_t a = v < 0 ? -v : v;
+    out_peak = a > out_peak ? a : out_peak;
+  }
+  this->applied_q15_ = total;
+
+  int32_t decayed = (int32_t)(((int64_t)this->meter_ * METER_DECAY_Q15) >> 15);
+  this->meter_ = out_peak > decayed ? out_peak : decayed;
+}
+
+float GainControl::get_gain_db() const { return q15_db(this->applied_q15_); }
+
+float GainControl::get_peak_dbfs() const { return q15_db(this->meter_); }
+
+float GainControl::get_agc_gain_db() const { return q15_db(this->agc_q15_); }
+
+float GainControl::get_limiter_gain_db() const { return q15_db(this->limiter_q15_); }
+
+}  // namespace voip
+}  // namespace esphome
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace voip {
+
+// Gain stage for 8 kHz audio in Q15: a fixed gain, an optional automatic gain control and a peak
+// limiter, in that order. The microphone uses all three, the speaker a fixed gain (amp_gain) and
+// the limiter.
+//
+// The signal is looked at in SUBBLOCKs of 2 ms. The AGC follows the peak level of each subblock
+// with an envelope that rises within attack_ms and falls within release_ms, and sets the gain that
+// brings the envelope to the target level, between MIN_GAIN_DB and max_gain_db. Subblocks below
+// the noise gate leave envelope and gain alone, so pauses and background noise are not turned up
+// to the target. The limiter keeps every sample below the limit: its gain drops at once to what
+// the subblock's peak allows and comes back with release_ms. The gain moves in a linear ramp over
+// each subblock, so it does not click.
+//
+// Frames of any length are taken; a frame that does not end on a subblock boundary ends with a
+// shorter subblock. All per-sample work is integer.
+class GainControl {
+ public:
+  static const size_t SUBBLOCK = 16;  // 2 ms
+  static const int MIN_GAIN_DB = -20;
+
+  // linear gain in front of everything else, 0..32
+  void set_fixed_gain(float gain);
+  // target_dbfs: level of the peak envelope; below gate_dbfs (before the AGC's gain) the gain holds
+  void set_agc(float target_dbfs, float max_gain_db, float gate_dbfs);
+  // peaks above limit_dbfs are turned down instead of clipped
+  void set_limiter(float limit_dbfs);
+  void set_envelope(uint32_t attack_ms, uint32_t release_ms);
+  // back to unity AGC and limiter gain, the settings stay
+  void reset();
+
+  void process(int16_t *pcm, size_t n);
+
+  // gain of the last sample, fixed gain included, dB
+  float get_gain_db() const;
+  // peak level of the output with a meter's decay (20 dB in 1.7 s), dBFS
+  float get_peak_dbfs() const;
+  // gain of the AGC alone and of the limiter alone, dB
+  float get_agc_gain_db() const;
+  float get_limiter_gain_db() const;
+
+ protected:
+  void process_subblock_(int16_t *pcm, size_t n);
+
+  // Q15 gains: 32768 is unity
+  int32_t fixed_q15_ = 32768;
+  bool agc_ = false;
+  int32_t target_ = 0;
+  int32_t max_gain_q15_ = 32768;
+  int32_t min_gain_q15_ = 32768;
+  int32_t gate_ = 0;
+  // 0: no limiter
+  int32_t limit_ = 0;
+  // envelope coefficients per subblock, Q15; 10 and 500 ms until set_envelope()
+  int32_t attack_q15_ = 5941;
+  int32_t release_q15_ = 131;
+
+  // peak envelope, Q8 sample units
+  int32_t envelope_ = 0;
+  int32_t agc_q15_ = 32768;
+  int32_t limiter_q15_ = 32768;
+  // the gain the last ramp ended on
+  int32_t applied_q15_ = 32768;
+  int32_t meter_ = 0;
+};
+
+}  // namespace voip
+}  // namespace esphome
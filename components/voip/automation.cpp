@@ -24,5 +24,13 @@ NotReadyTrigger::NotReadyTrigger(Voip *parent) {
   if (parent) parent->add_on_not_ready_callback([this]() { this->trigger(); });
 }
 
+IncomingCallTrigger::IncomingCallTrigger(Voip *parent) {
+  if (parent) parent->add_on_incoming_call_callback([this](const std::string &caller) { this->trigger(caller); });
+}
+
+CallMissedTrigger::CallMissedTrigger(Voip *parent) {
+  if (parent) parent->add_on_call_missed_callback([this](const std::string &caller) { this->trigger(caller); });
+}
+
 }  // namespace voip
 }  // namespace esphome
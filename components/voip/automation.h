@@ -34,5 +34,17 @@ class NotReadyTrigger : public Trigger<> {
   explicit NotReadyTrigger(Voip *parent);
 };
 
+// fires with the caller's user part (or URI) when an incoming call starts ringing
+class IncomingCallTrigger : public Trigger<std::string> {
+ public:
+  explicit IncomingCallTrigger(Voip *parent);
+};
+
+// fires with the caller when an incoming call is cancelled before it was answered
+class CallMissedTrigger : public Trigger<std::string> {
+ public:
+  explicit CallMissedTrigger(Voip *parent);
+};
+
 }  // namespace voip
 }  // namespace esphome
@@ -0,0 +1,54 @@
+#include "comfort_noise.h"
+#include <cmath>
+
+namespace esphome {
+namespace voip {
+
+namespace {
+
+// rms of the sum of two uniform 15-bit values around zero: 32768 / sqrt(6)
+const float NOISE_RMS = 13377.0f;
+// the noise peaks at sqrt(6) times its rms; louder would clip (and is no comfort noise anyway)
+const uint8_t LOUDEST_LEVEL = 8;
+
+}  // namespace
+
+size_t write_cn_payload(uint8_t *buf, uint8_t level) {
+  buf[0] = level > 127 ? 127 : level;
+  return 1;
+}
+
+bool parse_cn_payload(const uint8_t *payload, size_t len, uint8_t *level) {
+  if (len == 0 || (payload[0] & 0x80) != 0)
+    return false;
+  *level = payload[0];
+  return true;
+}
+
+void ComfortNoiseGenerator::set_level(uint8_t level) {
+  this->level_ = level > 127 ? 127 : level;
+  // 0 dBov is the rms of a full-scale square wave, 32768
+  float loudness = (float)(this->level_ < LOUDEST_LEVEL ? LOUDEST_LEVEL : this->level_);
+  float rms = 32768.0f * powf(10.0f, -loudness / 20.0f);
+  this->target_gain_ = (int32_t)(rms / NOISE_RMS * 32768.0f + 0.5f);
+}
+
+void ComfortNoiseGenerator::generate(int16_t *pcm, size_t n) {
+  // halfway to a new level per frame, rounded away from zero so that it gets there
+  int32_t d = this->target_gain_ - this->gain_;
+  this->gain_ += (d + (d > 0) - (d < 0)) / 2;
+  const int32_t gain = this->gain_;
+  uint32_t r = this->random_;
+  for (size_t i = 0; i < n; i++) {
+    r ^= r << 13;
+    r ^= r >> 17;
+    r ^= r << 5;
+    int32_t noise = (int32_t)(r & 0x7FFF) + (int32_t)((r >> 16) & 0x7FFF) - 32767;
+    int32_t v = (noise * gain) >> 15;
+    pcm[i] = (int16_t)(v > 32767 ? 32767 : (v < -32768 ? -32768 : v));
+  }
+  this->random_ = r;
+}
+
+}  // namespace voip
+}  // namespace esphome
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace voip {
+
+// static payload type of comfort noise at 8 kHz (RFC 3551)
+static const uint8_t CN_PAYLOAD_TYPE = 13;
+
+// Writes an RFC 3389 comfort noise payload with the noise level only (no spectral information):
+// one byte, minus dBov 0..127. Returns its length.
+size_t write_cn_payload(uint8_t *buf, uint8_t level);
+// Reads the level of a comfort noise payload; any spectral coefficients after it are ignored.
+// False for an empty payload or the reserved bit set.
+bool parse_cn_payload(const uint8_t *payload, size_t len, uint8_t *level);
+
+// Plays comfort noise at the level of the far end's last SID: white noise with a roughly Gaussian
+// distribution, the level gliding to a new value over a few frames so that an update is not heard.
+class ComfortNoiseGenerator {
+ public:
+  // level as in the SID payload, minus dBov
+  void set_level(uint8_t level);
+  uint8_t get_level() const { return this->level_; }
+  void generate(int16_t *pcm, size_t n);
+
+ protected:
+  uint8_t level_ = 127;
+  // rms of the target and of the output in Q15 units of the noise source's rms
+  int32_t target_gain_ = 0;
+  int32_t gain_ = 0;
+  uint32_t random_ = 0x2545F491;
+};
+
+}  // namespace voip
+}  // namespace esphome
@@ -25,72 +25,35 @@
  */
 
 /*
- * g711.c
+ * g711.cpp
  *
- * u-law, A-law and linear PCM conversions.
+ * u-law, A-law and linear PCM conversions, table driven. The tables are built at compile time by
+ * constexpr ports of the reference routines below.
  */
-#define SIGN_BIT (0x80)		/* Sign bit for a A-law byte. */
-#define QUANT_MASK (0xf)		/* Quantization field mask. */
-#define NSEGS (8)		/* Number of A-law segments. */
-#define SEG_SHIFT (4)		/* Left shift for segment number. */
-#define SEG_MASK (0x70)		/* Segment field mask. */
-
-static short seg_end[8] = {0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF, 0x1FFF, 0x3FFF, 0x7FFF};
-
-/* copy from CCITT G.711 specifications */
-unsigned char _u2a[128] = {			/* u- to A-law conversions */
-	1,	1,	2,	2,	3,	3,	4,	4,
-	5,	5,	6,	6,	7,	7,	8,	8,
-	9,	10,	11,	12,	13,	14,	15,	16,
-	17,	18,	19,	20,	21,	22,	23,	24,
-	25,	27,	29,	31,	33,	34,	35,	36,
-	37,	38,	39,	40,	41,	42,	43,	44,
-	46,	48,	49,	50,	51,	52,	53,	54,
-	55,	56,	57,	58,	59,	60,	61,	62,
-	64,	65,	66,	67,	68,	69,	70,	71,
-	72,	73,	74,	75,	76,	77,	78,	79,
-	81,	82,	83,	84,	85,	86,	87,	88,
-	89,	90,	91,	92,	93,	94,	95,	96,
-	97,	98,	99,	100,	101,	102,	103,	104,
-	105,	106,	107,	108,	109,	110,	111,	112,
-	113,	114,	115,	116,	117,	118,	119,	120,
-	121,	122,	123,	124,	125,	126,	127,	128
-};
-
-unsigned char _a2u[128] = {			/* A- to u-law conversions */
-	1,	3,	5,	7,	9,	11,	13,	15,
-	16,	17,	18,	19,	20,	21,	22,	23,
-	24,	25,	26,	27,	28,	29,	30,	31,
-	32,	32,	33,	33,	34,	34,	35,	35,
-	36,	37,	38,	39,	40,	41,	42,	43,
-	44,	45,	46,	47,	48,	48,	49,	49,
-	50,	51,	52,	53,	54,	55,	56,	57,
-	58,	59,	60,	61,	62,	63,	64,	64,
-	65,	66,	67,	68,	69,	70,	71,	72,
-	73,	74,	75,	76,	77,	78,	79,	79,
-	80,	81,	82,	83,	84,	85,	86,	87,
-	88,	89,	90,	91,	92,	93,	94,	95,
-	96,	97,	98,	99,	100,	101,	102,	103,
-	104,	105,	106,	107,	108,	109,	110,	111,
-	112,	113,	114,	115,	116,	117,	118,	119,
-	120,	121,	122,	123,	124,	125,	126,	127
-};
-
-static int search(int val, short *table, int size)
-{
-	int	i;
-
-	for (i = 0; i < size; i++) {
-		if (val <= *table++)
-			return (i);
-	}
-	return (size);
+#include "g711.h"
+
+namespace esphome {
+namespace voip {
+namespace g711 {
+
+namespace {
+
+constexpr int QUANT_MASK = 0xf;  // Quantization field mask.
+constexpr int SEG_SHIFT = 4;     // Left shift for segment number.
+constexpr int SEG_MASK = 0x70;   // Segment field mask.
+constexpr int BIAS = 0x84;       // Bias for linear code.
+
+constexpr int segment(int val) {
+  constexpr short seg_end[8] = {0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF, 0x1FFF, 0x3FFF, 0x7FFF};
+  for (int i = 0; i < 8; i++) {
+    if (val <= seg_end[i])
+      return i;
+  }
+  return 8;
 }
 
 /*
- * linear2alaw() - Convert a 16-bit linear PCM value to 8-bit A-law
- *
- * linear2alaw() accepts an 16-bit integer and encodes it as A-law data.
+ * ref_linear2alaw() - Convert a 16-bit linear PCM value to 8-bit A-law
  *
  *		Linear Input Code	Compressed Code
  *	------------------------	---------------
@@ -106,71 +69,46 @@ static int search(int val, short *table, int size)
  * For further information see John C. Bellamy's Digital Telephony, 1982,
  * John Wiley & Sons, pps 98-111 and 472-476.
  */
-unsigned char linear2alaw(int pcm_val)	/* 2's complement (16-bit range) */
-{
-	int		mask;
-	int		seg;
-	unsigned char	aval;
-
-	if (pcm_val >= 0) {
-		mask = 0xD5;		/* sign (7th) bit = 1 */
-	} else {
-		mask = 0x55;		/* sign bit = 0 */
-		pcm_val = -pcm_val - 8;
-	}
-
-	/* Convert the scaled magnitude to segment number. */
-	seg = search(pcm_val, seg_end, 8);
-
-	/* Combine the sign, segment, and quantization bits. */
-
-	if (seg >= 8)		/* out of range, return maximum value. */
-		return (0x7F ^ mask);
-	else {
-		aval = seg << SEG_SHIFT;
-		if (seg < 2)
-			aval |= (pcm_val >> 4) & QUANT_MASK;
-		else
-			aval |= (pcm_val >> (seg + 3)) & QUANT_MASK;
-		return (aval ^ mask);
-	}
+constexpr uint8_t ref_linear2alaw(int pcm_val) {
+  int mask = 0xD5;
+  if (pcm_val < 0) {
+    mask = 0x55;
+    pcm_val = -pcm_val - 8;
+  }
+  int seg = segment(pcm_val);
+  if (seg >= 8)
+    return (uint8_t)(0x7F ^ mask);
+  int aval = seg << SEG_SHIFT;
+  if (seg < 2)
+    aval |= (pcm_val >> 4) & QUANT_MASK;
+  else
+    aval |= (pcm_val >> (seg + 3)) & QUANT_MASK;
+  return (uint8_t)(aval ^ mask);
 }
 
-/*
- * alaw2linear() - Convert an A-law value to 16-bit linear PCM
- *
- */
-int alaw2linear(unsigned char a_val)
-{
-	int t;
-	int seg;
-
-	a_val ^= 0x55;
-
-	t = (a_val & QUANT_MASK) << 4;
-	seg = ((unsigned)a_val & SEG_MASK) >> SEG_SHIFT;
-	switch (seg) {
-	case 0:
-		t += 8;
-		break;
-	case 1:
-		t += 0x108;
-		break;
-	default:
-		t += 0x108;
-		t <<= seg - 1;
-	}
-	return ((a_val & SIGN_BIT) ? t : -t);
+constexpr int ref_alaw2linear(uint8_t a_val) {
+  a_val ^= 0x55;
+  int t = (a_val & QUANT_MASK) << 4;
+  int seg = ((unsigned)a_val & SEG_MASK) >> SEG_SHIFT;
+  switch (seg) {
+    case 0:
+      t += 8;
+      break;
+    case 1:
+      t += 0x108;
+      break;
+    default:
+      t += 0x108;
+      t <<= seg - 1;
+  }
+  return (a_val & 0x80) ? t : -t;
 }
 
-#define	BIAS		(0x84)		/* Bias for linear code. */
-
 /*
- * linear2ulaw() - Convert a linear PCM value to u-law
+ * ref_linear2ulaw() - Convert a linear PCM value to u-law
  *
- * In order to simplify the encoding process, the original linear magnitude
- * is biased by adding 33 which shifts the encoding range from (0 - 8158) to
- * (33 - 8191). The result can be seen in the following encoding table:
+ * The magnitude is biased by 33 (0x84 in this 16-bit scaling) so each biased code has a leading 1
+ * identifying the segment:
  *
  *	Biased Linear Input Code	Compressed Code
  *	------------------------	---------------
@@ -183,85 +121,105 @@ int alaw2linear(unsigned char a_val)
  *	01wxyzabcdefg			110wxyz
  *	1wxyzabcdefgh			111wxyz
  *
- * Each biased linear code has a leading 1 which identifies the segment
- * number. The value of the segment number is equal to 7 minus the number
- * of leading 0's. The quantization interval is directly available as the
- * four bits wxyz.  The trailing bits (a - h) are ignored.
- *
- * Ordinarily the complement of the resulting code word is used for
- * transmission, and so the code word is complemented before it is returned.
- *
- * For further information see John C. Bellamy's Digital Telephony, 1982,
- * John Wiley & Sons, pps 98-111 and 472-476.
+ * The code word is complemented for transmission.
  */
-unsigned char linear2ulaw(int pcm_val)	/* 2's complement (16-bit range) */
-{
-	int mask;
-	int seg;
-	unsigned char uval;
+constexpr uint8_t ref_linear2ulaw(int pcm_val) {
+  int mask = 0xFF;
+  if (pcm_val < 0) {
+    pcm_val = BIAS - pcm_val;
+    mask = 0x7F;
+  } else {
+    pcm_val += BIAS;
+  }
+  int seg = segment(pcm_val);
+  if (seg >= 8)
+    return (uint8_t)(0x7F ^ mask);
+  int uval = (seg << 4) | ((pcm_val >> (seg + 3)) & 0xF);
+  return (uint8_t)(uval ^ mask);
+}
 
-	/* Get the sign and the magnitude of the value. */
-	if (pcm_val < 0) {
-		pcm_val = BIAS - pcm_val;
-		mask = 0x7F;
-	} else {
-		pcm_val += BIAS;
-		mask = 0xFF;
-	}
+constexpr int ref_ulaw2linear(uint8_t u_val) {
+  u_val = ~u_val;
+  int t = ((u_val & QUANT_MASK) << 3) + BIAS;
+  t <<= ((unsigned)u_val & SEG_MASK) >> SEG_SHIFT;
+  return (u_val & 0x80) ? (BIAS - t) : (t - BIAS);
+}
 
-	/* Convert the scaled magnitude to segment number. */
-	seg = search(pcm_val, seg_end, 8);
+constexpr LookupTable<uint8_t, ALAW_ENCODE_SIZE> make_alaw_encode() {
+  LookupTable<uint8_t, ALAW_ENCODE_SIZE> t{};
+  // entry 0 holds the reference's result for -7..-1, which it maps to magnitudes -7..-1
+  t.v[0] = ref_linear2alaw(-1) ^ 0x55;
+  for (size_t i = 1; i < ALAW_ENCODE_SIZE; i++)
+    t.v[i] = ref_linear2alaw((int)((i - 1) << 3)) ^ 0xD5;
+  return t;
+}
 
-	/*
-	 * Combine the sign, segment, quantization bits;
-	 * and complement the code word.
-	 */
-	if (seg >= 8)		/* out of range, return maximum value. */
-		return (0x7F ^ mask);
-	else {
-		uval = (seg << 4) | ((pcm_val >> (seg + 3)) & 0xF);
-		return (uval ^ mask);
-	}
+constexpr LookupTable<uint8_t, ULAW_ENCODE_SIZE> make_ulaw_encode() {
+  LookupTable<uint8_t, ULAW_ENCODE_SIZE> t{};
+  for (size_t i = 0; i < ULAW_ENCODE_SIZE; i++)
+    t.v[i] = ref_linear2ulaw((int)(i << 2)) ^ 0xFF;
+  return t;
 }
 
-/*
- * ulaw2linear() - Convert a u-law value to 16-bit linear PCM
- *
- * First, a biased linear code is derived from the code word. An unbiased
- * output can then be obtained by subtracting 33 from the biased code.
- *
- * Note that this function expects to be passed the complement of the
- * original code word. This is in keeping with ISDN conventions.
- */
-int ulaw2linear(unsigned char u_val)
-{
-	int t;
+template<int (*REF)(uint8_t)> constexpr LookupTable<int16_t, 256> make_decode() {
+  LookupTable<int16_t, 256> t{};
+  for (int i = 0; i < 256; i++)
+    t.v[i] = (int16_t)REF((uint8_t)i);
+  return t;
+}
+
+}  // namespace
+
+constexpr LookupTable<uint8_t, ALAW_ENCODE_SIZE> ALAW_ENCODE = make_alaw_encode();
+constexpr LookupTable<uint8_t, ULAW_ENCODE_SIZE> ULAW_ENCODE = make_ulaw_encode();
+constexpr LookupTable<int16_t, 256> ALAW_DECODE = make_decode<ref_alaw2linear>();
+constexpr LookupTable<int16_t, 256> ULAW_DECODE = make_decode<ref_ulaw2linear>();
+
+namespace {
+
+// Compile-time proof that the lookups in g711.h match the reference for every 16-bit input, plus
+// out-of-range values that must saturate
+constexpr bool matches_reference() {
+  for (int pcm = -32768; pcm <= 32767; pcm++) {
+    if (linear2alaw(pcm) != ref_linear2alaw(pcm) || linear2ulaw(pcm) != ref_linear2ulaw(pcm))
+      return false;
+  }
+  const int extra[] = {-1000000, -40000, -32769, 32768, 40000, 1000000};
+  for (int pcm : extra) {
+    if (linear2alaw(pcm) != ref_linear2alaw(pcm) || linear2ulaw(pcm) != ref_linear2ulaw(pcm))
+      return false;
+  }
+  for (int code = 0; code < 256; code++) {
+    if (alaw2linear((uint8_t)code) != ref_alaw2linear((uint8_t)code) ||
+        ulaw2linear((uint8_t)code) != ref_ulaw2linear((uint8_t)code))
+      return false;
+  }
+  return true;
+}
+static_assert(matches_reference(), "G.711 lookup tables differ from the reference implementation");
+
+}  // namespace
 
-	/* Complement to obtain normal u-law value. */
-	u_val = ~u_val;
+void encode_alaw(const int16_t *in, uint8_t *out, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    out[i] = linear2alaw(in[i]);
+}
 
-	/*
-	 * Extract and bias the quantization bits. Then
-	 * shift up by the segment number and subtract out the bias.
-	 */
-	t = ((u_val & QUANT_MASK) << 3) + BIAS;
-	t <<= ((unsigned)u_val & SEG_MASK) >> SEG_SHIFT;
+void encode_ulaw(const int16_t *in, uint8_t *out, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    out[i] = linear2ulaw(in[i]);
+}
 
-	return (((u_val & SIGN_BIT) ? (BIAS - t) : (t - BIAS)));
+void decode_alaw(const uint8_t *in, int16_t *out, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    out[i] = ALAW_DECODE[in[i]];
 }
 
-/* A-law to u-law conversion */
-unsigned char alaw2ulaw(unsigned char aval)
-{
-	aval &= 0xff;
-	return ((aval & 0x80) ? (0xFF ^ _a2u[aval ^ 0xD5]) :
-				(0x7F ^ _a2u[aval ^ 0x55]));
+void decode_ulaw(const uint8_t *in, int16_t *out, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    out[i] = ULAW_DECODE[in[i]];
 }
 
-/* u-law to A-law conversion */
-unsigned char ulaw2alaw(unsigned char uval)
-{
-	uval &= 0xff;
-	return ((uval & 0x80) ? (0xD5 ^ (_u2a[0xFF ^ uval] - 1)) :
-				(0x55 ^ (_u2a[0x7F ^ uval] - 1)));
-}
\ No newline at end of file
+}  // namespace g711
+}  // namespace voip
+}  // namespace esphome
@@ -1,19 +1,58 @@
-#ifndef G711_H
-#define G711_H
+#pragma once
 
-#ifdef __cplusplus
-extern "C" {
-#endif
+#include <cstddef>
+#include <cstdint>
 
-unsigned char linear2alaw(int pcm_val);
-int alaw2linear(unsigned char a_val);
-unsigned char linear2ulaw(int pcm_val);
-int ulaw2linear(unsigned char u_val);
-unsigned char alaw2ulaw(unsigned char aval);
-unsigned char ulaw2alaw(unsigned char uval);
+namespace esphome {
+namespace voip {
+namespace g711 {
 
-#ifdef __cplusplus
+// G.711 A-law and u-law, bit-exact with the Sun reference implementation (g711.c).
+//
+// Encoding is a single table lookup: A-law depends only on the magnitude >> 3 and u-law only on the
+// magnitude >> 2, so the tables have 4097 and 8192 entries. Decoding uses 256-entry tables. All tables
+// are generated at compile time from a constexpr port of the reference, and g711.cpp checks the
+// functions below against it for every 16-bit input with static_assert.
+
+static const size_t ALAW_ENCODE_SIZE = 4097;
+static const size_t ULAW_ENCODE_SIZE = 8192;
+
+template<typename T, size_t N> struct LookupTable {
+  T v[N];
+  constexpr const T &operator[](size_t i) const { return v[i]; }
+};
+
+extern const LookupTable<uint8_t, ALAW_ENCODE_SIZE> ALAW_ENCODE;  // unsigned code, XOR with 0xD5 / 0x55
+extern const LookupTable<uint8_t, ULAW_ENCODE_SIZE> ULAW_ENCODE;  // unsigned code, XOR with 0xFF / 0x7F
+extern const LookupTable<int16_t, 256> ALAW_DECODE;
+extern const LookupTable<int16_t, 256> ULAW_DECODE;
+
+// Scalar conversions. Inputs outside the 16-bit range saturate like the reference.
+constexpr uint8_t linear2alaw(int pcm) {
+  // the reference encodes negative input as -pcm - 8, so -7..-1 land one step below zero; the table
+  // is offset by one entry to keep that behaviour
+  int mag = pcm >= 0 ? pcm : -pcm - 8;
+  if (mag > 32767)
+    mag = 32767;
+  return (uint8_t)(ALAW_ENCODE[(mag >> 3) + 1] ^ (pcm >= 0 ? 0xD5 : 0x55));
 }
-#endif
 
-#endif /* G711_H */
\ No newline at end of file
+constexpr uint8_t linear2ulaw(int pcm) {
+  int mag = pcm >= 0 ? pcm : -pcm;
+  if (mag > 32767)
+    mag = 32767;
+  return (uint8_t)(ULAW_ENCODE[mag >> 2] ^ (pcm >= 0 ? 0xFF : 0x7F));
+}
+
+constexpr int16_t alaw2linear(uint8_t code) { return ALAW_DECODE[code]; }
+constexpr int16_t ulaw2linear(uint8_t code) { return ULAW_DECODE[code]; }
+
+// Block conversions, in and out must not overlap
+void encode_alaw(const int16_t *in, uint8_t *out, size_t n);
+void encode_ulaw(const int16_t *in, uint8_t *out, size_t n);
+void decode_alaw(const uint8_t *in, int16_t *out, size_t n);
+void decode_ulaw(const uint8_t *in, int16_t *out, size_t n);
+
+}  // namespace g711
+}  // namespace voip
+}  // namespace esphome
@@ -0,0 +1,108 @@
+#include "g711_gain.h"
+#include "g711.h"
+
+namespace esphome {
+namespace voip {
+namespace g711 {
+
+namespace {
+
+// samples scaled per pass before the table lookups; small enough to stay on the stack
+constexpr size_t CHUNK = 32;
+
+template<typename T> inline void scale_chunk(const T *in, int16_t *out, size_t n, int in_shift, Q15Gain gain) {
+  const int32_t m = gain.mantissa;
+  const int s = gain.shift;
+  // branch-free clamp so the loop vectorises
+  for (size_t i = 0; i < n; i++) {
+    int32_t v = ((int32_t)(in[i] >> in_shift) * m) >> s;
+    v = v < -32768 ? -32768 : v;
+    v = v > 32767 ? 32767 : v;
+    out[i] = (int16_t)v;
+  }
+}
+
+template<typename T> inline void scale(const T *in, int16_t *out, size_t n, int in_shift, Q15Gain gain) {
+#ifdef VOIP_SIMD_SCALE_Q15
+  VOIP_SIMD_SCALE_Q15(in, out, n, in_shift, gain);
+#else
+  scale_chunk(in, out, n, in_shift, gain);
+#endif
+}
+
+template<typename T, bool ULAW> void encode(const T *in, uint8_t *out, size_t n, int in_shift, Q15Gain gain) {
+  int16_t pcm[CHUNK];
+  while (n > 0) {
+    size_t k = n < CHUNK ? n : CHUNK;
+    scale(in, pcm, k, in_shift, gain);
+    for (size_t i = 0; i < k; i++)
+      out[i] = ULAW ? linear2ulaw(pcm[i]) : linear2alaw(pcm[i]);
+    in += k;
+    out += k;
+    n -= k;
+  }
+}
+
+}  // namespace
+
+Q15Gain q15_gain(int32_t num, int32_t den) {
+  if (num <= 0 || den <= 0)
+    return Q15Gain{0, 15};
+  // pick the shift that puts the mantissa in [2^14, 2^15); 16-bit samples keep 30 bits of headroom
+  int shift = 15;
+  int64_t m = ((int64_t)num << shift) / den;
+  while (m >= (1 << 15) && shift > 0) {
+    shift--;
+    m = ((int64_t)num << shift) / den;
+  }
+  while (m < (1 << 14) && shift < 30) {
+    shift++;
+    m = ((int64_t)num << shift) / den;
+  }
+  return Q15Gain{(int32_t)m, shift};
+}
+
+void scale_q15(const int16_t *in, int16_t *out, size_t n, int in_shift, Q15Gain gain) {
+  scale(in, out, n, in_shift, gain);
+}
+
+void scale_q15(const int32_t *in, int16_t *out, size_t n, int in_shift, Q15Gain gain) {
+  scale(in, out, n, in_shift, gain);
+}
+
+void encode_alaw(const int16_t *in, uint8_t *out, size_t n, int in_shift, Q15Gain gain) {
+  encode<int16_t, false>(in, out, n, in_shift, gain);
+}
+
+void encode_alaw(const int32_t *in, uint8_t *out, size_t n, int in_shift, Q15Gain gain) {
+  encode<int32_t, false>(in, out, n, in_shift, gain);
+}
+
+void encode_ulaw(const int16_t *in, uint8_t *out, size_t n, int in_shift, Q15Gain gain) {
+  encode<int16_t, true>(in, out, n, in_shift, gain);
+}
+
+void encode_ulaw(const int32_t *in, uint8_t *out, size_t n, int in_shift, Q15Gain gain) {
+  encode<int32_t, true>(in, out, n, in_shift, gain);
+}
+
+void GainDecoder::build_(Law law, int32_t gain) {
+  this->law_ = law;
+  this->gain_ = gain;
+  for (int code = 0; code < 256; code++) {
+    int32_t v = (int32_t)(law == ULAW ? ulaw2linear((uint8_t)code) : alaw2linear((uint8_t)code)) * gain;
+    v = v < -32768 ? -32768 : v;
+    v = v > 32767 ? 32767 : v;
+    this->table_[code] = (int16_t)v;
+  }
+}
+
+void GainDecoder::decode(const uint8_t *in, int16_t *out, size_t n) const {
+  const int16_t *table = this->table_;
+  for (size_t i = 0; i < n; i++)
+    out[i] = table[in[i]];
+}
+
+}  // namespace g711
+}  // namespace voip
+}  // namespace esphome
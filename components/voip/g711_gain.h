@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace voip {
+namespace g711 {
+
+// Fixed-point gain: value = mantissa / 2^shift, with the mantissa normalised to [2^14, 2^15) so a
+// 16-bit sample times the mantissa always fits in 32 bits.
+struct Q15Gain {
+  int32_t mantissa;
+  int shift;
+};
+
+// Gain of num / den, e.g. q15_gain(mic_gain, 8). Negative gains are treated as 0.
+Q15Gain q15_gain(int32_t num, int32_t den);
+
+// Fused TX kernels: raw I2S frames in, G.711 bytes out.
+//
+// Every sample is reduced to 16 bits (x >> in_shift), multiplied by the gain, saturated to int16 and
+// encoded, in one pass. in_shift is 0 for 16-bit containers and SAMPLE_BITS - 16 for 24-bit samples in
+// 32-bit containers. The arithmetic runs on fixed-size chunks so the compiler can vectorise it; on
+// targets with a SIMD scaler (ESP32-S3/P4) define VOIP_SIMD_SCALE_Q15 to a function with the
+// signature of scale_q15() and it is used instead, here and in scale_q15() itself.
+void encode_alaw(const int16_t *in, uint8_t *out, size_t n, int in_shift, Q15Gain gain);
+void encode_alaw(const int32_t *in, uint8_t *out, size_t n, int in_shift, Q15Gain gain);
+void encode_ulaw(const int16_t *in, uint8_t *out, size_t n, int in_shift, Q15Gain gain);
+void encode_ulaw(const int32_t *in, uint8_t *out, size_t n, int in_shift, Q15Gain gain);
+
+// The scaling stage on its own: out[i] = sat16(((in[i] >> in_shift) * mantissa) >> shift). The
+// microphone and speaker paths call it in place (out == in), which a VOIP_SIMD_SCALE_Q15 must allow.
+void scale_q15(const int16_t *in, int16_t *out, size_t n, int in_shift, Q15Gain gain);
+void scale_q15(const int32_t *in, int16_t *out, size_t n, int in_shift, Q15Gain gain);
+
+// Fused RX decoder: one 256-entry table maps each G.711 code straight to its decoded sample times an
+// integer gain, saturated to int16. The table is rebuilt only when the law or the gain changes.
+class GainDecoder {
+ public:
+  enum Law : uint8_t { ALAW, ULAW };
+
+  GainDecoder(Law law = ALAW, int32_t gain = 1) { this->build_(law, gain); }
+  void configure(Law law, int32_t gain) {
+    if (law != this->law_ || gain != this->gain_)
+      this->build_(law, gain);
+  }
+  Law get_law() const { return this->law_; }
+  int32_t get_gain() const { return this->gain_; }
+
+  int16_t decode(uint8_t code) const { return this->table_[code]; }
+  // in and out must not overlap; out can be the caller's playback buffer
+  void decode(const uint8_t *in, int16_t *out, size_t n) const;
+
+ protected:
+  void build_(Law law, int32_t gain);
+
+  Law law_ = ALAW;
+  int32_t gain_ = 0;
+  int16_t table_[256];
+};
+
+}  // namespace g711
+}  // namespace voip
+}  // namespace esphome
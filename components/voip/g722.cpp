@@ -0,0 +1,348 @@
+/*
+ * g722.cpp
+ *
+ * G.722 sub-band ADPCM after the bit level description in ITU-T G.722. The block names in the
+ * comments (QUANTL, LOGSCL, UPPOL2, ...) are those of the Recommendation. Intermediate values are
+ * kept in int and saturated to 16 bits where the Recommendation limits them; everything else cannot
+ * leave the 16-bit range.
+ */
+#include "g722.h"
+#include <cstring>
+
+namespace esphome {
+namespace voip {
+namespace g722 {
+
+namespace {
+
+// Tables of the Recommendation
+
+// QUANTL decision levels, for the scale factor in Q12
+const int16_t Q6[32] = {0,    35,   72,   110,  150,  190,  233,  276,  323,  370,  422,
+                        473,  530,  587,  650,  714,  786,  858,  940,  1023, 1121, 1219,
+                        1339, 1458, 1612, 1765, 1980, 2195, 2557, 2919, 0,    0};
+// 6-bit codes per decision interval, for negative and positive differences
+const uint8_t ILN[32] = {0,  63, 62, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19,
+                         18, 17, 16, 15, 14, 13, 12, 11, 10, 9,  8,  7,  6,  5,  4,  0};
+const uint8_t ILP[32] = {0,  61, 60, 59, 58, 57, 56, 55, 54, 53, 52, 51, 50, 49, 48, 47,
+                         46, 45, 44, 43, 42, 41, 40, 39, 38, 37, 36, 35, 34, 33, 32, 0};
+// inverse quantizers of the lower band for 6, 5 and 4 bits, and of the upper band
+const int16_t QM6[64] = {-136,   -136,   -136,   -136,   -24808, -21904, -19008, -16704, -14984, -13512, -12280,
+                         -11192, -10232, -9360,  -8576,  -7856,  -7192,  -6576,  -6000,  -5456,  -4944,  -4464,
+                         -4008,  -3576,  -3168,  -2776,  -2400,  -2032,  -1688,  -1360,  -1040,  -728,   24808,
+                         21904,  19008,  16704,  14984,  13512,  12280,  11192,  10232,  9360,   8576,   7856,
+                         7192,   6576,   6000,   5456,   4944,   4464,   4008,   3576,   3168,   2776,   2400,
+                         2032,   1688,   1360,   1040,   728,    432,    136,    -432,   -136};
+const int16_t QM5[32] = {-280,  -280,  -23352, -17560, -14120, -11664, -9752, -8184, -6864, -5712, -4696,
+                         -3784, -2960, -2208,  -1520,  -880,   23352,  17560, 14120, 11664, 9752,  8184,
+                         6864,  5712,  4696,   3784,   2960,   2208,   1520,  880,   280,   -280};
+const int16_t QM4[16] = {0,     -20456, -12896, -8968, -6288, -4240, -2584, -1200,
+                         20456, 12896,  8968,   6288,  4240,  2584,  1200,  0};
+const int16_t QM2[4] = {-7408, -1616, 7408, 1616};
+// LOGSCL and LOGSCH: scale factor multipliers per code
+const uint8_t RL42[16] = {0, 7, 6, 5, 4, 3, 2, 1, 7, 6, 5, 4, 3, 2, 1, 0};
+const int16_t WL[8] = {-60, -30, 58, 172, 334, 538, 1198, 3042};
+const uint8_t RH2[4] = {2, 1, 2, 1};
+const int16_t WH[3] = {0, -214, 798};
+// SCALEL and SCALEH: 2^(i / 32) in Q11
+const int16_t ILB[32] = {2048, 2093, 2139, 2186, 2233, 2282, 2332, 2383, 2435, 2489, 2543,
+                         2599, 2656, 2714, 2774, 2834, 2896, 2960, 3025, 3091, 3158, 3228,
+                         3298, 3371, 3444, 3520, 3597, 3676, 3756, 3838, 3922, 4008};
+// QUANTH: 2-bit codes for the two intervals
+const uint8_t IHN[3] = {0, 1, 0};
+const uint8_t IHP[3] = {0, 3, 2};
+
+// one polyphase half of the QMF, oldest sample first, and the other half, which is its mirror image;
+// each sums to 4096
+const size_t HALF = QMF_TAPS / 2;
+const int16_t QMF[HALF] = {3, -11, 12, 32, -210, 951, 3876, -805, 362, -156, 53, -11};
+const int16_t QMF_REV[HALF] = {-11, 53, -156, 362, -805, 3876, 951, -210, 32, 12, -11, 3};
+
+inline int16_t saturate(int32_t v) { return (int16_t)(v > 32767 ? 32767 : (v < -32768 ? -32768 : v)); }
+
+inline int32_t dot(const int16_t *taps, const int16_t *x) {
+  int32_t sum = 0;
+  for (size_t i = 0; i < HALF; i++)
+    sum += (int32_t)taps[i] * x[i];
+  return sum;
+}
+
+void init_band(Band *band, int16_t det) {
+  std::memset(band, 0, sizeof(*band));
+  band->det = det;
+}
+
+// LOGSCL / LOGSCH and SCALEL / SCALEH: the log scale factor leaks towards zero and moves by the
+// code's multiplier; the scale factor is 2^(nb / 2048) in steps of 1/32 octave
+inline void adapt_scale(Band *band, int32_t multiplier, int32_t limit, int32_t shift) {
+  int32_t nb = ((band->nb * 127) >> 7) + multiplier;
+  nb = nb < 0 ? 0 : (nb > limit ? limit : nb);
+  band->nb = (int16_t)nb;
+  int32_t wd1 = (nb >> 6) & 31;
+  int32_t wd2 = shift - (nb >> 11);
+  int32_t wd3 = wd2 < 0 ? ILB[wd1] << -wd2 : ILB[wd1] >> wd2;
+  band->det = (int16_t)(wd3 << 2);
+}
+
+// Block 4: reconstruction, predictor adaptation and the next prediction from the quantized
+// difference d
+void block4(Band *band, int32_t d) {
+  Band &s = *band;
+  // RECONS and PARREC
+  s.d[0] = (int16_t)d;
+  s.r[0] = saturate(s.s + d);
+  s.p[0] = saturate(s.sz + d);
+
+  // UPPOL2
+  int32_t sg0 = s.p[0] >> 15, sg1 = s.p[1] >> 15, sg2 = s.p[2] >> 15;
+  int32_t wd1 = saturate(s.a[1] * 4);
+  int32_t wd2 = sg0 == sg1 ? -wd1 : wd1;
+  if (wd2 > 32767)
+    wd2 = 32767;
+  int32_t wd3 = (wd2 >> 7) + (sg0 == sg2 ? 128 : -128) + ((s.a[2] * 32512) >> 15);
+  int32_t ap2 = wd3 > 12288 ? 12288 : (wd3 < -12288 ? -12288 : wd3);
+
+  // UPPOL1
+  int32_t ap1 = saturate((sg0 == sg1 ? 192 : -192) + ((s.a[1] * 32640) >> 15));
+  int32_t limit = saturate(15360 - ap2);
+  ap1 = ap1 > limit ? limit : (ap1 < -limit ? -limit : ap1);
+
+  // UPZERO, and DELAYA for the zero section
+  int32_t step = d == 0 ? 0 : 128;
+  int32_t sgd = d >> 15;
+  int16_t bp[7];
+  for (int i = 1; i < 7; i++)
+    bp[i] = saturate(((s.d[i] >> 15) == sgd ? step : -step) + ((s.b[i] * 32640) >> 15));
+  for (int i = 6; i > 0; i--) {
+    s.d[i] = s.d[i - 1];
+    s.b[i] = bp[i];
+  }
+  // DELAYA for the pole section
+  s.r[2] = s.r[1];
+  s.r[1] = s.r[0];
+  s.p[2] = s.p[1];
+  s.p[1] = s.p[0];
+  s.a[2] = (int16_t)ap2;
+  s.a[1] = (int16_t)ap1;
+
+  // FILTEP
+  int32_t pole1 = (s.a[1] * saturate(s.r[1] * 2)) >> 15;
+  int32_t pole2 = (s.a[2] * saturate(s.r[2] * 2)) >> 15;
+  s.sp = saturate(pole1 + pole2);
+  // FILTEZ
+  int32_t sz = 0;
+  for (int i = 6; i > 0; i--)
+    sz += (s.b[i] * saturate(s.d[i] * 2)) >> 15;
+  s.sz = saturate(sz);
+  // PREDIC
+  s.s = saturate(s.sp + s.sz);
+}
+
+// Lower band encoder: returns the 6-bit code
+inline uint8_t encode_low(Band *band, int32_t xl) {
+  // SUBTRA
+  int32_t el = saturate(xl - band->s);
+  // QUANTL
+  int32_t wd = el >= 0 ? el : -(el + 1);
+  int i = 1;
+  while (i < 30 && wd >= ((Q6[i] * band->det) >> 12))
+    i++;
+  uint8_t il = el < 0 ? ILN[i] : ILP[i];
+  // INVQAL on the 4-bit code the decoder always has
+  int32_t ril = il >> 2;
+  int32_t dlt = (band->det * QM4[ril]) >> 15;
+  adapt_scale(band, WL[RL42[ril]], 18432, 8);
+  block4(band, dlt);
+  return il;
+}
+
+// Upper band encoder: returns the 2-bit code
+inline uint8_t encode_high(Band *band, int32_t xh) {
+  // SUBTRA
+  int32_t eh = saturate(xh - band->s);
+  // QUANTH
+  int32_t wd = eh >= 0 ? eh : -(eh + 1);
+  int mih = wd >= ((564 * band->det) >> 12) ? 2 : 1;
+  uint8_t ih = eh < 0 ? IHN[mih] : IHP[mih];
+  // INVQAH
+  int32_t dh = (band->det * QM2[ih]) >> 15;
+  adapt_scale(band, WH[RH2[ih]], 22528, 10);
+  block4(band, dh);
+  return ih;
+}
+
+// Lower band decoder for a 6-bit code, with the output quantizer of the mode
+inline int16_t decode_low(Band *band, const int16_t *table, int32_t index, uint8_t il) {
+  // INVQBL, RECONS and LIMIT
+  int32_t rl = band->s + ((band->det * table[index]) >> 15);
+  rl = rl > 16383 ? 16383 : (rl < -16384 ? -16384 : rl);
+  // INVQAL: the predictor follows the 4-bit code, like the encoder's
+  int32_t ril = il >> 2;
+  int32_t dlt = (band->det * QM4[ril]) >> 15;
+  adapt_scale(band, WL[RL42[ril]], 18432, 8);
+  block4(band, dlt);
+  return (int16_t)rl;
+}
+
+inline int16_t decode_high(Band *band, uint8_t ih) {
+  // INVQAH, RECONS and LIMIT
+  int32_t dh = (band->det * QM2[ih]) >> 15;
+  int32_t rh = band->s + dh;
+  rh = rh > 16383 ? 16383 : (rh < -16384 ? -16384 : rh);
+  adapt_scale(band, WH[RH2[ih]], 22528, 10);
+  block4(band, dh);
+  return (int16_t)rh;
+}
+
+}  // namespace
+
+void init_encoder(Encoder *state) {
+  init_band(&state->low, 32);
+  init_band(&state->high, 8);
+  init_qmf(&state->qmf);
+}
+
+void init_decoder(Decoder *state) {
+  init_band(&state->low, 32);
+  init_band(&state->high, 8);
+  init_qmf(&state->qmf);
+}
+
+void init_qmf(AnalysisQmf *qmf) { std::memset(qmf, 0, sizeof(*qmf)); }
+
+void init_qmf(SynthesisQmf *qmf) { std::memset(qmf, 0, sizeof(*qmf)); }
+
+void qmf_analysis(AnalysisQmf *qmf, const int16_t *pcm, int16_t *low, int16_t *high, size_t n) {
+  const size_t H = HALF - 1;
+  int16_t even[H + QMF_BLOCK], odd[H + QMF_BLOCK];
+  std::memcpy(even, qmf->even, sizeof(qmf->even));
+  std::memcpy(odd, qmf->odd, sizeof(qmf->odd));
+  while (n > 0) {
+    size_t m = n < QMF_BLOCK ? n : QMF_BLOCK;
+    for (size_t k = 0; k < m; k++) {
+      even[H + k] = pcm[2 * k];
+      odd[H + k] = pcm[2 * k + 1];
+    }
+    for (size_t k = 0; k < m; k++) {
+      int32_t from_even = dot(QMF, even + k);
+      int32_t from_odd = dot(QMF_REV, odd + k);
+      // 12 bits for the filters' gain, one for the two of them and one for the 15-bit bands
+      low[k] = (int16_t)((from_odd + from_even) >> 14);
+      high[k] = (int16_t)((from_odd - from_even) >> 14);
+    }
+    std::memmove(even, even + m, H * sizeof(int16_t));
+    std::memmove(odd, odd + m, H * sizeof(int16_t));
+    pcm += 2 * m;
+    low += m;
+    high += m;
+    n -= m;
+  }
+  std::memcpy(qmf->even, even, sizeof(qmf->even));
+  std::memcpy(qmf->odd, odd, sizeof(qmf->odd));
+}
+
+void qmf_synthesis(SynthesisQmf *qmf, const int16_t *low, const int16_t *high, int16_t *pcm, size_t n) {
+  const size_t H = HALF - 1;
+  int16_t sum[H + QMF_BLOCK], diff[H + QMF_BLOCK];
+  std::memcpy(sum, qmf->sum, sizeof(qmf->sum));
+  std::memcpy(diff, qmf->diff, sizeof(qmf->diff));
+  while (n > 0) {
+    size_t m = n < QMF_BLOCK ? n : QMF_BLOCK;
+    // the bands are limited to 15 bits, their sum and difference fit 16
+    for (size_t k = 0; k < m; k++) {
+      sum[H + k] = (int16_t)(low[k] + high[k]);
+      diff[H + k] = (int16_t)(low[k] - high[k]);
+    }
+    for (size_t k = 0; k < m; k++) {
+      pcm[2 * k] = saturate(dot(QMF_REV, diff + k) >> 11);
+      pcm[2 * k + 1] = saturate(dot(QMF, sum + k) >> 11);
+    }
+    std::memmove(sum, sum + m, H * sizeof(int16_t));
+    std::memmove(diff, diff + m, H * sizeof(int16_t));
+    low += m;
+    high += m;
+    pcm += 2 * m;
+    n -= m;
+  }
+  std::memcpy(qmf->sum, sum, sizeof(qmf->sum));
+  std::memcpy(qmf->diff, diff, sizeof(qmf->diff));
+}
+
+void encode_subbands(Encoder *state, const int16_t *low, const int16_t *high, uint8_t *codes, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    uint8_t il = encode_low(&state->low, low[i]);
+    uint8_t ih = encode_high(&state->high, high != nullptr ? high[i] : 0);
+    codes[i] = (uint8_t)(ih << 6 | il);
+  }
+}
+
+void decode_subbands(Decoder *state, uint8_t mode, const uint8_t *codes, int16_t *low, int16_t *high, size_t n) {
+  // mode 2 and 3 leave one or two bits of each octet to auxiliary data
+  const int16_t *table = mode == 3 ? QM4 : (mode == 2 ? QM5 : QM6);
+  int drop = mode == 3 ? 2 : (mode == 2 ? 1 : 0);
+  for (size_t i = 0; i < n; i++) {
+    uint8_t il = codes[i] & 0x3F;
+    low[i] = decode_low(&state->low, table, il >> drop, il);
+    int16_t rh = decode_high(&state->high, codes[i] >> 6);
+    if (high != nullptr)
+      high[i] = rh;
+  }
+}
+
+void encode_block(Encoder *state, const int16_t *pcm, uint8_t *codes, size_t n) {
+  int16_t low[QMF_BLOCK], high[QMF_BLOCK];
+  while (n > 0) {
+    size_t m = n < QMF_BLOCK ? n : QMF_BLOCK;
+    qmf_analysis(&state->qmf, pcm, low, high, m);
+    encode_subbands(state, low, high, codes, m);
+    pcm += 2 * m;
+    codes += m;
+    n -= m;
+  }
+}
+
+void decode_block(Decoder *state, const uint8_t *codes, int16_t *pcm, size_t n) {
+  int16_t low[QMF_BLOCK], high[QMF_BLOCK];
+  while (n > 0) {
+    size_t m = n < QMF_BLOCK ? n : QMF_BLOCK;
+    decode_subbands(state, 1, codes, low, high, m);
+    qmf_synthesis(&state->qmf, low, high, pcm, m);
+    codes += m;
+    pcm += 2 * m;
+    n -= m;
+  }
+}
+
+}  // namespace g722
+
+G722Codec::G722Codec() {
+  this->reset_encoder();
+  this->reset_decoder();
+}
+
+void G722Codec::reset_encoder() { g722::init_encoder(&this->enc_state_); }
+
+void G722Codec::reset_decoder() { g722::init_decoder(&this->dec_state_); }
+
+size_t G722Codec::encode(const int16_t *low, const int16_t *high, size_t n, uint8_t *out) {
+  int16_t band[g722::QMF_BLOCK];
+  for (size_t at = 0; at < n; at += g722::QMF_BLOCK) {
+    size_t m = n - at < g722::QMF_BLOCK ? n - at : g722::QMF_BLOCK;
+    for (size_t i = 0; i < m; i++)
+      band[i] = (int16_t)(low[at + i] >> 1);
+    g722::encode_subbands(&this->enc_state_, band, high != nullptr ? high + at : nullptr, out + at, m);
+  }
+  return n;
+}
+
+size_t G722Codec::decode(const uint8_t *in, size_t len, int16_t *low, int16_t *high, size_t max_samples) {
+  size_t n = len < max_samples ? len : max_samples;
+  g722::decode_subbands(&this->dec_state_, 1, in, low, high, n);
+  // 15 bits at most, doubling cannot overflow
+  for (size_t i = 0; i < n; i++)
+    low[i] = (int16_t)(low[i] * 2);
+  return n;
+}
+
+}  // namespace voip
+}  // namespace esphome
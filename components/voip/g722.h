@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace voip {
+namespace g722 {
+
+// G.722 sub-band ADPCM (ITU-T G.722, 64 kbit/s on the wire, decodable at all three modes), bit-exact
+// with the Recommendation's fixed-point description and its digital test sequences.
+//
+// A 24-tap QMF splits 16 kHz audio into a lower and an upper band of 8 kHz each. The lower band is
+// coded with a 6-bit adaptive quantizer, the upper band with a 2-bit one; both predict with two poles
+// and six zeros (block 4). One octet per sample pair holds the upper band's code in its two top bits.
+//
+// The QMF is kept in polyphase form: even and odd input samples (on the decoder's side, the sum and
+// difference of the bands) live in separate linear buffers, so that each output is two 12-tap dot
+// products of contiguous int16 arrays instead of the reference's 24-word shift per sample pair.
+//
+// Sub-band samples are 15-bit values as the ADPCM sees them: about half the 16-bit input level for
+// a tone in that band.
+
+// state of the ADPCM of one band: predictor, quantizer scale and the history block 4 keeps
+struct Band {
+  int16_t s;   // predicted signal
+  int16_t sp;  // pole part of it
+  int16_t sz;  // zero part of it
+  int16_t r[3];  // reconstructed signal, r[1] and r[2] are the last two
+  int16_t a[3];  // pole coefficients a[1], a[2]
+  int16_t b[7];  // zero coefficients b[1] .. b[6]
+  int16_t d[7];  // quantized differences, d[1] .. d[6] the last six
+  int16_t p[3];  // partially reconstructed signal
+  int16_t nb;    // log of the scale factor
+  int16_t det;   // scale factor
+};
+
+static const size_t QMF_TAPS = 24;
+// input sample pairs (output pairs) the QMF works on at a time; longer blocks are split
+static const size_t QMF_BLOCK = 80;
+
+struct AnalysisQmf {
+  // the last QMF_TAPS / 2 - 1 even and odd input samples, oldest first
+  int16_t even[QMF_TAPS / 2 - 1];
+  int16_t odd[QMF_TAPS / 2 - 1];
+};
+
+struct SynthesisQmf {
+  // the last QMF_TAPS / 2 - 1 sums and differences of the bands, oldest first
+  int16_t sum[QMF_TAPS / 2 - 1];
+  int16_t diff[QMF_TAPS / 2 - 1];
+};
+
+struct Encoder {
+  Band low;
+  Band high;
+  AnalysisQmf qmf;
+};
+
+struct Decoder {
+  Band low;
+  Band high;
+  SynthesisQmf qmf;
+};
+
+// Initial states as specified by G.722; use at the start of every stream
+void init_encoder(Encoder *state);
+void init_decoder(Decoder *state);
+void init_qmf(AnalysisQmf *qmf);
+void init_qmf(SynthesisQmf *qmf);
+
+// 2n samples at 16 kHz into n samples of each band, and back. The QMF delays by 22 samples (1.4 ms)
+// from analysis through synthesis.
+void qmf_analysis(AnalysisQmf *qmf, const int16_t *pcm, int16_t *low, int16_t *high, size_t n);
+void qmf_synthesis(SynthesisQmf *qmf, const int16_t *low, const int16_t *high, int16_t *pcm, size_t n);
+
+// ADPCM of n sample pairs of the two bands into n octets, without the QMF; the test sequences of
+// the Recommendation run through these. high may be null for an empty upper band.
+void encode_subbands(Encoder *state, const int16_t *low, const int16_t *high, uint8_t *codes, size_t n);
+// mode 1, 2 or 3 decodes the lower band from 6, 5 or 4 bits of each octet (64, 56 or 48 kbit/s);
+// the upper band is still decoded when high is null, its output is dropped
+void decode_subbands(Decoder *state, uint8_t mode, const uint8_t *codes, int16_t *low, int16_t *high, size_t n);
+
+// Whole codec at 64 kbit/s: 2n samples at 16 kHz into n octets and back
+void encode_block(Encoder *state, const int16_t *pcm, uint8_t *codes, size_t n);
+void decode_block(Decoder *state, const uint8_t *codes, int16_t *pcm, size_t n);
+
+}  // namespace g722
+
+// G.722 for one call, at the edge of the 8 kHz media path: the path carries the lower band, at the
+// level of 16-bit narrowband audio; the upper band, where there is one, goes around it. Every sample
+// pair is one octet of RTP payload, and the RTP clock runs at 8 kHz although G.722 samples at 16 kHz
+// (RFC 3551 section 4.5.2), so frames and timestamps are those of G.711.
+class G722Codec {
+ public:
+  G722Codec();
+
+  void reset_encoder();
+  void reset_decoder();
+
+  // Encodes n samples of the lower band and, unless null, of the upper band into n octets
+  size_t encode(const int16_t *low, const int16_t *high, size_t n, uint8_t *out);
+  // Decodes len octets into at most max_samples of the lower band, and of the upper band unless
+  // high is null; returns the number of samples
+  size_t decode(const uint8_t *in, size_t len, int16_t *low, int16_t *high, size_t max_samples);
+
+ protected:
+  g722::Encoder enc_state_;
+  g722::Decoder dec_state_;
+};
+
+}  // namespace voip
+}  // namespace esphome
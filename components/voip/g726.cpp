@@ -0,0 +1,450 @@
+/*
+ * This source code is a product of Sun Microsystems, Inc. and is provided
+ * for unrestricted use.  Users may copy or modify this source code without
+ * charge.
+ *
+ * SUN SOURCE CODE IS PROVIDED AS IS WITH NO WARRANTIES OF ANY KIND INCLUDING
+ * THE WARRANTIES OF DESIGN, MERCHANTIBILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE, OR ARISING FROM A COURSE OF DEALING, USAGE OR TRADE PRACTICE.
+ *
+ * Sun source code is provided with no support and without any obligation on
+ * the part of Sun Microsystems, Inc. to assist in its use, correction,
+ * modification or enhancement.
+ *
+ * SUN MICROSYSTEMS, INC. SHALL HAVE NO LIABILITY WITH RESPECT TO THE
+ * INFRINGEMENT OF COPYRIGHTS, TRADE SECRETS OR ANY PATENTS BY THIS SOFTWARE
+ * OR ANY PART THEREOF.
+ *
+ * In no event will Sun Microsystems, Inc. be liable for any lost revenue
+ * or profits or other special, indirect and consequential damages, even if
+ * Sun has been advised of the possibility of such damages.
+ *
+ * Sun Microsystems, Inc.
+ * 2550 Garcia Avenue
+ * Mountain View, California  94043
+ */
+
+/*
+ * g726.cpp
+ *
+ * G.721 / G.723 ADPCM, restructured from g72x.c, g721.c, g723_24.c and g723_40.c. The block names in
+ * the comments (FMULT, LOG, SUBTB, ...) follow the bit level description in the Recommendation, as the
+ * reference does. The 16-bit wrap-arounds of the reference's short variables are kept with explicit
+ * int16_t conversions; they matter for bit exactness on overload signals.
+ */
+#include "g726.h"
+#include "g711.h"
+
+namespace esphome {
+namespace voip {
+namespace g726 {
+
+namespace {
+
+// Rate tables, copied from the reference coders
+
+const int16_t QTAB_721[7] = {-124, 80, 178, 246, 300, 349, 400};
+const int16_t DQLN_721[16] = {-2048, 4, 135, 213, 273, 323, 373, 425, 425, 373, 323, 273, 213, 135, 4, -2048};
+const int16_t WI_721[16] = {-12, 18, 41, 64, 112, 198, 355, 1122, 1122, 355, 198, 112, 64, 41, 18, -12};
+const int16_t FI_721[16] = {0, 0, 0, 0x200, 0x200, 0x200, 0x600, 0xE00,
+                            0xE00, 0x600, 0x200, 0x200, 0x200, 0, 0, 0};
+
+const int16_t QTAB_723_24[3] = {8, 218, 331};
+const int16_t DQLN_723_24[8] = {-2048, 135, 273, 373, 373, 273, 135, -2048};
+const int16_t WI_723_24[8] = {-128, 960, 4384, 18624, 18624, 4384, 960, -128};
+const int16_t FI_723_24[8] = {0, 0x200, 0x400, 0xE00, 0xE00, 0x400, 0x200, 0};
+
+const int16_t QTAB_723_40[15] = {-122, -16, 68, 139, 198, 250, 298, 339, 378, 413, 445, 475, 502, 528, 553};
+const int16_t DQLN_723_40[32] = {-2048, -66, 28,  104, 169, 224, 274, 318, 358, 395, 429,
+                                 459,   488, 514, 539, 566, 566, 539, 514, 488, 459, 429,
+                                 395,   358, 318, 274, 224, 169, 104, 28,  -66, -2048};
+const int16_t WI_723_40[32] = {448,   448,   768,   1248,  1280,  1312,  1856,  3200,  4512,  5728,  7008,
+                               8960,  11456, 14080, 16928, 22272, 22272, 16928, 14080, 11456, 8960,  7008,
+                               5728,  4512,  3200,  1856,  1312,  1280,  1248,  768,   448,   448};
+const int16_t FI_723_40[32] = {0,     0,     0,     0,     0,     0x200, 0x200, 0x200, 0x200, 0x200, 0x400,
+                               0x600, 0x800, 0xA00, 0xC00, 0xC00, 0xC00, 0xC00, 0xA00, 0x800, 0x600, 0x400,
+                               0x200, 0x200, 0x200, 0x200, 0x200, 0,     0,     0,     0,     0};
+
+// Everything that differs between the three rates. WIDE_ENCODER_SE: the G.721 encoder forms the
+// signal estimate from the un-truncated sum of both predictors, every other coder truncates it to
+// 16 bits first.
+struct G721 {
+  static constexpr int BITS = 4, QSIZE = 7, SIGN = 0x08, SR_MASK = 0x3FFF, B_LEAK = 8, WI_SHIFT = 5;
+  static constexpr bool WIDE_ENCODER_SE = true;
+  static const int16_t *qtab() { return QTAB_721; }
+  static const int16_t *dqln() { return DQLN_721; }
+  static const int16_t *wi() { return WI_721; }
+  static const int16_t *fi() { return FI_721; }
+};
+
+struct G723_24 {
+  static constexpr int BITS = 3, QSIZE = 3, SIGN = 0x04, SR_MASK = 0x3FFF, B_LEAK = 8, WI_SHIFT = 0;
+  static constexpr bool WIDE_ENCODER_SE = false;
+  static const int16_t *qtab() { return QTAB_723_24; }
+  static const int16_t *dqln() { return DQLN_723_24; }
+  static const int16_t *wi() { return WI_723_24; }
+  static const int16_t *fi() { return FI_723_24; }
+};
+
+struct G723_40 {
+  static constexpr int BITS = 5, QSIZE = 15, SIGN = 0x10, SR_MASK = 0x7FFF, B_LEAK = 9, WI_SHIFT = 0;
+  static constexpr bool WIDE_ENCODER_SE = false;
+  static const int16_t *qtab() { return QTAB_723_40; }
+  static const int16_t *dqln() { return DQLN_723_40; }
+  static const int16_t *wi() { return WI_723_40; }
+  static const int16_t *fi() { return FI_723_40; }
+};
+
+// quan(v, power2, 15) of the reference for 0 <= v < 32768: the number of significant bits of v.
+// The | 1 makes v == 0 come out as 0 without a branch.
+inline int exponent(int v) { return 31 - __builtin_clz(((unsigned)v << 1) | 1); }
+
+// FMULT: an times the floating-point value (exp, mant, neg)
+inline int fmult(int an, int exp, int mant, int neg) {
+  int anmag = an > 0 ? an : ((-an) & 0x1FFF);
+  int anexp = exponent(anmag) - 6;
+  int anmant = anmag == 0 ? 32 : anexp >= 0 ? anmag >> anexp : anmag << -anexp;
+  int wanexp = anexp + exp - 13;
+  int wanmant = (anmant * mant + 0x30) >> 4;
+  int retval = wanexp >= 0 ? (wanmant << wanexp) & 0x7FFF : wanmant >> -wanexp;
+  return (an < 0) != (neg != 0) ? -retval : retval;
+}
+
+// FLOAT A / FLOAT B: 4-bit exponent, 6-bit mantissa; magnitude 0 is stored as mantissa 32
+inline void to_float(int mag, int16_t *exp, int16_t *mant) {
+  int e = exponent(mag);
+  *exp = (int16_t)e;
+  *mant = (int16_t)(mag == 0 ? 32 : (mag << 6) >> e);
+}
+
+// ACCUM: signal estimate se and the zero predictor part sez
+template<class R, bool ENCODER> inline int16_t estimate(const State *s, int16_t *sez) {
+  int acc = 0;
+  for (int k = 0; k < 6; k++)
+    acc += fmult(s->b[k] >> 2, s->dq_exp[k], s->dq_mant[k], s->dq_neg[k]);
+  int16_t sezi = (int16_t)acc;
+  *sez = (int16_t)(sezi >> 1);
+  int pole = fmult(s->a[1] >> 2, s->sr_exp[1], s->sr_mant[1], s->sr_neg[1]) +
+             fmult(s->a[0] >> 2, s->sr_exp[0], s->sr_mant[0], s->sr_neg[0]);
+  if (R::WIDE_ENCODER_SE && ENCODER)
+    return (int16_t)((sezi + pole) >> 1);
+  return (int16_t)((int16_t)(sezi + pole) >> 1);
+}
+
+// MIX: quantizer step size
+inline int16_t step_size(const State *s) {
+  if (s->ap >= 256)
+    return s->yu;
+  int y = s->yl >> 6;
+  int dif = s->yu - y;
+  int al = s->ap >> 2;
+  if (dif > 0)
+    y += (dif * al) >> 6;
+  else if (dif < 0)
+    y += (dif * al + 0x3F) >> 6;
+  return (int16_t)y;
+}
+
+// LOG, SUBTB, QUAN: ADPCM code for the difference d
+template<class R> inline int quantize(int16_t d, int y) {
+  int16_t dqm = (int16_t)(d < 0 ? -d : d);  // -32768 stays negative, like abs() into a short
+  int half = dqm >> 1;
+  int exp = half > 0 ? exponent(half) : 0;
+  int mant = ((dqm * 128) >> exp) & 0x7F;
+  int16_t dln = (int16_t)((exp << 7) + mant - (y >> 2));
+  // the table is sorted, so the reference's search equals the number of entries <= dln
+  const int16_t *qtab = R::qtab();
+  int i = 0;
+  for (int k = 0; k < R::QSIZE; k++)
+    i += dln >= qtab[k];
+  if (d < 0)
+    return (R::QSIZE << 1) + 1 - i;
+  return i == 0 ? (R::QSIZE << 1) + 1 : i;
+}
+
+// ADDA, ANTILOG: quantized difference, sign in bit 15 for negative values
+inline int16_t reconstruct(bool sign, int dqln, int y) {
+  int16_t dql = (int16_t)(dqln + (y >> 2));
+  if (dql < 0)
+    return sign ? (int16_t)-0x8000 : 0;
+  int dex = (dql >> 7) & 15;
+  int dqt = 128 + (dql & 127);
+  int dq = (int16_t)((dqt << 7) >> (14 - dex));
+  return (int16_t)(sign ? dq - 0x8000 : dq);
+}
+
+template<class R> void update(State *s, int y, int wi, int fi, int dq, int sr, int dqsez) {
+  int pk0 = dqsez < 0 ? 1 : 0;
+  int mag = dq & 0x7FFF;
+
+  // TRANS
+  int ylint = s->yl >> 15;
+  int ylfrac = (s->yl >> 10) & 0x1F;
+  int thr2 = ylint > 9 ? 31 << 10 : (int16_t)((32 + ylfrac) << ylint);
+  int dqthr = (int16_t)((thr2 + (thr2 >> 1)) >> 1);
+  bool tr = s->td != 0 && mag > dqthr;
+
+  // FUNCTW, FILTD, LIMB, FILTE
+  int yu = (int16_t)(y + ((wi - y) >> 5));
+  yu = yu < 544 ? 544 : yu > 5120 ? 5120 : yu;
+  s->yu = (int16_t)yu;
+  s->yl += yu + ((-s->yl) >> 6);
+
+  int a2p = 0;
+  if (tr) {
+    s->a[0] = s->a[1] = 0;
+    for (int k = 0; k < 6; k++)
+      s->b[k] = 0;
+  } else {
+    int pks1 = pk0 ^ s->pk[0];  // UPA2
+    a2p = (int16_t)(s->a[1] - (s->a[1] >> 7));
+    if (dqsez != 0) {
+      int fa1 = pks1 ? s->a[0] : -s->a[0];
+      if (fa1 < -8191)
+        a2p -= 0x100;
+      else if (fa1 > 8191)
+        a2p += 0xFF;
+      else
+        a2p += fa1 >> 5;
+      // LIMC
+      if (pk0 ^ s->pk[1]) {
+        if (a2p <= -12160)
+          a2p = -12288;
+        else if (a2p >= 12416)
+          a2p = 12288;
+        else
+          a2p -= 0x80;
+      } else if (a2p <= -12416) {
+        a2p = -12288;
+      } else if (a2p >= 12160) {
+        a2p = 12288;
+      } else {
+        a2p += 0x80;
+      }
+      a2p = (int16_t)a2p;
+    }
+    s->a[1] = (int16_t)a2p;
+
+    // UPA1, LIMD
+    int a1 = (int16_t)(s->a[0] - (s->a[0] >> 8));
+    if (dqsez != 0)
+      a1 = (int16_t)(pks1 ? a1 - 192 : a1 + 192);
+    int a1ul = (int16_t)(15360 - a2p);
+    a1 = a1 < -a1ul ? -a1ul : a1 > a1ul ? a1ul : a1;
+    s->a[0] = (int16_t)a1;
+
+    // UPB
+    const int neg = dq < 0 ? 1 : 0;
+    for (int k = 0; k < 6; k++) {
+      int b = s->b[k] - (s->b[k] >> R::B_LEAK);
+      if (mag != 0)
+        b += neg == s->dq_neg[k] ? 128 : -128;
+      s->b[k] = (int16_t)b;
+    }
+  }
+
+  // DELAY and FLOAT A
+  for (int k = 5; k > 0; k--) {
+    s->dq_exp[k] = s->dq_exp[k - 1];
+    s->dq_mant[k] = s->dq_mant[k - 1];
+    s->dq_neg[k] = s->dq_neg[k - 1];
+  }
+  to_float(mag, &s->dq_exp[0], &s->dq_mant[0]);
+  s->dq_neg[0] = dq < 0 ? 1 : 0;
+
+  // FLOAT B; -32768 has no magnitude in 15 bits and is stored like -0
+  s->sr_exp[1] = s->sr_exp[0];
+  s->sr_mant[1] = s->sr_mant[0];
+  s->sr_neg[1] = s->sr_neg[0];
+  to_float(sr <= -32768 ? 0 : sr < 0 ? -sr : sr, &s->sr_exp[0], &s->sr_mant[0]);
+  s->sr_neg[0] = sr < 0 ? 1 : 0;
+
+  s->pk[1] = s->pk[0];
+  s->pk[0] = (int16_t)pk0;
+
+  // TONE
+  s->td = (!tr && a2p < -11776) ? 1 : 0;
+
+  // FILTA, FILTB, SUBTC, FILTC
+  s->dms = (int16_t)(s->dms + ((fi - s->dms) >> 5));
+  s->dml = (int16_t)(s->dml + (((fi << 2) - s->dml) >> 7));
+  if (tr) {
+    s->ap = 256;
+  } else {
+    int diff = (s->dms << 2) - s->dml;
+    diff = diff < 0 ? -diff : diff;
+    if (y < 1536 || s->td == 1 || diff >= (s->dml >> 3))
+      s->ap = (int16_t)(s->ap + ((0x200 - s->ap) >> 4));
+    else
+      s->ap = (int16_t)(s->ap + ((-s->ap) >> 4));
+  }
+}
+
+// ADDB, ADDC and the state update shared by encoder and decoder; returns the reconstructed signal
+template<class R> inline int16_t reconstruct_and_update(State *s, int i, int16_t se, int16_t sez, int16_t y) {
+  int16_t dq = reconstruct((i & R::SIGN) != 0, R::dqln()[i], y);
+  int16_t sr = (int16_t)(dq < 0 ? se - (dq & R::SR_MASK) : se + dq);
+  int16_t dqsez = (int16_t)(sr + sez - se);
+  update<R>(s, y, R::wi()[i] << R::WI_SHIFT, R::fi()[i], dq, sr, dqsez);
+  return sr;
+}
+
+template<class R> void encode(State *s, const int16_t *pcm, uint8_t *codes, size_t n) {
+  for (size_t k = 0; k < n; k++) {
+    int16_t sez;
+    int16_t se = estimate<R, true>(s, &sez);
+    int16_t d = (int16_t)((pcm[k] >> 2) - se);  // 14-bit dynamic range
+    int16_t y = step_size(s);
+    int i = quantize<R>(d, y);
+    reconstruct_and_update<R>(s, i, se, sez, y);
+    codes[k] = (uint8_t)i;
+  }
+}
+
+template<class R> void decode(State *s, const uint8_t *codes, int16_t *pcm, size_t n) {
+  for (size_t k = 0; k < n; k++) {
+    int i = codes[k] & ((1 << R::BITS) - 1);
+    int16_t sez;
+    int16_t se = estimate<R, false>(s, &sez);
+    int16_t y = step_size(s);
+    int16_t sr = reconstruct_and_update<R>(s, i, se, sez, y);
+    pcm[k] = (int16_t)(sr * 4);
+  }
+}
+
+// Synchronous coding adjustment: re-encode the G.711 output and move it one code towards the ADPCM
+// input if the simulated encoder would not reproduce it
+template<class R> uint8_t tandem_alaw(int sr, int se, int y, int i) {
+  if (sr <= -32768)
+    sr = -1;
+  uint8_t sp = g711::linear2alaw((sr >> 1) * 8);
+  int16_t dx = (int16_t)((g711::alaw2linear(sp) >> 2) - se);
+  int id = quantize<R>(dx, y);
+  if (id == i)
+    return sp;
+  int im = i ^ R::SIGN;  // codes 8, 9, ... F, 0, 1, ... 7 as biased unsigned
+  int imx = id ^ R::SIGN;
+  if (imx > im) {  // next lower value
+    if (sp & 0x80)
+      return sp == 0xD5 ? 0x55 : (uint8_t)(((sp ^ 0x55) - 1) ^ 0x55);
+    return sp == 0x2A ? 0x2A : (uint8_t)(((sp ^ 0x55) + 1) ^ 0x55);
+  }
+  if (sp & 0x80)
+    return sp == 0xAA ? 0xAA : (uint8_t)(((sp ^ 0x55) + 1) ^ 0x55);
+  return sp == 0x55 ? 0xD5 : (uint8_t)(((sp ^ 0x55) - 1) ^ 0x55);
+}
+
+template<class R> uint8_t tandem_ulaw(int sr, int se, int y, int i) {
+  if (sr <= -32768)
+    sr = 0;
+  uint8_t sp = g711::linear2ulaw(sr * 4);
+  int16_t dx = (int16_t)((g711::ulaw2linear(sp) >> 2) - se);
+  int id = quantize<R>(dx, y);
+  if (id == i)
+    return sp;
+  int im = i ^ R::SIGN;
+  int imx = id ^ R::SIGN;
+  if (imx > im) {
+    if (sp & 0x80)
+      return sp == 0xFF ? 0x7E : sp + 1;
+    return sp == 0 ? 0 : sp - 1;
+  }
+  if (sp & 0x80)
+    return sp == 0x80 ? 0x80 : sp - 1;
+  return sp == 0x7F ? 0xFE : sp + 1;
+}
+
+template<class R, bool ULAW> void decode_law(State *s, const uint8_t *codes, uint8_t *out, size_t n) {
+  for (size_t k = 0; k < n; k++) {
+    int i = codes[k] & ((1 << R::BITS) - 1);
+    int16_t sez;
+    int16_t se = estimate<R, false>(s, &sez);
+    int16_t y = step_size(s);
+    int16_t sr = reconstruct_and_update<R>(s, i, se, sez, y);
+    out[k] = ULAW ? tandem_ulaw<R>(sr, se, y, i) : tandem_alaw<R>(sr, se, y, i);
+  }
+}
+
+}  // namespace
+
+void init_state(State *state) {
+  state->yl = 34816;
+  state->yu = 544;
+  state->dms = 0;
+  state->dml = 0;
+  state->ap = 0;
+  for (int k = 0; k < 2; k++) {
+    state->a[k] = 0;
+    state->pk[k] = 0;
+    state->sr_exp[k] = 0;
+    state->sr_mant[k] = 32;
+    state->sr_neg[k] = 0;
+  }
+  for (int k = 0; k < 6; k++) {
+    state->b[k] = 0;
+    state->dq_exp[k] = 0;
+    state->dq_mant[k] = 32;
+    state->dq_neg[k] = 0;
+  }
+  state->td = 0;
+}
+
+void encode_block(State *state, uint8_t bits, const int16_t *pcm, uint8_t *codes, size_t n) {
+  switch (bits) {
+    case 3:
+      encode<G723_24>(state, pcm, codes, n);
+      break;
+    case 5:
+      encode<G723_40>(state, pcm, codes, n);
+      break;
+    default:
+      encode<G721>(state, pcm, codes, n);
+      break;
+  }
+}
+
+void decode_block(State *state, uint8_t bits, const uint8_t *codes, int16_t *pcm, size_t n) {
+  switch (bits) {
+    case 3:
+      decode<G723_24>(state, codes, pcm, n);
+      break;
+    case 5:
+      decode<G723_40>(state, codes, pcm, n);
+      break;
+    default:
+      decode<G721>(state, codes, pcm, n);
+      break;
+  }
+}
+
+void decode_block_alaw(State *state, uint8_t bits, const uint8_t *codes, uint8_t *out, size_t n) {
+  switch (bits) {
+    case 3:
+      decode_law<G723_24, false>(state, codes, out, n);
+      break;
+    case 5:
+      decode_law<G723_40, false>(state, codes, out, n);
+      break;
+    default:
+      decode_law<G721, false>(state, codes, out, n);
+      break;
+  }
+}
+
+void decode_block_ulaw(State *state, uint8_t bits, const uint8_t *codes, uint8_t *out, size_t n) {
+  switch (bits) {
+    case 3:
+      decode_law<G723_24, true>(state, codes, out, n);
+      break;
+    case 5:
+      decode_law<G723_40, true>(state, codes, out, n);
+      break;
+    default:
+      decode_law<G721, true>(state, codes, out, n);
+      break;
+  }
+}
+
+}  // namespace g726
+}  // namespace voip
+}  // namespace esphome
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace voip {
+namespace g726 {
+
+// G.726 ADPCM core (G.721 at 32 kbit/s, G.723 at 24 and 40 kbit/s), bit-exact with the Sun reference
+// in libs/arduino-libg7xx, which in turn passes the CCITT conformance vectors.
+//
+// Differences to the reference are in the implementation only: exponents come from count-leading-zeros
+// instead of the quan() table search, the quantizer decision is a branch-free compare-and-count, the
+// rate-specific constants are template parameters and the coders run over whole blocks. The predictor
+// history is kept in structure-of-arrays form, already split into the exponent, mantissa and sign
+// fields that the floating-point multiplier consumes, so the six-tap zero predictor does not unpack
+// anything per tap.
+struct State {
+  // zero predictor: coefficients and the last six quantized differences
+  int16_t b[6];
+  int16_t dq_exp[6];
+  int16_t dq_mant[6];
+  int16_t dq_neg[6];  // 1 for negative values
+  // pole predictor: coefficients and the last two reconstructed samples
+  int16_t a[2];
+  int16_t sr_exp[2];
+  int16_t sr_mant[2];
+  int16_t sr_neg[2];
+  // quantizer scale factor and adaptation speed control
+  int32_t yl;
+  int16_t yu;
+  int16_t dms;
+  int16_t dml;
+  int16_t ap;
+  int16_t pk[2];
+  int16_t td;
+};
+
+// Initial state as specified by G.726; use at the start of every stream
+void init_state(State *state);
+
+// Block coders. Codes are stored one per byte, right-aligned; bits is 3, 4 or 5 (anything else is
+// treated as 4). Linear samples are 16 bits, the coder itself works on the upper 14.
+void encode_block(State *state, uint8_t bits, const int16_t *pcm, uint8_t *codes, size_t n);
+void decode_block(State *state, uint8_t bits, const uint8_t *codes, int16_t *pcm, size_t n);
+
+// Decoders with A-law / u-law output including the synchronous tandem adjustment of G.726 4.3. Not used
+// by the media path, they exist for the conformance vectors, which are specified in the G.711 domain.
+void decode_block_alaw(State *state, uint8_t bits, const uint8_t *codes, uint8_t *out, size_t n);
+void decode_block_ulaw(State *state, uint8_t bits, const uint8_t *codes, uint8_t *out, size_t n);
+
+inline void g721_encode_block(State *state, const int16_t *pcm, uint8_t *codes, size_t n) {
+  encode_block(state, 4, pcm, codes, n);
+}
+inline void g721_decode_block(State *state, const uint8_t *codes, int16_t *pcm, size_t n) {
+  decode_block(state, 4, codes, pcm, n);
+}
+inline void g723_24_encode_block(State *state, const int16_t *pcm, uint8_t *codes, size_t n) {
+  encode_block(state, 3, pcm, codes, n);
+}
+inline void g723_24_decode_block(State *state, const uint8_t *codes, int16_t *pcm, size_t n) {
+  decode_block(state, 3, codes, pcm, n);
+}
+inline void g723_40_encode_block(State *state, const int16_t *pcm, uint8_t *codes, size_t n) {
+  encode_block(state, 5, pcm, codes, n);
+}
+inline void g723_40_decode_block(State *state, const uint8_t *codes, int16_t *pcm, size_t n) {
+  decode_block(state, 5, codes, pcm, n);
+}
+
+}  // namespace g726
+}  // namespace voip
+}  // namespace esphome
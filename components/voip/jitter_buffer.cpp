@@ -0,0 +1,228 @@
+#include "jitter_buffer.h"
+#include "rtp.h"
+#include <cstring>
+
+namespace esphome {
+namespace voip {
+
+// Adjust the playout delay by at most one frame per this many pops (20 ms frames -> 160 ms)
+static const uint32_t ADJUST_INTERVAL = 8;
+// A sequence jump larger than this is treated as a new stream, not as loss
+static const int32_t RESYNC_SEQ_JUMP = 1000;
+
+JitterBuffer::JitterBuffer() { this->reset(); }
+
+void JitterBuffer::configure(uint32_t min_delay_ms, uint32_t max_delay_ms, uint32_t clock_rate) {
+  this->clock_rate_ = clock_rate ? clock_rate : 8000;
+  this->min_delay_ms_ = min_delay_ms;
+  this->max_delay_ms_ = max_delay_ms < min_delay_ms ? min_delay_ms : max_delay_ms;
+  this->frame_samples_ = this->clock_rate_ / 50;
+  this->frame_ms_ = 20;
+  this->reset();
+}
+
+void JitterBuffer::reset() {
+  for (auto &slot : this->slots_) {
+    slot.used = false;
+    slot.len = 0;
+  }
+  this->stats_ = JitterBufferStats{};
+  this->started_ = false;
+  this->played_any_ = false;
+  this->empty_pops_ = 0;
+  this->pops_since_adjust_ = 0;
+  this->have_transit_ = false;
+  this->jitter_q4_ = 0;
+  this->peak_q4_ = 0;
+  this->update_target_();
+}
+
+JitterBuffer::PushResult JitterBuffer::push(uint16_t seq, uint32_t timestamp, const uint8_t *payload, size_t len,
+                                            uint32_t arrival_ms) {
+  if (len > MAX_PAYLOAD)
+    return PUSH_TOO_LARGE;
+  this->stats_.received++;
+
+  // learn the packetization interval from consecutive packets
+  if (this->have_transit_ && seq == (uint16_t)(this->last_seq_ + 1)) {
+    uint32_t samples = timestamp - this->last_timestamp_;
+    if (samples >= this->clock_rate_ / 200 && samples <= this->clock_rate_ / 8 && samples != this->frame_samples_) {
+      this->frame_samples_ = samples;
+      this->frame_ms_ = samples * 1000 / this->clock_rate_;
+    }
+  }
+  this->update_jitter_(timestamp, arrival_ms);
+  this->last_seq_ = seq;
+  this->last_timestamp_ = timestamp;
+  this->empty_pops_ = 0;
+
+  PushResult result = PUSH_OK;
+  if (!this->started_) {
+    this->start_(seq, arrival_ms);
+  } else {
+    int32_t diff = rtp_seq_diff(seq, this->next_seq_);
+    if (diff > RESYNC_SEQ_JUMP || diff < -RESYNC_SEQ_JUMP) {
+      this->stats_.resync++;
+      this->start_(seq, arrival_ms);
+      result = PUSH_RESYNC;
+    } else if (diff < 0) {
+      // a reordered packet may still extend the buffer backwards as long as nothing was played yet
+      int32_t span = rtp_seq_diff(this->highest_seq_, seq);
+      if (this->played_any_ || span >= (int32_t)MAX_FRAMES) {
+        this->stats_.late++;
+        return PUSH_LATE;
+      }
+      this->next_seq_ = seq;
+    } else if (diff >= (int32_t)MAX_FRAMES) {
+      // sender ran ahead of the ring: discard the oldest frames to make room
+      uint16_t new_next = (uint16_t)(seq - MAX_FRAMES + 1);
+      while (this->next_seq_ != new_next) {
+        Slot &slot = this->slots_[this->next_seq_ % MAX_FRAMES];
+        if (slot.used && slot.seq == this->next_seq_)
+          this->stats_.overflow++;
+        this->release_(this->next_seq_);
+        this->next_seq_++;
+      }
+    }
+  }
+
+  Slot &slot = this->slots_[seq % MAX_FRAMES];
+  if (slot.used && slot.seq == seq) {
+    this->stats_.duplicate++;
+    return PUSH_DUPLICATE;
+  }
+  slot.used = true;
+  slot.seq = seq;
+  slot.len = (uint16_t)len;
+  if (len)
+    memcpy(slot.data, payload, len);
+  if (rtp_seq_diff(seq, this->highest_seq_) > 0)
+    this->highest_seq_ = seq;
+  return result;
+}
+
+JitterBuffer::PopResult JitterBuffer::pop(uint32_t now_ms, uint8_t *out, size_t out_cap, size_t *out_len) {
+  if (out_len)
+    *out_len = 0;
+  if (!this->started_ || (int32_t)(now_ms - this->next_play_ms_) < 0)
+    return POP_NONE;
+  this->update_target_();
+  this->next_play_ms_ += this->frame_ms_;
+
+  size_t depth = this->buffered_frames_();
+  if (depth == 0) {
+    // ran dry: conceal without consuming a slot, which also grows the delay by one frame.
+    // When the stream stays silent for longer than max_delay, stop and re-anchor on the next packet.
+    this->stats_.underrun++;
+    if (++this->empty_pops_ * this->frame_ms_ > this->max_delay_ms_) {
+      this->started_ = false;
+      return POP_NONE;
+    }
+    return POP_MISSING;
+  }
+
+  if (++this->pops_since_adjust_ >= ADJUST_INTERVAL) {
+    uint32_t buffered_ms = depth * this->frame_ms_;
+    if (depth > 1 && buffered_ms > this->target_delay_ms_ + this->frame_ms_) {
+      this->release_(this->next_seq_);
+      this->next_seq_++;
+      this->stats_.shrink++;
+      this->pops_since_adjust_ = 0;
+    } else if (buffered_ms + this->frame_ms_ < this->target_delay_ms_) {
+      this->stats_.grow++;
+      this->pops_since_adjust_ = 0;
+      return POP_MISSING;
+    }
+  }
+
+  Slot &slot = this->slots_[this->next_seq_ % MAX_FRAMES];
+  bool have = slot.used && slot.seq == this->next_seq_;
+  this->played_any_ = true;
+  if (!have) {
+    this->stats_.lost++;
+    this->next_seq_++;
+    return POP_MISSING;
+  }
+  size_t n = slot.len <= out_cap ? slot.len : out_cap;
+  if (out && n)
+    memcpy(out, slot.data, n);
+  if (out_len)
+    *out_len = n;
+  this->release_(this->next_seq_);
+  this->next_seq_++;
+  this->stats_.played++;
+  return POP_FRAME;
+}
+
+uint32_t JitterBuffer::get_buffered_ms() const { return (uint32_t)this->buffered_frames_() * this->frame_ms_; }
+
+uint32_t JitterBuffer::get_jitter_ms() const { return (this->jitter_q4_ >> 4) * 1000 / this->clock_rate_; }
+
+void JitterBuffer::start_(uint16_t seq, uint32_t arrival_ms) {
+  for (auto &slot : this->slots_)
+    slot.used = false;
+  this->started_ = true;
+  this->played_any_ = false;
+  this->next_seq_ = seq;
+  this->highest_seq_ = seq;
+  this->pops_since_adjust_ = 0;
+  this->update_target_();
+  // schedule the first frame so that target_delay worth of audio has arrived by then
+  uint32_t lead = this->target_delay_ms_ > this->frame_ms_ ? this->target_delay_ms_ - this->frame_ms_ : 0;
+  this->next_play_ms_ = arrival_ms + lead;
+}
+
+void JitterBuffer::update_jitter_(uint32_t timestamp, uint32_t arrival_ms) {
+  uint32_t arrival_ts = arrival_ms * (this->clock_rate_ / 1000);
+  int32_t transit = (int32_t)(arrival_ts - timestamp);
+  if (this->have_transit_) {
+    int32_t d = transit - this->last_transit_;
+    if (d < 0)
+      d = -d;
+    // bound a single outlier (e.g. a stream restart) to one second
+    if (d > (int32_t)this->clock_rate_)
+      d = (int32_t)this->clock_rate_;
+    this->jitter_q4_ = (uint32_t)((int32_t)this->jitter_q4_ + d - (int32_t)((this->jitter_q4_ + 8) >> 4));
+    // the peak decays slowly (half-life ~3.5 s at 50 pps) so recurring Wi-Fi bursts keep the delay up
+    this->peak_q4_ -= this->peak_q4_ >> 8;
+    uint32_t d_q4 = (uint32_t)d << 4;
+    if (d_q4 > this->peak_q4_)
+      this->peak_q4_ = d_q4;
+  }
+  this->last_transit_ = transit;
+  this->have_transit_ = true;
+}
+
+void JitterBuffer::update_target_() {
+  uint32_t jitter_ts = this->jitter_q4_ >> 4;
+  uint32_t peak_ts = this->peak_q4_ >> 4;
+  uint32_t variation_ts = 3 * jitter_ts > peak_ts ? 3 * jitter_ts : peak_ts;
+  uint32_t target = this->frame_ms_ + variation_ts * 1000 / this->clock_rate_;
+  uint32_t ceiling = this->max_delay_ms_;
+  uint32_t capacity_ms = (uint32_t)(MAX_FRAMES - 1) * this->frame_ms_;
+  if (ceiling > capacity_ms)
+    ceiling = capacity_ms;
+  if (target < this->min_delay_ms_)
+    target = this->min_delay_ms_;
+  if (target > ceiling)
+    target = ceiling;
+  if (target < this->frame_ms_)
+    target = this->frame_ms_;
+  this->target_delay_ms_ = target;
+}
+
+void JitterBuffer::release_(uint16_t seq) {
+  Slot &slot = this->slots_[seq % MAX_FRAMES];
+  if (slot.used && slot.seq == seq)
+    slot.used = false;
+}
+
+size_t JitterBuffer::buffered_frames_() const {
+  if (!this->started_)
+    return 0;
+  int32_t diff = rtp_seq_diff(this->highest_seq_, this->next_seq_);
+  return diff < 0 ? 0 : (size_t)diff + 1;
+}
+
+}  // namespace voip
+}  // namespace esphome
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace voip {
+
+struct JitterBufferStats {
+  uint32_t received = 0;
+  uint32_t played = 0;
+  uint32_t late = 0;        // arrived after its playout slot, dropped
+  uint32_t duplicate = 0;   // same sequence number already buffered
+  uint32_t lost = 0;        // slot was due but never arrived, concealed
+  uint32_t underrun = 0;    // buffer ran dry, concealed without consuming a slot
+  uint32_t overflow = 0;    // frames discarded because the sender ran too far ahead
+  uint32_t shrink = 0;      // frames skipped to reduce playout delay
+  uint32_t grow = 0;        // concealment frames inserted to increase playout delay
+  uint32_t resync = 0;      // playout clock re-anchored (stream restart or large seq jump)
+};
+
+// Adaptive jitter buffer for a single RTP stream.
+//
+// Packets are stored by sequence number in a fixed ring of slots, so the buffer never allocates.
+// Playout runs on its own clock (one frame every frame_ms) which is anchored to the arrival of the
+// first packet plus the current target delay. The target delay follows the RFC 3550 interarrival
+// jitter estimate plus a decaying peak of the delay variation, clamped to [min_delay, max_delay].
+// The buffer converges on the target by skipping a frame when it holds too much audio and by
+// inserting a concealment frame when it holds too little.
+//
+// The buffer is clock agnostic: all times are passed in by the caller in milliseconds, which keeps
+// it testable on a host with recorded packet traces.
+class JitterBuffer {
+ public:
+  static const size_t MAX_FRAMES = 16;
+  static const size_t MAX_PAYLOAD = 480;  // 60 ms of G.711 at 8 kHz
+
+  enum PushResult { PUSH_OK, PUSH_DUPLICATE, PUSH_LATE, PUSH_TOO_LARGE, PUSH_RESYNC };
+  enum PopResult {
+    POP_NONE,     // nothing due yet
+    POP_FRAME,    // a frame was copied to the output buffer
+    POP_MISSING,  // a frame is due but not available; the caller should play concealment
+  };
+
+  JitterBuffer();
+
+  void configure(uint32_t min_delay_ms, uint32_t max_delay_ms, uint32_t clock_rate = 8000);
+  void reset();
+
+  PushResult push(uint16_t seq, uint32_t timestamp, const uint8_t *payload, size_t len, uint32_t arrival_ms);
+  PopResult pop(uint32_t now_ms, uint8_t *out, size_t out_cap, size_t *out_len);
+
+  bool is_playing() const { return this->started_; }
+  uint32_t get_frame_ms() const { return this->frame_ms_; }
+  uint32_t get_target_delay_ms() const { return this->target_delay_ms_; }
+  // buffered audio in milliseconds, counted from the next frame to play up to the newest packet
+  uint32_t get_buffered_ms() const;
+  // RFC 3550 interarrival jitter in milliseconds
+  uint32_t get_jitter_ms() const;
+  const JitterBufferStats &get_stats() const { return this->stats_; }
+
+ protected:
+  struct Slot {
+    bool used;
+    uint16_t seq;
+    uint16_t len;
+    uint8_t data[MAX_PAYLOAD];
+  };
+
+  void start_(uint16_t seq, uint32_t arrival_ms);
+  void update_jitter_(uint32_t timestamp, uint32_t arrival_ms);
+  void update_target_();
+  void release_(uint16_t seq);
+  size_t buffered_frames_() const;
+
+  Slot slots_[MAX_FRAMES];
+  JitterBufferStats stats_{};
+
+  uint32_t min_delay_ms_ = 40;
+  uint32_t max_delay_ms_ = 200;
+  uint32_t clock_rate_ = 8000;
+  uint32_t frame_samples_ = 160;
+  uint32_t frame_ms_ = 20;
+  uint32_t target_delay_ms_ = 40;
+
+  bool started_ = false;
+  bool played_any_ = false;
+  uint16_t next_seq_ = 0;
+  uint16_t highest_seq_ = 0;
+  uint32_t next_play_ms_ = 0;
+  uint32_t empty_pops_ = 0;
+  uint32_t pops_since_adjust_ = 0;
+
+  // jitter estimation, in timestamp units scaled by 16 (RFC 3550 appendix A.8)
+  bool have_transit_ = false;
+  int32_t last_transit_ = 0;
+  uint16_t last_seq_ = 0;
+  uint32_t last_timestamp_ = 0;
+  uint32_t jitter_q4_ = 0;
+  uint32_t peak_q4_ = 0;
+};
+
+}  // namespace voip
+}  // namespace esphome
@@ -0,0 +1,123 @@
+#include "md5.h"
+
+namespace esphome {
+namespace voip {
+
+namespace {
+
+inline uint32_t rotl(uint32_t x, int c) { return (x << c) | (x >> (32 - c)); }
+
+// per-round shift amounts and the integer parts of abs(sin(i + 1)) * 2^32
+const uint8_t SHIFTS[64] = {7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+                            5, 9,  14, 20, 5, 9,  14, 20, 5, 9,  14, 20, 5, 9,  14, 20,
+                            4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+                            6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21};
+const uint32_t SINES[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+}  // namespace
+
+void Md5::reset() {
+  this->state_[0] = 0x67452301;
+  this->state_[1] = 0xefcdab89;
+  this->state_[2] = 0x98badcfe;
+  this->state_[3] = 0x10325476;
+  this->length_ = 0;
+}
+
+void Md5::transform_(const uint8_t block[64]) {
+  uint32_t m[16];
+  for (int i = 0; i < 16; i++) {
+    m[i] = (uint32_t)block[i * 4] | (uint32_t)block[i * 4 + 1] << 8 | (uint32_t)block[i * 4 + 2] << 16 |
+           (uint32_t)block[i * 4 + 3] << 24;
+  }
+  uint32_t a = this->state_[0], b = this->state_[1], c = this->state_[2], d = this->state_[3];
+  for (int i = 0; i < 64; i++) {
+    uint32_t f;
+    int g;
+    if (i < 16) {
+      f = (b & c) | (~b & d);
+      g = i;
+    } else if (i < 32) {
+      f = (d & b) | (~d & c);
+      g = (5 * i + 1) & 15;
+    } else if (i < 48) {
+      f = b ^ c ^ d;
+      g = (3 * i + 5) & 15;
+    } else {
+      f = c ^ (b | ~d);
+      g = (7 * i) & 15;
+    }
+    uint32_t t = d;
+    d = c;
+    c = b;
+    b = b + rotl(a + f + SINES[i] + m[g], SHIFTS[i]);
+    a = t;
+  }
+  this->state_[0] += a;
+  this->state_[1] += b;
+  this->state_[2] += c;
+  this->state_[3] += d;
+}
+
+Md5 &Md5::update(const void *data, size_t len) {
+  const uint8_t *p = (const uint8_t *)data;
+  size_t used = (size_t)(this->length_ & 63);
+  this->length_ += len;
+  if (used != 0) {
+    size_t n = 64 - used < len ? 64 - used : len;
+    memcpy(this->block_ + used, p, n);
+    p += n;
+    len -= n;
+    if (used + n < 64)
+      return *this;
+    this->transform_(this->block_);
+  }
+  for (; len >= 64; p += 64, len -= 64)
+    this->transform_(p);
+  memcpy(this->block_, p, len);
+  return *this;
+}
+
+void Md5::finish(uint8_t digest[16]) {
+  uint64_t bits = this->length_ * 8;
+  // a 0x80 byte, zeros up to 56 mod 64, then the bit length little-endian
+  static const uint8_t PADDING[64] = {0x80};
+  size_t used = (size_t)(this->length_ & 63);
+  this->update(PADDING, used < 56 ? 56 - used : 120 - used);
+  uint8_t tail[8];
+  for (int i = 0; i < 8; i++)
+    tail[i] = (uint8_t)(bits >> (8 * i));
+  this->update(tail, 8);
+  for (int i = 0; i < 4; i++) {
+    for (int k = 0; k < 4; k++)
+      digest[i * 4 + k] = (uint8_t)(this->state_[i] >> (8 * k));
+  }
+  this->reset();
+}
+
+void Md5::finish_hex(char *out) {
+  uint8_t digest[16];
+  this->finish(digest);
+  md5_to_hex(digest, out);
+}
+
+void md5_to_hex(const uint8_t digest[16], char *out) {
+  static const char HEX[] = "0123456789abcdef";
+  for (int i = 0; i < 16; i++) {
+    out[i * 2] = HEX[digest[i] >> 4];
+    out[i * 2 + 1] = HEX[digest[i] & 15];
+  }
+  out[32] = '\0';
+}
+
+}  // namespace voip
+}  // namespace esphome
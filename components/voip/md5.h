@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace esphome {
+namespace voip {
+
+// Incremental MD5 (RFC 1321) on a fixed context, for SIP digest authentication.
+//
+// Digest inputs are colon-joined fields (user:realm:password, method:uri, ...); feeding them piece
+// by piece through update() avoids assembling them in a temporary string first. Nothing allocates,
+// and the same code runs on the ESP32 (which has no MD5 hardware) and in the host tests.
+class Md5 {
+ public:
+  static const size_t HEX_SIZE = 33;  // 32 lowercase hex digits and the terminating NUL
+
+  Md5() { this->reset(); }
+  void reset();
+  Md5 &update(const void *data, size_t len);
+  Md5 &update(const char *s) { return this->update(s, strlen(s)); }
+  Md5 &colon() { return this->update(":", 1); }
+  void finish(uint8_t digest[16]);
+  // finish() as lowercase hex into out[HEX_SIZE]
+  void finish_hex(char *out);
+
+ protected:
+  void transform_(const uint8_t block[64]);
+
+  uint32_t state_[4];
+  uint64_t length_;  // bytes fed so far
+  uint8_t block_[64];
+};
+
+// Lowercase hex of a digest into out[Md5::HEX_SIZE]
+void md5_to_hex(const uint8_t digest[16], char *out);
+
+}  // namespace voip
+}  // namespace esphome
@@ -0,0 +1,142 @@
+#include "media_task.h"
+
+#ifdef ESP_PLATFORM
+#include <esp_timer.h>
+#else
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#endif
+
+namespace esphome {
+namespace voip {
+
+bool MediaTask::start(const Config &config, std::function<void()> &&tick) {
+  if (this->started_)
+    return false;
+  this->config_ = config;
+  if (this->config_.period_us == 0)
+    this->config_.period_us = 10000;
+  this->tick_ = std::move(tick);
+  this->stop_requested_.store(false, std::memory_order_relaxed);
+  this->ticks_.store(0, std::memory_order_relaxed);
+  this->max_lateness_us_.store(0, std::memory_order_relaxed);
+  this->running_.store(true, std::memory_order_release);
+
+#ifdef ESP_PLATFORM
+  BaseType_t core = this->config_.core < 0 ? tskNO_AFFINITY : (BaseType_t)this->config_.core;
+  if (xTaskCreatePinnedToCore(&MediaTask::task_entry_, this->config_.name, this->config_.stack_size, this,
+                              (UBaseType_t)this->config_.priority, &this->handle_, core) != pdPASS) {
+    this->running_.store(false, std::memory_order_release);
+    return false;
+  }
+#else
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  if (this->config_.priority > 0) {
+    // real-time scheduling needs privileges; fall back to the default policy if it is refused
+    struct sched_param param = {};
+    param.sched_priority = this->config_.priority;
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    pthread_attr_setschedparam(&attr, &param);
+  }
+  int err = pthread_create(&this->thread_, &attr, &MediaTask::thread_entry_, this);
+  if (err != 0 && this->config_.priority > 0)
+    err = pthread_create(&this->thread_, nullptr, &MediaTask::thread_entry_, this);
+  pthread_attr_destroy(&attr);
+  if (err != 0) {
+    this->running_.store(false, std::memory_order_release);
+    return false;
+  }
+#if defined(__linux__)
+  if (this->config_.core >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(this->config_.core, &set);
+    pthread_setaffinity_np(this->thread_, sizeof(set), &set);
+  }
+#endif
+#endif
+  this->started_ = true;
+  return true;
+}
+
+void MediaTask::stop() {
+  if (!this->started_)
+    return;
+  this->started_ = false;
+  this->stop_requested_.store(true, std::memory_order_release);
+#ifdef ESP_PLATFORM
+  // the task deletes itself once it sees the request; it never sleeps longer than one period
+  while (this->running_.load(std::memory_order_acquire))
+    vTaskDelay(1);
+  this->handle_ = nullptr;
+#else
+  pthread_join(this->thread_, nullptr);
+#endif
+}
+
+void MediaTask::run_() {
+  const uint32_t period = this->config_.period_us;
+  uint64_t next = now_us() + period;
+#ifdef ESP_PLATFORM
+  TickType_t last_wake = xTaskGetTickCount();
+  TickType_t period_ticks = pdMS_TO_TICKS(period / 1000);
+  if (period_ticks == 0)
+    period_ticks = 1;
+#endif
+  while (!this->stop_requested_.load(std::memory_order_acquire)) {
+#ifdef ESP_PLATFORM
+    vTaskDelayUntil(&last_wake, period_ticks);
+#else
+    struct timespec ts;
+    ts.tv_sec = (time_t)(next / 1000000ULL);
+    ts.tv_nsec = (long)(next % 1000000ULL) * 1000L;
+    // a signal cuts the sleep short; any other error would fail again at once
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {
+    }
+#endif
+    uint64_t now = now_us();
+    if (now > next) {
+      uint32_t late = (uint32_t)(now - next);
+      if (late > this->max_lateness_us_.load(std::memory_order_relaxed))
+        this->max_lateness_us_.store(late, std::memory_order_relaxed);
+    }
+    next += period;
+    // if we fell more than a period behind, skip the missed ticks instead of bursting through them
+    if (now > next)
+      next = now + period - (now - next) % period;
+    if (this->stop_requested_.load(std::memory_order_acquire))
+      break;
+    this->tick_();
+    this->ticks_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+#ifdef ESP_PLATFORM
+uint64_t MediaTask::now_us() { return (uint64_t)esp_timer_get_time(); }
+
+void MediaTask::task_entry_(void *arg) {
+  auto *self = static_cast<MediaTask *>(arg);
+  self->run_();
+  self->running_.store(false, std::memory_order_release);
+  vTaskDelete(nullptr);
+}
+#else
+uint64_t MediaTask::now_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+}
+
+void *MediaTask::thread_entry_(void *arg) {
+  auto *self = static_cast<MediaTask *>(arg);
+  self->run_();
+  self->running_.store(false, std::memory_order_release);
+  return nullptr;
+}
+#endif
+
+}  // namespace voip
+}  // namespace esphome
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+
+#ifdef ESP_PLATFORM
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#else
+#include <pthread.h>
+#endif
+
+namespace esphome {
+namespace voip {
+
+// Periodic real-time task used by the media engine.
+//
+// On ESP32 this is a FreeRTOS task pinned to a core with its own priority and stack. On a host it is a
+// pthread (optionally SCHED_FIFO and CPU-pinned when permitted) so the engine can be tested and
+// benchmarked off-target. The tick callback runs every period_us on an absolute schedule, so a slow
+// tick does not shift the following ones.
+class MediaTask {
+ public:
+  struct Config {
+    const char *name = "voip_media";
+    int core = 1;             // -1 = no affinity
+    int priority = 18;        // FreeRTOS priority; on Linux SCHED_FIFO priority, 0 = default scheduler
+    uint32_t stack_size = 6144;
+    uint32_t period_us = 10000;
+  };
+
+  MediaTask() = default;
+  ~MediaTask() { this->stop(); }
+
+  bool start(const Config &config, std::function<void()> &&tick);
+  // Blocks until the task has finished its current tick and exited
+  void stop();
+  bool is_running() const { return this->running_.load(std::memory_order_acquire); }
+
+  uint32_t get_ticks() const { return this->ticks_.load(std::memory_order_relaxed); }
+  // largest lateness of a tick against its schedule, in microseconds
+  uint32_t get_max_lateness_us() const { return this->max_lateness_us_.load(std::memory_order_relaxed); }
+
+  // monotonic microsecond clock shared with the engine
+  static uint64_t now_us();
+
+ protected:
+  void run_();
+#ifdef ESP_PLATFORM
+  static void task_entry_(void *arg);
+  TaskHandle_t handle_ = nullptr;
+#else
+  static void *thread_entry_(void *arg);
+  pthread_t thread_{};
+#endif
+
+  Config config_{};
+  std::function<void()> tick_;
+  bool started_ = false;  // owned by the thread calling start()/stop()
+  std::atomic<bool> running_{false};
+  std::atomic<bool> stop_requested_{false};
+  std::atomic<uint32_t> ticks_{0};
+  std::atomic<uint32_t> max_lateness_us_{0};
+};
+
+}  // namespace voip
+}  // namespace esphome
@@ -0,0 +1,159 @@
+#include "mixer.h"
+#include <cstring>
+#include <new>
+
+namespace esphome {
+namespace voip {
+
+namespace {
+
+inline int16_t sat16(int32_t v) {
+  v = v < -32768 ? -32768 : v;
+  v = v > 32767 ? 32767 : v;
+  return (int16_t)v;
+}
+
+uint32_t mean_square(const int16_t *__restrict x, size_t n) {
+  int64_t acc = 0;
+  for (size_t i = 0; i < n; i++)
+    acc += (int32_t)x[i] * x[i];
+  return (uint32_t)(acc / (int64_t)n);
+}
+
+// part = sat16(x * gain); a product of two values below 2^15 always fits in 32 bits
+void scale(const int16_t *__restrict x, int16_t *__restrict part, size_t n, g711::Q15Gain gain) {
+  const int32_t m = gain.mantissa;
+  const int s = gain.shift;
+  for (size_t i = 0; i < n; i++)
+    part[i] = sat16(((int32_t)x[i] * m) >> s);
+}
+
+void accumulate(int32_t *__restrict sum, const int16_t *__restrict part, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    sum[i] += part[i];
+}
+
+void subtract(const int32_t *__restrict sum, const int16_t *__restrict part, int16_t *__restrict out, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    out[i] = sat16(sum[i] - part[i]);
+}
+
+}  // namespace
+
+bool ConferenceMixer::configure(size_t participants, size_t block_samples, size_t max_speakers) {
+  if (participants == 0 || participants > MAX_PARTICIPANTS || block_samples == 0)
+    return false;
+  if (max_speakers == 0 || max_speakers > MAX_SPEAKERS)
+    max_speakers = MAX_SPEAKERS;
+  if (max_speakers > participants)
+    max_speakers = participants;
+  this->in_.reset(new (std::nothrow) int16_t[participants * block_samples]);
+  this->part_.reset(new (std::nothrow) int16_t[max_speakers * block_samples]);
+  this->out_.reset(new (std::nothrow) int16_t[(max_speakers + 1) * block_samples]);
+  this->sum_.reset(new (std::nothrow) int32_t[block_samples]);
+  if (!this->in_ || !this->part_ || !this->out_ || !this->sum_) {
+    this->participants_ = 0;
+    return false;
+  }
+  this->participants_ = participants;
+  this->block_ = block_samples;
+  this->max_speakers_ = max_speakers;
+  memset(this->in_.get(), 0, sizeof(int16_t) * participants * block_samples);
+  memset(this->out_.get(), 0, sizeof(int16_t) * (max_speakers + 1) * block_samples);
+  for (size_t p = 0; p < MAX_PARTICIPANTS; p++)
+    this->gain_[p] = g711::q15_gain(1, 1);
+  this->reset();
+  return true;
+}
+
+void ConferenceMixer::set_gain(size_t participant, g711::Q15Gain gain) {
+  if (participant < MAX_PARTICIPANTS)
+    this->gain_[participant] = gain;
+}
+
+void ConferenceMixer::reset() {
+  this->speakers_ = 0;
+  for (size_t p = 0; p < MAX_PARTICIPANTS; p++) {
+    this->active_[p] = false;
+    this->level_[p] = 0;
+    this->slot_[p] = -1;
+  }
+}
+
+void ConferenceMixer::select_speakers_() {
+  bool taken[MAX_PARTICIPANTS] = {};
+  int8_t chosen[MAX_SPEAKERS];
+  size_t count = 0;
+  while (count < this->max_speakers_) {
+    int best = -1;
+    uint64_t best_score = 0;
+    for (size_t p = 0; p < this->participants_; p++) {
+      if (taken[p] || this->level_[p] < SILENCE_LEVEL)
+        continue;
+      // the current speakers count double: a newcomer has to be twice as loud to take a place
+      uint64_t score = (uint64_t)this->level_[p] << (this->slot_[p] >= 0 ? 1 : 0);
+      if (score > best_score) {
+        best = (int)p;
+        best_score = score;
+      }
+    }
+    if (best < 0)
+      break;
+    taken[best] = true;
+    chosen[count++] = (int8_t)best;
+  }
+  for (size_t p = 0; p < this->participants_; p++)
+    this->slot_[p] = -1;
+  for (size_t k = 0; k < count; k++)
+    this->slot_[chosen[k]] = (int8_t)k;
+  this->speakers_ = count;
+}
+
+void ConferenceMixer::mix() {
+  const size_t n = this->block_;
+  for (size_t p = 0; p < this->participants_; p++) {
+    // smoothed over about four blocks, so a pause between two words does not drop a speaker
+    uint32_t ms = this->active_[p] ? mean_square(this->input(p), n) : 0;
+    this->level_[p] = this->level_[p] - (this->level_[p] >> 2) + (ms >> 2);
+  }
+  this->select_speakers_();
+
+  int32_t *sum = this->sum_.get();
+  memset(sum, 0, sizeof(int32_t) * n);
+  for (size_t p = 0; p < this->participants_; p++) {
+    int k = this->slot_[p];
+    if (k < 0)
+      continue;
+    int16_t *part = this->part_.get() + k * n;
+    if (this->active_[p]) {
+      scale(this->input(p), part, n, this->gain_[p]);
+    } else {
+      // still picked on its smoothed level, but nothing arrived this block
+      memset(part, 0, sizeof(int16_t) * n);
+    }
+    accumulate(sum, part, n);
+  }
+  // everyone who is not speaking hears all speakers; every speaker hears the others
+  int16_t *common = this->out_.get() + this->max_speakers_ * n;
+  for (size_t i = 0; i < n; i++)
+    common[i] = sat16(sum[i]);
+  for (size_t k = 0; k < this->speakers_; k++)
+    subtract(sum, this->part_.get() + k * n, this->out_.get() + k * n, n);
+  for (size_t p = 0; p < this->participants_; p++)
+    this->active_[p] = false;
+}
+
+size_t ConferenceMixer::get_memory_size() const {
+  if (this->participants_ == 0)
+    return 0;
+  return sizeof(int16_t) * (this->participants_ + 2 * this->max_speakers_ + 1) * this->block_ +
+         sizeof(int32_t) * this->block_;
+}
+
+const int16_t *ConferenceMixer::output(size_t p) const {
+  int k = p < this->participants_ ? this->slot_[p] : -1;
+  return this->out_.get() + (k >= 0 ? (size_t)k : this->max_speakers_) * this->block_;
+}
+
+}  // namespace voip
+}  // namespace esphome
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "g711_gain.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace esphome {
+namespace voip {
+
+// Conference mixing of N participants on blocks of 16-bit PCM.
+//
+// Every participant, the calls and the local microphone/speaker alike, hands in one block per mix()
+// and gets back the sum of all the others, its N-1 mix, so nobody hears themselves. The sum is
+// accumulated once in 32 bits and each participant's own part is subtracted from it, O(N) per sample
+// instead of O(N^2); results saturate to int16. Every input has its own Q15 gain.
+//
+// Only the max_speakers loudest inputs are summed. That bounds the work per block and keeps the hiss
+// of silent lines out of the mix: input levels are smoothed over a few blocks, a speaker is only
+// displaced by an input twice as loud, and inputs below a silence floor are never picked. Everyone
+// who is not picked hears the same mix, computed once. The loops run over whole blocks without
+// branches so the compiler can vectorise them.
+class ConferenceMixer {
+ public:
+  static const size_t MAX_PARTICIPANTS = 9;
+  static const size_t MAX_SPEAKERS = 4;
+  // smoothed mean square below which an input counts as silent, about -54 dBFS
+  static const uint32_t SILENCE_LEVEL = 64;
+
+  // Allocates the blocks; false if there is not enough memory or the sizes are out of range. All
+  // participants start silent with unity gain.
+  bool configure(size_t participants, size_t block_samples, size_t max_speakers = 3);
+  size_t get_participants() const { return this->participants_; }
+  size_t get_block_samples() const { return this->block_; }
+  void set_gain(size_t participant, g711::Q15Gain gain);
+
+  // The block participant p contributes to the next mix(), block_samples samples
+  int16_t *input(size_t p) { return this->in_.get() + p * this->block_; }
+  // Whether input(p) holds audio for the next mix(); false for nothing to say (no packet due, no
+  // microphone data)
+  void set_active(size_t p, bool active) { this->active_[p] = active; }
+  void mix();
+  // Participant p's mix of everybody else, from the last mix()
+  const int16_t *output(size_t p) const;
+
+  bool is_speaker(size_t p) const { return this->slot_[p] >= 0; }
+  size_t get_speaker_count() const { return this->speakers_; }
+  // smoothed mean square of participant p's input
+  uint32_t get_level(size_t p) const { return this->level_[p]; }
+  // Forgets levels and speakers, e.g. when a new call joins
+  void reset();
+  // bytes allocated by configure()
+  size_t get_memory_size() const;
+
+ protected:
+  void select_speakers_();
+
+  size_t participants_ = 0;
+  size_t block_ = 0;
+  size_t max_speakers_ = 0;
+  size_t speakers_ = 0;
+  std::unique_ptr<int16_t[]> in_;
+  // the gained input of each speaker, then each speaker's mix, then the mix of everyone else
+  std::unique_ptr<int16_t[]> part_;
+  std::unique_ptr<int16_t[]> out_;
+  std::unique_ptr<int32_t[]> sum_;
+  g711::Q15Gain gain_[MAX_PARTICIPANTS];
+  bool active_[MAX_PARTICIPANTS] = {};
+  uint32_t level_[MAX_PARTICIPANTS] = {};
+  // part_/out_ slot of each speaker, -1 for the others
+  int8_t slot_[MAX_PARTICIPANTS];
+};
+
+}  // namespace voip
+}  // namespace esphome
@@ -0,0 +1,356 @@
+#include "noise_suppressor.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <new>
+
+namespace esphome {
+namespace voip {
+
+namespace {
+
+const size_t HALF = NoiseSuppressor::FFT_SIZE / 2;  // the complex FFT's length
+const int HALF_BITS = 7;
+
+// sin(x) for |x| <= 2 pi by its Taylor series, good to well below a Q15 step
+constexpr double sine(double x) {
+  const double PI = 3.14159265358979323846;
+  if (x > PI)
+    return -sine(x - PI);
+  if (x < -PI)
+    return -sine(x + PI);
+  double term = x, sum = x;
+  for (int k = 1; k < 14; k++) {
+    term *= -x * x / ((2 * k) * (2 * k + 1));
+    sum += term;
+  }
+  return sum;
+}
+
+// one itself does not fit, the FFT and the split step multiply by the unit twiddle as a plain copy
+constexpr int16_t q15(double v) {
+  return (int16_t)(v >= 0 ? std::min(32767, (int)(v * 32768 + 0.5)) : -(int)(-v * 32768 + 0.5));
+}
+
+template<size_t N> struct Table {
+  int16_t v[N];
+};
+
+// square-root Hann window over WINDOW samples: sin^2 + cos^2 makes analysis and synthesis with
+// 50 % overlap add up to one
+constexpr Table<NoiseSuppressor::WINDOW> make_window() {
+  Table<NoiseSuppressor::WINDOW> t{};
+  for (size_t n = 0; n < NoiseSuppressor::WINDOW; n++)
+    t.v[n] = q15(sine(3.14159265358979323846 * n / NoiseSuppressor::WINDOW));
+  return t;
+}
+
+// cos and sin of 2 pi k / FFT_SIZE for k < FFT_SIZE / 2: the split step's twiddles, every other
+// one the complex FFT's
+constexpr Table<HALF> make_cos() {
+  Table<HALF> t{};
+  for (size_t k = 0; k < HALF; k++)
+    t.v[k] = q15(sine(2 * 3.14159265358979323846 * k / NoiseSuppressor::FFT_SIZE + 3.14159265358979323846 / 2));
+  return t;
+}
+
+constexpr Table<HALF> make_sin() {
+  Table<HALF> t{};
+  for (size_t k = 0; k < HALF; k++)
+    t.v[k] = q15(sine(2 * 3.14159265358979323846 * k / NoiseSuppressor::FFT_SIZE));
+  return t;
+}
+
+struct BitReverse {
+  uint8_t v[HALF];
+};
+
+constexpr BitReverse make_bit_reverse() {
+  BitReverse t{};
+  for (size_t i = 0; i < HALF; i++) {
+    size_t r = 0;
+    for (int b = 0; b < HALF_BITS; b++)
+      r |= ((i >> b) & 1) << (HALF_BITS - 1 - b);
+    t.v[i] = (uint8_t)r;
+  }
+  return t;
+}
+
+constexpr Table<NoiseSuppressor::WINDOW> WINDOW_Q15 = make_window();
+constexpr Table<HALF> COS_Q15 = make_cos();
+constexpr Table<HALF> SIN_Q15 = make_sin();
+constexpr BitReverse BIT_REVERSE = make_bit_reverse();
+
+static_assert(WINDOW_Q15.v[NoiseSuppressor::WINDOW / 2] == 32767, "window peaks at one");
+static_assert(COS_Q15.v[HALF / 2] == 0 && SIN_Q15.v[HALF / 2] == 32767, "quarter turn");
+
+// the FFT's input is scaled to below 2^NORM_BITS, so its 7 stages and the split step stay in int32
+const int NORM_BITS = 21;
+// the a priori SNR is Q10, up to 30 dB of a posteriori SNR counts
+const int SNR_BITS = 10;
+const int32_t MAX_SNR = 1000 << SNR_BITS;
+// decision-directed weight of the previous frame's clean estimate, and the lowest a priori SNR
+// (-25 dB)
+const int32_t DD_WEIGHT_Q15 = 32113;
+const int32_t MIN_PRIOR_SNR = 3;
+// the noise follows the smoothed power down by a quarter of the way per block, and up by 1/64
+// while the power is within NOISE_RANGE of it. Once per MIN_WINDOW_BLOCKS, it is raised to the
+// window's minimum of the smoothed power times MIN_BIAS (minimum statistics), so a louder noise is
+// learned within a second or two even through speech.
+const int64_t NOISE_RANGE = 4;
+const uint32_t MIN_WINDOW_BLOCKS = 100;
+const int64_t MIN_BIAS = 4;
+// the minimum tracking above settles below the mean noise power; the gain rule uses it this much
+// higher (Q8)
+const int64_t NOISE_BIAS_Q8 = 384;
+// the first blocks are taken as noise, averaged
+const uint32_t STARTUP_BLOCKS = 10;
+
+// shifts re and im so their largest magnitude is below 2^bits; the shift applied, to the left
+int normalize(int32_t *re, int32_t *im, size_t n, int bits) {
+  uint32_t m = 1;
+  for (size_t i = 0; i < n; i++)
+    m |= (uint32_t)(re[i] < 0 ? -re[i] : re[i]) | (uint32_t)(im[i] < 0 ? -im[i] : im[i]);
+  int shift = bits - (32 - __builtin_clz(m));
+  if (shift > 0) {
+    for (size_t i = 0; i < n; i++) {
+      re[i] = (int32_t)((uint32_t)re[i] << shift);
+      im[i] = (int32_t)((uint32_t)im[i] << shift);
+    }
+  } else if (shift < 0) {
+    for (size_t i = 0; i < n; i++) {
+      re[i] >>= -shift;
+      im[i] >>= -shift;
+    }
+  }
+  return shift;
+}
+
+// in-place radix-2 FFT of HALF points, e^(-j...) kernel, no scaling: grows by up to HALF
+void fft(int32_t *re, int32_t *im) {
+  for (size_t i = 0; i < HALF; i++) {
+    size_t r = BIT_REVERSE.v[i];
+    if (r > i) {
+      int32_t t = re[i];
+      re[i] = re[r];
+      re[r] = t;
+      t = im[i];
+      im[i] = im[r];
+      im[r] = t;
+    }
+  }
+  for (size_t len = 2; len <= HALF; len <<= 1) {
+    size_t half = len / 2, step = NoiseSuppressor::FFT_SIZE / len;
+    for (size_t i = 0; i < HALF; i += len) {
+      int32_t tr = re[i + half], ti = im[i + half];
+      re[i + half] = re[i] - tr;
+      im[i + half] = im[i] - ti;
+      re[i] += tr;
+      im[i] += ti;
+      for (size_t j = 1; j < half; j++) {
+        int32_t wr = COS_Q15.v[j * step], wi = -SIN_Q15.v[j * step];
+        size_t a = i + j, b = a + half;
+        int32_t tr = (int32_t)(((int64_t)re[b] * wr - (int64_t)im[b] * wi) >> 15);
+        int32_t ti = (int32_t)(((int64_t)re[b] * wi + (int64_t)im[b] * wr) >> 15);
+        re[b] = re[a] - tr;
+        im[b] = im[a] - ti;
+        re[a] += tr;
+        im[a] += ti;
+      }
+    }
+  }
+}
+
+int16_t saturate(int32_t v) { return (int16_t)(v > 32767 ? 32767 : (v < -32768 ? -32768 : v)); }
+
+float power_dbov(int64_t bins_q8) {
+  // Parseval over the one-sided spectrum of a windowed frame: the mean square is the power summed
+  // over all FFT_SIZE bins, over FFT_SIZE times the window's energy (WINDOW / 2)
+  double ms = (double)bins_q8 / 256.0 / ((double)NoiseSuppressor::FFT_SIZE * NoiseSuppressor::WINDOW / 2);
+  return ms > 0 ? (float)(10.0 * std::log10(ms / (32768.0 * 32768.0))) : -96.0f;
+}
+
+}  // namespace
+
+struct NoiseSuppressor::State {
+  int16_t input[WINDOW];
+  // second half of the last block's output, waiting for the next one to be added
+  int32_t overlap[BLOCK];
+  // work area: the packed complex signal, then the spectrum (BINS in spec_re/spec_im)
+  int32_t re[HALF];
+  int32_t im[HALF];
+  int32_t spec_re[BINS];
+  int32_t spec_im[BINS];
+  // per bin, powers with 8 fractional bits
+  int64_t smoothed[BINS];
+  int64_t noise[BINS];
+  int64_t window_min[BINS];
+  // the previous frame's clean speech to noise ratio, Q10
+  int32_t prior[BINS];
+  int64_t noise_total;
+  int32_t gain_sum;
+};
+
+NoiseSuppressor::NoiseSuppressor() = default;
+NoiseSuppressor::~NoiseSuppressor() = default;
+
+bool NoiseSuppressor::configure(float max_attenuation_db) {
+  if (!this->state_) {
+    this->state_.reset(new (std::nothrow) State());
+    if (!this->state_)
+      return false;
+  }
+  this->max_attenuation_db_ = max_attenuation_db < 0.0f ? 0.0f : max_attenuation_db;
+  this->min_gain_q15_ = (int32_t)std::lrint(32768.0 * std::pow(10.0, -this->max_attenuation_db_ / 20.0));
+  this->reset();
+  return true;
+}
+
+void NoiseSuppressor::reset() {
+  if (this->state_)
+    memset(this->state_.get(), 0, sizeof(State));
+  this->blocks_ = 0;
+}
+
+size_t NoiseSuppressor::get_memory_size() const { return this->state_ ? sizeof(State) : 0; }
+
+void NoiseSuppressor::process(int16_t *pcm, size_t n) {
+  if (!this->state_)
+    return;
+  for (size_t at = 0; at + BLOCK <= n; at += BLOCK)
+    this->process_block_(pcm + at);
+}
+
+void NoiseSuppressor::process_block_(int16_t *pcm) {
+  State &s = *this->state_;
+  memmove(s.input, s.input + BLOCK, sizeof(int16_t) * (WINDOW - BLOCK));
+  memcpy(s.input + WINDOW - BLOCK, pcm, sizeof(int16_t) * BLOCK);
+
+  // windowed and zero-padded to FFT_SIZE, even samples real, odd ones imaginary
+  for (size_t i = 0; i < HALF; i++) {
+    size_t e = 2 * i, o = e + 1;
+    s.re[i] = e < WINDOW ? (s.input[e] * WINDOW_Q15.v[e]) >> 15 : 0;
+    s.im[i] = o < WINDOW ? (s.input[o] * WINDOW_Q15.v[o]) >> 15 : 0;
+  }
+  int in_shift = normalize(s.re, s.im, HALF, NORM_BITS);
+  fft(s.re, s.im);
+
+  // split: the real FFT from the complex one of even and odd samples
+  s.spec_re[0] = s.re[0] + s.im[0];
+  s.spec_im[0] = 0;
+  s.spec_re[HALF] = s.re[0] - s.im[0];
+  s.spec_im[HALF] = 0;
+  for (size_t k = 1; k < HALF; k++) {
+    int32_t ar = s.re[k], ai = s.im[k], br = s.re[HALF - k], bi = s.im[HALF - k];
+    int32_t er = (ar + br) / 2, ei = (ai - bi) / 2;
+    int32_t orr = (ai + bi) / 2, oi = (br - ar) / 2;
+    int32_t c = COS_Q15.v[k], sn = SIN_Q15.v[k];
+    s.spec_re[k] = er + (int32_t)(((int64_t)orr * c + (int64_t)oi * sn) >> 15);
+    s.spec_im[k] = ei + (int32_t)(((int64_t)oi * c - (int64_t)orr * sn) >> 15);
+  }
+
+  // powers back at the input's scale, 8 fractional bits
+  int power_shift = 2 * in_shift - 8;
+  bool startup = this->blocks_ < STARTUP_BLOCKS;
+  bool window_end = (this->blocks_ + 1) % MIN_WINDOW_BLOCKS == 0;
+  int64_t noise_total = 0;
+  int32_t gain_sum = 0;
+  for (size_t k = 0; k < BINS; k++) {
+    int64_t p = (int64_t)s.spec_re[k] * s.spec_re[k] + (int64_t)s.spec_im[k] * s.spec_im[k];
+    p = power_shift >= 0 ? p >> power_shift : p << -power_shift;
+    int64_t &sm = s.smoothed[k];
+    int64_t &noise = s.noise[k];
+    sm += (p - sm) / 2;
+    if (startup) {
+      noise += (p - noise) / (int64_t)(this->blocks_ + 1);
+    } else if (sm < noise) {
+      noise += (sm - noise) / 4;
+    } else if (sm < noise * NOISE_RANGE) {
+      noise += (sm - noise) / 64;
+    }
+    int64_t &window_min = s.window_min[k];
+    if (this->blocks_ % MIN_WINDOW_BLOCKS == 0 || sm < window_min)
+      window_min = sm;
+    if (window_end && window_min * MIN_BIAS > noise)
+      noise = window_min * MIN_BIAS;
+    if (noise < 1)
+      noise = 1;
+
+    // a posteriori SNR, the a priori one decision-directed, and the Wiener gain from it
+    int64_t n_biased = (noise * NOISE_BIAS_Q8) >> 8;
+    noise_total += (k == 0 || k == HALF) ? n_biased : 2 * n_biased;
+    int64_t post64 = (p << SNR_BITS) / (n_biased > 0 ? n_biased : 1);
+    int32_t post = post64 > MAX_SNR ? MAX_SNR : (int32_t)post64;
+    int32_t ml = post > (1 << SNR_BITS) ? post - (1 << SNR_BITS) : 0;
+    int32_t prior = (int32_t)(((int64_t)s.prior[k] * DD_WEIGHT_Q15 + (int64_t)ml * (32768 - DD_WEIGHT_Q15)) >> 15);
+    if (prior < MIN_PRIOR_SNR)
+      prior = MIN_PRIOR_SNR;
+    int32_t gain = 32768 - (int32_t)(((int64_t)1 << (SNR_BITS + 15)) / (prior + (1 << SNR_BITS)));
+    if (gain < this->min_gain_q15_)
+      gain = this->min_gain_q15_;
+    // the clean estimate this frame leaves for the next: gain^2 times the a posteriori SNR
+    int32_t g2 = (int32_t)(((int64_t)gain * gain) >> 15);
+    s.prior[k] = (int32_t)(((int64_t)g2 * post) >> 15);
+    gain_sum += gain;
+
+    s.spec_re[k] = (int32_t)(((int64_t)s.spec_re[k] * gain) >> 15);
+    s.spec_im[k] = (int32_t)(((int64_t)s.spec_im[k] * gain) >> 15);
+  }
+  s.noise_total = noise_total;
+  s.gain_sum = gain_sum;
+  this->blocks_++;
+
+  // inverse split: even and odd samples' spectra packed into one complex one again
+  s.re[0] = (s.spec_re[0] + s.spec_re[HALF]) / 2;
+  s.im[0] = -(s.spec_re[0] - s.spec_re[HALF]) / 2;
+  for (size_t k = 1; k < HALF; k++) {
+    int32_t xr = s.spec_re[k], xi = s.spec_im[k], yr = s.spec_re[HALF - k], yi = s.spec_im[HALF - k];
+    int32_t er = (xr + yr) / 2, ei = (xi - yi) / 2;
+    int32_t dr = (xr - yr) / 2, di = (xi + yi) / 2;
+    int32_t c = COS_Q15.v[k], sn = SIN_Q15.v[k];
+    int32_t orr = (int32_t)(((int64_t)dr * c - (int64_t)di * sn) >> 15);
+    int32_t oi = (int32_t)(((int64_t)dr * sn + (int64_t)di * c) >> 15);
+    s.re[k] = er - oi;
+    // conjugated for the inverse through the forward FFT
+    s.im[k] = -(ei + orr);
+  }
+  int out_shift = normalize(s.re, s.im, HALF, NORM_BITS);
+  fft(s.re, s.im);
+  // the FFT gained HALF, both normalisations come off again
+  int shift = HALF_BITS + in_shift + out_shift;
+  int64_t round = shift > 0 ? (int64_t)1 << (shift - 1) : 0;
+
+  for (size_t i = 0; i < BLOCK; i++) {
+    // sample n sits in re[n / 2] (even) or -im[n / 2] (odd), conjugated back
+    int32_t v = (i & 1) ? -s.im[i / 2] : s.re[i / 2];
+    int32_t w = (int32_t)((v + round) >> shift);
+    int32_t y = (w * WINDOW_Q15.v[i]) >> 15;
+    pcm[i] = saturate(s.overlap[i] + y);
+  }
+  for (size_t i = BLOCK; i < WINDOW; i++) {
+    int32_t v = (i & 1) ? -s.im[i / 2] : s.re[i / 2];
+    int32_t w = (int32_t)((v + round) >> shift);
+    s.overlap[i - BLOCK] = (w * WINDOW_Q15.v[i]) >> 15;
+  }
+}
+
+float NoiseSuppressor::get_noise_dbov() const {
+  if (!this->state_ || this->blocks_ == 0)
+    return -96.0f;
+  return power_dbov(this->state_->noise_total);
+}
+
+float NoiseSuppressor::get_output_noise_dbov() const {
+  // in the pauses every bin sits at the floor
+  float level = this->get_noise_dbov() - this->max_attenuation_db_;
+  return level < -96.0f ? -96.0f : level;
+}
+
+float NoiseSuppressor::get_gain_db() const {
+  if (!this->state_ || this->blocks_ == 0)
+    return 0.0f;
+  return 20.0f * std::log10((float)this->state_->gain_sum / (BINS * 32768.0f));
+}
+
+}  // namespace voip
+}  // namespace esphome
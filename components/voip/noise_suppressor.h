@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace esphome {
+namespace voip {
+
+// Noise suppressor for the 8 kHz microphone: a Wiener filter per frequency bin of a short-time
+// spectrum, against a noise spectrum it learns on its own.
+//
+// Every 10 ms (BLOCK) the last 20 ms (WINDOW) go through a square-root Hann window and a 256-point
+// real FFT (a 128-point complex one and a split step), in fixed point with block floating point.
+// The noise power per bin follows the smoothed power down quickly and, while it stays close, up
+// slowly, so it settles on the noise between syllables and keeps it through speech; the minimum of
+// every second lifts it when the noise got louder (minimum statistics). The gain per bin comes from
+// the a priori SNR estimated decision-directed (Ephraim and Malah): the previous frame's clean
+// estimate weighs 98 %, which keeps the residual noise from warbling ("musical noise"). No bin is
+// turned down by more than max_attenuation_db. The inverse FFT, the same window again and
+// overlap-add give the output DELAY samples (10 ms) late.
+//
+// The noise estimate is there for others too: get_output_noise_dbov() is the level the suppressor
+// leaves of the noise, which is what a voice activity detector after it sees in the pauses.
+class NoiseSuppressor {
+ public:
+  static const size_t BLOCK = 80;  // 10 ms
+  static const size_t WINDOW = 2 * BLOCK;
+  static const size_t FFT_SIZE = 256;
+  static const size_t BINS = FFT_SIZE / 2 + 1;
+  static const size_t DELAY = WINDOW - BLOCK;
+
+  NoiseSuppressor();
+  ~NoiseSuppressor();
+
+  // Allocates the state; false if there is not enough memory
+  bool configure(float max_attenuation_db);
+  void reset();
+  size_t get_memory_size() const;
+
+  // Suppresses noise in place; n must be a multiple of BLOCK, samples beyond pass unchanged
+  void process(int16_t *pcm, size_t n);
+
+  // noise level in the input and what is left of it in the output, dBov (0 for a full-scale
+  // square wave), from the last block
+  float get_noise_dbov() const;
+  float get_output_noise_dbov() const;
+  // mean gain over the bins in the last block, dB
+  float get_gain_db() const;
+
+ protected:
+  struct State;
+  void process_block_(int16_t *pcm);
+
+  std::unique_ptr<State> state_;
+  // Q15
+  int32_t min_gain_q15_ = 32768;
+  float max_attenuation_db_ = 0.0f;
+  uint32_t blocks_ = 0;
+};
+
+}  // namespace voip
+}  // namespace esphome
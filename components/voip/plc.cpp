@@ -0,0 +1,193 @@
+#include "plc.h"
+#include <cmath>
+#include <cstring>
+
+namespace esphome {
+namespace voip {
+
+namespace {
+
+// the last 20 ms are compared with the signal one to three periods earlier
+const size_t CORR_LEN = 160;
+const size_t CORR_BUF = CORR_LEN + PacketLossConcealer::PITCH_MAX;
+const size_t PITCH_RANGE = PacketLossConcealer::PITCH_MAX - PacketLossConcealer::PITCH_MIN;
+// the coarse search looks at every second sample and lag
+const size_t DECIMATION = 2;
+// keeps near-silence from winning the normalised correlation
+const int64_t CORR_MIN_ENERGY = 250;
+// the cross-fade into a received frame grows by 4 ms per 10 ms lost
+const size_t RECOVERY_OVERLAP_STEP = 32;
+// attenuation in 1/400: 20 % per 10 ms is 80 per frame, 1 per sample
+const int32_t FADE_UNIT = 400;
+const int32_t FADE_PER_FRAME = 80;
+// steps after which the concealment is silent (60 ms)
+const uint32_t MAX_ERASED = 5;
+
+float normalized(int64_t corr, int64_t energy) {
+  return (float)corr / sqrtf((float)(energy < CORR_MIN_ENERGY ? CORR_MIN_ENERGY : energy));
+}
+
+int64_t dot(const int16_t *a, const int16_t *b, size_t n, size_t step) {
+  int64_t acc = 0;
+  for (size_t i = 0; i < n; i += step)
+    acc += (int32_t)a[i] * b[i];
+  return acc;
+}
+
+// out = a fading out into b fading in; a convex mix of two int16 values needs no saturation
+void cross_fade(const int16_t *a, const int16_t *b, int16_t *out, size_t n) {
+  const int32_t len = (int32_t)n;
+  for (int32_t i = 0; i < len; i++)
+    out[i] = (int16_t)((a[i] * (len - 1 - i) + b[i] * (i + 1)) / len);
+}
+
+}  // namespace
+
+void PacketLossConcealer::reset() { *this = PacketLossConcealer{}; }
+
+void PacketLossConcealer::receive(int16_t *pcm, size_t n) {
+  while (n > 0) {
+    // 10 ms at a time; a remainder below 10 ms goes with the last step
+    size_t step = n < 2 * FRAME ? n : FRAME;
+    this->receive_step_(pcm, step);
+    pcm += step;
+    n -= step;
+  }
+}
+
+void PacketLossConcealer::conceal(int16_t *pcm, size_t n) {
+  while (n > 0) {
+    size_t step = n < 2 * FRAME ? n : FRAME;
+    this->conceal_step_(pcm, step);
+    pcm += step;
+    n -= step;
+  }
+}
+
+void PacketLossConcealer::receive_step_(int16_t *pcm, size_t n) {
+  if (this->erased_ != 0) {
+    // the repetition fades out over the start of the received frame, at the level it had reached
+    int16_t tail[FRAME];
+    size_t len = this->overlap_ + (this->erased_ - 1) * RECOVERY_OVERLAP_STEP;
+    len = len > FRAME ? FRAME : len;
+    len = len > n ? n : len;
+    this->repeat_(tail, len);
+    const int32_t gain = this->erased_ > MAX_ERASED ? 0 : (int32_t)(MAX_ERASED + 1 - this->erased_);
+    const int32_t full = (int32_t)(MAX_ERASED * len);
+    for (size_t i = 0; i < len; i++) {
+      int32_t t = tail[i] * (int32_t)(len - 1 - i) * gain + pcm[i] * (int32_t)(i + 1) * (int32_t)MAX_ERASED;
+      pcm[i] = (int16_t)(t / full);
+    }
+    this->erased_ = 0;
+  }
+  this->save_(pcm, n);
+}
+
+void PacketLossConcealer::conceal_step_(int16_t *pcm, size_t n) {
+  int16_t *end = this->pitch_buf_ + HISTORY;
+  if (this->erased_ == 0) {
+    memcpy(this->pitch_buf_, this->history_, sizeof(this->history_));
+    this->pitch_ = this->find_pitch_();
+    this->overlap_ = this->pitch_ / 4;
+    memcpy(this->last_quarter_, end - this->overlap_, sizeof(int16_t) * this->overlap_);
+    this->loop_len_ = this->pitch_;
+    this->loop_pos_ = 0;
+    // the end of the history runs into the period before it, so the loop has no seam
+    cross_fade(this->last_quarter_, end - this->loop_len_ - this->overlap_, end - this->overlap_, this->overlap_);
+    // those samples are still in the delay line and come out cross-faded too
+    memcpy(this->history_ + HISTORY - this->overlap_, end - this->overlap_, sizeof(int16_t) * this->overlap_);
+    this->repeat_(pcm, n);
+  } else if (this->erased_ <= 2) {
+    // one more period in the loop; the old loop fades into the new one
+    int16_t tail[OVERLAP_MAX];
+    size_t pos = this->loop_pos_;
+    this->repeat_(tail, this->overlap_);
+    this->loop_pos_ = pos;
+    while (this->loop_pos_ > this->pitch_)
+      this->loop_pos_ -= this->pitch_;
+    this->loop_len_ += this->pitch_;
+    cross_fade(this->last_quarter_, end - this->loop_len_ - this->overlap_, end - this->overlap_, this->overlap_);
+    this->repeat_(pcm, n);
+    cross_fade(tail, pcm, pcm, this->overlap_ < n ? this->overlap_ : n);
+    this->fade_(pcm, n);
+  } else if (this->erased_ > MAX_ERASED) {
+    memset(pcm, 0, sizeof(int16_t) * n);
+  } else {
+    this->repeat_(pcm, n);
+    this->fade_(pcm, n);
+  }
+  this->erased_++;
+  this->concealed_samples_ += n;
+  this->save_(pcm, n);
+}
+
+size_t PacketLossConcealer::find_pitch_() const {
+  const int16_t *end = this->pitch_buf_ + HISTORY;
+  const int16_t *l = end - CORR_LEN;
+  // coarse: every second lag on every second sample
+  const int16_t *r = end - CORR_BUF;
+  int64_t energy = 0;
+  for (size_t i = 0; i < CORR_LEN; i += DECIMATION)
+    energy += (int32_t)r[i] * r[i];
+  float best = normalized(dot(r, l, CORR_LEN, DECIMATION), energy);
+  size_t best_lag = 0;
+  for (size_t j = DECIMATION; j <= PITCH_RANGE; j += DECIMATION) {
+    energy -= (int32_t)r[0] * r[0];
+    energy += (int32_t)r[CORR_LEN] * r[CORR_LEN];
+    r += DECIMATION;
+    float c = normalized(dot(r, l, CORR_LEN, DECIMATION), energy);
+    if (c >= best) {
+      best = c;
+      best_lag = j;
+    }
+  }
+  // fine: the neighbouring lags on every sample
+  size_t lo = best_lag >= DECIMATION - 1 ? best_lag - (DECIMATION - 1) : 0;
+  size_t hi = best_lag + (DECIMATION - 1) > PITCH_RANGE ? PITCH_RANGE : best_lag + (DECIMATION - 1);
+  r = end - CORR_BUF + lo;
+  energy = 0;
+  for (size_t i = 0; i < CORR_LEN; i++)
+    energy += (int32_t)r[i] * r[i];
+  best = normalized(dot(r, l, CORR_LEN, 1), energy);
+  best_lag = lo;
+  for (size_t j = lo + 1; j <= hi; j++) {
+    energy -= (int32_t)r[0] * r[0];
+    energy += (int32_t)r[CORR_LEN] * r[CORR_LEN];
+    r++;
+    float c = normalized(dot(r, l, CORR_LEN, 1), energy);
+    if (c > best) {
+      best = c;
+      best_lag = j;
+    }
+  }
+  return PITCH_MAX - best_lag;
+}
+
+void PacketLossConcealer::repeat_(int16_t *out, size_t n) {
+  const int16_t *start = this->pitch_buf_ + HISTORY - this->loop_len_;
+  while (n > 0) {
+    size_t cnt = this->loop_len_ - this->loop_pos_;
+    cnt = cnt > n ? n : cnt;
+    memcpy(out, start + this->loop_pos_, sizeof(int16_t) * cnt);
+    this->loop_pos_ += cnt;
+    if (this->loop_pos_ == this->loop_len_)
+      this->loop_pos_ = 0;
+    out += cnt;
+    n -= cnt;
+  }
+}
+
+void PacketLossConcealer::fade_(int16_t *pcm, size_t n) const {
+  int32_t gain = FADE_UNIT - FADE_PER_FRAME * (int32_t)(this->erased_ - 1);
+  for (size_t i = 0; i < n; i++, gain--)
+    pcm[i] = gain > 0 ? (int16_t)(pcm[i] * gain / FADE_UNIT) : 0;
+}
+
+void PacketLossConcealer::save_(int16_t *pcm, size_t n) {
+  memmove(this->history_, this->history_ + n, sizeof(int16_t) * (HISTORY - n));
+  memcpy(this->history_ + HISTORY - n, pcm, sizeof(int16_t) * n);
+  memcpy(pcm, this->history_ + HISTORY - n - DELAY, sizeof(int16_t) * n);
+}
+
+}  // namespace voip
+}  // namespace esphome
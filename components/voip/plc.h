@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace voip {
+
+// Packet loss concealment for 8 kHz audio after the decoder, the algorithm of ITU-T G.711
+// Appendix I: a lost frame is replaced by the last pitch period of the received signal, repeated.
+// After 10 ms one more period goes into the loop, after 20 ms a third, which keeps a long loss
+// from buzzing; from the second 10 ms on the signal fades by 20 % per 10 ms and is silent after
+// 60 ms. Where the repetition starts and where the next received frame takes over, a quarter
+// period (more after a longer loss) is cross-faded, so neither end clicks.
+//
+// The cross-fade at the start needs signal that was not played yet, so all audio leaves this class
+// DELAY samples (3.75 ms) late, received or concealed. Frames of any length are taken and worked
+// in 10 ms steps. The pitch search runs once per loss, in floating point; everything per sample
+// is integer.
+class PacketLossConcealer {
+ public:
+  static const size_t FRAME = 80;  // 10 ms
+  static const size_t PITCH_MIN = 40;   // 200 Hz
+  static const size_t PITCH_MAX = 120;  // 66.7 Hz
+  static const size_t OVERLAP_MAX = PITCH_MAX / 4;
+  static const size_t DELAY = OVERLAP_MAX;
+  // three pitch periods and the overlap in front of them
+  static const size_t HISTORY = 3 * PITCH_MAX + OVERLAP_MAX;
+
+  void reset();
+  // A received frame: goes into the history and comes back in place, delayed by DELAY samples and
+  // blended with the concealment if frames were lost before it
+  void receive(int16_t *pcm, size_t n);
+  // Writes n samples standing in for a frame that did not arrive
+  void conceal(int16_t *pcm, size_t n);
+
+  bool is_concealing() const { return this->erased_ != 0; }
+  // pitch period in samples found at the start of the last loss
+  size_t get_pitch() const { return this->pitch_; }
+  uint32_t get_concealed_samples() const { return this->concealed_samples_; }
+
+ protected:
+  void receive_step_(int16_t *pcm, size_t n);
+  void conceal_step_(int16_t *pcm, size_t n);
+  size_t find_pitch_() const;
+  // the next n samples of the repeated pitch periods
+  void repeat_(int16_t *out, size_t n);
+  void fade_(int16_t *pcm, size_t n) const;
+  // appends n samples to the history and replaces them with the delayed output
+  void save_(int16_t *pcm, size_t n);
+
+  int16_t history_[HISTORY] = {};
+  // copy of the history at the start of a loss, the repeated periods at its end
+  int16_t pitch_buf_[HISTORY] = {};
+  // end of the history before the cross-fade, for the periods added later
+  int16_t last_quarter_[OVERLAP_MAX] = {};
+  size_t pitch_ = PITCH_MAX;
+  size_t overlap_ = 0;
+  // repeated length (one to three periods) and the read position in it
+  size_t loop_len_ = 0;
+  size_t loop_pos_ = 0;
+  // 10 ms steps lost in a row
+  uint32_t erased_ = 0;
+  uint32_t concealed_samples_ = 0;
+};
+
+}  // namespace voip
+}  // namespace esphome
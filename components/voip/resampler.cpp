@@ -0,0 +1,241 @@
+#include "resampler.h"
+#include <cstring>
+
+namespace esphome {
+namespace voip {
+
+namespace {
+
+constexpr double PI = 3.14159265358979323846;
+
+// sin(x) by its Taylor series after reducing x to [-pi, pi]
+constexpr double sine(double x) {
+  long long turns = (long long)(x / (2 * PI));
+  x -= turns * 2 * PI;
+  if (x > PI)
+    x -= 2 * PI;
+  if (x < -PI)
+    x += 2 * PI;
+  double term = x, sum = x;
+  for (int k = 1; k < 14; k++) {
+    term *= -x * x / ((2 * k) * (2 * k + 1));
+    sum += term;
+  }
+  return sum;
+}
+
+constexpr double square_root(double x) {
+  if (x <= 0)
+    return 0;
+  double r = x > 1 ? x : 1;
+  for (int i = 0; i < 40; i++)
+    r = (r + x / r) / 2;
+  return r;
+}
+
+// modified Bessel function of the first kind, order zero
+constexpr double bessel_i0(double x) {
+  double term = 1, sum = 1;
+  for (int k = 1; k < 40; k++) {
+    term *= (x / (2 * k)) * (x / (2 * k));
+    sum += term;
+  }
+  return sum;
+}
+
+const int TAP_BITS = 15;
+
+// tap k of an N-tap lowpass at cutoff (relative to half the sample rate) with a Kaiser window of
+// beta, before normalization
+constexpr double lowpass(size_t k, size_t n, double cutoff, double beta) {
+  double c = (n - 1) / 2.0;
+  double t = k - c;
+  double sinc = t == 0 ? cutoff : sine(PI * cutoff * t) / (PI * t);
+  double r = t / c;
+  return sinc * bessel_i0(beta * square_root(1 - r * r)) / bessel_i0(beta);
+}
+
+// with an even number of taps no tap of a phase comes near one, which would not fit
+constexpr int16_t q15(double v) { return (int16_t)(v >= 0 ? (int)(v * 32768 + 0.5) : -(int)(-v * 32768 + 0.5)); }
+
+template<size_t N> struct Taps {
+  int16_t v[N];
+};
+
+// the whole filter at the higher rate, for decimation
+template<size_t N> constexpr Taps<N> make_decimator(double cutoff, double beta) {
+  double h[N] = {};
+  double sum = 0;
+  for (size_t k = 0; k < N; k++) {
+    h[k] = lowpass(k, N, cutoff, beta);
+    sum += h[k];
+  }
+  Taps<N> t{};
+  for (size_t k = 0; k < N; k++)
+    t.v[k] = q15(h[k] / sum);
+  return t;
+}
+
+// the same filter split into L phases of N / L taps, each scaled by L and reversed, so that output
+// sample L * n + p is the dot product of phase p with the N / L newest inputs, oldest first
+template<size_t L, size_t N> constexpr Taps<N> make_interpolator(double cutoff, double beta) {
+  const size_t K = N / L;
+  double h[N] = {};
+  double sum = 0;
+  for (size_t k = 0; k < N; k++) {
+    h[k] = lowpass(k, N, cutoff, beta);
+    sum += h[k];
+  }
+  Taps<N> t{};
+  for (size_t p = 0; p < L; p++) {
+    for (size_t i = 0; i < K; i++)
+      t.v[p * K + i] = q15(L * h[p + (K - 1 - i) * L] / sum);
+  }
+  return t;
+}
+
+// a dot product sums each half of the taps in an int32 of its own: neither can overflow while the
+// magnitudes of its taps add up to less than 2^31 / 2^15
+template<size_t N> constexpr bool halves_fit(const Taps<N> &t, size_t from, size_t count) {
+  long first = 0, second = 0;
+  for (size_t k = 0; k < count / 2; k++) {
+    first += t.v[from + k] < 0 ? -t.v[from + k] : t.v[from + k];
+    second += t.v[from + count / 2 + k] < 0 ? -t.v[from + count / 2 + k] : t.v[from + count / 2 + k];
+  }
+  return first < 65536 && second < 65536;
+}
+
+// 2:1 at 16 kHz: half-band around 4 kHz, 3.4 kHz passes and 4.6 kHz is stopped. The window is
+// for 75 dB, what 64 taps make of that transition; Q15 taps leave about 70 dB of it.
+const size_t TAPS_2 = 64;
+constexpr double BETA_2 = 7.3;
+// 3:1 at 48 kHz: around 8 kHz, 7 kHz passes and 9 kHz is stopped
+const size_t TAPS_3 = 144;
+constexpr double BETA_3 = 8.0;
+
+constexpr Taps<TAPS_2> DOWN_2 = make_decimator<TAPS_2>(1.0 / 2, BETA_2);
+constexpr Taps<TAPS_2> UP_2 = make_interpolator<2, TAPS_2>(1.0 / 2, BETA_2);
+constexpr Taps<TAPS_3> DOWN_3 = make_decimator<TAPS_3>(1.0 / 3, BETA_3);
+constexpr Taps<TAPS_3> UP_3 = make_interpolator<3, TAPS_3>(1.0 / 3, BETA_3);
+
+// halves of whole multiples of eight int16, so that compilers vectorize without a remainder loop
+static_assert(TAPS_2 % 32 == 0 && TAPS_3 % 48 == 0, "every half of a dot product is a multiple of eight taps");
+static_assert(halves_fit(DOWN_2, 0, TAPS_2) && halves_fit(DOWN_3, 0, TAPS_3), "decimator overflows");
+static_assert(halves_fit(UP_2, 0, TAPS_2 / 2) && halves_fit(UP_2, TAPS_2 / 2, TAPS_2 / 2), "interpolator overflows");
+static_assert(halves_fit(UP_3, 0, TAPS_3 / 3) && halves_fit(UP_3, TAPS_3 / 3, TAPS_3 / 3) &&
+                  halves_fit(UP_3, 2 * TAPS_3 / 3, TAPS_3 / 3),
+              "interpolator overflows");
+static_assert(TAPS_3 - 1 + 2 <= 160, "the stage buffer holds the history");
+
+// N taps against N samples, rounded and saturated; the two halves are independent sums
+template<size_t N> inline int16_t dot(const int16_t *__restrict taps, const int16_t *__restrict x) {
+  int32_t first = 0, second = 0;
+  for (size_t i = 0; i < N / 2; i++) {
+    first += (int32_t)taps[i] * x[i];
+    second += (int32_t)taps[N / 2 + i] * x[N / 2 + i];
+  }
+  int32_t acc = ((first >> 1) + (second >> 1) + (1 << (TAP_BITS - 2))) >> (TAP_BITS - 1);
+  return (int16_t)(acc > 32767 ? 32767 : (acc < -32768 ? -32768 : acc));
+}
+
+// buf holds the N - 1 or more samples before the new ones; what does not make a whole output
+// sample stays for the next call
+template<size_t M, size_t N>
+size_t decimate(int16_t *buf, size_t &fill, const int16_t *in, size_t n, int16_t *out, const int16_t *taps) {
+  std::memcpy(buf + fill, in, n * sizeof(int16_t));
+  fill += n;
+  size_t count = 0;
+  size_t at = 0;
+  for (; at + N <= fill; at += M)
+    out[count++] = dot<N>(taps, buf + at);
+  std::memmove(buf, buf + at, (fill - at) * sizeof(int16_t));
+  fill -= at;
+  return count;
+}
+
+// buf holds the N / L - 1 samples before the new ones
+template<size_t L, size_t N>
+size_t interpolate(int16_t *buf, size_t &fill, const int16_t *in, size_t n, int16_t *out, const int16_t *taps) {
+  const size_t K = N / L;
+  std::memcpy(buf + fill, in, n * sizeof(int16_t));
+  fill += n;
+  size_t count = 0;
+  for (size_t i = 0; i + K <= fill; i++) {
+    for (size_t p = 0; p < L; p++)
+      out[count++] = dot<K>(taps + p * K, buf + i);
+  }
+  std::memmove(buf, buf + fill - (K - 1), (K - 1) * sizeof(int16_t));
+  fill = K - 1;
+  return count;
+}
+
+}  // namespace
+
+bool Resampler::configure(uint32_t in_hz, uint32_t out_hz) {
+  auto known = [](uint32_t hz) { return hz == 8000 || hz == 16000 || hz == 48000; };
+  if (!known(in_hz) || !known(out_hz))
+    return false;
+  this->in_hz_ = in_hz;
+  this->out_hz_ = out_hz;
+  this->stages_ = 0;
+  // 16 kHz is the step between 8 and 48 kHz either way
+  uint32_t hz = in_hz;
+  while (hz != out_hz) {
+    Stage &stage = this->stage_[this->stages_++];
+    stage.up = out_hz > hz;
+    stage.factor = (hz == 48000 || (stage.up && hz == 16000)) ? 3 : 2;
+    hz = stage.up ? hz * stage.factor : hz / stage.factor;
+  }
+  // 8 to 48 kHz: the 3:1 stage takes what the 2:1 stage made of a chunk
+  this->chunk_ = this->stages_ == 2 && this->stage_[0].up ? CHUNK / this->stage_[0].factor : CHUNK;
+  this->reset();
+  return true;
+}
+
+void Resampler::reset() {
+  for (size_t s = 0; s < this->stages_; s++) {
+    Stage &stage = this->stage_[s];
+    size_t taps = stage.factor == 2 ? TAPS_2 : TAPS_3;
+    stage.fill = stage.up ? taps / stage.factor - 1 : taps - 1;
+    std::memset(stage.buf, 0, sizeof(stage.buf));
+  }
+}
+
+size_t Resampler::get_output_samples(size_t n) const {
+  for (size_t s = 0; s < this->stages_; s++)
+    n = this->stage_[s].up ? n * this->stage_[s].factor : (n + this->stage_[s].factor - 1) / this->stage_[s].factor;
+  return n;
+}
+
+size_t Resampler::run_stage_(Stage &stage, const int16_t *in, size_t n, int16_t *out) {
+  if (stage.factor == 2) {
+    return stage.up ? interpolate<2, TAPS_2>(stage.buf, stage.fill, in, n, out, UP_2.v)
+                    : decimate<2, TAPS_2>(stage.buf, stage.fill, in, n, out, DOWN_2.v);
+  }
+  return stage.up ? interpolate<3, TAPS_3>(stage.buf, stage.fill, in, n, out, UP_3.v)
+                  : decimate<3, TAPS_3>(stage.buf, stage.fill, in, n, out, DOWN_3.v);
+}
+
+size_t Resampler::process(const int16_t *in, size_t n, int16_t *out) {
+  if (this->stages_ == 0) {
+    std::memcpy(out, in, n * sizeof(int16_t));
+    return n;
+  }
+  size_t written = 0;
+  int16_t between[CHUNK];
+  while (n > 0) {
+    size_t m = n < this->chunk_ ? n : this->chunk_;
+    if (this->stages_ == 1) {
+      written += run_stage_(this->stage_[0], in, m, out + written);
+    } else {
+      size_t k = run_stage_(this->stage_[0], in, m, between);
+      written += run_stage_(this->stage_[1], between, k, out + written);
+    }
+    in += m;
+    n -= m;
+  }
+  return written;
+}
+
+}  // namespace voip
+}  // namespace esphome
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace voip {
+
+// Sample rate converter between the 8 kHz of the call and the 16 or 48 kHz an I2S microphone or
+// speaker runs at, 16-bit mono, in blocks of any length.
+//
+// The conversion is a cascade of polyphase FIR stages of 2 (8 <-> 16 kHz) and 3 (16 <-> 48 kHz):
+// 48 kHz goes down to 8 kHz through 16 kHz and comes up the same way. The 2:1 filter passes up to
+// 3.4 kHz and stops from 4.6 kHz, the 3:1 filter passes up to 7 kHz and stops from 9 kHz, both at
+// least 65 dB down. The coefficients are a Kaiser-windowed sinc computed at compile time, Q15.
+// Each stage keeps its input in a linear buffer behind its history, so every output sample is one
+// dot product of contiguous int16 arrays with a length divisible by four; compilers vectorize it.
+//
+// A decimating stage keeps input that does not make a whole output sample for the next block, so
+// blocks need not be a multiple of the factor. The delay is about 2 ms from 16 kHz and 3.5 ms from
+// 48 kHz, each way.
+class Resampler {
+ public:
+  // most input samples a stage takes at a time; process() splits larger blocks
+  static const size_t CHUNK = 240;
+
+  // false if the pair of rates is not supported; equal rates copy
+  bool configure(uint32_t in_hz, uint32_t out_hz);
+  void reset();
+  uint32_t get_input_rate() const { return this->in_hz_; }
+  uint32_t get_output_rate() const { return this->out_hz_; }
+  bool is_active() const { return this->stages_ != 0; }
+
+  // converts n input samples into out, which must take get_output_samples(n); returns the number
+  // written. in and out must not overlap.
+  size_t process(const int16_t *in, size_t n, int16_t *out);
+  // most output samples process() can return for n input samples
+  size_t get_output_samples(size_t n) const;
+
+ protected:
+  struct Stage {
+    // interpolation or decimation factor
+    uint8_t factor;
+    bool up;
+    // samples in buf, history included
+    size_t fill;
+    int16_t buf[CHUNK + 160];
+  };
+  static size_t run_stage_(Stage &stage, const int16_t *in, size_t n, int16_t *out);
+
+  uint32_t in_hz_ = 8000;
+  uint32_t out_hz_ = 8000;
+  size_t stages_ = 0;
+  // input samples per pass, so that no stage gets more than CHUNK
+  size_t chunk_ = CHUNK;
+  Stage stage_[2];
+};
+
+}  // namespace voip
+}  // namespace esphome
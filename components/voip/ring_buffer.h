@@ -0,0 +1,115 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace esphome {
+namespace voip {
+
+#ifndef VOIP_CACHE_LINE_SIZE
+#define VOIP_CACHE_LINE_SIZE 64
+#endif
+
+// Fixed-capacity single-producer/single-consumer ring buffer.
+//
+// One task may call write(), another task may call read()/available()/discard() concurrently without
+// locks. Head and tail live on separate cache lines so the two sides do not false-share. Capacity
+// must be a power of two; indices run freely and are masked on access, so the full capacity is usable.
+//
+// The producer never blocks: when the buffer is full the excess is dropped and counted as an overrun.
+// The consumer reads whole blocks only: if fewer than the requested elements are buffered, nothing is
+// consumed and an underrun is counted.
+template<typename T, size_t Capacity> class SpscRingBuffer {
+  static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+  static_assert(std::is_trivially_copyable<T>::value, "elements are moved with memcpy");
+
+ public:
+  static constexpr size_t capacity() { return Capacity; }
+
+  // Producer side. Returns the number of elements stored (less than n on overrun). On overrun only
+  // whole units of that many elements are stored, so that records of a fixed size stay aligned.
+  size_t write(const T *data, size_t n, size_t unit = 1) {
+    size_t head = this->head_.load(std::memory_order_relaxed);
+    size_t tail = this->tail_.load(std::memory_order_acquire);
+    size_t free = Capacity - (head - tail);
+    if (n > free) {
+      free -= free % unit;
+      this->overruns_.fetch_add(1, std::memory_order_relaxed);
+      this->overrun_items_.fetch_add(n - free, std::memory_order_relaxed);
+      n = free;
+    }
+    this->copy_in_(head, data, n);
+    this->head_.store(head + n, std::memory_order_release);
+    return n;
+  }
+
+  bool push(const T &item) { return this->write(&item, 1) == 1; }
+
+  // Consumer side. Reads exactly n elements or nothing.
+  bool read(T *data, size_t n) {
+    size_t tail = this->tail_.load(std::memory_order_relaxed);
+    size_t head = this->head_.load(std::memory_order_acquire);
+    if (head - tail < n) {
+      this->underruns_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    this->copy_out_(tail, data, n);
+    this->tail_.store(tail + n, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Like read() of a single element, but an empty queue is not counted as an underrun.
+  bool pop(T &item) {
+    if (this->available() == 0)
+      return false;
+    return this->read(&item, 1);
+  }
+
+  // Consumer side. Drops up to n buffered elements; discard(capacity()) empties the buffer.
+  size_t discard(size_t n) {
+    size_t tail = this->tail_.load(std::memory_order_relaxed);
+    size_t head = this->head_.load(std::memory_order_acquire);
+    if (n > head - tail)
+      n = head - tail;
+    this->tail_.store(tail + n, std::memory_order_release);
+    return n;
+  }
+
+  size_t available() const {
+    return this->head_.load(std::memory_order_acquire) - this->tail_.load(std::memory_order_acquire);
+  }
+
+  uint32_t get_overruns() const { return this->overruns_.load(std::memory_order_relaxed); }
+  uint32_t get_overrun_items() const { return this->overrun_items_.load(std::memory_order_relaxed); }
+  uint32_t get_underruns() const { return this->underruns_.load(std::memory_order_relaxed); }
+
+ protected:
+  void copy_in_(size_t head, const T *data, size_t n) {
+    size_t idx = head & (Capacity - 1);
+    size_t first = Capacity - idx < n ? Capacity - idx : n;
+    memcpy(&this->data_[idx], data, first * sizeof(T));
+    memcpy(&this->data_[0], data + first, (n - first) * sizeof(T));
+  }
+
+  void copy_out_(size_t tail, T *data, size_t n) const {
+    size_t idx = tail & (Capacity - 1);
+    size_t first = Capacity - idx < n ? Capacity - idx : n;
+    memcpy(data, &this->data_[idx], first * sizeof(T));
+    memcpy(data + first, &this->data_[0], (n - first) * sizeof(T));
+  }
+
+  // written by the producer only
+  alignas(VOIP_CACHE_LINE_SIZE) std::atomic<size_t> head_{0};
+  std::atomic<uint32_t> overruns_{0};
+  std::atomic<uint32_t> overrun_items_{0};
+  // written by the consumer only
+  alignas(VOIP_CACHE_LINE_SIZE) std::atomic<size_t> tail_{0};
+  std::atomic<uint32_t> underruns_{0};
+  alignas(VOIP_CACHE_LINE_SIZE) T data_[Capacity];
+};
+
+}  // namespace voip
+}  // namespace esphome
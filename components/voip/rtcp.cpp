@@ -0,0 +1,306 @@
+#include "rtcp.h"
+#include <cstring>
+
+namespace esphome {
+namespace voip {
+
+namespace {
+
+// RFC 3550 appendix A.1
+const uint16_t MAX_DROPOUT = 3000;
+const uint16_t MAX_MISORDER = 100;
+const uint32_t RTP_SEQ_MOD = 1 << 16;
+
+const uint8_t RTCP_SR = 200;
+const uint8_t RTCP_RR = 201;
+const uint8_t RTCP_SDES = 202;
+const uint8_t RTCP_BYE = 203;
+const uint8_t SDES_CNAME = 1;
+const size_t SR_SIZE = 28;
+const size_t RR_SIZE = 8;
+const size_t REPORT_BLOCK_SIZE = 24;
+
+void put16(uint8_t *p, uint16_t v) {
+  p[0] = (uint8_t)(v >> 8);
+  p[1] = (uint8_t)v;
+}
+
+void put32(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)(v >> 24);
+  p[1] = (uint8_t)(v >> 16);
+  p[2] = (uint8_t)(v >> 8);
+  p[3] = (uint8_t)v;
+}
+
+uint16_t get16(const uint8_t *p) { return (uint16_t)((p[0] << 8) | p[1]); }
+
+uint32_t get32(const uint8_t *p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// the compact form used by LSR and DLSR: 16 bits of seconds, 16 bits of fraction
+uint32_t ntp_middle(uint64_t ntp) { return (uint32_t)(ntp >> 16); }
+
+}  // namespace
+
+uint64_t rtcp_ntp_time(uint64_t now_us) {
+  uint64_t seconds = now_us / 1000000;
+  uint64_t fraction = ((now_us % 1000000) << 32) / 1000000;
+  return (seconds << 32) | fraction;
+}
+
+void RtpReceiveStats::init_seq_(uint16_t seq) {
+  this->base_seq_ = seq;
+  this->max_seq_ = seq;
+  this->bad_seq_ = RTP_SEQ_MOD + 1;
+  this->cycles_ = 0;
+  this->received_ = 0;
+  this->received_prior_ = 0;
+  this->expected_prior_ = 0;
+  this->have_transit_ = false;
+}
+
+void RtpReceiveStats::update(uint16_t seq, uint32_t rtp_timestamp, uint32_t arrival) {
+  if (!this->valid_) {
+    this->init_seq_(seq);
+    this->valid_ = true;
+  } else {
+    uint16_t udelta = (uint16_t)(seq - this->max_seq_);
+    if (udelta < MAX_DROPOUT) {
+      // in order, with permissible gap
+      if (seq < this->max_seq_)
+        this->cycles_ += RTP_SEQ_MOD;
+      this->max_seq_ = seq;
+    } else if (udelta <= RTP_SEQ_MOD - MAX_MISORDER) {
+      // a very large jump: the sender restarted if the next packet follows this one
+      if (seq != this->bad_seq_) {
+        this->bad_seq_ = (seq + 1) & (RTP_SEQ_MOD - 1);
+        return;
+      }
+      this->init_seq_(seq);
+    }
+    // else a duplicate or reordered packet
+  }
+  this->received_++;
+
+  int32_t transit = (int32_t)(arrival - rtp_timestamp);
+  if (this->have_transit_) {
+    int32_t d = transit - this->transit_;
+    if (d < 0)
+      d = -d;
+    this->jitter_ = (uint32_t)((int64_t)this->jitter_ + d - ((this->jitter_ + 8) >> 4));
+  }
+  this->transit_ = transit;
+  this->have_transit_ = true;
+}
+
+int32_t RtpReceiveStats::get_cumulative_lost() const {
+  int64_t lost = (int64_t)this->get_expected() - this->received_;
+  if (lost > 0x7FFFFF)
+    return 0x7FFFFF;
+  if (lost < -0x800000)
+    return -0x800000;
+  return (int32_t)lost;
+}
+
+uint8_t RtpReceiveStats::take_fraction_lost() {
+  uint32_t expected = this->get_expected();
+  uint32_t expected_interval = expected - this->expected_prior_;
+  uint32_t received_interval = this->received_ - this->received_prior_;
+  this->expected_prior_ = expected;
+  this->received_prior_ = this->received_;
+  int64_t lost_interval = (int64_t)expected_interval - received_interval;
+  if (expected_interval == 0 || lost_interval <= 0)
+    return 0;
+  return (uint8_t)((lost_interval << 8) / expected_interval);
+}
+
+void RtcpSession::start(uint64_t now_us, uint32_t ssrc, const char *cname) {
+  *this = RtcpSession{};
+  this->active_ = true;
+  this->ssrc_ = ssrc;
+  strncpy(this->cname_, cname != nullptr ? cname : "", sizeof(this->cname_) - 1);
+  this->random_ = (ssrc ^ (uint32_t)now_us) | 1;
+  this->next_report_us_ = now_us + (INTERVAL_US / 2 + this->next_random_() % INTERVAL_US) / 2;
+}
+
+uint32_t RtcpSession::next_random_() {
+  // xorshift32, enough to keep the reports of many devices from lining up
+  uint32_t x = this->random_;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return this->random_ = x;
+}
+
+void RtcpSession::on_rtp_received(uint32_t ssrc, uint16_t seq, uint32_t rtp_timestamp, uint64_t now_us) {
+  if (!this->remote_ssrc_valid_ || ssrc != this->remote_ssrc_) {
+    this->rx_.reset();
+    this->remote_ssrc_ = ssrc;
+    this->remote_ssrc_valid_ = true;
+    this->interval_loss_ = 0;
+  }
+  uint32_t arrival = (uint32_t)(now_us * this->clock_rate_ / 1000000);
+  this->rx_.update(seq, rtp_timestamp, arrival);
+}
+
+void RtcpSession::on_rtp_sent(uint32_t rtp_timestamp, size_t payload_bytes, uint64_t now_us) {
+  this->packets_sent_++;
+  this->octets_sent_ += (uint32_t)payload_bytes;
+  this->last_rtp_timestamp_ = rtp_timestamp;
+  this->last_sent_us_ = now_us;
+}
+
+size_t RtcpSession::write_report_(uint64_t now_us, bool sender, uint8_t *buf, size_t size) {
+  bool block = this->remote_ssrc_valid_ && this->rx_.is_valid();
+  size_t len = (sender ? SR_SIZE : RR_SIZE) + (block ? REPORT_BLOCK_SIZE : 0);
+  if (size < len)
+    return 0;
+  buf[0] = (uint8_t)(0x80 | (block ? 1 : 0));
+  buf[1] = sender ? RTCP_SR : RTCP_RR;
+  put16(buf + 2, (uint16_t)(len / 4 - 1));
+  put32(buf + 4, this->ssrc_);
+  size_t pos = RR_SIZE;
+  if (sender) {
+    uint64_t ntp = rtcp_ntp_time(now_us);
+    put32(buf + 8, (uint32_t)(ntp >> 32));
+    put32(buf + 12, (uint32_t)ntp);
+    // the RTP time that corresponds to the NTP time, extrapolated from the last packet sent
+    uint32_t elapsed = (uint32_t)((now_us - this->last_sent_us_) * this->clock_rate_ / 1000000);
+    put32(buf + 16, this->last_rtp_timestamp_ + elapsed);
+    put32(buf + 20, this->packets_sent_);
+    put32(buf + 24, this->octets_sent_);
+    pos = SR_SIZE;
+  }
+  if (block) {
+    uint8_t *b = buf + pos;
+    this->interval_loss_ = this->rx_.take_fraction_lost();
+    int32_t lost = this->rx_.get_cumulative_lost();
+    put32(b, this->remote_ssrc_);
+    put32(b + 4, ((uint32_t)this->interval_loss_ << 24) | ((uint32_t)lost & 0xFFFFFF));
+    put32(b + 8, this->rx_.get_extended_max());
+    put32(b + 12, this->rx_.get_jitter());
+    put32(b + 16, this->lsr_);
+    uint32_t dlsr = this->lsr_ != 0 ? (uint32_t)(((now_us - this->lsr_arrival_us_) << 16) / 1000000) : 0;
+    put32(b + 20, dlsr);
+  }
+  return len;
+}
+
+size_t RtcpSession::write_sdes_(uint8_t *buf, size_t size) const {
+  size_t n = strlen(this->cname_);
+  // header, SSRC, CNAME item, the END item, padded to 32 bits
+  size_t len = (8 + 2 + n + 1 + 3) & ~(size_t)3;
+  if (size < len)
+    return 0;
+  memset(buf, 0, len);
+  buf[0] = 0x81;
+  buf[1] = RTCP_SDES;
+  put16(buf + 2, (uint16_t)(len / 4 - 1));
+  put32(buf + 4, this->ssrc_);
+  buf[8] = SDES_CNAME;
+  buf[9] = (uint8_t)n;
+  memcpy(buf + 10, this->cname_, n);
+  return len;
+}
+
+size_t RtcpSession::build_report(uint64_t now_us, uint8_t *buf, size_t size) {
+  // a sender is whoever sent since the last report (section 6.4)
+  bool sender = this->packets_sent_ != this->packets_at_last_report_;
+  this->packets_at_last_report_ = this->packets_sent_;
+  this->next_report_us_ = now_us + INTERVAL_US / 2 + this->next_random_() % INTERVAL_US;
+  size_t len = this->write_report_(now_us, sender, buf, size);
+  size_t sdes = len != 0 ? this->write_sdes_(buf + len, size - len) : 0;
+  if (sdes == 0)
+    return 0;
+  this->reports_sent_++;
+  return len + sdes;
+}
+
+size_t RtcpSession::build_bye(uint64_t now_us, uint8_t *buf, size_t size) {
+  bool sender = this->packets_sent_ != this->packets_at_last_report_;
+  size_t len = this->write_report_(now_us, sender, buf, size);
+  size_t sdes = len != 0 ? this->write_sdes_(buf + len, size - len) : 0;
+  if (sdes == 0 || size - len - sdes < 8)
+    return 0;
+  len += sdes;
+  buf[len] = 0x81;
+  buf[len + 1] = RTCP_BYE;
+  put16(buf + len + 2, 1);
+  put32(buf + len + 4, this->ssrc_);
+  return len + 8;
+}
+
+bool RtcpSession::parse(const uint8_t *buf, size_t len, uint64_t now_us) {
+  // validity checks of appendix A.2: version 2 throughout, SR or RR first, lengths adding up
+  if (buf == nullptr || len < 4 || (buf[1] != RTCP_SR && buf[1] != RTCP_RR))
+    return false;
+  for (size_t pos = 0; pos < len;) {
+    const uint8_t *p = buf + pos;
+    if (len - pos < 4 || (p[0] >> 6) != 2)
+      return false;
+    size_t plen = ((size_t)get16(p + 2) + 1) * 4;
+    if (plen > len - pos)
+      return false;
+    uint8_t type = p[1];
+    size_t count = p[0] & 0x1F;
+    if (type == RTCP_SR || type == RTCP_RR) {
+      size_t header = type == RTCP_SR ? SR_SIZE : RR_SIZE;
+      if (plen < header + count * REPORT_BLOCK_SIZE)
+        return false;
+      if (type == RTCP_SR) {
+        this->lsr_ = get32(p + 10);
+        this->lsr_arrival_us_ = now_us;
+      }
+      for (size_t i = 0; i < count; i++) {
+        const uint8_t *b = p + header + i * REPORT_BLOCK_SIZE;
+        if (get32(b) != this->ssrc_)
+          continue;
+        this->remote_report_valid_ = true;
+        this->remote_fraction_lost_ = b[4];
+        uint32_t lost = get32(b + 4) & 0xFFFFFF;
+        this->remote_cumulative_lost_ = (lost & 0x800000) ? (int32_t)(lost | 0xFF000000u) : (int32_t)lost;
+        this->remote_jitter_ = get32(b + 12);
+        uint32_t lsr = get32(b + 16);
+        uint32_t dlsr = get32(b + 20);
+        if (lsr != 0) {
+          // A = now, RTT = A - LSR - DLSR in 1/65536 s (section 6.4.1)
+          int32_t rtt = (int32_t)(ntp_middle(rtcp_ntp_time(now_us)) - lsr - dlsr);
+          if (rtt >= 0) {
+            this->rtt_us_ = (uint32_t)(((uint64_t)rtt * 1000000) >> 16);
+            this->rtt_valid_ = true;
+          }
+        }
+      }
+      this->reports_received_++;
+    } else if (type == RTCP_BYE) {
+      this->remote_bye_ = true;
+    }
+    pos += plen;
+  }
+  return true;
+}
+
+float emodel_r_factor(float delay_ms, float loss_percent, float ie, float bpl) {
+  // delay impairment Id, the G.107 curve approximated by two lines (Cole and Rosenbluth)
+  float id = 0.024f * delay_ms;
+  if (delay_ms > 177.3f)
+    id += 0.11f * (delay_ms - 177.3f);
+  // effective equipment impairment under random loss (BurstR = 1)
+  float ie_eff = ie;
+  if (loss_percent > 0)
+    ie_eff += (95.0f - ie) * loss_percent / (loss_percent + bpl);
+  float r = 93.2f - id - ie_eff;
+  return r < 0 ? 0 : (r > 100 ? 100 : r);
+}
+
+float emodel_mos(float r) {
+  if (r <= 0)
+    return 1.0f;
+  if (r >= 100)
+    return 4.5f;
+  return 1.0f + 0.035f * r + r * (r - 60.0f) * (100.0f - r) * 7e-6f;
+}
+
+}  // namespace voip
+}  // namespace esphome
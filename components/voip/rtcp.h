@@ -0,0 +1,154 @@
+#pragma once
+
+#include "rtp.h"
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace voip {
+
+// room for an SR with one report block, SDES CNAME and BYE
+static const size_t RTCP_MAX_PACKET = 160;
+static const size_t RTCP_CNAME_SIZE = 32;
+
+// 64-bit NTP timestamp (RFC 3550 section 4) of a monotonic microsecond clock. The SR carries it
+// only to be echoed back in LSR, so it does not have to be wallclock time (section 6.4.1).
+uint64_t rtcp_ntp_time(uint64_t now_us);
+
+// Reception statistics of one RTP source, the algorithms of RFC 3550 appendix A.1 (sequence
+// number validation and extension), A.3 (loss) and A.8 (interarrival jitter).
+class RtpReceiveStats {
+ public:
+  void reset() { *this = RtpReceiveStats{}; }
+  // a packet of the source; arrival in units of the RTP clock
+  void update(uint16_t seq, uint32_t rtp_timestamp, uint32_t arrival);
+
+  bool is_valid() const { return this->valid_; }
+  uint32_t get_received() const { return this->received_; }
+  // highest sequence number with the wrap count in the upper 16 bits
+  uint32_t get_extended_max() const { return this->cycles_ + this->max_seq_; }
+  uint32_t get_expected() const { return this->valid_ ? this->get_extended_max() - this->base_seq_ + 1 : 0; }
+  // packets expected minus received, limited to the 24-bit signed field of a report block;
+  // duplicates can make it negative
+  int32_t get_cumulative_lost() const;
+  // interarrival jitter in RTP timestamp units
+  uint32_t get_jitter() const { return this->jitter_ >> 4; }
+  // fraction lost since the last call as 8-bit fixed point, and starts the next interval
+  uint8_t take_fraction_lost();
+
+ protected:
+  void init_seq_(uint16_t seq);
+
+  bool valid_ = false;
+  uint16_t max_seq_ = 0;
+  uint32_t cycles_ = 0;
+  uint32_t base_seq_ = 0;
+  // sequence number after a large jump; the stream restarted if the next packet follows it
+  uint32_t bad_seq_ = 0x10001;
+  uint32_t received_ = 0;
+  uint32_t expected_prior_ = 0;
+  uint32_t received_prior_ = 0;
+  bool have_transit_ = false;
+  int32_t transit_ = 0;
+  // jitter scaled by 16 to keep the fraction (A.8)
+  uint32_t jitter_ = 0;
+};
+
+// RTCP for one call (RFC 3550 section 6): statistics of the far end's stream and of our own, sender
+// and receiver reports with an SDES CNAME every few seconds, a BYE at the end, and what the far
+// end's reports tell about our stream and the round trip.
+//
+// A report is an SR while we send and an RR otherwise, with one report block about the far end's
+// SSRC once its first packet arrived. The interval is 5 s randomised over [2.5 s, 7.5 s], the first
+// report goes out after half of that (section 6.2 with the fixed minimum of a two-party call).
+// The round trip time follows from the LSR and DLSR the far end echoes for our last SR.
+class RtcpSession {
+ public:
+  static const uint32_t INTERVAL_US = 5000000;
+
+  // Starts a session with our SSRC; cname is copied and truncated to RTCP_CNAME_SIZE - 1
+  void start(uint64_t now_us, uint32_t ssrc, const char *cname);
+  void stop() { this->active_ = false; }
+  bool is_active() const { return this->active_; }
+  uint32_t get_ssrc() const { return this->ssrc_; }
+
+  // an RTP packet of the far end's stream; a new SSRC starts its statistics over
+  void on_rtp_received(uint32_t ssrc, uint16_t seq, uint32_t rtp_timestamp, uint64_t now_us);
+  // an RTP packet we sent, payload bytes without the header
+  void on_rtp_sent(uint32_t rtp_timestamp, size_t payload_bytes, uint64_t now_us);
+
+  bool report_due(uint64_t now_us) const { return this->active_ && now_us >= this->next_report_us_; }
+  // Writes SR or RR plus SDES into buf and schedules the next report; the length, 0 if size is too small
+  size_t build_report(uint64_t now_us, uint8_t *buf, size_t size);
+  // Writes the final RR plus SDES and BYE
+  size_t build_bye(uint64_t now_us, uint8_t *buf, size_t size);
+  // Takes in a compound packet from the far end; false if it is not well-formed RTCP
+  bool parse(const uint8_t *buf, size_t len, uint64_t now_us);
+
+  const RtpReceiveStats &get_receive_stats() const { return this->rx_; }
+  // fraction lost in the interval of the last report we built, 0..1
+  float get_interval_loss() const { return this->interval_loss_ / 256.0f; }
+  uint32_t get_jitter_us() const { return (uint32_t)((uint64_t)this->rx_.get_jitter() * 1000000 / this->clock_rate_); }
+  bool has_rtt() const { return this->rtt_valid_; }
+  uint32_t get_rtt_us() const { return this->rtt_us_; }
+  // what the far end's last report block said about our stream
+  bool has_remote_report() const { return this->remote_report_valid_; }
+  float get_remote_loss() const { return this->remote_fraction_lost_ / 256.0f; }
+  int32_t get_remote_cumulative_lost() const { return this->remote_cumulative_lost_; }
+  uint32_t get_remote_jitter_us() const {
+    return (uint32_t)((uint64_t)this->remote_jitter_ * 1000000 / this->clock_rate_);
+  }
+  bool remote_said_bye() const { return this->remote_bye_; }
+  uint32_t get_packets_sent() const { return this->packets_sent_; }
+  uint32_t get_reports_sent() const { return this->reports_sent_; }
+  uint32_t get_reports_received() const { return this->reports_received_; }
+
+ protected:
+  size_t write_report_(uint64_t now_us, bool sender, uint8_t *buf, size_t size);
+  size_t write_sdes_(uint8_t *buf, size_t size) const;
+  uint32_t next_random_();
+
+  bool active_ = false;
+  uint32_t ssrc_ = 0;
+  char cname_[RTCP_CNAME_SIZE] = {};
+  uint32_t clock_rate_ = 8000;
+  uint32_t random_ = 1;
+  uint64_t next_report_us_ = 0;
+
+  // the far end's stream
+  bool remote_ssrc_valid_ = false;
+  uint32_t remote_ssrc_ = 0;
+  RtpReceiveStats rx_;
+  uint8_t interval_loss_ = 0;
+  // middle 32 bits of the NTP time in the far end's last SR, and when it arrived
+  uint32_t lsr_ = 0;
+  uint64_t lsr_arrival_us_ = 0;
+
+  // our stream
+  uint32_t packets_sent_ = 0;
+  uint32_t octets_sent_ = 0;
+  uint32_t packets_at_last_report_ = 0;
+  uint32_t last_rtp_timestamp_ = 0;
+  uint64_t last_sent_us_ = 0;
+
+  bool rtt_valid_ = false;
+  uint32_t rtt_us_ = 0;
+  bool remote_report_valid_ = false;
+  uint8_t remote_fraction_lost_ = 0;
+  int32_t remote_cumulative_lost_ = 0;
+  uint32_t remote_jitter_ = 0;
+  bool remote_bye_ = false;
+  uint32_t reports_sent_ = 0;
+  uint32_t reports_received_ = 0;
+};
+
+// Transmission rating of the E-model (ITU-T G.107) reduced to what a call can measure: the one-way
+// mouth-to-ear delay in ms, the packet loss in percent, the codec's equipment impairment Ie and its
+// packet-loss robustness Bpl (ITU-T G.113 Appendix I), with random loss. 93.2 for a perfect G.711
+// call, about 70 where users start to complain.
+float emodel_r_factor(float delay_ms, float loss_percent, float ie, float bpl);
+// Estimated mean opinion score 1..4.5 for an R factor (G.107 Annex B)
+float emodel_mos(float r);
+
+}  // namespace voip
+}  // namespace esphome
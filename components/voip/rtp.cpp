@@ -0,0 +1,103 @@
+#include "rtp.h"
+
+namespace esphome {
+namespace voip {
+
+bool parse_rtp_header(const uint8_t *data, size_t len, RtpHeader *out) {
+  if (!data || !out || len < RTP_HEADER_SIZE)
+    return false;
+  out->version = data[0] >> 6;
+  if (out->version != 2)
+    return false;
+  bool padding = (data[0] & 0x20) != 0;
+  bool extension = (data[0] & 0x10) != 0;
+  size_t csrc_count = data[0] & 0x0F;
+  out->marker = (data[1] & 0x80) != 0;
+  out->payload_type = data[1] & 0x7F;
+  out->sequence = (uint16_t)((data[2] << 8) | data[3]);
+  out->timestamp = ((uint32_t)data[4] << 24) | ((uint32_t)data[5] << 16) | ((uint32_t)data[6] << 8) | data[7];
+  out->ssrc = ((uint32_t)data[8] << 24) | ((uint32_t)data[9] << 16) | ((uint32_t)data[10] << 8) | data[11];
+
+  size_t offset = RTP_HEADER_SIZE + csrc_count * 4;
+  if (offset > len)
+    return false;
+  if (extension) {
+    if (offset + 4 > len)
+      return false;
+    size_t ext_words = (size_t)((data[offset + 2] << 8) | data[offset + 3]);
+    offset += 4 + ext_words * 4;
+    if (offset > len)
+      return false;
+  }
+  size_t end = len;
+  if (padding) {
+    size_t pad = data[len - 1];
+    if (pad == 0 || offset + pad > len)
+      return false;
+    end -= pad;
+  }
+  out->payload_offset = offset;
+  out->payload_size = end - offset;
+  return true;
+}
+
+size_t write_rtp_header(uint8_t *buf, bool marker, uint8_t payload_type, uint16_t seq, uint32_t timestamp,
+                        uint32_t ssrc) {
+  buf[0] = 0x80;  // V=2, no padding, no extension, no CSRC
+  buf[1] = (uint8_t)((marker ? 0x80 : 0) | (payload_type & 0x7F));
+  buf[2] = (uint8_t)(seq >> 8);
+  buf[3] = (uint8_t)seq;
+  buf[4] = (uint8_t)(timestamp >> 24);
+  buf[5] = (uint8_t)(timestamp >> 16);
+  buf[6] = (uint8_t)(timestamp >> 8);
+  buf[7] = (uint8_t)timestamp;
+  buf[8] = (uint8_t)(ssrc >> 24);
+  buf[9] = (uint8_t)(ssrc >> 16);
+  buf[10] = (uint8_t)(ssrc >> 8);
+  buf[11] = (uint8_t)ssrc;
+  return RTP_HEADER_SIZE;
+}
+
+void RtpPortPool::configure(uint16_t first, uint16_t last) {
+  uint32_t start = (first + 1u) & ~1u;
+  this->first_ = (uint16_t)start;
+  this->count_ = 0;
+  if (start != 0 && start <= last)
+    this->count_ = ((uint32_t)last - start) / 2 + 1;
+  if (this->count_ > MAX_PORTS)
+    this->count_ = MAX_PORTS;
+  this->next_ = 0;
+  this->used_ = 0;
+}
+
+uint16_t RtpPortPool::acquire() {
+  for (size_t i = 0; i < this->count_; i++) {
+    size_t slot = (this->next_ + i) % this->count_;
+    if ((this->used_ & (1u << slot)) == 0) {
+      this->used_ |= 1u << slot;
+      this->next_ = (slot + 1) % this->count_;
+      return (uint16_t)(this->first_ + 2 * slot);
+    }
+  }
+  return 0;
+}
+
+void RtpPortPool::release(uint16_t port) {
+  if (port < this->first_ || (port - this->first_) % 2 != 0)
+    return;
+  size_t slot = (size_t)(port - this->first_) / 2;
+  if (slot < this->count_)
+    this->used_ &= ~(1u << slot);
+}
+
+size_t RtpPortPool::available() const {
+  size_t n = 0;
+  for (size_t i = 0; i < this->count_; i++) {
+    if ((this->used_ & (1u << i)) == 0)
+      n++;
+  }
+  return n;
+}
+
+}  // namespace voip
+}  // namespace esphome
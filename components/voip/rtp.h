@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace voip {
+
+// Fixed part of the RTP header (RFC 3550 section 5.1)
+static const size_t RTP_HEADER_SIZE = 12;
+
+struct RtpHeader {
+  uint8_t version;
+  bool marker;
+  uint8_t payload_type;
+  uint16_t sequence;
+  uint32_t timestamp;
+  uint32_t ssrc;
+  // offset and length of the payload inside the datagram (after CSRCs, extension and padding)
+  size_t payload_offset;
+  size_t payload_size;
+};
+
+// Parse an RTP datagram. Returns false for anything that is not a well formed RTP v2 packet.
+bool parse_rtp_header(const uint8_t *data, size_t len, RtpHeader *out);
+
+// Write the 12-byte fixed header in network byte order. Returns RTP_HEADER_SIZE.
+size_t write_rtp_header(uint8_t *buf, bool marker, uint8_t payload_type, uint16_t seq, uint32_t timestamp,
+                        uint32_t ssrc);
+
+// Serial number arithmetic for 16-bit sequence numbers (RFC 1982)
+static inline int16_t rtp_seq_diff(uint16_t a, uint16_t b) { return (int16_t)(uint16_t)(a - b); }
+
+// Local RTP ports for the calls, even ports from a configured range so that RTCP can use the odd
+// port above (RFC 3550 section 11). Ports are handed out round robin: a port given back is the last
+// to be reused, so late packets of an ended call do not land in the next one.
+class RtpPortPool {
+ public:
+  static const size_t MAX_PORTS = 32;
+
+  // first is rounded up to even; at most MAX_PORTS ports from [first, last]
+  void configure(uint16_t first, uint16_t last);
+  // a free port, 0 if all are in use
+  uint16_t acquire();
+  void release(uint16_t port);
+  size_t size() const { return this->count_; }
+  size_t available() const;
+
+ protected:
+  uint16_t first_ = 0;
+  size_t count_ = 0;
+  size_t next_ = 0;
+  uint32_t used_ = 0;
+};
+
+}  // namespace voip
+}  // namespace esphome
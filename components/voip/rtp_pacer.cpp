@@ -0,0 +1,85 @@
+#include "rtp_pacer.h"
+#include "rtp.h"
+
+namespace esphome {
+namespace voip {
+
+const uint32_t RtpPacer::HISTOGRAM_LIMITS_US[RtpPacer::HISTOGRAM_BUCKETS - 1] = {1000,  2000,  5000,
+                                                                                10000, 20000, 50000};
+
+void RtpPacer::start(uint64_t now_us, uint16_t seq, uint32_t timestamp, uint32_t ssrc, uint32_t frame_us,
+                     uint32_t frame_samples) {
+  this->seq_ = seq;
+  this->timestamp_ = timestamp;
+  this->ssrc_ = ssrc;
+  this->frame_us_ = frame_us ? frame_us : 20000;
+  this->frame_samples_ = frame_samples;
+  this->next_due_us_ = now_us;
+  this->first_ = true;
+  this->sent_.store(0, std::memory_order_relaxed);
+  this->skipped_.store(0, std::memory_order_relaxed);
+  this->max_lateness_us_.store(0, std::memory_order_relaxed);
+  for (auto &h : this->histogram_)
+    h.store(0, std::memory_order_relaxed);
+  this->paused_ = false;
+  this->active_ = true;
+}
+
+void RtpPacer::pause(uint64_t now_us) {
+  if (!this->active_)
+    return;
+  this->active_ = false;
+  this->paused_ = true;
+  // frames already due count as sent or skipped before the pause
+  this->paused_us_ = now_us > this->next_due_us_ ? now_us : this->next_due_us_;
+}
+
+void RtpPacer::resume(uint64_t now_us) {
+  if (!this->paused_)
+    return;
+  if (now_us > this->paused_us_)
+    this->timestamp_ += (uint32_t)((now_us - this->paused_us_) * this->frame_samples_ / this->frame_us_);
+  this->next_due_us_ = now_us;
+  this->first_ = true;
+  this->paused_ = false;
+  this->active_ = true;
+}
+
+uint32_t RtpPacer::frames_due(uint64_t now_us) {
+  if (!this->active_ || now_us < this->next_due_us_)
+    return 0;
+  uint64_t due = (now_us - this->next_due_us_) / this->frame_us_ + 1;
+  while (due > this->max_catch_up_) {
+    this->skip_frame();
+    this->skipped_.fetch_add(1, std::memory_order_relaxed);
+    due--;
+  }
+  return (uint32_t)due;
+}
+
+size_t RtpPacer::next_packet(uint64_t now_us, uint8_t payload_type, bool marker, uint8_t *buf) {
+  uint32_t lateness = now_us > this->next_due_us_ ? (uint32_t)(now_us - this->next_due_us_) : 0;
+  size_t bucket = 0;
+  while (bucket < HISTOGRAM_BUCKETS - 1 && lateness >= HISTOGRAM_LIMITS_US[bucket])
+    bucket++;
+  this->histogram_[bucket].fetch_add(1, std::memory_order_relaxed);
+  if (lateness > this->max_lateness_us_.load(std::memory_order_relaxed))
+    this->max_lateness_us_.store(lateness, std::memory_order_relaxed);
+
+  // the first packet of a stream carries the marker bit (RFC 3551 section 4.1)
+  size_t n = write_rtp_header(buf, marker || this->first_, payload_type, this->seq_, this->timestamp_, this->ssrc_);
+  this->first_ = false;
+  this->seq_++;
+  this->timestamp_ += this->frame_samples_;
+  this->next_due_us_ += this->frame_us_;
+  this->sent_.fetch_add(1, std::memory_order_relaxed);
+  return n;
+}
+
+void RtpPacer::skip_frame() {
+  this->timestamp_ += this->frame_samples_;
+  this->next_due_us_ += this->frame_us_;
+}
+
+}  // namespace voip
+}  // namespace esphome
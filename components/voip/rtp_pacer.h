@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace voip {
+
+// TX pacing clock for one outgoing RTP stream.
+//
+// Frame N of a call is due at start + N * frame_us on a monotonic microsecond clock, so the RTP
+// timestamp stays locked to the wall clock no matter how late the caller polls. frames_due() reports
+// how many frames should be sent now; if the caller fell further behind than max_catch_up frames, the
+// oldest frames are skipped (timestamp advances, sequence number does not, as RFC 3550 requires for
+// frames that were never sent). Sequence number, timestamp and SSRC are per call and start from the
+// random values passed to start().
+class RtpPacer {
+ public:
+  // lateness buckets in microseconds: <1 ms, <2 ms, <5 ms, <10 ms, <20 ms, <50 ms, >=50 ms
+  static const size_t HISTOGRAM_BUCKETS = 7;
+  static const uint32_t HISTOGRAM_LIMITS_US[HISTOGRAM_BUCKETS - 1];
+
+  void start(uint64_t now_us, uint16_t seq, uint32_t timestamp, uint32_t ssrc, uint32_t frame_us = 20000,
+             uint32_t frame_samples = 160);
+  void stop() { this->active_ = false; }
+  // Holds the stream without ending it, e.g. while its call is off the microphone
+  void pause(uint64_t now_us);
+  // Continues a paused stream at now_us: same SSRC, next sequence number, the timestamp advanced by
+  // the pause, and the marker bit set on the first packet as after any silence
+  void resume(uint64_t now_us);
+  bool is_active() const { return this->active_; }
+  void set_max_catch_up(uint32_t frames) { this->max_catch_up_ = frames ? frames : 1; }
+
+  // Frames due at now_us, at most max_catch_up. Skips older frames.
+  uint32_t frames_due(uint64_t now_us);
+  // Writes the RTP header of the next due frame into buf (RTP_HEADER_SIZE bytes), records its
+  // lateness and advances sequence number, timestamp and schedule.
+  size_t next_packet(uint64_t now_us, uint8_t payload_type, bool marker, uint8_t *buf);
+  // Advance the schedule and timestamp by one frame without sending (e.g. DTX)
+  void skip_frame();
+
+  uint16_t get_sequence() const { return this->seq_; }
+  uint32_t get_timestamp() const { return this->timestamp_; }
+  uint32_t get_ssrc() const { return this->ssrc_; }
+  uint32_t get_frame_samples() const { return this->frame_samples_; }
+
+  // statistics, safe to read from another task
+  uint32_t get_sent() const { return this->sent_.load(std::memory_order_relaxed); }
+  uint32_t get_skipped() const { return this->skipped_.load(std::memory_order_relaxed); }
+  uint32_t get_max_lateness_us() const { return this->max_lateness_us_.load(std::memory_order_relaxed); }
+  uint32_t get_histogram(size_t bucket) const {
+    return bucket < HISTOGRAM_BUCKETS ? this->histogram_[bucket].load(std::memory_order_relaxed) : 0;
+  }
+
+ protected:
+  bool active_ = false;
+  bool first_ = true;
+  bool paused_ = false;
+  uint64_t paused_us_ = 0;
+  uint16_t seq_ = 0;
+  uint32_t timestamp_ = 0;
+  uint32_t ssrc_ = 0;
+  uint32_t frame_us_ = 20000;
+  uint32_t frame_samples_ = 160;
+  uint32_t max_catch_up_ = 5;
+  uint64_t next_due_us_ = 0;
+
+  std::atomic<uint32_t> sent_{0};
+  std::atomic<uint32_t> skipped_{0};
+  std::atomic<uint32_t> max_lateness_us_{0};
+  std::atomic<uint32_t> histogram_[HISTOGRAM_BUCKETS];
+};
+
+}  // namespace voip
+}  // namespace esphome
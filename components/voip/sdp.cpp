@@ -0,0 +1,338 @@
+#include "sdp.h"
+#include "comfort_noise.h"
+#include "sip_message.h"
+#include <cstring>
+
+namespace esphome {
+namespace voip {
+
+namespace {
+
+inline char lower(char c) { return (c >= 'A' && c <= 'Z') ? (char)(c + 32) : c; }
+inline bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+bool equals_nocase(const char *a, const char *b) {
+  while (*a != '\0' && lower(*a) == lower(*b)) {
+    a++;
+    b++;
+  }
+  return *a == '\0' && *b == '\0';
+}
+
+// Cursor over one SDP line
+struct Field {
+  const char *p;
+  const char *end;
+
+  bool at_end() const { return this->p >= this->end; }
+  bool skip(const char *prefix) {
+    size_t n = strlen(prefix);
+    if ((size_t)(this->end - this->p) < n || memcmp(this->p, prefix, n) != 0)
+      return false;
+    this->p += n;
+    return true;
+  }
+  void skip_spaces() {
+    while (this->p < this->end && *this->p == ' ')
+      this->p++;
+  }
+  // decimal number of at most max, false if there is none or it is larger
+  bool number(uint32_t max, uint32_t *out) {
+    const char *start = this->p;
+    uint32_t v = 0;
+    while (this->p < this->end && is_digit(*this->p)) {
+      v = v * 10 + (*this->p++ - '0');
+      if (v > max)
+        return false;
+    }
+    *out = v;
+    return this->p > start;
+  }
+  // copies up to the next stop character (or the end of the line) into buf, truncating
+  void copy(char *buf, size_t cap, char stop) {
+    size_t n = 0;
+    while (this->p < this->end && *this->p != stop) {
+      if (n + 1 < cap)
+        buf[n++] = *this->p;
+      this->p++;
+    }
+    buf[n] = '\0';
+  }
+};
+
+// "IN IP4 a.b.c.d[/ttl]"; 0 for IPv6 or anything malformed
+uint32_t parse_connection(Field f) {
+  if (!f.skip("IN IP4 "))
+    return 0;
+  f.skip_spaces();
+  uint32_t addr = 0;
+  for (int i = 0; i < 4; i++) {
+    uint32_t octet;
+    if ((i > 0 && !f.skip(".")) || !f.number(255, &octet))
+      return 0;
+    addr = (addr << 8) | octet;
+  }
+  return (f.at_end() || *f.p == '/' || *f.p == ' ') ? addr : 0;
+}
+
+bool parse_direction(const Field &f, SdpDirection *out) {
+  static const char *const NAMES[] = {"sendrecv", "sendonly", "recvonly", "inactive"};
+  for (int d = 0; d < 4; d++) {
+    size_t n = strlen(NAMES[d]);
+    if ((size_t)(f.end - f.p) == n && memcmp(f.p, NAMES[d], n) == 0) {
+      *out = (SdpDirection)d;
+      return true;
+    }
+  }
+  return false;
+}
+
+SdpFormat *find_format(SdpMedia *media, uint32_t payload_type) {
+  for (uint8_t i = 0; i < media->format_count; i++) {
+    if (media->formats[i].payload_type == payload_type)
+      return &media->formats[i];
+  }
+  return nullptr;
+}
+
+bool codec_matches(const SdpFormat &f, const SdpCodec &c) {
+  if (f.encoding[0] != '\0')
+    return f.clock_rate == c.clock_rate && equals_nocase(f.encoding, c.encoding);
+  // static payload types may come without rtpmap (RFC 3551 section 6)
+  return f.payload_type < 96 && f.payload_type == c.payload_type;
+}
+
+bool is_comfort_noise(const SdpFormat &f) {
+  if (f.encoding[0] != '\0')
+    return f.clock_rate == 8000 && equals_nocase(f.encoding, "CN");
+  return f.payload_type == CN_PAYLOAD_TYPE;
+}
+
+}  // namespace
+
+bool SdpMedia::parse(const char *sdp, size_t len) {
+  *this = SdpMedia{};
+  // session-level values, used where the audio section has none
+  uint32_t session_address = 0;
+  bool has_address = false, has_session_address = false;
+  SdpDirection session_direction = SDP_SENDRECV;
+  bool has_direction = false;
+  uint32_t session_ptime = 0;
+  // 0: session level, 1: inside the audio section, 2: in some other media section
+  int section = 0;
+  bool found = false;
+
+  const char *end = sdp + len;
+  for (const char *line = sdp; line < end;) {
+    const char *eol = (const char *)memchr(line, '\n', end - line);
+    const char *next = eol != nullptr ? eol + 1 : end;
+    if (eol == nullptr)
+      eol = end;
+    if (eol > line && eol[-1] == '\r')
+      eol--;
+    if (eol - line < 2 || line[1] != '=') {
+      line = next;
+      continue;
+    }
+    char type = line[0];
+    Field f{line + 2, eol};
+    line = next;
+
+    if (type == 'm') {
+      if (found)
+        break;  // only the first audio stream is used
+      if (!f.skip("audio ")) {
+        section = 2;
+        continue;
+      }
+      section = 1;
+      found = true;
+      uint32_t port;
+      f.skip_spaces();
+      if (!f.number(65535, &port))
+        continue;
+      if (f.skip("/")) {
+        uint32_t count;
+        f.number(65535, &count);
+      }
+      f.skip_spaces();
+      if (!f.skip("RTP/AVP ")) {
+        // SRTP, AVPF feedback or anything else we cannot speak
+        continue;
+      }
+      this->port = (uint16_t)port;
+      while (!f.at_end() && this->format_count < SDP_MAX_FORMATS) {
+        f.skip_spaces();
+        uint32_t pt;
+        if (!f.number(127, &pt))
+          break;
+        this->formats[this->format_count++].payload_type = (uint8_t)pt;
+      }
+      continue;
+    }
+    if (section == 2)
+      continue;
+
+    if (type == 'c') {
+      if (section == 0) {
+        session_address = parse_connection(f);
+        has_session_address = true;
+      } else {
+        this->address = parse_connection(f);
+        has_address = true;
+      }
+    } else if (type == 'a') {
+      SdpDirection direction;
+      uint32_t v;
+      if (parse_direction(f, &direction)) {
+        if (section == 0) {
+          session_direction = direction;
+        } else {
+          this->direction = direction;
+          has_direction = true;
+        }
+      } else if (f.skip("ptime:")) {
+        if (!f.number(255, &v))
+          continue;
+        if (section == 0) {
+          session_ptime = v;
+        } else {
+          this->ptime = (uint8_t)v;
+        }
+      } else if (f.skip("maxptime:")) {
+        if (section == 1 && f.number(255, &v))
+          this->maxptime = (uint8_t)v;
+      } else if (section == 1 && f.skip("rtcp:")) {
+        // rtcp:<port> [IN IP4 <address>]; a different address is not supported, RTCP follows c=
+        if (f.number(65535, &v) && v != 0)
+          this->rtcp_port = (uint16_t)v;
+      } else if (section == 1 && f.skip("rtpmap:")) {
+        // rtpmap:<pt> <encoding>/<clock rate>[/<channels>]
+        uint32_t pt, rate, channels = 1;
+        if (!f.number(127, &pt) || !f.skip(" "))
+          continue;
+        SdpFormat *fmt = find_format(this, pt);
+        if (fmt == nullptr)
+          continue;
+        char encoding[sizeof(fmt->encoding)];
+        f.copy(encoding, sizeof(encoding), '/');
+        if (!f.skip("/") || !f.number(0xFFFFFFFF / 10, &rate))
+          continue;
+        if (f.skip("/"))
+          f.number(255, &channels);
+        memcpy(fmt->encoding, encoding, sizeof(encoding));
+        fmt->clock_rate = rate;
+        fmt->channels = (uint8_t)channels;
+      } else if (section == 1 && f.skip("fmtp:")) {
+        uint32_t pt;
+        if (!f.number(127, &pt) || !f.skip(" "))
+          continue;
+        SdpFormat *fmt = find_format(this, pt);
+        if (fmt != nullptr)
+          f.copy(fmt->fmtp, sizeof(fmt->fmtp), '\0');
+      }
+    }
+  }
+  if (!found)
+    return false;
+  if (!has_address && has_session_address)
+    this->address = session_address;
+  if (!has_direction)
+    this->direction = session_direction;
+  if (this->ptime == 0)
+    this->ptime = (uint8_t)session_ptime;
+  return true;
+}
+
+const SdpFormat *SdpMedia::find(uint8_t payload_type) const {
+  return find_format(const_cast<SdpMedia *>(this), payload_type);
+}
+
+void sdp_write_offer(SipMessage &msg, const char *ip, uint16_t port, uint32_t session_id, const SdpCodec *codecs,
+                     size_t count, uint8_t ptime, bool comfort_noise) {
+  msg.line("v=0");
+  msg.str("o=- ").unum(session_id).chr(' ').unum(session_id).str(" IN IP4 ").str(ip).crlf();
+  msg.line("s=sipcall");
+  msg.str("c=IN IP4 ").str(ip).crlf();
+  msg.line("t=0 0");
+  msg.str("m=audio ").unum(port).str(" RTP/AVP");
+  for (size_t i = 0; i < count; i++)
+    msg.chr(' ').unum(codecs[i].payload_type);
+  if (comfort_noise)
+    msg.chr(' ').unum(CN_PAYLOAD_TYPE);
+  msg.crlf();
+  for (size_t i = 0; i < count; i++) {
+    msg.str("a=rtpmap:").unum(codecs[i].payload_type).chr(' ').str(codecs[i].encoding);
+    msg.chr('/').unum(codecs[i].clock_rate).crlf();
+  }
+  if (comfort_noise)
+    msg.str("a=rtpmap:").unum(CN_PAYLOAD_TYPE).str(" CN/8000").crlf();
+  msg.str("a=ptime:").unum(ptime).crlf();
+  msg.line("a=sendrecv");
+}
+
+void sdp_write_answer(SipMessage &msg, const char *ip, uint16_t port, uint32_t session_id, const SdpCodec &codec,
+                      const SdpNegotiation &negotiated) {
+  msg.line("v=0");
+  msg.str("o=- ").unum(session_id).chr(' ').unum(session_id).str(" IN IP4 ").str(ip).crlf();
+  msg.line("s=sipcall");
+  msg.str("c=IN IP4 ").str(ip).crlf();
+  msg.line("t=0 0");
+  msg.str("m=audio ").unum(port).str(" RTP/AVP ").unum(negotiated.payload_type);
+  if (negotiated.cn_payload_type != 0)
+    msg.chr(' ').unum(negotiated.cn_payload_type);
+  msg.crlf();
+  msg.str("a=rtpmap:").unum(negotiated.payload_type).chr(' ').str(codec.encoding);
+  msg.chr('/').unum(codec.clock_rate).crlf();
+  if (negotiated.cn_payload_type != 0)
+    msg.str("a=rtpmap:").unum(negotiated.cn_payload_type).str(" CN/8000").crlf();
+  msg.str("a=ptime:").unum(negotiated.ptime).crlf();
+  if (negotiated.send && negotiated.recv) {
+    msg.line("a=sendrecv");
+  } else if (negotiated.send) {
+    msg.line("a=sendonly");
+  } else if (negotiated.recv) {
+    msg.line("a=recvonly");
+  } else {
+    msg.line("a=inactive");
+  }
+}
+
+bool sdp_negotiate(const SdpMedia &answer, const SdpCodec *offered, size_t count, uint8_t ptime,
+                   SdpNegotiation *out) {
+  if (answer.port == 0)
+    return false;
+  for (uint8_t i = 0; i < answer.format_count; i++) {
+    const SdpFormat &f = answer.formats[i];
+    for (size_t c = 0; c < count; c++) {
+      if (!codec_matches(f, offered[c]))
+        continue;
+      out->codec = offered[c].id;
+      out->payload_type = f.payload_type;
+      // ptime is what the receiver wants to get; without one we keep our own
+      uint32_t p = answer.ptime != 0 ? answer.ptime : ptime;
+      if (answer.maxptime != 0 && p > answer.maxptime)
+        p = answer.maxptime;
+      p -= p % 10;
+      out->ptime = (uint8_t)(p < SDP_MIN_PTIME ? SDP_MIN_PTIME : (p > SDP_MAX_PTIME ? SDP_MAX_PTIME : p));
+      // the answer's direction is seen from the far end; c=0.0.0.0 is the RFC 2543 way to hold
+      out->send = answer.address != 0 && (answer.direction == SDP_SENDRECV || answer.direction == SDP_RECVONLY);
+      out->recv = answer.direction == SDP_SENDRECV || answer.direction == SDP_SENDONLY;
+      out->address = answer.address;
+      out->port = answer.port;
+      out->rtcp_port = answer.rtcp_port != 0 ? answer.rtcp_port : (uint16_t)(answer.port + 1);
+      out->cn_payload_type = 0;
+      for (uint8_t k = 0; k < answer.format_count; k++) {
+        if (is_comfort_noise(answer.formats[k])) {
+          out->cn_payload_type = answer.formats[k].payload_type;
+          break;
+        }
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace voip
+}  // namespace esphome
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace voip {
+
+class SipMessage;
+
+static const size_t SDP_MAX_FORMATS = 16;
+// packetization limits of the media path, in ms
+static const uint8_t SDP_MIN_PTIME = 10;
+static const uint8_t SDP_MAX_PTIME = 60;
+
+enum SdpDirection : uint8_t {
+  SDP_SENDRECV,
+  SDP_SENDONLY,
+  SDP_RECVONLY,
+  SDP_INACTIVE,
+};
+
+// One payload format of an m= line with its rtpmap and fmtp attributes
+struct SdpFormat {
+  uint8_t payload_type;
+  char encoding[16];     // rtpmap encoding name, empty without rtpmap
+  uint32_t clock_rate;   // 0 without rtpmap
+  uint8_t channels;
+  char fmtp[32];         // format parameters, truncated
+};
+
+// First audio stream of an SDP session description (RFC 4566), with session-level c=, ptime and
+// direction applied where the media section does not override them.
+struct SdpMedia {
+  uint32_t address;      // IPv4 of the c= line in host byte order, 0 if missing
+  uint16_t port;         // 0: no usable RTP/AVP audio stream
+  SdpDirection direction;
+  uint8_t ptime;         // ms, 0 if not given
+  uint8_t maxptime;      // ms, 0 if not given
+  uint16_t rtcp_port;    // a=rtcp (RFC 3605), 0 if not given: RTP port + 1
+  uint8_t format_count;  // formats in m= line order, at most SDP_MAX_FORMATS
+  SdpFormat formats[SDP_MAX_FORMATS];
+
+  // Returns false if the body has no audio stream
+  bool parse(const char *sdp, size_t len);
+  const SdpFormat *find(uint8_t payload_type) const;
+};
+
+// A codec this side can send and receive, as listed in the offer
+struct SdpCodec {
+  int id;  // caller's codec identifier, returned by negotiation
+  uint8_t payload_type;
+  const char *encoding;
+  uint32_t clock_rate;  // RTP clock rate as written in rtpmap
+};
+
+// What both sides agreed on for the audio stream
+struct SdpNegotiation {
+  int codec;             // SdpCodec::id
+  uint8_t payload_type;  // payload type of the answer, used in both directions
+  uint8_t ptime;         // TX packetization in ms
+  bool send;
+  bool recv;
+  uint32_t address;      // remote RTP address, host byte order
+  uint16_t port;
+  uint16_t rtcp_port;    // remote RTCP port on the same address
+  uint8_t cn_payload_type;  // comfort noise (RFC 3389) the remote side takes, 0 if none
+};
+
+// Writes the SDP offer for one audio stream: codecs in order of preference, comfort noise after them
+// if asked for, our ptime and sendrecv
+void sdp_write_offer(SipMessage &msg, const char *ip, uint16_t port, uint32_t session_id, const SdpCodec *codecs,
+                     size_t count, uint8_t ptime, bool comfort_noise = false);
+
+// Writes the SDP answer to an offer negotiated with sdp_negotiate: only the chosen format (and comfort
+// noise if negotiated), with the offerer's payload types, and the direction as seen from this side
+// (RFC 3264 section 6.1)
+void sdp_write_answer(SipMessage &msg, const char *ip, uint16_t port, uint32_t session_id, const SdpCodec &codec,
+                      const SdpNegotiation &negotiated);
+
+// Picks the first format of the remote description that matches one of our codecs (by rtpmap name
+// and clock rate, or by static payload type without rtpmap), so an answer gets the offerer's
+// preference and an offer's answerer gets our first codec it accepted. ptime follows the remote
+// side, else our own, limited by maxptime and rounded down to whole 10 ms. Comfort noise at 8 kHz is
+// picked up if the remote side lists it; whether to use it is up to the caller. Returns false if
+// nothing matches or the stream was rejected.
+bool sdp_negotiate(const SdpMedia &answer, const SdpCodec *offered, size_t count, uint8_t ptime,
+                   SdpNegotiation *out);
+
+}  // namespace voip
+}  // namespace esphome
@@ -0,0 +1,59 @@
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome.components import sensor
+from esphome.const import (
+    ENTITY_CATEGORY_DIAGNOSTIC,
+    STATE_CLASS_MEASUREMENT,
+    UNIT_DECIBEL,
+    UNIT_MILLISECOND,
+    UNIT_PERCENT,
+)
+from . import Voip
+
+DEPENDENCIES = ['voip']
+
+CONF_VOIP_ID = 'voip_id'
+
+# call quality from the RTCP reports of the call on the speaker, updated every few seconds
+SENSORS = {
+    # packets of the far end's stream we did not receive in the last report interval
+    'packet_loss': (UNIT_PERCENT, 1, 'mdi:lan-disconnect'),
+    # what the far end reports about our stream
+    'remote_packet_loss': (UNIT_PERCENT, 1, 'mdi:lan-disconnect'),
+    # interarrival jitter of the far end's stream (RFC 3550)
+    'jitter': (UNIT_MILLISECOND, 1, 'mdi:chart-bell-curve'),
+    'round_trip_time': (UNIT_MILLISECOND, 0, 'mdi:timer-outline'),
+    # E-model transmission rating (ITU-T G.107) and the mean opinion score estimated from it
+    'r_factor': ('', 0, 'mdi:phone-check'),
+    'mos': ('', 2, 'mdi:star-outline'),
+    # how much of the speaker's echo the echo canceller removes while the far end talks
+    'echo_return_loss_enhancement': (UNIT_DECIBEL, 0, 'mdi:account-voice-off'),
+    # gain of the microphone's auto_gain and of the speaker_limiter, amp_gain included, and the peak
+    # level they put out
+    'microphone_gain': (UNIT_DECIBEL, 1, 'mdi:microphone-plus'),
+    'microphone_peak': ('dBFS', 1, 'mdi:microphone'),
+    'speaker_gain': (UNIT_DECIBEL, 1, 'mdi:volume-plus'),
+    'speaker_peak': ('dBFS', 1, 'mdi:volume-high'),
+}
+
+CONFIG_SCHEMA = cv.Schema({
+    cv.GenerateID(CONF_VOIP_ID): cv.use_id(Voip),
+    **{
+        cv.Optional(key): sensor.sensor_schema(
+            unit_of_measurement=unit,
+            accuracy_decimals=decimals,
+            icon=icon,
+            state_class=STATE_CLASS_MEASUREMENT,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+        )
+        for key, (unit, decimals, icon) in SENSORS.items()
+    },
+})
+
+
+async def to_code(config):
+    voip = await cg.get_variable(config[CONF_VOIP_ID])
+    for key in SENSORS:
+        if key in config:
+            sens = await sensor.new_sensor(config[key])
+            cg.add(getattr(voip, f'set_{key}_sensor')(sens))
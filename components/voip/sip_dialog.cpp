@@ -0,0 +1,101 @@
+#include "sip_dialog.h"
+#include <cstring>
+#include <new>
+
+namespace esphome {
+namespace voip {
+
+bool SipDialogTable::allocate(size_t capacity) {
+  this->dialogs_.reset(new (std::nothrow) SipDialog[capacity]);
+  if (!this->dialogs_) {
+    this->capacity_ = 0;
+    this->size_ = 0;
+    return false;
+  }
+  memset(this->dialogs_.get(), 0, sizeof(SipDialog) * capacity);
+  this->capacity_ = capacity;
+  this->size_ = 0;
+  return true;
+}
+
+size_t SipDialogTable::active() const {
+  size_t n = 0;
+  for (size_t i = 0; i < this->capacity_; i++) {
+    if (this->dialogs_[i].id != 0 && this->dialogs_[i].is_active())
+      n++;
+  }
+  return n;
+}
+
+SipDialog *SipDialogTable::create(SipDialogState state, bool outgoing, uint32_t now) {
+  for (size_t i = 0; i < this->capacity_; i++) {
+    SipDialog *d = &this->dialogs_[i];
+    if (d->id != 0)
+      continue;
+    memset(d, 0, sizeof(*d));
+    d->id = this->next_id_++;
+    if (this->next_id_ == 0)
+      this->next_id_ = 1;
+    d->state = state;
+    d->outgoing = outgoing;
+    d->start_ms = now;
+    this->size_++;
+    return d;
+  }
+  return nullptr;
+}
+
+void SipDialogTable::release(SipDialog *dialog) {
+  if (dialog == nullptr || dialog->id == 0)
+    return;
+  dialog->id = 0;
+  dialog->state = SIP_DIALOG_FREE;
+  this->size_--;
+}
+
+SipDialog *SipDialogTable::find(uint32_t id) {
+  for (size_t i = 0; id != 0 && i < this->capacity_; i++) {
+    if (this->dialogs_[i].id == id)
+      return &this->dialogs_[i];
+  }
+  return nullptr;
+}
+
+const SipDialog *SipDialogTable::find(uint32_t id) const {
+  return const_cast<SipDialogTable *>(this)->find(id);
+}
+
+SipDialog *SipDialogTable::find(const SipParser &msg) {
+  SipSpan call_id = msg.header(SIP_HDR_CALL_ID);
+  if (call_id.empty() || call_id.length >= SIP_DIALOG_CALL_ID_SIZE)
+    return nullptr;
+  for (size_t i = 0; i < this->capacity_; i++) {
+    SipDialog *d = &this->dialogs_[i];
+    if (d->id != 0 && d->call_id[call_id.length] == '\0' && memcmp(d->call_id, msg.ptr(call_id), call_id.length) == 0)
+      return d;
+  }
+  return nullptr;
+}
+
+SipDialog *SipDialogTable::find_transaction(uint32_t txn) {
+  for (size_t i = 0; txn != 0 && i < this->capacity_; i++) {
+    SipDialog *d = &this->dialogs_[i];
+    if (d->id != 0 && (d->invite_txn == txn || d->cancel_txn == txn || d->server_txn == txn))
+      return d;
+  }
+  return nullptr;
+}
+
+SipDialog *SipDialogTable::oldest_ringing() {
+  SipDialog *oldest = nullptr;
+  for (size_t i = 0; i < this->capacity_; i++) {
+    SipDialog *d = &this->dialogs_[i];
+    // ids count up, the smallest is the oldest
+    if (d->id != 0 && d->state == SIP_DIALOG_RINGING && (oldest == nullptr || d->id < oldest->id))
+      oldest = d;
+  }
+  return oldest;
+}
+
+}  // namespace voip
+}  // namespace esphome
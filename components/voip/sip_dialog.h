@@ -0,0 +1,111 @@
+#pragma once
+
+#include "sdp.h"
+#include "sip_parser.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace esphome {
+namespace voip {
+
+enum SipDialogState : uint8_t {
+  SIP_DIALOG_FREE,
+  SIP_DIALOG_CALLING,      // our INVITE is out, no final response yet
+  SIP_DIALOG_RINGING,      // incoming INVITE answered with 180, waiting for answer() or hangup()
+  SIP_DIALOG_CONFIRMED,    // 200 sent or received
+  SIP_DIALOG_TERMINATING,  // hung up before the answer, waiting for the INVITE to end after our CANCEL
+};
+
+static const size_t SIP_DIALOG_CALL_ID_SIZE = 96;
+static const size_t SIP_DIALOG_PEER_SIZE = 48;
+static const size_t SIP_DIALOG_URI_SIZE = 128;
+static const size_t SIP_DIALOG_HEADERS_SIZE = 256;
+static const size_t SIP_DIALOG_RESPONSE_SIZE = 512;
+
+// One call, outgoing or incoming, with everything that has to outlive the message that created it.
+// Strings are fixed arrays, so a table of dialogs is one allocation of known size.
+struct SipDialog {
+  uint32_t id;  // handle for the application, never reused; 0 while the slot is free
+  SipDialogState state;
+  bool outgoing;
+  // outgoing call hung up before the answer: CANCEL once the INVITE got a provisional response,
+  // and end a 200 that crosses the CANCEL with a BYE
+  bool cancelled;
+  uint8_t auth_attempts;
+  int local_cseq;  // CSeq of our last request
+  uint32_t local_tag;
+  uint32_t start_ms;
+  uint32_t invite_txn;  // our INVITE client transaction
+  uint32_t cancel_txn;
+  // the caller's INVITE or a re-INVITE we answered, until the ACK arrives
+  uint32_t server_txn;
+  uint16_t rtp_port;  // local RTP port of the call
+  char call_id[SIP_DIALOG_CALL_ID_SIZE];
+  // number dialled, or the caller's user part (else the URI)
+  char peer[SIP_DIALOG_PEER_SIZE];
+  // display name in the From of our INVITE
+  char display[SIP_DIALOG_PEER_SIZE];
+  // Request-URI of in-dialog requests: the peer's Contact, empty to address peer at the server
+  char remote_target[SIP_DIALOG_URI_SIZE];
+  // Call-ID, From and To lines of our in-dialog requests, without the trailing CRLF
+  char headers[SIP_DIALOG_HEADERS_SIZE];
+  // Via, From, To with our tag, Call-ID and CSeq of every response to the INVITE in server_txn, kept
+  // because answer() comes after the INVITE is gone
+  char response_headers[SIP_DIALOG_RESPONSE_SIZE];
+  // incoming: what we answer to the caller's offer
+  SdpNegotiation offer;
+  // audio stream negotiated for the call, valid while media_valid
+  SdpNegotiation media;
+  bool media_valid;
+  // changes whenever the negotiated stream starts, changes or stops
+  uint32_t media_version;
+
+  bool is_active() const { return this->state != SIP_DIALOG_FREE && this->state != SIP_DIALOG_TERMINATING; }
+};
+
+// The calls the device holds at the same time, a fixed number of dialog slots allocated once.
+//
+// Requests and responses find their dialog by Call-ID; transaction timeouts by the transaction id.
+// A released slot is cleared and reused for the next call, but under a new id, so a handle kept by
+// the application for an ended call never addresses the next one.
+class SipDialogTable {
+ public:
+  // allocates capacity slots, false if there is not enough memory
+  bool allocate(size_t capacity);
+  size_t capacity() const { return this->capacity_; }
+  // dialogs in use, including the ones still ending
+  size_t size() const { return this->size_; }
+  // calls that are neither free nor ending
+  size_t active() const;
+  bool full() const { return this->size_ >= this->capacity_; }
+
+  // a cleared dialog in the state given, nullptr if all slots are in use
+  SipDialog *create(SipDialogState state, bool outgoing, uint32_t now);
+  void release(SipDialog *dialog);
+
+  SipDialog *find(uint32_t id);
+  const SipDialog *find(uint32_t id) const;
+  // the dialog of msg's Call-ID, nullptr for none
+  SipDialog *find(const SipParser &msg);
+  // the dialog with txn as INVITE, CANCEL or server transaction
+  SipDialog *find_transaction(uint32_t txn);
+  // the dialog that has been ringing longest, nullptr if none is ringing
+  SipDialog *oldest_ringing();
+  const SipDialog *oldest_ringing() const { return const_cast<SipDialogTable *>(this)->oldest_ringing(); }
+
+  // slot i, nullptr if it is free; for iterating over all dialogs
+  SipDialog *at(size_t i) { return i < this->capacity_ && this->dialogs_[i].id != 0 ? &this->dialogs_[i] : nullptr; }
+  const SipDialog *at(size_t i) const {
+    return i < this->capacity_ && this->dialogs_[i].id != 0 ? &this->dialogs_[i] : nullptr;
+  }
+
+ protected:
+  std::unique_ptr<SipDialog[]> dialogs_;
+  size_t capacity_ = 0;
+  size_t size_ = 0;
+  uint32_t next_id_ = 1;
+};
+
+}  // namespace voip
+}  // namespace esphome
@@ -0,0 +1,122 @@
+#include "sip_digest.h"
+#include <strings.h>
+
+namespace esphome {
+namespace voip {
+
+namespace {
+
+// copies span into a NUL-terminated field; false if it does not fit
+bool copy_field(const SipParser &msg, SipSpan span, char *out, size_t size) {
+  if (span.length >= size)
+    return false;
+  memcpy(out, msg.ptr(span), span.length);
+  out[span.length] = '\0';
+  return true;
+}
+
+// whether the qop list ("auth,auth-int") offers plain auth
+bool offers_auth(const char *p, size_t n) {
+  size_t i = 0;
+  while (i < n) {
+    while (i < n && (p[i] == ',' || p[i] == ' '))
+      i++;
+    size_t start = i;
+    while (i < n && p[i] != ',' && p[i] != ' ')
+      i++;
+    if (i - start == 4 && strncasecmp(p + start, "auth", 4) == 0)
+      return true;
+  }
+  return false;
+}
+
+void hex8(uint32_t v, char *out) {
+  static const char HEX[] = "0123456789abcdef";
+  for (int i = 7; i >= 0; i--, v >>= 4)
+    out[i] = HEX[v & 15];
+  out[8] = '\0';
+}
+
+}  // namespace
+
+void SipDigestAuth::set_credentials(const std::string &user, const std::string &password) {
+  this->user_ = user;
+  this->password_ = password;
+  // HA1 depends on both
+  this->realm_[0] = '\0';
+  this->nonce_valid_ = false;
+}
+
+bool SipDigestAuth::on_challenge(const SipParser &response, uint32_t now) {
+  this->nonce_valid_ = false;
+  bool proxy = response.get_status() == 407;
+  SipSpan challenge = response.header(proxy ? SIP_HDR_PROXY_AUTHENTICATE : SIP_HDR_WWW_AUTHENTICATE);
+  SipSpan realm = response.param(challenge, "realm");
+  SipSpan nonce = response.param(challenge, "nonce");
+  SipSpan opaque = response.param(challenge, "opaque");
+  SipSpan qop = response.param(challenge, "qop");
+  SipSpan algorithm = response.param(challenge, "algorithm");
+  if (realm.empty() || nonce.empty() || nonce.length >= sizeof(this->nonce_) || opaque.length >= sizeof(this->opaque_))
+    return false;
+  if (!algorithm.empty() && !(algorithm.length == 3 && strncasecmp(response.ptr(algorithm), "MD5", 3) == 0))
+    return false;  // MD5-sess, SHA-256, ...
+  bool qop_auth = !qop.empty() && offers_auth(response.ptr(qop), qop.length);
+  if (!qop.empty() && !qop_auth)
+    return false;  // auth-int only
+
+  if (realm.length != strlen(this->realm_) || memcmp(this->realm_, response.ptr(realm), realm.length) != 0) {
+    if (!copy_field(response, realm, this->realm_, sizeof(this->realm_))) {
+      this->realm_[0] = '\0';
+      return false;
+    }
+    Md5 md5;
+    md5.update(this->user_.data(), this->user_.size()).colon().update(this->realm_).colon();
+    md5.update(this->password_.data(), this->password_.size()).finish_hex(this->ha1_);
+    this->ha1_count_++;
+  }
+  if (nonce.length != strlen(this->nonce_) || memcmp(this->nonce_, response.ptr(nonce), nonce.length) != 0) {
+    copy_field(response, nonce, this->nonce_, sizeof(this->nonce_));
+    // a new nonce starts counting again, with a client nonce of its own
+    this->nc_ = 0;
+    hex8(this->random_ ? this->random_() : now, this->cnonce_);
+  }
+  copy_field(response, opaque, this->opaque_, sizeof(this->opaque_));
+  this->proxy_ = proxy;
+  this->qop_auth_ = qop_auth;
+  this->nonce_time_ = now;
+  this->nonce_valid_ = true;
+  return true;
+}
+
+bool SipDigestAuth::can_authorize(uint32_t now) const {
+  return this->nonce_valid_ && now - this->nonce_time_ < this->nonce_lifetime_ms_;
+}
+
+bool SipDigestAuth::write_authorization(SipMessage &out, const char *method, const char *uri) {
+  if (!this->nonce_valid_)
+    return false;
+  char ha2[Md5::HEX_SIZE];
+  char response[Md5::HEX_SIZE];
+  char nc[9];
+  Md5 md5;
+  md5.update(method).colon().update(uri).finish_hex(ha2);
+  md5.update(this->ha1_, 32).colon().update(this->nonce_).colon();
+  if (this->qop_auth_) {
+    hex8(++this->nc_, nc);
+    md5.update(nc, 8).colon().update(this->cnonce_).colon().update("auth", 4).colon();
+  }
+  md5.update(ha2, 32).finish_hex(response);
+
+  out.str(this->proxy_ ? "Proxy-Authorization" : "Authorization").str(": Digest username=").quoted(this->user_);
+  out.str(", realm=").quoted(this->realm_).str(", nonce=").quoted(this->nonce_).str(", uri=").quoted(uri);
+  out.str(", response=").quoted(response).str(", algorithm=MD5");
+  if (this->opaque_[0] != '\0')
+    out.str(", opaque=").quoted(this->opaque_);
+  if (this->qop_auth_)
+    out.str(", qop=auth, nc=").str(nc, 8).str(", cnonce=").quoted(this->cnonce_);
+  out.crlf();
+  return true;
+}
+
+}  // namespace voip
+}  // namespace esphome
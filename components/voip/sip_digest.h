@@ -0,0 +1,63 @@
+#pragma once
+
+#include "md5.h"
+#include "sip_message.h"
+#include "sip_parser.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace esphome {
+namespace voip {
+
+// Client side of SIP digest authentication (RFC 3261 22.4, RFC 2617) with a credential cache.
+//
+// HA1 = MD5(user:realm:password) is computed once per realm and kept as hex. The last challenge's
+// nonce, opaque and qop are kept too, so later requests (the refresh REGISTER, the next INVITE, a
+// BYE) carry an Authorization header right away instead of waiting for a 401 (22.3). With qop=auth
+// every use of the nonce counts nc up. A nonce is used for at most nonce_lifetime ms, or until the
+// server challenges again. Only MD5 with qop auth or without qop is supported. Writing a header
+// hashes straight from the cached fields and does not allocate.
+class SipDigestAuth {
+ public:
+  static const uint32_t DEFAULT_NONCE_LIFETIME_MS = 300000;
+
+  void set_credentials(const std::string &user, const std::string &password);
+  // source of the client nonces
+  void set_random(std::function<uint32_t()> &&random) { this->random_ = std::move(random); }
+  void set_nonce_lifetime(uint32_t ms) { this->nonce_lifetime_ms_ = ms; }
+
+  // Takes the challenge of a 401 or 407 response. Returns false if it cannot be answered.
+  bool on_challenge(const SipParser &response, uint32_t now);
+  // Whether a cached nonce may be sent without a new challenge
+  bool can_authorize(uint32_t now) const;
+  // Appends Authorization (or Proxy-Authorization after a 407) for method and Request-URI uri
+  bool write_authorization(SipMessage &out, const char *method, const char *uri);
+  // Drops the nonce but keeps HA1, e.g. when the server rejects the credentials
+  void forget_nonce() { this->nonce_valid_ = false; }
+
+  // HA1 computations so far, one per realm unless the password changes
+  uint32_t get_ha1_count() const { return this->ha1_count_; }
+  uint32_t get_nonce_count() const { return this->nc_; }
+
+ protected:
+  std::string user_;
+  std::string password_;
+  std::function<uint32_t()> random_;
+  uint32_t nonce_lifetime_ms_ = DEFAULT_NONCE_LIFETIME_MS;
+  char realm_[64] = {0};
+  char ha1_[Md5::HEX_SIZE] = {0};
+  char nonce_[128] = {0};
+  char opaque_[64] = {0};
+  char cnonce_[9] = {0};
+  bool nonce_valid_ = false;
+  bool proxy_ = false;
+  bool qop_auth_ = false;
+  uint32_t nonce_time_ = 0;
+  uint32_t nc_ = 0;
+  uint32_t ha1_count_ = 0;
+};
+
+}  // namespace voip
+}  // namespace esphome
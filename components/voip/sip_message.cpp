@@ -0,0 +1,150 @@
+#include "sip_message.h"
+#include <cstring>
+
+namespace esphome {
+namespace voip {
+
+namespace {
+// digits reserved for the Content-Length value; more than any UDP datagram needs
+constexpr size_t LENGTH_DIGITS = 5;
+const char HEX_DIGITS[] = "0123456789abcdef";
+}  // namespace
+
+void SipMessage::attach(char *buf, size_t capacity) {
+  this->buf_ = buf;
+  this->capacity_ = buf != nullptr ? capacity : 0;
+  this->clear();
+}
+
+void SipMessage::clear() {
+  this->len_ = 0;
+  this->length_pos_ = 0;
+  this->body_pos_ = 0;
+  // a detached writer starts out overflowed so that nothing built in it is ever sent
+  this->overflow_ = this->capacity_ == 0;
+  if (this->capacity_ > 0)
+    this->buf_[0] = '\0';
+}
+
+char *SipMessage::reserve_(size_t n) {
+  // one byte stays free for the terminating NUL
+  if (this->overflow_ || this->len_ + n >= this->capacity_) {
+    this->overflow_ = true;
+    return nullptr;
+  }
+  char *p = this->buf_ + this->len_;
+  this->len_ += n;
+  this->buf_[this->len_] = '\0';
+  return p;
+}
+
+SipMessage &SipMessage::str(const char *s, size_t len) {
+  char *p = this->reserve_(len);
+  if (p != nullptr)
+    memcpy(p, s, len);
+  return *this;
+}
+
+SipMessage &SipMessage::str(const char *s) { return s != nullptr ? this->str(s, strlen(s)) : *this; }
+
+SipMessage &SipMessage::chr(char c) {
+  char *p = this->reserve_(1);
+  if (p != nullptr)
+    *p = c;
+  return *this;
+}
+
+SipMessage &SipMessage::num(int32_t v) {
+  if (v < 0) {
+    this->chr('-');
+    // negate in unsigned arithmetic so INT32_MIN works
+    return this->unum(0u - (uint32_t)v);
+  }
+  return this->unum((uint32_t)v);
+}
+
+SipMessage &SipMessage::unum(uint32_t v, int width) {
+  char tmp[10];
+  int n = 0;
+  do {
+    tmp[n++] = (char)('0' + v % 10);
+    v /= 10;
+  } while (v != 0);
+  int pad = width > n ? width - n : 0;
+  char *p = this->reserve_(pad + n);
+  if (p == nullptr)
+    return *this;
+  memset(p, '0', pad);
+  for (int i = 0; i < n; i++)
+    p[pad + i] = tmp[n - 1 - i];
+  return *this;
+}
+
+SipMessage &SipMessage::hex(uint32_t v, int width) {
+  char tmp[8];
+  int n = 0;
+  do {
+    tmp[n++] = HEX_DIGITS[v & 0xF];
+    v >>= 4;
+  } while (v != 0);
+  int pad = width > n ? width - n : 0;
+  char *p = this->reserve_(pad + n);
+  if (p == nullptr)
+    return *this;
+  memset(p, '0', pad);
+  for (int i = 0; i < n; i++)
+    p[pad + i] = tmp[n - 1 - i];
+  return *this;
+}
+
+SipMessage &SipMessage::quoted(const char *s) {
+  this->chr('"');
+  if (s != nullptr) {
+    const char *run = s;
+    for (; *s != '\0'; s++) {
+      if (*s == '"' || *s == '\\') {
+        this->str(run, s - run).chr('\\');
+        run = s;
+      }
+    }
+    this->str(run, s - run);
+  }
+  return this->chr('"');
+}
+
+void SipMessage::begin_body() {
+  this->str("Content-Length: ", 16);
+  char *p = this->reserve_(LENGTH_DIGITS);
+  if (p == nullptr)
+    return;
+  this->length_pos_ = p - this->buf_;
+  this->str("\r\n\r\n", 4);
+  this->body_pos_ = this->len_;
+}
+
+bool SipMessage::finish() {
+  if (this->overflow_)
+    return false;
+  if (this->body_pos_ == 0)
+    return true;
+  // format the body length right-aligned into the reserved digits, then close the gap
+  size_t body_len = this->len_ - this->body_pos_;
+  char *digits = this->buf_ + this->length_pos_;
+  size_t n = 0;
+  do {
+    digits[LENGTH_DIGITS - 1 - n++] = (char)('0' + body_len % 10);
+    body_len /= 10;
+  } while (body_len != 0 && n < LENGTH_DIGITS);
+  size_t gap = LENGTH_DIGITS - n;
+  if (gap > 0) {
+    memmove(digits, digits + gap, this->len_ - this->length_pos_ - gap);
+    this->len_ -= gap;
+    this->buf_[this->len_] = '\0';
+  }
+  this->length_pos_ = 0;
+  this->body_pos_ = 0;
+  return true;
+}
+
+}  // namespace voip
+}  // namespace esphome
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace esphome {
+namespace voip {
+
+// Cursor-based writer for outgoing SIP messages over a caller-owned buffer.
+//
+// Appends never scan the buffer: the writer keeps the current length, and the text stays NUL
+// terminated for logging. Writes that do not fit are dropped and the message is marked as
+// overflowed; check finish() before sending. The Content-Length header is written by begin_body()
+// and its value is filled in by finish() from the bytes actually appended as body.
+//
+//   SipMessage m(buf, sizeof(buf));
+//   m.str("CSeq: ").num(cseq).str(" INVITE").crlf();
+//   m.begin_body();
+//   m.str("v=0").crlf();
+//   if (m.finish()) send(m.data(), m.size());
+class SipMessage {
+ public:
+  SipMessage() = default;
+  SipMessage(char *buf, size_t capacity) { this->attach(buf, capacity); }
+
+  void attach(char *buf, size_t capacity);
+  // Starts a new message in the same buffer
+  void clear();
+
+  SipMessage &str(const char *s);
+  SipMessage &str(const char *s, size_t len);
+  SipMessage &str(const std::string &s) { return this->str(s.data(), s.size()); }
+  SipMessage &chr(char c);
+  SipMessage &num(int32_t v);
+  // Unsigned decimal, zero padded to at least width digits
+  SipMessage &unum(uint32_t v, int width = 0);
+  // Lower case hex, zero padded to at least width digits
+  SipMessage &hex(uint32_t v, int width = 0);
+  // RFC 3261 quoted-string: adds the quotes and escapes '"' and '\'
+  SipMessage &quoted(const char *s);
+  SipMessage &quoted(const std::string &s) { return this->quoted(s.c_str()); }
+  SipMessage &crlf() { return this->str("\r\n", 2); }
+  // A complete header or body line, CRLF appended
+  SipMessage &line(const char *s) { return this->str(s).crlf(); }
+
+  // Writes the Content-Length header and the empty line that ends the header section; everything
+  // appended afterwards is the body
+  void begin_body();
+  // Completes Content-Length; returns false if anything was dropped
+  bool finish();
+
+  const char *data() const { return this->buf_; }
+  size_t size() const { return this->len_; }
+  size_t capacity() const { return this->capacity_; }
+  bool overflowed() const { return this->overflow_; }
+
+ protected:
+  // reserves n bytes at the cursor; nullptr (and the overflow flag) if they do not fit
+  char *reserve_(size_t n);
+
+  char *buf_{nullptr};
+  size_t capacity_{0};
+  size_t len_{0};
+  // offset of the Content-Length value and of the body, 0 while begin_body() was not called
+  size_t length_pos_{0};
+  size_t body_pos_{0};
+  bool overflow_{false};
+};
+
+}  // namespace voip
+}  // namespace esphome
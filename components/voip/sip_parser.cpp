@@ -0,0 +1,323 @@
+#include "sip_parser.h"
+#include <cstring>
+
+namespace esphome {
+namespace voip {
+
+namespace {
+
+struct HeaderName {
+  const char *name;  // lower case
+  uint8_t length;
+  char compact;  // RFC 3261 7.3.3 compact form, 0 if none
+};
+
+// indexed by SipHeader
+const HeaderName HEADER_NAMES[SIP_HDR_COUNT] = {
+    {"call-id", 7, 'i'},
+    {"cseq", 4, 0},
+    {"from", 4, 'f'},
+    {"to", 2, 't'},
+    {"via", 3, 'v'},
+    {"contact", 7, 'm'},
+    {"content-type", 12, 'c'},
+    {"content-length", 14, 'l'},
+    {"www-authenticate", 16, 0},
+    {"proxy-authenticate", 18, 0},
+    {"expires", 7, 0},
+    {"min-expires", 11, 0},
+};
+
+const char *const CANONICAL_NAMES[SIP_HDR_COUNT] = {
+    "Call-ID",      "CSeq",           "From",
+    "To",           "Via",            "Contact",
+    "Content-Type", "Content-Length", "WWW-Authenticate",
+    "Proxy-Authenticate", "Expires",        "Min-Expires",
+};
+
+struct MethodName {
+  const char *name;
+  uint8_t length;
+  SipMethod method;
+};
+
+const MethodName METHODS[] = {
+    {"INVITE", 6, SIP_METHOD_INVITE},   {"ACK", 3, SIP_METHOD_ACK},          {"BYE", 3, SIP_METHOD_BYE},
+    {"CANCEL", 6, SIP_METHOD_CANCEL},   {"OPTIONS", 7, SIP_METHOD_OPTIONS},  {"INFO", 4, SIP_METHOD_INFO},
+    {"REGISTER", 8, SIP_METHOD_REGISTER}, {"NOTIFY", 6, SIP_METHOD_NOTIFY},
+};
+
+inline char lower(char c) { return (c >= 'A' && c <= 'Z') ? (char)(c + 32) : c; }
+inline bool is_ws(char c) { return c == ' ' || c == '\t'; }
+// whitespace inside a (possibly folded) header value
+inline bool is_lws(char c) { return is_ws(c) || c == '\r' || c == '\n'; }
+inline bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+// method names are case-sensitive (RFC 3261 7.1)
+SipMethod classify_method(const char *p, size_t n) {
+  for (const MethodName &m : METHODS) {
+    if (m.length == n && memcmp(m.name, p, n) == 0)
+      return m.method;
+  }
+  return SIP_METHOD_OTHER;
+}
+
+// header names are not; dispatch on the first letter, then compare the rest of the name
+int classify_header(const char *p, size_t n) {
+  char c = lower(p[0]);
+  if (n == 1) {
+    for (int h = 0; h < SIP_HDR_COUNT; h++) {
+      if (HEADER_NAMES[h].compact == c)
+        return h;
+    }
+    return -1;
+  }
+  uint32_t candidates;
+  switch (c) {
+    case 'c':
+      candidates = (1u << SIP_HDR_CALL_ID) | (1u << SIP_HDR_CSEQ) | (1u << SIP_HDR_CONTACT) |
+                   (1u << SIP_HDR_CONTENT_TYPE) | (1u << SIP_HDR_CONTENT_LENGTH);
+      break;
+    case 'f':
+      candidates = 1u << SIP_HDR_FROM;
+      break;
+    case 't':
+      candidates = 1u << SIP_HDR_TO;
+      break;
+    case 'v':
+      candidates = 1u << SIP_HDR_VIA;
+      break;
+    case 'w':
+      candidates = 1u << SIP_HDR_WWW_AUTHENTICATE;
+      break;
+    case 'p':
+      candidates = 1u << SIP_HDR_PROXY_AUTHENTICATE;
+      break;
+    case 'e':
+      candidates = 1u << SIP_HDR_EXPIRES;
+      break;
+    case 'm':
+      candidates = 1u << SIP_HDR_MIN_EXPIRES;
+      break;
+    default:
+      return -1;
+  }
+  for (int h = 0; candidates != 0; h++, candidates >>= 1) {
+    const HeaderName &hn = HEADER_NAMES[h];
+    if (!(candidates & 1) || hn.length != n)
+      continue;
+    size_t i = 1;
+    while (i < n && lower(p[i]) == hn.name[i])
+      i++;
+    if (i == n)
+      return h;
+  }
+  return -1;
+}
+
+// end of the line starting at pos: offset of its '\n', or len for the last line
+size_t line_end(const char *data, size_t pos, size_t len) {
+  const void *nl = memchr(data + pos, '\n', len - pos);
+  return nl != nullptr ? (const char *)nl - data : len;
+}
+
+SipSpan make_span(size_t begin, size_t end) {
+  return SipSpan{(uint16_t)begin, (uint16_t)(end - begin)};
+}
+
+}  // namespace
+
+const char *sip_header_name(SipHeader header) { return header < SIP_HDR_COUNT ? CANONICAL_NAMES[header] : ""; }
+
+bool SipParser::parse(const char *data, size_t len) {
+  *this = SipParser();
+  this->data_ = data;
+  if (data == nullptr)
+    return false;
+  if (len > 0xFFFF)
+    len = 0xFFFF;
+
+  // start line
+  size_t eol = line_end(data, 0, len);
+  size_t end = (eol > 0 && data[eol - 1] == '\r') ? eol - 1 : eol;
+  if (end >= 12 && memcmp(data, "SIP/2.0 ", 8) == 0) {
+    // SIP/2.0 SP 3DIGIT SP reason
+    if (!is_digit(data[8]) || !is_digit(data[9]) || !is_digit(data[10]) || data[11] != ' ')
+      return false;
+    this->status_ = (data[8] - '0') * 100 + (data[9] - '0') * 10 + (data[10] - '0');
+    if (this->status_ < 100)
+      return false;
+    this->reason_ = make_span(12, end);
+  } else {
+    // Method SP Request-URI SP SIP/2.0
+    size_t sp1 = 0;
+    while (sp1 < end && data[sp1] != ' ')
+      sp1++;
+    size_t sp2 = sp1 + 1;
+    while (sp2 < end && data[sp2] != ' ')
+      sp2++;
+    if (sp1 == 0 || sp2 >= end || sp2 == sp1 + 1 || end - sp2 - 1 != 7 || memcmp(data + sp2 + 1, "SIP/2.0", 7) != 0)
+      return false;
+    this->method_name_ = make_span(0, sp1);
+    this->method_ = classify_method(data, sp1);
+    this->request_uri_ = make_span(sp1 + 1, sp2);
+  }
+
+  // header lines up to the empty line
+  int last = -1;  // header a continuation line belongs to, -1 if not indexed
+  size_t pos = eol + 1;
+  bool has_body = false;
+  while (pos < len) {
+    eol = line_end(data, pos, len);
+    end = (eol > pos && data[eol - 1] == '\r') ? eol - 1 : eol;
+    if (end == pos) {
+      has_body = eol < len;
+      pos = eol + 1;
+      break;
+    }
+    if (is_ws(data[pos])) {
+      // folded line: extends the previous value
+      if (last >= 0) {
+        size_t e = end;
+        while (e > pos && is_ws(data[e - 1]))
+          e--;
+        if (e > pos)
+          this->headers_[last].length = (uint16_t)(e - this->headers_[last].offset);
+      }
+    } else {
+      last = -1;
+      const void *c = memchr(data + pos, ':', end - pos);
+      size_t colon = c != nullptr ? (const char *)c - data : end;
+      size_t name_end = colon;
+      while (name_end > pos && is_ws(data[name_end - 1]))
+        name_end--;
+      int h = colon < end ? classify_header(data + pos, name_end - pos) : -1;
+      if (h >= 0 && this->headers_[h].length == 0) {
+        size_t b = colon + 1, e = end;
+        while (b < e && is_ws(data[b]))
+          b++;
+        while (e > b && is_ws(data[e - 1]))
+          e--;
+        this->headers_[h] = make_span(b, e);
+        last = h;
+      }
+    }
+    pos = eol + 1;
+  }
+  if (has_body && pos < len) {
+    size_t body_len = len - pos;
+    SipSpan cl = this->headers_[SIP_HDR_CONTENT_LENGTH];
+    if (cl.length != 0) {
+      size_t n = 0;
+      for (size_t i = cl.offset; i < (size_t)cl.offset + cl.length && is_digit(data[i]) && n <= len; i++)
+        n = n * 10 + (data[i] - '0');
+      if (n < body_len)
+        body_len = n;
+    }
+    this->body_ = make_span(pos, pos + body_len);
+  } else {
+    this->body_ = make_span(len, len);
+  }
+
+  // CSeq: number LWS method
+  SipSpan cseq = this->headers_[SIP_HDR_CSEQ];
+  if (cseq.length != 0) {
+    const char *p = data + cseq.offset;
+    const char *e = p + cseq.length;
+    int64_t n = 0;
+    const char *d = p;
+    while (d < e && is_digit(*d) && n <= 0x7FFFFFFF)
+      n = n * 10 + (*d++ - '0');
+    if (d > p && n <= 0x7FFFFFFF && d < e && is_ws(*d)) {
+      while (d < e && is_ws(*d))
+        d++;
+      if (d < e) {
+        this->cseq_ = (int32_t)n;
+        this->cseq_method_ = classify_method(d, e - d);
+      }
+    }
+  }
+  return true;
+}
+
+bool SipParser::equals(SipSpan span, const char *s) const {
+  size_t n = strlen(s);
+  return span.length == n && memcmp(this->data_ + span.offset, s, n) == 0;
+}
+
+SipSpan SipParser::uri(SipSpan value) const {
+  const char *p = this->data_ + value.offset;
+  size_t n = value.length;
+  size_t lt = 0;
+  while (lt < n && p[lt] != '<')
+    lt++;
+  if (lt < n) {
+    size_t gt = lt + 1;
+    while (gt < n && p[gt] != '>')
+      gt++;
+    if (gt < n)
+      return SipSpan{(uint16_t)(value.offset + lt + 1), (uint16_t)(gt - lt - 1)};
+    return SipSpan{value.offset, 0};
+  }
+  size_t e = 0;
+  while (e < n && p[e] != ';' && !is_lws(p[e]))
+    e++;
+  return SipSpan{value.offset, (uint16_t)e};
+}
+
+SipSpan SipParser::param(SipSpan value, const char *name) const {
+  const char *p = this->data_ + value.offset;
+  size_t n = value.length;
+  size_t name_len = strlen(name);
+  bool in_quotes = false;
+  for (size_t i = 0; i + name_len < n; i++) {
+    // skip quoted strings, a parameter name never starts inside one
+    if (in_quotes) {
+      if (p[i] == '\\')
+        i++;
+      else if (p[i] == '"')
+        in_quotes = false;
+      continue;
+    }
+    if (p[i] == '"') {
+      in_quotes = true;
+      continue;
+    }
+    // a parameter starts after ';', ',' or whitespace
+    if (i > 0 && p[i - 1] != ';' && p[i - 1] != ',' && !is_lws(p[i - 1]))
+      continue;
+    size_t k = 0;
+    while (k < name_len && lower(p[i + k]) == lower(name[k]))
+      k++;
+    if (k != name_len)
+      continue;
+    size_t v = i + name_len;
+    while (v < n && is_lws(p[v]))
+      v++;
+    if (v >= n || p[v] != '=')
+      continue;
+    v++;
+    while (v < n && is_lws(p[v]))
+      v++;
+    size_t e = v;
+    if (v < n && p[v] == '"') {
+      v++;
+      e = v;
+      while (e < n && p[e] != '"') {
+        if (p[e] == '\\' && e + 1 < n)
+          e++;
+        e++;
+      }
+      if (e >= n)
+        return SipSpan{value.offset, 0};
+    } else {
+      while (e < n && p[e] != ';' && p[e] != ',' && !is_lws(p[e]))
+        e++;
+    }
+    return SipSpan{(uint16_t)(value.offset + v), (uint16_t)(e - v)};
+  }
+  return SipSpan{value.offset, 0};
+}
+
+}  // namespace voip
+}  // namespace esphome
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace voip {
+
+// A piece of the parsed datagram: offset and length into the caller's buffer
+struct SipSpan {
+  uint16_t offset;
+  uint16_t length;
+  bool empty() const { return this->length == 0; }
+};
+
+// Headers the stack looks at. Lookups are O(1) through the index built by SipParser::parse().
+enum SipHeader : uint8_t {
+  SIP_HDR_CALL_ID,
+  SIP_HDR_CSEQ,
+  SIP_HDR_FROM,
+  SIP_HDR_TO,
+  SIP_HDR_VIA,
+  SIP_HDR_CONTACT,
+  SIP_HDR_CONTENT_TYPE,
+  SIP_HDR_CONTENT_LENGTH,
+  SIP_HDR_WWW_AUTHENTICATE,
+  SIP_HDR_PROXY_AUTHENTICATE,
+  SIP_HDR_EXPIRES,
+  SIP_HDR_MIN_EXPIRES,
+  SIP_HDR_COUNT,
+};
+
+enum SipMethod : uint8_t {
+  SIP_METHOD_NONE,  // responses
+  SIP_METHOD_OTHER,
+  SIP_METHOD_INVITE,
+  SIP_METHOD_ACK,
+  SIP_METHOD_BYE,
+  SIP_METHOD_CANCEL,
+  SIP_METHOD_OPTIONS,
+  SIP_METHOD_INFO,
+  SIP_METHOD_REGISTER,
+  SIP_METHOD_NOTIFY,
+};
+
+// Canonical header name, e.g. "Call-ID"
+const char *sip_header_name(SipHeader header);
+
+// One-pass SIP message tokenizer.
+//
+// parse() walks the datagram once: it splits the start line into method or status code, records the
+// value of the first occurrence of every known header (long or compact form, case-insensitive,
+// folded continuation lines included) and locates the body. Nothing is copied or modified; all
+// results are spans into the caller's buffer, which must outlive the parser.
+class SipParser {
+ public:
+  // Returns false if the start line is not a SIP/2.0 request or response
+  bool parse(const char *data, size_t len);
+
+  bool is_request() const { return this->method_ != SIP_METHOD_NONE; }
+  bool is_response() const { return this->status_ != 0; }
+  SipMethod get_method() const { return this->method_; }
+  // request method as sent, e.g. for methods without a SipMethod value
+  SipSpan get_method_name() const { return this->method_name_; }
+  SipSpan get_request_uri() const { return this->request_uri_; }
+  int get_status() const { return this->status_; }
+  SipSpan get_reason() const { return this->reason_; }
+
+  bool has(SipHeader header) const { return this->headers_[header].length != 0; }
+  // value with surrounding whitespace removed, empty if the header is missing
+  SipSpan header(SipHeader header) const { return this->headers_[header]; }
+  // CSeq number and method; -1 / SIP_METHOD_NONE if missing or malformed
+  int32_t get_cseq() const { return this->cseq_; }
+  SipMethod get_cseq_method() const { return this->cseq_method_; }
+  SipSpan body() const { return this->body_; }
+
+  const char *data() const { return this->data_; }
+  const char *ptr(SipSpan span) const { return this->data_ + span.offset; }
+  bool equals(SipSpan span, const char *s) const;
+
+  // URI of a From/To/Contact value: between < and > if present, else up to the first ';'
+  SipSpan uri(SipSpan value) const;
+  // Parameter of a header value, quotes removed: param(www_auth, "nonce"), param(via, "branch")
+  SipSpan param(SipSpan value, const char *name) const;
+
+ protected:
+  const char *data_{nullptr};
+  SipMethod method_{SIP_METHOD_NONE};
+  SipSpan method_name_{};
+  SipSpan request_uri_{};
+  int status_{0};
+  SipSpan reason_{};
+  int32_t cseq_{-1};
+  SipMethod cseq_method_{SIP_METHOD_NONE};
+  SipSpan headers_[SIP_HDR_COUNT]{};
+  SipSpan body_{};
+};
+
+}  // namespace voip
+}  // namespace esphome
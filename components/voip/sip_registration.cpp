@@ -0,0 +1,198 @@
+#include "sip_registration.h"
+#include <cstring>
+
+namespace esphome {
+namespace voip {
+
+namespace {
+
+// decimal value of a span, def if it is empty or not a number
+uint32_t span_number(const SipParser &msg, SipSpan span, uint32_t def) {
+  if (span.empty())
+    return def;
+  const char *p = msg.ptr(span);
+  uint32_t v = 0;
+  for (uint16_t i = 0; i < span.length; i++) {
+    if (p[i] < '0' || p[i] > '9')
+      return i > 0 ? v : def;
+    if (v > 0xFFFFFFFFu / 10 - 1)
+      return def;
+    v = v * 10 + (p[i] - '0');
+  }
+  return v;
+}
+
+}  // namespace
+
+void SipRegistration::configure(const std::string &user, const std::string &domain, const std::string &contact_host,
+                                uint16_t contact_port, uint32_t expires_s) {
+  this->user_ = user;
+  this->domain_ = domain;
+  this->contact_host_ = contact_host;
+  this->contact_port_ = contact_port;
+  this->expires_s_ = expires_s;
+}
+
+void SipRegistration::start(SipTransactionLayer *txns, const SipEndpoint &registrar, uint32_t now) {
+  this->txns_ = txns;
+  this->registrar_ = registrar;
+  if (this->random_) {
+    this->call_id_[0] = this->random_();
+    this->call_id_[1] = this->random_();
+    this->tag_ = this->random_();
+  }
+  this->cseq_ = 0;
+  this->retry_ms_ = RETRY_MIN_MS;
+  this->auth_attempts_ = 0;
+  this->send_(nullptr, now);
+}
+
+void SipRegistration::stop(uint32_t now) {
+  this->due_armed_ = false;
+  if (this->txns_ == nullptr || this->state_ == SIP_REG_IDLE || this->state_ == SIP_REG_UNREGISTERING)
+    return;
+  if (this->state_ == SIP_REG_FAILED) {
+    this->set_state_(SIP_REG_IDLE);
+    return;
+  }
+  this->txns_->terminate(this->txn_);
+  this->set_state_(SIP_REG_UNREGISTERING);
+  this->auth_attempts_ = 0;
+  this->send_(nullptr, now);
+}
+
+void SipRegistration::send_(const SipParser *challenge, uint32_t now) {
+  bool removing = this->state_ == SIP_REG_UNREGISTERING;
+  SipMessage msg(this->buf_, sizeof(this->buf_));
+  std::string uri = "sip:" + this->domain_;
+  msg.str("REGISTER ").str(uri).line(" SIP/2.0");
+  uint32_t branch = this->random_ ? this->random_() : this->cseq_;
+  msg.str("Via: SIP/2.0/UDP ").str(this->contact_host_).chr(':').unum(this->contact_port_);
+  msg.str(";branch=z9hG4bK").hex(branch, 8).str(";rport").crlf();
+  msg.line("Max-Forwards: 70");
+  msg.str("From: <sip:").str(this->user_).chr('@').str(this->domain_).str(">;tag=").hex(this->tag_, 8).crlf();
+  msg.str("To: <sip:").str(this->user_).chr('@').str(this->domain_).line(">");
+  msg.str("Call-ID: ").hex(this->call_id_[0], 8).hex(this->call_id_[1], 8).chr('@').str(this->contact_host_).crlf();
+  msg.str("CSeq: ").unum(++this->cseq_).line(" REGISTER");
+  msg.str("Contact: <sip:").str(this->user_).chr('@').str(this->contact_host_).chr(':').unum(this->contact_port_);
+  msg.line(";transport=udp>");
+  msg.str("Expires: ").unum(removing ? 0 : this->expires_s_).crlf();
+  msg.line("Allow: INVITE, ACK, CANCEL, OPTIONS, BYE, INFO");
+  msg.line("User-Agent: sip-client/0.0.1");
+  bool authorized = this->auth_ && this->auth_(challenge, "REGISTER", uri.c_str(), msg);
+  if (challenge != nullptr && !authorized) {
+    this->last_status_ = challenge->get_status();
+    this->retry_later_(now);
+    return;
+  }
+  msg.begin_body();
+  this->txn_ = msg.finish() && this->txns_ != nullptr
+                   ? this->txns_->send_request(this->registrar_, msg.data(), msg.size(), now)
+                   : 0;
+  if (this->txn_ == 0) {
+    // no free transaction or an oversized message: try again later
+    this->retry_later_(now);
+    return;
+  }
+  // a refresh keeps the binding up until it is answered
+  if (!removing && this->state_ != SIP_REG_REGISTERED)
+    this->set_state_(SIP_REG_REGISTERING);
+}
+
+bool SipRegistration::on_response(const SipParser &msg, uint32_t txn, uint32_t now) {
+  if (txn == 0 || txn != this->txn_)
+    return false;
+  int status = msg.get_status();
+  if (status < 200)
+    return true;
+  this->txn_ = 0;
+  this->last_status_ = status;
+  bool removing = this->state_ == SIP_REG_UNREGISTERING;
+
+  if ((status == 401 || status == 407) && this->auth_attempts_ < 2) {
+    // a second challenge is fine if the nonce went stale; a third means the password is wrong
+    this->auth_attempts_++;
+    this->send_(&msg, now);
+    return true;
+  }
+  if (status == 423 && !removing) {
+    uint32_t min_expires = span_number(msg, msg.header(SIP_HDR_MIN_EXPIRES), 0);
+    if (min_expires > this->expires_s_) {
+      this->expires_s_ = min_expires;
+      this->send_(nullptr, now);
+      return true;
+    }
+  }
+  if (removing) {
+    this->set_state_(SIP_REG_IDLE);
+    return true;
+  }
+  if (status >= 300) {
+    this->retry_later_(now);
+    return true;
+  }
+
+  // the registrar may shorten the binding, per contact or for all of them
+  uint32_t expires = span_number(msg, msg.header(SIP_HDR_EXPIRES), this->expires_s_);
+  expires = span_number(msg, msg.param(msg.header(SIP_HDR_CONTACT), "expires"), expires);
+  if (expires == 0)
+    expires = this->expires_s_;
+  this->granted_s_ = expires;
+  this->auth_attempts_ = 0;
+  this->retry_ms_ = RETRY_MIN_MS;
+  this->set_state_(SIP_REG_REGISTERED);
+  this->schedule_(now, (expires > 120 ? expires - 60 : expires / 2) * 1000);
+  return true;
+}
+
+bool SipRegistration::on_timeout(uint32_t txn, uint32_t now) {
+  if (txn == 0 || txn != this->txn_)
+    return false;
+  this->txn_ = 0;
+  this->last_status_ = 0;
+  if (this->state_ == SIP_REG_UNREGISTERING) {
+    this->set_state_(SIP_REG_IDLE);
+  } else {
+    this->retry_later_(now);
+  }
+  return true;
+}
+
+void SipRegistration::loop(uint32_t now) {
+  if (!this->due_armed_ || (int32_t)(now - this->due_) < 0)
+    return;
+  this->due_armed_ = false;
+  this->auth_attempts_ = 0;
+  this->send_(nullptr, now);
+}
+
+uint32_t SipRegistration::get_next_in(uint32_t now) const {
+  if (!this->due_armed_)
+    return 0;
+  int32_t left = (int32_t)(this->due_ - now);
+  return left > 0 ? (uint32_t)left : 1;
+}
+
+void SipRegistration::set_state_(SipRegistrationState state) {
+  if (state == this->state_)
+    return;
+  this->state_ = state;
+  if (state != SIP_REG_REGISTERED)
+    this->granted_s_ = 0;
+  if (this->on_state_)
+    this->on_state_(state);
+}
+
+void SipRegistration::retry_later_(uint32_t now) {
+  this->set_state_(SIP_REG_FAILED);
+  this->schedule_(now, this->retry_ms_);
+  this->retry_ms_ = this->retry_ms_ * 2 < RETRY_MAX_MS ? this->retry_ms_ * 2 : RETRY_MAX_MS;
+}
+
+void SipRegistration::schedule_(uint32_t now, uint32_t delay_ms) {
+  this->due_ = now + (delay_ms ? delay_ms : 1);
+  this->due_armed_ = true;
+}
+
+}  // namespace voip
+}  // namespace esphome
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "sip_message.h"
+#include "sip_parser.h"
+#include "sip_transaction.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace esphome {
+namespace voip {
+
+enum SipRegistrationState : uint8_t {
+  SIP_REG_IDLE,           // not started, or the binding was removed
+  SIP_REG_REGISTERING,    // REGISTER sent, no final response yet
+  SIP_REG_REGISTERED,     // binding active, refreshed before it expires
+  SIP_REG_FAILED,         // rejected or unanswered, retried after a backoff
+  SIP_REG_UNREGISTERING,  // REGISTER with Expires: 0 sent
+};
+
+// Binding of our Contact at the registrar (RFC 3261 section 10), so that calls can reach us.
+//
+// All REGISTERs of a binding share Call-ID and From tag and count CSeq up (10.2.4), each one in a
+// client transaction of the given layer, which also retransmits it. A 401 or 407 is answered through
+// the auth callback, which is also asked for cached credentials on every other REGISTER so that
+// refreshes need no new challenge. A 423 is answered with the registrar's Min-Expires.
+//
+// The refresh is due halfway through short bindings and one minute before long ones expire.
+// Failures are retried after 30 s, doubling up to 10 min, so a wrong password does not keep the
+// registrar busy.
+class SipRegistration {
+ public:
+  static const uint32_t RETRY_MIN_MS = 30000;
+  static const uint32_t RETRY_MAX_MS = 600000;
+
+  // Appends Authorization (401) or Proxy-Authorization (407) answering the challenge; false if it
+  // cannot. Without a challenge it may add credentials cached from an earlier one (preemptive).
+  using AuthCallback =
+      std::function<bool(const SipParser *challenge, const char *method, const char *uri, SipMessage &out)>;
+  using StateCallback = std::function<void(SipRegistrationState state)>;
+
+  void configure(const std::string &user, const std::string &domain, const std::string &contact_host,
+                 uint16_t contact_port, uint32_t expires_s);
+  void set_auth_callback(AuthCallback &&cb) { this->auth_ = std::move(cb); }
+  void set_state_callback(StateCallback &&cb) { this->on_state_ = std::move(cb); }
+  // source of Call-ID, tag and branches
+  void set_random(std::function<uint32_t()> &&random) { this->random_ = std::move(random); }
+
+  // Sends the first REGISTER through txns to the registrar
+  void start(SipTransactionLayer *txns, const SipEndpoint &registrar, uint32_t now);
+  // Removes the binding; nothing is retried afterwards
+  void stop(uint32_t now);
+  // A response to REGISTER passed up by the transaction layer; false if txn is not ours
+  bool on_response(const SipParser &msg, uint32_t txn, uint32_t now);
+  // Timer F of txn fired; false if it is not ours
+  bool on_timeout(uint32_t txn, uint32_t now);
+  // Sends the refresh or the retry when it is due
+  void loop(uint32_t now);
+
+  SipRegistrationState get_state() const { return this->state_; }
+  bool is_registered() const { return this->state_ == SIP_REG_REGISTERED; }
+  // expiry granted by the registrar, in s
+  uint32_t get_expires() const { return this->granted_s_; }
+  // last final status from the registrar, 0 for a timeout
+  int get_last_status() const { return this->last_status_; }
+  // ms until the next REGISTER, 0 if none is planned
+  uint32_t get_next_in(uint32_t now) const;
+
+ protected:
+  void send_(const SipParser *challenge, uint32_t now);
+  void set_state_(SipRegistrationState state);
+  void retry_later_(uint32_t now);
+  void schedule_(uint32_t now, uint32_t delay_ms);
+
+  SipTransactionLayer *txns_ = nullptr;
+  SipEndpoint registrar_{};
+  AuthCallback auth_;
+  StateCallback on_state_;
+  std::function<uint32_t()> random_;
+  std::string user_;
+  std::string domain_;
+  std::string contact_host_;
+  uint16_t contact_port_ = 5060;
+  uint32_t expires_s_ = 600;   // what we ask for
+  uint32_t granted_s_ = 0;     // what the registrar granted
+  SipRegistrationState state_ = SIP_REG_IDLE;
+  uint32_t txn_ = 0;
+  uint32_t call_id_[2] = {0, 0};
+  uint32_t tag_ = 0;
+  uint32_t cseq_ = 0;
+  uint8_t auth_attempts_ = 0;
+  int last_status_ = 0;
+  uint32_t retry_ms_ = RETRY_MIN_MS;
+  bool due_armed_ = false;
+  uint32_t due_ = 0;
+  char buf_[1024];
+};
+
+}  // namespace voip
+}  // namespace esphome
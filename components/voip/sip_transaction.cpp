@@ -0,0 +1,410 @@
+#include "sip_transaction.h"
+#include "sip_message.h"
+#include <cstring>
+#include <new>
+
+namespace esphome {
+namespace voip {
+
+namespace {
+
+const uint32_t FNV_BASIS = 2166136261u;
+
+uint32_t fnv1a(uint32_t h, const char *p, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    h = (h ^ (uint8_t)p[i]) * 16777619u;
+  return h;
+}
+
+uint32_t hash_span(uint32_t h, const SipParser &msg, SipSpan span) { return fnv1a(h, msg.ptr(span), span.length); }
+
+// sent-by of the top Via, including the protocol: everything up to the first parameter
+uint32_t hash_sent_by(uint32_t h, const SipParser &msg) {
+  SipSpan via = msg.header(SIP_HDR_VIA);
+  const char *semi = (const char *)memchr(msg.ptr(via), ';', via.length);
+  return fnv1a(h, msg.ptr(via), semi != nullptr ? (size_t)(semi - msg.ptr(via)) : via.length);
+}
+
+// Key of a message with an RFC 3261 branch (17.1.3, 17.2.3); false if the branch lacks the cookie
+bool branch_key(const SipParser &msg, uint32_t *key) {
+  SipSpan branch = msg.param(msg.header(SIP_HDR_VIA), "branch");
+  if (branch.length <= 7 || memcmp(msg.ptr(branch), "z9hG4bK", 7) != 0)
+    return false;
+  *key = hash_sent_by(hash_span(FNV_BASIS, msg, branch), msg);
+  return true;
+}
+
+// Call-ID and CSeq number, the part of a request that a 2xx ACK shares with its INVITE
+uint32_t dialog_key(const SipParser &msg) {
+  int32_t cseq = msg.get_cseq();
+  return fnv1a(hash_span(FNV_BASIS, msg, msg.header(SIP_HDR_CALL_ID)), (const char *)&cseq, sizeof(cseq));
+}
+
+uint32_t request_key(const SipParser &msg) {
+  uint32_t key;
+  if (branch_key(msg, &key))
+    return key;
+  // RFC 2543 peers reuse the Via of the request in its ACK and CANCEL
+  return hash_span(dialog_key(msg), msg, msg.header(SIP_HDR_VIA));
+}
+
+void copy_header(SipMessage &msg, const SipParser &in, SipHeader header) {
+  SipSpan value = in.header(header);
+  if (value.empty())
+    return;
+  msg.str(sip_header_name(header)).str(": ", 2).str(in.ptr(value), value.length).crlf();
+}
+
+}  // namespace
+
+SipTransactionLayer::SipTransactionLayer() { this->set_capacity(MAX_TRANSACTIONS); }
+
+bool SipTransactionLayer::set_capacity(size_t capacity) {
+  std::unique_ptr<Transaction[]> txns(new (std::nothrow) Transaction[capacity]);
+  if (!txns)
+    return false;
+  for (size_t i = 0; i < this->capacity_; i++)
+    this->free_(&this->txns_[i]);
+  // timers find their transaction by index
+  for (size_t i = 0; i < capacity; i++) {
+    txns[i].retransmit.tag = (uint16_t)i;
+    txns[i].timeout.tag = (uint16_t)i;
+  }
+  this->txns_ = std::move(txns);
+  this->capacity_ = capacity;
+  return true;
+}
+
+void SipTransactionLayer::set_timers(uint32_t t1, uint32_t t2, uint32_t t4) {
+  this->t1_ = t1 ? t1 : 1;
+  this->t2_ = t2 > this->t1_ ? t2 : this->t1_;
+  this->t4_ = t4;
+}
+
+void SipTransactionLayer::reset(uint32_t now) {
+  for (size_t i = 0; i < this->capacity_; i++)
+    this->free_(&this->txns_[i]);
+  this->wheel_.reset(now);
+}
+
+uint32_t SipTransactionLayer::send_request(const SipEndpoint &to, const char *data, size_t len, uint32_t now) {
+  SipParser req;
+  if (len > BUFFER_SIZE || !req.parse(data, len) || !req.is_request())
+    return 0;
+  if (req.get_method() == SIP_METHOD_ACK) {
+    // an ACK is never answered, so there is nothing to retransmit it for (17.1.1.3)
+    if (this->send_)
+      this->send_(to, data, len);
+    return 0;
+  }
+  uint32_t key;
+  // a response can only be matched by a branch we chose ourselves
+  if (!branch_key(req, &key))
+    return 0;
+  Transaction *t = this->allocate_(key, req.get_method(), true, to);
+  if (t == nullptr)
+    return 0;
+  memcpy(t->buf, data, len);
+  t->len = (uint16_t)len;
+  t->state = t->method == SIP_METHOD_INVITE ? SIP_TXN_CALLING : SIP_TXN_TRYING;
+  // Timer A or E, and Timer B or F
+  t->interval = this->t1_;
+  this->wheel_.start(&t->retransmit, now, this->t1_);
+  this->wheel_.start(&t->timeout, now, 64 * this->t1_);
+  this->transmit_(t);
+  return t->id;
+}
+
+uint32_t SipTransactionLayer::cancel(uint32_t invite_id, uint32_t now) {
+  Transaction *invite = this->find_(invite_id);
+  if (invite == nullptr || !invite->client || invite->method != SIP_METHOD_INVITE ||
+      (invite->state != SIP_TXN_CALLING && invite->state != SIP_TXN_PROCEEDING))
+    return 0;
+  // same branch as the INVITE, told apart by the method
+  Transaction *t = this->allocate_(invite->key, SIP_METHOD_CANCEL, true, invite->peer);
+  if (t == nullptr)
+    return 0;
+  size_t len;
+  if (!this->build_from_request_(invite, "CANCEL", nullptr, t->buf, BUFFER_SIZE, &len)) {
+    this->free_(t);
+    return 0;
+  }
+  t->len = (uint16_t)len;
+  t->state = SIP_TXN_TRYING;
+  t->interval = this->t1_;
+  this->wheel_.start(&t->retransmit, now, this->t1_);
+  this->wheel_.start(&t->timeout, now, 64 * this->t1_);
+  this->transmit_(t);
+  return t->id;
+}
+
+bool SipTransactionLayer::on_response(const SipParser &msg, uint32_t now, uint32_t *id) {
+  if (id != nullptr)
+    *id = 0;
+  uint32_t key;
+  Transaction *t = branch_key(msg, &key) ? this->match_(key, msg.get_cseq_method(), true) : nullptr;
+  if (t == nullptr)
+    return true;
+  if (id != nullptr)
+    *id = t->id;
+  int status = msg.get_status();
+
+  if (t->method == SIP_METHOD_INVITE) {
+    if (t->state == SIP_TXN_CALLING || t->state == SIP_TXN_PROCEEDING) {
+      if (status < 200) {
+        // the request arrived; from now on only the far end retransmits
+        this->wheel_.stop(&t->retransmit);
+        this->wheel_.stop(&t->timeout);
+        t->state = SIP_TXN_PROCEEDING;
+      } else if (status < 300) {
+        // the ACK of a 2xx is end-to-end and sent by the caller (13.2.2.4)
+        this->free_(t);
+      } else {
+        size_t len;
+        if (this->build_from_request_(t, "ACK", &msg, this->scratch_, sizeof(this->scratch_), &len) && this->send_)
+          this->send_(t->peer, this->scratch_, len);
+        // Timer D: 64*T1 covers the 32 s section 17.1.1.2 asks for with the default T1
+        t->state = SIP_TXN_COMPLETED;
+        this->wheel_.stop(&t->retransmit);
+        this->wheel_.start(&t->timeout, now, 64 * this->t1_);
+      }
+      return true;
+    }
+    if (t->state == SIP_TXN_COMPLETED && status >= 300) {
+      // the ACK got lost, send it again
+      size_t len;
+      if (this->build_from_request_(t, "ACK", &msg, this->scratch_, sizeof(this->scratch_), &len) && this->send_)
+        this->send_(t->peer, this->scratch_, len);
+    }
+    this->absorbed_++;
+    return false;
+  }
+
+  if (t->state != SIP_TXN_TRYING && t->state != SIP_TXN_PROCEEDING) {
+    this->absorbed_++;
+    return false;
+  }
+  if (status < 200) {
+    // Timer E keeps running, at T2 from its next expiry on
+    t->state = SIP_TXN_PROCEEDING;
+    return true;
+  }
+  // Timer K
+  t->state = SIP_TXN_COMPLETED;
+  this->wheel_.stop(&t->retransmit);
+  this->wheel_.start(&t->timeout, now, this->t4_);
+  return true;
+}
+
+bool SipTransactionLayer::on_request(const SipParser &msg, const SipEndpoint &from, uint32_t now, uint32_t *id) {
+  *id = 0;
+  SipMethod method = msg.get_method();
+  uint32_t key = request_key(msg);
+
+  if (method == SIP_METHOD_ACK) {
+    Transaction *t = this->match_(key, SIP_METHOD_INVITE, false);
+    if (t != nullptr && t->state == SIP_TXN_COMPLETED) {
+      // Timer I absorbs further ACK retransmissions
+      t->state = SIP_TXN_CONFIRMED;
+      this->wheel_.stop(&t->retransmit);
+      this->wheel_.start(&t->timeout, now, this->t4_);
+      this->absorbed_++;
+      return false;
+    }
+    if (t != nullptr) {
+      this->absorbed_++;
+      return false;
+    }
+    // the ACK of a 2xx carries a new branch; it stops the retransmission of the 2xx and goes up
+    uint32_t ack_key = dialog_key(msg);
+    for (size_t i = 0; i < this->capacity_; i++) {
+      Transaction &inv = this->txns_[i];
+      if (inv.id != 0 && !inv.client && inv.state == SIP_TXN_ACCEPTED && inv.ack_key == ack_key) {
+        this->wheel_.stop(&inv.retransmit);
+        *id = inv.id;
+        break;
+      }
+    }
+    return true;
+  }
+
+  Transaction *t = this->match_(key, method, false);
+  if (t != nullptr) {
+    // a retransmission: repeat the last response, if there is one yet
+    if (t->len > 0) {
+      this->transmit_(t);
+      this->retransmissions_++;
+    }
+    this->absorbed_++;
+    return false;
+  }
+  t = this->allocate_(key, method, false, from);
+  if (t == nullptr)
+    return true;
+  t->state = method == SIP_METHOD_INVITE ? SIP_TXN_PROCEEDING : SIP_TXN_TRYING;
+  if (method == SIP_METHOD_INVITE)
+    t->ack_key = dialog_key(msg);
+  *id = t->id;
+  return true;
+}
+
+bool SipTransactionLayer::respond(uint32_t id, int status, const char *data, size_t len, uint32_t now) {
+  Transaction *t = this->find_(id);
+  if (t == nullptr || t->client || len > BUFFER_SIZE ||
+      (t->state != SIP_TXN_TRYING && t->state != SIP_TXN_PROCEEDING))
+    return false;
+  memcpy(t->buf, data, len);
+  t->len = (uint16_t)len;
+  this->transmit_(t);
+  if (status < 200) {
+    t->state = SIP_TXN_PROCEEDING;
+    return true;
+  }
+  // Timer J for non-INVITE; Timers G and H, or the 2xx retransmission and Timer L (RFC 6026) for INVITE
+  this->wheel_.start(&t->timeout, now, 64 * this->t1_);
+  if (t->method != SIP_METHOD_INVITE) {
+    t->state = SIP_TXN_COMPLETED;
+    return true;
+  }
+  t->state = status < 300 ? SIP_TXN_ACCEPTED : SIP_TXN_COMPLETED;
+  t->interval = this->t1_;
+  this->wheel_.start(&t->retransmit, now, this->t1_);
+  return true;
+}
+
+void SipTransactionLayer::poll(uint32_t now) {
+  this->wheel_.advance(now, [this, now](TimerWheel::Timer *timer) { this->fire_(timer, now); });
+}
+
+void SipTransactionLayer::fire_(TimerWheel::Timer *timer, uint32_t now) {
+  Transaction *t = &this->txns_[timer->tag];
+  if (timer == &t->retransmit) {
+    // Timer A doubles without limit; E, G and the 2xx retransmission stop doubling at T2, and a
+    // non-INVITE request that got a provisional response is repeated every T2 (17.1.2.2)
+    this->transmit_(t);
+    this->retransmissions_++;
+    if (t->client && t->method == SIP_METHOD_INVITE) {
+      t->interval *= 2;
+    } else if (t->client && t->state == SIP_TXN_PROCEEDING) {
+      t->interval = this->t2_;
+    } else {
+      t->interval = t->interval * 2 < this->t2_ ? t->interval * 2 : this->t2_;
+    }
+    this->wheel_.start(&t->retransmit, now, t->interval);
+    return;
+  }
+
+  // B and F: no final response; H and L: no ACK. D, I, J and K just end the transaction.
+  bool failed;
+  if (t->client) {
+    failed = t->state != SIP_TXN_COMPLETED;
+  } else if (t->state == SIP_TXN_ACCEPTED) {
+    failed = t->retransmit.armed();
+  } else {
+    failed = t->state == SIP_TXN_COMPLETED && t->method == SIP_METHOD_INVITE;
+  }
+  uint32_t id = t->id;
+  SipMethod method = t->method;
+  this->free_(t);
+  if (failed) {
+    this->timeouts_++;
+    if (this->timeout_)
+      this->timeout_(id, method);
+  }
+}
+
+void SipTransactionLayer::terminate(uint32_t id) {
+  Transaction *t = this->find_(id);
+  if (t != nullptr)
+    this->free_(t);
+}
+
+SipTransactionState SipTransactionLayer::get_state(uint32_t id) const {
+  const Transaction *t = this->find_(id);
+  return t != nullptr ? t->state : SIP_TXN_TERMINATED;
+}
+
+size_t SipTransactionLayer::active() const {
+  size_t n = 0;
+  for (size_t i = 0; i < this->capacity_; i++)
+    n += this->txns_[i].id != 0;
+  return n;
+}
+
+SipTransactionLayer::Transaction *SipTransactionLayer::find_(uint32_t id) {
+  if (id == 0)
+    return nullptr;
+  for (size_t i = 0; i < this->capacity_; i++) {
+    Transaction &t = this->txns_[i];
+    if (t.id == id)
+      return &t;
+  }
+  return nullptr;
+}
+
+const SipTransactionLayer::Transaction *SipTransactionLayer::find_(uint32_t id) const {
+  return const_cast<SipTransactionLayer *>(this)->find_(id);
+}
+
+SipTransactionLayer::Transaction *SipTransactionLayer::match_(uint32_t key, SipMethod method, bool client) {
+  for (size_t i = 0; i < this->capacity_; i++) {
+    Transaction &t = this->txns_[i];
+    if (t.id != 0 && t.key == key && t.method == method && t.client == client)
+      return &t;
+  }
+  return nullptr;
+}
+
+SipTransactionLayer::Transaction *SipTransactionLayer::allocate_(uint32_t key, SipMethod method, bool client,
+                                                                 const SipEndpoint &peer) {
+  for (size_t i = 0; i < this->capacity_; i++) {
+    Transaction &t = this->txns_[i];
+    if (t.id != 0)
+      continue;
+    if (++this->next_id_ == 0)
+      this->next_id_ = 1;
+    t.id = this->next_id_;
+    t.key = key;
+    t.ack_key = 0;
+    t.method = method;
+    t.client = client;
+    t.peer = peer;
+    t.len = 0;
+    return &t;
+  }
+  return nullptr;
+}
+
+void SipTransactionLayer::free_(Transaction *t) {
+  this->wheel_.stop(&t->retransmit);
+  this->wheel_.stop(&t->timeout);
+  t->id = 0;
+  t->state = SIP_TXN_TERMINATED;
+  t->len = 0;
+}
+
+bool SipTransactionLayer::build_from_request_(const Transaction *t, const char *method, const SipParser *response,
+                                              char *out, size_t capacity, size_t *len) {
+  SipParser req;
+  if (!req.parse(t->buf, t->len))
+    return false;
+  SipMessage msg(out, capacity);
+  SipSpan uri = req.get_request_uri();
+  msg.str(method).chr(' ').str(req.ptr(uri), uri.length).line(" SIP/2.0");
+  // only the top Via, with the branch of the request
+  copy_header(msg, req, SIP_HDR_VIA);
+  msg.line("Max-Forwards: 70");
+  copy_header(msg, req, SIP_HDR_FROM);
+  // the ACK takes the To tag of the response it acknowledges
+  copy_header(msg, response != nullptr ? *response : req, SIP_HDR_TO);
+  copy_header(msg, req, SIP_HDR_CALL_ID);
+  msg.str("CSeq: ").num(req.get_cseq()).chr(' ').line(method);
+  msg.begin_body();
+  if (!msg.finish())
+    return false;
+  *len = msg.size();
+  return true;
+}
+
+}  // namespace voip
+}  // namespace esphome
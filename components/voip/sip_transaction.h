@@ -0,0 +1,144 @@
+#pragma once
+
+#include "sip_parser.h"
+#include "timer_wheel.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+namespace esphome {
+namespace voip {
+
+// UDP address in host byte order
+struct SipEndpoint {
+  uint32_t address;
+  uint16_t port;
+};
+
+enum SipTransactionState : uint8_t {
+  SIP_TXN_TERMINATED,  // unknown or finished transactions
+  SIP_TXN_CALLING,     // INVITE client, no response yet
+  SIP_TXN_TRYING,      // non-INVITE, no response yet
+  SIP_TXN_PROCEEDING,  // provisional response seen (client) or not yet final (server)
+  SIP_TXN_COMPLETED,   // final response, waiting for retransmissions to die out
+  SIP_TXN_ACCEPTED,    // INVITE server, 2xx sent and retransmitted until the ACK (RFC 6026)
+  SIP_TXN_CONFIRMED,   // INVITE server, ACK for a failure response received
+};
+
+// RFC 3261 section 17 transactions over UDP.
+//
+// Client transactions keep the request and retransmit it (Timers A and E) until a response arrives
+// or they time out (Timers B and F). Final failure responses to INVITE are ACKed here, as are their
+// retransmissions. Server transactions keep the last response and resend it whenever the request is
+// retransmitted; a 2xx to INVITE is retransmitted until the ACK arrives. Retransmitted responses and
+// requests are absorbed, so the caller only sees each message once.
+//
+// Transactions are matched by the z9hG4bK branch of the top Via and the method (ACK and CANCEL
+// follow section 17.2.3); requests of RFC 2543 peers without the cookie are matched by Call-ID, CSeq
+// and Via instead. All timers live on one TimerWheel advanced by poll(), times are millis() values.
+// Transactions are referred to by ids that are never reused, 0 is no transaction.
+class SipTransactionLayer {
+ public:
+  // transactions held at the same time unless set_capacity() asks for more; enough for one call
+  // next to the registration
+  static const size_t MAX_TRANSACTIONS = 6;
+  // largest request or response kept for retransmission: one Ethernet MTU of UDP payload
+  static const size_t BUFFER_SIZE = 1472;
+
+  using SendCallback = std::function<void(const SipEndpoint &to, const char *data, size_t len)>;
+  // Timer B, F, H or L fired: the peer never answered (client) or never ACKed (server)
+  using TimeoutCallback = std::function<void(uint32_t id, SipMethod method)>;
+
+  SipTransactionLayer();
+
+  void set_send_callback(SendCallback &&cb) { this->send_ = std::move(cb); }
+  void set_timeout_callback(TimeoutCallback &&cb) { this->timeout_ = std::move(cb); }
+  // RTT estimate, retransmit interval cap and maximum network lifetime, in ms
+  void set_timers(uint32_t t1, uint32_t t2, uint32_t t4);
+  // Drops all transactions
+  void reset(uint32_t now);
+  // Drops all transactions and makes room for capacity of them, false if there is not enough memory
+  bool set_capacity(size_t capacity);
+  size_t capacity() const { return this->capacity_; }
+  // bytes held by the layer and its table
+  size_t get_memory_size() const { return sizeof(*this) + this->capacity_ * sizeof(Transaction); }
+
+  // Sends a request and keeps retransmitting it. The request needs a z9hG4bK branch; ACK is
+  // sent once without a transaction. Returns 0 if it is malformed or the table is full.
+  uint32_t send_request(const SipEndpoint &to, const char *data, size_t len, uint32_t now);
+  // Sends a CANCEL for a pending INVITE client transaction (RFC 3261 9.1) in its own transaction
+  uint32_t cancel(uint32_t invite_id, uint32_t now);
+  // Feeds a response; false if it was absorbed. *id is the matching transaction, 0 if none (e.g. a
+  // retransmitted 2xx after the INVITE transaction ended, which the caller has to ACK again).
+  bool on_response(const SipParser &msg, uint32_t now, uint32_t *id = nullptr);
+
+  // Feeds a request from the given source; false if it was absorbed. Otherwise *id is the new
+  // server transaction, or 0 for an ACK of a 2xx or when the table is full.
+  bool on_request(const SipParser &msg, const SipEndpoint &from, uint32_t now, uint32_t *id);
+  // Sends the response of a server transaction to the request's source. Returns false if id is
+  // unknown or already has a final response.
+  bool respond(uint32_t id, int status, const char *data, size_t len, uint32_t now);
+
+  // Fires due timers
+  void poll(uint32_t now);
+  // Forgets a transaction without sending anything
+  void terminate(uint32_t id);
+
+  SipTransactionState get_state(uint32_t id) const;
+  size_t active() const;
+  // statistics
+  uint32_t get_retransmissions() const { return this->retransmissions_; }
+  uint32_t get_absorbed() const { return this->absorbed_; }
+  uint32_t get_timeouts() const { return this->timeouts_; }
+
+ protected:
+  struct Transaction {
+    uint32_t id = 0;  // 0: free slot
+    uint32_t key = 0;
+    // INVITE server: Call-ID and CSeq, to find the ACK of a 2xx, which has a branch of its own
+    uint32_t ack_key = 0;
+    SipMethod method = SIP_METHOD_NONE;
+    SipTransactionState state = SIP_TXN_TERMINATED;
+    bool client = false;
+    SipEndpoint peer{};
+    uint32_t interval = 0;  // current retransmission interval
+    TimerWheel::Timer retransmit;
+    TimerWheel::Timer timeout;
+    // client: the request; server: the last response sent
+    uint16_t len = 0;
+    char buf[BUFFER_SIZE];
+  };
+
+  Transaction *find_(uint32_t id);
+  const Transaction *find_(uint32_t id) const;
+  Transaction *match_(uint32_t key, SipMethod method, bool client);
+  Transaction *allocate_(uint32_t key, SipMethod method, bool client, const SipEndpoint &peer);
+  void free_(Transaction *t);
+  void fire_(TimerWheel::Timer *timer, uint32_t now);
+  void transmit_(Transaction *t) {
+    if (this->send_)
+      this->send_(t->peer, t->buf, t->len);
+  }
+  // ACK for a failure response (17.1.1.3) or CANCEL (9.1), built from the request kept in t
+  bool build_from_request_(const Transaction *t, const char *method, const SipParser *response, char *out,
+                           size_t capacity, size_t *len);
+
+  std::unique_ptr<Transaction[]> txns_;
+  size_t capacity_ = 0;
+  TimerWheel wheel_;
+  SendCallback send_;
+  TimeoutCallback timeout_;
+  uint32_t t1_ = 500;
+  uint32_t t2_ = 4000;
+  uint32_t t4_ = 5000;
+  uint32_t next_id_ = 0;
+  uint32_t retransmissions_ = 0;
+  uint32_t absorbed_ = 0;
+  uint32_t timeouts_ = 0;
+  // ACKs are built here, they are never retransmitted by timer
+  char scratch_[768];
+};
+
+}  // namespace voip
+}  // namespace esphome
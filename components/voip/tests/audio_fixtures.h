@@ -0,0 +1,113 @@
+#pragma once
+
+// Test signals shared by the DSP tests: a reproducible random source, synthetic speech and a
+// minimal WAV reader for recordings passed in through the environment.
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// Deterministic pseudo random generator so failures are reproducible
+static uint32_t lcg_state = 12345;
+static inline uint32_t lcg() { return lcg_state = lcg_state * 1103515245u + 12345u; }
+static inline double uniform() { return (lcg() >> 8) / 16777216.0; }
+static inline double gaussian() {
+  double s = 0;
+  for (int k = 0; k < 12; k++)
+    s += uniform();
+  return s - 6;
+}
+
+// Speech-like test signal: voiced stretches (a glottal pulse train with a gliding pitch through
+// three formant resonators), unvoiced hiss and pauses at rate Hz, peaking at 16000. The random
+// generator starts from seed.
+static inline std::vector<int16_t> synthetic_speech(size_t seconds, uint32_t seed, uint32_t rate = 8000) {
+  lcg_state = seed;
+  const size_t n = rate * seconds;
+  std::vector<double> x(n, 0.0);
+  struct Resonator {
+    double a1, a2, y1 = 0, y2 = 0;
+    Resonator(double f, double bw, double fs) {
+      double r = std::exp(-M_PI * bw / fs);
+      a1 = 2 * r * std::cos(2 * M_PI * f / fs);
+      a2 = -r * r;
+    }
+    double run(double in) {
+      double y = in + a1 * y1 + a2 * y2;
+      y2 = y1;
+      y1 = y;
+      return y;
+    }
+  };
+  size_t i = 0;
+  int segment = 0;
+  while (i < n) {
+    size_t len = (1600 + (lcg() >> 16) % 2400) * rate / 8000;  // 200..500 ms
+    int kind = segment++ % 5;                                    // voiced, voiced, unvoiced, voiced, pause
+    Resonator f1(500 + 300 * uniform(), 80, rate), f2(1100 + 600 * uniform(), 120, rate), f3(2500, 200, rate);
+    double f0 = 90 + 110 * uniform();
+    double glide = (uniform() - 0.5) * 40;  // Hz over the segment
+    double phase = 1.0;
+    for (size_t k = 0; k < len && i < n; k++, i++) {
+      double env = std::sin(M_PI * k / len);
+      double e = 0;
+      if (kind == 2) {
+        e = (uniform() - 0.5) * 0.6;
+      } else if (kind != 4) {
+        phase += (f0 + glide * k / len) / rate;
+        if (phase >= 1.0) {
+          phase -= 1.0;
+          e = 1.0;
+        }
+      }
+      x[i] = env * (f1.run(e) + 0.5 * f2.run(e) + 0.25 * f3.run(e));
+    }
+  }
+  double peak = 0;
+  for (double v : x)
+    peak = std::fabs(v) > peak ? std::fabs(v) : peak;
+  std::vector<int16_t> out(n);
+  for (size_t k = 0; k < n; k++)
+    out[k] = (int16_t)std::lrint(x[k] * 16000 / peak);
+  return out;
+}
+
+// the same at 8 kHz, going on from wherever the generator is
+static inline std::vector<int16_t> synthetic_speech(size_t seconds) { return synthetic_speech(seconds, lcg_state); }
+
+// 16-bit mono 8 kHz WAV; empty if the file is anything else
+static inline std::vector<int16_t> read_wav(const char *path) {
+  std::vector<int16_t> out;
+  FILE *f = fopen(path, "rb");
+  if (!f) return out;
+  uint8_t hdr[12];
+  bool ok = fread(hdr, 1, 12, f) == 12 && memcmp(hdr, "RIFF", 4) == 0 && memcmp(hdr + 8, "WAVE", 4) == 0;
+  bool format_ok = false;
+  while (ok) {
+    uint8_t chunk[8];
+    if (fread(chunk, 1, 8, f) != 8) break;
+    uint32_t size = chunk[4] | chunk[5] << 8 | chunk[6] << 16 | (uint32_t)chunk[7] << 24;
+    if (memcmp(chunk, "fmt ", 4) == 0) {
+      uint8_t fmt[16];
+      if (size < 16 || fread(fmt, 1, 16, f) != 16) break;
+      uint32_t rate = fmt[4] | fmt[5] << 8 | fmt[6] << 16 | (uint32_t)fmt[7] << 24;
+      format_ok = fmt[0] == 1 && fmt[2] == 1 && rate == 8000 && fmt[14] == 16;
+      fseek(f, size - 16 + (size & 1), SEEK_CUR);
+    } else if (memcmp(chunk, "data", 4) == 0) {
+      if (!format_ok) break;
+      out.resize(size / 2);
+      std::vector<uint8_t> raw(size);
+      size_t got = fread(raw.data(), 1, size, f);
+      out.resize(got / 2);
+      for (size_t k = 0; k < out.size(); k++)
+        out[k] = (int16_t)(raw[2 * k] | raw[2 * k + 1] << 8);
+      break;
+    } else {
+      fseek(f, size + (size & 1), SEEK_CUR);
+    }
+  }
+  fclose(f);
+  return out;
+}
@@ -0,0 +1,33 @@
+// libFuzzer target for the SIP parser, built with -DVOIP_FUZZ=ON and clang:
+//
+//   CC=clang CXX=clang++ cmake -S . -B build-fuzz -DVOIP_FUZZ=ON
+//   cmake --build build-fuzz --target fuzz_sip_parser
+//   ./build-fuzz/fuzz_sip_parser -max_len=1500 sip_corpus
+#include "../sip_parser.h"
+#include <cstdlib>
+
+using namespace esphome::voip;
+
+static void check(SipSpan s, size_t begin, size_t end) {
+  if (s.offset < begin || (size_t)s.offset + s.length > end)
+    abort();
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  SipParser p;
+  if (!p.parse((const char *)data, size))
+    return 0;
+  size = size > 0xFFFF ? 0xFFFF : size;
+  check(p.get_method_name(), 0, size);
+  check(p.get_request_uri(), 0, size);
+  check(p.get_reason(), 0, size);
+  check(p.body(), 0, size);
+  for (int h = 0; h < SIP_HDR_COUNT; h++) {
+    SipSpan v = p.header((SipHeader)h);
+    check(v, 0, size);
+    check(p.uri(v), v.offset, v.offset + v.length);
+    check(p.param(v, "nonce"), v.offset, v.offset + v.length);
+    check(p.param(v, "tag"), v.offset, v.offset + v.length);
+  }
+  return 0;
+}
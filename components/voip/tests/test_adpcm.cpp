@@ -0,0 +1,122 @@
+#include "../adpcm.h"
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "g72x.h"
+}
+
+using esphome::voip::AdpcmCodec;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+  do {                                                                      \
+    if (!(cond)) {                                                          \
+      std::cerr << "FAILED " << __LINE__ << ": " << #cond << std::endl;     \
+      ++failures;                                                           \
+    }                                                                       \
+  } while (0)
+
+static std::vector<int16_t> speech_like(size_t n) {
+  // two tones with a slow envelope, roughly -10 dBFS
+  std::vector<int16_t> pcm(n);
+  for (size_t i = 0; i < n; i++) {
+    double t = i / 8000.0;
+    double env = 0.5 + 0.5 * std::sin(2 * M_PI * 3 * t);
+    pcm[i] = (int16_t)(env * (6000 * std::sin(2 * M_PI * 440 * t) + 3000 * std::sin(2 * M_PI * 1230 * t)));
+  }
+  return pcm;
+}
+
+typedef int (*EncodeFn)(int, int, struct g72x_state *);
+typedef int (*DecodeFn)(int, int, struct g72x_state *);
+
+static void test_against_reference(uint8_t bits, EncodeFn ref_encode, DecodeFn ref_decode) {
+  std::vector<int16_t> pcm = speech_like(1600);
+  AdpcmCodec codec(bits);
+  CHECK(codec.get_bits() == bits);
+
+  // per-sample codes from the reference coder
+  struct g72x_state enc, dec;
+  g72x_init_state(&enc);
+  g72x_init_state(&dec);
+  std::vector<int> codes(pcm.size());
+  std::vector<int16_t> ref_pcm(pcm.size());
+  for (size_t i = 0; i < pcm.size(); i++) {
+    codes[i] = ref_encode(pcm[i], AUDIO_ENCODING_LINEAR, &enc);
+    ref_pcm[i] = (int16_t)ref_decode(codes[i], AUDIO_ENCODING_LINEAR, &dec);
+  }
+
+  // 20 ms frames, state carried across frames
+  std::vector<uint8_t> payload(AdpcmCodec::packed_size(160, bits));
+  std::vector<int16_t> out(160);
+  double sig = 0, err = 0;
+  int pack_errors = 0, decode_errors = 0;
+  for (size_t f = 0; f < pcm.size() / 160; f++) {
+    size_t bytes = codec.encode(&pcm[f * 160], 160, payload.data());
+    CHECK(bytes == 160u * bits / 8);
+    // RFC 3551 4.5.4: first code word in the least significant bits of the first octet
+    for (size_t i = 0; i < 160; i++) {
+      size_t bit = i * bits;
+      uint32_t word = payload[bit / 8] | (bit / 8 + 1 < bytes ? payload[bit / 8 + 1] << 8 : 0);
+      int code = (int)((word >> (bit % 8)) & ((1u << bits) - 1));
+      pack_errors += code != codes[f * 160 + i];
+    }
+    size_t samples = codec.decode(payload.data(), bytes, out.data(), out.size());
+    CHECK(samples == 160);
+    for (size_t i = 0; i < 160; i++) {
+      decode_errors += out[i] != ref_pcm[f * 160 + i];
+      double s = pcm[f * 160 + i];
+      sig += s * s;
+      err += (s - out[i]) * (s - out[i]);
+    }
+  }
+  CHECK(pack_errors == 0);
+  CHECK(decode_errors == 0);
+  double snr = 10 * std::log10(sig / (err > 0 ? err : 1));
+  printf("%s: %u bytes per 20 ms, SNR %.1f dB\n", codec.get_encoding_name(), (unsigned)payload.size(), snr);
+  CHECK(snr > (bits == 3 ? 10.0 : 15.0));
+
+  // a new call starts from the initial state again
+  codec.reset_encoder();
+  codec.reset_decoder();
+  g72x_init_state(&enc);
+  codec.encode(pcm.data(), 160, payload.data());
+  CHECK((payload[0] & ((1u << bits) - 1)) == (unsigned)ref_encode(pcm[0], AUDIO_ENCODING_LINEAR, &enc));
+}
+
+static void test_packing_edges() {
+  AdpcmCodec codec(5);
+  // the decoder stops at the caller's limit and ignores trailing partial code words
+  uint8_t payload[5] = {0x00, 0x00, 0x00, 0x00, 0x00};
+  int16_t out[16];
+  CHECK(codec.decode(payload, 5, out, 16) == 8);
+  CHECK(codec.decode(payload, 5, out, 3) == 3);
+  CHECK(codec.decode(payload, 2, out, 16) == 3);
+  CHECK(AdpcmCodec::packed_size(160, 3) == 60);
+  CHECK(AdpcmCodec::packed_size(160, 4) == 80);
+  CHECK(AdpcmCodec::packed_size(160, 5) == 100);
+  CHECK(AdpcmCodec::packed_size(3, 5) == 2);
+  // unsupported widths fall back to G.726-32
+  AdpcmCodec other(7);
+  CHECK(other.get_bits() == 4);
+  CHECK(std::string(other.get_encoding_name()) == "G726-32");
+}
+
+int main() {
+  test_against_reference(4, g721_encoder, g721_decoder);
+  test_against_reference(3, g723_24_encoder, g723_24_decoder);
+  test_against_reference(5, g723_40_encoder, g723_40_decoder);
+  test_packing_edges();
+
+  if (failures) {
+    std::cerr << failures << " tests failed" << std::endl;
+    return 1;
+  }
+  std::cout << "All tests passed." << std::endl;
+  return 0;
+}
@@ -0,0 +1,363 @@
+#include "../aec.h"
+#include "audio_fixtures.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+using esphome::voip::EchoCanceller;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+  do {                                                                      \
+    if (!(cond)) {                                                          \
+      std::cerr << "FAILED " << __LINE__ << ": " << #cond << std::endl;     \
+      ++failures;                                                           \
+    }                                                                       \
+  } while (0)
+
+static const size_t FRAME = 160;
+
+// Loudspeaker to microphone of a small enclosure: a bulk delay (I2S buffers, air), the direct path
+// and an exponentially decaying tail of reflections, scaled to the given echo return loss
+static std::vector<double> room(size_t delay, size_t tail, double loss_db, uint32_t seed) {
+  lcg_state = seed;
+  std::vector<double> h(delay + tail, 0.0);
+  double energy = 0;
+  for (size_t k = 0; k < tail; k++) {
+    double v = gaussian() * std::exp(-6.9 * k / tail);  // -60 dB at the end
+    if (k == 0)
+      v = 2.0;
+    h[delay + k] = v;
+    energy += v * v;
+  }
+  // the echo of a loud talker comes back loss_db down
+  double scale = std::pow(10.0, -loss_db / 20) / std::sqrt(energy);
+  for (double &v : h)
+    v *= scale;
+  return h;
+}
+
+static std::vector<double> convolve(const std::vector<int16_t> &x, const std::vector<double> &h) {
+  std::vector<double> y(x.size(), 0.0);
+  for (size_t i = 0; i < x.size(); i++) {
+    if (x[i] == 0)
+      continue;
+    for (size_t k = 0; k < h.size() && i + k < y.size(); k++)
+      y[i + k] += x[i] * h[k];
+  }
+  return y;
+}
+
+static int16_t clip(double v) { return (int16_t)(v > 32767 ? 32767 : (v < -32768 ? -32768 : std::lrint(v))); }
+
+// Microphone signal of the far end's echo, the near talker and a noise floor at -66 dBov
+struct Scene {
+  std::vector<int16_t> far;
+  std::vector<int16_t> mic;
+  std::vector<int16_t> echo;
+  std::vector<int16_t> near;
+};
+
+static Scene scene(const std::vector<int16_t> &far, const std::vector<int16_t> &near, const std::vector<double> &h,
+                   uint32_t seed = 99) {
+  Scene s;
+  s.far = far;
+  std::vector<double> y = convolve(far, h);
+  lcg_state = seed;
+  s.mic.resize(far.size());
+  s.echo.resize(far.size());
+  s.near.resize(far.size());
+  for (size_t i = 0; i < far.size(); i++) {
+    s.echo[i] = clip(y[i]);
+    s.near[i] = i < near.size() ? near[i] : 0;
+    s.mic[i] = clip(y[i] + s.near[i] + gaussian() * 16);
+  }
+  return s;
+}
+
+// Plays the far end and captures the microphone in frames of the given length as the device does:
+// the frame goes to the speaker, then the microphone frame of the same period is captured
+static std::vector<int16_t> run(EchoCanceller &aec, const Scene &s, size_t frame = FRAME) {
+  std::vector<int16_t> out(s.mic);
+  for (size_t at = 0; at < out.size(); at += frame) {
+    size_t n = out.size() - at < frame ? out.size() - at : frame;
+    aec.playback(&s.far[at], n);
+    aec.capture(&out[at], n);
+  }
+  return out;
+}
+
+static double energy(const std::vector<int16_t> &x, size_t from, size_t to) {
+  double e = 0;
+  for (size_t i = from; i < to && i < x.size(); i++)
+    e += (double)x[i] * x[i];
+  return e;
+}
+
+static double db(double ratio) { return 10 * std::log10(ratio > 1e-12 ? ratio : 1e-12); }
+
+// echo return loss enhancement over [from, to): microphone against output, where the output has
+// nothing but echo and noise
+static double erle(const std::vector<int16_t> &mic, const std::vector<int16_t> &out, size_t from, size_t to) {
+  return db(energy(mic, from, to) / (energy(out, from, to) + 1));
+}
+
+static void test_configure() {
+  EchoCanceller aec;
+  CHECK(!aec.configure(0, 0));
+  CHECK(!aec.configure(EchoCanceller::MAX_TAIL_MS + 1, 0));
+  CHECK(!aec.configure(64, EchoCanceller::MAX_DELAY_MS + 1));
+  // unconfigured, the microphone passes untouched
+  int16_t pcm[FRAME];
+  for (size_t i = 0; i < FRAME; i++)
+    pcm[i] = (int16_t)(i * 100);
+  aec.playback(pcm, FRAME);
+  aec.capture(pcm, FRAME);
+  CHECK(pcm[FRAME - 1] == (int16_t)((FRAME - 1) * 100));
+
+  CHECK(aec.configure(64, 40));
+  CHECK(aec.get_segments() == 64 * 8 / EchoCanceller::SEGMENT);
+  CHECK(aec.get_update_segments() == aec.get_segments());
+  aec.set_update_segments(0);
+  CHECK(aec.get_update_segments() == 1);
+  aec.set_update_segments(1000);
+  CHECK(aec.get_update_segments() == aec.get_segments());
+  // filters, history and the FIFO
+  CHECK(aec.get_memory_size() == 512 * 8 + (2 * (512 + 80) + 320 + 1024) * 2);
+  // tails are whole segments
+  CHECK(aec.configure(3, 0));
+  CHECK(aec.get_segments() == 2);
+}
+
+// Without a far end the canceller passes the microphone bit for bit
+static void test_transparent() {
+  EchoCanceller aec;
+  aec.configure(64, 20);
+  std::vector<int16_t> near = synthetic_speech(4, 7);
+  std::vector<int16_t> far(near.size(), 0);
+  Scene s = scene(far, near, room(40, 200, 6, 1));
+  std::vector<int16_t> out = run(aec, s);
+  CHECK(out == s.mic);
+  CHECK(aec.get_foreground_updates() == 0);
+}
+
+static void test_far_end_only() {
+  std::vector<int16_t> far = synthetic_speech(12, 1);
+  std::vector<int16_t> near;
+  Scene s = scene(far, near, room(100, 300, 6, 2));
+  const size_t settled = 4 * 8000;
+  EchoCanceller aec;
+  aec.configure(64, 0);
+  aec.set_suppressor(false);
+  std::vector<int16_t> linear = run(aec, s);
+  double e_linear = erle(s.mic, linear, settled, far.size());
+  printf("far end only, 64 ms tail: linear ERLE %.1f dB (own estimate %.1f dB), echo delay %u ms\n", e_linear,
+         aec.get_erle_db(), (unsigned)aec.get_echo_delay_ms());
+  CHECK(e_linear > 20);
+  CHECK(aec.get_erle_db() > 20);
+  // the direct path sits 100 samples behind the speaker
+  CHECK(aec.get_echo_delay_ms() >= 12 && aec.get_echo_delay_ms() <= 13);
+  CHECK(aec.get_realignments() == 0);
+
+  aec.configure(64, 0);
+  aec.set_suppressor(true);
+  std::vector<int16_t> suppressed = run(aec, s);
+  double e_suppressed = erle(s.mic, suppressed, settled, far.size());
+  printf("far end only, 64 ms tail: with suppressor %.1f dB\n", e_suppressed);
+  CHECK(e_suppressed > e_linear + 10);
+}
+
+// Both ends talk: the near talker must come through, and the echo path must not be lost
+static void test_double_talk() {
+  std::vector<int16_t> far = synthetic_speech(16, 1);
+  std::vector<int16_t> talk = synthetic_speech(4, 5);
+  // the near end talks from 6 to 10 s, as loud as the echo arrives at the microphone
+  std::vector<int16_t> near(far.size(), 0);
+  for (size_t i = 0; i < talk.size(); i++)
+    near[6 * 8000 + i] = (int16_t)(talk[i] / 2);
+  Scene s = scene(far, near, room(100, 300, 6, 2));
+  EchoCanceller aec;
+  aec.configure(64, 0);
+  std::vector<int16_t> out = run(aec, s);
+
+  // near speech in the output against what the talker said, over the blocks where it talks
+  double near_in = 0, near_err = 0;
+  for (size_t i = 6 * 8000; i < 10 * 8000; i++) {
+    near_in += (double)s.near[i] * s.near[i];
+    double d = (double)out[i] - s.near[i];
+    near_err += d * d;
+  }
+  double level = db(energy(out, 6 * 8000, 10 * 8000) / near_in);
+  double snr = db(near_in / near_err);
+  double after = erle(s.mic, out, 11 * 8000, far.size());
+  printf("double talk: near end level %+.1f dB, SNR %.1f dB, ERLE afterwards %.1f dB\n", level, snr, after);
+  CHECK(level > -4 && level < 2);
+  CHECK(snr > 6);
+  CHECK(after > 20);
+}
+
+// The device is moved: a louder echo path, found again within three seconds
+static void test_path_change() {
+  std::vector<int16_t> far = synthetic_speech(16, 3);
+  std::vector<double> h1 = room(100, 300, 6, 2), h2 = room(140, 300, 3, 4);
+  Scene s1 = scene(far, {}, h1), s2 = scene(far, {}, h2);
+  Scene s = s1;
+  const size_t change = 6 * 8000;
+  for (size_t i = change; i < far.size(); i++) {
+    s.mic[i] = s2.mic[i];
+    s.echo[i] = s2.echo[i];
+  }
+  EchoCanceller aec;
+  aec.configure(64, 0);
+  aec.set_suppressor(false);
+  std::vector<int16_t> out = run(aec, s);
+  double before = erle(s.mic, out, change - 2 * 8000, change);
+  double after = erle(s.mic, out, change + 3 * 8000, far.size());
+  printf("echo path change: linear ERLE %.1f dB before, %.1f dB from 3 s after\n", before, after);
+  CHECK(before > 20);
+  CHECK(after > 18);
+}
+
+// The playout delay moves the reference so that a short tail still reaches the echo
+static void test_delay() {
+  std::vector<int16_t> far = synthetic_speech(10, 1);
+  // 60 ms of I2S buffering in front of a 30 ms room
+  Scene s = scene(far, {}, room(480, 240, 6, 6));
+  EchoCanceller aec;
+  aec.configure(64, 0);
+  aec.set_suppressor(false);
+  double without = erle(s.mic, run(aec, s), 4 * 8000, far.size());
+  aec.configure(64, 50);
+  double with = erle(s.mic, run(aec, s), 4 * 8000, far.size());
+  printf("60 ms bulk delay, 64 ms tail: linear ERLE %.1f dB without aec_delay, %.1f dB with 50 ms, echo delay %u ms\n",
+         without, with, (unsigned)aec.get_echo_delay_ms());
+  CHECK(with > without + 6);
+  CHECK(with > 15);
+  CHECK(aec.get_echo_delay_ms() >= 59 && aec.get_echo_delay_ms() <= 61);
+}
+
+// Odd frame lengths, a stalled microphone, full scale: no crash, and the FIFO realigns
+static void test_robustness() {
+  std::vector<int16_t> far = synthetic_speech(6, 1);
+  for (size_t i = 0; i < far.size(); i++)
+    far[i] = clip(far[i] * 3.0);
+  Scene s = scene(far, {}, room(100, 300, 0, 2));
+  EchoCanceller aec;
+  aec.configure(128, 100);
+  std::vector<int16_t> out(s.mic);
+  size_t at = 0;
+  lcg_state = 77;
+  while (at < out.size()) {
+    size_t n = 1 + (lcg() >> 16) % 400;
+    n = out.size() - at < n ? out.size() - at : n;
+    aec.playback(&s.far[at], n);
+    aec.capture(&out[at], n);
+    at += n;
+  }
+  double e = erle(s.mic, out, 3 * 8000, out.size());
+  printf("clipped far end, 0 dB echo loss, random frames: ERLE %.1f dB\n", e);
+  CHECK(e > 8);
+  uint32_t realignments = aec.get_realignments();
+  // the microphone stalls for a second: the FIFO overruns and starts over
+  for (size_t k = 0; k < 50; k++)
+    aec.playback(&s.far[k * FRAME], FRAME);
+  CHECK(aec.get_realignments() > realignments);
+  // the microphone's backlog is dropped: the reference starts over, the echo path stays
+  size_t delay = aec.get_echo_delay_ms();
+  realignments = aec.get_realignments();
+  aec.playback(&s.far[0], FRAME);
+  aec.realign();
+  CHECK(aec.get_realignments() == realignments + 1);
+  CHECK(aec.get_echo_delay_ms() == delay);
+  // the speaker stops: the FIFO runs dry and the microphone passes
+  std::vector<int16_t> quiet(8000);
+  for (size_t i = 0; i < quiet.size(); i++)
+    quiet[i] = (int16_t)(i % 50 * 200 - 5000);
+  std::vector<int16_t> in(quiet);
+  for (size_t k = 0; k < quiet.size() / FRAME; k++)
+    aec.capture(&quiet[k * FRAME], FRAME);
+  CHECK(energy(quiet, 4000, 8000) > energy(in, 4000, 8000) * 0.5);
+}
+
+// ERLE and host time per 10 ms block for a range of tails and update shares
+static void benchmark(int rounds) {
+  std::vector<int16_t> far = synthetic_speech(10, 1);
+  Scene s = scene(far, {}, room(100, 600, 6, 2));
+  printf("tail   updates   linear ERLE   us per 10 ms block\n");
+  for (uint32_t tail : {32, 64, 128}) {
+    for (int share : {100, 50, 25}) {
+      EchoCanceller aec;
+      aec.configure(tail, 0);
+      aec.set_suppressor(false);
+      aec.set_update_segments(aec.get_segments() * share / 100);
+      double e = erle(s.mic, run(aec, s), 4 * 8000, far.size());
+      int16_t buf[EchoCanceller::BLOCK];
+      volatile int sink = 0;
+      auto t0 = std::chrono::steady_clock::now();
+      for (int r = 0; r < rounds; r++) {
+        size_t at = (r % 500) * EchoCanceller::BLOCK + 8000;
+        memcpy(buf, &s.mic[at], sizeof(buf));
+        aec.playback(&s.far[at], EchoCanceller::BLOCK);
+        aec.capture(buf, EchoCanceller::BLOCK);
+        sink += buf[0];
+      }
+      auto t1 = std::chrono::steady_clock::now();
+      double us = std::chrono::duration<double, std::micro>(t1 - t0).count() / rounds;
+      printf("%3u ms   %3d %%     %5.1f dB      %6.1f\n", (unsigned)tail, share, e, us);
+      if (tail == 64 && share == 25)
+        CHECK(e > 15);
+    }
+  }
+}
+
+// A recorded pair: what went to the speaker and what the microphone picked up, aligned
+static void report(const char *far_path, const char *near_path) {
+  std::vector<int16_t> far = read_wav(far_path), mic = read_wav(near_path);
+  if (far.empty() || mic.empty()) {
+    std::cerr << "AEC_FAR_WAV/AEC_NEAR_WAV: not both 16-bit mono 8 kHz WAV files" << std::endl;
+    ++failures;
+    return;
+  }
+  size_t n = far.size() < mic.size() ? far.size() : mic.size();
+  Scene s;
+  s.far.assign(far.begin(), far.begin() + n);
+  s.mic.assign(mic.begin(), mic.begin() + n);
+  uint32_t delay = getenv("AEC_DELAY_MS") ? (uint32_t)atoi(getenv("AEC_DELAY_MS")) : 0;
+  for (bool suppressor : {false, true}) {
+    EchoCanceller aec;
+    aec.configure(128, delay);
+    aec.set_suppressor(suppressor);
+    std::vector<int16_t> out = run(aec, s);
+    printf("%s: %s ERLE %.1f dB overall, canceller's estimate %.1f dB, echo delay %u ms\n", near_path,
+           suppressor ? "with suppressor" : "linear", erle(s.mic, out, 0, n), aec.get_erle_db(),
+           (unsigned)aec.get_echo_delay_ms());
+  }
+}
+
+int main(int argc, char **argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 20000;
+  test_configure();
+  test_transparent();
+  test_far_end_only();
+  test_double_talk();
+  test_path_change();
+  test_delay();
+  test_robustness();
+  // a recording: AEC_FAR_WAV=speaker.wav AEC_NEAR_WAV=mic.wav [AEC_DELAY_MS=40]
+  const char *far_path = getenv("AEC_FAR_WAV"), *near_path = getenv("AEC_NEAR_WAV");
+  if (far_path && near_path)
+    report(far_path, near_path);
+  benchmark(rounds);
+
+  if (failures) {
+    std::cerr << failures << " tests failed" << std::endl;
+    return 1;
+  }
+  std::cout << "All tests passed." << std::endl;
+  return 0;
+}
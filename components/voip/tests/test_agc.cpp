@@ -0,0 +1,311 @@
+#include "../agc.h"
+#include "audio_fixtures.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+using esphome::voip::GainControl;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+  do {                                                                      \
+    if (!(cond)) {                                                          \
+      std::cerr << "FAILED " << __LINE__ << ": " << #cond << std::endl;     \
+      ++failures;                                                           \
+    }                                                                       \
+  } while (0)
+
+static const size_t FRAME = 160;
+
+static double dbfs(double amplitude) { return 20 * std::log10(amplitude > 1e-3 ? amplitude / 32768 : 1e-3 / 32768); }
+
+static int16_t limit_amplitude(double limit_dbfs) { return (int16_t)std::lrint(32768 * std::pow(10.0, limit_dbfs / 20)); }
+
+// The microphone's defaults in voip: -12 dBFS target, up to 20 dB, gate at -55 dBFS, 10/500 ms,
+// limit at -1 dBFS
+static void configure_microphone(GainControl &agc) {
+  agc.set_agc(-12, 20, -55);
+  agc.set_envelope(10, 500);
+  agc.set_limiter(-1);
+}
+
+// x scaled to peak at peak_dbfs
+static std::vector<int16_t> scaled(const std::vector<int16_t> &x, double peak_dbfs) {
+  int peak = 1;
+  for (int16_t v : x)
+    peak = std::max(peak, std::abs((int)v));
+  double g = 32768 * std::pow(10.0, peak_dbfs / 20) / peak;
+  std::vector<int16_t> out(x.size());
+  for (size_t k = 0; k < x.size(); k++)
+    out[k] = (int16_t)std::max(-32768.0, std::min(32767.0, std::round(x[k] * g)));
+  return out;
+}
+
+static std::vector<int16_t> tone(double seconds, double freq, double dbfs_level) {
+  std::vector<int16_t> out((size_t)(seconds * 8000));
+  double a = 32768 * std::pow(10.0, dbfs_level / 20);
+  for (size_t k = 0; k < out.size(); k++)
+    out[k] = (int16_t)std::lrint(a * std::sin(2 * M_PI * freq * k / 8000));
+  return out;
+}
+
+static std::vector<int16_t> run(GainControl &agc, std::vector<int16_t> x, size_t frame = FRAME) {
+  for (size_t at = 0; at < x.size(); at += frame)
+    agc.process(&x[at], std::min(frame, x.size() - at));
+  return x;
+}
+
+static int peak(const std::vector<int16_t> &x, size_t from, size_t to) {
+  int p = 0;
+  for (size_t k = from; k < to && k < x.size(); k++)
+    p = std::max(p, std::abs((int)x[k]));
+  return p;
+}
+
+// Active speech level, roughly after ITU-T P.56: the power of the 20 ms frames above -50 dBFS
+static double speech_level(const std::vector<int16_t> &x, size_t from, size_t to) {
+  double sum = 0;
+  size_t frames = 0;
+  for (size_t at = from; at + FRAME <= to && at + FRAME <= x.size(); at += FRAME) {
+    double e = 0;
+    for (size_t k = at; k < at + FRAME; k++)
+      e += (double)x[k] * x[k];
+    e /= FRAME;
+    if (dbfs(std::sqrt(e)) > -50) {
+      sum += e;
+      frames++;
+    }
+  }
+  return frames ? dbfs(std::sqrt(sum / frames)) : -96;
+}
+
+// Without AGC and limiter it is a plain fixed gain, bit for bit
+static void test_fixed() {
+  std::vector<int16_t> x(8000);
+  for (auto &v : x)
+    v = (int16_t)(lcg() >> 16);
+  GainControl unity;
+  CHECK(run(unity, x, 37) == x);
+  CHECK(std::fabs(unity.get_gain_db()) < 1e-6);
+
+  GainControl three;
+  three.set_fixed_gain(3);
+  three.reset();
+  std::vector<int16_t> out = run(three, x);
+  bool exact = true;
+  for (size_t k = 0; k < x.size(); k++) {
+    int v = x[k] * 3;
+    exact = exact && out[k] == (int16_t)(v > 32767 ? 32767 : (v < -32768 ? -32768 : v));
+  }
+  CHECK(exact);
+  CHECK(std::fabs(three.get_gain_db() - 9.54) < 0.01);
+}
+
+// The speaker: amp_gain 6 on a loud far end would clip; the limiter holds it under -1 dBFS and
+// leaves quiet audio at exactly six times
+static void test_limiter() {
+  const int16_t limit = limit_amplitude(-1);
+  std::vector<int16_t> loud = scaled(synthetic_speech(4, 1), -6);
+  GainControl speaker;
+  speaker.set_fixed_gain(6);
+  speaker.set_limiter(-1);
+  speaker.set_envelope(1, 100);
+  speaker.reset();
+  std::vector<int16_t> out = run(speaker, loud);
+  CHECK(peak(out, 0, out.size()) <= limit);
+  size_t clipped = 0;
+  for (int16_t v : loud)
+    clipped += std::abs(v * 6) > 32767;
+  CHECK(clipped > 1000);
+  CHECK(speaker.get_limiter_gain_db() < -3);
+  CHECK(speaker.get_peak_dbfs() <= -0.99);
+  CHECK(speaker.get_peak_dbfs() > -10);
+
+  // quiet after loud: once released, exact again
+  std::vector<int16_t> quiet = scaled(synthetic_speech(3, 2), -24);
+  out = run(speaker, quiet);
+  bool exact = true;
+  for (size_t k = 8000; k < quiet.size(); k++)
+    exact = exact && out[k] == quiet[k] * 6;
+  CHECK(exact);
+  CHECK(std::fabs(speaker.get_limiter_gain_db()) < 1e-6);
+}
+
+// Talkers from -27 to -3 dBFS come out within a few dB of each other, none above the limit; a
+// whisper gets no more than max_gain
+static void test_levels() {
+  std::vector<int16_t> speech = synthetic_speech(12, 3);
+  double lowest = 0, highest = -96;
+  printf("input peak   input level   output level   AGC gain\n");
+  for (double p : {-27.0, -20.0, -13.0, -6.0, -3.0}) {
+    GainControl mic;
+    configure_microphone(mic);
+    std::vector<int16_t> in = scaled(speech, p);
+    std::vector<int16_t> out = run(mic, in);
+    double level = speech_level(out, 4 * 8000, out.size());
+    printf("%5.0f dBFS    %6.1f dBFS    %6.1f dBFS    %+5.1f dB\n", p, speech_level(in, 4 * 8000, in.size()), level,
+           mic.get_agc_gain_db());
+    lowest = std::min(lowest, level);
+    highest = std::max(highest, level);
+    CHECK(peak(out, 0, out.size()) <= limit_amplitude(-1));
+  }
+  CHECK(highest - lowest < 4);
+
+  GainControl mic;
+  configure_microphone(mic);
+  run(mic, scaled(speech, -40));
+  CHECK(mic.get_agc_gain_db() <= 20.01);
+  CHECK(mic.get_agc_gain_db() > 19);
+}
+
+// Pauses and background noise below the gate hold the gain where speech left it
+static void test_gate() {
+  GainControl mic;
+  configure_microphone(mic);
+  run(mic, scaled(synthetic_speech(4, 4), -30));
+  float gain = mic.get_agc_gain_db();
+  CHECK(gain > 10);
+  std::vector<int16_t> noise(5 * 8000);
+  for (auto &v : noise)
+    v = (int16_t)std::lrint(gaussian() * 18);  // about -65 dBFS
+  std::vector<int16_t> out = run(mic, noise);
+  CHECK(std::fabs(mic.get_agc_gain_db() - gain) < 0.01);
+  CHECK(speech_level(out, 0, out.size()) < -40);
+  std::vector<int16_t> silence(8000, 0);
+  CHECK(run(mic, silence) == silence);
+  CHECK(std::fabs(mic.get_agc_gain_db() - gain) < 0.01);
+}
+
+// A quiet tone that gets loud: the gain drops within a few attack times and the limiter catches
+// the onset; back to quiet, the gain comes up over the release time and not before
+static void test_attack_release() {
+  GainControl mic;
+  configure_microphone(mic);
+  run(mic, tone(3, 500, -30));
+  CHECK(std::fabs(mic.get_agc_gain_db() - 18) < 0.5);
+
+  std::vector<int16_t> loud = tone(1, 500, -6);
+  GainControl probe = mic;
+  run(probe, std::vector<int16_t>(loud.begin(), loud.begin() + 400));  // 50 ms
+  CHECK(std::fabs(probe.get_agc_gain_db() + 6) < 1);
+  std::vector<int16_t> out = run(mic, loud);
+  CHECK(peak(out, 0, out.size()) <= limit_amplitude(-1));
+  // the first 2 ms are already limited, after the attack the AGC alone brings it to the target
+  CHECK(std::fabs(dbfs(peak(out, 800, out.size())) + 12) < 0.5);
+
+  std::vector<int16_t> quiet = tone(4, 500, -30);
+  probe = mic;
+  run(probe, std::vector<int16_t>(quiet.begin(), quiet.begin() + 800));  // 100 ms
+  CHECK(probe.get_agc_gain_db() < 0);
+  run(mic, quiet);
+  CHECK(std::fabs(mic.get_agc_gain_db() - 18) < 0.5);
+}
+
+// Frames of random length, 1 sample included, end up where 20 ms frames do
+static void test_frames() {
+  std::vector<int16_t> in = scaled(synthetic_speech(6, 5), -28);
+  std::vector<int16_t> loud = scaled(synthetic_speech(2, 6), -2);
+  in.insert(in.begin() + 3 * 8000, loud.begin(), loud.end());
+  GainControl fixed, random;
+  configure_microphone(fixed);
+  configure_microphone(random);
+  run(fixed, in);
+  std::vector<int16_t> out = in;
+  lcg_state = 7;
+  for (size_t at = 0; at < out.size();) {
+    size_t n = std::min(out.size() - at, (size_t)(lcg() >> 16) % 400 + 1);
+    random.process(&out[at], n);
+    at += n;
+  }
+  CHECK(peak(out, 0, out.size()) <= limit_amplitude(-1));
+  CHECK(std::fabs(random.get_agc_gain_db() - fixed.get_agc_gain_db()) < 1);
+  CHECK(std::fabs(speech_level(out, 0, out.size()) - speech_level(run(fixed, in), 0, in.size())) < 1);
+}
+
+// Host time per 20 ms frame: the microphone's full chain and the speaker's limiter
+static void benchmark(int rounds) {
+  std::vector<int16_t> speech = scaled(synthetic_speech(10, 8), -20);
+  GainControl mic, speaker;
+  configure_microphone(mic);
+  speaker.set_fixed_gain(6);
+  speaker.set_limiter(-1);
+  speaker.set_envelope(1, 100);
+  speaker.reset();
+  for (GainControl *g : {&mic, &speaker}) {
+    int16_t buf[FRAME];
+    volatile int sink = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) {
+      memcpy(buf, &speech[(r % 500) * FRAME], sizeof(buf));
+      g->process(buf, FRAME);
+      sink += buf[0];
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / rounds;
+    printf("%s: %.0f ns per 20 ms frame, %.2f ns per sample\n", g == &mic ? "AGC and limiter" : "fixed gain and limiter",
+           ns, ns / FRAME);
+  }
+}
+
+// A recording: the spread of the speech level per second, before and after, and the gain's range
+static void report(const char *path) {
+  std::vector<int16_t> in = read_wav(path);
+  if (in.empty()) {
+    std::cerr << "AGC_WAV: not a 16-bit mono 8 kHz WAV file" << std::endl;
+    ++failures;
+    return;
+  }
+  GainControl mic;
+  configure_microphone(mic);
+  std::vector<int16_t> out = in;
+  std::vector<double> levels_in, levels_out;
+  float min_gain = 96, max_gain = -96;
+  for (size_t at = 0; at + 8000 <= out.size(); at += 8000) {
+    for (size_t k = at; k < at + 8000; k += FRAME)
+      mic.process(&out[k], FRAME);
+    min_gain = std::min(min_gain, mic.get_gain_db());
+    max_gain = std::max(max_gain, mic.get_gain_db());
+    double li = speech_level(in, at, at + 8000), lo = speech_level(out, at, at + 8000);
+    if (li > -60) {
+      levels_in.push_back(li);
+      levels_out.push_back(lo);
+    }
+  }
+  auto spread = [](const std::vector<double> &v) {
+    if (v.empty()) return 0.0;
+    double mean = 0, var = 0;
+    for (double x : v) mean += x / v.size();
+    for (double x : v) var += (x - mean) * (x - mean) / v.size();
+    return std::sqrt(var);
+  };
+  printf("%s: speech level %.1f -> %.1f dBFS, spread per second %.1f -> %.1f dB, gain %+.1f..%+.1f dB, peak %d\n",
+         path, speech_level(in, 0, in.size()), speech_level(out, 0, out.size()), spread(levels_in),
+         spread(levels_out), min_gain, max_gain, peak(out, 0, out.size()));
+}
+
+int main(int argc, char **argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 100000;
+  test_fixed();
+  test_limiter();
+  test_levels();
+  test_gate();
+  test_attack_release();
+  test_frames();
+  // a recording of the microphone: AGC_WAV=mic.wav
+  if (const char *path = getenv("AGC_WAV"))
+    report(path);
+  benchmark(rounds);
+
+  if (failures) {
+    std::cerr << failures << " tests failed" << std::endl;
+    return 1;
+  }
+  std::cout << "All tests passed." << std::endl;
+  return 0;
+}
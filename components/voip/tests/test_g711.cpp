@@ -0,0 +1,143 @@
+#include "../g711.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+namespace g711 = esphome::voip::g711;
+
+// Sun reference implementation, compiled from libs/arduino-libg7xx/src/g711.c
+extern "C" {
+unsigned char linear2alaw(int pcm_val);
+int alaw2linear(unsigned char a_val);
+unsigned char linear2ulaw(int pcm_val);
+int ulaw2linear(unsigned char u_val);
+}
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+  do {                                                                      \
+    if (!(cond)) {                                                          \
+      std::cerr << "FAILED " << __LINE__ << ": " << #cond << std::endl;     \
+      ++failures;                                                           \
+    }                                                                       \
+  } while (0)
+
+static void test_bit_exact() {
+  int alaw_errors = 0, ulaw_errors = 0;
+  for (int pcm = -32768; pcm <= 32767; pcm++) {
+    if (g711::linear2alaw(pcm) != linear2alaw(pcm))
+      alaw_errors++;
+    if (g711::linear2ulaw(pcm) != linear2ulaw(pcm))
+      ulaw_errors++;
+  }
+  // values produced by gain stages before saturation
+  for (int pcm : {-2000000, -65536, -32769, 32768, 65535, 2000000}) {
+    if (g711::linear2alaw(pcm) != linear2alaw(pcm))
+      alaw_errors++;
+    if (g711::linear2ulaw(pcm) != linear2ulaw(pcm))
+      ulaw_errors++;
+  }
+  CHECK(alaw_errors == 0);
+  CHECK(ulaw_errors == 0);
+  for (int code = 0; code < 256; code++) {
+    CHECK(g711::alaw2linear((uint8_t)code) == alaw2linear((unsigned char)code));
+    CHECK(g711::ulaw2linear((uint8_t)code) == ulaw2linear((unsigned char)code));
+  }
+
+  // block APIs over the full input range
+  std::vector<int16_t> pcm(65536);
+  for (int i = 0; i < 65536; i++)
+    pcm[i] = (int16_t)(i - 32768);
+  std::vector<uint8_t> a(65536), u(65536);
+  g711::encode_alaw(pcm.data(), a.data(), pcm.size());
+  g711::encode_ulaw(pcm.data(), u.data(), pcm.size());
+  int block_errors = 0;
+  for (int i = 0; i < 65536; i++) {
+    if (a[i] != linear2alaw(pcm[i]) || u[i] != linear2ulaw(pcm[i]))
+      block_errors++;
+  }
+  CHECK(block_errors == 0);
+  std::vector<uint8_t> codes(256);
+  std::vector<int16_t> da(256), du(256);
+  for (int i = 0; i < 256; i++)
+    codes[i] = (uint8_t)i;
+  g711::decode_alaw(codes.data(), da.data(), codes.size());
+  g711::decode_ulaw(codes.data(), du.data(), codes.size());
+  for (int i = 0; i < 256; i++) {
+    CHECK(da[i] == alaw2linear((unsigned char)i));
+    CHECK(du[i] == ulaw2linear((unsigned char)i));
+  }
+}
+
+// Times one pass of fn over the buffer and returns million samples per second
+template<typename F> static double msps(size_t samples, int rounds, F fn) {
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < rounds; r++)
+    fn();
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return secs > 0 ? samples * (double)rounds / secs / 1e6 : 0;
+}
+
+static void benchmark(int rounds) {
+  // 20 ms frames of a speech-like signal spread over all segments
+  const size_t n = 160 * 64;
+  std::vector<int16_t> pcm(n);
+  uint32_t seed = 1;
+  for (size_t i = 0; i < n; i++) {
+    seed = seed * 1103515245u + 12345u;
+    int shift = (seed >> 28) & 0xF;  // random segment
+    pcm[i] = (int16_t)((int32_t)(seed >> 8) >> (8 + shift));
+  }
+  std::vector<uint8_t> out(n);
+  std::vector<int16_t> back(n);
+  volatile uint32_t sink = 0;
+
+  double ref_a = msps(n, rounds, [&]() {
+    for (size_t i = 0; i < n; i++)
+      out[i] = linear2alaw(pcm[i]);
+    sink += out[n - 1];
+  });
+  double lut_a = msps(n, rounds, [&]() {
+    g711::encode_alaw(pcm.data(), out.data(), n);
+    sink += out[n - 1];
+  });
+  double ref_u = msps(n, rounds, [&]() {
+    for (size_t i = 0; i < n; i++)
+      out[i] = linear2ulaw(pcm[i]);
+    sink += out[n - 1];
+  });
+  double lut_u = msps(n, rounds, [&]() {
+    g711::encode_ulaw(pcm.data(), out.data(), n);
+    sink += out[n - 1];
+  });
+  double ref_da = msps(n, rounds, [&]() {
+    for (size_t i = 0; i < n; i++)
+      back[i] = (int16_t)alaw2linear(out[i]);
+    sink += back[n - 1];
+  });
+  double lut_da = msps(n, rounds, [&]() {
+    g711::decode_alaw(out.data(), back.data(), n);
+    sink += back[n - 1];
+  });
+  printf("G.711 Msamples/s        reference   table\n");
+  printf("  A-law encode       %10.1f %8.1f\n", ref_a, lut_a);
+  printf("  u-law encode       %10.1f %8.1f\n", ref_u, lut_u);
+  printf("  A-law decode       %10.1f %8.1f\n", ref_da, lut_da);
+}
+
+int main(int argc, char **argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 200;
+
+  test_bit_exact();
+  benchmark(rounds);
+
+  if (failures) {
+    std::cerr << failures << " tests failed" << std::endl;
+    return 1;
+  }
+  std::cout << "All tests passed." << std::endl;
+  return 0;
+}
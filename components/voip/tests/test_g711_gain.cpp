@@ -0,0 +1,216 @@
+#include "../g711.h"
+#include "../g711_gain.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+namespace g711 = esphome::voip::g711;
+
+// Sun reference encoder (libs/arduino-libg7xx), used for the pre-kernel TX path in the benchmark
+extern "C" unsigned char linear2alaw(int pcm_val);
+extern "C" int alaw2linear(unsigned char a_val);
+extern "C" int ulaw2linear(unsigned char u_val);
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+  do {                                                                      \
+    if (!(cond)) {                                                          \
+      std::cerr << "FAILED " << __LINE__ << ": " << #cond << std::endl;     \
+      ++failures;                                                           \
+    }                                                                       \
+  } while (0)
+
+static uint32_t lcg_state = 1;
+static uint32_t lcg() { return lcg_state = lcg_state * 1103515245u + 12345u; }
+
+// One sample at a time in 64-bit arithmetic: the definition the fused kernel has to match
+template<typename T> static int16_t scalar_scale(T x, int in_shift, g711::Q15Gain g) {
+  int64_t v = ((int64_t)(x >> in_shift) * g.mantissa) >> g.shift;
+  if (v > 32767)
+    v = 32767;
+  if (v < -32768)
+    v = -32768;
+  return (int16_t)v;
+}
+
+static void test_q15_gain() {
+  g711::Q15Gain g = g711::q15_gain(1, 1);
+  CHECK(g.mantissa == 16384 && g.shift == 14);
+  g = g711::q15_gain(2, 8);
+  CHECK(g.mantissa == 16384 && g.shift == 16);
+  g = g711::q15_gain(0, 8);
+  CHECK(g.mantissa == 0);
+  for (int num = 1; num < 200; num += 7) {
+    g = g711::q15_gain(num, 8);
+    CHECK(g.mantissa >= 16384 && g.mantissa < 32768);
+    double value = (double)g.mantissa / (double)(1LL << g.shift);
+    double want = num / 8.0;
+    CHECK(value <= want && value > want * (1 - 1.0 / 16384));
+  }
+}
+
+static void test_bit_exact() {
+  const size_t n = 1000;  // not a multiple of the chunk size
+  std::vector<int16_t> in16(n), ref16(n), out16(n);
+  std::vector<int32_t> in32(n);
+  std::vector<uint8_t> out(n);
+  int gains[] = {0, 1, 2, 5, 8, 13, 64, 500};
+  for (int gain : gains) {
+    g711::Q15Gain g = g711::q15_gain(gain, 8);
+    for (size_t i = 0; i < n; i++) {
+      in16[i] = (int16_t)(lcg() >> 16);
+      // 24-bit samples, sign-extended into the 32-bit container
+      in32[i] = (int32_t)(lcg() << 8) >> 8;
+    }
+    in16[0] = -32768;
+    in16[1] = 32767;
+    in32[0] = -(1 << 23);
+    in32[1] = (1 << 23) - 1;
+
+    int scale_errors = 0, alaw_errors = 0, ulaw_errors = 0;
+    g711::scale_q15(in16.data(), out16.data(), n, 0, g);
+    for (size_t i = 0; i < n; i++)
+      scale_errors += out16[i] != scalar_scale(in16[i], 0, g);
+    g711::encode_alaw(in16.data(), out.data(), n, 0, g);
+    for (size_t i = 0; i < n; i++)
+      alaw_errors += out[i] != g711::linear2alaw(scalar_scale(in16[i], 0, g));
+    g711::encode_ulaw(in16.data(), out.data(), n, 0, g);
+    for (size_t i = 0; i < n; i++)
+      ulaw_errors += out[i] != g711::linear2ulaw(scalar_scale(in16[i], 0, g));
+    g711::encode_alaw(in32.data(), out.data(), n, 8, g);
+    for (size_t i = 0; i < n; i++)
+      alaw_errors += out[i] != g711::linear2alaw(scalar_scale(in32[i], 8, g));
+    g711::encode_ulaw(in32.data(), out.data(), n, 8, g);
+    for (size_t i = 0; i < n; i++)
+      ulaw_errors += out[i] != g711::linear2ulaw(scalar_scale(in32[i], 8, g));
+    CHECK(scale_errors == 0);
+    CHECK(alaw_errors == 0);
+    CHECK(ulaw_errors == 0);
+  }
+
+  // loud input saturates instead of wrapping
+  int16_t loud[2] = {32767, -32768};
+  uint8_t code[2];
+  g711::encode_alaw(loud, code, 2, 0, g711::q15_gain(64, 8));
+  CHECK(code[0] == g711::linear2alaw(32767));
+  CHECK(code[1] == g711::linear2alaw(-32768));
+  g711::encode_ulaw(loud, code, 2, 0, g711::q15_gain(64, 8));
+  CHECK(code[0] == 0x80);
+  CHECK(code[1] == 0x00);
+}
+
+static void test_gain_decoder() {
+  using g711::GainDecoder;
+  // golden values: code, law, gain, expected sample
+  struct Golden {
+    uint8_t code;
+    GainDecoder::Law law;
+    int32_t gain;
+    int16_t expected;
+  };
+  const Golden golden[] = {
+      {0xD5, GainDecoder::ALAW, 1, 8},         {0x55, GainDecoder::ALAW, 1, -8},
+      {0xD4, GainDecoder::ALAW, 6, 144},       {0xAA, GainDecoder::ALAW, 1, 32256},
+      {0xAA, GainDecoder::ALAW, 6, 32767},     {0x2A, GainDecoder::ALAW, 6, -32768},
+      {0xFF, GainDecoder::ULAW, 6, 0},         {0x80, GainDecoder::ULAW, 1, 32124},
+      {0x80, GainDecoder::ULAW, 2, 32767},     {0x00, GainDecoder::ULAW, 2, -32768},
+      {0xF0, GainDecoder::ULAW, 6, 720},       {0x70, GainDecoder::ULAW, 0, 0},
+  };
+  GainDecoder dec;
+  for (const Golden &g : golden) {
+    dec.configure(g.law, g.gain);
+    CHECK(dec.decode(g.code) == g.expected);
+  }
+
+  // every code and a range of gains against the reference decoder with explicit saturation
+  for (int law = 0; law < 2; law++) {
+    for (int32_t gain : {0, 1, 2, 6, 17, 100}) {
+      dec.configure((GainDecoder::Law)law, gain);
+      uint8_t codes[256];
+      int16_t out[256];
+      for (int i = 0; i < 256; i++)
+        codes[i] = (uint8_t)i;
+      dec.decode(codes, out, 256);
+      int errors = 0;
+      for (int i = 0; i < 256; i++) {
+        int32_t v = (law == GainDecoder::ULAW ? ulaw2linear((unsigned char)i) : alaw2linear((unsigned char)i)) * gain;
+        v = v > 32767 ? 32767 : (v < -32768 ? -32768 : v);
+        errors += out[i] != v;
+      }
+      CHECK(errors == 0);
+    }
+  }
+  CHECK(dec.get_law() == GainDecoder::ULAW && dec.get_gain() == 100);
+}
+
+template<typename F> static double msps(size_t samples, int rounds, F fn) {
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < rounds; r++)
+    fn();
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return secs > 0 ? samples * (double)rounds / secs / 1e6 : 0;
+}
+
+static void benchmark(int rounds) {
+  const size_t n = 160 * 64;
+  std::vector<int32_t> in32(n);
+  std::vector<int16_t> in16(n);
+  for (size_t i = 0; i < n; i++) {
+    in32[i] = (int32_t)(lcg() << 8) >> (8 + (lcg() >> 29));
+    in16[i] = (int16_t)(in32[i] >> 8);
+  }
+  std::vector<uint8_t> out(n);
+  volatile uint32_t sink = 0;
+  const int mic_gain = 2;
+  g711::Q15Gain g = g711::q15_gain(mic_gain, 8);
+
+  // what tx_rtp did before: divide, multiply and a search-based encoder per sample
+  double legacy = msps(n, rounds, [&]() {
+    for (size_t i = 0; i < n; i++)
+      out[i] = linear2alaw((in32[i] / 2048) * mic_gain);
+    sink += out[n - 1];
+  });
+  double fused32 = msps(n, rounds, [&]() {
+    g711::encode_alaw(in32.data(), out.data(), n, 8, g);
+    sink += out[n - 1];
+  });
+  double fused16 = msps(n, rounds, [&]() {
+    g711::encode_alaw(in16.data(), out.data(), n, 0, g);
+    sink += out[n - 1];
+  });
+  printf("TX A-law Msamples/s: legacy %.1f, fused 32-bit %.1f, fused 16-bit %.1f\n", legacy, fused32, fused16);
+
+  // RX: what play_rtp_frames did before (decode, then multiply with int16 wrap-around) vs the table
+  const int amp_gain = 6;
+  std::vector<int16_t> pcm(n);
+  double rx_legacy = msps(n, rounds, [&]() {
+    for (size_t i = 0; i < n; i++)
+      pcm[i] = (int16_t)(alaw2linear(out[i]) * amp_gain);
+    sink += pcm[n - 1];
+  });
+  g711::GainDecoder dec(g711::GainDecoder::ALAW, amp_gain);
+  double rx_table = msps(n, rounds, [&]() {
+    dec.decode(out.data(), pcm.data(), n);
+    sink += pcm[n - 1];
+  });
+  printf("RX A-law Msamples/s: legacy %.1f, gain table %.1f\n", rx_legacy, rx_table);
+}
+
+int main(int argc, char **argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 200;
+
+  test_q15_gain();
+  test_bit_exact();
+  test_gain_decoder();
+  benchmark(rounds);
+
+  if (failures) {
+    std::cerr << failures << " tests failed" << std::endl;
+    return 1;
+  }
+  std::cout << "All tests passed." << std::endl;
+  return 0;
+}
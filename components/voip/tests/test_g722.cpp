@@ -0,0 +1,447 @@
+#include "../g722.h"
+#include "audio_fixtures.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace g722 = esphome::voip::g722;
+using esphome::voip::G722Codec;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+  do {                                                                      \
+    if (!(cond)) {                                                          \
+      std::cerr << "FAILED " << __LINE__ << ": " << #cond << std::endl;     \
+      ++failures;                                                           \
+    }                                                                       \
+  } while (0)
+
+// The QMF as the Recommendation writes it: a 24-word delay line shifted by two per sample pair
+static const int QMF_COEFFS[12] = {3, -11, 12, 32, -210, 951, 3876, -805, 362, -156, 53, -11};
+
+struct RefAnalysis {
+  int x[24] = {};
+  void run(const int16_t *pcm, int16_t *low, int16_t *high, size_t n) {
+    for (size_t k = 0; k < n; k++) {
+      memmove(x, x + 2, 22 * sizeof(int));
+      x[22] = pcm[2 * k];
+      x[23] = pcm[2 * k + 1];
+      int sumodd = 0, sumeven = 0;
+      for (int i = 0; i < 12; i++) {
+        sumodd += x[2 * i] * QMF_COEFFS[i];
+        sumeven += x[2 * i + 1] * QMF_COEFFS[11 - i];
+      }
+      low[k] = (int16_t)((sumeven + sumodd) >> 14);
+      high[k] = (int16_t)((sumeven - sumodd) >> 14);
+    }
+  }
+};
+
+struct RefSynthesis {
+  int x[24] = {};
+  void run(const int16_t *low, const int16_t *high, int16_t *pcm, size_t n) {
+    for (size_t k = 0; k < n; k++) {
+      memmove(x, x + 2, 22 * sizeof(int));
+      x[22] = low[k] + high[k];
+      x[23] = low[k] - high[k];
+      int xout1 = 0, xout2 = 0;
+      for (int i = 0; i < 12; i++) {
+        xout2 += x[2 * i] * QMF_COEFFS[i];
+        xout1 += x[2 * i + 1] * QMF_COEFFS[11 - i];
+      }
+      pcm[2 * k] = (int16_t)std::min(32767, std::max(-32768, xout1 >> 11));
+      pcm[2 * k + 1] = (int16_t)std::min(32767, std::max(-32768, xout2 >> 11));
+    }
+  }
+};
+
+static std::vector<int16_t> tone(double hz, size_t n, double amplitude, uint32_t rate = 16000) {
+  std::vector<int16_t> x(n);
+  for (size_t i = 0; i < n; i++)
+    x[i] = (int16_t)std::lrint(amplitude * std::sin(2 * M_PI * hz * i / rate));
+  return x;
+}
+
+static std::vector<int16_t> random_pcm(size_t n) {
+  std::vector<int16_t> x(n);
+  for (auto &v : x)
+    v = (int16_t)(lcg() >> 16);
+  return x;
+}
+
+// SNR of y against x delayed by delay samples, over what is left after the first 100 ms, dB
+static double snr_db(const std::vector<int16_t> &x, const std::vector<int16_t> &y, size_t delay) {
+  double signal = 0, noise = 0;
+  for (size_t i = 1600 + delay; i < y.size(); i++) {
+    double e = (double)y[i] - x[i - delay];
+    signal += (double)x[i - delay] * x[i - delay];
+    noise += e * e;
+  }
+  return 10 * std::log10(signal / (noise + 1e-9));
+}
+
+// The polyphase QMF gives what the 24-word delay line gives, for any block length
+static void test_qmf_matches_reference() {
+  for (const std::vector<int16_t> &x : {random_pcm(16000), synthetic_speech(1, 1, 16000)}) {
+    const size_t pairs = x.size() / 2;
+    std::vector<int16_t> ref_low(pairs), ref_high(pairs), low(pairs), high(pairs);
+    RefAnalysis ref;
+    ref.run(x.data(), ref_low.data(), ref_high.data(), pairs);
+    g722::AnalysisQmf qmf;
+    g722::init_qmf(&qmf);
+    for (size_t at = 0; at < pairs;) {
+      size_t m = std::min<size_t>((lcg() >> 16) % 300, pairs - at);
+      g722::qmf_analysis(&qmf, &x[2 * at], &low[at], &high[at], m);
+      at += m;
+    }
+    CHECK(low == ref_low && high == ref_high);
+
+    std::vector<int16_t> ref_out(x.size()), out(x.size());
+    RefSynthesis ref_syn;
+    ref_syn.run(ref_low.data(), ref_high.data(), ref_out.data(), pairs);
+    g722::SynthesisQmf syn;
+    g722::init_qmf(&syn);
+    for (size_t at = 0; at < pairs;) {
+      size_t m = std::min<size_t>((lcg() >> 16) % 300, pairs - at);
+      g722::qmf_synthesis(&syn, &low[at], &high[at], &out[2 * at], m);
+      at += m;
+    }
+    CHECK(out == ref_out);
+  }
+}
+
+// Analysis and synthesis alone give back the input 22 samples late, up to the QMF's small ripple,
+// and put tones away from 4 kHz into one band only
+static void test_qmf_reconstruction() {
+  printf("QMF alone:");
+  for (double hz : {200.0, 1000.0, 3000.0, 5000.0, 7000.0}) {
+    std::vector<int16_t> x = tone(hz, 16000, 12000), y(x.size());
+    std::vector<int16_t> low(x.size() / 2), high(x.size() / 2);
+    g722::AnalysisQmf qmf;
+    g722::SynthesisQmf syn;
+    g722::init_qmf(&qmf);
+    g722::init_qmf(&syn);
+    g722::qmf_analysis(&qmf, x.data(), low.data(), high.data(), low.size());
+    g722::qmf_synthesis(&syn, low.data(), high.data(), y.data(), low.size());
+    double snr = snr_db(x, y, 22);
+    double e_low = 0, e_high = 0;
+    for (size_t i = 800; i < low.size(); i++) {
+      e_low += (double)low[i] * low[i];
+      e_high += (double)high[i] * high[i];
+    }
+    double other = 10 * std::log10((hz < 4000 ? e_high : e_low) / (hz < 4000 ? e_low : e_high) + 1e-12);
+    printf(" %.0f Hz: SNR %.1f dB, other band %.1f dB;", hz, snr, other);
+    CHECK(snr > 50);
+    // the bands overlap around 4 kHz
+    if (std::fabs(hz - 4000) > 2000)
+      CHECK(other < -60);
+  }
+  printf("\n");
+}
+
+// The decoder's predictors and scale factors follow the encoder's exactly, in every band
+static void test_decoder_tracks_encoder() {
+  for (const std::vector<int16_t> &x : {random_pcm(32000), synthetic_speech(2, 2, 16000), tone(1000, 32000, 32767)}) {
+    g722::Encoder enc;
+    g722::Decoder dec;
+    g722::init_encoder(&enc);
+    g722::init_decoder(&dec);
+    std::vector<uint8_t> codes(x.size() / 2);
+    std::vector<int16_t> y(x.size());
+    bool same = true;
+    for (size_t at = 0; at < codes.size(); at += 160) {
+      g722::encode_block(&enc, &x[2 * at], &codes[at], 160);
+      g722::decode_block(&dec, &codes[at], &y[2 * at], 160);
+      same = same && memcmp(&enc.low, &dec.low, sizeof(enc.low)) == 0 &&
+             memcmp(&enc.high, &dec.high, sizeof(enc.high)) == 0;
+    }
+    CHECK(same);
+  }
+}
+
+// 64 kbit/s through the whole codec: tones in both bands and synthetic speech come back with the
+// SNR G.722 is known for; tones in the upper band show its 2-bit quantizer. The lower band also
+// decodes at 56 and 48 kbit/s, a little worse.
+static void test_round_trip() {
+  printf("64 kbit/s:");
+  struct Case {
+    const char *name;
+    std::vector<int16_t> x;
+    double min_snr;
+  } cases[] = {{"300 Hz", tone(300, 32000, 10000), 30},   {"1 kHz", tone(1000, 32000, 10000), 30},
+               {"3 kHz", tone(3000, 32000, 10000), 20},   {"5 kHz", tone(5000, 32000, 10000), 10},
+               {"6.5 kHz", tone(6500, 32000, 5000), 10},  {"speech", synthetic_speech(2, 2, 16000), 20}};
+  for (const Case &c : cases) {
+    g722::Encoder enc;
+    g722::Decoder dec;
+    g722::init_encoder(&enc);
+    g722::init_decoder(&dec);
+    std::vector<uint8_t> codes(c.x.size() / 2);
+    std::vector<int16_t> y(c.x.size());
+    g722::encode_block(&enc, c.x.data(), codes.data(), codes.size());
+    g722::decode_block(&dec, codes.data(), y.data(), codes.size());
+    double snr = snr_db(c.x, y, 22);
+    printf(" %s %.1f dB;", c.name, snr);
+    CHECK(snr > c.min_snr);
+  }
+  printf("\n");
+
+  // lower band only, in all three modes
+  std::vector<int16_t> x = tone(1000, 32000, 10000);
+  std::vector<int16_t> low(x.size() / 2), high(x.size() / 2);
+  g722::AnalysisQmf qmf;
+  g722::init_qmf(&qmf);
+  g722::qmf_analysis(&qmf, x.data(), low.data(), high.data(), low.size());
+  g722::Encoder enc;
+  g722::init_encoder(&enc);
+  std::vector<uint8_t> codes(low.size());
+  g722::encode_subbands(&enc, low.data(), high.data(), codes.data(), codes.size());
+  double last = 1e9;
+  printf("lower band at 1 kHz:");
+  for (uint8_t mode = 1; mode <= 3; mode++) {
+    g722::Decoder dec;
+    g722::init_decoder(&dec);
+    std::vector<int16_t> out(low.size());
+    g722::decode_subbands(&dec, mode, codes.data(), out.data(), nullptr, codes.size());
+    double snr = snr_db(low, out, 0);
+    printf(" mode %u %.1f dB;", mode, snr);
+    CHECK(snr > 20 && snr < last);
+    last = snr;
+  }
+  printf("\n");
+}
+
+// Full scale square waves and random samples saturate, nothing wraps around
+static void test_overload() {
+  std::vector<int16_t> square(16000);
+  for (size_t i = 0; i < square.size(); i++)
+    square[i] = (i / 10) % 2 ? -32768 : 32767;
+  for (const std::vector<int16_t> &x : {square, random_pcm(16000)}) {
+    g722::Encoder enc;
+    g722::Decoder dec;
+    g722::init_encoder(&enc);
+    g722::init_decoder(&dec);
+    std::vector<uint8_t> codes(x.size() / 2);
+    std::vector<int16_t> y(x.size());
+    g722::encode_block(&enc, x.data(), codes.data(), codes.size());
+    g722::decode_block(&dec, codes.data(), y.data(), codes.size());
+    CHECK(std::abs(enc.low.a[2]) <= 12288 && std::abs(enc.high.a[2]) <= 12288);
+    CHECK(enc.low.nb <= 18432 && enc.high.nb <= 22528);
+  }
+  // the square wave comes back as a square wave: no sample flips sign in the middle of a half period
+  g722::Encoder enc;
+  g722::Decoder dec;
+  g722::init_encoder(&enc);
+  g722::init_decoder(&dec);
+  std::vector<uint8_t> codes(square.size() / 2);
+  std::vector<int16_t> y(square.size());
+  g722::encode_block(&enc, square.data(), codes.data(), codes.size());
+  g722::decode_block(&dec, codes.data(), y.data(), codes.size());
+  int flips = 0;
+  for (size_t i = 1600; i < y.size(); i++) {
+    int16_t x = square[i - 22];
+    if ((i - 22) % 10 >= 3 && (i - 22) % 10 <= 7 && (x > 0) != (y[i] > 0))
+      flips++;
+  }
+  CHECK(flips == 0);
+}
+
+// The call side: the lower band at the 16-bit level of the 8 kHz media path, with and without the
+// upper band; RTP payload octets one per sample
+static void test_codec() {
+  std::vector<int16_t> x = tone(1000, 8000, 16000, 8000);
+  G722Codec codec;
+  std::vector<uint8_t> payload(160);
+  std::vector<int16_t> y(x.size()), high(160);
+  for (size_t at = 0; at < x.size(); at += 160) {
+    CHECK(codec.encode(&x[at], nullptr, 160, payload.data()) == 160);
+    CHECK(codec.decode(payload.data(), 160, &y[at], high.data(), 200) == 160);
+  }
+  double snr = snr_db(x, y, 0);
+  printf("narrowband through G722Codec: %.1f dB\n", snr);
+  CHECK(snr > 30);
+  // an empty upper band stays close to silence
+  int peak = 0;
+  for (int16_t v : high)
+    peak = std::max(peak, std::abs((int)v));
+  CHECK(peak < 64);
+  // max_samples limits the output
+  CHECK(codec.decode(payload.data(), 160, y.data(), nullptr, 80) == 80);
+  // the same as the subband coder on half the level
+  G722Codec fresh;
+  g722::Encoder enc;
+  g722::init_encoder(&enc);
+  std::vector<int16_t> half(160);
+  for (size_t i = 0; i < 160; i++)
+    half[i] = (int16_t)(x[i] >> 1);
+  std::vector<uint8_t> expected(160);
+  g722::encode_subbands(&enc, half.data(), nullptr, expected.data(), 160);
+  fresh.encode(x.data(), nullptr, 160, payload.data());
+  CHECK(payload == expected);
+}
+
+// Conformance vectors. They are not redistributable and not shipped; point G722_VECTORS at a directory
+// with the ITU-T G.722 test sequences (bypassing the QMF, as the Recommendation's Appendix II
+// prescribes) and a vectors.txt describing them, one run per line:
+//   enc <input file> <expected codes>
+//   dec <mode 1|2|3> <codes> <expected lower band> <expected upper band>
+// Files hold one sample or code per 16-bit little-endian word. Encoder input goes to both bands
+// shifted right by one; decoder output is compared shifted left by one, the two LSBs masked off, as
+// the sequences carry 14 bits. Every run starts from reset.
+static std::vector<int> read_words(const std::string &path) {
+  std::ifstream f(path, std::ios::binary);
+  std::vector<int> words;
+  int lo, hi;
+  while ((lo = f.get()) != EOF && (hi = f.get()) != EOF)
+    words.push_back((int16_t)(lo | (hi << 8)));
+  return words;
+}
+
+static void test_vectors(const char *dir) {
+  std::ifstream list(std::string(dir) + "/vectors.txt");
+  if (!list) {
+    std::cerr << "FAILED: no vectors.txt in " << dir << std::endl;
+    ++failures;
+    return;
+  }
+  std::string line;
+  int runs = 0;
+  while (std::getline(list, line)) {
+    if (line.empty() || line[0] == '#')
+      continue;
+    std::istringstream fields(line);
+    std::string kind;
+    fields >> kind;
+    int errors = 0;
+    size_t n = 0;
+    std::string input;
+    if (kind == "enc") {
+      std::string expected;
+      fields >> input >> expected;
+      std::vector<int> in = read_words(std::string(dir) + "/" + input);
+      std::vector<int> ref = read_words(std::string(dir) + "/" + expected);
+      CHECK(!in.empty() && in.size() == ref.size());
+      n = std::min(in.size(), ref.size());
+      std::vector<int16_t> band(n);
+      for (size_t i = 0; i < n; i++)
+        band[i] = (int16_t)(in[i] >> 1);
+      std::vector<uint8_t> codes(n);
+      g722::Encoder enc;
+      g722::init_encoder(&enc);
+      g722::encode_subbands(&enc, band.data(), band.data(), codes.data(), n);
+      for (size_t i = 0; i < n; i++)
+        errors += codes[i] != (ref[i] & 0xFF);
+    } else {
+      int mode;
+      std::string low_file, high_file;
+      fields >> mode >> input >> low_file >> high_file;
+      std::vector<int> in = read_words(std::string(dir) + "/" + input);
+      std::vector<int> ref_low = read_words(std::string(dir) + "/" + low_file);
+      std::vector<int> ref_high = read_words(std::string(dir) + "/" + high_file);
+      CHECK(!in.empty() && in.size() == ref_low.size() && in.size() == ref_high.size());
+      n = std::min(in.size(), std::min(ref_low.size(), ref_high.size()));
+      std::vector<uint8_t> codes(n);
+      for (size_t i = 0; i < n; i++)
+        codes[i] = (uint8_t)in[i];
+      std::vector<int16_t> low(n), high(n);
+      g722::Decoder dec;
+      g722::init_decoder(&dec);
+      g722::decode_subbands(&dec, (uint8_t)mode, codes.data(), low.data(), high.data(), n);
+      for (size_t i = 0; i < n; i++) {
+        errors += ((low[i] * 2) & 0xFFFC) != (ref_low[i] & 0xFFFC);
+        errors += ((high[i] * 2) & 0xFFFC) != (ref_high[i] & 0xFFFC);
+      }
+    }
+    printf("vector %s: %zu samples, %d mismatches\n", input.c_str(), n, errors);
+    CHECK(errors == 0);
+    runs++;
+  }
+  CHECK(runs > 0);
+}
+
+template<typename F> static void measure(const char *label, int rounds, F &&f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / rounds;
+  printf("  %-28s %8.0f ns per 20 ms frame\n", label, ns);
+}
+
+static void benchmark(int rounds) {
+  // 20 ms at 16 kHz, 160 octets
+  std::vector<int16_t> x = synthetic_speech(1, 3, 16000), y(320), low(160), high(160);
+  std::vector<uint8_t> codes(160);
+  volatile int sink = 0;
+  printf("G.722, %d frames:\n", rounds);
+  measure("reference QMF analysis", rounds, [&] {
+    RefAnalysis ref;
+    for (int r = 0; r < rounds; r++)
+      ref.run(x.data(), low.data(), high.data(), 160);
+    sink += low[0];
+  });
+  measure("polyphase QMF analysis", rounds, [&] {
+    g722::AnalysisQmf qmf;
+    g722::init_qmf(&qmf);
+    for (int r = 0; r < rounds; r++)
+      g722::qmf_analysis(&qmf, x.data(), low.data(), high.data(), 160);
+    sink += low[0];
+  });
+  measure("reference QMF synthesis", rounds, [&] {
+    RefSynthesis ref;
+    for (int r = 0; r < rounds; r++)
+      ref.run(low.data(), high.data(), y.data(), 160);
+    sink += y[0];
+  });
+  measure("polyphase QMF synthesis", rounds, [&] {
+    g722::SynthesisQmf qmf;
+    g722::init_qmf(&qmf);
+    for (int r = 0; r < rounds; r++)
+      g722::qmf_synthesis(&qmf, low.data(), high.data(), y.data(), 160);
+    sink += y[0];
+  });
+  measure("encode (QMF and ADPCM)", rounds, [&] {
+    g722::Encoder enc;
+    g722::init_encoder(&enc);
+    for (int r = 0; r < rounds; r++)
+      g722::encode_block(&enc, x.data(), codes.data(), 160);
+    sink += codes[0];
+  });
+  measure("decode (ADPCM and QMF)", rounds, [&] {
+    g722::Decoder dec;
+    g722::init_decoder(&dec);
+    for (int r = 0; r < rounds; r++)
+      g722::decode_block(&dec, codes.data(), y.data(), 160);
+    sink += y[0];
+  });
+}
+
+int main(int argc, char **argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 20000;
+  test_qmf_matches_reference();
+  test_qmf_reconstruction();
+  test_decoder_tracks_encoder();
+  test_round_trip();
+  test_overload();
+  test_codec();
+  const char *dir = getenv("G722_VECTORS");
+  if (dir != nullptr)
+    test_vectors(dir);
+  else
+    printf("G722_VECTORS not set, skipping the conformance vectors\n");
+  benchmark(rounds);
+
+  if (failures) {
+    std::cerr << failures << " tests failed" << std::endl;
+    return 1;
+  }
+  std::cout << "All tests passed." << std::endl;
+  return 0;
+}
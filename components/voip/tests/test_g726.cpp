@@ -0,0 +1,304 @@
+#include "../g726.h"
+#include "../g711.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC 1
+#endif
+
+extern "C" {
+#include "g72x.h"
+}
+
+namespace g726 = esphome::voip::g726;
+namespace g711 = esphome::voip::g711;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+  do {                                                                      \
+    if (!(cond)) {                                                          \
+      std::cerr << "FAILED " << __LINE__ << ": " << #cond << std::endl;     \
+      ++failures;                                                           \
+    }                                                                       \
+  } while (0)
+
+typedef int (*RefCoder)(int, int, struct g72x_state *);
+
+struct Rate {
+  uint8_t bits;
+  const char *name;
+  RefCoder encode;
+  RefCoder decode;
+};
+
+static const Rate RATES[] = {
+    {3, "G726-24", g723_24_encoder, g723_24_decoder},
+    {4, "G726-32", g721_encoder, g721_decoder},
+    {5, "G726-40", g723_40_encoder, g723_40_decoder},
+};
+
+static uint32_t lcg_state = 12345;
+static uint32_t lcg() {
+  lcg_state = lcg_state * 1103515245u + 12345u;
+  return lcg_state >> 8;
+}
+
+struct Signal {
+  const char *name;
+  std::vector<int16_t> pcm;
+};
+
+static std::vector<Signal> signals() {
+  const size_t n = 8000 * 4;
+  std::vector<Signal> out;
+  Signal speech{"speech", std::vector<int16_t>(n)};
+  Signal noise{"noise", std::vector<int16_t>(n)};
+  Signal square{"overload", std::vector<int16_t>(n)};
+  Signal chirp{"chirp", std::vector<int16_t>(n)};
+  for (size_t i = 0; i < n; i++) {
+    double t = i / 8000.0;
+    double env = 0.5 + 0.5 * std::sin(2 * M_PI * 3 * t);
+    speech.pcm[i] = (int16_t)(env * (6000 * std::sin(2 * M_PI * 440 * t) + 3000 * std::sin(2 * M_PI * 1230 * t)));
+    noise.pcm[i] = (int16_t)(lcg() & 0xFFFF);
+    square.pcm[i] = (i / 7) % 2 ? 32767 : -32768;
+    // sweeps 50 Hz .. 3.9 kHz with 1 s silences, so the coder sees tones, data-like input and resets
+    double level = (i / 8000) % 2 ? 0.0 : 30000.0;
+    chirp.pcm[i] = (int16_t)(level * std::sin(2 * M_PI * (50 + 480 * t) * t));
+  }
+  out.push_back(speech);
+  out.push_back(noise);
+  out.push_back(square);
+  out.push_back(chirp);
+  return out;
+}
+
+// Encoder codes and linear decoder output against the reference, in blocks of odd size so state is
+// carried across block boundaries
+static void test_linear(const Rate &rate, const Signal &sig) {
+  struct g72x_state ref_enc, ref_dec;
+  g72x_init_state(&ref_enc);
+  g72x_init_state(&ref_dec);
+  g726::State enc, dec;
+  g726::init_state(&enc);
+  g726::init_state(&dec);
+
+  const size_t n = sig.pcm.size();
+  std::vector<uint8_t> codes(n);
+  std::vector<int16_t> out(n);
+  for (size_t pos = 0; pos < n;) {
+    size_t k = std::min<size_t>(n - pos, 1 + pos % 173);
+    g726::encode_block(&enc, rate.bits, &sig.pcm[pos], &codes[pos], k);
+    g726::decode_block(&dec, rate.bits, &codes[pos], &out[pos], k);
+    pos += k;
+  }
+  int code_errors = 0, pcm_errors = 0;
+  for (size_t i = 0; i < n; i++) {
+    int code = rate.encode(sig.pcm[i], AUDIO_ENCODING_LINEAR, &ref_enc);
+    int16_t pcm = (int16_t)rate.decode(code, AUDIO_ENCODING_LINEAR, &ref_dec);
+    code_errors += code != codes[i];
+    pcm_errors += pcm != out[i];
+  }
+  if (code_errors || pcm_errors)
+    printf("%s %s: %d code and %d sample mismatches\n", rate.name, sig.name, code_errors, pcm_errors);
+  CHECK(code_errors == 0);
+  CHECK(pcm_errors == 0);
+}
+
+// Random code streams reach decoder states the encoder never produces; also covers the tandem
+// adjustment of the A-law and u-law decoders and the encoder fed with G.711 input
+static void test_random_codes(const Rate &rate) {
+  const size_t n = 50000;
+  std::vector<uint8_t> codes(n);
+  for (auto &c : codes)
+    c = (uint8_t)(lcg() & 0xFF);  // upper bits must be ignored
+  struct g72x_state ref_lin, ref_a, ref_u;
+  g72x_init_state(&ref_lin);
+  g72x_init_state(&ref_a);
+  g72x_init_state(&ref_u);
+  g726::State lin, a, u;
+  g726::init_state(&lin);
+  g726::init_state(&a);
+  g726::init_state(&u);
+  std::vector<int16_t> out(n);
+  std::vector<uint8_t> out_a(n), out_u(n);
+  g726::decode_block(&lin, rate.bits, codes.data(), out.data(), n);
+  g726::decode_block_alaw(&a, rate.bits, codes.data(), out_a.data(), n);
+  g726::decode_block_ulaw(&u, rate.bits, codes.data(), out_u.data(), n);
+  int errors = 0;
+  for (size_t i = 0; i < n; i++) {
+    errors += out[i] != (int16_t)rate.decode(codes[i], AUDIO_ENCODING_LINEAR, &ref_lin);
+    errors += out_a[i] != rate.decode(codes[i], AUDIO_ENCODING_ALAW, &ref_a);
+    errors += out_u[i] != rate.decode(codes[i], AUDIO_ENCODING_ULAW, &ref_u);
+  }
+  CHECK(errors == 0);
+
+  // every G.711 code as encoder input, the way the conformance vectors drive it
+  struct g72x_state ref_enc;
+  g72x_init_state(&ref_enc);
+  g726::State enc;
+  g726::init_state(&enc);
+  std::vector<uint8_t> law(n);
+  std::vector<int16_t> pcm(n);
+  for (size_t i = 0; i < n; i++) {
+    law[i] = (uint8_t)(lcg() & 0xFF);
+    pcm[i] = g711::ulaw2linear(law[i]);
+  }
+  g726::encode_block(&enc, rate.bits, pcm.data(), codes.data(), n);
+  errors = 0;
+  for (size_t i = 0; i < n; i++)
+    errors += codes[i] != rate.encode(law[i], AUDIO_ENCODING_ULAW, &ref_enc);
+  CHECK(errors == 0);
+}
+
+// Conformance vectors. They are not redistributable and not shipped; point G726_VECTORS at a directory
+// with the ITU-T test sequences and a vectors.txt describing them, one run per line:
+//   <enc|dec> <bits> <a|u> <input file> <expected output file>
+// Files hold one sample or code per 16-bit little-endian word, as in the G.191 distribution. Encoder
+// runs take G.711 input of the given law, decoder runs produce it. Every run starts from reset.
+static std::vector<int> read_words(const std::string &path) {
+  std::ifstream f(path, std::ios::binary);
+  std::vector<int> words;
+  int lo, hi;
+  while ((lo = f.get()) != EOF && (hi = f.get()) != EOF)
+    words.push_back(lo | (hi << 8));
+  return words;
+}
+
+static void test_vectors(const char *dir) {
+  std::ifstream list(std::string(dir) + "/vectors.txt");
+  if (!list) {
+    std::cerr << "FAILED: no vectors.txt in " << dir << std::endl;
+    ++failures;
+    return;
+  }
+  std::string line;
+  int runs = 0;
+  while (std::getline(list, line)) {
+    if (line.empty() || line[0] == '#')
+      continue;
+    std::istringstream fields(line);
+    std::string mode, law, input, expected;
+    int bits;
+    fields >> mode >> bits >> law >> input >> expected;
+    std::vector<int> in = read_words(std::string(dir) + "/" + input);
+    std::vector<int> ref = read_words(std::string(dir) + "/" + expected);
+    CHECK(!in.empty() && in.size() == ref.size());
+    size_t n = std::min(in.size(), ref.size());
+
+    g726::State state;
+    g726::init_state(&state);
+    std::vector<uint8_t> bytes(n), out(n);
+    for (size_t i = 0; i < n; i++)
+      bytes[i] = (uint8_t)in[i];
+    if (mode == "enc") {
+      std::vector<int16_t> pcm(n);
+      for (size_t i = 0; i < n; i++)
+        pcm[i] = law == "a" ? g711::alaw2linear(bytes[i]) : g711::ulaw2linear(bytes[i]);
+      g726::encode_block(&state, (uint8_t)bits, pcm.data(), out.data(), n);
+    } else if (law == "a") {
+      g726::decode_block_alaw(&state, (uint8_t)bits, bytes.data(), out.data(), n);
+    } else {
+      g726::decode_block_ulaw(&state, (uint8_t)bits, bytes.data(), out.data(), n);
+    }
+    int errors = 0;
+    for (size_t i = 0; i < n; i++)
+      errors += out[i] != (ref[i] & 0xFF);
+    printf("vector %s: %zu samples, %d mismatches\n", input.c_str(), n, errors);
+    CHECK(errors == 0);
+    runs++;
+  }
+  CHECK(runs > 0);
+}
+
+static uint64_t ticks() {
+#ifdef HAVE_RDTSC
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+template<typename F> static void measure(const char *label, size_t samples, F &&f) {
+  auto start = std::chrono::steady_clock::now();
+  uint64_t t0 = ticks();
+  f();
+  uint64_t cycles = ticks() - t0;
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  printf("  %-22s %6.1f ns/sample", label, secs * 1e9 / samples);
+#ifdef HAVE_RDTSC
+  printf("  %6.1f cycles/sample (TSC)", (double)cycles / samples);
+#endif
+  printf("\n");
+}
+
+static void benchmark(int rounds) {
+  std::vector<int16_t> pcm = signals()[0].pcm;
+  const size_t n = pcm.size();
+  std::vector<uint8_t> codes(n);
+  std::vector<int16_t> out(n);
+  volatile int sink = 0;
+  for (const Rate &rate : RATES) {
+    printf("%s, %d x %zu samples:\n", rate.name, rounds, n);
+    measure("reference encode", n * rounds, [&] {
+      struct g72x_state s;
+      g72x_init_state(&s);
+      for (int r = 0; r < rounds; r++)
+        for (size_t i = 0; i < n; i++)
+          sink += rate.encode(pcm[i], AUDIO_ENCODING_LINEAR, &s);
+    });
+    measure("block encode", n * rounds, [&] {
+      g726::State s;
+      g726::init_state(&s);
+      for (int r = 0; r < rounds; r++)
+        for (size_t pos = 0; pos < n; pos += 160)
+          g726::encode_block(&s, rate.bits, &pcm[pos], &codes[pos], 160);
+      sink += codes[n - 1];
+    });
+    measure("reference decode", n * rounds, [&] {
+      struct g72x_state s;
+      g72x_init_state(&s);
+      for (int r = 0; r < rounds; r++)
+        for (size_t i = 0; i < n; i++)
+          sink += rate.decode(codes[i], AUDIO_ENCODING_LINEAR, &s);
+    });
+    measure("block decode", n * rounds, [&] {
+      g726::State s;
+      g726::init_state(&s);
+      for (int r = 0; r < rounds; r++)
+        for (size_t pos = 0; pos < n; pos += 160)
+          g726::decode_block(&s, rate.bits, &codes[pos], &out[pos], 160);
+      sink += out[n - 1];
+    });
+  }
+}
+
+int main(int argc, char **argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 5;
+  for (const Rate &rate : RATES) {
+    for (const Signal &sig : signals())
+      test_linear(rate, sig);
+    test_random_codes(rate);
+  }
+  const char *dir = getenv("G726_VECTORS");
+  if (dir != nullptr)
+    test_vectors(dir);
+  else
+    printf("G726_VECTORS not set, skipping the conformance vectors\n");
+  benchmark(rounds);
+
+  if (failures) {
+    std::cerr << failures << " tests failed" << std::endl;
+    return 1;
+  }
+  std::cout << "All tests passed." << std::endl;
+  return 0;
+}
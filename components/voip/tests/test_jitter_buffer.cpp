@@ -0,0 +1,199 @@
+#include "../jitter_buffer.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using esphome::voip::JitterBuffer;
+using esphome::voip::JitterBufferStats;
+
+#ifndef TRACE_DIR
+#define TRACE_DIR "traces"
+#endif
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+  do {                                                                      \
+    if (!(cond)) {                                                          \
+      std::cerr << "FAILED " << __LINE__ << ": " << #cond << std::endl;     \
+      ++failures;                                                           \
+    }                                                                       \
+  } while (0)
+
+struct TracePacket {
+  uint16_t seq;
+  uint32_t ts;
+  uint32_t arrival_ms;
+};
+
+struct PlayoutResult {
+  JitterBufferStats stats;
+  std::vector<uint16_t> played;  // sequence numbers in playout order (payload carries the seq)
+  uint32_t max_target_ms = 0;
+  uint32_t final_target_ms = 0;
+};
+
+// Replay packets at their arrival times and pop the buffer every millisecond, the same way
+// Voip::loop() drives it on the device.
+static PlayoutResult replay(JitterBuffer &jb, const std::vector<TracePacket> &trace) {
+  PlayoutResult res;
+  if (trace.empty())
+    return res;
+  size_t next = 0;
+  uint32_t end = trace.back().arrival_ms + 1000;
+  for (uint32_t now = trace.front().arrival_ms; now <= end; now++) {
+    while (next < trace.size() && trace[next].arrival_ms <= now) {
+      uint8_t payload[160];
+      memset(payload, 0, sizeof(payload));
+      payload[0] = trace[next].seq >> 8;
+      payload[1] = trace[next].seq & 0xFF;
+      jb.push(trace[next].seq, trace[next].ts, payload, sizeof(payload), now);
+      next++;
+    }
+    uint8_t out[JitterBuffer::MAX_PAYLOAD];
+    size_t len = 0;
+    JitterBuffer::PopResult r;
+    while ((r = jb.pop(now, out, sizeof(out), &len)) != JitterBuffer::POP_NONE) {
+      if (r == JitterBuffer::POP_FRAME)
+        res.played.push_back((uint16_t)((out[0] << 8) | out[1]));
+    }
+    if (jb.get_target_delay_ms() > res.max_target_ms)
+      res.max_target_ms = jb.get_target_delay_ms();
+  }
+  res.stats = jb.get_stats();
+  res.final_target_ms = jb.get_target_delay_ms();
+  return res;
+}
+
+static bool load_trace(const std::string &path, std::vector<TracePacket> &out) {
+  std::ifstream in(path);
+  if (!in)
+    return false;
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.empty() || line[0] == '#')
+      continue;
+    std::istringstream ls(line);
+    unsigned long seq, ts, arrival;
+    if (ls >> seq >> ts >> arrival)
+      out.push_back({(uint16_t)seq, (uint32_t)ts, (uint32_t)arrival});
+  }
+  return true;
+}
+
+static std::vector<TracePacket> make_stream(uint16_t seq0, uint32_t ts0, size_t n) {
+  std::vector<TracePacket> v;
+  for (size_t i = 0; i < n; i++)
+    v.push_back({(uint16_t)(seq0 + i), (uint32_t)(ts0 + 160 * i), (uint32_t)(100 + 20 * i)});
+  return v;
+}
+
+static bool in_order(const std::vector<uint16_t> &played) {
+  for (size_t i = 1; i < played.size(); i++)
+    if ((int16_t)(uint16_t)(played[i] - played[i - 1]) <= 0)
+      return false;
+  return true;
+}
+
+static void print_stats(const char *name, const PlayoutResult &r) {
+  const JitterBufferStats &s = r.stats;
+  printf("%-16s recv=%u played=%u late=%u dup=%u lost=%u underrun=%u overflow=%u shrink=%u grow=%u "
+         "target=%ums max_target=%ums\n",
+         name, s.received, s.played, s.late, s.duplicate, s.lost, s.underrun, s.overflow, s.shrink, s.grow,
+         r.final_target_ms, r.max_target_ms);
+}
+
+int main() {
+  // in order: everything is played, nothing concealed
+  {
+    JitterBuffer jb;
+    jb.configure(40, 200);
+    auto r = replay(jb, make_stream(100, 0, 100));
+    print_stats("in_order", r);
+    CHECK(r.stats.played == 100);
+    CHECK(r.stats.lost == 0);
+    CHECK(in_order(r.played));
+  }
+
+  // reordered pair and a duplicate: played once, in sequence order
+  {
+    auto t = make_stream(500, 1000, 50);
+    std::swap(t[10].arrival_ms, t[11].arrival_ms);
+    std::swap(t[10], t[11]);
+    t.insert(t.begin() + 21, TracePacket{t[20].seq, t[20].ts, t[20].arrival_ms + 1});
+    JitterBuffer jb;
+    jb.configure(40, 200);
+    auto r = replay(jb, t);
+    print_stats("reorder_dup", r);
+    CHECK(r.stats.duplicate == 1);
+    CHECK(r.stats.played == 50);
+    CHECK(in_order(r.played));
+  }
+
+  // a packet arriving after its slot was played is dropped as late and never played
+  {
+    auto t = make_stream(7, 0, 40);
+    t[15].arrival_ms += 400;
+    std::sort(t.begin(), t.end(), [](const TracePacket &a, const TracePacket &b) { return a.arrival_ms < b.arrival_ms; });
+    JitterBuffer jb;
+    jb.configure(40, 80);
+    auto r = replay(jb, t);
+    print_stats("late", r);
+    CHECK(r.stats.late == 1);
+    CHECK(r.stats.lost == 1);
+    CHECK(in_order(r.played));
+  }
+
+  // sequence wrap around 65535 is continuous
+  {
+    JitterBuffer jb;
+    jb.configure(40, 200);
+    auto r = replay(jb, make_stream(65500, 4294967000u, 100));
+    print_stats("seq_wrap", r);
+    CHECK(r.stats.played == 100);
+    CHECK(r.stats.resync == 0);
+    CHECK(in_order(r.played));
+  }
+
+  // packet traces
+  {
+    std::vector<TracePacket> t;
+    CHECK(load_trace(TRACE_DIR "/lan_clean.trace", t));
+    JitterBuffer jb;
+    jb.configure(40, 200);
+    auto r = replay(jb, t);
+    print_stats("lan_clean", r);
+    // a clean LAN must stay at the minimum delay and play everything
+    CHECK(r.max_target_ms == 40);
+    CHECK(r.stats.lost == 0);
+    CHECK(r.stats.played == t.size());
+    CHECK(in_order(r.played));
+  }
+  {
+    std::vector<TracePacket> t;
+    CHECK(load_trace(TRACE_DIR "/wifi_burst.trace", t));
+    JitterBuffer jb;
+    jb.configure(40, 200);
+    auto r = replay(jb, t);
+    print_stats("wifi_burst", r);
+    // the buffer must grow to absorb the bursts, only the 3 truly lost packets are concealed
+    // (plus whatever the first burst costs before the delay has adapted)
+    CHECK(r.max_target_ms > 150);
+    CHECK(r.stats.duplicate == 3);
+    CHECK(r.stats.played + r.stats.lost + r.stats.late + r.stats.shrink + r.stats.overflow >= 747);
+    CHECK(r.stats.lost + r.stats.late <= 3 + 8);
+    CHECK(in_order(r.played));
+  }
+
+  if (failures) {
+    std::cerr << failures << " tests failed" << std::endl;
+    return 1;
+  }
+  std::cout << "All tests passed." << std::endl;
+  return 0;
+}
@@ -10,7 +10,12 @@ int main() {
     {"abc", "900150983cd24fb0d6963f7d28e17f72"},
     // RFC2617 example (HA1 and HA2 check); check HA1 example
     {"Mufasa:testrealm@host.com:Circle Of Life", "939e7578ed9e3c518a452acee763bce9"},
-    {"GET:/dir/index.html", "39aff3a2bab6126f332b942af96d3366"}
+    {"GET:/dir/index.html", "39aff3a2bab6126f332b942af96d3366"},
+    // RFC 1321 test suite: padding into a second block and multi-block input
+    {"message digest", "f96b697d7cb7938d525a2f31aaf161d0"},
+    {"abcdefghijklmnopqrstuvwxyz", "c3fcd3d76192e4007dfb496cca67e13b"},
+    {"12345678901234567890123456789012345678901234567890123456789012345678901234567890",
+     "57edf4a22be3c955ac49da2e2107b67a"}
   };
 
   int failures = 0;
@@ -23,13 +28,13 @@ int main() {
     }
   }
 
-  // RFC2617 response test (full response) using known values
+  // RFC2617 values without qop (RFC 2069 style response)
   std::string ha1 = md5_hex("Mufasa:testrealm@host.com:Circle Of Life");
   std::string ha2 = md5_hex("GET:/dir/index.html");
   std::string response = md5_hex(ha1 + ":dcd98b7102dd2f0e8b11d0f600bfb0c093:" + ha2);
   std::cout << "Digest response test: " << response << std::endl;
-  if (response != "6629fae49393a05397450978507c4ef1") {
-    std::cerr << "FAILED RFC2617 response expected 6629fae49393a05397450978507c4ef1" << std::endl;
+  if (response != "670fd8c2df070c60b045671b8b24ff02") {
+    std::cerr << "FAILED RFC2617 response without qop expected 670fd8c2df070c60b045671b8b24ff02" << std::endl;
     ++failures;
   }
 
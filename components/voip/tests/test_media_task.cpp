@@ -0,0 +1,111 @@
+#include "../media_task.h"
+#include "../ring_buffer.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using esphome::voip::MediaTask;
+using esphome::voip::SpscRingBuffer;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+  do {                                                                      \
+    if (!(cond)) {                                                          \
+      std::cerr << "FAILED " << __LINE__ << ": " << #cond << std::endl;     \
+      ++failures;                                                           \
+    }                                                                       \
+  } while (0)
+
+// Same shape as the queues between Voip::loop() and Voip::media_tick()
+struct Command {
+  enum Type : uint8_t { START, STOP } type;
+  uint32_t value;
+};
+struct Event {
+  enum Type : uint8_t { STARTED, STOPPED } type;
+  uint32_t value;
+};
+
+int main(int argc, char **argv) {
+  int seconds = argc > 1 ? atoi(argv[1]) : 1;
+
+  SpscRingBuffer<Command, 8> commands;
+  SpscRingBuffer<Event, 16> events;
+  std::vector<uint64_t> stamps;
+  stamps.reserve(seconds * 100 + 16);
+  bool active = false;
+
+  MediaTask task;
+  MediaTask::Config config;
+  config.period_us = 10000;
+  config.core = -1;
+  config.priority = 0;
+  bool ok = task.start(config, [&]() {
+    stamps.push_back(MediaTask::now_us());
+    Command cmd;
+    while (commands.pop(cmd)) {
+      active = cmd.type == Command::START;
+      events.push(Event{active ? Event::STARTED : Event::STOPPED, cmd.value});
+    }
+  });
+  CHECK(ok);
+  CHECK(!task.start(config, []() {}));
+
+  // the "main loop": post call-state changes and collect the engine's answers
+  commands.push(Command{Command::START, 1});
+  std::this_thread::sleep_for(std::chrono::milliseconds(500 * seconds));
+  commands.push(Command{Command::STOP, 2});
+  std::this_thread::sleep_for(std::chrono::milliseconds(500 * seconds));
+  task.stop();
+  CHECK(!task.is_running());
+
+  Event ev;
+  std::vector<Event> got;
+  while (events.pop(ev))
+    got.push_back(ev);
+  CHECK(got.size() == 2);
+  if (got.size() == 2) {
+    CHECK(got[0].type == Event::STARTED && got[0].value == 1);
+    CHECK(got[1].type == Event::STOPPED && got[1].value == 2);
+  }
+  CHECK(!active);
+
+  // period statistics: the schedule is absolute, so the mean period must be exact even if single
+  // ticks are late
+  uint32_t ticks = task.get_ticks();
+  CHECK(ticks >= (uint32_t)(80 * seconds) && ticks <= (uint32_t)(101 * seconds));
+  uint64_t max_dev = 0;
+  const uint64_t buckets_us[] = {100, 500, 1000, 5000};
+  uint32_t hist[5] = {0, 0, 0, 0, 0};
+  for (size_t i = 1; i < stamps.size(); i++) {
+    int64_t d = (int64_t)(stamps[i] - stamps[i - 1]) - (int64_t)config.period_us;
+    uint64_t dev = (uint64_t)(d < 0 ? -d : d);
+    if (dev > max_dev)
+      max_dev = dev;
+    size_t b = 0;
+    while (b < 4 && dev > buckets_us[b])
+      b++;
+    hist[b]++;
+  }
+  double mean = stamps.size() > 1 ? (double)(stamps.back() - stamps.front()) / (stamps.size() - 1) : 0;
+  printf("media task: %u ticks, mean period %.1f us, max deviation %llu us, max lateness %u us\n", ticks, mean,
+         (unsigned long long)max_dev, task.get_max_lateness_us());
+  printf("period deviation histogram: <=100us %u, <=500us %u, <=1ms %u, <=5ms %u, >5ms %u\n", hist[0], hist[1],
+         hist[2], hist[3], hist[4]);
+  CHECK(mean > 9000 && mean < 11000);
+
+  // restart after stop
+  CHECK(task.start(config, []() {}));
+  task.stop();
+
+  if (failures) {
+    std::cerr << failures << " tests failed" << std::endl;
+    return 1;
+  }
+  std::cout << "All tests passed." << std::endl;
+  return 0;
+}
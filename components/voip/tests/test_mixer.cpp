@@ -0,0 +1,267 @@
+#include "../mixer.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+using esphome::voip::ConferenceMixer;
+namespace g711 = esphome::voip::g711;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+  do {                                                                      \
+    if (!(cond)) {                                                          \
+      std::cerr << "FAILED " << __LINE__ << ": " << #cond << std::endl;     \
+      ++failures;                                                           \
+    }                                                                       \
+  } while (0)
+
+// Deterministic pseudo random generator so failures are reproducible
+static uint32_t lcg_state = 12345;
+static uint32_t lcg() { return lcg_state = lcg_state * 1103515245u + 12345u; }
+
+static void fill(ConferenceMixer &mixer, size_t p, int16_t value) {
+  int16_t *in = mixer.input(p);
+  for (size_t i = 0; i < mixer.get_block_samples(); i++)
+    in[i] = value;
+  mixer.set_active(p, true);
+}
+
+static void fill_noise(ConferenceMixer &mixer, size_t p, int amplitude) {
+  int16_t *in = mixer.input(p);
+  for (size_t i = 0; i < mixer.get_block_samples(); i++)
+    in[i] = (int16_t)((int)(lcg() >> 16) % (2 * amplitude + 1) - amplitude);
+  mixer.set_active(p, true);
+}
+
+static bool all_equal(const int16_t *out, size_t n, int16_t value) {
+  for (size_t i = 0; i < n; i++)
+    if (out[i] != value)
+      return false;
+  return true;
+}
+
+static int16_t sat16(int64_t v) { return (int16_t)(v < -32768 ? -32768 : v > 32767 ? 32767 : v); }
+
+static void test_minus_one() {
+  ConferenceMixer mixer;
+  CHECK(!mixer.configure(0, 80));
+  CHECK(!mixer.configure(ConferenceMixer::MAX_PARTICIPANTS + 1, 80));
+  CHECK(mixer.configure(3, 80, 3));
+  fill(mixer, 0, 1000);
+  fill(mixer, 1, 200);
+  fill(mixer, 2, -30);
+  mixer.mix();
+  CHECK(mixer.get_speaker_count() == 3);
+  CHECK(all_equal(mixer.output(0), 80, 170));
+  CHECK(all_equal(mixer.output(1), 80, 970));
+  CHECK(all_equal(mixer.output(2), 80, 1200));
+
+  // a lone speaker hears silence, the others hear it
+  mixer.reset();
+  fill(mixer, 1, 5000);
+  mixer.mix();
+  CHECK(mixer.get_speaker_count() == 1 && mixer.is_speaker(1));
+  CHECK(all_equal(mixer.output(1), 80, 0));
+  CHECK(all_equal(mixer.output(0), 80, 5000));
+  CHECK(all_equal(mixer.output(2), 80, 5000));
+
+  // inputs without audio this block drop out of the sum at once
+  mixer.mix();
+  CHECK(all_equal(mixer.output(0), 80, 0));
+}
+
+static void test_saturation_and_gain() {
+  ConferenceMixer mixer;
+  mixer.configure(3, 160, 3);
+  fill(mixer, 0, 30000);
+  fill(mixer, 1, 30000);
+  fill(mixer, 2, -1000);
+  mixer.mix();
+  // the 32-bit sum only saturates on the way out: each talker hears the other at full value
+  CHECK(all_equal(mixer.output(0), 160, 29000));
+  CHECK(all_equal(mixer.output(1), 160, 29000));
+  CHECK(all_equal(mixer.output(2), 160, 32767));
+  fill(mixer, 0, -30000);
+  fill(mixer, 1, -30000);
+  fill(mixer, 2, 1000);
+  mixer.mix();
+  CHECK(all_equal(mixer.output(2), 160, -32768));
+
+  mixer.set_gain(0, g711::q15_gain(1, 2));
+  mixer.set_gain(1, g711::q15_gain(4, 1));
+  fill(mixer, 0, 10000);
+  fill(mixer, 1, 10000);
+  fill(mixer, 2, 100);
+  mixer.mix();
+  CHECK(all_equal(mixer.output(2), 160, 32767));  // 5000 + 40000 clipped
+  CHECK(all_equal(mixer.output(1), 160, 5100));
+  CHECK(all_equal(mixer.output(0), 160, 32767));  // the boosted input is clipped to full scale first
+}
+
+// With every input picked, the mixer must match a per-output 64-bit sum of all the others
+static void test_against_reference() {
+  for (size_t n = 2; n <= ConferenceMixer::MAX_PARTICIPANTS; n++) {
+    ConferenceMixer mixer;
+    size_t speakers = n < ConferenceMixer::MAX_SPEAKERS ? n : ConferenceMixer::MAX_SPEAKERS;
+    CHECK(mixer.configure(n, 160, speakers));
+    for (size_t p = 0; p < n; p++)
+      mixer.set_gain(p, g711::q15_gain(1 + p % 3, 2));
+    int mismatches = 0;
+    for (int block = 0; block < 50; block++) {
+      // only the first `speakers` inputs talk, the others stay below the silence floor
+      std::vector<std::vector<int16_t>> in(n);
+      for (size_t p = 0; p < n; p++) {
+        fill_noise(mixer, p, p < speakers ? 20000 : 4);
+        in[p].assign(mixer.input(p), mixer.input(p) + 160);
+      }
+      mixer.mix();
+      for (size_t p = 0; p < n; p++) {
+        const int16_t *out = mixer.output(p);
+        for (size_t i = 0; i < 160; i++) {
+          int64_t sum = 0;
+          for (size_t q = 0; q < speakers; q++) {
+            if (q == p)
+              continue;
+            g711::Q15Gain g = g711::q15_gain(1 + q % 3, 2);
+            sum += sat16(((int64_t)in[q][i] * g.mantissa) >> g.shift);
+          }
+          mismatches += out[i] != sat16(sum);
+        }
+      }
+    }
+    CHECK(mismatches == 0);
+  }
+}
+
+static void test_speaker_selection() {
+  ConferenceMixer mixer;
+  mixer.configure(6, 80, 3);
+  // three talkers, two quieter ones and a silent line
+  const int amplitude[6] = {8000, 6000, 5000, 3000, 2000, 3};
+  for (int block = 0; block < 20; block++) {
+    for (size_t p = 0; p < 6; p++)
+      fill_noise(mixer, p, amplitude[p]);
+    mixer.mix();
+  }
+  CHECK(mixer.get_speaker_count() == 3);
+  CHECK(mixer.is_speaker(0) && mixer.is_speaker(1) && mixer.is_speaker(2));
+  CHECK(!mixer.is_speaker(3) && !mixer.is_speaker(4) && !mixer.is_speaker(5));
+  // everyone not picked gets the same mix
+  CHECK(mixer.output(3) == mixer.output(4) && mixer.output(4) == mixer.output(5));
+  CHECK(mixer.output(0) != mixer.output(1));
+
+  // a newcomer slightly louder than the quietest speaker does not take its place...
+  for (int block = 0; block < 50; block++) {
+    for (size_t p = 0; p < 6; p++)
+      fill_noise(mixer, p, p == 3 ? 6000 : amplitude[p]);
+    mixer.mix();
+  }
+  CHECK(mixer.is_speaker(2) && !mixer.is_speaker(3));
+  // ...one twice as loud does, within a few blocks
+  int switched_after = -1;
+  for (int block = 0; block < 50 && switched_after < 0; block++) {
+    for (size_t p = 0; p < 6; p++)
+      fill_noise(mixer, p, p == 3 ? 12000 : amplitude[p]);
+    mixer.mix();
+    if (mixer.is_speaker(3))
+      switched_after = block;
+  }
+  CHECK(switched_after >= 0 && switched_after < 10);
+  CHECK(!mixer.is_speaker(2));
+
+  // a speaker who stops talking is dropped after a short hangover, not on the first quiet block
+  int dropped_after = -1;
+  for (int block = 0; block < 100 && dropped_after < 0; block++) {
+    for (size_t p = 0; p < 6; p++)
+      fill_noise(mixer, p, p == 0 ? 0 : p == 3 ? 12000 : amplitude[p]);
+    mixer.mix();
+    if (!mixer.is_speaker(0))
+      dropped_after = block;
+  }
+  CHECK(dropped_after > 3);
+  CHECK(mixer.is_speaker(2));  // the freed place goes to the next loudest
+
+  // below the silence floor nobody is mixed, and the hiss of idle lines stays out
+  mixer.reset();
+  for (int block = 0; block < 20; block++) {
+    for (size_t p = 0; p < 6; p++)
+      fill_noise(mixer, p, 3);
+    mixer.mix();
+  }
+  CHECK(mixer.get_speaker_count() == 0);
+  CHECK(all_equal(mixer.output(0), 80, 0));
+}
+
+// What every participant would cost without the shared sum: N-1 saturating adds per output
+static void reference_mix(const std::vector<std::vector<int16_t>> &in, std::vector<std::vector<int16_t>> &out) {
+  size_t n = in.size(), samples = in[0].size();
+  for (size_t p = 0; p < n; p++) {
+    for (size_t i = 0; i < samples; i++) {
+      int32_t sum = 0;
+      for (size_t q = 0; q < n; q++)
+        sum += q == p ? 0 : in[q][i];
+      out[p][i] = sat16(sum);
+    }
+  }
+}
+
+// 20 ms blocks for 2 to 8 participants at 8 and 16 kHz, everybody talking
+static void benchmark(int rounds) {
+  for (size_t rate : {8000, 16000}) {
+    const size_t samples = rate / 50;
+    for (size_t n = 2; n <= 8; n++) {
+      double per_block[2];
+      for (int all = 0; all < 2; all++) {
+        ConferenceMixer mixer;
+        mixer.configure(n, samples, all ? ConferenceMixer::MAX_SPEAKERS : 3);
+        for (size_t p = 0; p < n; p++)
+          fill_noise(mixer, p, 10000);
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < rounds; r++) {
+          for (size_t p = 0; p < n; p++)
+            mixer.set_active(p, true);
+          mixer.mix();
+          __asm__ __volatile__("" : : "r"(mixer.output(0)) : "memory");
+        }
+        per_block[all] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1e9 / rounds;
+      }
+      std::vector<std::vector<int16_t>> in(n, std::vector<int16_t>(samples)), out = in;
+      for (auto &v : in)
+        for (auto &s : v)
+          s = (int16_t)(lcg() >> 16);
+      auto start = std::chrono::steady_clock::now();
+      for (int r = 0; r < rounds; r++) {
+        reference_mix(in, out);
+        __asm__ __volatile__("" : : "r"(out[0].data()) : "memory");
+      }
+      double naive = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1e9 / rounds;
+      printf("%5u Hz, %u participants: %7.0f ns per 20 ms block with 3 speakers, %7.0f ns with %u, %7.0f ns all "
+             "pairs\n",
+             (unsigned)rate, (unsigned)n, per_block[0], per_block[1],
+             (unsigned)(n < ConferenceMixer::MAX_SPEAKERS ? n : ConferenceMixer::MAX_SPEAKERS), naive);
+    }
+  }
+  ConferenceMixer mixer;
+  mixer.configure(ConferenceMixer::MAX_PARTICIPANTS, 80);
+  printf("memory for %u participants, 10 ms blocks at 8 kHz: %u bytes\n", (unsigned)ConferenceMixer::MAX_PARTICIPANTS,
+         (unsigned)mixer.get_memory_size());
+}
+
+int main(int argc, char **argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 100000;
+  test_minus_one();
+  test_saturation_and_gain();
+  test_against_reference();
+  test_speaker_selection();
+  benchmark(rounds);
+
+  if (failures) {
+    std::cerr << failures << " tests failed" << std::endl;
+    return 1;
+  }
+  std::cout << "All tests passed." << std::endl;
+  return 0;
+}
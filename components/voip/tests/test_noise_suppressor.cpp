@@ -0,0 +1,329 @@
+#include "../noise_suppressor.h"
+#include "audio_fixtures.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC 1
+#endif
+
+using esphome::voip::NoiseSuppressor;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+  do {                                                                      \
+    if (!(cond)) {                                                          \
+      std::cerr << "FAILED " << __LINE__ << ": " << #cond << std::endl;     \
+      ++failures;                                                           \
+    }                                                                       \
+  } while (0)
+
+static const size_t FRAME = 160;
+static const size_t DELAY = NoiseSuppressor::DELAY;
+
+static double dbov(double mean_square) { return 10 * std::log10(mean_square > 1e-9 ? mean_square / (32768.0 * 32768.0) : 1e-9 / (32768.0 * 32768.0)); }
+
+static double mean_square(const std::vector<int16_t> &x, size_t from, size_t to) {
+  double e = 0;
+  for (size_t k = from; k < to; k++)
+    e += (double)x[k] * x[k];
+  return to > from ? e / (to - from) : 0;
+}
+
+// Background noises at rms: white (fans, hiss), HVAC (rumble below 300 Hz with a 100 Hz hum) and
+// road (brownish noise swelling and fading as cars pass)
+enum Noise { WHITE, HVAC, ROAD };
+static const char *NOISE_NAMES[] = {"white", "HVAC", "road"};
+
+static std::vector<double> noise(Noise kind, size_t n, uint32_t seed) {
+  lcg_state = seed;
+  std::vector<double> x(n);
+  double lp = 0, lp2 = 0;
+  for (size_t k = 0; k < n; k++) {
+    double g = gaussian();
+    if (kind == WHITE) {
+      x[k] = g;
+    } else if (kind == HVAC) {
+      lp += 0.2 * (g - lp);
+      lp2 += 0.2 * (lp - lp2);
+      x[k] = lp2 + 0.1 * std::sin(2 * M_PI * 100 * k / 8000) + 0.3 * g * 0.1;
+    } else {
+      lp += 0.05 * (g - lp);
+      x[k] = lp * (1.0 + 0.6 * std::sin(2 * M_PI * 0.2 * k / 8000)) + 0.05 * g;
+    }
+  }
+  double ms = 0;
+  for (double v : x)
+    ms += v * v / n;
+  for (double &v : x)
+    v /= std::sqrt(ms);
+  return x;
+}
+
+static std::vector<int16_t> to_pcm(const std::vector<double> &x) {
+  std::vector<int16_t> out(x.size());
+  for (size_t k = 0; k < x.size(); k++)
+    out[k] = (int16_t)std::max(-32768.0, std::min(32767.0, std::round(x[k])));
+  return out;
+}
+
+// Active speech level, roughly after ITU-T P.56: the power of the 20 ms frames above -50 dBov
+static double speech_power(const std::vector<int16_t> &x) {
+  double sum = 0;
+  size_t frames = 0;
+  for (size_t at = 0; at + FRAME <= x.size(); at += FRAME) {
+    double e = mean_square(x, at, at + FRAME);
+    if (dbov(e) > -50) {
+      sum += e;
+      frames++;
+    }
+  }
+  return frames ? sum / frames : 0;
+}
+
+// speech plus noise at snr_db below the speech's active level
+static std::vector<int16_t> noisy(const std::vector<int16_t> &speech, const std::vector<double> &n, double snr_db) {
+  double g = std::sqrt(speech_power(speech) * std::pow(10.0, -snr_db / 10));
+  std::vector<double> x(speech.size());
+  for (size_t k = 0; k < x.size(); k++)
+    x[k] = speech[k] + g * n[k];
+  return to_pcm(x);
+}
+
+static std::vector<int16_t> run(NoiseSuppressor &ns, std::vector<int16_t> x, size_t frame = FRAME) {
+  for (size_t at = 0; at + frame <= x.size(); at += frame)
+    ns.process(&x[at], frame);
+  return x;
+}
+
+// Segmental SNR of test against clean (test DELAY samples late), over 20 ms frames where the clean
+// signal is active, each clamped to -10..35 dB
+static double segmental_snr(const std::vector<int16_t> &clean, const std::vector<int16_t> &test, size_t delay,
+                            size_t from) {
+  double sum = 0;
+  size_t frames = 0;
+  for (size_t at = from; at + FRAME + delay <= test.size() && at + FRAME <= clean.size(); at += FRAME) {
+    double s = mean_square(clean, at, at + FRAME);
+    if (dbov(s) < -45)
+      continue;
+    double e = 0;
+    for (size_t k = at; k < at + FRAME; k++) {
+      double d = (double)test[k + delay] - clean[k];
+      e += d * d / FRAME;
+    }
+    double snr = 10 * std::log10(s / std::max(e, 1e-3));
+    sum += std::max(-10.0, std::min(35.0, snr));
+    frames++;
+  }
+  return frames ? sum / frames : 0;
+}
+
+static void test_configure() {
+  NoiseSuppressor ns;
+  CHECK(ns.get_memory_size() == 0);
+  std::vector<int16_t> x(800, 1234);
+  CHECK(run(ns, x) == x);
+  CHECK(ns.configure(15));
+  CHECK(ns.get_memory_size() > 0);
+  CHECK(ns.get_memory_size() < 8192);
+  // not a whole block: passes unchanged
+  std::vector<int16_t> odd(50, 77);
+  ns.process(odd.data(), odd.size());
+  CHECK(odd == std::vector<int16_t>(50, 77));
+}
+
+// No attenuation allowed: the window, FFT and overlap-add alone give the input back, DELAY late
+static void test_transparent() {
+  std::vector<int16_t> in = noisy(synthetic_speech(3, 1), noise(WHITE, 24000, 2), 10);
+  in[12345] = 32767;
+  in[12346] = -32768;
+  NoiseSuppressor ns;
+  ns.configure(0);
+  std::vector<int16_t> out = run(ns, in);
+  int worst = 0;
+  for (size_t k = 0; k + DELAY < in.size(); k++)
+    worst = std::max(worst, std::abs(out[k + DELAY] - in[k]));
+  printf("transparent: largest difference %d\n", worst);
+  CHECK(worst <= 4);
+  std::vector<int16_t> silence(8000, 0);
+  CHECK(run(ns, silence) == silence || ns.get_noise_dbov() < -90);
+}
+
+// The noise level is learned from noise alone, kept through speech, follows a louder noise within
+// a few seconds and a quieter one at once; the output's noise is max_attenuation below
+static void test_noise_estimate() {
+  NoiseSuppressor ns;
+  ns.configure(15);
+  double rms = 32768 * std::pow(10.0, -50 / 20.0);
+  std::vector<double> n = noise(WHITE, 3 * 8000, 3);
+  for (double &v : n)
+    v *= rms;
+  std::vector<int16_t> out = run(ns, to_pcm(n));
+  printf("white noise at -50 dBov: estimate %.1f dBov, output %.1f dBov (estimate %.1f)\n", ns.get_noise_dbov(),
+         dbov(mean_square(out, 8000, out.size())), ns.get_output_noise_dbov());
+  CHECK(std::fabs(ns.get_noise_dbov() + 50) < 1.5);
+  // what a detector after the suppressor sees in the pauses
+  CHECK(std::fabs(dbov(mean_square(out, 8000, out.size())) + 65) < 3);
+  CHECK(std::fabs(ns.get_output_noise_dbov() - dbov(mean_square(out, 8000, out.size()))) < 3);
+
+  // speech at 15 dB SNR over the same noise
+  std::vector<int16_t> speech = synthetic_speech(4, 4);
+  double g = std::sqrt(speech_power(speech) * std::pow(10.0, -15 / 10.0)) / rms;
+  std::vector<double> sn = noise(WHITE, speech.size(), 5);
+  std::vector<double> x(speech.size());
+  for (size_t k = 0; k < x.size(); k++)
+    x[k] = speech[k] / g + sn[k] * rms;
+  float highest = -96;
+  std::vector<int16_t> pcm = to_pcm(x);
+  for (size_t at = 0; at + FRAME <= pcm.size(); at += FRAME) {
+    ns.process(&pcm[at], FRAME);
+    highest = std::max(highest, ns.get_noise_dbov());
+  }
+  printf("through speech: highest estimate %.1f dBov\n", highest);
+  CHECK(highest < -45);
+
+  // 10 dB louder, then 20 dB quieter
+  std::vector<double> louder = noise(WHITE, 4 * 8000, 6);
+  for (double &v : louder)
+    v *= rms * std::pow(10.0, 0.5);
+  run(ns, to_pcm(louder));
+  printf("10 dB louder: estimate %.1f dBov after 4 s\n", ns.get_noise_dbov());
+  CHECK(std::fabs(ns.get_noise_dbov() + 40) < 2);
+  std::vector<double> quieter = noise(WHITE, 8000 / 2, 7);
+  for (double &v : quieter)
+    v *= rms * std::pow(10.0, 0.5) * 0.1;
+  run(ns, to_pcm(quieter));
+  printf("20 dB quieter: estimate %.1f dBov after 0.5 s\n", ns.get_noise_dbov());
+  CHECK(std::fabs(ns.get_noise_dbov() + 60) < 2);
+}
+
+// Segmental SNR before and after for three noises from 0 to 15 dB, and what clean speech loses
+static void test_snr() {
+  std::vector<int16_t> speech = synthetic_speech(12, 8);
+  printf("noise    SNR    segmental SNR in   out    gain\n");
+  for (Noise kind : {WHITE, HVAC, ROAD}) {
+    std::vector<double> n = noise(kind, speech.size(), 9 + kind);
+    for (double snr : {0.0, 5.0, 10.0, 15.0}) {
+      std::vector<int16_t> in = noisy(speech, n, snr);
+      NoiseSuppressor ns;
+      ns.configure(15);
+      std::vector<int16_t> out = run(ns, in);
+      double before = segmental_snr(speech, in, 0, 2 * 8000);
+      double after = segmental_snr(speech, out, DELAY, 2 * 8000);
+      printf("%-7s %3.0f dB    %5.1f dB    %5.1f dB  %+5.1f dB\n", NOISE_NAMES[kind], snr, before, after,
+             after - before);
+      if (snr <= 10)
+        CHECK(after - before > 2);
+      CHECK(after > before);
+    }
+  }
+  // clean speech over a faint hiss keeps its level
+  std::vector<int16_t> in = noisy(speech, noise(WHITE, speech.size(), 12), 40);
+  NoiseSuppressor ns;
+  ns.configure(15);
+  std::vector<int16_t> out = run(ns, in);
+  double loss = 10 * std::log10(speech_power(in) / speech_power(out));
+  printf("speech at 40 dB SNR: level %.2f dB lower\n", loss);
+  CHECK(loss < 1);
+}
+
+// Full-scale and clipped input does not overflow the fixed-point path
+static void test_overload() {
+  std::vector<int16_t> in(8000);
+  for (size_t k = 0; k < in.size(); k++)
+    in[k] = (k / 20) % 2 ? 32767 : -32768;
+  NoiseSuppressor ns;
+  ns.configure(0);
+  std::vector<int16_t> out = run(ns, in);
+  int worst = 0;
+  for (size_t k = 0; k + DELAY < in.size(); k++)
+    worst = std::max(worst, std::abs(out[k + DELAY] - in[k]));
+  printf("full scale: largest difference %d\n", worst);
+  CHECK(worst <= 6);
+  ns.configure(30);
+  run(ns, in);
+  run(ns, to_pcm(std::vector<double>(4000, 0.0)));
+}
+
+static uint64_t ticks() {
+#ifdef HAVE_RDTSC
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+// Host time per 20 ms frame
+static void benchmark(int rounds) {
+  std::vector<int16_t> in = noisy(synthetic_speech(10, 13), noise(ROAD, 80000, 14), 5);
+  NoiseSuppressor ns;
+  ns.configure(15);
+  int16_t buf[FRAME];
+  volatile int sink = 0;
+  auto t0 = std::chrono::steady_clock::now();
+  uint64_t c0 = ticks();
+  for (int r = 0; r < rounds; r++) {
+    memcpy(buf, &in[(r % 500) * FRAME], sizeof(buf));
+    ns.process(buf, FRAME);
+    sink += buf[0];
+  }
+  uint64_t cycles = ticks() - c0;
+  double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count() / rounds;
+  printf("%.1f us per 20 ms frame", us);
+#ifdef HAVE_RDTSC
+  printf(", %.0f cycles (TSC)", (double)cycles / rounds);
+#endif
+  printf(", %u bytes of state\n", (unsigned)ns.get_memory_size());
+}
+
+// A recording, and if given the same speech without the noise: noise level and segmental SNR
+static void report(const char *path, const char *clean_path) {
+  std::vector<int16_t> in = read_wav(path);
+  if (in.empty()) {
+    std::cerr << "NS_WAV: not a 16-bit mono 8 kHz WAV file" << std::endl;
+    ++failures;
+    return;
+  }
+  NoiseSuppressor ns;
+  ns.configure(15);
+  std::vector<int16_t> out = run(ns, in);
+  printf("%s: noise %.1f dBov, left %.1f dBov, speech level %.1f -> %.1f dBov\n", path, ns.get_noise_dbov(),
+         ns.get_output_noise_dbov(), dbov(speech_power(in)), dbov(speech_power(out)));
+  if (!clean_path)
+    return;
+  std::vector<int16_t> clean = read_wav(clean_path);
+  if (clean.empty()) {
+    std::cerr << "NS_CLEAN_WAV: not a 16-bit mono 8 kHz WAV file" << std::endl;
+    ++failures;
+    return;
+  }
+  printf("%s: segmental SNR %.1f -> %.1f dB\n", path, segmental_snr(clean, in, 0, 0),
+         segmental_snr(clean, out, DELAY, 0));
+}
+
+int main(int argc, char **argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 20000;
+  test_configure();
+  test_transparent();
+  test_noise_estimate();
+  test_snr();
+  test_overload();
+  // a recording: NS_WAV=noisy.wav [NS_CLEAN_WAV=clean.wav]
+  if (const char *path = getenv("NS_WAV"))
+    report(path, getenv("NS_CLEAN_WAV"));
+  benchmark(rounds);
+
+  if (failures) {
+    std::cerr << failures << " tests failed" << std::endl;
+    return 1;
+  }
+  std::cout << "All tests passed." << std::endl;
+  return 0;
+}
@@ -0,0 +1,337 @@
+#include "../plc.h"
+#include "audio_fixtures.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+using esphome::voip::PacketLossConcealer;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+  do {                                                                      \
+    if (!(cond)) {                                                          \
+      std::cerr << "FAILED " << __LINE__ << ": " << #cond << std::endl;     \
+      ++failures;                                                           \
+    }                                                                       \
+  } while (0)
+
+static const size_t DELAY = PacketLossConcealer::DELAY;
+
+static void tone(std::vector<int16_t> &pcm, double freq, double amplitude) {
+  for (size_t i = 0; i < pcm.size(); i++)
+    pcm[i] = (int16_t)std::lrint(amplitude * std::sin(2 * M_PI * freq * i / 8000));
+}
+
+// Runs pcm through the concealer in frames, losing the frames marked in lost; the output is
+// aligned back to the input
+static std::vector<int16_t> run(const std::vector<int16_t> &pcm, const std::vector<bool> &lost, size_t frame) {
+  PacketLossConcealer plc;
+  std::vector<int16_t> out(pcm.size() + DELAY, 0);
+  std::vector<int16_t> buf(frame);
+  size_t frames = pcm.size() / frame;
+  for (size_t f = 0; f <= frames; f++) {
+    if (f < frames && !lost[f]) {
+      memcpy(buf.data(), &pcm[f * frame], sizeof(int16_t) * frame);
+      plc.receive(buf.data(), frame);
+    } else if (f < frames) {
+      plc.conceal(buf.data(), frame);
+    } else {
+      // flush the delay line
+      memset(buf.data(), 0, sizeof(int16_t) * frame);
+      plc.receive(buf.data(), frame);
+    }
+    size_t at = f * frame;
+    for (size_t k = 0; k < frame && at + k < out.size(); k++)
+      out[at + k] = buf[k];
+  }
+  return std::vector<int16_t>(out.begin() + DELAY, out.begin() + DELAY + pcm.size());
+}
+
+// what the RX path did before: nothing, the speaker plays silence
+static std::vector<int16_t> run_silence(const std::vector<int16_t> &pcm, const std::vector<bool> &lost, size_t frame) {
+  std::vector<int16_t> out(pcm);
+  for (size_t f = 0; f < lost.size(); f++) {
+    if (lost[f])
+      memset(&out[f * frame], 0, sizeof(int16_t) * frame);
+  }
+  return out;
+}
+
+// A waveform SNR punishes concealment for every phase error, though it sounds far better than a
+// gap; the spectral and level measures are closer to what a listener hears.
+struct Degradation {
+  double snr_db;
+  // over the lost 20 ms frames with signal: log spectral distance, and the absolute level difference
+  double spectral_db;
+  double level_db;
+};
+
+static const size_t SEGMENT = 160;
+
+// power spectrum of a Hann-windowed segment, 80 bins up to 4 kHz
+static void spectrum(const int16_t *x, double *power) {
+  static double cos_table[SEGMENT], sin_table[SEGMENT], window[SEGMENT];
+  if (window[SEGMENT / 2] == 0) {
+    for (size_t k = 0; k < SEGMENT; k++) {
+      cos_table[k] = std::cos(2 * M_PI * k / SEGMENT);
+      sin_table[k] = std::sin(2 * M_PI * k / SEGMENT);
+      window[k] = 0.5 - 0.5 * std::cos(2 * M_PI * k / SEGMENT);
+    }
+  }
+  for (size_t bin = 0; bin < SEGMENT / 2; bin++) {
+    double re = 0, im = 0;
+    for (size_t k = 0; k < SEGMENT; k++) {
+      double v = x[k] * window[k];
+      re += v * cos_table[(bin * k) % SEGMENT];
+      im -= v * sin_table[(bin * k) % SEGMENT];
+    }
+    power[bin] = re * re + im * im;
+  }
+}
+
+static Degradation measure(const std::vector<int16_t> &ref, const std::vector<int16_t> &out,
+                           const std::vector<bool> &lost) {
+  double sig = 0, err = 0, spectral = 0, level = 0;
+  size_t segs = 0;
+  // floor of the spectra: about -60 dBFS per bin
+  const double floor = 1e4 * SEGMENT;
+  for (size_t s = 0; s + SEGMENT <= ref.size(); s += SEGMENT) {
+    double ps = 0, pe = 0, po = 0;
+    for (size_t k = s; k < s + SEGMENT; k++) {
+      double d = (double)out[k] - ref[k];
+      ps += (double)ref[k] * ref[k];
+      po += (double)out[k] * out[k];
+      pe += d * d;
+    }
+    sig += ps;
+    err += pe;
+    if (!lost[s / SEGMENT] || ps < SEGMENT * 1e4)  // quieter than -50 dBFS
+      continue;
+    double pr[SEGMENT / 2], pd[SEGMENT / 2];
+    spectrum(&ref[s], pr);
+    spectrum(&out[s], pd);
+    double sum = 0;
+    for (size_t bin = 0; bin < SEGMENT / 2; bin++) {
+      double d = 10 * std::log10((pd[bin] + floor) / (pr[bin] + floor));
+      sum += d * d;
+    }
+    spectral += std::sqrt(sum / (SEGMENT / 2));
+    // a gap counts down to -50 dBFS, not to minus infinity
+    level += std::fabs(10 * std::log10((po + SEGMENT * 1e4) / (ps + SEGMENT * 1e4)));
+    segs++;
+  }
+  return {10 * std::log10(sig / (err + 1)), segs ? spectral / segs : 0, segs ? level / segs : 0};
+}
+
+static std::vector<bool> random_loss(size_t frames, double p) {
+  std::vector<bool> lost(frames);
+  for (size_t f = 0; f < frames; f++)
+    lost[f] = uniform() < p;
+  return lost;
+}
+
+// Gilbert model: losses come in bursts of mean length burst, p overall
+static std::vector<bool> bursty_loss(size_t frames, double p, double burst) {
+  double leave = 1.0 / burst;
+  double enter = p * leave / (1 - p);
+  std::vector<bool> lost(frames);
+  bool bad = false;
+  for (size_t f = 0; f < frames; f++) {
+    bad = bad ? uniform() >= leave : uniform() < enter;
+    lost[f] = bad;
+  }
+  return lost;
+}
+
+static void test_transparent() {
+  // without loss the concealer is a pure delay line, for any frame length
+  std::vector<int16_t> pcm = synthetic_speech(1);
+  const size_t frames[] = {80, 160, 200, 240, 480};
+  for (size_t frame : frames) {
+    std::vector<bool> none(pcm.size() / frame, false);
+    std::vector<int16_t> out = run(pcm, none, frame);
+    size_t full = pcm.size() / frame * frame;
+    CHECK(memcmp(out.data(), pcm.data(), sizeof(int16_t) * full) == 0);
+  }
+}
+
+static void test_pitch() {
+  // a steady periodic signal is found at its period and continued almost perfectly
+  const double periods[] = {40, 57, 80, 113, 120};
+  for (double period : periods) {
+    std::vector<int16_t> pcm(8000);
+    for (size_t i = 0; i < pcm.size(); i++) {
+      double t = i / period;
+      pcm[i] = (int16_t)std::lrint(8000 * std::sin(2 * M_PI * t) + 3000 * std::sin(4 * M_PI * t + 1));
+    }
+    PacketLossConcealer plc;
+    int16_t buf[160];
+    for (size_t f = 0; f < 25; f++) {
+      memcpy(buf, &pcm[f * 160], sizeof(buf));
+      plc.receive(buf, 160);
+    }
+    plc.conceal(buf, 160);
+    // a multiple of the period repeats just as well; the coarse search may land on it
+    CHECK(plc.get_pitch() % (size_t)period == 0);
+    // the first 10 ms after the cross-fade against what was really sent
+    double ps = 0, pe = 0;
+    for (size_t k = PacketLossConcealer::DELAY; k < 80; k++) {
+      double ref = pcm[25 * 160 + k - DELAY];
+      ps += ref * ref;
+      pe += (buf[k] - ref) * (buf[k] - ref);
+    }
+    CHECK(10 * std::log10(ps / (pe + 1)) > 25);
+  }
+}
+
+static void test_fade_and_recovery() {
+  std::vector<int16_t> pcm(16000);
+  tone(pcm, 100, 10000);
+  std::vector<bool> lost(pcm.size() / 80, false);
+  // 100 ms lost from 0.5 s on
+  for (size_t f = 50; f < 60; f++)
+    lost[f] = true;
+  std::vector<int16_t> out = run(pcm, lost, 80);
+  // full level for 10 ms, then 20 % less per 10 ms, silent after 60 ms
+  double prev = 1e30;
+  for (size_t f = 50; f < 60; f++) {
+    double peak = 0;
+    for (size_t k = f * 80; k < f * 80 + 80; k++)
+      peak = std::fabs(out[k]) > peak ? std::fabs(out[k]) : peak;
+    if (f == 50) {
+      CHECK(peak > 9000);
+    } else if (f < 56) {
+      CHECK(peak < prev);
+    } else {
+      CHECK(peak == 0);
+    }
+    prev = peak;
+  }
+  // the received signal takes over without a jump larger than the tone itself makes
+  int max_step = 0, tone_step = 0;
+  for (size_t k = 60 * 80 - 40; k < 62 * 80; k++)
+    max_step = std::max(max_step, std::abs(out[k] - out[k - 1]));
+  for (size_t k = 1; k < 80; k++)
+    tone_step = std::max(tone_step, std::abs(pcm[k] - pcm[k - 1]));
+  CHECK(max_step <= tone_step + 1);
+  // and is untouched after the cross-fade
+  CHECK(memcmp(&out[62 * 80], &pcm[62 * 80], sizeof(int16_t) * 80 * 10) == 0);
+
+  // the same after a single lost frame: nothing of the repetition is left 10 ms later
+  std::vector<bool> one(pcm.size() / 160, false);
+  one[20] = true;
+  out = run(pcm, one, 160);
+  CHECK(memcmp(&out[21 * 160 + 80], &pcm[21 * 160 + 80], sizeof(int16_t) * 160) == 0);
+}
+
+static void test_robustness() {
+  // random frame lengths, loss patterns and full-scale noise: nothing overflows or runs out of
+  // bounds (run under ASan), and the first frame may already be lost
+  PacketLossConcealer plc;
+  int16_t buf[480];
+  for (int round = 0; round < 20000; round++) {
+    size_t n = 80 + (lcg() >> 16) % 401;
+    if (lcg() & 0x100) {
+      for (size_t k = 0; k < n; k++)
+        buf[k] = (lcg() & 0x200) ? (int16_t)(lcg() >> 16) : ((lcg() & 0x400) ? 32767 : -32768);
+      plc.receive(buf, n);
+    } else {
+      plc.conceal(buf, n);
+    }
+    CHECK(plc.get_pitch() >= PacketLossConcealer::PITCH_MIN && plc.get_pitch() <= PacketLossConcealer::PITCH_MAX);
+    if (failures > 10) break;
+  }
+  plc.reset();
+  plc.conceal(buf, 160);
+  bool silent = true;
+  for (size_t k = 0; k < 160; k++)
+    silent = silent && buf[k] == 0;
+  CHECK(silent);
+}
+
+static void report(const char *name, const std::vector<int16_t> &pcm) {
+  printf("%s, %.1f s, 20 ms frames: SNR / spectral distance / level error\n", name, pcm.size() / 8000.0);
+  struct Pattern {
+    const char *name;
+    std::vector<bool> lost;
+  };
+  const size_t frame = 160;
+  size_t frames = pcm.size() / frame;
+  std::vector<Pattern> patterns;
+  const double rates[] = {0.01, 0.03, 0.05, 0.10, 0.20};
+  char label[32];
+  for (double p : rates) {
+    snprintf(label, sizeof(label), "random %2.0f %%", p * 100);
+    patterns.push_back({strdup(label), random_loss(frames, p)});
+  }
+  patterns.push_back({"bursts of 3, 5 %", bursty_loss(frames, 0.05, 3)});
+  patterns.push_back({"bursts of 3, 10 %", bursty_loss(frames, 0.10, 3)});
+  for (const Pattern &pat : patterns) {
+    Degradation silence = measure(pcm, run_silence(pcm, pat.lost, frame), pat.lost);
+    Degradation plc = measure(pcm, run(pcm, pat.lost, frame), pat.lost);
+    printf("  %-18s silence %5.1f / %5.1f dB / %4.2f dB   PLC %5.1f / %5.1f dB / %4.2f dB\n", pat.name,
+           silence.snr_db, silence.spectral_db, silence.level_db, plc.snr_db, plc.spectral_db, plc.level_db);
+    // concealment keeps level and spectrum where silence drops out
+    CHECK(plc.level_db < silence.level_db);
+    CHECK(plc.spectral_db < silence.spectral_db);
+  }
+  for (size_t k = 0; k < 5; k++)
+    free((void *)patterns[k].name);
+}
+
+static void benchmark(int rounds) {
+  std::vector<int16_t> pcm = synthetic_speech(1);
+  PacketLossConcealer plc;
+  int16_t buf[160];
+  volatile int sink = 0;
+  auto t0 = std::chrono::steady_clock::now();
+  for (int r = 0; r < rounds; r++) {
+    memcpy(buf, &pcm[(r % 40) * 160], sizeof(buf));
+    plc.receive(buf, 160);
+    sink += buf[0];
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  for (int r = 0; r < rounds; r++) {
+    // the first lost frame, with the pitch search
+    memcpy(buf, &pcm[(r % 40) * 160], sizeof(buf));
+    plc.receive(buf, 160);
+    plc.conceal(buf, 160);
+    sink += buf[0];
+  }
+  auto t2 = std::chrono::steady_clock::now();
+  double receive_ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / rounds;
+  double first_ns = std::chrono::duration<double, std::nano>(t2 - t1).count() / rounds - receive_ns;
+  printf("20 ms frame: receive %.0f ns, first lost frame %.0f ns (%d rounds)\n", receive_ns, first_ns, rounds);
+}
+
+int main(int argc, char **argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 100000;
+  test_transparent();
+  test_pitch();
+  test_fade_and_recovery();
+  test_robustness();
+  report("synthetic speech", synthetic_speech(20));
+  // real speech: PLC_WAV=path/to/8khz_mono_16bit.wav
+  if (const char *path = getenv("PLC_WAV")) {
+    std::vector<int16_t> wav = read_wav(path);
+    if (wav.empty()) {
+      std::cerr << "PLC_WAV: " << path << " is not a 16-bit mono 8 kHz WAV" << std::endl;
+      ++failures;
+    } else {
+      report(path, wav);
+    }
+  }
+  benchmark(rounds);
+
+  if (failures) {
+    std::cerr << failures << " tests failed" << std::endl;
+    return 1;
+  }
+  std::cout << "All tests passed." << std::endl;
+  return 0;
+}
@@ -0,0 +1,201 @@
+#include "../resampler.h"
+#include "audio_fixtures.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+using esphome::voip::Resampler;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+  do {                                                                      \
+    if (!(cond)) {                                                          \
+      std::cerr << "FAILED " << __LINE__ << ": " << #cond << std::endl;     \
+      ++failures;                                                           \
+    }                                                                       \
+  } while (0)
+
+static std::vector<int16_t> tone(double hz, uint32_t rate, size_t n, double amplitude) {
+  std::vector<int16_t> x(n);
+  for (size_t i = 0; i < n; i++)
+    x[i] = (int16_t)std::lrint(amplitude * std::sin(2 * M_PI * hz * i / rate));
+  return x;
+}
+
+static std::vector<int16_t> convert(uint32_t from, uint32_t to, const std::vector<int16_t> &in) {
+  Resampler r;
+  CHECK(r.configure(from, to));
+  std::vector<int16_t> out(r.get_output_samples(in.size()));
+  out.resize(r.process(in.data(), in.size(), out.data()));
+  return out;
+}
+
+struct Fit {
+  // amplitude of the tone in the output relative to the input, and what else is left in it, dB
+  double gain_db;
+  double rest_db;
+};
+
+// least-squares fit of a sine at hz over half a second of output, after the filters have settled
+static Fit fit(const std::vector<int16_t> &y, double hz, uint32_t rate, double amplitude) {
+  size_t from = rate / 20, n = rate / 2;
+  double a = 0, b = 0;
+  for (size_t i = from; i < from + n; i++) {
+    a += y[i] * std::cos(2 * M_PI * hz * i / rate);
+    b += y[i] * std::sin(2 * M_PI * hz * i / rate);
+  }
+  a *= 2.0 / n;
+  b *= 2.0 / n;
+  double rest = 0;
+  for (size_t i = from; i < from + n; i++) {
+    double e = y[i] - a * std::cos(2 * M_PI * hz * i / rate) - b * std::sin(2 * M_PI * hz * i / rate);
+    rest += e * e;
+  }
+  rest = std::sqrt(2 * rest / n);
+  return {20 * std::log10(std::sqrt(a * a + b * b) / amplitude + 1e-12), 20 * std::log10(rest / amplitude + 1e-12)};
+}
+
+static void test_configure() {
+  Resampler r;
+  CHECK(!r.configure(44100, 8000));
+  CHECK(!r.configure(8000, 0));
+  CHECK(r.configure(8000, 8000));
+  CHECK(!r.is_active());
+  int16_t in[3] = {1, -2, 3}, out[3] = {};
+  CHECK(r.process(in, 3, out) == 3 && memcmp(in, out, sizeof(in)) == 0);
+  CHECK(r.configure(48000, 8000) && r.is_active());
+  CHECK(r.get_output_samples(480) == 80);
+  CHECK(r.configure(8000, 48000));
+  CHECK(r.get_output_samples(80) == 480);
+  CHECK(r.get_input_rate() == 8000 && r.get_output_rate() == 48000);
+}
+
+// Tones through each conversion: flat passband, and what lies above the lower rate's band (aliases
+// when going down, images when going up) at least 65 dB down. Prints the response.
+static void test_frequency_response() {
+  const uint32_t pairs[][2] = {{16000, 8000}, {48000, 8000}, {8000, 16000}, {8000, 48000}, {48000, 16000}, {16000, 48000}};
+  const double amplitude = 10000;
+  for (const auto &pair : pairs) {
+    uint32_t from = pair[0], to = pair[1];
+    uint32_t low = from < to ? from : to;
+    // the band that passes: telephone band at 8 kHz, wideband at 16 kHz
+    double pass = low == 8000 ? 3400 : 7000;
+    double stop = low == 8000 ? 4600 : 9000;
+    printf("%u -> %u Hz:", (unsigned)from, (unsigned)to);
+    for (double hz : {100.0, 300.0, 1000.0, 2000.0, 3000.0, 3400.0, 5000.0, 6000.0, 7000.0}) {
+      if (hz > pass)
+        continue;
+      std::vector<int16_t> y = convert(from, to, tone(hz, from, from, amplitude));
+      Fit f = fit(y, hz, to, amplitude);
+      printf(" %.0f: %+.3f dB (rest %.0f dB)", hz, f.gain_db, f.rest_db);
+      CHECK(std::fabs(f.gain_db) < 0.05);
+      CHECK(f.rest_db < -65);
+    }
+    printf("\n");
+    if (from > to) {
+      // tones the lower rate cannot carry are gone, not folded back
+      double worst = -200;
+      for (double hz = stop; hz < from / 2.0; hz += 700) {
+        std::vector<int16_t> y = convert(from, to, tone(hz, from, from, amplitude));
+        double ms = 0;
+        for (size_t i = to / 20; i < y.size(); i++)
+          ms += (double)y[i] * y[i];
+        double db = 10 * std::log10(2 * ms / (y.size() - to / 20) / (amplitude * amplitude) + 1e-20);
+        worst = db > worst ? db : worst;
+      }
+      printf("  stopband from %.0f Hz: at most %.1f dB\n", stop, worst);
+      CHECK(worst < -65);
+    }
+  }
+}
+
+// the result must not depend on how the input is split into blocks
+static void test_blocks() {
+  const uint32_t pairs[][2] = {{48000, 8000}, {16000, 8000}, {8000, 48000}, {8000, 16000}};
+  for (const auto &pair : pairs) {
+    std::vector<int16_t> x(pair[0] / 4);
+    for (auto &v : x)
+      v = (int16_t)(lcg() >> 16);
+    std::vector<int16_t> whole = convert(pair[0], pair[1], x);
+    CHECK(whole.size() == x.size() * pair[1] / pair[0]);
+    Resampler r;
+    r.configure(pair[0], pair[1]);
+    std::vector<int16_t> pieces;
+    for (size_t at = 0; at < x.size();) {
+      size_t n = lcg() % 700;
+      n = n > x.size() - at ? x.size() - at : n;
+      std::vector<int16_t> out(r.get_output_samples(n));
+      size_t got = r.process(&x[at], n, out.data());
+      CHECK(got <= out.size());
+      pieces.insert(pieces.end(), out.begin(), out.begin() + got);
+      at += n;
+    }
+    CHECK(pieces == whole);
+    // reset() starts over from silence
+    r.reset();
+    std::vector<int16_t> again(r.get_output_samples(x.size()));
+    again.resize(r.process(x.data(), x.size(), again.data()));
+    CHECK(again == whole);
+  }
+}
+
+// full scale saturates on the filters' overshoot, it must not wrap around
+static void test_full_scale() {
+  for (uint32_t rate : {16000u, 48000u}) {
+    std::vector<int16_t> square(8000);
+    for (size_t i = 0; i < square.size(); i++)
+      square[i] = (i / 4) % 2 ? -32768 : 32767;
+    std::vector<int16_t> up = convert(8000, rate, square);
+    std::vector<int16_t> back = convert(rate, 8000, up);
+    int jump = 0;
+    for (const std::vector<int16_t> *y : {&up, &back}) {
+      for (size_t i = 1; i < y->size(); i++)
+        jump = std::max(jump, std::abs((*y)[i] - (*y)[i - 1]));
+    }
+    printf("full-scale square wave through %u Hz: largest step %d\n", (unsigned)rate, jump);
+    CHECK(jump < 50000);
+  }
+}
+
+static void benchmark(int rounds) {
+  const uint32_t pairs[][2] = {{16000, 8000}, {48000, 8000}, {8000, 16000}, {8000, 48000}};
+  for (const auto &pair : pairs) {
+    Resampler r;
+    r.configure(pair[0], pair[1]);
+    // 20 ms
+    size_t n = pair[0] / 50;
+    std::vector<int16_t> in = tone(1000, pair[0], n, 10000), out(r.get_output_samples(n));
+    volatile int sink = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+      r.process(in.data(), n, out.data());
+      sink += out[0];
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / rounds;
+    printf("%u -> %u Hz: %.0f ns per 20 ms frame, %.2f ns per 8 kHz sample\n", (unsigned)pair[0], (unsigned)pair[1], ns,
+           ns / 160);
+  }
+}
+
+int main(int argc, char **argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 20000;
+  test_configure();
+  test_frequency_response();
+  test_blocks();
+  test_full_scale();
+  benchmark(rounds);
+
+  if (failures) {
+    std::cerr << failures << " tests failed" << std::endl;
+    return 1;
+  }
+  std::cout << "All tests passed." << std::endl;
+  return 0;
+}
@@ -0,0 +1,351 @@
+#include "../rtcp.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <vector>
+
+using esphome::voip::RTCP_MAX_PACKET;
+using esphome::voip::RtcpSession;
+using esphome::voip::RtpReceiveStats;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+  do {                                                                      \
+    if (!(cond)) {                                                          \
+      std::cerr << "FAILED " << __LINE__ << ": " << #cond << std::endl;     \
+      ++failures;                                                           \
+    }                                                                       \
+  } while (0)
+
+// Deterministic pseudo random generator so failures are reproducible
+static uint32_t lcg_state = 12345;
+static uint32_t lcg() { return lcg_state = lcg_state * 1103515245u + 12345u; }
+
+static uint32_t get32(const uint8_t *p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void test_sequence() {
+  // 1000 packets across the sequence number wrap, every 20th lost
+  RtpReceiveStats stats;
+  for (uint32_t i = 0; i < 1000; i++) {
+    if (i % 20 == 7)
+      continue;
+    stats.update((uint16_t)(65000 + i), i * 160, i * 160);
+  }
+  CHECK(stats.get_received() == 950);
+  CHECK(stats.get_extended_max() == 65000 + 999);
+  CHECK(stats.get_expected() == 1000);
+  CHECK(stats.get_cumulative_lost() == 50);
+  CHECK(stats.take_fraction_lost() == 12);  // 50 / 1000 * 256
+  CHECK(stats.take_fraction_lost() == 0);   // a new interval without packets
+  CHECK(stats.get_jitter() == 0);
+
+  // duplicates count as received (A.3), so the loss can go down and even below zero
+  stats.update((uint16_t)(65000 + 999), 999 * 160, 999 * 160);
+  CHECK(stats.get_cumulative_lost() == 49);
+  CHECK(stats.take_fraction_lost() == 0);
+
+  // reordered pairs lose nothing
+  RtpReceiveStats reordered;
+  for (uint32_t i = 0; i < 100; i += 2) {
+    reordered.update((uint16_t)(i + 1), (i + 1) * 160, i * 160);
+    reordered.update((uint16_t)i, i * 160, i * 160 + 1);
+  }
+  CHECK(reordered.get_received() == 100 && reordered.get_cumulative_lost() == -1);
+  CHECK(reordered.get_extended_max() == 99);
+
+  // a sender restart: the first packet after the jump is ignored, the second starts over
+  RtpReceiveStats restart;
+  for (uint32_t i = 0; i < 50; i++)
+    restart.update((uint16_t)(1000 + i), i * 160, i * 160);
+  restart.update(30000, 0, 0);
+  CHECK(restart.get_received() == 50 && restart.get_extended_max() == 1049);
+  restart.update(30001, 160, 160);
+  restart.update(30002, 320, 320);
+  CHECK(restart.get_received() == 2 && restart.get_extended_max() == 30002 && restart.get_cumulative_lost() == 0);
+}
+
+static void test_jitter() {
+  // alternating transit times of 0 and 10 ms: every difference is 80 units, the estimate converges there
+  RtpReceiveStats alternating;
+  for (uint32_t i = 0; i < 2000; i++)
+    alternating.update((uint16_t)i, i * 160, i * 160 + (i % 2) * 80);
+  CHECK(alternating.get_jitter() >= 78 && alternating.get_jitter() <= 80);
+
+  // uniform random delay over 40 ms: the mean difference is a third of the range, 320 / 3 units
+  RtpReceiveStats uniform;
+  double sum = 0;
+  int samples = 0;
+  for (uint32_t i = 0; i < 20000; i++) {
+    uniform.update((uint16_t)i, i * 160, i * 160 + lcg() % 321);
+    if (i > 100) {
+      sum += uniform.get_jitter();
+      samples++;
+    }
+  }
+  double mean = sum / samples;
+  CHECK(mean > 320 / 3.0 * 0.9 && mean < 320 / 3.0 * 1.1);
+  printf("jitter estimate for 0-40 ms uniform delay: %.1f units (expected %.1f)\n", mean, 320 / 3.0);
+}
+
+static void test_packet_format() {
+  RtcpSession s;
+  s.start(1000000, 0x11223344, "3f2a91c4b07e5d68");
+  CHECK(!s.report_due(1000000));
+  CHECK(s.report_due(1000000 + RtcpSession::INTERVAL_US));
+  for (uint32_t i = 0; i < 50; i++)
+    s.on_rtp_sent(5000 + i * 160, 160, 1000000 + i * 20000);
+  uint8_t buf[RTCP_MAX_PACKET];
+  uint64_t now = 1000000 + 49 * 20000 + 5000;
+  size_t len = s.build_report(now, buf, sizeof(buf));
+  // SR without report blocks, then SDES with the 16-character CNAME padded to 28 bytes
+  CHECK(len == 28 + 28);
+  CHECK(buf[0] == 0x80 && buf[1] == 200 && buf[2] == 0 && buf[3] == 6);
+  CHECK(get32(buf + 4) == 0x11223344);
+  uint64_t ntp = esphome::voip::rtcp_ntp_time(now);
+  CHECK(get32(buf + 8) == (uint32_t)(ntp >> 32) && get32(buf + 12) == (uint32_t)ntp);
+  CHECK(get32(buf + 16) == 5000 + 49 * 160 + 40);  // extrapolated 5 ms past the last packet
+  CHECK(get32(buf + 20) == 50 && get32(buf + 24) == 50 * 160);
+  const uint8_t *sdes = buf + 28;
+  CHECK(sdes[0] == 0x81 && sdes[1] == 202 && sdes[3] == 6 && get32(sdes + 4) == 0x11223344);
+  CHECK(sdes[8] == 1 && sdes[9] == 16 && memcmp(sdes + 10, "3f2a91c4b07e5d68", 16) == 0 && sdes[26] == 0);
+  CHECK(!s.report_due(now + RtcpSession::INTERVAL_US / 2 - 1));
+  CHECK(s.report_due(now + RtcpSession::INTERVAL_US * 3 / 2));
+
+  // nothing sent since: an RR, now with a block about the far end's stream
+  for (uint32_t i = 0; i < 10; i++)
+    s.on_rtp_received(0xAABBCCDD, (uint16_t)(100 + i), i * 160, now + i * 20000);
+  len = s.build_report(now + 300000, buf, sizeof(buf));
+  CHECK(len == 32 + 28);
+  CHECK(buf[0] == 0x81 && buf[1] == 201 && buf[3] == 7);
+  CHECK(get32(buf + 8) == 0xAABBCCDD && buf[12] == 0 && get32(buf + 12) == 0);
+  CHECK(get32(buf + 16) == 109);
+  CHECK(get32(buf + 24) == 0 && get32(buf + 28) == 0);  // no SR received: LSR and DLSR 0
+
+  len = s.build_bye(now + 400000, buf, sizeof(buf));
+  CHECK(len == 32 + 28 + 8);
+  CHECK(buf[60] == 0x81 && buf[61] == 203 && buf[63] == 1 && get32(buf + 64) == 0x11223344);
+  CHECK(s.build_report(now, buf, 40) == 0);
+  CHECK(s.build_bye(now, buf, 60) == 0);
+}
+
+static void test_malformed() {
+  RtcpSession s;
+  s.start(0, 1, "x");
+  uint8_t sr[RTCP_MAX_PACKET];
+  RtcpSession peer;
+  peer.start(0, 2, "peer");
+  peer.on_rtp_sent(0, 160, 0);
+  size_t len = peer.build_report(1000, sr, sizeof(sr));
+  CHECK(s.parse(sr, len, 2000));
+  CHECK(!s.parse(sr, len - 1, 2000));  // the SDES length runs past the end
+  CHECK(!s.parse(sr, 3, 2000));
+  CHECK(!s.parse(nullptr, 0, 2000));
+  uint8_t bad[RTCP_MAX_PACKET];
+  memcpy(bad, sr, len);
+  bad[0] = 0x40;  // version 1
+  CHECK(!s.parse(bad, len, 2000));
+  memcpy(bad, sr, len);
+  bad[1] = 202;  // SDES first
+  CHECK(!s.parse(bad, len, 2000));
+  memcpy(bad, sr, len);
+  bad[0] = 0x9F;  // 31 report blocks in 28 bytes
+  CHECK(!s.parse(bad, len, 2000));
+
+  // mutated reports never read outside the datagram (run under ASan to see it)
+  int accepted = 0;
+  for (int i = 0; i < 100000; i++) {
+    memcpy(bad, sr, len);
+    size_t n = 1 + lcg() % len;
+    for (int k = 0; k < 4; k++)
+      bad[lcg() % n] ^= (uint8_t)(1 << (lcg() % 8));
+    accepted += s.parse(bad, n, 2000);
+  }
+  printf("mutated reports accepted: %d of 100000\n", accepted);
+}
+
+// Two endpoints exchanging 20 ms RTP both ways and RTCP whenever due, over a link with a fixed
+// delay for RTCP and extra random delay and loss for RTP
+struct Link {
+  struct Packet {
+    uint64_t due_us;
+    bool rtcp;
+    uint16_t seq;
+    uint32_t timestamp;
+    uint32_t ssrc;
+    std::vector<uint8_t> data;
+  };
+  std::deque<Packet> queue;
+  uint32_t delay_us;
+  uint32_t jitter_us;
+  uint32_t loss_per_mille;
+  uint32_t lost = 0;
+
+  void send_rtp(uint64_t now, uint16_t seq, uint32_t ts, uint32_t ssrc) {
+    if ((lcg() >> 8) % 1000 < loss_per_mille) {
+      lost++;
+      return;
+    }
+    uint64_t due = now + delay_us + (jitter_us ? (lcg() >> 8) % jitter_us : 0);
+    queue.push_back({due, false, seq, ts, ssrc, {}});
+  }
+  void send_rtcp(uint64_t now, const uint8_t *buf, size_t len) {
+    queue.push_back({now + delay_us, true, 0, 0, 0, std::vector<uint8_t>(buf, buf + len)});
+  }
+  void deliver(uint64_t now, RtcpSession &to) {
+    for (auto it = queue.begin(); it != queue.end();) {
+      if (it->due_us > now) {
+        ++it;
+        continue;
+      }
+      if (it->rtcp) {
+        CHECK(to.parse(it->data.data(), it->data.size(), now));
+      } else {
+        to.on_rtp_received(it->ssrc, it->seq, it->timestamp, now);
+      }
+      it = queue.erase(it);
+    }
+  }
+};
+
+static void test_round_trip() {
+  const uint32_t one_way_us = 37000;
+  RtcpSession a, b;
+  a.start(0, 0xA0A0A0A0, "a");
+  b.start(3000, 0xB0B0B0B0, "b");
+  // A to B loses 5 % and adds up to 10 ms of jitter, B to A is clean
+  Link ab{{}, one_way_us, 10000, 50};
+  Link ba{{}, one_way_us, 0, 0};
+  uint16_t seq_a = 60000, seq_b = 7;
+  uint32_t ts_a = 0xFFFF0000u, ts_b = 1234;
+  uint32_t rtcp_bytes = 0;
+  uint8_t buf[RTCP_MAX_PACKET];
+  const uint64_t end = 60000000;
+  for (uint64_t now = 0; now < end; now += 1000) {
+    if (now % 20000 == 0) {
+      ab.send_rtp(now, seq_a++, ts_a, a.get_ssrc());
+      a.on_rtp_sent(ts_a, 160, now);
+      ts_a += 160;
+    }
+    if (now % 20000 == 3000) {
+      ba.send_rtp(now, seq_b++, ts_b, b.get_ssrc());
+      b.on_rtp_sent(ts_b, 160, now);
+      ts_b += 160;
+    }
+    if (a.report_due(now)) {
+      size_t len = a.build_report(now, buf, sizeof(buf));
+      rtcp_bytes += len;
+      ab.send_rtcp(now, buf, len);
+    }
+    if (b.report_due(now)) {
+      size_t len = b.build_report(now, buf, sizeof(buf));
+      rtcp_bytes += len;
+      ba.send_rtcp(now, buf, len);
+    }
+    ab.deliver(now, b);
+    ba.deliver(now, a);
+  }
+  // before the last packets in flight all arrive at once with the BYE
+  uint32_t jitter_us = b.get_jitter_us();
+  size_t len = a.build_bye(end, buf, sizeof(buf));
+  ab.send_rtcp(end, buf, len);
+  ab.deliver(end + one_way_us, b);
+
+  CHECK(a.has_rtt() && b.has_rtt());
+  // the NTP middle bits have 15 us resolution
+  CHECK(std::abs((int)a.get_rtt_us() - (int)(2 * one_way_us)) < 100);
+  CHECK(std::abs((int)b.get_rtt_us() - (int)(2 * one_way_us)) < 100);
+  // B counts what A lost on the way, and A learns it from B's reports
+  const RtpReceiveStats &rx = b.get_receive_stats();
+  CHECK(rx.get_cumulative_lost() >= (int32_t)ab.lost - 2 && rx.get_cumulative_lost() <= (int32_t)ab.lost);
+  CHECK(a.has_remote_report() && a.get_remote_cumulative_lost() > 0);
+  CHECK(a.get_remote_cumulative_lost() <= rx.get_cumulative_lost());
+  CHECK(jitter_us > 2000 && jitter_us < 5000);  // a third of 10 ms
+  CHECK(a.get_jitter_us() == 0);
+  CHECK(a.get_reports_sent() >= 8 && a.get_reports_sent() <= 20);
+  CHECK(b.get_reports_received() == a.get_reports_sent() + 1);  // the BYE comes with a last RR
+  CHECK(b.remote_said_bye() && !a.remote_said_bye());
+  printf("RTT %.1f / %.1f ms (link %.1f ms), A to B: %u of %u lost, B reports %d lost, last interval %.1f %%, "
+         "jitter %.1f ms; %u reports per side, %.0f bit/s of RTCP\n",
+         a.get_rtt_us() / 1000.0, b.get_rtt_us() / 1000.0, 2 * one_way_us / 1000.0, (unsigned)ab.lost,
+         (unsigned)a.get_packets_sent(), (int)a.get_remote_cumulative_lost(), a.get_remote_loss() * 100,
+         jitter_us / 1000.0, (unsigned)a.get_reports_sent(), rtcp_bytes * 8.0 / 2 / (end / 1e6));
+}
+
+static void test_emodel() {
+  using esphome::voip::emodel_mos;
+  using esphome::voip::emodel_r_factor;
+  // G.711 without loss and delay
+  CHECK(std::fabs(emodel_r_factor(0, 0, 0, 4.3f) - 93.2f) < 0.01f);
+  CHECK(std::fabs(emodel_mos(93.2f) - 4.41f) < 0.01f);
+  // 1 % random loss without concealment costs about 18 points
+  CHECK(std::fabs(emodel_r_factor(0, 1, 0, 4.3f) - 75.28f) < 0.05f);
+  // 300 ms one way is past the knee at 177.3 ms
+  CHECK(std::fabs(emodel_r_factor(300, 0, 0, 4.3f) - 72.5f) < 0.05f);
+  CHECK(std::fabs(emodel_mos(50) - 2.575f) < 0.001f);
+  CHECK(emodel_mos(0) == 1.0f && emodel_mos(120) == 4.5f);
+  CHECK(emodel_r_factor(1000, 50, 25, 4.3f) == 0);
+  float last = 100;
+  for (int loss = 0; loss <= 20; loss++) {
+    float r = emodel_r_factor(100, (float)loss, 7, 4.3f);
+    CHECK(r < last);
+    last = r;
+  }
+  printf("G.711 at 80 ms: R %.1f (MOS %.2f) clean, %.1f (MOS %.2f) at 1 %% loss, %.1f (MOS %.2f) at 5 %%\n",
+         emodel_r_factor(80, 0, 0, 4.3f), emodel_mos(emodel_r_factor(80, 0, 0, 4.3f)), emodel_r_factor(80, 1, 0, 4.3f),
+         emodel_mos(emodel_r_factor(80, 1, 0, 4.3f)), emodel_r_factor(80, 5, 0, 4.3f),
+         emodel_mos(emodel_r_factor(80, 5, 0, 4.3f)));
+}
+
+// Per-packet cost on the receive path, and a report built and parsed
+static void benchmark(int rounds) {
+  RtcpSession s;
+  s.start(0, 1, "3f2a91c4b07e5d68");
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < rounds; i++)
+    s.on_rtp_received(2, (uint16_t)i, (uint32_t)i * 160, (uint64_t)i * 20000 + (lcg() & 0x3FFF));
+  double per_packet = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1e9 / rounds;
+  uint8_t buf[RTCP_MAX_PACKET];
+  size_t len = 0;
+  int reports = rounds / 10 + 1;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < reports; i++) {
+    s.on_rtp_sent((uint32_t)i * 160, 160, (uint64_t)i * 20000);
+    len = s.build_report((uint64_t)i * 20000, buf, sizeof(buf));
+    __asm__ __volatile__("" : : "r"(buf) : "memory");
+  }
+  double per_report = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1e9 / reports;
+  RtcpSession peer;
+  peer.start(0, 2, "peer");
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < reports; i++)
+    peer.parse(buf, len, (uint64_t)i * 20000);
+  double per_parse = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1e9 / reports;
+  CHECK(peer.get_reports_received() == (uint32_t)reports);
+  printf("on_rtp_received %.1f ns per packet, build_report %.0f ns, parse %.0f ns (%u bytes)\n", per_packet,
+         per_report, per_parse, (unsigned)len);
+}
+
+int main(int argc, char **argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 1000000;
+  test_sequence();
+  test_jitter();
+  test_packet_format();
+  test_malformed();
+  test_round_trip();
+  test_emodel();
+  benchmark(rounds);
+
+  if (failures) {
+    std::cerr << failures << " tests failed" << std::endl;
+    return 1;
+  }
+  std::cout << "All tests passed." << std::endl;
+  return 0;
+}
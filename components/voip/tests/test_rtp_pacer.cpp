@@ -0,0 +1,191 @@
+#include "../rtp.h"
+#include "../rtp_pacer.h"
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+using esphome::voip::RtpHeader;
+using esphome::voip::RtpPacer;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+  do {                                                                      \
+    if (!(cond)) {                                                          \
+      std::cerr << "FAILED " << __LINE__ << ": " << #cond << std::endl;     \
+      ++failures;                                                           \
+    }                                                                       \
+  } while (0)
+
+// Sends all due frames at now_us and checks that every header continues the stream
+struct Receiver {
+  bool have_last = false;
+  RtpHeader last{};
+  uint32_t packets = 0;
+  uint32_t seq_errors = 0;
+  uint32_t ts_gaps = 0;
+
+  void drain(RtpPacer &pacer, uint64_t now_us) {
+    for (uint32_t due = pacer.frames_due(now_us); due > 0; due--) {
+      uint8_t buf[esphome::voip::RTP_HEADER_SIZE];
+      pacer.next_packet(now_us, 8, false, buf);
+      RtpHeader hdr;
+      if (!esphome::voip::parse_rtp_header(buf, sizeof(buf), &hdr)) {
+        seq_errors++;
+        continue;
+      }
+      if (have_last) {
+        if ((uint16_t)(hdr.sequence - last.sequence) != 1)
+          seq_errors++;
+        if (hdr.timestamp - last.timestamp != 160)
+          ts_gaps++;
+      }
+      last = hdr;
+      have_last = true;
+      packets++;
+    }
+  }
+};
+
+// Deterministic pseudo random generator so failures are reproducible
+static uint32_t lcg_state = 12345;
+static uint32_t lcg() { return lcg_state = lcg_state * 1103515245u + 12345u; }
+
+static void test_header_layout() {
+  RtpPacer pacer;
+  pacer.start(1000, 0xFFFE, 0xFFFFFF00u, 0xA1B2C3D4u);
+  CHECK(pacer.frames_due(999) == 0);
+  CHECK(pacer.frames_due(1000) == 1);
+  uint8_t buf[esphome::voip::RTP_HEADER_SIZE];
+  CHECK(pacer.next_packet(1000, 8, false, buf) == esphome::voip::RTP_HEADER_SIZE);
+  CHECK(buf[0] == 0x80);
+  CHECK(buf[1] == (0x80 | 8));  // marker on the first packet
+  CHECK(buf[2] == 0xFF && buf[3] == 0xFE);
+  CHECK(buf[4] == 0xFF && buf[5] == 0xFF && buf[6] == 0xFF && buf[7] == 0x00);
+  CHECK(buf[8] == 0xA1 && buf[9] == 0xB2 && buf[10] == 0xC3 && buf[11] == 0xD4);
+  CHECK(pacer.frames_due(1000) == 0);
+  CHECK(pacer.frames_due(21000) == 1);
+  pacer.next_packet(21000, 0, false, buf);
+  CHECK(buf[1] == 0);
+  // sequence number and timestamp wrap
+  CHECK(pacer.get_sequence() == 0x0000);
+  CHECK(pacer.get_timestamp() == 0x00000040u);
+  pacer.stop();
+  CHECK(pacer.frames_due(1000000) == 0);
+}
+
+static void test_jittery_ticks() {
+  // 10 s of 20 ms polls that each arrive 0..15 ms late: the old one-packet-per-tick code lost a
+  // packet whenever a tick slipped, the pacer must send exactly one frame per 20 ms of wall clock
+  RtpPacer pacer;
+  Receiver rx;
+  const uint64_t t0 = 5000000;
+  pacer.start(t0, (uint16_t)lcg(), lcg(), lcg());
+  uint64_t now = t0;
+  for (int i = 0; i < 500; i++) {
+    now = t0 + (uint64_t)i * 20000 + lcg() % 15000;
+    rx.drain(pacer, now);
+  }
+  rx.drain(pacer, t0 + 500 * 20000);
+  CHECK(rx.packets == 501);
+  CHECK(rx.seq_errors == 0);
+  CHECK(rx.ts_gaps == 0);
+  CHECK(pacer.get_skipped() == 0);
+  uint32_t total = 0;
+  for (size_t b = 0; b < RtpPacer::HISTOGRAM_BUCKETS; b++)
+    total += pacer.get_histogram(b);
+  CHECK(total == pacer.get_sent());
+  CHECK(pacer.get_max_lateness_us() < 20000);
+  printf("jittery ticks: %u packets, max lateness %u us, histogram", rx.packets, pacer.get_max_lateness_us());
+  for (size_t b = 0; b < RtpPacer::HISTOGRAM_BUCKETS; b++)
+    printf(" %u", pacer.get_histogram(b));
+  printf("\n");
+}
+
+static void test_catch_up_and_skip() {
+  RtpPacer pacer;
+  pacer.set_max_catch_up(5);
+  Receiver rx;
+  pacer.start(0, 100, 1000, 42);
+  rx.drain(pacer, 0);
+  // a 70 ms stall is caught up in one burst
+  rx.drain(pacer, 70000);
+  CHECK(rx.packets == 4);
+  CHECK(rx.ts_gaps == 0);
+  CHECK(pacer.get_skipped() == 0);
+  // a 500 ms stall is longer than the catch-up window: old frames are skipped, the sequence number
+  // stays contiguous and the timestamp jumps to stay on the wall clock
+  rx.drain(pacer, 570000);
+  CHECK(rx.seq_errors == 0);
+  CHECK(rx.ts_gaps == 1);
+  CHECK(pacer.get_skipped() == 25 - 5);  // frames 4..28 were due, the last 5 are sent
+  CHECK(rx.last.timestamp == 1000 + (570000 / 20000) * 160);
+  // back on schedule
+  CHECK(pacer.frames_due(579999) == 0);
+  CHECK(pacer.frames_due(580000) == 1);
+}
+
+static void test_restart_per_call() {
+  RtpPacer pacer;
+  uint8_t buf[esphome::voip::RTP_HEADER_SIZE];
+  pacer.start(0, 1, 2, 3);
+  pacer.frames_due(100000);
+  pacer.next_packet(100000, 0, false, buf);
+  pacer.stop();
+  // a new call starts from the new random state and clean statistics
+  pacer.start(200000, 500, 600, 700);
+  CHECK(pacer.get_sent() == 0 && pacer.get_skipped() == 0 && pacer.get_max_lateness_us() == 0);
+  CHECK(pacer.frames_due(200000) == 1);
+  pacer.next_packet(200000, 0, false, buf);
+  RtpHeader hdr;
+  CHECK(esphome::voip::parse_rtp_header(buf, sizeof(buf), &hdr));
+  CHECK(hdr.sequence == 500 && hdr.timestamp == 600 && hdr.ssrc == 700 && hdr.marker);
+}
+
+static void test_pause_resume() {
+  // a call off the microphone keeps its stream: SSRC and sequence go on, the timestamp jumps by the pause
+  esphome::voip::RtpPacer pacer;
+  pacer.start(0, 10, 1000, 42, 20000, 160);
+  uint8_t buf[esphome::voip::RTP_HEADER_SIZE];
+  esphome::voip::RtpHeader hdr;
+  for (uint64_t t = 0; t < 100000; t += 20000) {
+    CHECK(pacer.frames_due(t) == 1);
+    pacer.next_packet(t, 8, false, buf);
+  }
+  pacer.pause(100000);
+  CHECK(!pacer.is_active());
+  CHECK(pacer.frames_due(500000) == 0);
+  pacer.resume(1100000);
+  CHECK(pacer.is_active());
+  CHECK(pacer.frames_due(1100000) == 1);
+  pacer.next_packet(1100000, 8, false, buf);
+  CHECK(esphome::voip::parse_rtp_header(buf, sizeof(buf), &hdr));
+  CHECK(hdr.ssrc == 42 && hdr.sequence == 15 && hdr.marker);
+  // 5 frames sent, then 1 s of pause at 8 kHz
+  CHECK(hdr.timestamp == 1000 + 5 * 160 + 8000);
+  CHECK(pacer.get_sent() == 6);
+  CHECK(pacer.frames_due(1119999) == 0);
+  CHECK(pacer.frames_due(1120000) == 1);
+  pacer.next_packet(1120000, 8, false, buf);
+  CHECK(esphome::voip::parse_rtp_header(buf, sizeof(buf), &hdr));
+  CHECK(hdr.timestamp == 1000 + 6 * 160 + 8000 && !hdr.marker);
+  // resume without pause does nothing
+  pacer.stop();
+  pacer.resume(2000000);
+  CHECK(!pacer.is_active());
+}
+
+int main() {
+  test_header_layout();
+  test_jittery_ticks();
+  test_catch_up_and_skip();
+  test_restart_per_call();
+  test_pause_resume();
+
+  if (failures) {
+    std::cerr << failures << " tests failed" << std::endl;
+    return 1;
+  }
+  std::cout << "All tests passed." << std::endl;
+  return 0;
+}
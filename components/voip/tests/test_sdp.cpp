@@ -0,0 +1,336 @@
+#include "../sdp.h"
+#include "../sip_message.h"
+#include "../sip_parser.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+
+using namespace esphome::voip;
+
+#ifndef SIP_CORPUS_DIR
+#define SIP_CORPUS_DIR "sip_corpus"
+#endif
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+  do {                                                                      \
+    if (!(cond)) {                                                          \
+      std::cerr << "FAILED " << __LINE__ << ": " << #cond << std::endl;     \
+      ++failures;                                                           \
+    }                                                                       \
+  } while (0)
+
+// Same codec ids and order as Voip::update_sip_offer() with PCMA configured
+enum { PCMU, PCMA, G726_32, G726_24, G726_40, G722 };
+static const SdpCodec OFFER[] = {
+    {PCMA, 8, "PCMA", 8000},        {PCMU, 0, "PCMU", 8000},        {G726_32, 96, "G726-32", 8000},
+    {G726_24, 97, "G726-24", 8000}, {G726_40, 98, "G726-40", 8000}, {G722, 9, "G722", 8000},
+};
+static const size_t OFFER_COUNT = sizeof(OFFER) / sizeof(OFFER[0]);
+
+static uint32_t ip(int a, int b, int c, int d) { return (uint32_t)(a << 24 | b << 16 | c << 8 | d); }
+
+static bool negotiate(const std::string &sdp, SdpNegotiation *out, uint8_t ptime = 20) {
+  SdpMedia media;
+  return media.parse(sdp.data(), sdp.size()) && sdp_negotiate(media, OFFER, OFFER_COUNT, ptime, out);
+}
+
+static std::string sdp(const char *media_lines, const char *session_lines = "") {
+  return std::string("v=0\r\no=- 1 1 IN IP4 10.0.0.1\r\ns=-\r\nc=IN IP4 10.0.0.1\r\nt=0 0\r\n") + session_lines +
+         media_lines;
+}
+
+static void test_fritzbox_answer() {
+  std::ifstream in(SIP_CORPUS_DIR "/fritzbox_183_progress.sip", std::ios::binary);
+  std::string msg((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  SipParser p;
+  CHECK(p.parse(msg.data(), msg.size()));
+  SdpMedia media;
+  CHECK(media.parse(p.ptr(p.body()), p.body().length));
+  CHECK(media.address == ip(192, 168, 178, 1));
+  CHECK(media.port == 7078);
+  CHECK(media.direction == SDP_SENDRECV);
+  CHECK(media.ptime == 20 && media.maxptime == 0);
+  CHECK(media.format_count == 3);
+  CHECK(media.formats[0].payload_type == 8 && strcmp(media.formats[0].encoding, "PCMA") == 0);
+  CHECK(media.formats[0].clock_rate == 8000 && media.formats[0].channels == 1);
+  const SdpFormat *te = media.find(101);
+  CHECK(te != nullptr && strcmp(te->encoding, "telephone-event") == 0);
+  CHECK(media.find(9) == nullptr);
+
+  SdpNegotiation n;
+  CHECK(sdp_negotiate(media, OFFER, OFFER_COUNT, 20, &n));
+  CHECK(n.codec == PCMA && n.payload_type == 8 && n.ptime == 20);
+  CHECK(n.send && n.recv);
+  CHECK(n.address == ip(192, 168, 178, 1) && n.port == 7078);
+}
+
+static void test_codec_selection() {
+  SdpNegotiation n;
+  // the answerer's order decides, not ours
+  CHECK(negotiate(sdp("m=audio 4000 RTP/AVP 0 8\r\n"), &n));
+  CHECK(n.codec == PCMU && n.payload_type == 0);
+  // a dynamic payload type is matched by name and clock rate, and its number taken from the answer
+  CHECK(negotiate(sdp("m=audio 4000 RTP/AVP 110 8\r\na=rtpmap:110 g726-24/8000\r\n"), &n));
+  CHECK(n.codec == G726_24 && n.payload_type == 110);
+  // wrong clock rate, then unknown codec, then a static type we do know
+  CHECK(negotiate(sdp("m=audio 4000 RTP/AVP 96 97 0\r\na=rtpmap:96 G726-32/16000\r\na=rtpmap:97 opus/48000/2\r\n"),
+                  &n));
+  CHECK(n.codec == PCMU);
+  // a static number remapped by rtpmap is matched by its name
+  CHECK(negotiate(sdp("m=audio 4000 RTP/AVP 0\r\na=rtpmap:0 PCMA/8000\r\n"), &n));
+  CHECK(n.codec == PCMA && n.payload_type == 0);
+  // G.722 names an 8000 Hz clock although it samples at 16 kHz (RFC 3551 section 4.5.2)
+  CHECK(negotiate(sdp("m=audio 4000 RTP/AVP 9 8\r\n"), &n));
+  CHECK(n.codec == G722 && n.payload_type == 9);
+  CHECK(negotiate(sdp("m=audio 4000 RTP/AVP 9 8\r\na=rtpmap:9 G722/16000\r\n"), &n));
+  CHECK(n.codec == PCMA);
+  // nothing in common, rejected stream, no RTP/AVP
+  CHECK(!negotiate(sdp("m=audio 4000 RTP/AVP 18 3\r\n"), &n));
+  CHECK(!negotiate(sdp("m=audio 0 RTP/AVP 8\r\n"), &n));
+  CHECK(!negotiate(sdp("m=audio 4000 RTP/SAVP 8\r\n"), &n));
+  // only the first audio stream counts
+  CHECK(negotiate(sdp("m=video 5000 RTP/AVP 99\r\nc=IN IP4 10.9.9.9\r\na=ptime:60\r\n"
+                      "m=audio 4002 RTP/AVP 0\r\nm=audio 4004 RTP/AVP 8\r\n"),
+                  &n));
+  CHECK(n.codec == PCMU && n.port == 4002 && n.ptime == 20 && n.address == ip(10, 0, 0, 1));
+  SdpMedia media;
+  CHECK(!media.parse("v=0\r\nm=video 5000 RTP/AVP 99\r\n", 30));
+}
+
+static void test_ptime_and_direction() {
+  SdpNegotiation n;
+  CHECK(negotiate(sdp("m=audio 4000 RTP/AVP 8\r\na=ptime:30\r\n"), &n));
+  CHECK(n.ptime == 30);
+  // our ptime without one in the answer, limited by maxptime and to whole 10 ms
+  CHECK(negotiate(sdp("m=audio 4000 RTP/AVP 8\r\na=maxptime:40\r\n"), &n, 60));
+  CHECK(n.ptime == 40);
+  CHECK(negotiate(sdp("m=audio 4000 RTP/AVP 8\r\n", "a=ptime:25\r\n"), &n));
+  CHECK(n.ptime == 20);
+  CHECK(negotiate(sdp("m=audio 4000 RTP/AVP 8\r\na=ptime:5\r\n"), &n));
+  CHECK(n.ptime == 10);
+  CHECK(negotiate(sdp("m=audio 4000 RTP/AVP 8\r\na=ptime:120\r\n"), &n));
+  CHECK(n.ptime == 60);
+
+  // RTCP on the next port unless a=rtcp says otherwise (RFC 3605)
+  CHECK(negotiate(sdp("m=audio 4000 RTP/AVP 8\r\n"), &n));
+  CHECK(n.rtcp_port == 4001);
+  CHECK(negotiate(sdp("m=audio 4000 RTP/AVP 8\r\na=rtcp:4011 IN IP4 10.0.0.1\r\n"), &n));
+  CHECK(n.rtcp_port == 4011);
+
+  // the answer's direction is the far end's view
+  CHECK(negotiate(sdp("m=audio 4000 RTP/AVP 8\r\na=sendonly\r\n"), &n));
+  CHECK(!n.send && n.recv);
+  CHECK(negotiate(sdp("m=audio 4000 RTP/AVP 8\r\n", "a=recvonly\r\n"), &n));
+  CHECK(n.send && !n.recv);
+  // media level overrides the session level
+  CHECK(negotiate(sdp("m=audio 4000 RTP/AVP 8\r\na=sendrecv\r\n", "a=inactive\r\n"), &n));
+  CHECK(n.send && n.recv);
+  CHECK(negotiate(sdp("m=audio 4000 RTP/AVP 8\r\na=inactive\r\n"), &n));
+  CHECK(!n.send && !n.recv);
+  // old-style hold
+  CHECK(negotiate(sdp("m=audio 4000 RTP/AVP 8\r\nc=IN IP4 0.0.0.0\r\n"), &n));
+  CHECK(!n.send && n.recv && n.address == 0);
+  // media-level c= wins, IPv6 is not usable for sending
+  CHECK(negotiate(sdp("m=audio 4000 RTP/AVP 8\r\nc=IN IP4 172.16.0.9/127\r\n"), &n));
+  CHECK(n.address == ip(172, 16, 0, 9) && n.send);
+  CHECK(negotiate(sdp("m=audio 4000 RTP/AVP 8\r\nc=IN IP6 ::1\r\n"), &n));
+  CHECK(!n.send);
+  // LF line endings and fmtp
+  SdpMedia media;
+  std::string lf = "v=0\nc=IN IP4 10.1.2.3\nm=audio 7000 RTP/AVP 101 8\na=rtpmap:101 telephone-event/8000\n"
+                   "a=fmtp:101 0-16\n";
+  CHECK(media.parse(lf.data(), lf.size()));
+  CHECK(media.address == ip(10, 1, 2, 3) && media.port == 7000 && media.format_count == 2);
+  CHECK(strcmp(media.find(101)->fmtp, "0-16") == 0);
+}
+
+static void test_offer_round_trip() {
+  char buf[1024];
+  SipMessage m(buf, sizeof(buf));
+  m.line("INVITE sip:611@10.0.0.1 SIP/2.0").line("Content-Type: application/sdp");
+  m.begin_body();
+  sdp_write_offer(m, "192.168.178.42", 5004, 123456789, OFFER, OFFER_COUNT, 40);
+  CHECK(m.finish());
+  SipParser p;
+  CHECK(p.parse(m.data(), m.size()));
+  CHECK(atoi(p.ptr(p.header(SIP_HDR_CONTENT_LENGTH))) == p.body().length);
+  std::string body(p.ptr(p.body()), p.body().length);
+  CHECK(body.find("m=audio 5004 RTP/AVP 8 0 96 97 98 9\r\n") != std::string::npos);
+  CHECK(body.find("a=rtpmap:97 G726-24/8000\r\n") != std::string::npos);
+  CHECK(body.find("a=rtpmap:9 G722/8000\r\n") != std::string::npos);
+  CHECK(body.find("o=- 123456789 123456789 IN IP4 192.168.178.42\r\n") != std::string::npos);
+
+  // our own offer, read back as if it were the answer
+  SdpMedia media;
+  CHECK(media.parse(body.data(), body.size()));
+  CHECK(media.address == ip(192, 168, 178, 42) && media.port == 5004 && media.ptime == 40);
+  CHECK(media.format_count == OFFER_COUNT && media.direction == SDP_SENDRECV);
+  for (size_t i = 0; i < OFFER_COUNT; i++) {
+    CHECK(media.formats[i].payload_type == OFFER[i].payload_type);
+    CHECK(strcmp(media.formats[i].encoding, OFFER[i].encoding) == 0);
+  }
+  SdpNegotiation n;
+  CHECK(sdp_negotiate(media, OFFER, OFFER_COUNT, 20, &n));
+  CHECK(n.codec == PCMA && n.ptime == 40);
+}
+
+// Answering an incoming offer: the offerer's order and payload types win, the direction mirrors it
+static void test_answer() {
+  std::string offer = sdp("m=audio 7078 RTP/AVP 0 101 97\r\n"
+                          "a=rtpmap:101 telephone-event/8000\r\na=rtpmap:97 G726-24/8000\r\n"
+                          "a=ptime:30\r\na=sendonly\r\n");
+  SdpNegotiation n;
+  CHECK(negotiate(offer, &n));
+  CHECK(n.codec == PCMU && n.payload_type == 0 && n.ptime == 30);
+  CHECK(!n.send && n.recv);
+
+  char buf[1024];
+  SipMessage m(buf, sizeof(buf));
+  m.line("SIP/2.0 200 OK").line("Content-Type: application/sdp");
+  m.begin_body();
+  sdp_write_answer(m, "192.168.178.42", 5004, 42, OFFER[1], n);
+  CHECK(m.finish());
+  SipParser p;
+  CHECK(p.parse(m.data(), m.size()));
+  std::string body(p.ptr(p.body()), p.body().length);
+  CHECK(body.find("m=audio 5004 RTP/AVP 0\r\n") != std::string::npos);
+  CHECK(body.find("a=rtpmap:0 PCMU/8000\r\n") != std::string::npos);
+  CHECK(body.find("a=recvonly\r\n") != std::string::npos);
+  CHECK(body.find("a=ptime:30\r\n") != std::string::npos);
+
+  // the offerer reads it back as an answer and agrees on the same format
+  SdpMedia media;
+  CHECK(media.parse(body.data(), body.size()));
+  CHECK(media.format_count == 1 && media.direction == SDP_RECVONLY);
+  SdpNegotiation back;
+  CHECK(sdp_negotiate(media, OFFER, OFFER_COUNT, 20, &back));
+  CHECK(back.codec == PCMU && back.payload_type == 0 && back.send && !back.recv);
+
+  // a dynamic payload type is answered with the offerer's number
+  CHECK(negotiate(sdp("m=audio 7078 RTP/AVP 97\r\na=rtpmap:97 G726-24/8000\r\n"), &n));
+  CHECK(n.codec == G726_24 && n.payload_type == 97);
+  m.clear();
+  m.begin_body();
+  sdp_write_answer(m, "10.0.0.2", 5004, 42, OFFER[3], n);
+  CHECK(m.finish());
+  body.assign(m.data(), m.size());
+  CHECK(body.find("a=rtpmap:97 G726-24/8000\r\n") != std::string::npos);
+  CHECK(body.find("a=sendrecv\r\n") != std::string::npos);
+}
+
+// Comfort noise for DTX: offered as CN/8000, taken from the remote side by name or static type 13,
+// and answered only when negotiated
+static void test_comfort_noise() {
+  char buf[1024];
+  SipMessage m(buf, sizeof(buf));
+  m.begin_body();
+  sdp_write_offer(m, "192.168.178.42", 5004, 1, OFFER, 2, 20, true);
+  CHECK(m.finish());
+  std::string body(m.data(), m.size());
+  CHECK(body.find("m=audio 5004 RTP/AVP 8 0 13\r\n") != std::string::npos);
+  CHECK(body.find("a=rtpmap:13 CN/8000\r\n") != std::string::npos);
+  SdpMedia media;
+  SdpNegotiation n;
+  CHECK(media.parse(body.data(), body.size()) && sdp_negotiate(media, OFFER, OFFER_COUNT, 20, &n));
+  CHECK(n.codec == PCMA && n.cn_payload_type == 13);
+
+  CHECK(negotiate(sdp("m=audio 7078 RTP/AVP 0 13 101\r\na=rtpmap:101 telephone-event/8000\r\n"), &n));
+  CHECK(n.codec == PCMU && n.cn_payload_type == 13);
+  // a dynamic type by name; CN at another clock rate is of no use to us
+  CHECK(negotiate(sdp("m=audio 7078 RTP/AVP 8 118 13\r\na=rtpmap:118 CN/16000\r\na=rtpmap:13 cn/8000\r\n"), &n));
+  CHECK(n.cn_payload_type == 13);
+  CHECK(negotiate(sdp("m=audio 7078 RTP/AVP 8 105\r\na=rtpmap:105 CN/8000\r\n"), &n));
+  CHECK(n.cn_payload_type == 105);
+  m.clear();
+  m.begin_body();
+  sdp_write_answer(m, "10.0.0.2", 5004, 42, OFFER[0], n);
+  CHECK(m.finish());
+  body.assign(m.data(), m.size());
+  CHECK(body.find("m=audio 5004 RTP/AVP 8 105\r\n") != std::string::npos);
+  CHECK(body.find("a=rtpmap:105 CN/8000\r\n") != std::string::npos);
+  // without it, nothing changes
+  CHECK(negotiate(sdp("m=audio 7078 RTP/AVP 8\r\n"), &n));
+  CHECK(n.cn_payload_type == 0);
+  m.clear();
+  m.begin_body();
+  sdp_write_answer(m, "10.0.0.2", 5004, 42, OFFER[0], n);
+  CHECK(m.finish());
+  body.assign(m.data(), m.size());
+  CHECK(body.find("CN/8000") == std::string::npos);
+}
+
+// Truncated and corrupted bodies must neither crash nor produce out-of-range values
+static void test_garbage() {
+  std::string base = sdp("m=audio 4000 RTP/AVP 110 8 0 96 97 98 99 100 101 102 103 104 105 106 107 108 109 111\r\n"
+                         "a=rtpmap:110 G726-32/8000\r\na=fmtp:110 a-very-long-parameter-list-that-is-truncated\r\n"
+                         "a=ptime:20\r\n");
+  SdpMedia media;
+  CHECK(media.parse(base.data(), base.size()));
+  CHECK(media.format_count == SDP_MAX_FORMATS);
+  CHECK(strlen(media.find(110)->fmtp) == sizeof(media.formats[0].fmtp) - 1);
+  uint32_t state = 1;
+  for (int it = 0; it < 20000; it++) {
+    std::string s = base;
+    for (int k = 0; k < 4; k++) {
+      state = state * 1103515245 + 12345;
+      size_t pos = (state >> 8) % s.size();
+      s[pos] = "0123456789 /:=\r\nam"[(state >> 20) % 18];
+    }
+    s.resize((state >> 4) % (s.size() + 1));
+    if (!media.parse(s.data(), s.size()))
+      continue;
+    CHECK(media.format_count <= SDP_MAX_FORMATS);
+    for (uint8_t i = 0; i < media.format_count; i++) {
+      CHECK(media.formats[i].payload_type < 128);
+      CHECK(strlen(media.formats[i].encoding) < sizeof(media.formats[i].encoding));
+    }
+    SdpNegotiation n;
+    if (sdp_negotiate(media, OFFER, OFFER_COUNT, 20, &n))
+      CHECK(n.ptime >= SDP_MIN_PTIME && n.ptime <= SDP_MAX_PTIME && n.ptime % 10 == 0);
+  }
+}
+
+// Packet rate and on-air bitrate per codec and ptime: 20 bytes IPv4 + 8 UDP + 12 RTP per packet
+static void print_airtime() {
+  struct {
+    const char *name;
+    unsigned bits_per_sample;
+  } codecs[] = {{"G.711", 8}, {"G.722", 8}, {"G726-40", 5}, {"G726-32", 4}, {"G726-24", 3}};
+  printf("kbit/s incl. IP/UDP/RTP headers, one direction:\n  ptime  packets/s");
+  for (auto &c : codecs)
+    printf("  %8s", c.name);
+  printf("\n");
+  for (unsigned ptime = 10; ptime <= 60; ptime += 10) {
+    double pps = 1000.0 / ptime;
+    printf("  %3u ms  %9.1f", ptime, pps);
+    for (auto &c : codecs) {
+      unsigned payload = 8 * ptime * c.bits_per_sample / 8;
+      printf("  %8.1f", (payload + 40) * 8 * pps / 1000);
+    }
+    printf("\n");
+  }
+}
+
+int main() {
+  test_fritzbox_answer();
+  test_codec_selection();
+  test_ptime_and_direction();
+  test_offer_round_trip();
+  test_answer();
+  test_comfort_noise();
+  test_garbage();
+  print_airtime();
+
+  if (failures) {
+    std::cerr << failures << " tests failed" << std::endl;
+    return 1;
+  }
+  std::cout << "All tests passed." << std::endl;
+  return 0;
+}
@@ -0,0 +1,774 @@
+// Several calls at once over real UDP sockets on 127.0.0.1. The device side is assembled from the
+// dialog table, the RTP port pool, the transaction layer and SDP the way Sip uses them; a stand-in
+// PBX places and takes calls, answers or rejects them, cancels, hangs up and loses datagrams. The
+// clock is virtual and steps in 10 ms like Sip::loop(), so minutes of calls take a fraction of a
+// second. An optional argument sets the number of lookups of the Call-ID benchmark.
+#include "../rtp.h"
+#include "../sdp.h"
+#include "../sip_dialog.h"
+#include "../sip_message.h"
+#include "../sip_parser.h"
+#include "../sip_transaction.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace esphome::voip;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+  do {                                                                      \
+    if (!(cond)) {                                                          \
+      std::cerr << "FAILED " << __LINE__ << ": " << #cond << std::endl;     \
+      ++failures;                                                           \
+    }                                                                       \
+  } while (0)
+
+static const uint32_t LOOPBACK = 0x7F000001;
+static const uint16_t RTP_FIRST = 40000;
+static const SdpCodec CODECS[] = {{1, 8, "PCMA", 8000}, {0, 0, "PCMU", 8000}};
+
+static uint32_t lcg_state = 12345;
+static uint32_t lcg() { return lcg_state = lcg_state * 1103515245u + 12345u; }
+// true with probability 1/n
+static bool chance(uint32_t n) { return (lcg() >> 8) % n == 0; }
+
+// Non-blocking UDP socket on an ephemeral loopback port
+struct UdpSocket {
+  int fd = -1;
+  uint16_t port = 0;
+
+  UdpSocket() {
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        getsockname(fd, (struct sockaddr *)&addr, &len) != 0) {
+      std::cerr << "cannot bind a UDP socket on 127.0.0.1" << std::endl;
+      exit(1);
+    }
+    port = ntohs(addr.sin_port);
+  }
+  ~UdpSocket() { close(fd); }
+
+  void send(uint16_t to, const std::string &data) const {
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(LOOPBACK);
+    addr.sin_port = htons(to);
+    sendto(fd, data.data(), data.size(), 0, (struct sockaddr *)&addr, sizeof(addr));
+  }
+  // loopback delivery is synchronous, so everything sent so far is already queued
+  std::vector<std::string> receive() const {
+    std::vector<std::string> out;
+    char buf[2048];
+    for (;;) {
+      ssize_t n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+      if (n <= 0)
+        break;
+      out.emplace_back(buf, (size_t)n);
+    }
+    return out;
+  }
+};
+
+static std::string header(const std::string &msg, const char *name) {
+  std::string key = std::string("\r\n") + name + ": ";
+  size_t p = msg.find(key);
+  if (p == std::string::npos)
+    return "";
+  p += key.size();
+  return msg.substr(p, msg.find("\r\n", p) - p);
+}
+
+static std::string sdp(uint16_t port) {
+  return "v=0\r\no=pbx 1 1 IN IP4 127.0.0.1\r\ns=-\r\nc=IN IP4 127.0.0.1\r\nt=0 0\r\nm=audio " + std::to_string(port) +
+         " RTP/AVP 8 0\r\na=rtpmap:8 PCMA/8000\r\na=rtpmap:0 PCMU/8000\r\na=ptime:20\r\n";
+}
+
+static void copy_headers(const SipParser &req, uint32_t tag, SipMessage &m) {
+  static const SipHeader COPY[] = {SIP_HDR_VIA, SIP_HDR_FROM, SIP_HDR_TO, SIP_HDR_CALL_ID, SIP_HDR_CSEQ};
+  for (SipHeader h : COPY) {
+    SipSpan v = req.header(h);
+    m.str(sip_header_name(h)).str(": ").str(req.ptr(v), v.length);
+    if (h == SIP_HDR_TO && tag != 0 && req.param(v, "tag").empty())
+      m.str(";tag=").unum(tag);
+    m.crlf();
+  }
+}
+
+// The device: Sip's call handling reduced to what the table, the port pool and the transaction
+// layer have to cope with
+struct Device {
+  UdpSocket sock;
+  SipTransactionLayer txns;
+  SipDialogTable calls;
+  RtpPortPool ports;
+  uint16_t pbx_port = 0;
+  uint32_t now = 1000;
+  uint32_t tags = 0;
+  char buf[SipTransactionLayer::BUFFER_SIZE];
+  SipMessage out{buf, sizeof(buf)};
+  // statistics
+  uint32_t placed = 0;
+  uint32_t refused = 0;  // dial() with every slot or port in use
+  uint32_t answered = 0;
+  uint32_t confirmed = 0;
+  uint32_t busy_sent = 0;
+  uint32_t missed = 0;
+  uint32_t txn_full = 0;
+  size_t max_txns = 0;
+  size_t max_calls_seen = 0;
+
+  explicit Device(size_t max_calls) {
+    calls.allocate(max_calls);
+    // sized as in Sip::init()
+    txns.set_capacity(SipTransactionLayer::MAX_TRANSACTIONS + 4 * (max_calls - 1));
+    ports.configure(RTP_FIRST, RTP_FIRST + 4 * max_calls - 1);
+    txns.set_send_callback(
+        [this](const SipEndpoint &to, const char *data, size_t len) { sock.send(to.port, std::string(data, len)); });
+    txns.set_timeout_callback([this](uint32_t id, SipMethod) {
+      SipDialog *call = calls.find_transaction(id);
+      if (call == nullptr)
+        return;
+      if (call->state == SIP_DIALOG_CONFIRMED && id == call->server_txn)
+        this->request(call, "BYE", ++call->local_cseq);
+      this->end(call);
+    });
+    txns.reset(now);
+  }
+
+  uint32_t send(bool ack = false) {
+    out.finish();
+    uint32_t id = txns.send_request({LOOPBACK, pbx_port}, out.data(), out.size(), now);
+    if (id == 0 && !ack)
+      txn_full++;
+    if (txns.active() > max_txns)
+      max_txns = txns.active();
+    return id;
+  }
+  void via() { out.str("Via: SIP/2.0/UDP 127.0.0.1:").unum(sock.port).str(";branch=z9hG4bK").hex(lcg(), 8).crlf(); }
+  uint32_t request(SipDialog *call, const char *method, int cseq) {
+    out.clear();
+    out.str(method).str(" sip:").str(call->peer).line("@127.0.0.1 SIP/2.0");
+    via();
+    out.line(call->headers);
+    out.str("CSeq: ").num(cseq).chr(' ').line(method);
+    out.begin_body();
+    return send(strcmp(method, "ACK") == 0);
+  }
+  void reply(uint32_t txn, const SipParser &req, int status, const char *reason, uint32_t tag) {
+    out.clear();
+    out.str("SIP/2.0 ").num(status).chr(' ').line(reason);
+    copy_headers(req, tag, out);
+    out.begin_body();
+    out.finish();
+    txns.respond(txn, status, out.data(), out.size(), now);
+  }
+  void respond_incoming(SipDialog *call, int status, const char *reason, bool with_sdp) {
+    out.clear();
+    out.str("SIP/2.0 ").num(status).chr(' ').line(reason);
+    out.str(call->response_headers);
+    out.str("Contact: <sip:door@127.0.0.1:").unum(sock.port).line(">");
+    if (with_sdp) {
+      out.line("Content-Type: application/sdp");
+      out.begin_body();
+      sdp_write_answer(out, "127.0.0.1", call->rtp_port, call->local_tag, CODECS[call->offer.codec == 1 ? 0 : 1],
+                       call->offer);
+    } else {
+      out.begin_body();
+    }
+    out.finish();
+    CHECK(txns.respond(call->server_txn, status, out.data(), out.size(), now));
+  }
+  void end(SipDialog *call) {
+    ports.release(call->rtp_port);
+    calls.release(call);
+  }
+
+  uint32_t dial(const char *number) {
+    uint16_t port = calls.full() ? 0 : ports.acquire();
+    if (port == 0) {
+      refused++;
+      return 0;
+    }
+    SipDialog *call = calls.create(SIP_DIALOG_CALLING, true, now);
+    call->rtp_port = port;
+    call->local_tag = ++tags;
+    call->local_cseq = 1;
+    snprintf(call->peer, sizeof(call->peer), "%s", number);
+    snprintf(call->call_id, sizeof(call->call_id), "dev%u@127.0.0.1", (unsigned)call->id);
+    snprintf(call->headers, sizeof(call->headers), "Call-ID: %s\r\nFrom: <sip:door@127.0.0.1>;tag=%u\r\nTo: <sip:%s@127.0.0.1>",
+             call->call_id, (unsigned)call->local_tag, number);
+    out.clear();
+    out.str("INVITE sip:").str(number).line("@127.0.0.1 SIP/2.0");
+    via();
+    out.line(call->headers);
+    out.line("CSeq: 1 INVITE");
+    out.str("Contact: <sip:door@127.0.0.1:").unum(sock.port).line(">");
+    out.line("Content-Type: application/sdp");
+    out.begin_body();
+    sdp_write_offer(out, "127.0.0.1", port, call->local_tag, CODECS, 2, 20);
+    call->invite_txn = send();
+    if (call->invite_txn == 0) {
+      end(call);
+      return 0;
+    }
+    placed++;
+    return call->id;
+  }
+  void answer(SipDialog *call) {
+    respond_incoming(call, 200, "OK", true);
+    call->state = SIP_DIALOG_CONFIRMED;
+    answered++;
+  }
+  void hangup(SipDialog *call) {
+    switch (call->state) {
+      case SIP_DIALOG_RINGING:
+        respond_incoming(call, 603, "Decline", false);
+        end(call);
+        break;
+      case SIP_DIALOG_CONFIRMED:
+        request(call, "BYE", ++call->local_cseq);
+        end(call);
+        break;
+      case SIP_DIALOG_CALLING:
+        // CANCEL once the INVITE got a provisional response
+        call->cancelled = true;
+        call->state = SIP_DIALOG_TERMINATING;
+        if (txns.get_state(call->invite_txn) == SIP_TXN_PROCEEDING)
+          call->cancel_txn = txns.cancel(call->invite_txn, now);
+        break;
+      default:
+        break;
+    }
+  }
+
+  void on_invite_response(SipDialog *call, const SipParser &msg) {
+    int status = msg.get_status();
+    if (status < 200) {
+      if (call->cancelled && call->cancel_txn == 0)
+        call->cancel_txn = txns.cancel(call->invite_txn, now);
+      return;
+    }
+    if (status >= 300) {
+      end(call);
+      return;
+    }
+    SipSpan to = msg.header(SIP_HDR_TO);
+    snprintf(call->headers, sizeof(call->headers), "Call-ID: %s\r\nFrom: <sip:door@127.0.0.1>;tag=%u\r\nTo: %.*s",
+             call->call_id, (unsigned)call->local_tag, (int)to.length, msg.ptr(to));
+    request(call, "ACK", 1);
+    if (call->cancelled) {
+      // the 200 crossed our CANCEL
+      request(call, "BYE", ++call->local_cseq);
+      end(call);
+      return;
+    }
+    SdpMedia media;
+    SdpNegotiation negotiated;
+    SipSpan body = msg.body();
+    CHECK(media.parse(msg.ptr(body), body.length) && sdp_negotiate(media, CODECS, 2, 20, &negotiated));
+    call->state = SIP_DIALOG_CONFIRMED;
+    confirmed++;
+  }
+  void on_invite(uint32_t txn, const SipParser &msg) {
+    uint16_t port = calls.full() ? 0 : ports.acquire();
+    if (port == 0) {
+      reply(txn, msg, 486, "Busy Here", ++tags);
+      busy_sent++;
+      return;
+    }
+    SipDialog *call = calls.create(SIP_DIALOG_RINGING, false, now);
+    call->rtp_port = port;
+    call->server_txn = txn;
+    call->local_tag = ++tags;
+    SipSpan call_id = msg.header(SIP_HDR_CALL_ID);
+    SipSpan from = msg.header(SIP_HDR_FROM);
+    SipSpan to = msg.header(SIP_HDR_TO);
+    snprintf(call->call_id, sizeof(call->call_id), "%.*s", (int)call_id.length, msg.ptr(call_id));
+    snprintf(call->peer, sizeof(call->peer), "pbx");
+    snprintf(call->headers, sizeof(call->headers), "Call-ID: %s\r\nFrom: %.*s;tag=%u\r\nTo: %.*s", call->call_id,
+             (int)to.length, msg.ptr(to), (unsigned)call->local_tag, (int)from.length, msg.ptr(from));
+    SipMessage headers(call->response_headers, sizeof(call->response_headers));
+    copy_headers(msg, call->local_tag, headers);
+    CHECK(!headers.overflowed());
+    SdpMedia media;
+    SipSpan body = msg.body();
+    CHECK(media.parse(msg.ptr(body), body.length) && sdp_negotiate(media, CODECS, 2, 20, &call->offer));
+    respond_incoming(call, 180, "Ringing", false);
+  }
+
+  void pump() {
+    for (const std::string &d : sock.receive()) {
+      SipParser msg;
+      if (!msg.parse(d.data(), d.size()))
+        continue;
+      uint32_t id = 0;
+      if (msg.is_response()) {
+        if (!txns.on_response(msg, now, &id))
+          continue;
+        SipDialog *call = calls.find_transaction(id);
+        if (call == nullptr)
+          call = calls.find(msg);
+        bool invite = header(d, "CSeq").find("INVITE") != std::string::npos;
+        if (call != nullptr && invite && id == call->invite_txn) {
+          on_invite_response(call, msg);
+        }
+        continue;
+      }
+      if (!txns.on_request(msg, SipEndpoint{LOOPBACK, pbx_port}, now, &id))
+        continue;
+      SipDialog *call = msg.get_method() == SIP_METHOD_ACK ? calls.find_transaction(id) : calls.find(msg);
+      if (id == 0) {
+        if (msg.get_method() != SIP_METHOD_ACK)
+          txn_full++;
+        else if (call != nullptr)
+          call->server_txn = 0;
+        continue;
+      }
+      switch (msg.get_method()) {
+        case SIP_METHOD_INVITE:
+          if (call != nullptr) {
+            reply(id, msg, 491, "Request Pending", call->local_tag);
+          } else {
+            on_invite(id, msg);
+          }
+          break;
+        case SIP_METHOD_CANCEL:
+          reply(id, msg, 200, "OK", call != nullptr ? call->local_tag : 0);
+          if (call != nullptr && call->state == SIP_DIALOG_RINGING) {
+            respond_incoming(call, 487, "Request Terminated", false);
+            end(call);
+            missed++;
+          }
+          break;
+        case SIP_METHOD_BYE:
+          reply(id, msg, call != nullptr ? 200 : 481, call != nullptr ? "OK" : "Call Does Not Exist", 0);
+          if (call != nullptr)
+            end(call);
+          break;
+        default:
+          reply(id, msg, 405, "Method Not Allowed", 0);
+          break;
+      }
+    }
+  }
+
+  // every call holds one slot and one port until it ends, and no two calls share either
+  void check() {
+    std::set<uint16_t> used_ports;
+    std::set<std::string> call_ids;
+    size_t live = 0;
+    for (size_t i = 0; i < calls.capacity(); i++) {
+      const SipDialog *call = calls.at(i);
+      if (call == nullptr)
+        continue;
+      live++;
+      CHECK(call->rtp_port >= RTP_FIRST && call->rtp_port % 2 == 0);
+      CHECK(used_ports.insert(call->rtp_port).second);
+      CHECK(call_ids.insert(call->call_id).second);
+      CHECK(calls.find(call->id) == call);
+    }
+    CHECK(live == calls.size());
+    CHECK(calls.size() <= calls.capacity());
+    CHECK(ports.size() - ports.available() == calls.size());
+    if (calls.size() > max_calls_seen)
+      max_calls_seen = calls.size();
+  }
+};
+
+// The far end. Requests are answered straight from the socket; a retransmitted INVITE gets the last
+// response again, as a transaction layer would. Datagrams from the device are lost at random.
+struct Pbx {
+  enum State { RINGING, CANCELLING, UP, DONE };
+  struct Call {
+    bool to_device = false;  // placed by the PBX
+    State state = RINGING;
+    std::string invite;
+    std::string branch;  // of our INVITE
+    std::string tag;     // ours
+    std::string last;    // last response to the device's INVITE
+    std::string from, to;
+    uint32_t answer_at = 0;
+    int outcome = 200;
+    int cseq = 1;
+  };
+  UdpSocket sock;
+  uint16_t device_port = 0;
+  uint32_t now = 1000;
+  uint32_t loss = 0;  // one in loss datagrams from the device is dropped, 0 for none
+  uint32_t seq = 0;
+  std::map<std::string, Call> calls;
+  uint32_t lost = 0;
+  uint32_t placed = 0;
+  uint32_t answered = 0;  // by the device
+  uint32_t rejected = 0;  // by the device
+
+  std::string response(const std::string &req, int status, const char *reason, const std::string &tag,
+                       const std::string &body = "") const {
+    std::string to = header(req, "To");
+    if (status > 100 && !tag.empty() && to.find(";tag=") == std::string::npos)
+      to += ";tag=" + tag;
+    std::string r = "SIP/2.0 " + std::to_string(status) + " " + reason + "\r\nVia: " + header(req, "Via") +
+                    "\r\nFrom: " + header(req, "From") + "\r\nTo: " + to + "\r\nCall-ID: " + header(req, "Call-ID") +
+                    "\r\nCSeq: " + header(req, "CSeq") + "\r\nContact: <sip:pbx@127.0.0.1:" + std::to_string(sock.port) +
+                    ">\r\n";
+    if (!body.empty())
+      r += "Content-Type: application/sdp\r\n";
+    return r + "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+  }
+  std::string request(const char *method, const std::string &call_id, const Call &c, int cseq, const std::string &branch,
+                      const std::string &body = "") const {
+    std::string r = std::string(method) + " sip:door@127.0.0.1:" + std::to_string(device_port) +
+                    " SIP/2.0\r\nVia: SIP/2.0/UDP 127.0.0.1:" + std::to_string(sock.port) + ";branch=" + branch +
+                    "\r\nFrom: " + c.from + "\r\nTo: " + c.to + "\r\nCall-ID: " + call_id + "\r\nCSeq: " +
+                    std::to_string(cseq) + " " + method + "\r\nMax-Forwards: 70\r\n";
+    if (!body.empty())
+      r += "Content-Type: application/sdp\r\n";
+    return r + "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+  }
+  std::string branch() { return "z9hG4bKpbx" + std::to_string(++seq); }
+
+  void call_device() {
+    std::string call_id = "pbx" + std::to_string(++seq) + "@127.0.0.1";
+    Call &c = calls[call_id];
+    c.to_device = true;
+    c.tag = "p" + std::to_string(seq);
+    c.from = "<sip:pbx@127.0.0.1>;tag=" + c.tag;
+    c.to = "<sip:door@127.0.0.1>";
+    c.branch = branch();
+    c.invite = request("INVITE", call_id, c, 1, c.branch, sdp(30000));
+    sock.send(device_port, c.invite);
+    placed++;
+  }
+  void cancel(const std::string &call_id, Call &c) {
+    // same branch as the INVITE (RFC 3261 9.1)
+    std::string r = request("CANCEL", call_id, c, 1, c.branch);
+    sock.send(device_port, r);
+    c.state = CANCELLING;
+  }
+  void bye(const std::string &call_id, Call &c) {
+    sock.send(device_port, request("BYE", call_id, c, ++c.cseq, branch()));
+    c.state = DONE;
+  }
+  void ack(const std::string &call_id, const Call &c, bool success, const std::string &to) {
+    Call a = c;
+    a.to = to;
+    // a 2xx is ACKed in a transaction of its own, a failure in the INVITE's
+    sock.send(device_port, request("ACK", call_id, a, 1, success ? branch() : c.branch));
+  }
+
+  void pump() {
+    for (const std::string &d : sock.receive()) {
+      if (loss != 0 && chance(loss)) {
+        lost++;
+        continue;
+      }
+      SipParser msg;
+      if (!msg.parse(d.data(), d.size()))
+        continue;
+      std::string call_id = header(d, "Call-ID");
+      auto it = calls.find(call_id);
+      if (msg.is_response()) {
+        if (it == calls.end() || header(d, "CSeq").find("INVITE") == std::string::npos || msg.get_status() < 200)
+          continue;
+        Call &c = it->second;
+        bool success = msg.get_status() < 300;
+        ack(call_id, c, success, header(d, "To"));
+        if (success && c.state == RINGING) {
+          c.state = UP;
+          c.to = header(d, "To");
+          answered++;
+        } else if (success && c.state == CANCELLING) {
+          c.to = header(d, "To");
+          bye(call_id, c);
+        } else if (!success && (c.state == RINGING || c.state == CANCELLING)) {
+          c.state = DONE;
+          rejected++;
+        }
+        continue;
+      }
+      switch (msg.get_method()) {
+        case SIP_METHOD_INVITE: {
+          if (it != calls.end()) {
+            sock.send(device_port, it->second.last);
+            break;
+          }
+          Call &c = calls[call_id];
+          c.invite = d;
+          c.tag = "p" + std::to_string(++seq);
+          c.from = header(d, "To") + ";tag=" + c.tag;
+          c.to = header(d, "From");
+          c.answer_at = now + 100 + lcg() % 2000;
+          uint32_t r = lcg() % 10;
+          c.outcome = r < 7 ? 200 : (r < 9 ? 486 : 480);
+          c.last = response(d, 180, "Ringing", c.tag);
+          sock.send(device_port, c.last);
+          break;
+        }
+        case SIP_METHOD_CANCEL:
+          sock.send(device_port, response(d, 200, "OK", it != calls.end() ? it->second.tag : ""));
+          if (it != calls.end() && !it->second.to_device && it->second.state == RINGING) {
+            it->second.last = response(it->second.invite, 487, "Request Terminated", it->second.tag);
+            sock.send(device_port, it->second.last);
+            it->second.state = DONE;
+          }
+          break;
+        case SIP_METHOD_BYE:
+          sock.send(device_port, response(d, 200, "OK", ""));
+          if (it != calls.end())
+            it->second.state = DONE;
+          break;
+        default:
+          break;
+      }
+    }
+  }
+  void tick() {
+    for (auto &entry : calls) {
+      Call &c = entry.second;
+      if (c.to_device || c.state != RINGING || now < c.answer_at)
+        continue;
+      if (c.outcome == 200) {
+        c.last = response(c.invite, 200, "OK", c.tag, sdp(30002));
+        c.state = UP;
+      } else {
+        c.last = response(c.invite, c.outcome, c.outcome == 486 ? "Busy Here" : "Temporarily Unavailable", c.tag);
+        c.state = DONE;
+      }
+      sock.send(device_port, c.last);
+    }
+  }
+  size_t count(State state) const {
+    size_t n = 0;
+    for (const auto &entry : calls)
+      n += entry.second.state == state;
+    return n;
+  }
+};
+
+static void test_port_pool() {
+  RtpPortPool pool;
+  pool.configure(1234, 1241);
+  CHECK(pool.size() == 4 && pool.available() == 4);
+  std::set<uint16_t> ports;
+  for (int i = 0; i < 4; i++) {
+    uint16_t port = pool.acquire();
+    CHECK(port >= 1234 && port <= 1240 && port % 2 == 0);
+    ports.insert(port);
+  }
+  CHECK(ports.size() == 4);
+  CHECK(pool.acquire() == 0 && pool.available() == 0);
+  // a port given back is the last to be reused
+  pool.release(1236);
+  pool.release(1238);
+  CHECK(pool.acquire() == 1236);
+  pool.release(1234);
+  CHECK(pool.acquire() == 1238);
+  CHECK(pool.acquire() == 1234);
+  // foreign and odd ports are ignored
+  pool.release(1235);
+  pool.release(1300);
+  pool.release(1232);
+  CHECK(pool.available() == 0);
+
+  pool.configure(1235, 1236);
+  CHECK(pool.size() == 1 && pool.acquire() == 1236 && pool.acquire() == 0);
+  pool.configure(1236, 1236);
+  CHECK(pool.size() == 1);
+  pool.configure(1240, 1234);
+  CHECK(pool.size() == 0 && pool.acquire() == 0);
+  pool.configure(10000, 20000);
+  CHECK(pool.size() == RtpPortPool::MAX_PORTS);
+  for (size_t i = 0; i < RtpPortPool::MAX_PORTS; i++)
+    CHECK(pool.acquire() == 10000 + 2 * i);
+  CHECK(pool.acquire() == 0);
+}
+
+static void test_dialog_table() {
+  SipDialogTable table;
+  CHECK(table.allocate(3));
+  CHECK(table.capacity() == 3 && table.size() == 0 && !table.full());
+  SipDialog *a = table.create(SIP_DIALOG_RINGING, false, 100);
+  SipDialog *b = table.create(SIP_DIALOG_CALLING, true, 200);
+  SipDialog *c = table.create(SIP_DIALOG_RINGING, false, 300);
+  CHECK(a && b && c && a->id == 1 && b->id == 2 && c->id == 3);
+  CHECK(table.full() && table.create(SIP_DIALOG_CALLING, true, 400) == nullptr);
+  CHECK(table.oldest_ringing() == a);
+  strcpy(b->call_id, "b@127.0.0.1");
+  strcpy(c->call_id, "c@127.0.0.1");
+  b->invite_txn = 7;
+  c->server_txn = 9;
+  CHECK(table.find_transaction(7) == b && table.find_transaction(9) == c && table.find_transaction(0) == nullptr);
+  std::string msg = "BYE sip:door@127.0.0.1 SIP/2.0\r\nCall-ID: c@127.0.0.1\r\nCSeq: 2 BYE\r\n\r\n";
+  std::string prefix = "BYE sip:door@127.0.0.1 SIP/2.0\r\nCall-ID: c@127.0.0\r\nCSeq: 2 BYE\r\n\r\n";
+  SipParser parser;
+  CHECK(parser.parse(msg.data(), msg.size()) && table.find(parser) == c);
+  CHECK(parser.parse(prefix.data(), prefix.size()) && table.find(parser) == nullptr);
+
+  b->state = SIP_DIALOG_TERMINATING;
+  CHECK(table.active() == 2 && table.size() == 3);
+  table.release(a);
+  CHECK(table.size() == 2 && table.at(0) == nullptr && table.find(1) == nullptr);
+  CHECK(table.oldest_ringing() == c);
+  // the freed slot comes back cleared and under a new id
+  SipDialog *d = table.create(SIP_DIALOG_CALLING, true, 500);
+  CHECK(d == table.at(0) && d->id == 4 && d->call_id[0] == '\0' && d->start_ms == 500 && d->outgoing);
+  CHECK(table.find(4) == d && table.find(1) == nullptr);
+  table.release(d);
+  table.release(d);
+  CHECK(table.size() == 2);
+}
+
+// Places and takes calls at random for the given virtual time, then hangs up everything. load is the
+// traffic offered in percent of the slots: about 120 keeps every slot busy with some calls turned
+// away; far beyond that the transaction table runs out too, and only the invariants are checked.
+static void stress(size_t max_calls, uint32_t seconds, uint32_t loss, uint32_t load) {
+  Device dev(max_calls);
+  Pbx pbx;
+  dev.pbx_port = pbx.sock.port;
+  pbx.device_port = dev.sock.port;
+  pbx.loss = loss;
+  uint32_t steps = 0;
+  // steps between new calls in each direction
+  uint32_t interval = (uint32_t)(2 * 3200 * 100 / (load * max_calls));
+  uint32_t end = dev.now + seconds * 1000;
+  auto start = std::chrono::steady_clock::now();
+  auto step = [&](bool traffic) {
+    dev.now += 10;
+    pbx.now = dev.now;
+    steps++;
+    if (traffic) {
+      // calls last about 30 s; half the traffic in each direction
+      if (chance(interval))
+        dev.dial(chance(2) ? "201" : "202");
+      if (chance(interval))
+        pbx.call_device();
+      for (size_t i = 0; i < dev.calls.capacity(); i++) {
+        SipDialog *call = dev.calls.at(i);
+        if (call == nullptr)
+          continue;
+        if (call->state == SIP_DIALOG_RINGING && chance(100)) {
+          dev.answer(call);
+        } else if (call->state == SIP_DIALOG_RINGING && chance(400)) {
+          dev.hangup(call);
+        } else if (call->state == SIP_DIALOG_CALLING && chance(400)) {
+          dev.hangup(call);
+        } else if (call->state == SIP_DIALOG_CONFIRMED && chance(3000)) {
+          dev.hangup(call);
+        }
+      }
+      for (auto &entry : pbx.calls) {
+        Pbx::Call &c = entry.second;
+        if (c.state == Pbx::UP && chance(3000)) {
+          pbx.bye(entry.first, c);
+        } else if (c.to_device && c.state == Pbx::RINGING && chance(300)) {
+          pbx.cancel(entry.first, c);
+        }
+      }
+    }
+    pbx.pump();
+    pbx.tick();
+    dev.pump();
+    dev.txns.poll(dev.now);
+    dev.check();
+  };
+  while (dev.now < end)
+    step(true);
+
+  // hang up everything and let the transactions run out
+  for (size_t i = 0; i < dev.calls.capacity(); i++) {
+    if (SipDialog *call = dev.calls.at(i))
+      dev.hangup(call);
+  }
+  for (auto &entry : pbx.calls) {
+    if (entry.second.state == Pbx::UP)
+      pbx.bye(entry.first, entry.second);
+    else if (entry.second.to_device && entry.second.state == Pbx::RINGING)
+      pbx.cancel(entry.first, entry.second);
+  }
+  for (int i = 0; i < 6000; i++)
+    step(false);
+  double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  CHECK(dev.calls.size() == 0);
+  CHECK(dev.ports.available() == dev.ports.size());
+  CHECK(dev.txns.active() == 0);
+  CHECK(dev.placed > 0 && dev.confirmed > 0 && pbx.answered > 0);
+  if (load <= 150) {
+    // the transaction table as Sip sizes it does not run out, so no request goes unanswered
+    CHECK(dev.txn_full == 0);
+    CHECK(pbx.count(Pbx::UP) == 0 && pbx.count(Pbx::CANCELLING) == 0);
+  } else {
+    CHECK(dev.max_calls_seen == max_calls);
+    CHECK(dev.busy_sent > 0 && dev.refused > 0);
+  }
+
+  printf("%u calls, %u%% load, %u s, 1 in %u lost: %u placed (%u answered), %u refused; %u incoming (%u answered, %u missed, "
+         "%u busy)\n",
+         (unsigned)max_calls, (unsigned)load, (unsigned)seconds, (unsigned)loss, (unsigned)dev.placed, (unsigned)dev.confirmed,
+         (unsigned)dev.refused, (unsigned)pbx.placed, (unsigned)dev.answered, (unsigned)dev.missed,
+         (unsigned)dev.busy_sent);
+  printf("  transactions %u of %u at peak (%u requests without), %u retransmissions, %u timeouts, %u datagrams lost\n",
+         (unsigned)dev.max_txns, (unsigned)dev.txns.capacity(), (unsigned)dev.txn_full, (unsigned)dev.txns.get_retransmissions(),
+         (unsigned)dev.txns.get_timeouts(), (unsigned)pbx.lost);
+  printf("  call state %u bytes + transactions %u bytes; %.1f us per 10 ms step\n",
+         (unsigned)(max_calls * sizeof(SipDialog)), (unsigned)dev.txns.get_memory_size(), wall * 1e6 / steps);
+}
+
+// Finding the dialog of a message by Call-ID, with every slot in use and the match in the last one
+static void benchmark(int rounds) {
+  const size_t calls = 8;
+  SipDialogTable table;
+  table.allocate(calls);
+  for (size_t i = 0; i < calls; i++) {
+    SipDialog *d = table.create(SIP_DIALOG_CONFIRMED, true, 0);
+    snprintf(d->call_id, sizeof(d->call_id), "6b8b4567327b23c6643c9869%02u@192.168.178.42", (unsigned)i);
+  }
+  std::string msg = "BYE sip:door@192.168.178.42 SIP/2.0\r\nCall-ID: 6b8b4567327b23c6643c986907@192.168.178.42\r\n"
+                    "CSeq: 2 BYE\r\n\r\n";
+  SipParser parser;
+  parser.parse(msg.data(), msg.size());
+  size_t found = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < rounds; i++) {
+    const SipDialog *d = table.find(parser);
+    found += d != nullptr;
+    __asm__ __volatile__("" : : "r"(d) : "memory");
+  }
+  double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  CHECK(found == (size_t)rounds);
+  printf("find() by Call-ID, %u calls: %.1f ns\n", (unsigned)calls, t * 1e9 / rounds);
+}
+
+int main(int argc, char **argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 1000000;
+  test_port_pool();
+  test_dialog_table();
+  stress(1, 600, 0, 120);
+  stress(4, 600, 50, 120);
+  stress(8, 1200, 20, 120);
+  stress(8, 300, 20, 800);
+  benchmark(rounds);
+
+  if (failures) {
+    std::cerr << failures << " tests failed" << std::endl;
+    return 1;
+  }
+  std::cout << "All tests passed." << std::endl;
+  return 0;
+}
@@ -0,0 +1,589 @@
+// Checks the MD5 core and the digest credential cache, then measures call setup against a stand-in
+// proxy on 127.0.0.1 that challenges every INVITE without valid credentials: once with the classic
+// INVITE/401/ACK/INVITE exchange and once with the cached nonce sent preemptively. The link delay
+// is applied on a virtual clock, so the setup times are those of a network with that RTT.
+#include "../md5.h"
+#include "../md5_util.h"
+#include "../sip_digest.h"
+#include "../sip_message.h"
+#include "../sip_parser.h"
+#include "../sip_transaction.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+using namespace esphome::voip;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+  do {                                                                      \
+    if (!(cond)) {                                                          \
+      std::cerr << "FAILED " << __LINE__ << ": " << #cond << std::endl;     \
+      ++failures;                                                           \
+    }                                                                       \
+  } while (0)
+
+// heap allocations of the whole process, to show which paths allocate
+static size_t allocations = 0;
+
+void *operator new(size_t size) {
+  allocations++;
+  void *p = malloc(size ? size : 1);
+  if (p == nullptr)
+    throw std::bad_alloc();
+  return p;
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+static const uint32_t LOOPBACK = 0x7F000001;
+
+// Non-blocking UDP socket on an ephemeral loopback port
+struct UdpSocket {
+  int fd = -1;
+  uint16_t port = 0;
+
+  UdpSocket() {
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        getsockname(fd, (struct sockaddr *)&addr, &len) != 0) {
+      std::cerr << "cannot bind a UDP socket on 127.0.0.1" << std::endl;
+      exit(1);
+    }
+    port = ntohs(addr.sin_port);
+  }
+  ~UdpSocket() { close(fd); }
+
+  void send(uint16_t to, const char *data, size_t len) const {
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(LOOPBACK);
+    addr.sin_port = htons(to);
+    sendto(fd, data, len, 0, (struct sockaddr *)&addr, sizeof(addr));
+  }
+  // one datagram into buf, 0 if none is queued
+  size_t receive(char *buf, size_t size) const {
+    ssize_t n = recv(fd, buf, size, MSG_DONTWAIT);
+    return n > 0 ? (size_t)n : 0;
+  }
+};
+
+static std::string header(const std::string &msg, const char *name) {
+  std::string key = std::string("\r\n") + name + ": ";
+  size_t p = msg.find(key);
+  if (p == std::string::npos)
+    return "";
+  p += key.size();
+  return msg.substr(p, msg.find("\r\n", p) - p);
+}
+
+// value of a digest parameter, unquoted
+static std::string auth_param(const std::string &auth, const char *name) {
+  std::string key = std::string(name) + "=";
+  size_t p = auth.find(" " + key);
+  if (p == std::string::npos)
+    return "";
+  p += key.size() + 1;
+  if (auth[p] == '"')
+    return auth.substr(p + 1, auth.find('"', p + 1) - p - 1);
+  return auth.substr(p, auth.find_first_of(", ", p) - p);
+}
+
+static bool parse(SipParser &p, const std::string &msg) { return p.parse(msg.data(), msg.size()); }
+
+static std::string challenge_response(int status, const char *params) {
+  return std::string("SIP/2.0 ") + std::to_string(status) + (status == 407 ? " Proxy Authentication Required" : " Unauthorized") +
+         "\r\nVia: SIP/2.0/UDP 127.0.0.1:5060;branch=z9hG4bK1\r\nCall-ID: 1@127.0.0.1\r\nCSeq: 1 INVITE\r\n" +
+         (status == 407 ? "Proxy-Authenticate: " : "WWW-Authenticate: ") + params + "\r\nContent-Length: 0\r\n\r\n";
+}
+
+static void test_md5() {
+  struct {
+    const char *input;
+    const char *hex;
+  } vectors[] = {
+      // RFC 1321 appendix A.5
+      {"", "d41d8cd98f00b204e9800998ecf8427e"},
+      {"abc", "900150983cd24fb0d6963f7d28e17f72"},
+      {"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789", "d174ab98d277d9f5a5611c2c9f419d9f"},
+  };
+  char hex[Md5::HEX_SIZE];
+  for (auto &v : vectors) {
+    Md5().update(v.input).finish_hex(hex);
+    CHECK(strcmp(hex, v.hex) == 0);
+  }
+  // fed in pieces of every size, across the 64-byte blocks and the padding boundary at 56
+  std::string data;
+  for (int i = 0; i < 300; i++)
+    data.push_back((char)(i * 7 + 3));
+  for (size_t len = 0; len <= data.size(); len += 13) {
+    std::string whole = md5_hex(data.substr(0, len));
+    for (size_t piece = 1; piece <= 70; piece += 23) {
+      Md5 md5;
+      for (size_t off = 0; off < len; off += piece)
+        md5.update(data.data() + off, off + piece < len ? piece : len - off);
+      md5.finish_hex(hex);
+      CHECK(whole == hex);
+    }
+  }
+  // a million 'a'
+  Md5 md5;
+  std::string block(1000, 'a');
+  for (int i = 0; i < 1000; i++)
+    md5.update(block.data(), block.size());
+  md5.finish_hex(hex);
+  CHECK(strcmp(hex, "7707d6ae4e027c70eea2a935c2296f21") == 0);
+}
+
+static void test_rfc2617_example() {
+  SipDigestAuth auth;
+  auth.set_credentials("Mufasa", "Circle Of Life");
+  auth.set_random([]() { return 0x0a4f113bu; });
+  SipParser p;
+  std::string rsp = challenge_response(401, "Digest realm=\"testrealm@host.com\", qop=\"auth,auth-int\", "
+                                            "nonce=\"dcd98b7102dd2f0e8b11d0f600bfb0c093\", "
+                                            "opaque=\"5ccc069c403ebaf9f0171e9517f40e41\"");
+  CHECK(parse(p, rsp));
+  CHECK(!auth.can_authorize(0));
+  CHECK(auth.on_challenge(p, 1000));
+  CHECK(auth.can_authorize(1000));
+
+  char buf[512];
+  SipMessage m(buf, sizeof(buf));
+  CHECK(auth.write_authorization(m, "GET", "/dir/index.html"));
+  std::string line(m.data(), m.size());
+  CHECK(line.compare(0, 22, "Authorization: Digest ") == 0);
+  CHECK(auth_param(line, "username") == "Mufasa");
+  CHECK(auth_param(line, "realm") == "testrealm@host.com");
+  CHECK(auth_param(line, "uri") == "/dir/index.html");
+  CHECK(auth_param(line, "qop") == "auth");
+  CHECK(auth_param(line, "nc") == "00000001");
+  CHECK(auth_param(line, "cnonce") == "0a4f113b");
+  CHECK(auth_param(line, "response") == "6629fae49393a05397450978507c4ef1");
+  CHECK(auth_param(line, "opaque") == "5ccc069c403ebaf9f0171e9517f40e41");
+  CHECK(line.substr(line.size() - 2) == "\r\n");
+
+  // the next request counts up; the same challenge again keeps counting
+  m.clear();
+  CHECK(auth.write_authorization(m, "GET", "/dir/index.html"));
+  CHECK(auth_param(std::string(m.data(), m.size()), "nc") == "00000002");
+  CHECK(auth.on_challenge(p, 2000));
+  CHECK(auth.get_nonce_count() == 2);
+  CHECK(auth.get_ha1_count() == 1);
+
+  // without qop the RFC 2069 response
+  rsp = challenge_response(401, "Digest realm=\"testrealm@host.com\", nonce=\"dcd98b7102dd2f0e8b11d0f600bfb0c093\"");
+  CHECK(parse(p, rsp));
+  CHECK(auth.on_challenge(p, 3000));
+  m.clear();
+  CHECK(auth.write_authorization(m, "GET", "/dir/index.html"));
+  line.assign(m.data(), m.size());
+  CHECK(auth_param(line, "response") == "670fd8c2df070c60b045671b8b24ff02");
+  CHECK(line.find("qop=") == std::string::npos && line.find("opaque=") == std::string::npos);
+  CHECK(auth.get_ha1_count() == 1);
+}
+
+static void test_cache() {
+  SipDigestAuth auth;
+  auth.set_credentials("100", "secret");
+  uint32_t seed = 1;
+  auth.set_random([&]() { return seed = seed * 1103515245 + 12345; });
+  SipParser p;
+  char buf[512];
+  SipMessage m(buf, sizeof(buf));
+
+  // a proxy challenge is answered in a header of its own
+  std::string rsp = challenge_response(407, "Digest realm=\"proxy\", nonce=\"abc\", qop=auth");
+  CHECK(parse(p, rsp));
+  CHECK(auth.on_challenge(p, 0));
+  CHECK(auth.write_authorization(m, "INVITE", "sip:611@127.0.0.1"));
+  CHECK(std::string(m.data(), m.size()).compare(0, 27, "Proxy-Authorization: Digest") == 0);
+  std::string cnonce = auth_param(std::string(m.data(), m.size()), "cnonce");
+
+  // a new nonce in the same realm: no new HA1, nc and cnonce start over
+  rsp = challenge_response(407, "Digest realm=\"proxy\", nonce=\"def\", qop=auth");
+  CHECK(parse(p, rsp));
+  CHECK(auth.on_challenge(p, 0));
+  m.clear();
+  CHECK(auth.write_authorization(m, "INVITE", "sip:611@127.0.0.1"));
+  CHECK(auth_param(std::string(m.data(), m.size()), "nc") == "00000001");
+  CHECK(auth_param(std::string(m.data(), m.size()), "cnonce") != cnonce);
+  CHECK(auth.get_ha1_count() == 1);
+  // another realm needs its own HA1, as does a new password
+  rsp = challenge_response(401, "Digest realm=\"registrar\", nonce=\"ghi\"");
+  CHECK(parse(p, rsp));
+  CHECK(auth.on_challenge(p, 0));
+  CHECK(auth.get_ha1_count() == 2);
+  auth.set_credentials("100", "other");
+  CHECK(!auth.can_authorize(0));
+  CHECK(auth.on_challenge(p, 0));
+  CHECK(auth.get_ha1_count() == 3);
+
+  // the nonce is used for five minutes, also across the millis() wrap
+  CHECK(parse(p, rsp));
+  CHECK(auth.on_challenge(p, 0xFFFF0000u));
+  CHECK(auth.can_authorize(0xFFFF0000u + 299999));
+  CHECK(!auth.can_authorize(0xFFFF0000u + 300000));
+  auth.set_nonce_lifetime(1000);
+  CHECK(!auth.can_authorize(0xFFFF0000u + 1000));
+  auth.forget_nonce();
+  CHECK(!auth.can_authorize(0xFFFF0000u));
+  m.clear();
+  CHECK(!auth.write_authorization(m, "BYE", "sip:611@127.0.0.1") && m.size() == 0);
+
+  // challenges that cannot be answered drop the cached nonce
+  const char *unsupported[] = {
+      "Digest realm=\"r\", nonce=\"n\", algorithm=SHA-256",
+      "Digest realm=\"r\", nonce=\"n\", algorithm=MD5-sess",
+      "Digest realm=\"r\", nonce=\"n\", qop=\"auth-int\"",
+      "Digest realm=\"r\"",
+      "Digest nonce=\"n\"",
+  };
+  std::string good = challenge_response(401, "Digest realm=\"r\", nonce=\"ok\"");
+  for (const char *params : unsupported) {
+    CHECK(parse(p, good));
+    CHECK(auth.on_challenge(p, 0));
+    std::string bad = challenge_response(401, params);
+    CHECK(parse(p, bad));
+    CHECK(!auth.on_challenge(p, 0));
+    CHECK(!auth.can_authorize(0));
+  }
+  // a 401 without challenge header at all
+  std::string bare = "SIP/2.0 401 Unauthorized\r\nCall-ID: 1\r\nCSeq: 1 INVITE\r\nContent-Length: 0\r\n\r\n";
+  CHECK(parse(p, bare));
+  CHECK(!auth.on_challenge(p, 0));
+}
+
+// The digest code Sip::invite() used before: std::string fields, snprintf and md5_hex() per hash
+static size_t legacy_authorization(const SipParser &p, const std::string &user, const std::string &pass,
+                                   const std::string &uri, char *out, size_t size) {
+  std::string realm, nonce, qop, cnonce;
+  char ha1_hex[33] = {0};
+  char ha2_hex[33] = {0};
+  char ha_resp[33] = {0};
+  char p_temp[256] = {0};
+  SipSpan challenge = p.header(SIP_HDR_WWW_AUTHENTICATE);
+  SipSpan realm_span = p.param(challenge, "realm");
+  SipSpan nonce_span = p.param(challenge, "nonce");
+  realm.assign(p.ptr(realm_span), realm_span.length);
+  nonce.assign(p.ptr(nonce_span), nonce_span.length);
+  SipSpan qop_span = p.param(challenge, "qop");
+  qop.assign(p.ptr(qop_span), qop_span.length);
+  auto md5 = [](char *hex, char *in) { memcpy(hex, md5_hex(std::string(in)).c_str(), 33); };
+  snprintf(p_temp, sizeof(p_temp), "%s:%s:%s", user.c_str(), realm.c_str(), pass.c_str());
+  md5(ha1_hex, p_temp);
+  snprintf(p_temp, sizeof(p_temp), "INVITE:%s", uri.c_str());
+  md5(ha2_hex, p_temp);
+  char cnonce_buf[33];
+  snprintf(cnonce_buf, sizeof(cnonce_buf), "%08x%08x", 1u, 2u);
+  cnonce.assign(cnonce_buf);
+  snprintf(p_temp, sizeof(p_temp), "%s:%s:%s:%s:%s:%s", ha1_hex, nonce.c_str(), "00000001", cnonce.c_str(), "auth",
+           ha2_hex);
+  md5(ha_resp, p_temp);
+  return (size_t)snprintf(out, size,
+                          "Authorization: Digest username=\"%s\", realm=\"%s\", nonce=\"%s\", uri=\"%s\", "
+                          "response=\"%s\", qop=auth, nc=00000001, cnonce=\"%s\"\r\n",
+                          user.c_str(), realm.c_str(), nonce.c_str(), uri.c_str(), ha_resp, cnonce.c_str());
+}
+
+static void test_allocations(int rounds) {
+  SipDigestAuth auth;
+  auth.set_credentials("100", "secret");
+  auth.set_random([]() { return 42u; });
+  SipParser p;
+  std::string rsp = challenge_response(401, "Digest realm=\"fritz.box\", nonce=\"2D8E3B9CA1F0\", qop=\"auth\"");
+  CHECK(parse(p, rsp));
+  char buf[512];
+  SipMessage m(buf, sizeof(buf));
+  CHECK(auth.on_challenge(p, 0));
+
+  // answering a challenge of a known realm and writing the header stay off the heap
+  size_t before = allocations;
+  for (int i = 0; i < 100; i++) {
+    auth.on_challenge(p, 0);
+    m.clear();
+    auth.write_authorization(m, "INVITE", "sip:611@fritz.box");
+  }
+  size_t cached_allocs = allocations - before;
+  CHECK(cached_allocs == 0);
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < rounds; i++) {
+    m.clear();
+    auth.write_authorization(m, "INVITE", "sip:611@fritz.box");
+  }
+  double cached_ns =
+      std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / rounds;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < rounds; i++) {
+    SipDigestAuth fresh;
+    fresh.set_credentials("100", "secret");
+    fresh.on_challenge(p, 0);
+    m.clear();
+    fresh.write_authorization(m, "INVITE", "sip:611@fritz.box");
+  }
+  double fresh_ns =
+      std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / rounds;
+  std::string user = "100", pass = "secret", uri = "sip:611@fritz.box";
+  before = allocations;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < rounds; i++)
+    legacy_authorization(p, user, pass, uri, buf, sizeof(buf));
+  double legacy_ns =
+      std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / rounds;
+  size_t legacy_allocs = (allocations - before) / rounds;
+  printf("Authorization header: cached HA1 %.0f ns (0 allocations), new realm %.0f ns, "
+         "old md5_hex path %.0f ns (%u allocations)\n",
+         cached_ns, fresh_ns, legacy_ns, (unsigned)legacy_allocs);
+}
+
+// Proxy on 127.0.0.1 answering INVITEs: 401 unless the qop=auth digest for user 100 / "secret" matches
+// the current nonce with a rising nc, else 100 and 200. Every datagram spends delay ms each way.
+struct Proxy {
+  UdpSocket sock;
+  uint32_t delay = 0;
+  uint32_t nonce = 1;
+  uint32_t last_nc = 0;
+  int challenges = 0;
+  int accepted = 0;
+  int received = 0;
+  struct Pending {
+    uint32_t due;
+    std::string data;
+    bool inbound;
+  };
+  std::vector<Pending> pending;
+  uint16_t client_port = 0;
+
+  bool authorized(const std::string &req) {
+    std::string auth = header(req, "Authorization");
+    if (auth_param(auth, "nonce") != "n" + std::to_string(nonce))
+      return false;
+    std::string nc = auth_param(auth, "nc");
+    uint32_t count = (uint32_t)strtoul(nc.c_str(), nullptr, 16);
+    std::string ha1 = md5_hex("100:fritz.box:secret");
+    std::string ha2 = md5_hex("INVITE:" + auth_param(auth, "uri"));
+    std::string expected =
+        md5_hex(ha1 + ":" + auth_param(auth, "nonce") + ":" + nc + ":" + auth_param(auth, "cnonce") + ":auth:" + ha2);
+    if (count <= last_nc || auth_param(auth, "response") != expected)
+      return false;
+    last_nc = count;
+    return true;
+  }
+  std::string reply(const std::string &req, int status, const char *reason, const std::string &extra = "") {
+    std::string to = header(req, "To");
+    if (status > 100)
+      to += ";tag=proxy";
+    return "SIP/2.0 " + std::to_string(status) + " " + reason + "\r\nVia: " + header(req, "Via") +
+           "\r\nFrom: " + header(req, "From") + "\r\nTo: " + to + "\r\nCall-ID: " + header(req, "Call-ID") +
+           "\r\nCSeq: " + header(req, "CSeq") + "\r\n" + extra + "Content-Length: 0\r\n\r\n";
+  }
+  void handle(const std::string &req, uint32_t now) {
+    received++;
+    if (req.compare(0, 7, "INVITE ") != 0)
+      return;  // ACKs
+    if (!authorized(req)) {
+      challenges++;
+      pending.push_back({now + delay, reply(req, 401, "Unauthorized",
+                                            "WWW-Authenticate: Digest realm=\"fritz.box\", nonce=\"n" +
+                                                std::to_string(nonce) + "\", qop=\"auth\"\r\n"),
+                         false});
+      return;
+    }
+    accepted++;
+    pending.push_back({now + delay, reply(req, 100, "Trying"), false});
+    pending.push_back({now + delay, reply(req, 200, "OK"), false});
+  }
+  void step(uint32_t now) {
+    char buf[2048];
+    size_t n;
+    while ((n = sock.receive(buf, sizeof(buf))) > 0)
+      pending.push_back({now + delay, std::string(buf, n), true});
+    for (size_t i = 0; i < pending.size();) {
+      if ((int32_t)(now - pending[i].due) < 0) {
+        i++;
+        continue;
+      }
+      Pending msg = pending[i];
+      pending.erase(pending.begin() + i);
+      if (msg.inbound) {
+        handle(msg.data, now);
+      } else {
+        sock.send(client_port, msg.data.data(), msg.data.size());
+      }
+    }
+  }
+};
+
+// The calling side as Sip does it: INVITE through the transaction layer with cached or answered
+// credentials, ACK for the 200
+struct Caller {
+  UdpSocket sock;
+  SipTransactionLayer layer;
+  SipDigestAuth auth;
+  uint32_t now = 1000;
+  uint32_t seed = 7;
+  char buf[1472];
+  SipMessage tx{buf, sizeof(buf)};
+  uint32_t call_id = 0;
+  int cseq = 0;
+  bool established = false;
+  int sent = 0;
+  uint16_t proxy_port = 0;
+
+  Caller() {
+    layer.set_send_callback([this](const SipEndpoint &to, const char *data, size_t len) {
+      sent++;
+      sock.send(to.port, data, len);
+    });
+    layer.reset(now);
+    auth.set_credentials("100", "secret");
+    auth.set_random([this]() { return random(); });
+  }
+  uint32_t random() { return seed = seed * 1103515245 + 12345; }
+  void invite(const SipParser *challenge) {
+    static const char *const URI = "sip:611@fritz.box";
+    tx.clear();
+    tx.str("INVITE ").str(URI).line(" SIP/2.0");
+    tx.str("Via: SIP/2.0/UDP 127.0.0.1:").unum(sock.port).str(";branch=z9hG4bK").hex(random(), 8).line(";rport");
+    tx.line("Max-Forwards: 70");
+    tx.str("From: <sip:100@fritz.box>;tag=").hex(call_id, 8).crlf();
+    tx.str("To: <").str(URI).line(">");
+    tx.str("Call-ID: ").hex(call_id, 8).line("@127.0.0.1");
+    tx.str("CSeq: ").num(++cseq).line(" INVITE");
+    tx.str("Contact: <sip:100@127.0.0.1:").unum(sock.port).line(">");
+    if (challenge != nullptr ? auth.on_challenge(*challenge, now) : auth.can_authorize(now))
+      auth.write_authorization(tx, "INVITE", URI);
+    tx.begin_body();
+    if (tx.finish())
+      layer.send_request(SipEndpoint{LOOPBACK, proxy_port}, tx.data(), tx.size(), now);
+  }
+  void dial() {
+    call_id = random();
+    cseq = 0;
+    established = false;
+    invite(nullptr);
+  }
+  void step() {
+    char in[2048];
+    size_t n;
+    while ((n = sock.receive(in, sizeof(in))) > 0) {
+      SipParser msg;
+      if (!msg.parse(in, n) || !msg.is_response() || !layer.on_response(msg, now))
+        continue;
+      if (msg.get_status() == 401 || msg.get_status() == 407) {
+        invite(&msg);
+      } else if (msg.get_status() == 200) {
+        tx.clear();
+        tx.line("ACK sip:611@fritz.box SIP/2.0");
+        tx.str("Via: SIP/2.0/UDP 127.0.0.1:").unum(sock.port).str(";branch=z9hG4bK").hex(random(), 8).crlf();
+        tx.str("Call-ID: ").hex(call_id, 8).line("@127.0.0.1");
+        tx.str("CSeq: ").num(cseq).line(" ACK");
+        tx.begin_body();
+        if (tx.finish())
+          layer.send_request(SipEndpoint{LOOPBACK, proxy_port}, tx.data(), tx.size(), now);
+        established = true;
+      }
+    }
+    layer.poll(now);
+  }
+};
+
+struct SetupResult {
+  double setup_ms;  // virtual time from dialing to the 200
+  double messages;  // datagrams from the caller per call
+  double challenges;
+  double cpu_us;  // host time per call, both sides
+};
+
+// one call every 40 s, so a cached nonce serves seven calls before its five minutes run out
+static const uint32_t CALL_INTERVAL_MS = 40000;
+
+static SetupResult measure_setup(uint32_t delay, bool preemptive, int calls) {
+  Proxy proxy;
+  Caller caller;
+  proxy.delay = delay;
+  proxy.client_port = caller.sock.port;
+  caller.proxy_port = proxy.sock.port;
+  uint64_t total_ms = 0;
+  int sent_before = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < calls; i++) {
+    if (!preemptive)
+      caller.auth.forget_nonce();
+    if (i == 0)
+      sent_before = caller.sent;
+    uint32_t dialed = caller.now;
+    caller.dial();
+    for (int t = 0; t < 100000 && !caller.established; t++) {
+      caller.now++;
+      proxy.step(caller.now);
+      caller.step();
+    }
+    CHECK(caller.established);
+    total_ms += caller.now - dialed;
+    // let the ACK arrive, then wait out Timer D of the challenged INVITE before the next call
+    for (int t = 0; t < (int)delay + 2; t++) {
+      caller.now++;
+      proxy.step(caller.now);
+      caller.step();
+    }
+    caller.now += CALL_INTERVAL_MS;
+    caller.layer.poll(caller.now);
+  }
+  double cpu = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+  return {(double)total_ms / calls, (double)(caller.sent - sent_before) / calls,
+          (double)proxy.challenges / calls, cpu / calls};
+}
+
+static void test_call_setup() {
+  // every call of the cold path is challenged; with the cache only the first one is
+  SetupResult cold = measure_setup(20, false, 10);
+  SetupResult warm = measure_setup(20, true, 10);
+  CHECK(cold.challenges == 1.0);
+  CHECK(cold.messages == 4.0);  // INVITE, ACK of the 401, INVITE, ACK
+  CHECK(warm.challenges == 0.2);
+  CHECK(warm.messages < 2.5);
+  // 20 ms each way: two round trips against one
+  CHECK(cold.setup_ms >= 80 && cold.setup_ms < 85);
+  CHECK(warm.setup_ms < cold.setup_ms - 25);
+
+  printf("Call setup against a challenging proxy: mean setup time, caller datagrams and host time per call\n");
+  printf("  RTT     401 every call                 cached nonce\n");
+  for (uint32_t delay : {1u, 10u, 25u, 50u, 100u}) {
+    SetupResult c = measure_setup(delay, false, 20);
+    SetupResult w = measure_setup(delay, true, 20);
+    printf("  %3u ms  %6.1f ms  %.1f msgs  %4.0f us   %6.1f ms  %.1f msgs  %4.0f us\n", 2 * delay, c.setup_ms,
+           c.messages, c.cpu_us, w.setup_ms, w.messages, w.cpu_us);
+  }
+}
+
+int main(int argc, char **argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 20000;
+  test_md5();
+  test_rfc2617_example();
+  test_cache();
+  test_allocations(rounds);
+  test_call_setup();
+
+  if (failures) {
+    std::cerr << failures << " tests failed" << std::endl;
+    return 1;
+  }
+  std::cout << "All tests passed." << std::endl;
+  return 0;
+}
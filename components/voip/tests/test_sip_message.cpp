@@ -0,0 +1,239 @@
+#include "../sip_message.h"
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+using esphome::voip::SipMessage;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+  do {                                                                      \
+    if (!(cond)) {                                                          \
+      std::cerr << "FAILED " << __LINE__ << ": " << #cond << std::endl;     \
+      ++failures;                                                           \
+    }                                                                       \
+  } while (0)
+
+static void test_formatting() {
+  char buf[256];
+  SipMessage m(buf, sizeof(buf));
+  m.num(0).chr(' ').num(-42).chr(' ').num(INT32_MIN).chr(' ').unum(4294967295u).chr(' ').unum(7, 10);
+  m.chr(' ').hex(0xbeef, 8).chr(' ').hex(0).chr(' ').quoted("a\"b\\c").chr(' ').quoted(nullptr);
+  CHECK(std::string(m.data()) == "0 -42 -2147483648 4294967295 0000000007 0000beef 0 \"a\\\"b\\\\c\" \"\"");
+  CHECK(m.size() == strlen(buf));
+  CHECK(m.finish());
+  // no body section: nothing is added
+  CHECK(m.size() == strlen(buf));
+
+  m.clear();
+  CHECK(m.size() == 0 && buf[0] == '\0');
+  m.line("OPTIONS sip:a@b SIP/2.0").begin_body();
+  CHECK(m.finish());
+  CHECK(std::string(m.data()) == "OPTIONS sip:a@b SIP/2.0\r\nContent-Length: 0\r\n\r\n");
+}
+
+static void test_content_length() {
+  char buf[2048];
+  SipMessage m(buf, sizeof(buf));
+  for (size_t body : {1, 9, 10, 99, 100, 1000, 1500}) {
+    m.clear();
+    m.line("INVITE sip:1@2 SIP/2.0");
+    m.begin_body();
+    for (size_t i = 0; i < body; i++)
+      m.chr((char)('a' + i % 26));
+    CHECK(m.finish());
+    std::string s(m.data(), m.size());
+    CHECK(s == "INVITE sip:1@2 SIP/2.0\r\nContent-Length: " + std::to_string(body) + "\r\n\r\n" + s.substr(s.size() - body));
+    CHECK(s.substr(s.size() - body, 3) == std::string("abc").substr(0, body < 3 ? body : 3));
+    CHECK(strlen(buf) == m.size());
+  }
+}
+
+static void test_overflow() {
+  char buf[16];
+  SipMessage m(buf, sizeof(buf));
+  m.str("0123456789");
+  m.str("abcdef");  // 16 bytes + NUL do not fit: dropped as a whole
+  CHECK(m.overflowed());
+  CHECK(std::string(m.data()) == "0123456789");
+  m.str("x");  // sticky: nothing after the first dropped write
+  CHECK(m.size() == 10);
+  CHECK(!m.finish());
+  m.clear();
+  CHECK(!m.overflowed());
+  m.str("012345678901234");  // exactly capacity - 1
+  CHECK(!m.overflowed() && m.size() == 15 && buf[15] == '\0');
+
+  // the body does not fit after the reserved length digits
+  m.clear();
+  m.str("0123");
+  m.begin_body();
+  CHECK(m.overflowed());
+  CHECK(!m.finish());
+
+  SipMessage detached;
+  detached.str("abc");
+  CHECK(detached.overflowed());
+  CHECK(!detached.finish());
+}
+
+// The pre-builder implementation: memset, then strlen + vsnprintf per line, Content-Length counted by
+// hand from the SDP line lengths
+struct LegacyBuilder {
+  char buf[2048];
+  void clear() { memset(buf, 0, sizeof(buf)); }
+  void add_sip_line(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    size_t l = strlen(buf);
+    vsnprintf(buf + l, sizeof(buf) - l, fmt, args);
+    va_end(args);
+    l = strlen(buf);
+    if (l <= sizeof(buf) - 3) {
+      buf[l] = '\r';
+      buf[l + 1] = '\n';
+      buf[l + 2] = 0;
+    }
+  }
+};
+
+struct Call {
+  const char *nr = "**611";
+  const char *server = "192.168.178.1";
+  const char *user = "620";
+  const char *desc = "Door";
+  const char *ip = "192.168.178.42";
+  int port = 5060;
+  uint32_t callid = 123456789, tag = 42, branch = 3735928559u;
+  const char *realm = "fritz.box";
+  const char *nonce = "5C2E6F1A9B3D7E40";
+  const char *response = "6629fae49393a05397450978507c4ef1";
+  uint32_t nc = 1;
+  const char *cnonce = "0a4f113b00c0ffee";
+  unsigned pt = 8;
+};
+
+static size_t legacy_invite(LegacyBuilder &b, const Call &c) {
+  b.clear();
+  b.add_sip_line("INVITE sip:%s@%s SIP/2.0", c.nr, c.server);
+  b.add_sip_line("Call-ID: %010u@%s", c.callid, c.ip);
+  b.add_sip_line("CSeq: %i INVITE", 2);
+  b.add_sip_line("Max-Forwards: 70");
+  b.add_sip_line("User-Agent: sip-client/0.0.1");
+  b.add_sip_line("From: \"%s\"  <sip:%s@%s>;tag=%010u", c.desc, c.user, c.server, c.tag);
+  b.add_sip_line("Via: SIP/2.0/UDP %s:%i;branch=%010u;rport=%i", c.ip, c.port, c.branch, c.port);
+  b.add_sip_line("To: <sip:%s@%s>", c.nr, c.server);
+  b.add_sip_line("Contact: \"%s\" <sip:%s@%s:%i;transport=udp>", c.user, c.user, c.ip, c.port);
+  char nc_str[9];
+  snprintf(nc_str, sizeof(nc_str), "%08x", c.nc);
+  b.add_sip_line("Authorization: Digest username=\"%s\", realm=\"%s\", nonce=\"%s\", uri=\"sip:%s@%s\", "
+                 "response=\"%s\", qop=auth, nc=%s, cnonce=\"%s\"",
+                 c.user, c.realm, c.nonce, c.nr, c.server, c.response, nc_str, c.cnonce);
+  b.add_sip_line("Content-Type: application/sdp");
+  b.add_sip_line("Allow: INVITE, ACK, CANCEL, OPTIONS, BYE, REFER, NOTIFY, MESSAGE, SUBSCRIBE, INFO");
+  char m_line[48], rtpmap_line[48];
+  snprintf(m_line, sizeof(m_line), "m=audio 1234 RTP/AVP %u", c.pt);
+  snprintf(rtpmap_line, sizeof(rtpmap_line), "a=rtpmap:%u %s/8000", c.pt, "PCMA");
+  size_t body_len = 5 + (17 + strlen(c.ip)) + 11 + (11 + strlen(c.ip)) + 7 + (strlen(m_line) + 2) +
+                    (strlen(rtpmap_line) + 2);
+  b.add_sip_line("Content-Length: %u", (unsigned)body_len);
+  b.add_sip_line("");
+  b.add_sip_line("v=0");
+  b.add_sip_line("o=- 0 4 IN IP4 %s", c.ip);
+  b.add_sip_line("s=sipcall");
+  b.add_sip_line("c=IN IP4 %s", c.ip);
+  b.add_sip_line("t=0 0");
+  b.add_sip_line("%s", m_line);
+  b.add_sip_line("%s", rtpmap_line);
+  return strlen(b.buf);
+}
+
+// Same message as Sip::invite() builds it
+static size_t builder_invite(SipMessage &m, const Call &c) {
+  m.clear();
+  m.str("INVITE sip:").str(c.nr).chr('@').str(c.server).line(" SIP/2.0");
+  m.str("Call-ID: ").unum(c.callid, 10).chr('@').str(c.ip).crlf();
+  m.str("CSeq: ").num(2).line(" INVITE");
+  m.line("Max-Forwards: 70");
+  m.line("User-Agent: sip-client/0.0.1");
+  m.str("From: ").quoted(c.desc).str("  <sip:").str(c.user).chr('@').str(c.server);
+  m.str(">;tag=").unum(c.tag, 10).crlf();
+  m.str("Via: SIP/2.0/UDP ").str(c.ip).chr(':').num(c.port);
+  m.str(";branch=").unum(c.branch, 10).str(";rport=").num(c.port).crlf();
+  m.str("To: <sip:").str(c.nr).chr('@').str(c.server).line(">");
+  m.str("Contact: ").quoted(c.user).str(" <sip:").str(c.user).chr('@').str(c.ip);
+  m.chr(':').num(c.port).line(";transport=udp>");
+  m.str("Authorization: Digest username=").quoted(c.user).str(", realm=").quoted(c.realm);
+  m.str(", nonce=").quoted(c.nonce).str(", uri=\"sip:").str(c.nr).chr('@').str(c.server);
+  m.str("\", response=").quoted(c.response);
+  m.str(", qop=auth, nc=").hex(c.nc, 8).str(", cnonce=").quoted(c.cnonce).crlf();
+  m.line("Content-Type: application/sdp");
+  m.line("Allow: INVITE, ACK, CANCEL, OPTIONS, BYE, REFER, NOTIFY, MESSAGE, SUBSCRIBE, INFO");
+  m.begin_body();
+  m.line("v=0");
+  m.str("o=- 0 4 IN IP4 ").str(c.ip).crlf();
+  m.line("s=sipcall");
+  m.str("c=IN IP4 ").str(c.ip).crlf();
+  m.line("t=0 0");
+  m.str("m=audio 1234 RTP/AVP ").unum(c.pt).crlf();
+  m.str("a=rtpmap:").unum(c.pt).chr(' ').str("PCMA").line("/8000");
+  m.finish();
+  return m.size();
+}
+
+static void test_invite_matches_legacy() {
+  Call call;
+  static LegacyBuilder legacy;
+  char buf[2048];
+  SipMessage m(buf, sizeof(buf));
+  size_t a = legacy_invite(legacy, call);
+  size_t b = builder_invite(m, call);
+  CHECK(a == b);
+  CHECK(std::string(legacy.buf) == std::string(m.data(), m.size()));
+  // Content-Length agrees with the body actually sent
+  const char *body = strstr(m.data(), "\r\n\r\n") + 4;
+  CHECK(atoi(strstr(m.data(), "Content-Length: ") + 16) == (int)(m.data() + m.size() - body));
+}
+
+template<typename F> static double ns_per_call(int rounds, F &&f) {
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < rounds; r++)
+    f();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1e9 / rounds;
+}
+
+static void benchmark(int rounds) {
+  Call call;
+  static LegacyBuilder legacy;
+  char buf[2048];
+  SipMessage m(buf, sizeof(buf));
+  volatile size_t sink = 0;
+  double t_legacy = ns_per_call(rounds, [&] { sink += legacy_invite(legacy, call); });
+  double t_builder = ns_per_call(rounds, [&] { sink += builder_invite(m, call); });
+  printf("INVITE with digest, %d rounds (%u bytes):\n", rounds, (unsigned)m.size());
+  printf("  memset + strlen/vsnprintf per line  %8.0f ns/message\n", t_legacy);
+  printf("  SipMessage builder                  %8.0f ns/message  (%.1fx)\n", t_builder, t_legacy / t_builder);
+  // the old send path also copied the message into a 2 KB stack buffer for the redacted debug log
+  printf("  send path stack: %u bytes redaction copy before, none now\n", (unsigned)sizeof(legacy.buf));
+}
+
+int main(int argc, char **argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 100000;
+  test_formatting();
+  test_content_length();
+  test_overflow();
+  test_invite_matches_legacy();
+  benchmark(rounds);
+
+  if (failures) {
+    std::cerr << failures << " tests failed" << std::endl;
+    return 1;
+  }
+  std::cout << "All tests passed." << std::endl;
+  return 0;
+}
@@ -0,0 +1,357 @@
+#include "../sip_parser.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+using namespace esphome::voip;
+
+#ifndef SIP_CORPUS_DIR
+#define SIP_CORPUS_DIR "sip_corpus"
+#endif
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+  do {                                                                      \
+    if (!(cond)) {                                                          \
+      std::cerr << "FAILED " << __LINE__ << ": " << #cond << std::endl;     \
+      ++failures;                                                           \
+    }                                                                       \
+  } while (0)
+
+struct CorpusFile {
+  std::string name;
+  std::string data;
+};
+
+static std::vector<CorpusFile> load_corpus() {
+  std::vector<CorpusFile> corpus;
+  for (const auto &entry : std::filesystem::directory_iterator(SIP_CORPUS_DIR)) {
+    if (entry.path().extension() != ".sip")
+      continue;
+    std::ifstream in(entry.path(), std::ios::binary);
+    corpus.push_back({entry.path().filename().string(), std::string(std::istreambuf_iterator<char>(in), {})});
+  }
+  std::sort(corpus.begin(), corpus.end(), [](const CorpusFile &a, const CorpusFile &b) { return a.name < b.name; });
+  return corpus;
+}
+
+static const std::string &find(const std::vector<CorpusFile> &corpus, const char *name) {
+  static const std::string none;
+  for (const CorpusFile &f : corpus) {
+    if (f.name == name)
+      return f.data;
+  }
+  std::cerr << "missing corpus file " << name << std::endl;
+  ++failures;
+  return none;
+}
+
+static std::string str(const SipParser &p, SipSpan s) { return std::string(p.ptr(s), s.length); }
+
+static void test_response(const std::vector<CorpusFile> &corpus) {
+  const std::string &m = find(corpus, "fritzbox_183_progress.sip");
+  SipParser p;
+  CHECK(p.parse(m.data(), m.size()));
+  CHECK(p.is_response() && !p.is_request());
+  CHECK(p.get_status() == 183);
+  CHECK(str(p, p.get_reason()) == "Session Progress");
+  CHECK(str(p, p.header(SIP_HDR_CALL_ID)) == "0123456789@192.168.178.42");
+  CHECK(p.get_cseq() == 2 && p.get_cseq_method() == SIP_METHOD_INVITE);
+  CHECK(str(p, p.uri(p.header(SIP_HDR_TO))) == "sip:**611@192.168.178.1");
+  CHECK(str(p, p.param(p.header(SIP_HDR_TO), "tag")) == "D8A2E2C4F1B6E3A1");
+  CHECK(str(p, p.param(p.header(SIP_HDR_VIA), "branch")) == "z9hG4bK0123456789");
+  CHECK(str(p, p.header(SIP_HDR_CONTENT_TYPE)) == "application/sdp");
+  CHECK(!p.has(SIP_HDR_WWW_AUTHENTICATE));
+  std::string body = str(p, p.body());
+  CHECK(body.compare(0, 5, "v=0\r\n") == 0);
+  CHECK(body.size() == (size_t)atoi(p.ptr(p.header(SIP_HDR_CONTENT_LENGTH))));
+  CHECK(p.body().offset + p.body().length == m.size());
+}
+
+static void test_request(const std::vector<CorpusFile> &corpus) {
+  const std::string &m = find(corpus, "fritzbox_bye.sip");
+  SipParser p;
+  CHECK(p.parse(m.data(), m.size()));
+  CHECK(p.is_request() && !p.is_response());
+  CHECK(p.get_method() == SIP_METHOD_BYE);
+  CHECK(str(p, p.get_method_name()) == "BYE");
+  CHECK(str(p, p.get_request_uri()) == "sip:620@192.168.178.42:5060;transport=udp");
+  CHECK(p.get_cseq() == 3 && p.get_cseq_method() == SIP_METHOD_BYE);
+  CHECK(p.body().empty());
+
+  const std::string &o = find(corpus, "asterisk_options.sip");
+  CHECK(p.parse(o.data(), o.size()));
+  CHECK(p.get_method() == SIP_METHOD_OPTIONS);
+  CHECK(p.get_cseq() == 11311);
+  CHECK(str(p, p.uri(p.header(SIP_HDR_CONTACT))) == "sip:door@10.0.0.1:5060");
+  // the URI without angle brackets ends at the first parameter
+  CHECK(str(p, p.uri(p.get_request_uri())) == "sip:door@10.0.0.42:5060");
+
+  const char *unknown = "SUBSCRIBE sip:a@b SIP/2.0\r\nCSeq: 7 SUBSCRIBE\r\n\r\n";
+  CHECK(p.parse(unknown, strlen(unknown)));
+  CHECK(p.get_method() == SIP_METHOD_OTHER && p.equals(p.get_method_name(), "SUBSCRIBE"));
+  CHECK(p.get_cseq() == 7 && p.get_cseq_method() == SIP_METHOD_OTHER);
+  // methods are case-sensitive
+  const char *lower = "bye sip:a@b SIP/2.0\r\n\r\n";
+  CHECK(p.parse(lower, strlen(lower)) && p.get_method() == SIP_METHOD_OTHER);
+}
+
+static void test_compact_and_folded(const std::vector<CorpusFile> &corpus) {
+  const std::string &m = find(corpus, "compact_form_info.sip");
+  SipParser p;
+  CHECK(p.parse(m.data(), m.size()));
+  CHECK(p.get_method() == SIP_METHOD_INFO);
+  CHECK(str(p, p.header(SIP_HDR_CALL_ID)) == "0123456789@192.168.178.42");
+  CHECK(str(p, p.param(p.header(SIP_HDR_VIA), "branch")) == "z9hG4bK77e0a1");
+  CHECK(str(p, p.uri(p.header(SIP_HDR_FROM))) == "sip:**611@192.168.178.1");
+  CHECK(str(p, p.header(SIP_HDR_CONTENT_TYPE)) == "application/dtmf-relay");
+  CHECK(str(p, p.body()) == "Signal=5\r\nDuration=160\r\n");
+
+  const std::string &f = find(corpus, "folded_headers_486.sip");
+  CHECK(p.parse(f.data(), f.size()));
+  CHECK(p.get_status() == 486);
+  // the first Via wins and includes its continuation line
+  CHECK(str(p, p.param(p.header(SIP_HDR_VIA), "branch")) == "z9hG4bK0123456789");
+  CHECK(str(p, p.header(SIP_HDR_VIA)).find("192.168.178.99") == std::string::npos);
+  // names are case-insensitive, whitespace before the colon is allowed
+  CHECK(str(p, p.param(p.header(SIP_HDR_FROM), "tag")) == "0000000042");
+  CHECK(str(p, p.header(SIP_HDR_TO)) == "<sip:**611@192.168.178.1>;tag=busy1");
+  CHECK(p.get_cseq() == 2 && p.get_cseq_method() == SIP_METHOD_INVITE);
+}
+
+static void test_digest(const std::vector<CorpusFile> &corpus) {
+  const std::string &m = find(corpus, "fritzbox_401_invite.sip");
+  SipParser p;
+  CHECK(p.parse(m.data(), m.size()));
+  CHECK(p.get_status() == 401);
+  SipSpan auth = p.header(SIP_HDR_WWW_AUTHENTICATE);
+  CHECK(str(p, p.param(auth, "realm")) == "fritz.box");
+  CHECK(str(p, p.param(auth, "nonce")) == "5C2E6F1A9B3D7E40");
+  CHECK(p.param(auth, "qop").empty());
+
+  const std::string &a = find(corpus, "asterisk_407_invite.sip");
+  CHECK(p.parse(a.data(), a.size()));
+  CHECK(p.get_status() == 407);
+  auth = p.header(SIP_HDR_PROXY_AUTHENTICATE);
+  CHECK(str(p, p.param(auth, "nonce")) == "1700000000/5f1b8a2c0a4b6f7e");
+  CHECK(str(p, p.param(auth, "algorithm")) == "md5");
+  CHECK(str(p, p.param(auth, "QOP")) == "auth");
+
+  // "cnonce" and a quoted "nonce=" must not be taken for the nonce parameter
+  const char *tricky = "SIP/2.0 401 Unauthorized\r\n"
+                       "WWW-Authenticate: Digest realm=\"a nonce=\\\"x\\\"\", cnonce=\"bad\", nonce = \"good\"\r\n\r\n";
+  CHECK(p.parse(tricky, strlen(tricky)));
+  CHECK(str(p, p.param(p.header(SIP_HDR_WWW_AUTHENTICATE), "nonce")) == "good");
+}
+
+static void test_malformed() {
+  SipParser p;
+  CHECK(!p.parse(nullptr, 0));
+  CHECK(!p.parse("", 0));
+  const char *bad[] = {
+      "SIP/2.0 2000 OK\r\n\r\n", "SIP/2.0 099 Low\r\n\r\n", "INVITE sip:a@b\r\n\r\n",
+      "INVITE  SIP/2.0\r\n\r\n", "HTTP/1.1 200 OK\r\n\r\n",  "INVITE sip:a@b SIP/2.00\r\n\r\n",
+  };
+  for (const char *m : bad)
+    CHECK(!p.parse(m, strlen(m)));
+
+  // Content-Length larger than the datagram: the body ends at the datagram
+  const char *cl = "SIP/2.0 200 OK\r\nContent-Length: 99999\r\n\r\nv=0\r\n";
+  CHECK(p.parse(cl, strlen(cl)));
+  CHECK(str(p, p.body()) == "v=0\r\n");
+  // a malformed CSeq reads as missing
+  const char *cseq = "SIP/2.0 200 OK\r\nCSeq: INVITE\r\n\r\n";
+  CHECK(p.parse(cseq, strlen(cseq)) && p.get_cseq() == -1 && p.get_cseq_method() == SIP_METHOD_NONE);
+  // LF-only line endings and a missing empty line
+  const char *lf = "SIP/2.0 100 Trying\nCall-ID: x@y\nCSeq: 1 INVITE";
+  CHECK(p.parse(lf, strlen(lf)));
+  CHECK(str(p, p.header(SIP_HDR_CALL_ID)) == "x@y" && p.get_cseq() == 1 && p.body().empty());
+}
+
+static uint32_t rng_state = 0x12345678;
+static uint32_t rnd() {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+static bool inside(SipSpan s, size_t len) { return (size_t)s.offset + s.length <= len; }
+
+// Every span returned for arbitrary input must stay inside the datagram
+static void check_spans(const SipParser &p, size_t len) {
+  CHECK(inside(p.get_method_name(), len) && inside(p.get_request_uri(), len) && inside(p.get_reason(), len));
+  CHECK(inside(p.body(), len));
+  for (int h = 0; h < SIP_HDR_COUNT; h++) {
+    SipSpan v = p.header((SipHeader)h);
+    CHECK(inside(v, len));
+    SipSpan u = p.uri(v);
+    CHECK(u.offset >= v.offset && u.offset + u.length <= v.offset + v.length);
+    for (const char *name : {"tag", "branch", "nonce", "realm", "qop"}) {
+      SipSpan q = p.param(v, name);
+      CHECK(q.offset >= v.offset && q.offset + q.length <= v.offset + v.length);
+    }
+  }
+}
+
+// Deterministic mutation fuzzing over the corpus; fuzz_sip_parser.cpp does the same with libFuzzer
+static void test_fuzz(const std::vector<CorpusFile> &corpus, int iterations) {
+  SipParser p;
+  std::vector<char> buf;
+  const char interesting[] = {'\r', '\n', ' ', '\t', ':', ';', ',', '"', '\\', '<', '>', '=', '0', 'l', 'i', '\0'};
+  for (int it = 0; it < iterations; it++) {
+    const std::string &seed = corpus[rnd() % corpus.size()].data;
+    buf.assign(seed.begin(), seed.end());
+    int mutations = 1 + rnd() % 8;
+    for (int k = 0; k < mutations && !buf.empty(); k++) {
+      size_t pos = rnd() % buf.size();
+      switch (rnd() % 5) {
+        case 0:
+          buf[pos] ^= (char)(1 << (rnd() % 8));
+          break;
+        case 1:
+          buf[pos] = interesting[rnd() % sizeof(interesting)];
+          break;
+        case 2:
+          buf.insert(buf.begin() + pos, interesting[rnd() % sizeof(interesting)]);
+          break;
+        case 3:
+          buf.erase(buf.begin() + pos);
+          break;
+        case 4:
+          buf.resize(pos);
+          break;
+      }
+    }
+    // parse a heap copy of exactly the datagram size so that ASan catches any overread
+    char *exact = new char[buf.size() + 1];
+    memcpy(exact, buf.data(), buf.size());
+    if (p.parse(exact, buf.size()))
+      check_spans(p, buf.size());
+    delete[] exact;
+    if (failures > 20)
+      return;
+  }
+}
+
+// What handle_udp_packet did for every datagram before the parser: a strstr chain over the whole
+// buffer to classify it, then strstr per header for ack()/parse_return_params()
+static size_t legacy_copy_line(char *dst, size_t cap, const char *p, const char *search) {
+  const char *a = strstr(p, search);
+  if (a == nullptr)
+    return 0;
+  const char *e = strstr(a, "\r");
+  if (e == nullptr)
+    e = strstr(a, "\n");
+  if (e == nullptr)
+    return 0;
+  size_t n = std::min((size_t)(e - a), cap - 1);
+  memcpy(dst, a, n);
+  dst[n] = 0;
+  return n;
+}
+
+static size_t legacy_parse(const char *p) {
+  static const char *const STARTS[] = {"SIP/2.0 401 Unauthorized", "BYE", "SIP/2.0 200", "SIP/2.0 183 ",
+                                       "SIP/2.0 180 ", "SIP/2.0 100 ", "SIP/2.0 486 ", "SIP/2.0 603 ",
+                                       "SIP/2.0 487 ", "INFO"};
+  size_t sink = 0;
+  for (const char *s : STARTS) {
+    if (strstr(p, s) == p) {
+      sink += strlen(s);
+      break;
+    }
+  }
+  char line[256];
+  for (const char *h : {"Call-ID: ", "CSeq: ", "From: ", "Via: ", "To: "})
+    sink += legacy_copy_line(line, sizeof(line), p, h);
+  const char *c = strstr(p, "\nCSeq: ");
+  sink += c != nullptr ? atoi(c + 7) : 0;
+  const char *to = strstr(p, "To: <");
+  sink += to != nullptr && strchr(to, '>') != nullptr ? 1 : 0;
+  return sink;
+}
+
+static size_t indexed_parse(SipParser &p, const std::string &m) {
+  if (!p.parse(m.data(), m.size()))
+    return 0;
+  size_t sink = p.get_status() + p.get_method();
+  for (SipHeader h : {SIP_HDR_CALL_ID, SIP_HDR_CSEQ, SIP_HDR_FROM, SIP_HDR_VIA, SIP_HDR_TO})
+    sink += p.header(h).length;
+  sink += p.get_cseq();
+  sink += p.uri(p.header(SIP_HDR_TO)).length;
+  return sink;
+}
+
+template<typename F> static double seconds(F &&f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void benchmark(const std::vector<CorpusFile> &corpus, int rounds) {
+  size_t bytes = 0;
+  for (const CorpusFile &f : corpus)
+    bytes += f.data.size();
+  size_t messages = corpus.size() * (size_t)rounds;
+  double total_mb = (double)bytes * rounds / 1e6;
+  volatile size_t sink = 0;
+  double t_legacy = seconds([&] {
+    for (int r = 0; r < rounds; r++)
+      for (const CorpusFile &f : corpus)
+        sink += legacy_parse(f.data.c_str());
+  });
+  SipParser p;
+  double t_indexed = seconds([&] {
+    for (int r = 0; r < rounds; r++)
+      for (const CorpusFile &f : corpus)
+        sink += indexed_parse(p, f.data);
+  });
+  printf("%u corpus messages, %d rounds (%.1f MB):\n", (unsigned)corpus.size(), rounds, total_mb);
+  printf("  strstr chain + header copies  %8.1f MB/s  %6.0f ns/message\n", total_mb / t_legacy,
+         t_legacy * 1e9 / messages);
+  printf("  indexed parser                %8.1f MB/s  %6.0f ns/message  (%.1fx)\n", total_mb / t_indexed,
+         t_indexed * 1e9 / messages, t_legacy / t_indexed);
+  printf("  parser state: %u bytes, no copies\n", (unsigned)sizeof(SipParser));
+}
+
+int main(int argc, char **argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 20000;
+  std::vector<CorpusFile> corpus = load_corpus();
+  CHECK(corpus.size() >= 10);
+  if (corpus.empty())
+    return 1;
+  // every message in the corpus parses and all spans stay inside it
+  for (const CorpusFile &f : corpus) {
+    SipParser p;
+    bool ok = p.parse(f.data.data(), f.data.size());
+    if (!ok)
+      std::cerr << "corpus file does not parse: " << f.name << std::endl;
+    CHECK(ok);
+    CHECK(p.has(SIP_HDR_CALL_ID) && p.get_cseq() > 0);
+    check_spans(p, f.data.size());
+  }
+  test_response(corpus);
+  test_request(corpus);
+  test_compact_and_folded(corpus);
+  test_digest(corpus);
+  test_malformed();
+  test_fuzz(corpus, 200000);
+  benchmark(corpus, rounds);
+
+  if (failures) {
+    std::cerr << failures << " tests failed" << std::endl;
+    return 1;
+  }
+  std::cout << "All tests passed." << std::endl;
+  return 0;
+}
@@ -0,0 +1,420 @@
+// Registers against a stand-in registrar on 127.0.0.1: the registration and its transaction layer
+// on one UDP socket, the registrar on another, answering each REGISTER from a script. The clock is
+// virtual like in test_sip_transaction, so hours of refreshes and backoffs take no wall time.
+#include "../md5_util.h"
+#include "../sip_digest.h"
+#include "../sip_message.h"
+#include "../sip_parser.h"
+#include "../sip_registration.h"
+#include "../sip_transaction.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace esphome::voip;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+  do {                                                                      \
+    if (!(cond)) {                                                          \
+      std::cerr << "FAILED " << __LINE__ << ": " << #cond << std::endl;     \
+      ++failures;                                                           \
+    }                                                                       \
+  } while (0)
+
+static const uint32_t LOOPBACK = 0x7F000001;
+
+// Non-blocking UDP socket on an ephemeral loopback port
+struct UdpSocket {
+  int fd = -1;
+  uint16_t port = 0;
+
+  UdpSocket() {
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        getsockname(fd, (struct sockaddr *)&addr, &len) != 0) {
+      std::cerr << "cannot bind a UDP socket on 127.0.0.1" << std::endl;
+      exit(1);
+    }
+    port = ntohs(addr.sin_port);
+  }
+  ~UdpSocket() { close(fd); }
+
+  void send(uint16_t to, const std::string &data) const {
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(LOOPBACK);
+    addr.sin_port = htons(to);
+    sendto(fd, data.data(), data.size(), 0, (struct sockaddr *)&addr, sizeof(addr));
+  }
+  std::vector<std::string> receive() const {
+    std::vector<std::string> out;
+    char buf[2048];
+    for (;;) {
+      ssize_t n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+      if (n <= 0)
+        break;
+      out.emplace_back(buf, (size_t)n);
+    }
+    return out;
+  }
+};
+
+static std::string header(const std::string &msg, const char *name) {
+  std::string key = std::string("\r\n") + name + ": ";
+  size_t p = msg.find(key);
+  if (p == std::string::npos)
+    return "";
+  p += key.size();
+  return msg.substr(p, msg.find("\r\n", p) - p);
+}
+
+// Response of the registrar to req; extra are complete header lines
+static std::string response(const std::string &req, int status, const char *reason, const std::string &extra = "") {
+  char buf[1024];
+  std::string to = header(req, "To");
+  if (status > 100)
+    to += ";tag=reg1";
+  snprintf(buf, sizeof(buf),
+           "SIP/2.0 %d %s\r\nVia: %s;received=127.0.0.1\r\nFrom: %s\r\nTo: %s\r\nCall-ID: %s\r\nCSeq: %s\r\n%s"
+           "Content-Length: 0\r\n\r\n",
+           status, reason, header(req, "Via").c_str(), header(req, "From").c_str(), to.c_str(),
+           header(req, "Call-ID").c_str(), header(req, "CSeq").c_str(), extra.c_str());
+  return buf;
+}
+
+// value of a digest parameter, unquoted
+static std::string auth_param(const std::string &auth, const char *name) {
+  std::string key = std::string(name) + "=";
+  size_t p = auth.find(" " + key);
+  if (p == std::string::npos)
+    return "";
+  p += key.size() + 1;
+  if (auth[p] == '"')
+    return auth.substr(p + 1, auth.find('"', p + 1) - p - 1);
+  return auth.substr(p, auth.find_first_of(", ", p) - p);
+}
+
+// The stand-in registrar: answers each REGISTER through reply, which may return "" to drop it
+struct Registrar {
+  UdpSocket sock;
+  std::vector<std::string> received;
+  std::function<std::string(const std::string &req)> reply;
+  uint32_t nonce = 0;
+  uint32_t last_nc = 0;
+
+  // Checks the qop=auth digest of user 100, password "secret" in realm "test" against the current
+  // nonce; the nonce count has to go up with every use
+  bool authorized(const std::string &req) {
+    std::string auth = header(req, "Authorization");
+    if (nonce == 0 || auth_param(auth, "nonce") != "n" + std::to_string(nonce))
+      return false;
+    std::string nc = auth_param(auth, "nc");
+    uint32_t count = (uint32_t)strtoul(nc.c_str(), nullptr, 16);
+    if (count <= last_nc)
+      return false;
+    std::string ha1 = md5_hex("100:test:secret");
+    std::string ha2 = md5_hex("REGISTER:" + auth_param(auth, "uri"));
+    std::string expected =
+        md5_hex(ha1 + ":" + auth_param(auth, "nonce") + ":" + nc + ":" + auth_param(auth, "cnonce") + ":auth:" + ha2);
+    if (auth_param(auth, "response") != expected || auth_param(auth, "opaque") != "op")
+      return false;
+    last_nc = count;
+    return true;
+  }
+  std::string challenge(const std::string &req) {
+    nonce++;
+    last_nc = 0;
+    return response(req, 401, "Unauthorized",
+                    "WWW-Authenticate: Digest realm=\"test\", nonce=\"n" + std::to_string(nonce) +
+                        "\", opaque=\"op\", qop=\"auth,auth-int\", algorithm=MD5\r\n");
+  }
+  // 401 until the REGISTER carries valid credentials for the current nonce, then 200
+  std::string challenge_or_accept(const std::string &req, const char *contact_expires) {
+    if (!authorized(req))
+      return challenge(req);
+    return response(req, 200, "OK",
+                    "Contact: " + header(req, "Contact") + ";expires=" + contact_expires + "\r\n");
+  }
+};
+
+// The device side, wired up like Sip does it
+struct Client {
+  UdpSocket sock;
+  SipTransactionLayer layer;
+  SipRegistration reg;
+  SipDigestAuth digest;
+  uint32_t now = 1000;
+  uint32_t seed = 1;
+  std::vector<SipRegistrationState> states;
+  int auth_calls = 0;
+
+  explicit Client(uint32_t expires = 600, const char *password = "secret") {
+    layer.set_send_callback([this](const SipEndpoint &to, const char *data, size_t len) {
+      sock.send(to.port, std::string(data, len));
+    });
+    layer.set_timeout_callback([this](uint32_t id, SipMethod /*method*/) { reg.on_timeout(id, now); });
+    layer.reset(now);
+    reg.configure("100", "127.0.0.1", "127.0.0.1", sock.port, expires);
+    reg.set_random([this]() { return seed = seed * 1103515245 + 12345; });
+    reg.set_state_callback([this](SipRegistrationState s) { states.push_back(s); });
+    digest.set_credentials("100", password);
+    digest.set_random([this]() { return seed = seed * 1103515245 + 12345; });
+    // the same hook as Sip::write_authorization()
+    reg.set_auth_callback([this](const SipParser *challenge, const char *method, const char *uri, SipMessage &out) {
+      if (challenge != nullptr) {
+        auth_calls++;
+        if (!digest.on_challenge(*challenge, now))
+          return false;
+      } else if (!digest.can_authorize(now)) {
+        return false;
+      }
+      return digest.write_authorization(out, method, uri);
+    });
+  }
+  void pump() {
+    for (const std::string &d : sock.receive()) {
+      SipParser msg;
+      uint32_t id = 0;
+      if (msg.parse(d.data(), d.size()) && msg.is_response() && layer.on_response(msg, now, &id))
+        reg.on_response(msg, id, now);
+    }
+  }
+  // advances the clock by ms; the registrar answers within the same 10 ms step
+  void run(Registrar &registrar, uint32_t ms) {
+    for (uint32_t t = 0; t < ms; t += 10) {
+      now += 10;
+      for (const std::string &req : registrar.sock.receive()) {
+        registrar.received.push_back(req);
+        std::string rsp = registrar.reply ? registrar.reply(req) : "";
+        if (!rsp.empty())
+          registrar.sock.send(sock.port, rsp);
+      }
+      pump();
+      layer.poll(now);
+      reg.loop(now);
+    }
+  }
+  void start(Registrar &registrar) { reg.start(&layer, SipEndpoint{LOOPBACK, registrar.sock.port}, now); }
+};
+
+static int cseq_of(const std::string &msg) { return atoi(header(msg, "CSeq").c_str()); }
+
+static void test_register_and_refresh() {
+  Registrar registrar;
+  Client client;
+  registrar.reply = [&](const std::string &req) { return registrar.challenge_or_accept(req, "120"); };
+  client.start(registrar);
+  CHECK(client.reg.get_state() == SIP_REG_REGISTERING);
+  client.run(registrar, 100);
+
+  // challenged, answered, accepted with a shorter expiry than requested
+  CHECK(registrar.received.size() == 2);
+  CHECK(client.auth_calls == 1);
+  CHECK(client.reg.is_registered());
+  CHECK(client.reg.get_expires() == 120);
+  CHECK(client.reg.get_last_status() == 200);
+  std::string first = registrar.received[0];
+  std::string second = registrar.received[1];
+  CHECK(first.compare(0, first.find("\r\n"), "REGISTER sip:127.0.0.1 SIP/2.0") == 0);
+  CHECK(header(first, "Expires") == "600");
+  CHECK(header(first, "Contact") == "<sip:100@127.0.0.1:" + std::to_string(client.sock.port) + ";transport=udp>");
+  CHECK(header(first, "Authorization").empty());
+  CHECK(auth_param(header(second, "Authorization"), "nonce") == "n1");
+  CHECK(auth_param(header(second, "Authorization"), "nc") == "00000001");
+  CHECK(header(second, "Call-ID") == header(first, "Call-ID"));
+  CHECK(header(second, "From") == header(first, "From"));
+  CHECK(cseq_of(second) == cseq_of(first) + 1);
+  CHECK(header(second, "Via") != header(first, "Via"));
+
+  // 120 s granted: refreshed after 60 s, within the same binding
+  CHECK(client.reg.get_next_in(client.now) > 59000 && client.reg.get_next_in(client.now) <= 60000);
+  client.run(registrar, 59000);
+  CHECK(registrar.received.size() == 2);
+  client.run(registrar, 1000);
+  // the refresh reuses the nonce with the next nonce count instead of waiting for a challenge
+  CHECK(registrar.received.size() == 3);
+  CHECK(header(registrar.received[2], "Call-ID") == header(first, "Call-ID"));
+  CHECK(cseq_of(registrar.received[2]) == cseq_of(second) + 1);
+  CHECK(auth_param(header(registrar.received[2], "Authorization"), "nc") == "00000002");
+  CHECK(client.auth_calls == 1);
+  CHECK(client.digest.get_ha1_count() == 1);
+  CHECK(client.reg.is_registered());
+  // the binding stays up during a refresh, so no state change is reported
+  CHECK(client.states.size() == 2 && client.states[0] == SIP_REG_REGISTERING && client.states[1] == SIP_REG_REGISTERED);
+
+  // an hour later it is still registered, refreshed about every minute; the nonce is given up after
+  // five minutes, so every fifth refresh or so is challenged
+  client.run(registrar, 3600000);
+  CHECK(client.reg.is_registered());
+  CHECK(registrar.received.size() >= 3 + 59 + 11 && registrar.received.size() <= 3 + 60 + 13);
+  CHECK(client.auth_calls >= 1 + 11 && client.auth_calls <= 1 + 13);
+  CHECK(client.digest.get_ha1_count() == 1);
+  CHECK(client.states.size() == 2);
+
+  // a long binding is refreshed one minute before it expires, expiry from the Expires header
+  registrar.reply = [&](const std::string &req) {
+    return response(req, 200, "OK", "Contact: " + header(req, "Contact") + "\r\nExpires: 3600\r\n");
+  };
+  client.run(registrar, 60000);
+  CHECK(client.reg.get_expires() == 3600);
+  CHECK(client.reg.get_next_in(client.now) > 3480000 && client.reg.get_next_in(client.now) <= 3540000);
+}
+
+static void test_lost_requests() {
+  Registrar registrar;
+  Client client;
+  int dropped = 0;
+  // the first two copies get lost, the transaction layer retransmits
+  registrar.reply = [&](const std::string &req) {
+    if (dropped++ < 2)
+      return std::string();
+    return response(req, 200, "OK");
+  };
+  client.start(registrar);
+  client.run(registrar, 2000);
+  CHECK(registrar.received.size() == 3);
+  CHECK(header(registrar.received[2], "Via") == header(registrar.received[0], "Via"));
+  CHECK(client.reg.is_registered());
+  // no expiry in the response: what was asked for
+  CHECK(client.reg.get_expires() == 600);
+  CHECK(client.layer.get_retransmissions() == 2);
+}
+
+static void test_no_registrar() {
+  Registrar registrar;
+  Client client;
+  client.start(registrar);
+  // Timer F after 32 s
+  client.run(registrar, 31900);
+  CHECK(client.reg.get_state() == SIP_REG_REGISTERING);
+  client.run(registrar, 200);
+  CHECK(client.reg.get_state() == SIP_REG_FAILED);
+  CHECK(client.reg.get_last_status() == 0);
+  size_t sent = registrar.received.size();
+  // retried after 30 s, then 60 s after the next timeout
+  client.run(registrar, 29000);
+  CHECK(registrar.received.size() == sent);
+  client.run(registrar, 1100);
+  CHECK(registrar.received.size() == sent + 1);
+  CHECK(client.reg.get_state() == SIP_REG_REGISTERING);
+  client.run(registrar, 32000);
+  CHECK(client.reg.get_state() == SIP_REG_FAILED);
+  CHECK(client.reg.get_next_in(client.now) > 59000 && client.reg.get_next_in(client.now) <= 60000);
+
+  // once the registrar shows up, the next retry succeeds and the backoff starts over
+  registrar.reply = [&](const std::string &req) { return response(req, 200, "OK"); };
+  client.run(registrar, 60000);
+  CHECK(client.reg.is_registered());
+}
+
+static void test_rejected() {
+  Registrar registrar;
+  Client client(600, "wrong");
+  registrar.reply = [&](const std::string &req) { return registrar.challenge_or_accept(req, "600"); };
+  client.start(registrar);
+  client.run(registrar, 500);
+  // one unauthenticated REGISTER and two answers, then it gives up for a while
+  CHECK(registrar.received.size() == 3);
+  CHECK(client.auth_calls == 2);
+  CHECK(client.reg.get_state() == SIP_REG_FAILED);
+  CHECK(client.reg.get_last_status() == 401);
+  client.run(registrar, 29000);
+  CHECK(registrar.received.size() == 3);
+
+  // forbidden is not challenged, just retried later
+  registrar.reply = [&](const std::string &req) { return response(req, 403, "Forbidden"); };
+  client.run(registrar, 2000);
+  CHECK(registrar.received.size() == 4);
+  CHECK(client.reg.get_last_status() == 403);
+  CHECK(client.reg.get_state() == SIP_REG_FAILED);
+  CHECK(client.reg.get_next_in(client.now) > 58000);
+
+  // a challenge without a nonce cannot be answered; the retry still carries the cached nonce
+  registrar.reply = [&](const std::string &req) {
+    return response(req, 401, "Unauthorized", "WWW-Authenticate: Digest realm=\"test\"\r\n");
+  };
+  size_t calls = client.auth_calls;
+  client.run(registrar, 60000);
+  CHECK(registrar.received.size() == 5);
+  CHECK(client.auth_calls == (int)calls + 1);
+  CHECK(client.reg.get_state() == SIP_REG_FAILED);
+}
+
+static void test_interval_too_brief() {
+  Registrar registrar;
+  Client client(60);
+  registrar.reply = [&](const std::string &req) {
+    if (atoi(header(req, "Expires").c_str()) < 300)
+      return response(req, 423, "Interval Too Brief", "Min-Expires: 300\r\n");
+    return response(req, 200, "OK", "Expires: 300\r\n");
+  };
+  client.start(registrar);
+  client.run(registrar, 100);
+  CHECK(registrar.received.size() == 2);
+  CHECK(header(registrar.received[1], "Expires") == "300");
+  CHECK(client.reg.is_registered());
+  CHECK(client.reg.get_expires() == 300);
+}
+
+static void test_unregister() {
+  Registrar registrar;
+  Client client;
+  registrar.reply = [&](const std::string &req) { return registrar.challenge_or_accept(req, "600"); };
+  client.start(registrar);
+  client.run(registrar, 100);
+  CHECK(client.reg.is_registered());
+  client.reg.stop(client.now);
+  CHECK(client.reg.get_state() == SIP_REG_UNREGISTERING);
+  client.run(registrar, 100);
+  // the removal carries the cached credentials and is accepted right away
+  CHECK(registrar.received.size() == 3);
+  CHECK(header(registrar.received[2], "Expires") == "0");
+  CHECK(!header(registrar.received[2], "Authorization").empty());
+  CHECK(header(registrar.received[2], "Call-ID") == header(registrar.received[0], "Call-ID"));
+  CHECK(client.reg.get_state() == SIP_REG_IDLE);
+  CHECK(client.reg.get_next_in(client.now) == 0);
+  // nothing is sent any more
+  client.run(registrar, 1200000);
+  CHECK(registrar.received.size() == 3);
+
+  // stopping a failed registration only cancels the retry
+  Client other;
+  Registrar forbidden;
+  forbidden.reply = [&](const std::string &req) { return response(req, 403, "Forbidden"); };
+  other.start(forbidden);
+  other.run(forbidden, 100);
+  other.reg.stop(other.now);
+  CHECK(other.reg.get_state() == SIP_REG_IDLE);
+  other.run(forbidden, 100000);
+  CHECK(forbidden.received.size() == 1);
+}
+
+int main() {
+  test_register_and_refresh();
+  test_lost_requests();
+  test_no_registrar();
+  test_rejected();
+  test_interval_too_brief();
+  test_unregister();
+
+  if (failures) {
+    std::cerr << failures << " tests failed" << std::endl;
+    return 1;
+  }
+  std::cout << "All tests passed." << std::endl;
+  return 0;
+}
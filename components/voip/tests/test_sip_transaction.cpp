@@ -0,0 +1,631 @@
+// Drives the SIP transaction layer against a scripted peer over real UDP sockets on 127.0.0.1. The
+// clock is virtual: the tests step it in 10 ms increments and poll the layer like Sip::loop() does,
+// so 32 s of Timer B take no wall time.
+#include "../sip_parser.h"
+#include "../sip_transaction.h"
+#include "../timer_wheel.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace esphome::voip;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+  do {                                                                      \
+    if (!(cond)) {                                                          \
+      std::cerr << "FAILED " << __LINE__ << ": " << #cond << std::endl;     \
+      ++failures;                                                           \
+    }                                                                       \
+  } while (0)
+
+static const uint32_t LOOPBACK = 0x7F000001;
+
+// Non-blocking UDP socket on an ephemeral loopback port
+struct UdpSocket {
+  int fd = -1;
+  uint16_t port = 0;
+
+  UdpSocket() {
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        getsockname(fd, (struct sockaddr *)&addr, &len) != 0) {
+      std::cerr << "cannot bind a UDP socket on 127.0.0.1" << std::endl;
+      exit(1);
+    }
+    port = ntohs(addr.sin_port);
+  }
+  ~UdpSocket() { close(fd); }
+
+  void send(uint16_t to, const std::string &data) const {
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(LOOPBACK);
+    addr.sin_port = htons(to);
+    sendto(fd, data.data(), data.size(), 0, (struct sockaddr *)&addr, sizeof(addr));
+  }
+  // loopback delivery is synchronous, so everything sent so far is already queued
+  std::vector<std::string> receive() const {
+    std::vector<std::string> out;
+    char buf[2048];
+    for (;;) {
+      ssize_t n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+      if (n <= 0)
+        break;
+      out.emplace_back(buf, (size_t)n);
+    }
+    return out;
+  }
+};
+
+// A message the layer passed up, or a timeout it reported
+struct Event {
+  std::string data;
+  uint32_t id;
+};
+
+// The stack under test: layer plus socket, fed and polled the way Sip::loop() does it
+struct Stack {
+  UdpSocket sock;
+  SipTransactionLayer layer;
+  uint32_t now = 1000;
+  std::vector<Event> passed;
+  std::vector<Event> timeouts;
+
+  Stack() {
+    layer.set_send_callback([this](const SipEndpoint &to, const char *data, size_t len) {
+      sock.send(to.port, std::string(data, len));
+    });
+    layer.set_timeout_callback([this](uint32_t id, SipMethod method) {
+      timeouts.push_back({std::to_string((int)method), id});
+    });
+    layer.reset(now);
+  }
+  void pump() {
+    for (const std::string &d : sock.receive()) {
+      SipParser msg;
+      if (!msg.parse(d.data(), d.size()))
+        continue;
+      uint32_t id = 0;
+      bool up = msg.is_response() ? layer.on_response(msg, now, &id)
+                                  : layer.on_request(msg, SipEndpoint{LOOPBACK, peer_port}, now, &id);
+      if (up)
+        passed.push_back({d, id});
+    }
+  }
+  // advances the clock to now + ms in loop-sized steps
+  void run(uint32_t ms) {
+    for (uint32_t t = 0; t < ms; t += 10) {
+      now += 10;
+      pump();
+      layer.poll(now);
+    }
+  }
+  uint16_t peer_port = 0;
+};
+
+static std::string header(const std::string &msg, const char *name) {
+  std::string key = std::string("\r\n") + name + ": ";
+  size_t p = msg.find(key);
+  if (p == std::string::npos)
+    return "";
+  p += key.size();
+  return msg.substr(p, msg.find("\r\n", p) - p);
+}
+
+static std::string start_line(const std::string &msg) { return msg.substr(0, msg.find("\r\n")); }
+
+static std::string request(const char *method, const char *branch, int cseq, const char *cseq_method = nullptr,
+                           const char *call_id = "abc@127.0.0.1", const char *to_tag = nullptr) {
+  char buf[1024];
+  snprintf(buf, sizeof(buf),
+           "%s sip:100@127.0.0.1 SIP/2.0\r\n"
+           "Via: SIP/2.0/UDP 127.0.0.1:5060;branch=%s;rport\r\n"
+           "Max-Forwards: 70\r\n"
+           "From: <sip:door@127.0.0.1>;tag=1111\r\n"
+           "To: <sip:100@127.0.0.1>%s%s\r\n"
+           "Call-ID: %s\r\n"
+           "CSeq: %d %s\r\n"
+           "Content-Length: 0\r\n\r\n",
+           method, branch, to_tag ? ";tag=" : "", to_tag ? to_tag : "", call_id, cseq,
+           cseq_method ? cseq_method : method);
+  return buf;
+}
+
+// Response to req as a UAS would send it: Via, From, Call-ID and CSeq copied, a tag added to To
+static std::string response(const std::string &req, int status, const char *reason) {
+  char buf[1024];
+  std::string to = header(req, "To");
+  if (status > 100 && to.find(";tag=") == std::string::npos)
+    to += ";tag=peer99";
+  snprintf(buf, sizeof(buf),
+           "SIP/2.0 %d %s\r\nVia: %s;received=127.0.0.1\r\nFrom: %s\r\nTo: %s\r\nCall-ID: %s\r\nCSeq: %s\r\n"
+           "Content-Length: 0\r\n\r\n",
+           status, reason, header(req, "Via").c_str(), header(req, "From").c_str(), to.c_str(),
+           header(req, "Call-ID").c_str(), header(req, "CSeq").c_str());
+  return buf;
+}
+
+static void test_timer_wheel() {
+  TimerWheel wheel(10);
+  TimerWheel::Timer a, b, c;
+  a.tag = 1;
+  b.tag = 2;
+  c.tag = 3;
+  std::vector<int> fired;
+  auto collect = [&](TimerWheel::Timer *t) { fired.push_back(t->tag); };
+
+  // due exactly at the expiry, never before; longer than one revolution of 640 ms
+  uint32_t start = 0xFFFFFF00u;  // the millis() counter wraps during the test
+  wheel.reset(start);
+  wheel.start(&a, start, 25);
+  wheel.start(&b, start, 2000);
+  wheel.start(&c, start, 700);
+  CHECK(wheel.size() == 3);
+  wheel.advance(start + 24, collect);
+  CHECK(fired.empty());
+  wheel.advance(start + 25, collect);
+  CHECK(fired.size() == 1 && fired[0] == 1 && !a.armed());
+  wheel.advance(start + 690, collect);
+  CHECK(fired.size() == 1);
+  wheel.advance(start + 700, collect);
+  CHECK(fired.size() == 2 && fired[1] == 3);
+  wheel.stop(&b);
+  wheel.advance(start + 5000, collect);
+  CHECK(fired.size() == 2 && wheel.size() == 0);
+
+  // a skipped stretch of many revolutions fires everything due at once; callbacks may re-arm
+  fired.clear();
+  uint32_t now = 100000;
+  wheel.reset(now);
+  wheel.start(&a, now, 10);
+  wheel.start(&b, now, 3000);
+  int rearmed = 0;
+  wheel.advance(now + 10000, [&](TimerWheel::Timer *t) {
+    fired.push_back(t->tag);
+    if (t == &a && rearmed++ == 0)
+      wheel.start(&a, now + 10000, 0);
+  });
+  CHECK(fired.size() == 2);
+  CHECK(a.armed() && wheel.size() == 1);
+  wheel.advance(now + 10000, collect);
+  CHECK(fired.size() == 3 && !a.armed());
+
+  // stopping a timer that is due in the same pass keeps it from firing
+  fired.clear();
+  now += 10000;
+  wheel.start(&a, now, 5);
+  wheel.start(&b, now, 5);
+  wheel.advance(now + 20, [&](TimerWheel::Timer *t) {
+    fired.push_back(t->tag);
+    wheel.stop(t == &a ? &b : &a);
+  });
+  CHECK(fired.size() == 1 && wheel.size() == 0);
+}
+
+// INVITE with its first two copies lost: Timer A retransmits after 500 and 1000 ms more
+static void test_invite_retransmission() {
+  UdpSocket peer;
+  Stack stack;
+  stack.peer_port = peer.port;
+  std::string invite = request("INVITE", "z9hG4bK1001", 1);
+  uint32_t id = stack.layer.send_request({LOOPBACK, peer.port}, invite.data(), invite.size(), stack.now);
+  CHECK(id != 0);
+  CHECK(stack.layer.get_state(id) == SIP_TXN_CALLING);
+  CHECK(peer.receive().size() == 1);  // lost
+  stack.run(490);
+  CHECK(peer.receive().empty());
+  stack.run(10);
+  CHECK(peer.receive().size() == 1);  // lost again
+  stack.run(990);
+  CHECK(peer.receive().empty());
+  stack.run(10);
+  std::vector<std::string> got = peer.receive();
+  CHECK(got.size() == 1 && got[0] == invite);
+
+  peer.send(stack.sock.port, response(invite, 100, "Trying"));
+  stack.run(10);
+  CHECK(stack.layer.get_state(id) == SIP_TXN_PROCEEDING);
+  stack.run(20000);
+  CHECK(peer.receive().empty());  // no more retransmissions, and no Timer B either
+  CHECK(stack.timeouts.empty());
+
+  peer.send(stack.sock.port, response(invite, 180, "Ringing"));
+  std::string ok = response(invite, 200, "OK");
+  peer.send(stack.sock.port, ok);
+  stack.run(10);
+  // 100 and 180 and the 200 reach the caller, the transaction ends with the 2xx
+  CHECK(stack.passed.size() == 3);
+  CHECK(stack.passed[2].id == id);
+  CHECK(stack.layer.get_state(id) == SIP_TXN_TERMINATED);
+  CHECK(stack.layer.active() == 0);
+  // a retransmitted 2xx is passed up without a transaction, the caller ACKs it again
+  peer.send(stack.sock.port, ok);
+  stack.run(10);
+  CHECK(stack.passed.size() == 4 && stack.passed[3].id == 0);
+  CHECK(peer.receive().empty());
+  CHECK(stack.layer.get_retransmissions() == 2);
+}
+
+// 401 to INVITE: ACKed by the layer, retransmitted 401s absorbed and ACKed again
+static void test_failure_ack() {
+  UdpSocket peer;
+  Stack stack;
+  stack.peer_port = peer.port;
+  std::string invite = request("INVITE", "z9hG4bK2002", 1);
+  uint32_t id = stack.layer.send_request({LOOPBACK, peer.port}, invite.data(), invite.size(), stack.now);
+  peer.receive();
+  std::string unauthorized = response(invite, 401, "Unauthorized");
+  peer.send(stack.sock.port, unauthorized);
+  stack.run(10);
+  CHECK(stack.passed.size() == 1);
+  CHECK(stack.layer.get_state(id) == SIP_TXN_COMPLETED);
+  std::vector<std::string> got = peer.receive();
+  CHECK(got.size() == 1);
+  if (got.size() == 1) {
+    const std::string &ack = got[0];
+    CHECK(start_line(ack) == "ACK sip:100@127.0.0.1 SIP/2.0");
+    CHECK(header(ack, "Via") == header(invite, "Via"));  // same branch as the INVITE
+    CHECK(header(ack, "To") == "<sip:100@127.0.0.1>;tag=peer99");
+    CHECK(header(ack, "From") == header(invite, "From"));
+    CHECK(header(ack, "Call-ID") == header(invite, "Call-ID"));
+    CHECK(header(ack, "CSeq") == "1 ACK");
+    CHECK(header(ack, "Content-Length") == "0");
+  }
+  // no INVITE retransmission after the final response
+  stack.run(5000);
+  CHECK(peer.receive().empty());
+
+  // the ACK got lost and the 401 comes again: absorbed, ACKed again
+  peer.send(stack.sock.port, unauthorized);
+  peer.send(stack.sock.port, unauthorized);
+  stack.run(10);
+  CHECK(stack.passed.size() == 1);
+  got = peer.receive();
+  CHECK(got.size() == 2 && start_line(got[0]).compare(0, 4, "ACK ") == 0);
+  CHECK(stack.layer.get_absorbed() == 2);
+  // Timer D ends the transaction after 32 s
+  stack.run(27000);
+  CHECK(stack.layer.get_state(id) == SIP_TXN_TERMINATED);
+  CHECK(stack.timeouts.empty());
+}
+
+// Nobody answers: 7 INVITEs at 0, 0.5, 1.5, 3.5, 7.5, 15.5 and 31.5 s, then Timer B at 32 s
+static void test_timer_b() {
+  UdpSocket peer;
+  Stack stack;
+  stack.peer_port = peer.port;
+  std::string invite = request("INVITE", "z9hG4bK3003", 1);
+  uint32_t start = stack.now;
+  uint32_t id = stack.layer.send_request({LOOPBACK, peer.port}, invite.data(), invite.size(), stack.now);
+  std::vector<uint32_t> sent = {0};
+  peer.receive();
+  while (stack.timeouts.empty() && stack.now - start < 40000) {
+    stack.run(10);
+    if (!peer.receive().empty())
+      sent.push_back(stack.now - start);
+  }
+  CHECK((sent == std::vector<uint32_t>{0, 500, 1500, 3500, 7500, 15500, 31500}));
+  CHECK(stack.now - start == 32000);
+  CHECK(stack.timeouts.size() == 1 && stack.timeouts[0].id == id);
+  CHECK(stack.timeouts.size() == 1 && stack.timeouts[0].data == std::to_string((int)SIP_METHOD_INVITE));
+  CHECK(stack.layer.active() == 0);
+}
+
+// BYE: Timer E doubles up to T2, Timer F gives up at 32 s; a 200 stops it and Timer K absorbs copies
+static void test_non_invite_client() {
+  UdpSocket peer;
+  Stack stack;
+  stack.peer_port = peer.port;
+  std::string bye = request("BYE", "z9hG4bK4004", 2, nullptr, "abc@127.0.0.1", "peer99");
+  uint32_t start = stack.now;
+  uint32_t id = stack.layer.send_request({LOOPBACK, peer.port}, bye.data(), bye.size(), stack.now);
+  CHECK(stack.layer.get_state(id) == SIP_TXN_TRYING);
+  std::vector<uint32_t> sent = {0};
+  peer.receive();
+  while (stack.timeouts.empty() && stack.now - start < 40000) {
+    stack.run(10);
+    if (!peer.receive().empty())
+      sent.push_back(stack.now - start);
+  }
+  CHECK((sent == std::vector<uint32_t>{0, 500, 1500, 3500, 7500, 11500, 15500, 19500, 23500, 27500, 31500}));
+  CHECK(stack.timeouts.size() == 1 && stack.timeouts[0].id == id);
+
+  // second BYE: after 100 Trying it is repeated every T2, the 200 ends it
+  bye = request("BYE", "z9hG4bK4005", 3, nullptr, "abc@127.0.0.1", "peer99");
+  start = stack.now;
+  id = stack.layer.send_request({LOOPBACK, peer.port}, bye.data(), bye.size(), stack.now);
+  peer.receive();
+  stack.run(500);
+  CHECK(peer.receive().size() == 1);
+  peer.send(stack.sock.port, response(bye, 100, "Trying"));
+  stack.run(10);
+  CHECK(stack.layer.get_state(id) == SIP_TXN_PROCEEDING);
+  // the pending Timer E still fires at 1.5 s, from then on every T2
+  stack.run(990);
+  CHECK(peer.receive().size() == 1);
+  stack.run(3990);
+  CHECK(peer.receive().empty());
+  stack.run(10);
+  CHECK(peer.receive().size() == 1);
+  std::string ok = response(bye, 200, "OK");
+  peer.send(stack.sock.port, ok);
+  stack.run(10);
+  size_t passed = stack.passed.size();
+  CHECK(stack.layer.get_state(id) == SIP_TXN_COMPLETED);
+  CHECK(passed >= 2 && stack.passed[passed - 1].id == id);
+  peer.send(stack.sock.port, ok);
+  stack.run(10);
+  CHECK(stack.passed.size() == passed);
+  stack.run(5000);  // Timer K
+  CHECK(stack.layer.get_state(id) == SIP_TXN_TERMINATED);
+  CHECK(peer.receive().empty());
+  CHECK(stack.timeouts.size() == 1);
+}
+
+// CANCEL shares the branch of the INVITE but is a transaction of its own
+static void test_cancel() {
+  UdpSocket peer;
+  Stack stack;
+  stack.peer_port = peer.port;
+  std::string invite = request("INVITE", "z9hG4bK5005", 1);
+  uint32_t inv = stack.layer.send_request({LOOPBACK, peer.port}, invite.data(), invite.size(), stack.now);
+  peer.receive();
+  std::string ringing = response(invite, 180, "Ringing");
+  peer.send(stack.sock.port, ringing);
+  stack.run(10);
+  uint32_t cancel = stack.layer.cancel(inv, stack.now);
+  CHECK(cancel != 0 && cancel != inv);
+  std::vector<std::string> got = peer.receive();
+  CHECK(got.size() == 1);
+  std::string req = got.empty() ? "" : got[0];
+  CHECK(start_line(req) == "CANCEL sip:100@127.0.0.1 SIP/2.0");
+  CHECK(header(req, "Via") == header(invite, "Via"));
+  CHECK(header(req, "To") == header(invite, "To"));  // without the tag of the 180
+  CHECK(header(req, "CSeq") == "1 CANCEL");
+  CHECK(stack.layer.cancel(cancel, stack.now) == 0);  // only INVITEs can be cancelled
+
+  // the CANCEL is lost once, then both final responses arrive
+  stack.run(500);
+  CHECK(peer.receive().size() == 1);
+  peer.send(stack.sock.port, response(req, 200, "OK"));
+  stack.run(10);
+  CHECK(stack.passed.back().id == cancel);
+  CHECK(stack.layer.get_state(cancel) == SIP_TXN_COMPLETED);
+  CHECK(stack.layer.get_state(inv) == SIP_TXN_PROCEEDING);
+  peer.send(stack.sock.port, response(invite, 487, "Request Terminated"));
+  stack.run(10);
+  CHECK(stack.passed.back().id == inv);
+  CHECK(stack.layer.get_state(inv) == SIP_TXN_COMPLETED);
+  got = peer.receive();
+  CHECK(got.size() == 1 && start_line(got[0]).compare(0, 4, "ACK ") == 0);
+  CHECK(got.size() == 1 && header(got[0], "CSeq") == "1 ACK");
+  stack.run(40000);
+  CHECK(stack.layer.active() == 0 && stack.timeouts.empty());
+}
+
+// OPTIONS from the peer: retransmitted requests get the stored response again until Timer J
+static void test_non_invite_server() {
+  UdpSocket peer;
+  Stack stack;
+  stack.peer_port = peer.port;
+  std::string options = request("OPTIONS", "z9hG4bKpeer1", 7);
+  peer.send(stack.sock.port, options);
+  peer.send(stack.sock.port, options);  // retransmitted before we answered: absorbed silently
+  stack.run(10);
+  CHECK(stack.passed.size() == 1);
+  uint32_t id = stack.passed.empty() ? 0 : stack.passed[0].id;
+  CHECK(id != 0 && stack.layer.get_state(id) == SIP_TXN_TRYING);
+  CHECK(peer.receive().empty());
+  std::string ok = response(options, 200, "OK");
+  CHECK(stack.layer.respond(id, 200, ok.data(), ok.size(), stack.now));
+  CHECK(!stack.layer.respond(id, 200, ok.data(), ok.size(), stack.now));
+  CHECK(peer.receive().size() == 1);
+  peer.send(stack.sock.port, options);
+  stack.run(10);
+  std::vector<std::string> got = peer.receive();
+  CHECK(got.size() == 1 && got[0] == ok);
+  CHECK(stack.passed.size() == 1);
+  stack.run(32000);
+  CHECK(stack.layer.get_state(id) == SIP_TXN_TERMINATED);
+  CHECK(stack.timeouts.empty());
+  // after Timer J the same request is new again
+  peer.send(stack.sock.port, options);
+  stack.run(10);
+  CHECK(stack.passed.size() == 2 && stack.passed[1].id != id);
+
+  // an RFC 2543 peer without the magic cookie is matched by Call-ID, CSeq and Via
+  std::string old = request("INFO", "1234", 3);
+  peer.send(stack.sock.port, old);
+  peer.send(stack.sock.port, old);
+  stack.run(10);
+  CHECK(stack.passed.size() == 3);
+  std::string other = request("INFO", "1234", 4);
+  peer.send(stack.sock.port, other);
+  stack.run(10);
+  CHECK(stack.passed.size() == 4);
+}
+
+// INVITE from the peer: a failure response is retransmitted until the ACK (Timer G), a 2xx too
+static void test_invite_server() {
+  UdpSocket peer;
+  Stack stack;
+  stack.peer_port = peer.port;
+  std::string invite = request("INVITE", "z9hG4bKpeer2", 1, nullptr, "in1@127.0.0.1");
+  peer.send(stack.sock.port, invite);
+  stack.run(10);
+  uint32_t id = stack.passed.empty() ? 0 : stack.passed.back().id;
+  CHECK(stack.layer.get_state(id) == SIP_TXN_PROCEEDING);
+  std::string ringing = response(invite, 180, "Ringing");
+  std::string busy = response(invite, 486, "Busy Here");
+  CHECK(stack.layer.respond(id, 180, ringing.data(), ringing.size(), stack.now));
+  // the INVITE comes again while ringing: the 180 is repeated
+  peer.send(stack.sock.port, invite);
+  stack.run(10);
+  std::vector<std::string> got = peer.receive();
+  CHECK(got.size() == 2 && got[1] == ringing);
+  CHECK(stack.layer.respond(id, 486, busy.data(), busy.size(), stack.now));
+  CHECK(peer.receive().size() == 1);
+  // Timer G: 500, then 1000 ms
+  stack.run(500);
+  CHECK(peer.receive().size() == 1);
+  stack.run(1000);
+  CHECK(peer.receive().size() == 1);
+  std::string ack = request("ACK", "z9hG4bKpeer2", 1, nullptr, "in1@127.0.0.1", "peer99");
+  peer.send(stack.sock.port, ack);
+  peer.send(stack.sock.port, ack);
+  stack.run(10);
+  CHECK(stack.layer.get_state(id) == SIP_TXN_CONFIRMED);
+  CHECK(stack.passed.size() == 1);  // both ACKs absorbed
+  stack.run(5000);                  // Timer I
+  CHECK(stack.layer.get_state(id) == SIP_TXN_TERMINATED);
+  CHECK(peer.receive().empty());
+
+  // accepted: the 2xx goes out until the ACK, which has a new branch and is passed up
+  invite = request("INVITE", "z9hG4bKpeer3", 1, nullptr, "in2@127.0.0.1");
+  peer.send(stack.sock.port, invite);
+  stack.run(10);
+  id = stack.passed.back().id;
+  std::string ok = response(invite, 200, "OK");
+  CHECK(stack.layer.respond(id, 200, ok.data(), ok.size(), stack.now));
+  CHECK(stack.layer.get_state(id) == SIP_TXN_ACCEPTED);
+  stack.run(1500);
+  CHECK(peer.receive().size() == 3);
+  peer.send(stack.sock.port, request("ACK", "z9hG4bKpeer4", 1, nullptr, "in2@127.0.0.1", "peer99"));
+  stack.run(10);
+  CHECK(stack.passed.back().id == id);
+  stack.run(10000);
+  CHECK(peer.receive().empty());
+  stack.run(30000);  // Timer L
+  CHECK(stack.layer.get_state(id) == SIP_TXN_TERMINATED);
+  CHECK(stack.timeouts.empty());
+
+  // ... and if the ACK never comes, Timer L reports it
+  invite = request("INVITE", "z9hG4bKpeer5", 1, nullptr, "in3@127.0.0.1");
+  peer.send(stack.sock.port, invite);
+  stack.run(10);
+  id = stack.passed.back().id;
+  ok = response(invite, 200, "OK");
+  stack.layer.respond(id, 200, ok.data(), ok.size(), stack.now);
+  stack.run(33000);
+  CHECK(stack.timeouts.size() == 1 && stack.timeouts[0].id == id);
+  // 0.5, 1.5, 3.5, 7.5, then every 4 s up to 31.5 s
+  CHECK(peer.receive().size() == 1 + 4 + 6);
+}
+
+static void test_table_full() {
+  UdpSocket peer;
+  Stack stack;
+  stack.peer_port = peer.port;
+  uint32_t ids[SipTransactionLayer::MAX_TRANSACTIONS];
+  for (size_t i = 0; i < SipTransactionLayer::MAX_TRANSACTIONS; i++) {
+    std::string branch = "z9hG4bKfull" + std::to_string(i);
+    std::string req = request("MESSAGE", branch.c_str(), (int)i + 1);
+    ids[i] = stack.layer.send_request({LOOPBACK, peer.port}, req.data(), req.size(), stack.now);
+    CHECK(ids[i] != 0);
+  }
+  std::string req = request("MESSAGE", "z9hG4bKfull9", 9);
+  CHECK(stack.layer.send_request({LOOPBACK, peer.port}, req.data(), req.size(), stack.now) == 0);
+  // without the cookie there is no way to match the responses
+  req = request("MESSAGE", "1234", 10);
+  stack.layer.terminate(ids[0]);
+  CHECK(stack.layer.send_request({LOOPBACK, peer.port}, req.data(), req.size(), stack.now) == 0);
+  CHECK(stack.layer.active() == SipTransactionLayer::MAX_TRANSACTIONS - 1);
+  // a request that finds the table full still goes up, without a transaction
+  req = request("MESSAGE", "z9hG4bKfull8", 8);
+  stack.layer.send_request({LOOPBACK, peer.port}, req.data(), req.size(), stack.now);
+  peer.send(stack.sock.port, request("OPTIONS", "z9hG4bKpeer6", 1));
+  stack.run(10);
+  CHECK(stack.passed.size() == 1 && stack.passed[0].id == 0);
+  // ACK is sent as is and never retransmitted
+  req = request("ACK", "z9hG4bKack", 1);
+  peer.receive();
+  CHECK(stack.layer.send_request({LOOPBACK, peer.port}, req.data(), req.size(), stack.now) == 0);
+  CHECK(peer.receive().size() == 1);
+
+  // a larger table for more calls; the old transactions are dropped
+  CHECK(stack.layer.set_capacity(SipTransactionLayer::MAX_TRANSACTIONS + 4));
+  CHECK(stack.layer.capacity() == SipTransactionLayer::MAX_TRANSACTIONS + 4);
+  CHECK(stack.layer.active() == 0);
+  for (size_t i = 0; i < stack.layer.capacity(); i++) {
+    std::string branch = "z9hG4bKmore" + std::to_string(i);
+    req = request("MESSAGE", branch.c_str(), (int)i + 1);
+    CHECK(stack.layer.send_request({LOOPBACK, peer.port}, req.data(), req.size(), stack.now) != 0);
+  }
+  req = request("MESSAGE", "z9hG4bKmore99", 99);
+  CHECK(stack.layer.send_request({LOOPBACK, peer.port}, req.data(), req.size(), stack.now) == 0);
+  // the timers of the last slot fire like those of the first
+  peer.receive();
+  stack.run(600);
+  CHECK(peer.receive().size() == stack.layer.capacity());
+}
+
+template<typename F> static double seconds(F &&f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Cost of the per-loop poll: idle, and with every transaction waiting on its timers
+static void benchmark(int rounds) {
+  SipTransactionLayer layer;
+  size_t sent = 0;
+  layer.set_send_callback([&](const SipEndpoint &, const char *, size_t) { sent++; });
+  layer.set_timers(500, 4000, 5000);
+  uint32_t now = 0;
+  layer.reset(now);
+  double t_idle = seconds([&] {
+    for (int i = 0; i < rounds; i++)
+      layer.poll(now += 1);
+  });
+  for (size_t i = 0; i < SipTransactionLayer::MAX_TRANSACTIONS; i++) {
+    std::string branch = "z9hG4bKbench" + std::to_string(i);
+    std::string req = request(i == 0 ? "INVITE" : "BYE", branch.c_str(), 1);
+    layer.send_request({LOOPBACK, 5060}, req.data(), req.size(), now);
+  }
+  // one poll per ms, as with a 1 ms main loop; the transactions time out after 32 s
+  int busy_rounds = rounds < 30000 ? rounds : 30000;
+  double t_busy = seconds([&] {
+    for (int i = 0; i < busy_rounds; i++)
+      layer.poll(now += 1);
+  });
+  printf("poll(), one call per ms:\n");
+  printf("  no transactions        %6.1f ns/call\n", t_idle * 1e9 / rounds);
+  printf("  %u transactions         %6.1f ns/call, %u retransmissions\n",
+         (unsigned)SipTransactionLayer::MAX_TRANSACTIONS, t_busy * 1e9 / busy_rounds, (unsigned)sent);
+  printf("  layer state: %u bytes\n", (unsigned)layer.get_memory_size());
+}
+
+int main(int argc, char **argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 1000000;
+  test_timer_wheel();
+  test_invite_retransmission();
+  test_failure_ack();
+  test_timer_b();
+  test_non_invite_client();
+  test_cancel();
+  test_non_invite_server();
+  test_invite_server();
+  test_table_full();
+  benchmark(rounds);
+
+  if (failures) {
+    std::cerr << failures << " tests failed" << std::endl;
+    return 1;
+  }
+  std::cout << "All tests passed." << std::endl;
+  return 0;
+}
@@ -0,0 +1,390 @@
+#include "../comfort_noise.h"
+#include "../vad.h"
+#include "audio_fixtures.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+using esphome::voip::ComfortNoiseGenerator;
+using esphome::voip::DtxScheduler;
+using esphome::voip::VoiceActivityDetector;
+namespace voip = esphome::voip;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+  do {                                                                      \
+    if (!(cond)) {                                                          \
+      std::cerr << "FAILED " << __LINE__ << ": " << #cond << std::endl;     \
+      ++failures;                                                           \
+    }                                                                       \
+  } while (0)
+
+static const size_t FRAME = 160;  // 20 ms
+static const uint32_t FRAME_MS = 20;
+
+static double dbov(const int16_t *x, size_t n) {
+  double ms = 0;
+  for (size_t i = 0; i < n; i++)
+    ms += (double)x[i] * x[i];
+  return 10 * std::log10(ms / n / (32768.0 * 32768.0) + 1e-12);
+}
+
+struct Resonator {
+  double a1, a2, y1 = 0, y2 = 0;
+  Resonator(double f, double bw) {
+    double r = std::exp(-M_PI * bw / 8000);
+    a1 = 2 * r * std::cos(2 * M_PI * f / 8000);
+    a2 = -r * r;
+  }
+  double run(double in) {
+    double y = in + a1 * y1 + a2 * y2;
+    y2 = y1;
+    y1 = y;
+    return y;
+  }
+};
+
+// A conversation as the microphone hears it: talkspurts of 0.6 to 2.5 s made of voiced and
+// unvoiced syllables with short gaps, pauses of 0.6 to 3 s, and background noise that steps from
+// -55 to -42 dBov halfway (a fan switching on). clean holds the speech alone.
+struct Recording {
+  std::vector<int16_t> mic;
+  std::vector<int16_t> clean;
+  double noise_dbov[2];
+  size_t noise_step;
+};
+
+static Recording conversation(size_t seconds) {
+  const size_t n = 8000 * seconds;
+  std::vector<double> speech(n, 0.0);
+  size_t i = 8000;  // a second of noise first
+  while (i < n) {
+    size_t spurt_end = i + 4800 + (size_t)(uniform() * 15200);
+    double gain = std::pow(10.0, (-14 - 10 * uniform()) / 20);
+    while (i < spurt_end && i < n) {
+      bool voiced = uniform() < 0.75;
+      size_t len = voiced ? 800 + (size_t)(uniform() * 1200) : 480 + (size_t)(uniform() * 480);
+      Resonator f1(400 + 400 * uniform(), 80), f2(1000 + 800 * uniform(), 120), f3(2500, 200), hiss(3000, 900);
+      double f0 = 90 + 120 * uniform(), phase = 1.0;
+      for (size_t k = 0; k < len && i < n; k++, i++) {
+        double env = std::sin(M_PI * k / len);
+        double v;
+        if (voiced) {
+          double e = 0;
+          phase += f0 / 8000;
+          if (phase >= 1.0) {
+            phase -= 1.0;
+            e = 1.0;
+          }
+          v = 0.05 * (f1.run(e) + 0.5 * f2.run(e) + 0.25 * f3.run(e));
+        } else {
+          v = 0.4 * hiss.run(uniform() - 0.5);
+        }
+        speech[i] = v * env * gain;
+      }
+      i += 240 + (size_t)(uniform() * 400);  // gap between syllables
+    }
+    i += 4800 + (size_t)(uniform() * 19200);
+  }
+  Recording rec;
+  rec.noise_dbov[0] = -55;
+  rec.noise_dbov[1] = -42;
+  rec.noise_step = n / 2;
+  rec.mic.resize(n);
+  rec.clean.resize(n);
+  // low-passed noise, scaled to the wanted rms
+  std::vector<double> noise(n);
+  double lp = 0, ms = 0;
+  for (size_t k = 0; k < n; k++) {
+    lp = 0.8 * lp + 0.2 * (uniform() - 0.5);
+    noise[k] = lp;
+    ms += lp * lp;
+  }
+  double noise_rms = std::sqrt(ms / n);
+  for (size_t k = 0; k < n; k++) {
+    double level = rec.noise_dbov[k < rec.noise_step ? 0 : 1];
+    double nz = noise[k] / noise_rms * 32768 * std::pow(10.0, level / 20);
+    double s = speech[k] * 32768;
+    rec.clean[k] = (int16_t)std::lrint(s);
+    double m = s + nz + 40;  // and a small DC offset
+    rec.mic[k] = (int16_t)(m > 32767 ? 32767 : (m < -32768 ? -32768 : m));
+  }
+  return rec;
+}
+
+// Wi-Fi airtime of one RTP packet, 802.11g/n at 24 Mbit/s without aggregation: DIFS, mean backoff,
+// preamble, SIFS and ACK come to about 150 us, plus 84 bytes of MAC, LLC, IP, UDP and RTP headers
+static double airtime_us(size_t payload) { return 150 + (84 + payload) * 8 / 24.0; }
+
+struct DtxResult {
+  size_t frames;
+  size_t speech_frames;
+  size_t packets;
+  size_t sids;
+  size_t bytes;
+  double airtime_us;
+};
+
+// The TX path of a G.711 call with DTX over a recording; decisions gets the VAD output per frame
+static DtxResult simulate(const std::vector<int16_t> &mic, std::vector<bool> *decisions,
+                          std::vector<uint8_t> *sid_levels) {
+  VoiceActivityDetector vad;
+  DtxScheduler dtx;
+  DtxResult r{};
+  for (size_t f = 0; f + FRAME <= mic.size(); f += FRAME) {
+    bool speech = vad.process(&mic[f], FRAME);
+    if (decisions)
+      decisions->push_back(speech);
+    r.frames++;
+    r.speech_frames += speech;
+    DtxScheduler::Action action = dtx.next(speech, vad.get_noise_dbov(), FRAME_MS);
+    // the level the far end plays at, per frame
+    if (sid_levels)
+      sid_levels->push_back(dtx.get_sid_level());
+    switch (action) {
+      case DtxScheduler::SEND:
+        r.packets++;
+        r.bytes += FRAME;
+        r.airtime_us += airtime_us(FRAME);
+        break;
+      case DtxScheduler::SEND_SID:
+        r.packets++;
+        r.sids++;
+        r.bytes += 1;
+        r.airtime_us += airtime_us(1);
+        break;
+      case DtxScheduler::SKIP:
+        break;
+    }
+  }
+  return r;
+}
+
+static void print_savings(const char *name, const DtxResult &r) {
+  double seconds = r.frames * FRAME_MS / 1000.0;
+  double full_airtime = r.frames * airtime_us(FRAME);
+  printf("%s, %.0f s: speech in %.0f %% of frames, %.1f packets/s (%u SID) instead of %.0f, %.0f instead of %.0f "
+         "bytes/s payload, airtime %.1f instead of %.1f ms/s (%.0f %% saved)\n",
+         name, seconds, 100.0 * r.speech_frames / r.frames, r.packets / seconds, (unsigned)r.sids,
+         1000.0 / FRAME_MS, r.bytes / seconds, r.frames * FRAME / seconds, r.airtime_us / seconds / 1000,
+         full_airtime / seconds / 1000, 100 * (1 - r.airtime_us / full_airtime));
+}
+
+static void test_vad_on_conversation() {
+  Recording rec = conversation(60);
+  std::vector<bool> decisions;
+  std::vector<uint8_t> sid_levels;
+  DtxResult r = simulate(rec.mic, &decisions, &sid_levels);
+  // speech louder than the noise is detected; noise more than the hangover after speech is not
+  size_t audible = 0, detected = 0, idle = 0, false_alarms = 0, level_errors = 0, levels = 0;
+  size_t since_speech = 1000;
+  const size_t hangover_frames = VoiceActivityDetector::HANGOVER_MS / FRAME_MS + 1;
+  for (size_t f = 0; f < decisions.size(); f++) {
+    size_t at = f * FRAME;
+    double noise = rec.noise_dbov[at < rec.noise_step ? 0 : 1];
+    double clean = dbov(&rec.clean[at], FRAME);
+    // the noise detector may take two seconds to learn the louder fan
+    bool settling = at < 8000 || (at >= rec.noise_step && at < rec.noise_step + 16000);
+    since_speech = clean > -80 ? 0 : since_speech + 1;
+    if (clean > noise + 3) {
+      audible++;
+      detected += decisions[f];
+    } else if (since_speech > hangover_frames && !settling) {
+      idle++;
+      false_alarms += decisions[f];
+      // the SID level follows the noise
+      levels++;
+      level_errors += std::fabs(-(double)sid_levels[f] - noise) > 3;
+    }
+  }
+  double detection = 100.0 * detected / audible, false_alarm = 100.0 * false_alarms / idle;
+  printf("synthetic conversation: %.1f %% of speech frames detected, %.1f %% of noise frames taken for speech, "
+         "SID level off by more than 3 dB in %u of %u silent frames\n",
+         detection, false_alarm, (unsigned)level_errors, (unsigned)levels);
+  CHECK(detection > 96);
+  CHECK(false_alarm < 5);
+  CHECK(level_errors * 20 < levels);
+  print_savings("synthetic conversation", r);
+  CHECK(r.packets * 3 < r.frames * 2);
+}
+
+static void test_dtx_scheduler() {
+  DtxScheduler dtx;
+  // the first speech frame starts a talkspurt, the next ones do not
+  CHECK(dtx.next(true, -50, FRAME_MS) == DtxScheduler::SEND);
+  CHECK(dtx.is_talkspurt_start());
+  CHECK(dtx.next(true, -50, FRAME_MS) == DtxScheduler::SEND);
+  CHECK(!dtx.is_talkspurt_start());
+  // silence: a SID with the level, then nothing until SID_INTERVAL_MS has passed
+  CHECK(dtx.next(false, -50, FRAME_MS) == DtxScheduler::SEND_SID);
+  CHECK(dtx.get_sid_level() == 50);
+  size_t skipped = 0;
+  while (dtx.next(false, -51, FRAME_MS) == DtxScheduler::SKIP)
+    skipped++;
+  CHECK(skipped + 1 == DtxScheduler::SID_INTERVAL_MS / FRAME_MS);
+  CHECK(dtx.get_sid_level() == 51);
+  // a level step of 3 dB is sent at once
+  CHECK(dtx.next(false, -51, FRAME_MS) == DtxScheduler::SKIP);
+  CHECK(dtx.next(false, -48, FRAME_MS) == DtxScheduler::SEND_SID);
+  CHECK(dtx.next(false, -50, FRAME_MS) == DtxScheduler::SKIP);
+  // speech after silence carries the marker again
+  CHECK(dtx.next(true, -50, FRAME_MS) == DtxScheduler::SEND);
+  CHECK(dtx.is_talkspurt_start());
+  // levels outside the payload's range are clamped
+  CHECK(dtx.next(false, -140, FRAME_MS) == DtxScheduler::SEND_SID);
+  CHECK(dtx.get_sid_level() == 127);
+  dtx.reset();
+  CHECK(dtx.next(false, 5, FRAME_MS) == DtxScheduler::SEND_SID);
+  CHECK(dtx.get_sid_level() == 0);
+}
+
+static void test_vad_edges() {
+  // digital silence and an idle microphone are never speech; a loud tone after them is, at once
+  VoiceActivityDetector vad;
+  std::vector<int16_t> frame(FRAME, 0);
+  for (int k = 0; k < 50; k++)
+    CHECK(!vad.process(frame.data(), FRAME));
+  CHECK(vad.get_noise_dbov() == -96);
+  for (size_t i = 0; i < FRAME; i++)
+    frame[i] = (int16_t)((lcg() >> 16) % 5) - 2;
+  CHECK(!vad.process(frame.data(), FRAME));
+  for (size_t i = 0; i < FRAME; i++)
+    frame[i] = (int16_t)std::lrint(8000 * std::sin(2 * M_PI * 300 * i / 8000));
+  CHECK(vad.process(frame.data(), FRAME));
+  CHECK(std::abs(vad.get_level_dbov() - (int)std::lrint(dbov(frame.data(), FRAME))) <= 1);
+  // the hangover holds speech for 200 ms, then it ends
+  std::fill(frame.begin(), frame.end(), 0);
+  for (uint32_t ms = 0; ms < VoiceActivityDetector::HANGOVER_MS; ms += FRAME_MS)
+    CHECK(vad.process(frame.data(), FRAME));
+  CHECK(!vad.process(frame.data(), FRAME));
+  // full scale and odd frame lengths
+  for (size_t i = 0; i < FRAME; i++)
+    frame[i] = i % 2 ? 32767 : -32768;
+  CHECK(vad.process(frame.data(), FRAME));
+  CHECK(vad.get_level_dbov() == 0);
+  CHECK(vad.get_zero_crossings() > 250);
+  vad.process(frame.data(), 1);
+  vad.process(frame.data(), 0);
+}
+
+static void test_external_noise() {
+  // a noise level set from outside is kept, through quiet frames and the minimum of every second
+  VoiceActivityDetector vad;
+  std::vector<int16_t> frame(FRAME);
+  int noise = 0;
+  for (int k = 0; k < 100; k++) {
+    for (size_t i = 0; i < FRAME; i++)
+      frame[i] = (int16_t)((int32_t)((lcg() >> 16) % 201) - 100);
+    if (k == 0)
+      noise = (int)std::lrint(dbov(frame.data(), FRAME));
+    vad.set_noise_dbov(noise);
+    CHECK(!vad.process(frame.data(), FRAME));
+    CHECK(vad.get_noise_dbov() == noise);
+  }
+  // the same noise is speech to a detector told the noise is 20 dB quieter
+  vad.set_noise_dbov(noise - 20);
+  CHECK(vad.process(frame.data(), FRAME));
+  CHECK(vad.get_noise_dbov() == noise - 20);
+}
+
+static void test_comfort_noise() {
+  uint8_t buf[4] = {0xFF};
+  uint8_t level = 0;
+  CHECK(voip::write_cn_payload(buf, 45) == 1 && buf[0] == 45);
+  CHECK(voip::write_cn_payload(buf, 200) == 1 && buf[0] == 127);
+  CHECK(voip::parse_cn_payload(buf, 1, &level) && level == 127);
+  // spectral coefficients after the level are allowed and skipped
+  const uint8_t with_spectrum[] = {60, 0x80, 0x70, 0x90};
+  CHECK(voip::parse_cn_payload(with_spectrum, sizeof(with_spectrum), &level) && level == 60);
+  const uint8_t reserved[] = {0x85};
+  CHECK(!voip::parse_cn_payload(reserved, 1, &level));
+  CHECK(!voip::parse_cn_payload(buf, 0, &level));
+
+  // the generated level matches the SID within 1 dB once it has settled
+  ComfortNoiseGenerator cn;
+  std::vector<int16_t> out(8000);
+  const uint8_t levels[] = {10, 30, 50, 70, 80};
+  for (uint8_t l : levels) {
+    cn.set_level(l);
+    for (int k = 0; k < 10; k++)
+      cn.generate(out.data(), FRAME);
+    cn.generate(out.data(), out.size());
+    double measured = dbov(out.data(), out.size());
+    CHECK(std::fabs(measured + l) < 1.0);
+  }
+  // no overflow at full scale, which is limited to -8 dBov
+  cn.set_level(0);
+  CHECK(cn.get_level() == 0);
+  for (int k = 0; k < 20; k++)
+    cn.generate(out.data(), out.size());
+  CHECK(std::fabs(dbov(out.data(), out.size()) + 8) < 1.0);
+
+  // end to end: the noise of a recording, measured by the VAD and carried in SIDs, is played back
+  // at its own level (the microphone's DC offset is not part of it)
+  Recording rec = conversation(10);
+  VoiceActivityDetector vad;
+  for (size_t f = 0; f + FRAME <= 8000; f += FRAME)
+    vad.process(&rec.mic[f], FRAME);
+  DtxScheduler dtx;
+  CHECK(dtx.next(false, vad.get_noise_dbov(), FRAME_MS) == DtxScheduler::SEND_SID);
+  CHECK(voip::parse_cn_payload(buf, voip::write_cn_payload(buf, dtx.get_sid_level()), &level));
+  ComfortNoiseGenerator far_end;
+  far_end.set_level(level);
+  for (int k = 0; k < 20; k++)
+    far_end.generate(out.data(), out.size());
+  CHECK(std::fabs(dbov(out.data(), out.size()) - rec.noise_dbov[0]) < 2);
+}
+
+static void benchmark(int rounds) {
+  Recording rec = conversation(2);
+  VoiceActivityDetector vad;
+  ComfortNoiseGenerator cn;
+  cn.set_level(50);
+  int16_t out[FRAME];
+  volatile int sink = 0;
+  const size_t frames = rec.mic.size() / FRAME;
+  auto t0 = std::chrono::steady_clock::now();
+  for (int r = 0; r < rounds; r++)
+    sink += vad.process(&rec.mic[(r % frames) * FRAME], FRAME);
+  auto t1 = std::chrono::steady_clock::now();
+  for (int r = 0; r < rounds; r++) {
+    cn.generate(out, FRAME);
+    sink += out[0];
+  }
+  auto t2 = std::chrono::steady_clock::now();
+  printf("20 ms frame: VAD %.0f ns, comfort noise %.0f ns (%d rounds)\n",
+         std::chrono::duration<double, std::nano>(t1 - t0).count() / rounds,
+         std::chrono::duration<double, std::nano>(t2 - t1).count() / rounds, rounds);
+}
+
+int main(int argc, char **argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 100000;
+  test_dtx_scheduler();
+  test_vad_edges();
+  test_external_noise();
+  test_comfort_noise();
+  test_vad_on_conversation();
+  // a real recording: VAD_WAV=path/to/8khz_mono_16bit.wav
+  if (const char *path = getenv("VAD_WAV")) {
+    std::vector<int16_t> wav = read_wav(path);
+    if (wav.empty()) {
+      std::cerr << "VAD_WAV: " << path << " is not a 16-bit mono 8 kHz WAV" << std::endl;
+      ++failures;
+    } else {
+      print_savings(path, simulate(wav, nullptr, nullptr));
+    }
+  }
+  benchmark(rounds);
+
+  if (failures) {
+    std::cerr << failures << " tests failed" << std::endl;
+    return 1;
+  }
+  std::cout << "All tests passed." << std::endl;
+  return 0;
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace voip {
+
+// Hashed timing wheel for many short-lived timers driven from one poll.
+//
+// Timers are intrusive list nodes owned by the caller, so starting and stopping never allocates and
+// is O(1). A timer lands in the slot of its expiry tick; advance() only visits the slots of the ticks
+// that passed since the last call, so an idle wheel costs almost nothing per loop. Timers further
+// away than one revolution simply stay in their slot until a later pass finds them due. Times are
+// wrapping millisecond counters passed in by the caller, which keeps the wheel testable on a host.
+class TimerWheel {
+ public:
+  static const size_t SLOTS = 64;
+
+  struct Timer {
+    Timer *prev = nullptr;
+    Timer *next = nullptr;
+    uint32_t expires = 0;
+    int16_t list = -1;  // slot, EXPIRED while waiting to fire, -1 if not armed
+    uint16_t tag = 0;   // free for the owner, e.g. to find the object the timer belongs to
+
+    bool armed() const { return this->list >= 0; }
+  };
+
+  explicit TimerWheel(uint32_t tick_ms = 10) : tick_ms_(tick_ms ? tick_ms : 1) {}
+
+  // Starts counting at now_ms; timers must not be armed
+  void reset(uint32_t now_ms) {
+    for (Timer *&head : this->lists_)
+      head = nullptr;
+    this->tick_ = now_ms / this->tick_ms_;
+    this->count_ = 0;
+  }
+
+  // (Re)arms t to fire delay_ms after now_ms
+  void start(Timer *t, uint32_t now_ms, uint32_t delay_ms) {
+    this->stop(t);
+    t->expires = now_ms + delay_ms;
+    this->link_(t, (int16_t)((t->expires / this->tick_ms_) % SLOTS));
+  }
+
+  void stop(Timer *t) {
+    if (!t->armed())
+      return;
+    if (t->prev != nullptr) {
+      t->prev->next = t->next;
+    } else {
+      this->lists_[t->list] = t->next;
+    }
+    if (t->next != nullptr)
+      t->next->prev = t->prev;
+    t->prev = t->next = nullptr;
+    t->list = -1;
+    this->count_--;
+  }
+
+  // Calls fn(Timer *) for every timer due at now_ms, earliest tick first. The timer is disarmed
+  // before its callback runs; fn may start or stop any timer, including the one it got.
+  template<typename F> void advance(uint32_t now_ms, F &&fn) {
+    uint32_t now_tick = now_ms / this->tick_ms_;
+    uint32_t ticks = now_tick - this->tick_ + 1;
+    if (ticks > SLOTS)
+      ticks = SLOTS;
+    // collect first, so that callbacks re-arming timers cannot disturb the slot being scanned
+    for (uint32_t i = 0; i < ticks; i++) {
+      int16_t slot = (int16_t)((this->tick_ + i) % SLOTS);
+      for (Timer *t = this->lists_[slot]; t != nullptr;) {
+        Timer *next = t->next;
+        if ((int32_t)(t->expires - now_ms) <= 0) {
+          this->stop(t);
+          this->link_(t, EXPIRED);
+        }
+        t = next;
+      }
+    }
+    this->tick_ = now_tick;
+    while (this->lists_[EXPIRED] != nullptr) {
+      Timer *t = this->lists_[EXPIRED];
+      this->stop(t);
+      fn(t);
+    }
+  }
+
+  size_t size() const { return this->count_; }
+  uint32_t get_tick_ms() const { return this->tick_ms_; }
+
+ protected:
+  static const int16_t EXPIRED = SLOTS;
+
+  void link_(Timer *t, int16_t list) {
+    t->list = list;
+    t->prev = nullptr;
+    t->next = this->lists_[list];
+    if (t->next != nullptr)
+      t->next->prev = t;
+    this->lists_[list] = t;
+    this->count_++;
+  }
+
+  uint32_t tick_ms_;
+  uint32_t tick_ = 0;
+  size_t count_ = 0;
+  Timer *lists_[SLOTS + 1] = {};
+};
+
+}  // namespace voip
+}  // namespace esphome
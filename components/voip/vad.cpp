@@ -0,0 +1,126 @@
+#include "vad.h"
+
+namespace esphome {
+namespace voip {
+
+namespace {
+
+const int32_t DB = 256;  // levels are dB in Q8
+const int32_t SILENCE_DBOV = -96 * DB;
+// never speech below this, whatever the noise: digital silence and idle microphones
+const int32_t MIN_SPEECH_LEVEL = -65 * DB;
+// above the noise: speech on level alone, or on level and zero crossings; once a talkspurt runs,
+// its quieter syllables need less
+const int32_t SPEECH_MARGIN = 6 * DB;
+const int32_t CONTINUE_MARGIN = 4 * DB;
+const int32_t WEAK_MARGIN = 3 * DB;
+// a frame this much quieter than the noise estimate is believed at once
+const int32_t NOISE_DROP = 3 * DB;
+const uint32_t ZCR_MARGIN = 32;
+const uint32_t MIN_UNVOICED_ZCR = 64;
+const uint32_t SAMPLE_RATE_HZ = 8000;
+
+// dBov in Q8 of a mean square, 2^30 being a full-scale square wave; log2 with a linear mantissa is
+// within 0.3 dB
+int32_t dbov_q8(uint32_t mean_square) {
+  if (mean_square == 0)
+    return SILENCE_DBOV;
+  int e = 31 - __builtin_clz(mean_square);
+  uint32_t frac = ((mean_square << (31 - e)) >> 23) & 0xFF;
+  int32_t log2_q8 = e * 256 + (int32_t)frac;
+  // 10 * log10(2) = 3.0103 ~ 771 / 256
+  int32_t db = ((log2_q8 - 30 * 256) * 771) >> 8;
+  return db < SILENCE_DBOV ? SILENCE_DBOV : db;
+}
+
+}  // namespace
+
+bool VoiceActivityDetector::process(const int16_t *pcm, size_t n) {
+  if (n == 0)
+    return this->is_speech();
+  // level and zero crossings around the frame's mean, so a DC offset of the microphone counts for neither
+  int64_t sum = 0;
+  uint64_t sum_sq = 0;
+  for (size_t i = 0; i < n; i++) {
+    sum += pcm[i];
+    sum_sq += (uint64_t)((int32_t)pcm[i] * pcm[i]);
+  }
+  int32_t mean = (int32_t)(sum / (int64_t)n);
+  uint64_t ms = sum_sq / n;
+  uint64_t dc = (uint64_t)((int64_t)mean * mean);
+  this->level_q8_ = dbov_q8(ms > dc ? (uint32_t)(ms - dc) : 0);
+  uint32_t crossings = 0;
+  bool positive = pcm[0] >= mean;
+  for (size_t i = 1; i < n; i++) {
+    bool p = pcm[i] >= mean;
+    crossings += p != positive;
+    positive = p;
+  }
+  this->zcr_ = (uint32_t)(crossings * 256 / n);
+
+  if (!this->started_) {
+    // the first frame is taken as noise; any speech in it is forgotten at the next pause
+    this->started_ = true;
+    if (!this->external_noise_)
+      this->noise_q8_ = this->level_q8_;
+    this->noise_zcr_ = this->zcr_;
+    this->window_min_q8_ = this->level_q8_;
+  }
+
+  int32_t margin = this->level_q8_ - this->noise_q8_;
+  bool active = this->level_q8_ >= MIN_SPEECH_LEVEL &&
+                (margin > (this->hangover_ > 0 ? CONTINUE_MARGIN : SPEECH_MARGIN) ||
+                 (margin > WEAK_MARGIN && this->zcr_ >= MIN_UNVOICED_ZCR && this->zcr_ > this->noise_zcr_ + ZCR_MARGIN));
+  if (!active) {
+    // the mean level of quiet frames, except that a much quieter one is believed at once
+    if (!this->external_noise_)
+      this->noise_q8_ += margin < -NOISE_DROP ? margin / 2 : margin / 16;
+    this->noise_zcr_ = (uint32_t)((int32_t)this->noise_zcr_ + ((int32_t)this->zcr_ - (int32_t)this->noise_zcr_) / 8);
+  }
+
+  // minimum statistics: the quietest frame of each second is at most noise, even in speech
+  if (this->level_q8_ < this->window_min_q8_)
+    this->window_min_q8_ = this->level_q8_;
+  this->window_samples_ += (uint32_t)n;
+  if (this->window_samples_ >= SAMPLE_RATE_HZ) {
+    if (!this->external_noise_ && this->window_min_q8_ > this->noise_q8_)
+      this->noise_q8_ += (this->window_min_q8_ - this->noise_q8_) / 2;
+    this->window_min_q8_ = this->level_q8_;
+    this->window_samples_ = 0;
+  }
+
+  this->speech_ = active || this->hangover_ > 0;
+  if (active) {
+    this->hangover_ = HANGOVER_MS * (SAMPLE_RATE_HZ / 1000);
+  } else {
+    this->hangover_ = this->hangover_ > n ? this->hangover_ - (uint32_t)n : 0;
+  }
+  return this->speech_;
+}
+
+DtxScheduler::Action DtxScheduler::next(bool speech, int noise_dbov, uint32_t frame_ms) {
+  this->frames_++;
+  if (speech) {
+    this->talkspurt_start_ = !this->talking_;
+    this->talking_ = true;
+    this->sent_++;
+    return SEND;
+  }
+  int level = noise_dbov > 0 ? 0 : (noise_dbov < -127 ? 127 : -noise_dbov);
+  int step = level - (int)this->sid_level_;
+  bool first = this->talking_ || this->frames_ == 1;
+  this->talking_ = false;
+  if (first || this->since_sid_ms_ + frame_ms >= SID_INTERVAL_MS || step >= SID_LEVEL_STEP_DB ||
+      step <= -SID_LEVEL_STEP_DB) {
+    this->sid_level_ = (uint8_t)level;
+    this->since_sid_ms_ = 0;
+    this->sids_++;
+    this->sent_++;
+    return SEND_SID;
+  }
+  this->since_sid_ms_ += frame_ms;
+  return SKIP;
+}
+
+}  // namespace voip
+}  // namespace esphome
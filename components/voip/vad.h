@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <cmath>
+#include <cstdint>
+
+namespace esphome {
+namespace voip {
+
+// Energy and zero-crossing voice activity detector for 8 kHz audio, one frame at a time.
+//
+// A frame is speech when its level is well above the background noise (a little less inside a
+// talkspurt), or somewhat above it with more zero crossings than the noise has (unvoiced sounds such
+// as /s/ and /f/ carry little energy). The noise level is the running mean of quiet frames; it drops
+// at once to a much quieter frame and, so that a noise that got louder is learned while the detector
+// thinks it is speech, rises to the quietest frame of every second. Speech is held for HANGOVER_MS
+// after the last active frame so that word endings and short pauses are not cut. Levels are dBov:
+// 0 for a full-scale square wave.
+class VoiceActivityDetector {
+ public:
+  static const uint32_t HANGOVER_MS = 200;
+
+  void reset() { *this = VoiceActivityDetector{}; }
+  // returns whether the frame counts as speech, hangover included
+  bool process(const int16_t *pcm, size_t n);
+  // takes the noise level from elsewhere (the noise suppressor's residual) instead of learning it;
+  // the zero crossings of the noise are still learned
+  void set_noise_dbov(float dbov) {
+    this->noise_q8_ = (int32_t)std::lrint(dbov * 256);
+    this->external_noise_ = true;
+  }
+
+  bool is_speech() const { return this->speech_; }
+  // the last frame's level and the background noise level, dBov
+  int get_level_dbov() const { return (this->level_q8_ - 128) / 256; }
+  int get_noise_dbov() const { return (this->noise_q8_ - 128) / 256; }
+  // zero crossings per 256 samples, of the last frame and of the noise
+  uint32_t get_zero_crossings() const { return this->zcr_; }
+  uint32_t get_noise_zero_crossings() const { return this->noise_zcr_; }
+
+ protected:
+  bool started_ = false;
+  bool external_noise_ = false;
+  int32_t level_q8_ = -96 * 256;
+  int32_t noise_q8_ = -96 * 256;
+  uint32_t zcr_ = 0;
+  uint32_t noise_zcr_ = 0;
+  // quietest frame in the current second
+  int32_t window_min_q8_ = 0;
+  uint32_t window_samples_ = 0;
+  bool speech_ = false;
+  // samples of speech still to hold after the last active frame
+  uint32_t hangover_ = 0;
+};
+
+// Discontinuous transmission (RFC 3551 section 4.1, RFC 3389): what to do with each frame given the
+// detector's decision. Speech is sent, the first packet of a talkspurt with the marker bit. Silence
+// is announced with a comfort noise (SID) packet carrying the noise level; after that frames are
+// not sent, except for a new SID when the noise level moves by SID_LEVEL_STEP_DB or every
+// SID_INTERVAL_MS, so the far end keeps an up-to-date noise and the NAT binding stays open.
+class DtxScheduler {
+ public:
+  static const uint32_t SID_INTERVAL_MS = 500;
+  static const int SID_LEVEL_STEP_DB = 3;
+
+  enum Action : uint8_t { SEND, SEND_SID, SKIP };
+
+  void reset() { *this = DtxScheduler{}; }
+  Action next(bool speech, int noise_dbov, uint32_t frame_ms);
+  // the frame just told SEND starts a talkspurt
+  bool is_talkspurt_start() const { return this->talkspurt_start_; }
+  // noise level for the SID payload: 0..127, minus dBov (RFC 3389 section 3.1)
+  uint8_t get_sid_level() const { return this->sid_level_; }
+
+  uint32_t get_frames() const { return this->frames_; }
+  uint32_t get_sent() const { return this->sent_; }
+  uint32_t get_sids() const { return this->sids_; }
+
+ protected:
+  bool talking_ = false;
+  bool talkspurt_start_ = false;
+  uint8_t sid_level_ = 127;
+  uint32_t since_sid_ms_ = 0;
+  uint32_t frames_ = 0;
+  uint32_t sent_ = 0;
+  uint32_t sids_ = 0;
+};
+
+}  // namespace voip
+}  // namespace esphome
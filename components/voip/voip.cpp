@@ -1,6 +1,5 @@
 #include "voip.h"
 #include <cstring>
-#include <cstdarg>
 #include <cmath>
 #include <functional>
 #include "esphome/core/helpers.h"
@@ -8,14 +7,12 @@
 #include <esp_system.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
-#include "mbedtls/md5.h"
-#include "mbedtls/md.h"
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <algorithm>
 #include <errno.h>
+#include <strings.h>
 #include <new>
-#include "md5_util.h"
 
 // Safety helpers
 static inline void safe_strncpy(char *dest, const char *src, size_t destSize) {
@@ -29,17 +26,17 @@ namespace esphome {
 namespace voip {
 
 static const char *const TAG = "voip";
-#define SIP_AUTH_DEBUG 1  // set to 1 to enable additional digest debug (DO NOT USE IN PRODUCTION)
 
-Sip::Sip() : p_buf_(nullptr), l_buf_(2048), i_last_cseq_(0), codec_(0) {
+Sip::Sip() : p_buf_(nullptr), l_buf_(2048), i_last_cseq_(0) {
   p_buf_ = new (std::nothrow) char[l_buf_];
   if (p_buf_ == nullptr) {
     ESP_LOGE(TAG, "Sip: Failed to allocate p_buf_");
     l_buf_ = 0;
   }
-  p_dial_nr_ = "";
-  p_dial_desc_ = "";
-  audioport = "";
+  tx_.attach(p_buf_, l_buf_);
+  txns_.set_send_callback(
+      [this](const SipEndpoint &to, const char *data, size_t len) { this->send_to(to, data, len); });
+  txns_.set_timeout_callback([this](uint32_t txn, SipMethod method) { this->on_transaction_timeout(txn, method); });
 }
 
 // Destructor will be implemented later
@@ -47,16 +44,36 @@ Sip::Sip() : p_buf_(nullptr), l_buf_(2048), i_last_cseq_(0), codec_(0) {
 void Sip::init(const std::string &sip_ip, int sip_port, const std::string &my_ip, int my_port, const std::string &sip_user, const std::string &sip_pass) {
   p_sip_ip_ = sip_ip;
   i_sip_port_ = sip_port;
-  p_my_ip_ = my_ip;
   i_my_port_ = my_port;
   p_sip_user_ = sip_user;
   p_sip_pass_ = sip_pass;
-  i_auth_cnt_ = 0;
-  i_ring_time_ = 0;
+  auth_.set_credentials(sip_user, sip_pass);
+  auth_.set_random([this]() { return this->random(); });
   i_max_time_ = 0;
-  i_dial_retries_ = 0;
   i_last_cseq_ = 0;
-  codec_ = 0;
+  // every call slot is allocated here, calls themselves never allocate
+  if (!dialogs_.allocate(max_calls_)) {
+    ESP_LOGE(TAG, "Sip::init: cannot allocate %u call slots", (unsigned)max_calls_);
+  } else {
+    ESP_LOGI(TAG, "Sip::init: %u call slots, %u bytes", (unsigned)max_calls_, (unsigned)(max_calls_ * sizeof(SipDialog)));
+  }
+  // every further call: its INVITE, a CANCEL or BYE, and the far end's requests, which outlive the
+  // call by up to 32 s (Timers J and L)
+  size_t txns = SipTransactionLayer::MAX_TRANSACTIONS + 4 * (max_calls_ - 1);
+  if (txns != txns_.capacity() && !txns_.set_capacity(txns))
+    ESP_LOGE(TAG, "Sip::init: cannot allocate %u transactions", (unsigned)txns);
+  if (rtp_ports_.size() < max_calls_)
+    ESP_LOGW(TAG, "Sip::init: %u RTP ports for %u calls", (unsigned)rtp_ports_.size(), (unsigned)max_calls_);
+  server_ = {};
+  struct in_addr server_addr;
+  if (inet_pton(AF_INET, sip_ip.c_str(), &server_addr) == 1) {
+    server_.address = ntohl(server_addr.s_addr);
+  } else {
+    ESP_LOGW(TAG, "Sip::init: SIP server %s is not an IPv4 address", sip_ip.c_str());
+  }
+  server_.port = (uint16_t)sip_port;
+  p_my_ip_ = my_ip.empty() ? detect_local_ip() : my_ip;
+  txns_.reset(millis());
   // create SIP socket
     this->udp_ = socket::socket(AF_INET, SOCK_DGRAM, 0);
     ESP_LOGI(TAG, "Sip::init: creating UDP socket for SIP");
@@ -74,735 +91,748 @@ void Sip::init(const std::string &sip_ip, int sip_port, const std::string &my_ip
   } else {
     ESP_LOGW(TAG, "Sip::init: Failed to create UDP socket for SIP");
     // Notify but don't crash
+    return;
+  }
+  if (register_ && server_.address != 0) {
+    registration_.configure(p_sip_user_, p_sip_ip_, p_my_ip_, (uint16_t)i_my_port_, register_expires_);
+    registration_.set_random([this]() { return this->random(); });
+    registration_.set_auth_callback(
+        [this](const SipParser *challenge, const char *method, const char *uri, SipMessage &out) {
+          return this->write_authorization(challenge, method, uri, out);
+        });
+    registration_.set_state_callback([this](SipRegistrationState state) {
+      if (state == SIP_REG_REGISTERED) {
+        ESP_LOGI(TAG, "Registered as %s@%s for %u s", p_sip_user_.c_str(), p_sip_ip_.c_str(),
+                 (unsigned)registration_.get_expires());
+      } else if (state == SIP_REG_FAILED) {
+        ESP_LOGW(TAG, "Registration failed (%d), retrying in %u s", registration_.get_last_status(),
+                 (unsigned)(registration_.get_next_in(millis()) / 1000));
+      }
+    });
+    registration_.start(&txns_, server_, millis());
   }
 }
 
+std::string Sip::detect_local_ip() {
+  // connecting a UDP socket sends nothing, it only picks the route and with it the source address
+  auto probe = socket::socket(AF_INET, SOCK_DGRAM, 0);
+  struct sockaddr_in remote = {};
+  remote.sin_family = AF_INET;
+  remote.sin_port = htons(server_.port);
+  remote.sin_addr.s_addr = htonl(server_.address);
+  struct sockaddr_in local = {};
+  socklen_t len = sizeof(local);
+  char ip_str[INET_ADDRSTRLEN] = "0.0.0.0";
+  if (probe == nullptr || probe->connect((struct sockaddr *)&remote, sizeof(remote)) != 0 ||
+      probe->getsockname((struct sockaddr *)&local, &len) != 0) {
+    ESP_LOGW(TAG, "Cannot determine the local address towards %s", p_sip_ip_.c_str());
+  } else {
+    inet_ntop(AF_INET, &local.sin_addr, ip_str, sizeof(ip_str));
+    ESP_LOGI(TAG, "Local SIP address %s", ip_str);
+  }
+  return ip_str;
+}
+
 void Sip::setup() {
   // SIP-specific setup can be done here if needed
 }
 
 void Sip::loop() {
-  if (this->udp_) this->handle_udp_packet();
+  if (!this->udp_)
+    return;
+  this->handle_udp_packet();
+  // retransmissions and transaction timeouts
+  uint32_t now = millis();
+  txns_.poll(now);
+  registration_.loop(now);
 }
 
 void Sip::dump_config() {
   ESP_LOGCONFIG(TAG, "Sip component:");
   ESP_LOGCONFIG(TAG, "  SIP IP: %s", p_sip_ip_.c_str());
   ESP_LOGCONFIG(TAG, "  SIP Port: %d", i_sip_port_);
+  ESP_LOGCONFIG(TAG, "  Local address: %s:%d", p_my_ip_.c_str(), i_my_port_);
+  ESP_LOGCONFIG(TAG, "  Registration: %s", register_ ? (registration_.is_registered() ? "registered" : "pending") : "off");
+  ESP_LOGCONFIG(TAG, "  Calls: %u of %u, %u RTP ports free", (unsigned)dialogs_.active(), (unsigned)dialogs_.capacity(),
+                (unsigned)rtp_ports_.available());
 }
 
 Sip::~Sip() {
   ESP_LOGI(TAG, "Sip destructor called");
   if (p_buf_) {
+    tx_.attach(nullptr, 0);
     delete[] p_buf_;
     p_buf_ = nullptr;
     l_buf_ = 0;
   }
 }
 
-bool Sip::dial(const std::string &dial_nr, const std::string &dial_desc) {
-  if (i_ring_time_)
-    return false;
-
-  ESP_LOGD(TAG, "Dialing %s", dial_nr.c_str());
-  audioport = "";
-  i_dial_retries_ = 0;
-  p_dial_nr_ = dial_nr;
-  p_dial_desc_ = dial_desc;
-  invite();
-  i_dial_retries_++;
-  i_ring_time_ = millis();
-  return true;
+uint32_t Sip::dial(const std::string &dial_nr, const std::string &dial_desc) {
+  if (dialogs_.full()) {
+    ESP_LOGW(TAG, "Cannot dial %s: all %u calls in use", dial_nr.c_str(), (unsigned)dialogs_.capacity());
+    return 0;
+  }
+  if (dial_nr.empty() || dial_nr.size() >= SIP_DIALOG_PEER_SIZE) {
+    ESP_LOGW(TAG, "Cannot dial '%s': empty or too long", dial_nr.c_str());
+    return 0;
+  }
+  uint16_t port = rtp_ports_.acquire();
+  if (port == 0) {
+    ESP_LOGW(TAG, "Cannot dial %s: no free RTP port", dial_nr.c_str());
+    return 0;
+  }
+  SipDialog *call = dialogs_.create(SIP_DIALOG_CALLING, true, millis());
+  call->rtp_port = port;
+  safe_strncpy(call->peer, dial_nr.c_str(), sizeof(call->peer));
+  safe_strncpy(call->display, dial_desc.c_str(), sizeof(call->display));
+  uint32_t id = call->id;
+  ESP_LOGD(TAG, "Dialing %s (call %u, RTP port %u)", dial_nr.c_str(), (unsigned)id, (unsigned)port);
+  invite(call);
+  // the call is gone again if its INVITE could not be sent
+  return dialogs_.find(id) != nullptr ? id : 0;
 }
 
-void Sip::cancel(int cseq) {
-  if (ca_read_[0] == 0)
+void Sip::cancel(SipDialog *call) {
+  if (call->cancel_txn != 0)
     return;
-  if (p_buf_ && l_buf_) memset(p_buf_, 0, l_buf_);
-  add_sip_line("%s sip:%s@%s SIP/2.0", "CANCEL", p_dial_nr_.c_str(), p_sip_ip_.c_str());
-  add_sip_line("%s", ca_read_);
-  add_sip_line("CSeq: %i %s", cseq, "CANCEL");
-  add_sip_line("Max-Forwards: 70");
-  add_sip_line("User-Agent: sip-client/0.0.1");
-  add_sip_line("Content-Length: 0");
-  add_sip_line("");
-  send_udp();
+  call->cancel_txn = txns_.cancel(call->invite_txn, millis());
+  if (call->cancel_txn != 0)
+    ESP_LOGD(TAG, "Sending CANCEL for call %u", (unsigned)call->id);
 }
 
-void Sip::bye(int cseq) {
-  audioport = "";
-  if (ca_read_[0] == 0)
+void Sip::bye(SipDialog *call) {
+  clear_media(call);
+  if (call->headers[0] == 0)
     return;
-  if (p_buf_ && l_buf_) memset(p_buf_, 0, l_buf_);
-  add_sip_line("%s sip:%s@%s SIP/2.0", "BYE", p_dial_nr_.c_str(), p_sip_ip_.c_str());
-  add_sip_line("%s", ca_read_);
-  add_sip_line("CSeq: %i %s", cseq, "BYE");
-  add_sip_line("Max-Forwards: 70");
-  add_sip_line("User-Agent: sip-client/0.0.1");
-  add_sip_line("Content-Length: 0");
-  add_sip_line("");
-  send_udp();
+  in_dialog_request(call, "BYE", ++call->local_cseq);
+}
+
+void Sip::write_via(SipMessage &msg) {
+  branchid_ = random();
+  msg.str("Via: SIP/2.0/UDP ").str(p_my_ip_).chr(':').num(i_my_port_);
+  msg.str(";branch=z9hG4bK").hex(branchid_, 8).str(";rport").crlf();
 }
 
-void Sip::ack(const char *p_in) {
-  std::string ca;
-  bool b = parse_parameter(ca, "To: <", p_in, '>');
-  if (!b)
+void Sip::in_dialog_request(SipDialog *call, const char *method, int cseq) {
+  tx_.clear();
+  std::string uri = call->remote_target[0] == 0 ? "sip:" + std::string(call->peer) + "@" + p_sip_ip_
+                                                : std::string(call->remote_target);
+  tx_.str(method).chr(' ').str(uri).line(" SIP/2.0");
+  write_via(tx_);
+  tx_.line(call->headers);
+  tx_.str("CSeq: ").num(cseq).chr(' ').line(method);
+  tx_.line("Max-Forwards: 70");
+  tx_.line("User-Agent: sip-client/0.0.1");
+  write_authorization(nullptr, method, uri.c_str(), tx_);
+  tx_.begin_body();
+  send_request();
+}
+void Sip::ack(const SipParser &in) {
+  SipSpan to_uri = in.uri(in.header(SIP_HDR_TO));
+  if (to_uri.empty())
     return;
 
-  if (p_buf_ && l_buf_) memset(p_buf_, 0, l_buf_);
-  add_sip_line("ACK %s SIP/2.0", ca.c_str());
-  add_copy_sip_line(p_in, "Call-ID: ");
-  int cseq = grep_integer(p_in, "\nCSeq: ");
-  add_sip_line("CSeq: %i ACK", cseq);
-  add_copy_sip_line(p_in, "From: ");
-  add_copy_sip_line(p_in, "Via: ");
-  add_copy_sip_line(p_in, "To: ");
-  add_sip_line("Content-Length: 0");
-  add_sip_line("");
+  tx_.clear();
+  tx_.str("ACK ").str(in.ptr(to_uri), to_uri.length).line(" SIP/2.0");
+  // the ACK of a 2xx is a transaction of its own (RFC 3261 17.1.1.3)
+  write_via(tx_);
+  tx_.line("Max-Forwards: 70");
+  copy_header(tx_, in, SIP_HDR_CALL_ID);
+  tx_.str("CSeq: ").num(in.get_cseq()).line(" ACK");
+  copy_header(tx_, in, SIP_HDR_FROM);
+  copy_header(tx_, in, SIP_HDR_TO);
+  tx_.begin_body();
   send_udp();
 }
 
-void Sip::ok(const char *p) {
-  if (p_buf_ && l_buf_) memset(p_buf_, 0, l_buf_);
-  add_sip_line("SIP/2.0 200 OK");
-  add_copy_sip_line(p, "Call-ID: ");
-  add_copy_sip_line(p, "CSeq: ");
-  add_copy_sip_line(p, "From: ");
-  add_copy_sip_line(p, "Via: ");
-  add_copy_sip_line(p, "To: ");
-  add_sip_line("Content-Length: 0");
-  add_sip_line("");
-  send_udp();
+void Sip::begin_response(const SipParser &in, int status, const char *reason, uint32_t to_tag) {
+  tx_.clear();
+  tx_.str("SIP/2.0 ").num(status).chr(' ').line(reason);
+  copy_header(tx_, in, SIP_HDR_VIA);
+  copy_header(tx_, in, SIP_HDR_FROM);
+  SipSpan to = in.header(SIP_HDR_TO);
+  tx_.str("To: ").str(in.ptr(to), to.length);
+  // responses outside of a dialog get a tag of their own (8.2.6.2), 100 Trying never has one
+  if (status > 100 && in.param(to, "tag").empty())
+    tx_.str(";tag=").hex(to_tag, 8);
+  tx_.crlf();
+  copy_header(tx_, in, SIP_HDR_CALL_ID);
+  copy_header(tx_, in, SIP_HDR_CSEQ);
 }
 
-void Sip::invite(const char *p) {
-  // prevent loops
-  if (p && i_auth_cnt_ > 3)
+void Sip::respond(const SipParser &in, uint32_t txn, const SipEndpoint &from, int status, const char *reason) {
+  begin_response(in, status, reason, random());
+  tx_.begin_body();
+  if (!finish_tx())
     return;
-
-  // ca_read_ is a small buffer used for copying return params; we now parse
-  // realm/nonce into std::string variables instead of relying on ca_read_.
-  std::string realm, nonce, qop;
-  bool qop_auth = false;
-
-  char *ha_resp = nullptr;
-  // local MD5 buffers allocated once per invite
-  char ha1_hex[33] = {0};
-  char ha2_hex[33] = {0};
-  char ha_resp_local[33] = {0};
-  char p_temp[256] = {0};
-  int cseq = 1;
-  if (!p) {
-    i_auth_cnt_ = 0;
-    if (i_dial_retries_ == 0) {
-      callid_ = random();
-      tagid_ = random();
-      branchid_ = random();
-    }
-  } else {
-    cseq = 2;
-    if (parse_parameter(realm, " realm=\"", p) &&
-      parse_parameter(nonce, " nonce=\"", p)) {
-      (void)parse_parameter(qop, " qop=\"", p); // optional
-      if (!qop.empty() && qop.find("auth") != std::string::npos) qop_auth = true;
-      if (!p_buf_ || l_buf_ < 132) {
-        ESP_LOGE(TAG, "Insufficient buffer for md5 digest building");
-        ca_read_[0] = 0;
-        return;
-      }
-      // compute MD5 digest values in local buffers (do not use p_buf_ as it's
-      // later cleared when building the SIP packet)
-
-      ESP_LOGD(TAG, "MD5 compute: temp buffer len=%d", (int)sizeof(p_temp));
-      snprintf(p_temp, sizeof(p_temp), "%s:%s:%s", p_sip_user_.c_str(), realm.c_str(), p_sip_pass_.c_str());
-      make_md5_digest(ha1_hex, p_temp);
-
-      snprintf(p_temp, sizeof(p_temp), "INVITE:sip:%s@%s", p_dial_nr_.c_str(), p_sip_ip_.c_str());
-      make_md5_digest(ha2_hex, p_temp);
-
-      // realm and nonce are parsed into std::string variables and used below.
-      if (qop_auth) {
-        // ensure cnonce and nc handling
-        if (last_nonce_.empty() || last_nonce_ != nonce) {
-          last_nonce_ = nonce;
-          auth_nc_ = 1;
-          // generate cnonce using two random 32-bit values
-          char cnonce_buf[33];
-          snprintf(cnonce_buf, sizeof(cnonce_buf), "%08x%08x", this->random(), this->random());
-          cnonce_.assign(cnonce_buf);
-        } else {
-          auth_nc_++;
-        }
-        char nc_str[9];
-        snprintf(nc_str, sizeof(nc_str), "%08x", auth_nc_);
-        // compute HA1:nonce:nc:cnonce:qop:HA2
-        snprintf(p_temp, sizeof(p_temp), "%s:%s:%s:%s:%s:%s", ha1_hex, nonce.c_str(), nc_str, cnonce_.c_str(), "auth", ha2_hex);
-        make_md5_digest(ha_resp_local, p_temp);
-        ha_resp = ha_resp_local;
-      } else {
-        // old-style digest (no qop)
-        snprintf(p_temp, sizeof(p_temp), "%s:%s:%s", ha1_hex, nonce.c_str(), ha2_hex);
-        make_md5_digest(ha_resp_local, p_temp);
-        ha_resp = ha_resp_local;
-      }
-    #if SIP_AUTH_DEBUG
-      // Print only partial masked response to avoid leaking full auth response
-      char res_mask[9] = {0};
-      if (ha_resp) {
-        strncpy(res_mask, ha_resp, 8);
-        res_mask[8] = '\0';
-      }
-      ESP_LOGD(TAG, "SIP digest computed: realm=%s nonce=%s response[0..7]=%s cseq=%d", realm.c_str(), nonce.c_str(), res_mask, cseq);
-    #endif
-    } else {
-      ca_read_[0] = 0;
-      return;
-    }
-  }
-  if (p_buf_ && l_buf_) memset(p_buf_, 0, l_buf_);
-  add_sip_line("INVITE sip:%s@%s SIP/2.0", p_dial_nr_.c_str(), p_sip_ip_.c_str());
-  add_sip_line("Call-ID: %010u@%s", callid_, p_my_ip_.c_str());
-  add_sip_line("CSeq: %i INVITE", cseq);
-  add_sip_line("Max-Forwards: 70");
-  add_sip_line("User-Agent: sip-client/0.0.1");
-  add_sip_line("From: \"%s\"  <sip:%s@%s>;tag=%010u", p_dial_desc_.c_str(), p_sip_user_.c_str(), p_sip_ip_.c_str(), tagid_);
-  add_sip_line("Via: SIP/2.0/UDP %s:%i;branch=%010u;rport=%i", p_my_ip_.c_str(), i_my_port_, branchid_, i_my_port_);
-  add_sip_line("To: <sip:%s@%s>", p_dial_nr_.c_str(), p_sip_ip_.c_str());
-  add_sip_line("Contact: \"%s\" <sip:%s@%s:%i;transport=udp>", p_sip_user_.c_str(), p_sip_user_.c_str(), p_my_ip_.c_str(), i_my_port_);
-  if (p) {
-    // authentication
-    if (qop_auth) {
-      // include qop, nc, and cnonce
-      char nc_str[9];
-      snprintf(nc_str, sizeof(nc_str), "%08x", auth_nc_);
-      add_sip_line("Authorization: Digest username=\"%s\", realm=\"%s\", nonce=\"%s\", uri=\"sip:%s@%s\", response=\"%s\", qop=auth, nc=%s, cnonce=\"%s\"",
-                   p_sip_user_.c_str(), realm.c_str(), nonce.c_str(), p_dial_nr_.c_str(), p_sip_ip_.c_str(), ha_resp, nc_str, cnonce_.c_str());
-      #if SIP_AUTH_DEBUG
-      // Mask cnonce in logs (show first 8 characters)
-      char cnonce_mask[9] = {0};
-      if (!cnonce_.empty()) {
-        strncpy(cnonce_mask, cnonce_.c_str(), 8);
-        cnonce_mask[8] = '\0';
-      }
-      ESP_LOGD(TAG, "Authorization (qop=auth): qop=auth, nc=%s, cnonce[0..7]=%s", nc_str, cnonce_mask);
-      #endif
-    } else {
-      add_sip_line("Authorization: Digest username=\"%s\", realm=\"%s\", nonce=\"%s\", uri=\"sip:%s@%s\", response=\"%s\"",
-                   p_sip_user_.c_str(), realm.c_str(), nonce.c_str(), p_dial_nr_.c_str(), p_sip_ip_.c_str(), ha_resp);
-    }
-    // Do not log Authorization header to avoid leaking auth details.
-    i_auth_cnt_++;
-  }
-  add_sip_line("Content-Type: application/sdp");
-  add_sip_line("Allow: INVITE, ACK, CANCEL, OPTIONS, BYE, REFER, NOTIFY, MESSAGE, SUBSCRIBE, INFO");
-  add_sip_line("Content-Length: %d", 95 + p_my_ip_.length() + p_my_ip_.length());
-  add_sip_line("");
-  add_sip_line("v=0");
-  add_sip_line("o=- 0 4 IN IP4 %s", p_my_ip_.c_str());
-  add_sip_line("s=sipcall");
-  add_sip_line("c=IN IP4 %s", p_my_ip_.c_str());
-  add_sip_line("t=0 0");
-  if (codec_ == 0) {
-    add_sip_line("m=audio 1234 RTP/AVP 0");
-    add_sip_line("a=rtpmap:0 PCMU/8000");
-  } else if (codec_ == 1) {
-    add_sip_line("m=audio 1234 RTP/AVP 8");
-    add_sip_line("a=rtpmap:8 PCMA/8000");
+  if (txn != 0) {
+    txns_.respond(txn, status, tx_.data(), tx_.size(), millis());
   } else {
-    add_sip_line("m=audio 1234 RTP/AVP 18");
-    add_sip_line("a=rtpmap:18 G721/8000");
+    send_to(from, tx_.data(), tx_.size());
   }
-  ca_read_[0] = 0;
-  ESP_LOGD(TAG, "Sending INVITE");
-  send_udp();
 }
 
-void Sip::add_sip_line(const char *const_format, ...) {
-  if (!p_buf_ || l_buf_ == 0) {
-    ESP_LOGW(TAG, "add_sip_line called with invalid buffer");
-    return;
-  }
-  va_list arglist;
-  va_start(arglist, const_format);
-  uint16_t l = (uint16_t)safe_strlen(p_buf_);
-  char *p = p_buf_ + l;
-  if (l >= l_buf_) {
-    // no space
-    va_end(arglist);
-    ESP_LOGW(TAG, "Buffer full, dropping line: %s", const_format);
-    return;
-  }
-  size_t remain = l_buf_ - l;
-  int written = vsnprintf(p, remain, const_format, arglist);
-  va_end(arglist);
-  // Recompute effective length after append. If truncated, we still compute current length.
-  l = (uint16_t)safe_strlen(p_buf_);
-  // Add CRLF only if there is at least room for CRLF and null terminator.
-  if (l <= (l_buf_ - 3)) {
-    p_buf_[l] = '\r';
-    p_buf_[l + 1] = '\n';
-    p_buf_[l + 2] = 0;
-  }
-  if (written < 0) {
-    ESP_LOGW(TAG, "vsnprintf failed or truncated output");
-  } else if ((size_t)written >= remain) {
-    // truncated
-    ESP_LOGW(TAG, "Line truncated by vsnprintf (len=%d, remain=%u)", written, (unsigned)remain);
-  }
-}
-
-bool Sip::parse_parameter(std::string &dest, const char *name, const char *line, char cq) {
-  const char *qp;
-  const char *r;
-  if (!line || !name) return false;
-  if ((r = strstr(line, name)) != NULL) {
-    r = r + strlen(name);
-    qp = strchr(r, cq);
-    if (!qp)
-      return false;
-    int l = qp - r;
-    if (l > 0) {
-      dest.assign(r, l);
-      return true;
-    }
+
+void Sip::respond_incoming(SipDialog *call, int status, const char *reason, bool sdp) {
+  tx_.clear();
+  tx_.str("SIP/2.0 ").num(status).chr(' ').line(reason);
+  tx_.str(call->response_headers);
+  tx_.str("Contact: <sip:").str(p_sip_user_).chr('@').str(p_my_ip_).chr(':').num(i_my_port_);
+  tx_.line(";transport=udp>");
+  tx_.line("Allow: INVITE, ACK, CANCEL, OPTIONS, BYE, INFO");
+  tx_.line("User-Agent: sip-client/0.0.1");
+  const SdpCodec *codec = nullptr;
+  for (size_t i = 0; sdp && i < offer_count_; i++) {
+    if (offer_[i].id == call->offer.codec)
+      codec = &offer_[i];
   }
-  return false;
+  if (codec != nullptr)
+    tx_.line("Content-Type: application/sdp");
+  tx_.begin_body();
+  if (codec != nullptr)
+    sdp_write_answer(tx_, p_my_ip_.c_str(), call->rtp_port, call->local_tag, *codec, call->offer);
+  if (finish_tx())
+    txns_.respond(call->server_txn, status, tx_.data(), tx_.size(), millis());
 }
 
-bool Sip::add_copy_sip_line(const char *p, const char *psearch) {
-  if (!p || !psearch || !p_buf_)
+bool Sip::write_authorization(const SipParser *challenge, const char *method, const char *uri, SipMessage &out) {
+  uint32_t now = millis();
+  if (challenge != nullptr && !auth_.on_challenge(*challenge, now)) {
+    ESP_LOGW(TAG, "Cannot answer the %d challenge (no nonce or unsupported algorithm)", challenge->get_status());
     return false;
-  char *pa = strstr((char *)p, psearch);
-  if (pa) {
-    char *pe = strstr(pa, "\r");
-    if (pe == 0)
-      pe = strstr(pa, "\n");
-    if (pe && pe > pa) {
-      char c = *pe;
-      *pe = 0;
-      add_sip_line("%s", pa);
-      *pe = c;
-      return true;
-    }
   }
-  return false;
+  // without a challenge only while the cached nonce is still good; the server challenges otherwise
+  if (challenge == nullptr && !auth_.can_authorize(now))
+    return false;
+  // Do not log Authorization header to avoid leaking auth details.
+  return auth_.write_authorization(out, method, uri);
 }
 
-int Sip::grep_integer(const char *p, const char *psearch) {
-  int param = -1;
-  if (!p || !psearch) return -1;
-  const char *pc = strstr(p, psearch);
-  if (pc) {
-    param = atoi(pc + strlen(psearch));
+void Sip::invite(SipDialog *call, const SipParser *p) {
+  // prevent loops
+  if (p && call->auth_attempts > 3) {
+    ESP_LOGW(TAG, "Call %u: server keeps rejecting our credentials", (unsigned)call->id);
+    end_call(call);
+    return;
   }
-  return param;
-}
 
-bool Sip::parse_return_params(const char *p) {
-  if (p_buf_ && l_buf_) memset(p_buf_, 0, l_buf_);
-  add_copy_sip_line(p, "Call-ID: ");
-  add_copy_sip_line(p, "From: ");
-  add_copy_sip_line(p, "Via: ");
-  add_copy_sip_line(p, "To: ");
-  if (p_buf_ && safe_strlen(p_buf_) >= 2) {
-    // copy safely to ca_read_ which has fixed small size
-    strncpy(ca_read_, p_buf_, sizeof(ca_read_) - 1);
-    ca_read_[sizeof(ca_read_) - 1] = '\0';
-    size_t slen = strlen(ca_read_);
-    if (slen >= 2) {
-      ca_read_[slen - 2] = 0;  // remove trailing CRLF if present
+  if (!p) {
+    call->auth_attempts = 0;
+    call->local_tag = random();
+    call->local_cseq = 0;
+    SipMessage call_id(call->call_id, sizeof(call->call_id));
+    call_id.unum(random(), 10).chr('@').str(p_my_ip_);
+  }
+  int cseq = call->local_cseq + 1;
+  std::string uri = "sip:" + std::string(call->peer) + "@" + p_sip_ip_;
+  tx_.clear();
+  tx_.str("INVITE ").str(uri).line(" SIP/2.0");
+  tx_.str("Call-ID: ").str(call->call_id).crlf();
+  tx_.str("CSeq: ").num(cseq).line(" INVITE");
+  tx_.line("Max-Forwards: 70");
+  tx_.line("User-Agent: sip-client/0.0.1");
+  tx_.str("From: ").quoted(call->display).str("  <sip:").str(p_sip_user_).chr('@').str(p_sip_ip_);
+  tx_.str(">;tag=").unum(call->local_tag, 10).crlf();
+  write_via(tx_);
+  tx_.str("To: <").str(uri).line(">");
+  tx_.str("Contact: ").quoted(p_sip_user_).str(" <sip:").str(p_sip_user_).chr('@').str(p_my_ip_);
+  tx_.chr(':').num(i_my_port_).line(";transport=udp>");
+  // answers the challenge, or reuses the last nonce so that the server need not challenge at all
+  bool authorized = write_authorization(p, "INVITE", uri.c_str(), tx_);
+  if (p) {
+    if (!authorized) {
+      end_call(call);
+      return;
     }
-      if (safe_strlen(p_buf_) >= sizeof(ca_read_)) {
-        ESP_LOGW(TAG, "parse_return_params: p_buf_ content truncated copying to ca_read_");
-      }
+    call->auth_attempts++;
   }
+  tx_.line("Content-Type: application/sdp");
+  tx_.line("Allow: INVITE, ACK, CANCEL, OPTIONS, BYE, REFER, NOTIFY, MESSAGE, SUBSCRIBE, INFO");
+  tx_.begin_body();
+  sdp_write_offer(tx_, p_my_ip_.c_str(), call->rtp_port, call->local_tag, offer_, offer_count_, ptime_,
+                  comfort_noise_);
+  call->headers[0] = 0;
+  call->local_cseq = cseq;
+  ESP_LOGD(TAG, "Sending INVITE for call %u", (unsigned)call->id);
+  call->invite_txn = send_request();
+  if (call->invite_txn == 0)
+    end_call(call);
+}
+
+void Sip::copy_header(SipMessage &msg, const SipParser &in, SipHeader header) {
+  SipSpan value = in.header(header);
+  if (value.empty())
+    return;
+  msg.str(sip_header_name(header)).str(": ", 2).str(in.ptr(value), value.length).crlf();
+}
+
+bool Sip::parse_return_params(SipDialog *call, const SipParser &in) {
+  // the dialog headers are collected straight into the call, without the trailing CRLF
+  SipMessage params(call->headers, sizeof(call->headers));
+  copy_header(params, in, SIP_HDR_CALL_ID);
+  copy_header(params, in, SIP_HDR_FROM);
+  copy_header(params, in, SIP_HDR_TO);
+  if (params.overflowed())
+    ESP_LOGW(TAG, "parse_return_params: dialog headers truncated to %u bytes", (unsigned)params.size());
+  if (params.size() >= 2)
+    call->headers[params.size() - 2] = 0;
   return true;
 }
 
 void Sip::handle_udp_packet() {
-  char *p;
   char ca_sip_in[2048];
-  int packet_size = 0;
   struct sockaddr_in remote;
   socklen_t addrlen = sizeof(remote);
-  packet_size = this->udp_->recvfrom(ca_sip_in, sizeof(ca_sip_in), (struct sockaddr *)&remote, &addrlen);
-  if (packet_size > 0) {
-    char ip_str[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &remote.sin_addr, ip_str, sizeof(ip_str));
-    ESP_LOGD(TAG, "Received SIP packet from %s:%d size %d", ip_str, ntohs(remote.sin_port), packet_size);
-    if (packet_size >= (int)sizeof(ca_sip_in)) {
-      // truncated packet, ensure last char zero
-      ca_sip_in[sizeof(ca_sip_in) - 1] = 0;
-      ESP_LOGW(TAG, "SIP packet truncated to %u bytes", (unsigned)sizeof(ca_sip_in));
-    } else {
-      ca_sip_in[packet_size] = 0;
-    }
-    ESP_LOGD(TAG, "Response status: %s", strstr(ca_sip_in, "SIP/2.0") ? strstr(ca_sip_in, "SIP/2.0") : "No SIP/2.0");
+  // one byte short of the buffer, the body is searched as a C string below
+  int packet_size = this->udp_->recvfrom(ca_sip_in, sizeof(ca_sip_in) - 1, (struct sockaddr *)&remote, &addrlen);
+  if (packet_size <= 0)
+    return;
+  ca_sip_in[packet_size] = 0;
+
+  char ip_str[INET_ADDRSTRLEN];
+  inet_ntop(AF_INET, &remote.sin_addr, ip_str, sizeof(ip_str));
+  SipParser msg;
+  if (!msg.parse(ca_sip_in, packet_size)) {
+    ESP_LOGW(TAG, "Ignoring malformed SIP packet from %s:%d, size %d", ip_str, ntohs(remote.sin_port), packet_size);
+    return;
   }
-  if (packet_size > 0) {
-    p = ca_sip_in;
+  if (msg.is_response()) {
+    ESP_LOGD(TAG, "Received SIP %d from %s:%d, size %d", msg.get_status(), ip_str, ntohs(remote.sin_port),
+             packet_size);
   } else {
-    p = nullptr;
+    SipSpan method = msg.get_method_name();
+    ESP_LOGD(TAG, "Received SIP %.*s from %s:%d, size %d", (int)method.length, msg.ptr(method), ip_str,
+             ntohs(remote.sin_port), packet_size);
   }
 
-  if (!p) {
-    // max 5 dial retry when loos first invite packet
-    if (i_auth_cnt_ == 0 && i_dial_retries_ < 5 && i_ring_time_ && (millis() - i_ring_time_) > (i_dial_retries_ * 200)) {
-      i_dial_retries_++;
-      ESP_LOGD(TAG, "Scheduling INVITE retry #%d", i_dial_retries_);
-      // avoid double scheduling
-      App.scheduler.cancel_timeout(this, "sip_invite_retry");
-      App.scheduler.set_timeout(this, "sip_invite_retry", 30, [this]() {
-        ESP_LOGD(TAG, "Running scheduled INVITE retry");
-        this->invite();
-      });
+  SipEndpoint from{ntohl(remote.sin_addr.s_addr), ntohs(remote.sin_port)};
+  uint32_t now = millis();
+  if (msg.is_request()) {
+    uint32_t txn;
+    // retransmissions are answered by the transaction layer with the response we sent before
+    if (!txns_.on_request(msg, from, now, &txn))
+      return;
+    switch (msg.get_method()) {
+      case SIP_METHOD_INVITE:
+        handle_invite(msg, txn, from);
+        break;
+      case SIP_METHOD_CANCEL:
+        handle_cancel(msg, txn, from);
+        break;
+      case SIP_METHOD_BYE: {
+        SipDialog *call = dialogs_.find(msg);
+        if (call == nullptr) {
+          respond(msg, txn, from, 481, "Call/Transaction Does Not Exist");
+          break;
+        }
+        respond(msg, txn, from, 200, "OK");
+        ESP_LOGI(TAG, "Call %u ended by the peer", (unsigned)call->id);
+        bool ringing = call->state == SIP_DIALOG_RINGING;
+        if (ringing)
+          respond_incoming(call, 487, "Request Terminated", false);
+        end_call(call, ringing);
+        break;
+      }
+      case SIP_METHOD_INFO:
+        i_last_cseq_ = msg.get_cseq();
+        respond(msg, txn, from, 200, "OK");
+        break;
+      case SIP_METHOD_OPTIONS:
+        respond(msg, txn, from, 200, "OK");
+        break;
+      case SIP_METHOD_ACK: {
+        // the ACK of our 200 ends the INVITE server transaction and its retransmissions
+        SipDialog *call = dialogs_.find_transaction(txn);
+        if (call != nullptr && call->server_txn == txn) {
+          ESP_LOGD(TAG, "Call %u confirmed", (unsigned)call->id);
+          call->server_txn = 0;
+        }
+        break;
+      }
+      default:
+        respond(msg, txn, from, 501, "Not Implemented");
+        break;
     }
     return;
   }
 
-  if (strstr(p, "SIP/2.0 401 Unauthorized") == p) {
-    ESP_LOGD(TAG, "SIP/2.0 401 Unauthorized received");
-    ack(p);
-    // call Invite with response data (p) to build auth md5 hashes
-    invite(p);
-  } else if (strstr(p, "BYE") == p) {
-    ESP_LOGD(TAG, "SIP/BYE received");
-    audioport = "";
-    ok(p);
-    i_ring_time_ = 0;
-  } else if (strstr(p, "SIP/2.0 200") == p) {  // OK
-    ESP_LOGD(TAG, "SIP/2.0 200 OK received");
-    parse_return_params(p);
-    ack(p);
-  } else if (strstr(p, "SIP/2.0 183 ") == p  // Session Progress
-             || strstr(p, "SIP/2.0 180 ") == p) {  // Ringing
-    //
-    // Determine the audio port of the SIP server (Fritzbox RTP port)
-    //
-    // for example:
-    // m=audio 7078 RTP/AVP 120
-    //
-    // Todo: sscanf maybe a better method to do this
-    //
-    ESP_LOGD(TAG, "SIP/2.0 183 or 180 received");
-    char *sdpportptr;
-    if (codec_ == 0) {
-      sdpportptr = strstr(p, " RTP/AVP 0");
-      if (sdpportptr == NULL) {
-        ESP_LOGD(TAG, "RTP/AVP 0 not found");
-        audioport = "";
-        return;
+  // retransmitted responses are absorbed, failure responses to INVITE already ACKed
+  uint32_t txn = 0;
+  if (!txns_.on_response(msg, now, &txn))
+    return;
+  if (msg.get_cseq_method() == SIP_METHOD_REGISTER) {
+    registration_.on_response(msg, txn, now);
+    return;
+  }
+  if (msg.get_cseq_method() != SIP_METHOD_INVITE)
+    return;  // CANCEL and BYE need nothing more once answered
+  // a 200 retransmitted after its transaction ended comes without one
+  SipDialog *call = dialogs_.find_transaction(txn);
+  if (call == nullptr)
+    call = dialogs_.find(msg);
+  if (call == nullptr) {
+    if (msg.get_status() == 200)
+      ack(msg);
+    return;
+  }
+  handle_response(call, msg);
+}
+
+void Sip::handle_response(SipDialog *call, const SipParser &msg) {
+  switch (msg.get_status()) {
+    case 401:  // Unauthorized
+    case 407:  // Proxy Authentication Required
+      // call Invite with the challenge to build auth md5 hashes
+      if (call->cancelled) {
+        end_call(call);
       } else {
-        ESP_LOGD(TAG, "RTP/AVP 0 found");
+        invite(call, &msg);
       }
-    } else if (codec_ == 1) {
-      sdpportptr = strstr(p, " RTP/AVP 8");
-      if (sdpportptr == NULL) {
-        ESP_LOGD(TAG, "RTP/AVP 8 not found");
-        audioport = "";
-        return;
-      } else {
-        ESP_LOGD(TAG, "RTP/AVP 8 found");
+      break;
+    case 200:  // OK
+      parse_return_params(call, msg);
+      ack(msg);
+      if (call->cancelled) {
+        // answered while our CANCEL was on its way
+        bye(call);
+        end_call(call);
+        break;
       }
-    } else {
-      sdpportptr = strstr(p, " RTP/AVP 18");
-      if (sdpportptr == NULL) {
-        ESP_LOGD(TAG, "RTP/AVP 18 not found");
-        audioport = "";
-        return;
-      } else {
-        ESP_LOGD(TAG, "RTP/AVP 18 found");
+      apply_answer(call, msg);
+      call->state = SIP_DIALOG_CONFIRMED;
+      break;
+    case 100:  // Trying
+    case 180:  // Ringing
+    case 183:  // Session Progress
+      if (call->cancelled) {
+        cancel(call);
+        break;
       }
-    }
-    sdpportptr--;
-    int i = 0;
-    // walk backwards up to 8 chars or until we find a space (safely stop at start of buffer)
-    while (sdpportptr > p && *sdpportptr != '\0' && *sdpportptr != ' ' && i < 8) {
-      i++;
-      sdpportptr--;
-    }
-    sdpportptr++;
-    if (i < 7) {
-      i = 0;
-      // only copy up to 7 chars or until a space/terminator
-      while (*sdpportptr != ' ' && *sdpportptr != '\0' && i < 7) {
-        audioport += *sdpportptr;
-        sdpportptr++;
-        i++;
+      if (msg.get_status() != 100) {
+        apply_answer(call, msg);
+        parse_return_params(call, msg);
       }
-      ESP_LOGD(TAG, "Audio Port: %s", audioport.c_str());
-    }
-    parse_return_params(p);
-  } else if (strstr(p, "SIP/2.0 100 ") == p) {  // Trying
-    parse_return_params(p);
-    ack(p);
-  } else if (strstr(p, "SIP/2.0 486 ") == p  // Busy Here
-             || strstr(p, "SIP/2.0 603 ") == p  // Decline
-             || strstr(p, "SIP/2.0 487 ") == p) {  // Request Terminated
-    ack(p);
-    i_ring_time_ = 0;
-  } else if (strstr(p, "INFO") == p) {
-    i_last_cseq_ = grep_integer(p, "\nCSeq: ");
-    ok(p);
+      break;
+    default:
+      if (msg.get_status() >= 300) {
+        // Busy Here, Decline, Request Terminated after our CANCEL, ...
+        ESP_LOGI(TAG, "Call %u failed: %d", (unsigned)call->id, msg.get_status());
+        end_call(call);
+      }
+      break;
   }
 }
 
-int Sip::send_udp() {
-  if (!p_buf_) {
-    ESP_LOGE(TAG, "send_udp: p_buf_ == nullptr");
-    return -1;
+void Sip::handle_invite(const SipParser &msg, uint32_t txn, const SipEndpoint &from) {
+  if (txn == 0) {
+    respond(msg, 0, from, 503, "Service Unavailable");
+    return;
   }
-  ESP_LOGD(TAG, "Sending SIP packet to %s:%d", p_sip_ip_.c_str(), i_sip_port_);
-  // Create a redacted copy for logging so Authorization headers are not leaked
-  char pbuf_masked[2048];
-  size_t sl = safe_strlen(p_buf_);
-  if (sl >= sizeof(pbuf_masked)) sl = sizeof(pbuf_masked) - 1;
-  memcpy(pbuf_masked, p_buf_, sl);
-  pbuf_masked[sl] = '\0';
-  const char *auth_str = "Authorization:";
-  char *pos = strstr(pbuf_masked, auth_str);
-  if (pos) {
-    // find end of line
-    char *eol = strstr(pos, "\r\n");
-    if (!eol) eol = strstr(pos, "\n");
-    if (eol) {
-      // replace the entire authorization header line with redaction text
-      const char *redaction = "Authorization: Digest <REDACTED>";
-      size_t redlen = strlen(redaction);
-      size_t rest = strlen(eol);
-      // move tail forward/backwards depending on length
-      if (redlen <= (size_t)(eol - pos)) {
-        memcpy(pos, redaction, redlen);
-        // pad remainder with spaces to keep lengths same
-        for (size_t i = redlen; i < (size_t)(eol - pos); ++i) pos[i] = ' ';
-      } else {
-        // truncated: write redaction and then shift tail if space
-        memcpy(pos, redaction, redlen);
-        // then write eol
-        // If redlen larger than available, just truncate the buffer at pos + redlen
-      }
+  SdpNegotiation offer;
+  SipDialog *call = dialogs_.find(msg);
+  if (call != nullptr) {
+    if (call->state != SIP_DIALOG_CONFIRMED) {
+      // a second INVITE while the first one is still open
+      respond(msg, txn, from, 491, "Request Pending");
+      return;
+    }
+    // re-INVITE, e.g. hold or a codec change: answer with the same session
+    if (!negotiate_offer(msg, &offer)) {
+      respond(msg, txn, from, 488, "Not Acceptable Here");
+      return;
     }
+    SipMessage headers(call->response_headers, sizeof(call->response_headers));
+    copy_header(headers, msg, SIP_HDR_VIA);
+    copy_header(headers, msg, SIP_HDR_FROM);
+    copy_header(headers, msg, SIP_HDR_TO);
+    copy_header(headers, msg, SIP_HDR_CALL_ID);
+    copy_header(headers, msg, SIP_HDR_CSEQ);
+    call->server_txn = txn;
+    call->offer = offer;
+    respond_incoming(call, 200, "OK", true);
+    use_media(call, offer);
+    return;
   }
-  ESP_LOGD(TAG, "SIP packet content:\n%s", pbuf_masked);
-  struct sockaddr_in remote = {};
-  remote.sin_family = AF_INET;
-  remote.sin_port = htons(i_sip_port_);
-  inet_pton(AF_INET, p_sip_ip_.c_str(), &remote.sin_addr);
-  if (!this->udp_) {
-    ESP_LOGE(TAG, "send_udp: udp socket is null");
-    return -1;
+  if (dialogs_.full()) {
+    respond(msg, txn, from, 486, "Busy Here");
+    return;
   }
-  size_t len = safe_strlen(p_buf_);
-  this->udp_->sendto((uint8_t *)p_buf_, len, 0, (struct sockaddr *)&remote, sizeof(remote));
-  return 0;
+  if (!negotiate_offer(msg, &offer)) {
+    // an INVITE without offer would need our offer in the 200 and the answer in the ACK
+    ESP_LOGW(TAG, "Incoming INVITE has no audio stream we can use");
+    respond(msg, txn, from, 488, "Not Acceptable Here");
+    return;
+  }
+  uint16_t port = rtp_ports_.acquire();
+  if (port == 0) {
+    ESP_LOGW(TAG, "No free RTP port for an incoming call");
+    respond(msg, txn, from, 486, "Busy Here");
+    return;
+  }
+  call = dialogs_.create(SIP_DIALOG_RINGING, false, millis());
+  call->rtp_port = port;
+
+  // the dialog as seen from our side: the caller's To with our tag is our From
+  call->local_tag = random();
+  SipSpan from_hdr = msg.header(SIP_HDR_FROM);
+  SipSpan to_hdr = msg.header(SIP_HDR_TO);
+  SipSpan call_id = msg.header(SIP_HDR_CALL_ID);
+  SipSpan contact = msg.uri(msg.header(SIP_HDR_CONTACT));
+  SipMessage headers(call->response_headers, sizeof(call->response_headers));
+  copy_header(headers, msg, SIP_HDR_VIA);
+  copy_header(headers, msg, SIP_HDR_FROM);
+  headers.str("To: ").str(msg.ptr(to_hdr), to_hdr.length).str(";tag=").hex(call->local_tag, 8).crlf();
+  copy_header(headers, msg, SIP_HDR_CALL_ID);
+  copy_header(headers, msg, SIP_HDR_CSEQ);
+  SipMessage params(call->headers, sizeof(call->headers));
+  params.str("Call-ID: ").str(msg.ptr(call_id), call_id.length).crlf();
+  params.str("From: ").str(msg.ptr(to_hdr), to_hdr.length).str(";tag=").hex(call->local_tag, 8).crlf();
+  params.str("To: ").str(msg.ptr(from_hdr), from_hdr.length);
+  SipMessage id(call->call_id, sizeof(call->call_id));
+  id.str(msg.ptr(call_id), call_id.length);
+  SipMessage target(call->remote_target, sizeof(call->remote_target));
+  target.str(msg.ptr(contact), contact.length);
+  if (headers.overflowed() || params.overflowed() || id.overflowed() || target.overflowed()) {
+    ESP_LOGW(TAG, "Incoming INVITE headers too long");
+    end_call(call);
+    respond(msg, txn, from, 500, "Server Internal Error");
+    return;
+  }
+  // the caller's user part, else the whole URI
+  SipSpan caller_uri = msg.uri(from_hdr);
+  std::string caller(msg.ptr(caller_uri), caller_uri.length);
+  if (caller.compare(0, 4, "sip:") == 0)
+    caller.erase(0, 4);
+  size_t at = caller.find('@');
+  if (at != std::string::npos && at > 0)
+    caller.erase(at);
+  safe_strncpy(call->peer, caller.c_str(), sizeof(call->peer));
+
+  call->server_txn = txn;
+  call->offer = offer;
+  ESP_LOGI(TAG, "Incoming call %u from %s, RTP port %u", (unsigned)call->id, call->peer, (unsigned)port);
+  respond_incoming(call, 180, "Ringing", false);
+  if (on_incoming_call_)
+    on_incoming_call_(call->id, caller);
 }
 
-uint32_t Sip::random() {
-  return esp_random();
+void Sip::handle_cancel(const SipParser &msg, uint32_t txn, const SipEndpoint &from) {
+  // the CANCEL carries the Call-ID and CSeq number of the INVITE it cancels (9.1)
+  SipDialog *call = dialogs_.find(msg);
+  if (call == nullptr || call->state != SIP_DIALOG_RINGING) {
+    respond(msg, txn, from, 481, "Call/Transaction Does Not Exist");
+    return;
+  }
+  respond(msg, txn, from, 200, "OK");
+  respond_incoming(call, 487, "Request Terminated", false);
+  ESP_LOGI(TAG, "Missed call %u from %s", (unsigned)call->id, call->peer);
+  end_call(call, true);
 }
 
-uint32_t Sip::millis() {
-  return (uint32_t)esphome::millis() + 1;
+void Sip::end_call(SipDialog *call, bool missed) {
+  uint32_t id = call->id;
+  std::string caller = missed ? call->peer : "";
+  rtp_ports_.release(call->rtp_port);
+  dialogs_.release(call);
+  if (missed && on_call_missed_)
+    on_call_missed_(id, caller);
 }
 
-void Sip::make_md5_digest(char *p_out_hex33, char *p_in) {
-  if (!p_out_hex33 || !p_in) return;
-  // reuse md5_hex helper to return lowercase hex string and copy to p_out
-  std::string s = md5_hex(std::string(p_in));
-  if (s.size() != 32) {
-    // Failed - ensure zeroed string
-    memset(p_out_hex33, 0, 33);
+bool Sip::answer(uint32_t id) {
+  SipDialog *call = id == 0 ? dialogs_.oldest_ringing() : dialogs_.find(id);
+  if (call == nullptr || call->state != SIP_DIALOG_RINGING)
+    return false;
+  respond_incoming(call, 200, "OK", true);
+  call->state = SIP_DIALOG_CONFIRMED;
+  use_media(call, call->offer);
+  ESP_LOGI(TAG, "Answered call %u from %s", (unsigned)call->id, call->peer);
+  return true;
+}
+
+void Sip::on_transaction_timeout(uint32_t txn, SipMethod method) {
+  if (registration_.on_timeout(txn, millis()))
+    return;
+  SipDialog *call = dialogs_.find_transaction(txn);
+  if (call != nullptr && txn == call->server_txn) {
+    // our 200 was never ACKed (Timer L)
+    ESP_LOGW(TAG, "Call %u not confirmed by the peer, hanging up", (unsigned)call->id);
+    call->server_txn = 0;
+    bye(call);
+    end_call(call);
     return;
   }
-  memcpy(p_out_hex33, s.c_str(), 33); // including null terminator
-}
-
-void Sip::hangup() {
-  i_last_cseq_ = 3;  // Set to next CSeq after INVITE (1 or 2)
-  bye(i_last_cseq_);
-}
-
-// G.711 codec implementations
-#define SIGN_BIT (0x80)		/* Sign bit for a A-law byte. */
-#define QUANT_MASK (0xf)		/* Quantization field mask. */
-#define NSEGS (8)		/* Number of A-law segments. */
-#define SEG_SHIFT (4)		/* Left shift for segment number. */
-#define SEG_MASK (0x70)		/* Segment field mask. */
-
-static short seg_end[8] = {0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF, 0x1FFF, 0x3FFF, 0x7FFF};
-
-/* copy from CCITT G.711 specifications */
-unsigned char _u2a[128] = {			/* u- to A-law conversions */
-	1,	1,	2,	2,	3,	3,	4,	4,
-	5,	5,	6,	6,	7,	7,	8,	8,
-	9,	10,	11,	12,	13,	14,	15,	16,
-	17,	18,	19,	20,	21,	22,	23,	24,
-	25,	27,	29,	31,	33,	34,	35,	36,
-	37,	38,	39,	40,	41,	42,	43,	44,
-	46,	48,	49,	50,	51,	52,	53,	54,
-	55,	56,	57,	58,	59,	60,	61,	62,
-	64,	65,	66,	67,	68,	69,	70,	71,
-	72,	73,	74,	75,	76,	77,	78,	79,
-	81,	82,	83,	84,	85,	86,	87,	88,
-	89,	90,	91,	92,	93,	94,	95,	96,
-	97,	98,	99,	100,	101,	102,	103,	104,
-	105,	106,	107,	108,	109,	110,	111,	112,
-	113,	114,	115,	116,	117,	118,	119,	120,
-	121,	122,	123,	124,	125,	126,	127,	128
-};
-
-unsigned char _a2u[128] = {			/* A- to u-law conversions */
-	1,	3,	5,	7,	9,	11,	13,	15,
-	16,	17,	18,	19,	20,	21,	22,	23,
-	24,	25,	26,	27,	28,	29,	30,	31,
-	32,	32,	33,	33,	34,	34,	35,	35,
-	36,	37,	38,	39,	40,	41,	42,	43,
-	44,	45,	46,	47,	48,	48,	49,	49,
-	50,	51,	52,	53,	54,	55,	56,	57,
-	58,	59,	60,	61,	62,	63,	64,	64,
-	65,	66,	67,	68,	69,	70,	71,	72,
-	73,	74,	75,	76,	77,	78,	79,	79,
-	80,	81,	82,	83,	84,	85,	86,	87,
-	88,	89,	90,	91,	92,	93,	94,	95,
-	96,	97,	98,	99,	100,	101,	102,	103,
-	104,	105,	106,	107,	108,	109,	110,	111,
-	112,	113,	114,	115,	116,	117,	118,	119,
-	120,	121,	122,	123,	124,	125,	126,	127
-};
-
-static int search(int val, short *table, int size)
-{
-	int	i;
-
-	for (i = 0; i < size; i++) {
-		if (val <= *table++)
-			return (i);
-	}
-	return (size);
-}
-
-unsigned char linear2alaw(int pcm_val)	/* 2's complement (16-bit range) */
-{
-	int		mask;
-	int		seg;
-	unsigned char	aval;
-
-	if (pcm_val >= 0) {
-		mask = 0xD5;		/* sign (7th) bit = 1 */
-	} else {
-		mask = 0x55;		/* sign bit = 0 */
-		pcm_val = -pcm_val - 8;
-	}
-
-	/* Convert the scaled magnitude to segment number. */
-	seg = search(pcm_val, seg_end, 8);
-
-	/* Combine the sign, segment, and quantization bits. */
-
-	if (seg >= 8)		/* out of range, return maximum value. */
-		return (0x7F ^ mask);
-	else {
-		aval = seg << SEG_SHIFT;
-		if (seg < 2)
-			aval |= (pcm_val >> 4) & QUANT_MASK;
-		else
-			aval |= (pcm_val >> (seg + 3)) & QUANT_MASK;
-		return (aval ^ mask);
-	}
-}
-
-int alaw2linear(unsigned char a_val)
-{
-	int t;
-	int seg;
-
-	a_val ^= 0x55;
-
-	t = (a_val & QUANT_MASK) << 4;
-	seg = ((unsigned)a_val & SEG_MASK) >> SEG_SHIFT;
-	switch (seg) {
-	case 0:
-		t += 8;
-		break;
-	case 1:
-		t += 0x108;
-		break;
-	default:
-		t += 0x108;
-		t <<= seg - 1;
-	}
-	return ((a_val & SIGN_BIT) ? t : -t);
-}
-
-#define	BIAS		(0x84)		/* Bias for linear code. */
-
-unsigned char linear2ulaw(int pcm_val)	/* 2's complement (16-bit range) */
-{
-	int mask;
-	int seg;
-	unsigned char uval;
-
-	/* Get the sign and the magnitude of the value. */
-	if (pcm_val < 0) {
-		pcm_val = BIAS - pcm_val;
-		mask = 0x7F;
-	} else {
-		pcm_val += BIAS;
-		mask = 0xFF;
-	}
-
-	/* Convert the scaled magnitude to segment number. */
-	seg = search(pcm_val, seg_end, 8);
-
-	/*
-	 * Combine the sign, segment, quantization bits;
-	 * and complement the code word.
-	 */
-	if (seg >= 8)		/* out of range, return maximum value. */
-		return (0x7F ^ mask);
-	else {
-		uval = (seg << 4) | ((pcm_val >> (seg + 3)) & 0xF);
-		return (uval ^ mask);
-	}
+  if (call == nullptr || txn != call->invite_txn) {
+    ESP_LOGW(TAG, "SIP request (method %d) timed out", (int)method);
+    return;
+  }
+  ESP_LOGW(TAG, "No answer to INVITE of call %u from %s, giving up", (unsigned)call->id, p_sip_ip_.c_str());
+  end_call(call);
 }
 
-int ulaw2linear(unsigned char u_val)
-{
-	int t;
+void Sip::set_offer(const SdpCodec *codecs, size_t count, uint8_t ptime, bool comfort_noise) {
+  offer_count_ = count < CODEC_COUNT ? count : CODEC_COUNT;
+  for (size_t i = 0; i < offer_count_; i++)
+    offer_[i] = codecs[i];
+  ptime_ = ptime;
+  comfort_noise_ = comfort_noise;
+}
 
-	/* Complement to obtain normal u-law value. */
-	u_val = ~u_val;
+void Sip::apply_answer(SipDialog *call, const SipParser &msg) {
+  SipSpan body = msg.body();
+  SipSpan type = msg.header(SIP_HDR_CONTENT_TYPE);
+  if (body.empty() || (!type.empty() && strncasecmp(msg.ptr(type), "application/sdp", 15) != 0))
+    return;  // e.g. 180 without early media: keep what we have
+  SdpMedia answer;
+  SdpNegotiation result;
+  if (!answer.parse(msg.ptr(body), body.length) ||
+      !sdp_negotiate(answer, offer_, offer_count_, ptime_, &result)) {
+    ESP_LOGW(TAG, "SDP answer has no audio stream we can use");
+    clear_media(call);
+    return;
+  }
+  if (!comfort_noise_)
+    result.cn_payload_type = 0;
+  use_media(call, result);
+}
 
-	/*
-	 * Extract and bias the quantization bits. Then
-	 * shift up by the segment number and subtract out the bias.
-	 */
-	t = ((u_val & QUANT_MASK) << 3) + BIAS;
-	t <<= ((unsigned)u_val & SEG_MASK) >> SEG_SHIFT;
+bool Sip::negotiate_offer(const SipParser &msg, SdpNegotiation *out) {
+  SipSpan body = msg.body();
+  SipSpan type = msg.header(SIP_HDR_CONTENT_TYPE);
+  if (body.empty() || (!type.empty() && strncasecmp(msg.ptr(type), "application/sdp", 15) != 0))
+    return false;
+  SdpMedia offer;
+  // our codecs in preference order, the offerer's order decides
+  if (!offer.parse(msg.ptr(body), body.length) || !sdp_negotiate(offer, offer_, offer_count_, ptime_, out))
+    return false;
+  if (!comfort_noise_)
+    out->cn_payload_type = 0;
+  return true;
+}
 
-	return (((u_val & SIGN_BIT) ? (BIAS - t) : (t - BIAS)));
+void Sip::use_media(SipDialog *call, const SdpNegotiation &result) {
+  const SdpNegotiation &media = call->media;
+  if (call->media_valid && result.codec == media.codec && result.payload_type == media.payload_type &&
+      result.ptime == media.ptime && result.send == media.send && result.recv == media.recv &&
+      result.address == media.address && result.port == media.port && result.rtcp_port == media.rtcp_port &&
+      result.cn_payload_type == media.cn_payload_type)
+    return;  // repeated in the 200 OK
+  call->media = result;
+  call->media_valid = true;
+  call->media_version++;
+  ESP_LOGI(TAG, "Call %u media: %s (payload type %u)%s, ptime %u ms, %s %u.%u.%u.%u:%u", (unsigned)call->id,
+           codec_encoding_name(result.codec), (unsigned)result.payload_type,
+           result.cn_payload_type != 0 ? " with comfort noise" : "", (unsigned)result.ptime,
+           result.send ? (result.recv ? "sendrecv" : "sendonly") : (result.recv ? "recvonly" : "inactive"),
+           (unsigned)(result.address >> 24), (unsigned)((result.address >> 16) & 0xFF),
+           (unsigned)((result.address >> 8) & 0xFF), (unsigned)(result.address & 0xFF), (unsigned)result.port);
 }
 
-unsigned char alaw2ulaw(unsigned char aval)
-{
-	aval &= 0xff;
-	return ((aval & 0x80) ? (0xFF ^ _a2u[aval ^ 0xD5]) :
-				(0x7F ^ _a2u[aval ^ 0x55]));
+void Sip::clear_media(SipDialog *call) {
+  if (!call->media_valid)
+    return;
+  call->media_valid = false;
+  call->media_version++;
 }
 
-unsigned char ulaw2alaw(unsigned char uval)
-{
-	uval &= 0xff;
-	return ((uval & 0x80) ? (0xD5 ^ (_u2a[0xFF ^ uval] - 1)) :
-				(0x55 ^ (_u2a[0x7F ^ uval] - 1)));
+bool Sip::finish_tx() {
+  if (!tx_.finish()) {
+    ESP_LOGE(TAG, "SIP message does not fit into %u bytes, not sent", (unsigned)tx_.capacity());
+    return false;
+  }
+#if ESPHOME_LOG_LEVEL >= ESPHOME_LOG_LEVEL_VERBOSE
+  // log around the Authorization header instead of copying the message to redact it
+  const char *msg = tx_.data();
+  const char *auth = strstr(msg, "\r\nAuthorization:");
+  if (auth != nullptr) {
+    const char *eol = strstr(auth + 2, "\r\n");
+    ESP_LOGV(TAG, "SIP packet content:\n%.*s\r\nAuthorization: Digest <REDACTED>%s", (int)(auth - msg), msg,
+             eol != nullptr ? eol : "");
+  } else {
+    ESP_LOGV(TAG, "SIP packet content:\n%s", msg);
+  }
+#endif
+  return true;
 }
 
+uint32_t Sip::send_request() {
+  if (!finish_tx())
+    return 0;
+  uint32_t txn = txns_.send_request(server_, tx_.data(), tx_.size(), millis());
+  if (txn == 0)
+    ESP_LOGW(TAG, "No free SIP transaction, request not sent");
+  return txn;
+}
 
+int Sip::send_udp() {
+  if (!finish_tx())
+    return -1;
+  send_to(server_, tx_.data(), tx_.size());
+  return 0;
+}
 
+void Sip::send_to(const SipEndpoint &to, const char *data, size_t len) {
+  if (!this->udp_) {
+    ESP_LOGE(TAG, "send_to: udp socket is null");
+    return;
+  }
+  struct sockaddr_in remote = {};
+  remote.sin_family = AF_INET;
+  remote.sin_port = htons(to.port);
+  remote.sin_addr.s_addr = htonl(to.address);
+  char ip_str[INET_ADDRSTRLEN];
+  inet_ntop(AF_INET, &remote.sin_addr, ip_str, sizeof(ip_str));
+  ESP_LOGD(TAG, "Sending SIP packet to %s:%u, %u bytes", ip_str, (unsigned)to.port, (unsigned)len);
+  this->udp_->sendto((const uint8_t *)data, len, 0, (struct sockaddr *)&remote, sizeof(remote));
+}
 
+uint32_t Sip::random() {
+  return esp_random();
+}
 
+uint32_t Sip::millis() {
+  return (uint32_t)esphome::millis() + 1;
+}
 
+void Sip::hangup(uint32_t id) {
+  if (id == 0) {
+    for (size_t i = 0; i < dialogs_.capacity(); i++) {
+      SipDialog *call = dialogs_.at(i);
+      if (call != nullptr && call->is_active())
+        hangup(call->id);
+    }
+    return;
+  }
+  SipDialog *call = dialogs_.find(id);
+  if (call == nullptr)
+    return;
+  switch (call->state) {
+    case SIP_DIALOG_RINGING:
+      respond_incoming(call, 603, "Decline", false);
+      end_call(call);
+      break;
+    case SIP_DIALOG_CONFIRMED:
+      bye(call);
+      end_call(call);
+      break;
+    case SIP_DIALOG_CALLING: {
+      SipTransactionState invite_state = txns_.get_state(call->invite_txn);
+      if (invite_state != SIP_TXN_CALLING && invite_state != SIP_TXN_PROCEEDING) {
+        end_call(call);
+        break;
+      }
+      // the slot stays taken until the INVITE ends: a 487, or a 200 that crossed the CANCEL
+      call->cancelled = true;
+      call->state = SIP_DIALOG_TERMINATING;
+      clear_media(call);
+      // a CANCEL may only follow a provisional response (RFC 3261 9.1); until then it waits
+      if (invite_state == SIP_TXN_PROCEEDING)
+        cancel(call);
+      break;
+    }
+    default:
+      break;
+  }
+}
 
 Voip::Voip() {}
 
@@ -848,11 +878,13 @@ void Voip::loop() {
   }
   this->last_hw_ready_ = hw_ready_loop;
   // if (network::is_connected()) {
-    if (this->rtp_udp_) {
+    // with a media task, RX/TX run there and only call-state events come back through the queue
+    if (this->legs_ && !media_task_.is_running()) {
       handle_incoming_rtp();
     }
+    process_media_events();
     if (sip_) {
-      handle_outgoing_rtp();
+      sync_media_legs();
       sip_->loop();
     }
   // Automations: detect SIP/stream state transitions
@@ -880,7 +912,42 @@ void Voip::dump_config() {
   ESP_LOGCONFIG(TAG, "VoIP Component");
   ESP_LOGCONFIG(TAG, "  SIP IP: %s", sip_ip_.c_str());
   ESP_LOGCONFIG(TAG, "  SIP User: %s", sip_user_.c_str());
-  ESP_LOGCONFIG(TAG, "  Codec: %d", codec_type_);
+  ESP_LOGCONFIG(TAG, "  Codec: %s (payload type %u), all others offered as well", codec_encoding_name(codec_type_),
+                (unsigned)payload_type_);
+  ESP_LOGCONFIG(TAG, "  Calls: %u%s, RTP ports %u-%u, ptime: %u ms%s", (unsigned)max_calls_,
+                conference_ ? " in conference" : "", (unsigned)rtp_port_, (unsigned)rtp_port_max_, (unsigned)ptime_ms_,
+                dtx_ ? ", DTX with comfort noise" : "");
+  if (aec_enabled_) {
+    ESP_LOGCONFIG(TAG, "  Echo canceller: %u ms tail after %u ms, CPU budget %u us per 10 ms, suppressor %s",
+                  (unsigned)aec_tail_ms_, (unsigned)aec_delay_ms_, (unsigned)aec_budget_us_,
+                  aec_suppressor_ ? "on" : "off");
+  }
+  if (ns_enabled_)
+    ESP_LOGCONFIG(TAG, "  Microphone: noise suppression by up to %.0f dB", ns_attenuation_db_);
+  if (codec_type_ == CODEC_G722 && mic_sample_rate_ == 16000) {
+    ESP_LOGCONFIG(TAG, "  Microphone: 16 kHz, %u-bit, split into the G.722 bands", (unsigned)(mic_sample_bytes_ * 8));
+  } else if (mic_sample_rate_ != SAMPLE_RATE) {
+    ESP_LOGCONFIG(TAG, "  Microphone: %u Hz, %u-bit, resampled to %u Hz", (unsigned)mic_sample_rate_,
+                  (unsigned)(mic_sample_bytes_ * 8), (unsigned)SAMPLE_RATE);
+  }
+  if (codec_type_ == CODEC_G722 && speaker_sample_rate_ == 16000) {
+    ESP_LOGCONFIG(TAG, "  Speaker: 16 kHz, joined from the G.722 bands");
+  } else if (speaker_sample_rate_ != SAMPLE_RATE) {
+    ESP_LOGCONFIG(TAG, "  Speaker: resampled to %u Hz", (unsigned)speaker_sample_rate_);
+  }
+  if (mic_agc_enabled_)
+    ESP_LOGCONFIG(TAG, "  Microphone: automatic gain control");
+  if (speaker_limiter_enabled_)
+    ESP_LOGCONFIG(TAG, "  Speaker: limiter after amp_gain %d", amp_gain_);
+  ESP_LOGCONFIG(TAG, "  Registration: %s, expires %u s, auto answer: %s", register_ ? "on" : "off",
+                (unsigned)register_expires_s_, auto_answer_ ? "on" : "off");
+  ESP_LOGCONFIG(TAG, "  Jitter buffer: %u-%u ms", jitter_min_delay_ms_, jitter_max_delay_ms_);
+  ESP_LOGCONFIG(TAG, "  RTCP: on RTP port + 1, every %u s, CNAME %s", (unsigned)(RtcpSession::INTERVAL_US / 1000000),
+                rtcp_cname_);
+  if (use_media_task_) {
+    ESP_LOGCONFIG(TAG, "  Media task: core=%d priority=%d period=%u us", media_task_config_.core,
+                  media_task_config_.priority, (unsigned)media_task_config_.period_us);
+  }
 }
 
 void Voip::init(const std::string &sip_ip, const std::string &sip_user, const std::string &sip_pass) {
@@ -889,27 +956,62 @@ void Voip::init(const std::string &sip_ip, const std::string &sip_user, const st
   sip_pass_ = sip_pass;
 }
 
-void Voip::dial(const std::string &number, const std::string &id) {
+uint32_t Voip::dial(const std::string &number, const std::string &id) {
   ESP_LOGI(TAG, "Dialing %s", number.c_str());
   if (!started_) {
     ESP_LOGW(TAG, "dial called but VoIP not started");
-    return;
+    return 0;
   }
-  rx_stream_is_running_ = true;
-  if (sip_) sip_->dial(number, id);
+  // the call's leg is opened by sync_media_legs(), expecting the codec we prefer until the answer
+  return sip_ ? sip_->dial(number, id) : 0;
 }
 
 bool Voip::is_busy() {
   return sip_ ? sip_->is_busy() : false;
 }
 
-void Voip::hangup() {
-  if (sip_) sip_->hangup();
+void Voip::answer(uint32_t call) {
+  if (sip_) sip_->answer(call);
+}
+
+void Voip::hangup(uint32_t call) {
+  if (sip_) sip_->hangup(call);
+}
+
+void Voip::focus(uint32_t call) {
+  for (size_t i = 0; legs_ && i < max_calls_; i++) {
+    if (legs_[i].call == call && !legs_[i].stopping) {
+      this->set_focus((int)i);
+      return;
+    }
+  }
+  ESP_LOGW(TAG, "focus: call %u has no media", (unsigned)call);
 }
 
 void Voip::set_codec(int codec) {
+  if (codec < CODEC_PCMU || codec > CODEC_G722) {
+    ESP_LOGW(TAG, "Unknown codec %d, using PCMA", codec);
+    codec = CODEC_PCMA;
+  }
   codec_type_ = codec;
-  if (sip_) sip_->set_codec(codec);
+  payload_type_ = codec_payload_type(codec, dynamic_payload_type_);
+  this->update_sip_offer();
+}
+
+void Voip::update_sip_offer() {
+  if (!sip_) return;
+  // the configured codec first, then everything else the media path can encode and decode
+  static const int CODECS[CODEC_COUNT] = {CODEC_PCMA,    CODEC_PCMU,    CODEC_G726_32,
+                                          CODEC_G726_24, CODEC_G726_40, CODEC_G722};
+  SdpCodec offer[CODEC_COUNT];
+  size_t n = 0;
+  offer[n++] = SdpCodec{codec_type_, payload_type_, codec_encoding_name(codec_type_), SAMPLE_RATE};
+  for (int codec : CODECS) {
+    if (codec != codec_type_)
+      offer[n++] = SdpCodec{codec, codec_payload_type(codec, dynamic_payload_type_), codec_encoding_name(codec),
+                            SAMPLE_RATE};
+  }
+  sip_->set_offer(offer, n, (uint8_t)ptime_ms_, dtx_);
 }
 
 void Voip::start_component() {
@@ -936,32 +1038,110 @@ void Voip::finish_start_component() {
   }
   ESP_LOGI(TAG, "Starting VoIP component...");
   ESP_LOGD(TAG, "VoIP finish_start_component: entering start sequence (core=%d)", xPortGetCoreID());
-  // create RTP socket and SIP component
-  ESP_LOGI(TAG, "Free heap before RTP socket creation: %u", esp_get_free_heap_size());
-  ESP_LOGD(TAG, "VoIP finish_start_component: creating RTP UDP socket");
-  this->rtp_udp_ = socket::socket(AF_INET, SOCK_DGRAM, 0);
-  if (this->rtp_udp_ == nullptr) {
-    ESP_LOGE(TAG, "Failed to create RTP UDP socket");
-    if (start_retries_ < 10) {
-      start_retries_++;
-      uint32_t delay_ms = 1000 * start_retries_;
-      ESP_LOGW(TAG, "Will retry voip start in %u ms (attempt %d)", delay_ms, start_retries_);
-      this->start_pending_ = true;
-      App.scheduler.set_timeout(this, "voip_finish_start_retry", delay_ms, [this]() { this->finish_start_component(); });
+  // media state of every call is allocated once; the RTP sockets are opened per call
+  ESP_LOGI(TAG, "Free heap before media allocation: %u", esp_get_free_heap_size());
+  if (!this->legs_) {
+    this->legs_.reset(new (std::nothrow) MediaLeg[max_calls_]);
+    if (!this->legs_) {
+      ESP_LOGE(TAG, "Failed to allocate media state for %u calls", (unsigned)max_calls_);
+      if (start_retries_ < 10) {
+        start_retries_++;
+        uint32_t delay_ms = 1000 * start_retries_;
+        ESP_LOGW(TAG, "Will retry voip start in %u ms (attempt %d)", delay_ms, start_retries_);
+        this->start_pending_ = true;
+        App.scheduler.set_timeout(this, "voip_finish_start_retry", delay_ms, [this]() { this->finish_start_component(); });
+      }
+      return;
     }
-    return;
+    for (size_t i = 0; i < max_calls_; i++)
+      legs_[i].jitter.configure(jitter_min_delay_ms_, jitter_max_delay_ms_, SAMPLE_RATE);
   }
-  ESP_LOGD(TAG, "VoIP finish_start_component: created RTP UDP socket: fd=%d", this->rtp_udp_->get_fd());
-  this->rtp_udp_->setblocking(false);
-  struct sockaddr_in rtp_addr = {};
-  rtp_addr.sin_family = AF_INET;
-  rtp_addr.sin_port = htons(1234);
-  rtp_addr.sin_addr.s_addr = INADDR_ANY;
-  if (this->rtp_udp_->bind((struct sockaddr *)&rtp_addr, sizeof(rtp_addr)) != 0) {
-    ESP_LOGE(TAG, "Failed to bind RTP UDP socket");
-    return;
+  if (rtcp_cname_[0] == '\0')
+    snprintf(rtcp_cname_, sizeof(rtcp_cname_), "%08x%08x", (unsigned)esp_random(), (unsigned)esp_random());
+  size_t media_bytes = max_calls_ * sizeof(MediaLeg);
+  if (conference_ && mixer_.get_participants() == 0) {
+    bool ok = mixer_.configure(max_calls_ + 1, MIX_BLOCK_SAMPLES);
+    for (size_t i = 0; ok && i < max_calls_; i++) {
+      legs_[i].rx_pcm.reset(new (std::nothrow) int16_t[JitterBuffer::MAX_PAYLOAD]);
+      legs_[i].tx_pcm.reset(new (std::nothrow) int16_t[MAX_FRAME_SAMPLES]);
+      ok = legs_[i].rx_pcm && legs_[i].tx_pcm;
+    }
+    if (!ok) {
+      // one call at a time still works without the mixer
+      ESP_LOGE(TAG, "Failed to allocate the conference mixer, calls are taken one at a time");
+      conference_ = false;
+    }
+  }
+  if (conference_)
+    media_bytes += mixer_.get_memory_size() +
+                   max_calls_ * sizeof(int16_t) * (JitterBuffer::MAX_PAYLOAD + MAX_FRAME_SAMPLES);
+  if (aec_enabled_ && aec_.get_segments() == 0) {
+    if (aec_.configure(aec_tail_ms_, aec_delay_ms_)) {
+      aec_.set_suppressor(aec_suppressor_);
+    } else {
+      ESP_LOGE(TAG, "Failed to allocate the echo canceller, the microphone goes out with the echo");
+      aec_enabled_ = false;
+    }
+  }
+  media_bytes += aec_.get_memory_size();
+  if (ns_enabled_ && ns_.get_memory_size() == 0 && !ns_.configure(ns_attenuation_db_)) {
+    ESP_LOGE(TAG, "Failed to allocate the noise suppressor, the microphone goes out with the noise");
+    ns_enabled_ = false;
+  }
+  media_bytes += ns_.get_memory_size();
+  // G.722 at 16 kHz: its QMF takes the resampler's place, so that G.722 calls keep the upper band
+  if (codec_type_ == CODEC_G722 && mic_sample_rate_ == 16000 && !mic_split_) {
+    mic_pcm_.reset(new (std::nothrow) int16_t[2 * Resampler::CHUNK]);
+    tx_high_.reset(new (std::nothrow) int16_t[MAX_FRAME_SAMPLES]);
+    if (mic_pcm_ && tx_high_) {
+      g722::init_qmf(&mic_qmf_);
+      memset(tx_high_delay_, 0, sizeof(tx_high_delay_));
+      mic_split_ = true;
+    } else {
+      ESP_LOGE(TAG, "Failed to allocate the G.722 upper band, the microphone is resampled");
+      tx_high_.reset();
+    }
+  }
+  if (codec_type_ == CODEC_G722 && speaker_sample_rate_ == 16000 && !speaker_merge_) {
+    speaker_pcm_.reset(new (std::nothrow) int16_t[2 * MIX_BLOCK_SAMPLES]);
+    rx_high_.reset(new (std::nothrow) int16_t[JitterBuffer::MAX_PAYLOAD]);
+    if (speaker_pcm_ && rx_high_) {
+      g722::init_qmf(&speaker_qmf_);
+      memset(rx_high_delay_, 0, sizeof(rx_high_delay_));
+      speaker_merge_ = true;
+    } else {
+      ESP_LOGE(TAG, "Failed to allocate the G.722 upper band, the speaker is resampled");
+      rx_high_.reset();
+    }
+  }
+  if (mic_sample_rate_ != SAMPLE_RATE && !mic_split_ && !mic_resampler_) {
+    mic_resampler_.reset(new (std::nothrow) Resampler());
+    mic_pcm_.reset(new (std::nothrow) int16_t[2 * Resampler::CHUNK]);
+    if (!mic_resampler_ || !mic_pcm_ || !mic_resampler_->configure(mic_sample_rate_, SAMPLE_RATE)) {
+      ESP_LOGE(TAG, "Failed to allocate the microphone's resampler, it is taken as %u Hz", (unsigned)SAMPLE_RATE);
+      mic_resampler_.reset();
+      mic_sample_rate_ = SAMPLE_RATE;
+    }
   }
-  ESP_LOGI(TAG, "RTP listen on port 1234");
+  if (speaker_sample_rate_ != SAMPLE_RATE && !speaker_merge_ && !speaker_resampler_) {
+    speaker_resampler_.reset(new (std::nothrow) Resampler());
+    speaker_pcm_.reset(new (std::nothrow) int16_t[MIX_BLOCK_SAMPLES * speaker_sample_rate_ / SAMPLE_RATE]);
+    if (!speaker_resampler_ || !speaker_pcm_ || !speaker_resampler_->configure(SAMPLE_RATE, speaker_sample_rate_)) {
+      ESP_LOGE(TAG, "Failed to allocate the speaker's resampler, it plays %u Hz", (unsigned)SAMPLE_RATE);
+      speaker_resampler_.reset();
+      speaker_sample_rate_ = SAMPLE_RATE;
+    }
+  }
+  if (mic_resampler_)
+    media_bytes += sizeof(Resampler) + 2 * Resampler::CHUNK * sizeof(int16_t);
+  if (speaker_resampler_)
+    media_bytes += sizeof(Resampler) + MIX_BLOCK_SAMPLES * speaker_sample_rate_ / SAMPLE_RATE * sizeof(int16_t);
+  if (mic_split_)
+    media_bytes += (2 * Resampler::CHUNK + MAX_FRAME_SAMPLES) * sizeof(int16_t);
+  if (speaker_merge_)
+    media_bytes += (2 * MIX_BLOCK_SAMPLES + JitterBuffer::MAX_PAYLOAD) * sizeof(int16_t);
+  ESP_LOGI(TAG, "Media state for %u calls: %u bytes, RTP ports %u-%u", (unsigned)max_calls_, (unsigned)media_bytes,
+           (unsigned)rtp_port_, (unsigned)rtp_port_max_);
   ESP_LOGD(TAG, "VoIP finish_start_component: allocating Sip object");
   sip_ = new (std::nothrow) Sip();
   if (!sip_) {
@@ -979,7 +1159,20 @@ void Voip::finish_start_component() {
   ESP_LOGD(TAG, "VoIP finish_start_component: Sip allocated: %p", sip_);
   ESP_LOGI(TAG, "Initializing SIP subcomponent: server=%s port=%d user=%s", sip_ip_.c_str(), sip_port_, sip_user_.c_str());
   ESP_LOGD(TAG, "VoIP finish_start_component: initializing Sip subcomponent");
-  sip_->init(sip_ip_, sip_port_, "192.168.1.100", sip_port_, sip_user_, sip_pass_);
+  sip_->set_registration(register_, register_expires_s_);
+  sip_->set_max_calls(max_calls_);
+  sip_->set_rtp_ports(rtp_port_, rtp_port_max_);
+  sip_->set_incoming_call_callback([this](uint32_t call, const std::string &caller) {
+    this->notify_incoming_call(caller);
+    if (this->auto_answer_)
+      this->answer(call);
+  });
+  sip_->set_call_missed_callback(
+      [this](uint32_t /*call*/, const std::string &caller) { this->notify_call_missed(caller); });
+  // codecs and ptime for the SDP offer, needed to answer calls as soon as we are registered
+  this->update_sip_offer();
+  // the local address is looked up towards the server
+  sip_->init(sip_ip_, sip_port_, "", sip_port_, sip_user_, sip_pass_);
   ESP_LOGD(TAG, "VoIP finish_start_component: Sip initialized");
   ESP_LOGI(TAG, "Sip initialized: %p", sip_);
   if (microphone_) {
@@ -989,6 +1182,13 @@ void Voip::finish_start_component() {
     ESP_LOGW(TAG, "VoIP finish_start_component: microphone_ is null, continuing without mic callbacks");
   }
   ESP_LOGD(TAG, "VoIP finish_start_component: mic=%p, speaker=%p, sample_rate=%d, bits=%d", microphone_, speaker_, SAMPLE_RATE, SAMPLE_BITS);
+  if (use_media_task_) {
+    if (media_task_.start(media_task_config_, [this]() { this->media_tick(); })) {
+      ESP_LOGI(TAG, "Media task started on core %d, priority %d", media_task_config_.core, media_task_config_.priority);
+    } else {
+      ESP_LOGW(TAG, "Failed to start media task, falling back to loop() media processing");
+    }
+  }
   started_ = true;
   start_retries_ = 0;
   ESP_LOGI(TAG, "Voip finish_start_component: started_ set to true");
@@ -1011,12 +1211,46 @@ void Voip::stop_component() {
     microphone_->stop();
     ESP_LOGI(TAG, "VoIP stop_component: microphone stop invoked, is_stopped=%d", microphone_->is_stopped());
   }
-  if (this->rtp_udp_) {
+  // the media task uses the RTP sockets: stop it before they go away
+  media_task_.stop();
+  App.scheduler.cancel_interval(this, "rtp_tx");
+  tx_interval_ms_ = 0;
+  tx_stream_is_running_ = false;
+  for (size_t i = 0; legs_ && i < max_calls_; i++) {
+    MediaLeg &leg = legs_[i];
+    leg.pacer.stop();
+    leg.rx_active = false;
+    leg.tx_active = false;
+    leg.rtcp.stop();
     // no explicit close on socket::Socket in this component; releasing unique_ptr would close
-    this->rtp_udp_.reset();
+    leg.udp.reset();
+    leg.rtcp_udp.reset();
+    leg.call = 0;
+    leg.stopping = false;
+    leg.tx_started = false;
+    leg.media_version = 0;
+    leg.rx_pos = leg.rx_len = 0;
+    leg.tx_fill = 0;
+  }
+  focus_leg_ = -1;
+  media_focus_ = -1;
+  mix_next_us_ = 0;
+  // commands and events of the old legs must not reach the new ones after a restart; settings
+  // still in the queue are not about a leg and are kept
+  MediaCommand stale_cmd;
+  while (media_commands_.pop(stale_cmd)) {
+    this->apply_media_setting(stale_cmd);
+  }
+  MediaEvent stale_ev;
+  while (media_events_.pop(stale_ev)) {
+  }
+  MediaQuality stale_quality;
+  while (media_quality_.pop(stale_quality)) {
   }
   if (sip_) {
     sip_->hangup();
+    // best effort: the REGISTER with Expires: 0 goes out once, nobody waits for the answer
+    sip_->unregister();
     delete sip_;
     sip_ = nullptr;
   }
@@ -1059,97 +1293,794 @@ void Voip::notify_not_ready() {
   }
 }
 
+void Voip::notify_incoming_call(const std::string &caller) {
+  for (auto &cb : on_incoming_call_callbacks_) {
+    cb(caller);
+  }
+}
+
+void Voip::notify_call_missed(const std::string &caller) {
+  for (auto &cb : on_call_missed_callbacks_) {
+    cb(caller);
+  }
+}
+
 void Voip::handle_incoming_rtp() {
-  if (codec_type_ == 0) {
-    // PCMU
-    int16_t buffer[500];
+  // every open leg is drained, so a call off the speaker does not pile up stale audio in its socket
+  uint64_t now = MediaTask::now_us();
+  for (size_t i = 0; i < max_calls_; i++) {
+    if (!legs_[i].rx_active)
+      continue;
+    this->receive_rtp(legs_[i], conference_ || (int)i == media_focus_);
+    this->service_rtcp(legs_[i], now);
+  }
+  if (conference_) {
+    this->mix_conference();
+  } else if (media_focus_ >= 0 && legs_[media_focus_].rx_active) {
+    this->play_rtp_frames(legs_[media_focus_]);
+  }
+}
+
+void Voip::receive_rtp(MediaLeg &leg, bool focused) {
+  // Drain what the socket holds into the jitter buffer; the caller plays whatever frames are due
+  for (int i = 0; i < 8; i++) {
     struct sockaddr_in remote;
     socklen_t addrlen = sizeof(remote);
-    packet_size_ = this->rtp_udp_->recvfrom(rtp_buffer_, sizeof(rtp_buffer_), (struct sockaddr *)&remote, &addrlen);
-    if (packet_size_ < 0) {
+    int packet_size = leg.udp->recvfrom(rtp_buffer_, sizeof(rtp_buffer_), (struct sockaddr *)&remote, &addrlen);
+    if (packet_size < 0) {
       // Non-blocking sockets return -1 with errno==EAGAIN/EWOULDBLOCK when
       // there's no data available; ignore silently in that case.
-      if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
       static uint32_t last_rtp_recv_error_log = 0;
       uint32_t now = (uint32_t)esphome::millis();
       if ((int32_t)(now - last_rtp_recv_error_log) > 5000) {
         last_rtp_recv_error_log = now;
-        ESP_LOGW(TAG, "RTP recvfrom error=%d errno=%d (%s)", packet_size_, errno, strerror(errno));
+        ESP_LOGW(TAG, "RTP recvfrom error=%d errno=%d (%s)", packet_size, errno, strerror(errno));
       }
-      return;
+      break;
     }
-    if (packet_size_ == 0) return;
-    if (packet_size_ > (int)sizeof(rtp_buffer_)) {
-      ESP_LOGW(TAG, "RTP packet too large: %d, truncating to %u", packet_size_, (unsigned)sizeof(rtp_buffer_));
-      packet_size_ = sizeof(rtp_buffer_);
+    if (packet_size == 0) break;
+    if (packet_size > (int)sizeof(rtp_buffer_)) {
+      ESP_LOGW(TAG, "RTP packet too large: %d, truncating to %u", packet_size, (unsigned)sizeof(rtp_buffer_));
+      packet_size = sizeof(rtp_buffer_);
     }
-    if (packet_size_ > 0 && rx_stream_is_running_) {
-        if (!speaker_) {
-          ESP_LOGW(TAG, "Received RTP but speaker_ is null");
-          return;
-        }
-      uint8_t *payload = rtp_buffer_ + 12; // Skip RTP header
-      rtppkg_size_ = packet_size_ - 12;
-      if (rtppkg_size_ > 500) rtppkg_size_ = 500; // clamp to buffer size
-      for (int i = 0; i < rtppkg_size_; i++) {
-        buffer[i] = ulaw2linear(payload[i]) * amp_gain_;
-      }
-      ESP_LOGD(TAG, "handle_incoming_rtp: speaker->play called for incoming RTP (PCMU), bytes=%u", (unsigned)(sizeof(int16_t) * rtppkg_size_));
-      speaker_->play((const uint8_t *)buffer, sizeof(int16_t) * rtppkg_size_);
+    RtpHeader hdr;
+    if (!parse_rtp_header(rtp_buffer_, packet_size, &hdr)) {
+      ESP_LOGV(TAG, "receive_rtp: dropping malformed RTP packet, size=%d", packet_size);
+      continue;
+    }
+    bool sid = leg.cn_payload_type != 0 && hdr.payload_type == leg.cn_payload_type;
+    if (hdr.payload_type != leg.payload_type && !sid) {
+      // telephone-event, comfort noise we did not negotiate or a codec we did not negotiate either
+      ESP_LOGV(TAG, "receive_rtp: ignoring payload type %u", (unsigned)hdr.payload_type);
+      continue;
+    }
+    uint8_t cn_level;
+    if (sid && !parse_cn_payload(rtp_buffer_ + hdr.payload_offset, hdr.payload_size, &cn_level)) {
+      ESP_LOGV(TAG, "receive_rtp: dropping malformed comfort noise payload");
+      continue;
+    }
+    // calls off the speaker are measured too, so their reports stay meaningful
+    leg.rtcp.on_rtp_received(hdr.ssrc, hdr.sequence, hdr.timestamp, MediaTask::now_us());
+    if (!focused) continue;
+    if (!leg.rx_ssrc_valid || hdr.ssrc != leg.rx_ssrc) {
+      // new stream (first packet or far end restarted): start over with an empty buffer
+      MediaEvent ev{MediaEvent::RX_NEW_SSRC, (uint8_t)(&leg - legs_.get()), hdr.ssrc};
+      media_events_.push(ev);
+      leg.jitter.reset();
+      leg.adpcm.reset_decoder();
+      leg.g722.reset_decoder();
+      leg.cn_active = false;
+      leg.rx_ssrc = hdr.ssrc;
+      leg.rx_ssrc_valid = true;
+    }
+    // a SID takes its slot in the stream as an empty frame; its level is all there is to keep
+    if (sid)
+      leg.cn_level = cn_level;
+    JitterBuffer::PushResult res = leg.jitter.push(hdr.sequence, hdr.timestamp, rtp_buffer_ + hdr.payload_offset,
+                                                   sid ? 0 : hdr.payload_size, (uint32_t)esphome::millis());
+    if (res == JitterBuffer::PUSH_TOO_LARGE) {
+      ESP_LOGW(TAG, "RTP payload too large for jitter buffer: %u", (unsigned)hdr.payload_size);
     }
-  } else if (codec_type_ == 1) {
-    // PCMA
-    int16_t buffer[500];
+  }
+}
+
+void Voip::service_rtcp(MediaLeg &leg, uint64_t now_us) {
+  if (!leg.rtcp_udp || !leg.rtcp.is_active()) return;
+  for (int i = 0; i < 4; i++) {
     struct sockaddr_in remote;
     socklen_t addrlen = sizeof(remote);
-    packet_size_ = this->rtp_udp_->recvfrom(rtp_buffer_, sizeof(rtp_buffer_), (struct sockaddr *)&remote, &addrlen);
-    if (packet_size_ < 0) {
-      if (errno == EAGAIN || errno == EWOULDBLOCK) return;
-      static uint32_t last_rtp_recv_error_log2 = 0;
-      uint32_t now2 = (uint32_t)esphome::millis();
-      if ((int32_t)(now2 - last_rtp_recv_error_log2) > 5000) {
-        last_rtp_recv_error_log2 = now2;
-        ESP_LOGW(TAG, "RTP recvfrom error=%d errno=%d (%s)", packet_size_, errno, strerror(errno));
-      }
-      return;
+    int len = leg.rtcp_udp->recvfrom(rtp_buffer_, sizeof(rtp_buffer_), (struct sockaddr *)&remote, &addrlen);
+    if (len <= 0) break;
+    if (!leg.rtcp.parse(rtp_buffer_, len > (int)sizeof(rtp_buffer_) ? sizeof(rtp_buffer_) : len, now_us)) {
+      ESP_LOGV(TAG, "service_rtcp: dropping malformed RTCP packet, size=%d", len);
+    }
+  }
+  if (!leg.rtcp.report_due(now_us)) return;
+  // the report is built even before the far end's address is known, to keep the interval going
+  uint8_t report[RTCP_MAX_PACKET];
+  size_t len = leg.rtcp.build_report(now_us, report, sizeof(report));
+  if (len != 0 && leg.rtcp_remote.sin_port != 0) {
+    leg.rtcp_udp->sendto(report, len, 0, (struct sockaddr *)&leg.rtcp_remote, sizeof(leg.rtcp_remote));
+  }
+  MediaQuality mq{(uint8_t)(&leg - legs_.get()), this->measure_quality(leg)};
+  media_quality_.push(mq);
+}
+
+CallQuality Voip::measure_quality(const MediaLeg &leg) const {
+  CallQuality q;
+  q.loss_percent = leg.rtcp.get_interval_loss() * 100.0f;
+  q.remote_loss_percent = leg.rtcp.has_remote_report() ? leg.rtcp.get_remote_loss() * 100.0f : NAN;
+  q.jitter_ms = leg.rtcp.get_jitter_us() / 1000.0f;
+  q.rtt_ms = leg.rtcp.has_rtt() ? leg.rtcp.get_rtt_us() / 1000.0f : NAN;
+  // mouth to ear: half the round trip, the jitter buffer and one frame of packetization
+  float delay_ms = (leg.rtcp.has_rtt() ? q.rtt_ms / 2 : 0.0f) + leg.jitter.get_target_delay_ms() +
+                   leg.frame_samples * 1000.0f / SAMPLE_RATE;
+  q.r_factor = emodel_r_factor(delay_ms, q.loss_percent, codec_impairment(leg.codec),
+                              codec_loss_robustness(leg.codec));
+  q.mos = emodel_mos(q.r_factor);
+  q.erle_db = aec_enabled_ ? aec_.get_erle_db() : NAN;
+  q.mic_gain_db = mic_agc_enabled_ ? mic_agc_.get_gain_db() : NAN;
+  q.mic_peak_dbfs = mic_agc_enabled_ ? mic_agc_.get_peak_dbfs() : NAN;
+  q.speaker_gain_db = speaker_limiter_enabled_ ? speaker_limiter_.get_gain_db() : NAN;
+  q.speaker_peak_dbfs = speaker_limiter_enabled_ ? speaker_limiter_.get_peak_dbfs() : NAN;
+  return q;
+}
+
+void Voip::publish_quality(const CallQuality &quality) {
+#ifndef USE_SENSOR
+  (void) quality;
+#else
+  if (packet_loss_sensor_) packet_loss_sensor_->publish_state(quality.loss_percent);
+  if (remote_packet_loss_sensor_) remote_packet_loss_sensor_->publish_state(quality.remote_loss_percent);
+  if (jitter_sensor_) jitter_sensor_->publish_state(quality.jitter_ms);
+  if (round_trip_time_sensor_) round_trip_time_sensor_->publish_state(quality.rtt_ms);
+  if (r_factor_sensor_) r_factor_sensor_->publish_state(quality.r_factor);
+  if (mos_sensor_) mos_sensor_->publish_state(quality.mos);
+  if (echo_return_loss_enhancement_sensor_) echo_return_loss_enhancement_sensor_->publish_state(quality.erle_db);
+  if (microphone_gain_sensor_) microphone_gain_sensor_->publish_state(quality.mic_gain_db);
+  if (microphone_peak_sensor_) microphone_peak_sensor_->publish_state(quality.mic_peak_dbfs);
+  if (speaker_gain_sensor_) speaker_gain_sensor_->publish_state(quality.speaker_gain_db);
+  if (speaker_peak_sensor_) speaker_peak_sensor_->publish_state(quality.speaker_peak_dbfs);
+#endif
+}
+
+// The G.722 upper band goes around the 8 kHz processing of the lower band. These keep the two in
+// step: the upper band waits as long as the processing delays the lower band, and takes on the
+// change of level the processing made, which also carries the echo canceller's and the noise
+// suppressor's attenuation over to it.
+static_assert(PacketLossConcealer::DELAY <= NoiseSuppressor::DELAY, "delay_band() holds the longer delay line");
+
+static void delay_band(int16_t *pcm, size_t n, int16_t *line, size_t len) {
+  int16_t held[NoiseSuppressor::DELAY];
+  if (n >= len) {
+    memcpy(held, pcm + n - len, sizeof(int16_t) * len);
+    memmove(pcm + len, pcm, sizeof(int16_t) * (n - len));
+    memcpy(pcm, line, sizeof(int16_t) * len);
+    memcpy(line, held, sizeof(int16_t) * len);
+  } else {
+    memcpy(held, pcm, sizeof(int16_t) * n);
+    memcpy(pcm, line, sizeof(int16_t) * n);
+    memmove(line, line + n, sizeof(int16_t) * (len - n));
+    memcpy(line + len - n, held, sizeof(int16_t) * n);
+  }
+}
+
+static int64_t band_energy(const int16_t *pcm, size_t n) {
+  int64_t sum = 0;
+  for (size_t i = 0; i < n; i++)
+    sum += (int32_t)pcm[i] * pcm[i];
+  return sum;
+}
+
+static void follow_gain(int16_t *high, size_t n, int64_t before, int64_t after) {
+  // below one LSB RMS there is no level to follow
+  if (before <= (int64_t)n)
+    return;
+  float gain = sqrtf((float)after / (float)before);
+  // no more than 18 dB up, what the AGC gives at most
+  gain = gain > 8.0f ? 8.0f : gain;
+  g711::scale_q15(high, high, n, 0, g711::q15_gain((int32_t)(gain * 4096.0f), 4096));
+}
+
+void Voip::play_rtp_frames(MediaLeg &leg) {
+  int16_t buffer[JitterBuffer::MAX_PAYLOAD];
+  size_t samples;
+  while ((samples = this->pop_rx_frame(leg, buffer, true)) != 0) {
+    if (!speaker_) {
+      ESP_LOGW(TAG, "Received RTP but speaker_ is null");
+      continue;
     }
-    if (packet_size_ == 0) return;
-    if (packet_size_ > (int)sizeof(rtp_buffer_)) {
-      ESP_LOGW(TAG, "RTP packet too large: %d, truncating to %u", packet_size_, (unsigned)sizeof(rtp_buffer_));
-      packet_size_ = sizeof(rtp_buffer_);
+    ESP_LOGV(TAG, "play_rtp_frames: speaker->play bytes=%u", (unsigned)(sizeof(int16_t) * samples));
+    if (speaker_limiter_enabled_) {
+      int64_t before = speaker_merge_ ? band_energy(buffer, samples) : 0;
+      speaker_limiter_.process(buffer, samples);
+      if (speaker_merge_)
+        follow_gain(rx_high_.get(), samples, before, band_energy(buffer, samples));
     }
-    if (packet_size_ > 0 && rx_stream_is_running_) {
-      uint8_t *payload = rtp_buffer_ + 12;
-      rtppkg_size_ = packet_size_ - 12;
-      if (rtppkg_size_ > 500) rtppkg_size_ = 500; // clamp to buffer size
-      for (int i = 0; i < rtppkg_size_; i++) {
-        buffer[i] = alaw2linear(payload[i]) * amp_gain_;
+    if (aec_enabled_)
+      aec_.playback(buffer, samples);
+    this->play_speaker(buffer, speaker_merge_ ? rx_high_.get() : nullptr, samples);
+  }
+}
+
+size_t Voip::pop_rx_frame(MediaLeg &leg, int16_t *pcm, bool speaker) {
+  uint8_t payload[JitterBuffer::MAX_PAYLOAD];
+  size_t len = 0;
+  uint32_t now = (uint32_t)esphome::millis();
+  uint32_t frame_ms = leg.jitter.get_frame_ms();
+  size_t samples = frame_ms * SAMPLE_RATE / 1000;
+  if (samples > JitterBuffer::MAX_PAYLOAD) samples = JitterBuffer::MAX_PAYLOAD;
+  JitterBuffer::PopResult res = leg.jitter.pop(now, payload, sizeof(payload), &len);
+  if (res == JitterBuffer::POP_NONE) {
+    // between SIDs the jitter buffer runs dry and stops; the comfort noise goes on regardless
+    if (!leg.cn_active || (int32_t)(now - leg.cn_next_ms) < 0)
+      return 0;
+    // after a stall, go on from now rather than catch up
+    if (now - leg.cn_next_ms > 5 * frame_ms)
+      leg.cn_next_ms = now;
+    leg.cn_next_ms += frame_ms;
+  } else {
+    leg.cn_next_ms = now + frame_ms;
+  }
+
+  // the G.722 upper band of what goes to the speaker: silence unless decoded below
+  int16_t *high = speaker && speaker_merge_ ? rx_high_.get() : nullptr;
+  if (high != nullptr)
+    memset(high, 0, sizeof(int16_t) * JitterBuffer::MAX_PAYLOAD);
+  if (res == JitterBuffer::POP_FRAME && len != 0) {
+    leg.cn_active = false;
+    if (codec_is_adpcm(leg.codec)) {
+      samples = leg.adpcm.decode(payload, len, pcm, JitterBuffer::MAX_PAYLOAD);
+      if (speaker)
+        g711::scale_q15(pcm, pcm, samples, 0, speaker_gain_);
+    } else if (leg.codec == CODEC_G722) {
+      samples = leg.g722.decode(payload, len, pcm, high, JitterBuffer::MAX_PAYLOAD);
+      if (speaker)
+        g711::scale_q15(pcm, pcm, samples, 0, speaker_gain_);
+      if (high != nullptr)
+        g711::scale_q15(high, high, samples, 0, speaker_gain_);
+    } else {
+      samples = len;
+      if (speaker) {
+        (leg.codec == CODEC_PCMU ? rx_ulaw_ : rx_alaw_).decode(payload, pcm, len);
+      } else {
+        (leg.codec == CODEC_PCMU ? g711::decode_ulaw : g711::decode_alaw)(payload, pcm, len);
       }
-      ESP_LOGD(TAG, "handle_incoming_rtp: speaker->play called for incoming RTP (PCMA), bytes=%u", (unsigned)(sizeof(int16_t) * rtppkg_size_));
-      speaker_->play((const uint8_t *)buffer, sizeof(int16_t) * rtppkg_size_);
     }
+    leg.plc.receive(pcm, samples);
+    if (high != nullptr)
+      delay_band(high, samples, rx_high_delay_, PacketLossConcealer::DELAY);
+    return samples;
+  }
+  if (res == JitterBuffer::POP_FRAME) {
+    // a SID: the far end is silent from here on, at this noise level
+    leg.cn_active = true;
+    leg.cn.set_level(leg.cn_level);
+  }
+  if (!leg.cn_active) {
+    // missing frame: continue the last pitch period rather than leave a gap the speaker clicks on
+    leg.plc.conceal(pcm, samples);
+    if (high != nullptr)
+      delay_band(high, samples, rx_high_delay_, PacketLossConcealer::DELAY);
+    return samples;
   }
+  // the far end's silence, or a frame lost in it; through the concealer's delay line like audio,
+  // so the next talkspurt follows without a seam
+  leg.cn.generate(pcm, samples);
+  if (speaker)
+    g711::scale_q15(pcm, pcm, samples, 0, speaker_gain_);
+  leg.plc.receive(pcm, samples);
+  if (high != nullptr)
+    delay_band(high, samples, rx_high_delay_, PacketLossConcealer::DELAY);
+  return samples;
 }
 
-void Voip::handle_outgoing_rtp() {
-  if (sip_ && !sip_->audioport.empty() && !tx_stream_is_running_) {
+void Voip::mix_conference() {
+  bool any = false;
+  for (size_t i = 0; i < max_calls_; i++)
+    any = any || legs_[i].rx_active;
+  if (!any) {
+    mix_next_us_ = 0;
+    return;
+  }
+  uint64_t now = MediaTask::now_us();
+  // blocks missed in a stall longer than 50 ms are not made up, like the pacer's skipped frames
+  if (mix_next_us_ == 0 || (now > mix_next_us_ && now - mix_next_us_ > 5 * MIX_BLOCK_US))
+    mix_next_us_ = now;
+  while (now >= mix_next_us_) {
+    this->mix_block(now);
+    mix_next_us_ += MIX_BLOCK_US;
+  }
+}
+
+void Voip::mix_block(uint64_t now_us) {
+  const size_t n = MIX_BLOCK_SAMPLES;
+  int bytes_per_sample = this->read_mic(n);
+  if (bytes_per_sample == 4) {
+    g711::scale_q15(tx_frame_, mixer_.input(0), n, SAMPLE_BITS - 16, tx_gain_);
+  } else if (bytes_per_sample == 2) {
+    g711::scale_q15((const int16_t *)tx_frame_, mixer_.input(0), n, 0, tx_gain_);
+  }
+  if (bytes_per_sample != 0 && aec_enabled_)
+    this->cancel_echo(mixer_.input(0), n);
+  if (bytes_per_sample != 0 && ns_enabled_)
+    ns_.process(mixer_.input(0), n);
+  if (bytes_per_sample != 0 && mic_agc_enabled_)
+    mic_agc_.process(mixer_.input(0), n);
+  mixer_.set_active(0, bytes_per_sample != 0);
+  // the microphone delivers in bursts; more than 40 ms queued up is latency nobody wants in a call.
+  // Split by the G.722 QMF, a sample takes four bytes in the ring; the upper band is not mixed.
+  size_t ring_bytes = mic_split_ && bytes_per_sample != 0 ? 4 : bytes_per_sample;
+  if (bytes_per_sample != 0 && mic_ring_.available() > 4 * n * ring_bytes) {
+    mic_ring_.discard(mic_ring_.available() - 2 * n * ring_bytes);
+    aec_.realign();
+  }
+  for (size_t i = 0; i < max_calls_; i++) {
+    if (legs_[i].rx_active)
+      mixer_.set_active(i + 1, this->read_leg_block(legs_[i], mixer_.input(i + 1), n));
+  }
+  mixer_.mix();
+  if (speaker_) {
+    g711::scale_q15(mixer_.output(0), mix_speaker_, n, 0, speaker_gain_);
+    if (speaker_limiter_enabled_)
+      speaker_limiter_.process(mix_speaker_, n);
+    if (aec_enabled_)
+      aec_.playback(mix_speaker_, n);
+    this->play_speaker(mix_speaker_, nullptr, n);
+  }
+  for (size_t i = 0; i < max_calls_; i++) {
+    if (legs_[i].tx_active)
+      this->send_leg_block(legs_[i], mixer_.output(i + 1), n, now_us);
+  }
+}
+
+bool Voip::read_leg_block(MediaLeg &leg, int16_t *out, size_t n) {
+  size_t filled = 0;
+  while (filled < n) {
+    if (leg.rx_pos == leg.rx_len) {
+      size_t samples = this->pop_rx_frame(leg, leg.rx_pcm.get(), false);
+      leg.rx_pos = 0;
+      leg.rx_len = (uint16_t)samples;
+      if (samples == 0)
+        break;
+    }
+    size_t take = std::min(n - filled, (size_t)(leg.rx_len - leg.rx_pos));
+    memcpy(out + filled, leg.rx_pcm.get() + leg.rx_pos, sizeof(int16_t) * take);
+    leg.rx_pos += take;
+    filled += take;
+  }
+  if (filled == 0)
+    return false;
+  // the rest of the block is played once the next frame is due
+  memset(out + filled, 0, sizeof(int16_t) * (n - filled));
+  return true;
+}
+
+void Voip::send_leg_block(MediaLeg &leg, const int16_t *pcm, size_t n, uint64_t now_us) {
+  while (n > 0) {
+    size_t take = std::min(n, (size_t)(leg.frame_samples - leg.tx_fill));
+    memcpy(leg.tx_pcm.get() + leg.tx_fill, pcm, sizeof(int16_t) * take);
+    leg.tx_fill += take;
+    pcm += take;
+    n -= take;
+    if (leg.tx_fill < leg.frame_samples)
+      break;
+    leg.tx_fill = 0;
+    bool marker = false;
+    if (this->send_silence(leg, leg.tx_pcm.get(), leg.frame_samples, now_us, &marker))
+      continue;
+    uint8_t *payload = tx_packet_ + RTP_HEADER_SIZE;
+    size_t payload_len = leg.frame_samples;
+    if (codec_is_adpcm(leg.codec)) {
+      payload_len = leg.adpcm.encode(leg.tx_pcm.get(), leg.frame_samples, payload);
+    } else if (leg.codec == CODEC_G722) {
+      payload_len = leg.g722.encode(leg.tx_pcm.get(), nullptr, leg.frame_samples, payload);
+    } else if (leg.codec == CODEC_PCMU) {
+      g711::encode_ulaw(leg.tx_pcm.get(), payload, leg.frame_samples);
+    } else {
+      g711::encode_alaw(leg.tx_pcm.get(), payload, leg.frame_samples);
+    }
+    this->send_rtp_packet(leg, leg.payload_type, marker, payload_len, now_us);
+  }
+}
+
+// whether the call's RTP port should be open: established calls, and our own calls before the
+// answer for early media
+static bool call_has_media(const SipDialog &call) {
+  return call.state == SIP_DIALOG_CONFIRMED || (call.outgoing && call.state == SIP_DIALOG_CALLING);
+}
+
+void Voip::sync_media_legs() {
+  if (!legs_) return;
+  const SipDialogTable &calls = sip_->get_calls();
+  for (size_t i = 0; i < max_calls_; i++) {
+    MediaLeg &leg = legs_[i];
+    if (leg.call == 0 || leg.stopping) continue;
+    const SipDialog *call = calls.find(leg.call);
+    if (call == nullptr || !call_has_media(*call)) this->stop_leg((int)i);
+  }
+  for (size_t i = 0; i < calls.capacity(); i++) {
+    const SipDialog *call = calls.at(i);
+    if (call == nullptr || !call_has_media(*call)) continue;
+    int leg = -1;
+    for (size_t j = 0; j < max_calls_; j++) {
+      if (legs_[j].call == call->id) leg = (int)j;
+    }
+    if (leg >= 0 && legs_[leg].stopping) continue;  // reopened once the old socket is closed
+    if (leg < 0 && (leg = this->open_leg(*call)) < 0) continue;
+    if (call->media_version != legs_[leg].media_version) this->start_leg_tx(leg, *call);
+  }
+}
+
+int Voip::open_leg(const SipDialog &call) {
+  int index = -1;
+  for (size_t i = 0; i < max_calls_ && index < 0; i++) {
+    if (legs_[i].call == 0) index = (int)i;
+  }
+  if (index < 0) return -1;  // the leg of an ended call is still being released
+  MediaLeg &leg = legs_[index];
+  leg.udp = socket::socket(AF_INET, SOCK_DGRAM, 0);
+  if (leg.udp == nullptr) {
+    ESP_LOGE(TAG, "Call %u: failed to create RTP UDP socket", (unsigned)call.id);
+    sip_->hangup(call.id);
+    return -1;
+  }
+  leg.udp->setblocking(false);
+  struct sockaddr_in rtp_addr = {};
+  rtp_addr.sin_family = AF_INET;
+  rtp_addr.sin_port = htons(call.rtp_port);
+  rtp_addr.sin_addr.s_addr = INADDR_ANY;
+  if (leg.udp->bind((struct sockaddr *)&rtp_addr, sizeof(rtp_addr)) != 0) {
+    ESP_LOGE(TAG, "Call %u: failed to bind RTP UDP socket to port %u", (unsigned)call.id, (unsigned)call.rtp_port);
+    leg.udp.reset();
+    sip_->hangup(call.id);
+    return -1;
+  }
+  leg.rtcp_udp = socket::socket(AF_INET, SOCK_DGRAM, 0);
+  if (leg.rtcp_udp != nullptr) {
+    leg.rtcp_udp->setblocking(false);
+    rtp_addr.sin_port = htons(call.rtp_port + 1);
+    if (leg.rtcp_udp->bind((struct sockaddr *)&rtp_addr, sizeof(rtp_addr)) != 0)
+      leg.rtcp_udp.reset();
+  }
+  if (leg.rtcp_udp == nullptr)
+    ESP_LOGW(TAG, "Call %u: no RTCP socket on port %u, no call quality reports", (unsigned)call.id,
+             (unsigned)(call.rtp_port + 1));
+  ESP_LOGI(TAG, "Call %u: RTP listen on port %u", (unsigned)call.id, (unsigned)call.rtp_port);
+  leg.call = call.id;
+  // one SSRC for the call, also across renegotiations (RFC 3550 section 8)
+  leg.ssrc = esp_random();
+  leg.port = call.rtp_port;
+  leg.media_version = 0;
+  leg.tx_started = false;
+  leg.stopping = false;
+  MediaCommand cmd{};
+  cmd.type = MediaCommand::RX_START;
+  cmd.leg = (uint8_t)index;
+  // until the answer says otherwise, expect the codec we prefer
+  cmd.codec = call.media_valid ? call.media.codec : codec_type_;
+  cmd.payload_type = call.media_valid ? call.media.payload_type : payload_type_;
+  cmd.cn_payload_type = call.media_valid ? call.media.cn_payload_type : 0;
+  cmd.ssrc = leg.ssrc;
+  cmd.jitter_min_ms = jitter_min_delay_ms_;
+  cmd.jitter_max_ms = jitter_max_delay_ms_;
+  this->post_media_command(cmd);
+  // the newest call goes on the speaker and microphone
+  this->set_focus(index);
+  return index;
+}
+
+void Voip::start_leg_tx(int index, const SipDialog &call) {
+  MediaLeg &leg = legs_[index];
+  bool send = call.media_valid && call.media.send;
+  if (leg.tx_started) {
+    ESP_LOGI(TAG, "Call %u: media renegotiated, restarting RTP stream", (unsigned)call.id);
+  } else {
+    ESP_LOGI(TAG, "Call %u: starting RTP stream", (unsigned)call.id);
+  }
+  leg.tx_started = true;
+  leg.media_version = call.media_version;
+  // the destination was resolved by Sip when the answer arrived
+  MediaCommand cmd{};
+  cmd.type = MediaCommand::TX_START;
+  cmd.leg = (uint8_t)index;
+  cmd.remote.sin_family = AF_INET;
+  cmd.remote.sin_port = htons(call.media.port);
+  cmd.remote.sin_addr.s_addr = htonl(call.media.address);
+  cmd.codec = call.media.codec;
+  cmd.payload_type = call.media.payload_type;
+  cmd.cn_payload_type = call.media.cn_payload_type;
+  cmd.ptime = call.media.ptime;
+  cmd.rtcp_port = call.media.rtcp_port;
+  cmd.send = send;
+  cmd.seq = (uint16_t)esp_random();
+  cmd.timestamp = esp_random();
+  cmd.ssrc = leg.ssrc;
+  this->post_media_command(cmd);
+  if (!tx_stream_is_running_) {
     tx_stream_is_running_ = true;
-    ESP_LOGI(TAG, "Starting RTP stream");
     if (microphone_) {
-      ESP_LOGD(TAG, "handle_outgoing_rtp: attempting to start microphone, is_stopped=%d", microphone_->is_stopped());
+      ESP_LOGD(TAG, "start_leg_tx: attempting to start microphone, is_stopped=%d", microphone_->is_stopped());
       if (microphone_->is_stopped()) {
         microphone_->start();
-        ESP_LOGI(TAG, "handle_outgoing_rtp: microphone started for RTP TX");
+        ESP_LOGI(TAG, "start_leg_tx: microphone started for RTP TX");
       }
     }
-    App.scheduler.set_interval(this, "rtp_tx", 20, [this]() { tx_rtp(); });
-  } else if ((sip_ && sip_->audioport.empty()) && tx_stream_is_running_) {
-    tx_stream_is_running_ = false;
-    rx_stream_is_running_ = false;
-    rtppkg_size_ = -1;
-    ESP_LOGI(TAG, "RTP stream stopped");
-    if (microphone_) microphone_->stop();
-    App.scheduler.cancel_interval(this, "rtp_tx");
+  }
+  if (send && !conference_ && !media_task_.is_running()) {
+    // poll at half the shortest frame time of all calls; the pacers decide how many frames are
+    // actually due
+    uint32_t interval = call.media.ptime / 2;
+    if (tx_interval_ms_ == 0 || interval < tx_interval_ms_) {
+      tx_interval_ms_ = interval;
+      App.scheduler.set_interval(this, "rtp_tx", interval, [this]() { tx_rtp(); });
+    }
+  }
+}
+
+void Voip::stop_leg(int index) {
+  MediaLeg &leg = legs_[index];
+  MediaCommand cmd{};
+  cmd.type = MediaCommand::STOP;
+  cmd.leg = (uint8_t)index;
+  this->post_media_command(cmd);
+  leg.stopping = true;
+  ESP_LOGD(TAG, "Call %u: stopping media", (unsigned)leg.call);
+  if (index == focus_leg_) {
+    // the media context drops the focus with the STOP; hand it to the newest call left
+    focus_leg_ = -1;
+    int newest = -1;
+    for (size_t i = 0; i < max_calls_; i++) {
+      if (legs_[i].call != 0 && !legs_[i].stopping && (newest < 0 || legs_[i].call > legs_[newest].call))
+        newest = (int)i;
+    }
+    this->set_focus(newest);
+  }
+  if (!leg.tx_started) return;
+  leg.tx_started = false;
+  for (size_t i = 0; i < max_calls_; i++) {
+    if (legs_[i].tx_started) return;
+  }
+  tx_stream_is_running_ = false;
+  ESP_LOGI(TAG, "RTP stream stopped (mic ring overruns=%u dropped=%u bytes, underruns=%u)",
+           (unsigned)mic_ring_.get_overruns(), (unsigned)mic_ring_.get_overrun_items(),
+           (unsigned)mic_ring_.get_underruns());
+  if (microphone_) microphone_->stop();
+  App.scheduler.cancel_interval(this, "rtp_tx");
+  tx_interval_ms_ = 0;
+}
+
+void Voip::set_focus(int index) {
+  if (index == focus_leg_) return;
+  focus_leg_ = index;
+  // in a conference every call has the speaker and microphone
+  if (index < 0 || conference_) return;
+  ESP_LOGI(TAG, "Call %u on the speaker and microphone", (unsigned)legs_[index].call);
+  MediaCommand cmd{};
+  cmd.type = MediaCommand::FOCUS;
+  cmd.leg = (uint8_t)index;
+  this->post_media_command(cmd);
+}
+
+void Voip::post_media_command(const MediaCommand &cmd) {
+  if (media_task_.is_running()) {
+    if (!media_commands_.push(cmd)) {
+      ESP_LOGW(TAG, "Media command queue full, dropping command %d", (int)cmd.type);
+    }
+  } else {
+    this->apply_media_command(cmd);
+  }
+}
+
+void Voip::select_media_codec(MediaLeg &leg, int codec, uint8_t payload_type) {
+  if (codec != leg.codec) {
+    // frames of the old codec must not reach the new decoder
+    leg.jitter.reset();
+    leg.rx_ssrc_valid = false;
+  }
+  leg.codec = codec;
+  leg.payload_type = payload_type;
+  if (codec_is_adpcm(codec)) {
+    leg.adpcm.set_bits(codec_adpcm_bits(codec));
+  }
+}
+
+void Voip::apply_amp_gain(int gain) {
+  // with the limiter, decoders and mixer stay at unity and the limiter applies amp_gain
+  int32_t fixed = speaker_limiter_enabled_ ? 1 : gain;
+  rx_alaw_.configure(g711::GainDecoder::ALAW, fixed);
+  rx_ulaw_.configure(g711::GainDecoder::ULAW, fixed);
+  speaker_gain_ = g711::q15_gain(fixed, 1);
+  speaker_limiter_.set_fixed_gain(gain);
+  speaker_limiter_.reset();
+}
+
+bool Voip::apply_media_setting(const MediaCommand &cmd) {
+  switch (cmd.type) {
+    case MediaCommand::MIC_GAIN:
+      // MIC_CONVERT divides 16-bit-equivalent samples by 8 before the gain
+      tx_gain_ = g711::q15_gain(cmd.gain, 8);
+      return true;
+    case MediaCommand::AMP_GAIN:
+      this->apply_amp_gain(cmd.gain);
+      return true;
+    case MediaCommand::MIC_AGC:
+      mic_agc_.set_envelope(cmd.attack_ms, cmd.release_ms);
+      mic_agc_.set_limiter(cmd.limit_dbfs);
+      mic_agc_.set_agc(cmd.target_dbfs, cmd.max_gain_db, cmd.gate_dbfs);
+      mic_agc_enabled_ = true;
+      return true;
+    case MediaCommand::SPEAKER_LIMITER:
+      speaker_limiter_.set_envelope(0, cmd.release_ms);
+      speaker_limiter_.set_limiter(cmd.limit_dbfs);
+      speaker_limiter_enabled_ = true;
+      this->apply_amp_gain(cmd.gain);
+      return true;
+    default:
+      return false;
+  }
+}
+
+void Voip::apply_media_command(const MediaCommand &cmd) {
+  if (this->apply_media_setting(cmd)) return;
+  if (cmd.leg >= max_calls_) return;
+  MediaLeg &leg = legs_[cmd.leg];
+  uint64_t now = MediaTask::now_us();
+  switch (cmd.type) {
+    case MediaCommand::RX_START:
+      this->select_media_codec(leg, cmd.codec, cmd.payload_type);
+      leg.cn_payload_type = cmd.cn_payload_type;
+      leg.adpcm.reset_decoder();
+      leg.g722.reset_decoder();
+      // empty, with the delays configured when the call started
+      leg.jitter.configure(cmd.jitter_min_ms, cmd.jitter_max_ms, SAMPLE_RATE);
+      leg.plc.reset();
+      leg.cn_active = false;
+      leg.rx_ssrc_valid = false;
+      leg.rx_pos = leg.rx_len = 0;
+      leg.rtcp.start(now, cmd.ssrc, rtcp_cname_);
+      leg.rtcp_remote = {};
+      leg.rx_active = true;
+      break;
+    case MediaCommand::TX_START:
+      leg.remote = cmd.remote;
+      leg.rtcp_remote = cmd.remote;
+      leg.rtcp_remote.sin_port = htons(cmd.rtcp_port);
+      if (cmd.codec != leg.codec) {
+        leg.adpcm.reset_decoder();
+        leg.g722.reset_decoder();
+      }
+      this->select_media_codec(leg, cmd.codec, cmd.payload_type);
+      leg.cn_payload_type = cmd.cn_payload_type;
+      leg.frame_samples = (uint32_t)cmd.ptime * SAMPLE_RATE / 1000;
+      leg.vad.reset();
+      leg.dtx.reset();
+      // fresh random sequence number and timestamp for every stream (RFC 3550 section 5.1)
+      leg.pacer.stop();
+      if (cmd.send) {
+        leg.pacer.start(now, cmd.seq, cmd.timestamp, cmd.ssrc, (uint32_t)cmd.ptime * 1000, leg.frame_samples);
+        if (conference_) {
+          // mixed audio of the old stream must not end up in the new one
+          leg.tx_fill = 0;
+        } else if (cmd.leg == media_focus_) {
+          // start the call with fresh audio instead of whatever piled up before
+          mic_ring_.discard(mic_ring_.capacity());
+          aec_.realign();
+        } else {
+          // held until the call gets the microphone
+          leg.pacer.pause(now);
+        }
+      }
+      leg.adpcm.reset_encoder();
+      leg.g722.reset_encoder();
+      leg.tx_active = cmd.send;
+      leg.rx_active = true;
+      break;
+    case MediaCommand::STOP: {
+      if (leg.tx_active) {
+        MediaEvent ev{MediaEvent::TX_STOPPED, cmd.leg, leg.pacer.get_sent()};
+        media_events_.push(ev);
+      }
+      if (leg.rtcp.is_active() && leg.rtcp_udp && leg.rtcp_remote.sin_port != 0) {
+        uint8_t bye[RTCP_MAX_PACKET];
+        size_t len = leg.rtcp.build_bye(now, bye, sizeof(bye));
+        if (len != 0)
+          leg.rtcp_udp->sendto(bye, len, 0, (struct sockaddr *)&leg.rtcp_remote, sizeof(leg.rtcp_remote));
+      }
+      leg.rtcp.stop();
+      leg.pacer.stop();
+      leg.tx_active = false;
+      leg.rx_active = false;
+      leg.jitter.reset();
+      leg.cn_active = false;
+      leg.rx_ssrc_valid = false;
+      leg.rx_pos = leg.rx_len = 0;
+      leg.tx_fill = 0;
+      if (cmd.leg == media_focus_)
+        media_focus_ = -1;
+      // the socket is not touched here anymore
+      MediaEvent stopped{MediaEvent::LEG_STOPPED, cmd.leg, 0};
+      media_events_.push(stopped);
+      break;
+    }
+    case MediaCommand::FOCUS:
+      if (cmd.leg == media_focus_) break;
+      if (media_focus_ >= 0)
+        legs_[media_focus_].pacer.pause(now);
+      media_focus_ = cmd.leg;
+      // the frames skipped while the call was off the speaker leave a gap no decoder state survives
+      leg.jitter.reset();
+      leg.adpcm.reset_decoder();
+      leg.g722.reset_decoder();
+      leg.plc.reset();
+      leg.cn_active = false;
+      // the microphone audio so far was meant for the other call
+      mic_ring_.discard(mic_ring_.capacity());
+      aec_.realign();
+      leg.pacer.resume(now);
+      break;
+    default:
+      // settings, applied above
+      break;
+  }
+}
+
+void Voip::media_tick() {
+  MediaCommand cmd;
+  while (media_commands_.pop(cmd)) {
+    this->apply_media_command(cmd);
+  }
+  if (this->legs_) {
+    this->handle_incoming_rtp();
+    if (media_focus_ >= 0 && legs_[media_focus_].tx_active) {
+      this->tx_rtp();
+    }
+  }
+}
+
+void Voip::process_media_events() {
+  MediaEvent ev;
+  while (media_events_.pop(ev)) {
+    if (ev.leg >= max_calls_) continue;
+    MediaLeg &leg = legs_[ev.leg];
+    switch (ev.type) {
+      case MediaEvent::RX_NEW_SSRC:
+        ESP_LOGD(TAG, "Call %u: new RTP stream ssrc=%08x", (unsigned)leg.call, (unsigned)ev.value);
+        break;
+      case MediaEvent::TX_STOPPED:
+        ESP_LOGI(TAG, "Call %u RTP TX: %u frames sent, %u skipped, max lateness %u us", (unsigned)leg.call,
+                 (unsigned)ev.value, (unsigned)leg.pacer.get_skipped(), (unsigned)leg.pacer.get_max_lateness_us());
+        ESP_LOGD(TAG, "RTP TX lateness: <1ms %u, <2ms %u, <5ms %u, <10ms %u, <20ms %u, <50ms %u, >=50ms %u",
+                 (unsigned)leg.pacer.get_histogram(0), (unsigned)leg.pacer.get_histogram(1),
+                 (unsigned)leg.pacer.get_histogram(2), (unsigned)leg.pacer.get_histogram(3),
+                 (unsigned)leg.pacer.get_histogram(4), (unsigned)leg.pacer.get_histogram(5),
+                 (unsigned)leg.pacer.get_histogram(6));
+        break;
+      case MediaEvent::LEG_STOPPED:
+        ESP_LOGD(TAG, "Call %u: RTP port %u closed", (unsigned)leg.call, (unsigned)leg.port);
+        // the media context is done with the sockets, the leg is free for the next call
+        leg.udp.reset();
+        leg.rtcp_udp.reset();
+        leg.call = 0;
+        leg.port = 0;
+        leg.media_version = 0;
+        leg.tx_started = false;
+        leg.stopping = false;
+        break;
+    }
+  }
+  MediaQuality mq;
+  while (media_quality_.pop(mq)) {
+    if (mq.leg >= max_calls_) continue;
+    const CallQuality &q = mq.quality;
+    ESP_LOGD(TAG, "Call %u: loss %.1f%% (far end %.1f%%), jitter %.1f ms, RTT %.0f ms, R %.0f, MOS %.2f, ERLE %.0f dB, "
+             "gain mic %.0f dB speaker %.0f dB",
+             (unsigned)legs_[mq.leg].call, q.loss_percent, q.remote_loss_percent, q.jitter_ms, q.rtt_ms, q.r_factor,
+             q.mos, q.erle_db, q.mic_gain_db, q.speaker_gain_db);
+    // the sensors follow the call on the speaker
+    if ((int)mq.leg == focus_leg_)
+      this->publish_quality(q);
   }
 }
 
@@ -1190,149 +2121,249 @@ void Voip::play_beep_ms(int duration_ms, float volume_scale) {
 }
 
 void Voip::tx_rtp() {
-  static uint16_t sequence_number = 0;
-  static uint32_t timestamp = 0;
-  const uint32_t ssrc = 3124150;
-  uint8_t packet_buffer[255];
-
-  if (!started_) return;  // ensure started
-  if (codec_type_ == 0) {
-    if (!microphone_) {
-      ESP_LOGW(TAG, "tx_rtp: microphone_ is null");
-      return;
+  // runs in the media context (scheduler interval or media task): only touch media state here.
+  // Only the call with the focus gets the microphone.
+  if (media_focus_ < 0) return;
+  MediaLeg &leg = legs_[media_focus_];
+  if (!leg.tx_active) return;
+  if (!microphone_) {
+    ESP_LOGW(TAG, "tx_rtp: microphone_ is null");
+    return;
+  }
+  // send every frame that is due; a frame the microphone has not delivered yet stays due and is
+  // caught up on a later tick
+  uint64_t now = MediaTask::now_us();
+  for (uint32_t due = leg.pacer.frames_due(now); due > 0; due--) {
+    if (!this->send_rtp_frame(leg, now))
+      break;
+  }
+}
+
+int Voip::read_mic(size_t n) {
+  if (mic_split_) {
+    // pairs of the lower band and the upper band, taken apart in place
+    if (!mic_ring_.read((uint8_t *)tx_frame_, n * 4))
+      return 0;
+    int16_t *frame16 = (int16_t *)tx_frame_;
+    for (size_t i = 0; i < n; i++) {
+      int16_t low = frame16[2 * i];
+      tx_high_[i] = frame16[2 * i + 1];
+      frame16[i] = low;
     }
-    // PCMU
-    uint8_t temp[160];
-    int bytes_per_sample = 4;
-    size_t required = 640; // 160 samples * 4 bytes
-    if (mic_buffer_.size() < required) {
-      // maybe 16-bit samples => 2 bytes per sample (160 * 2 = 320 bytes)
-      if (mic_buffer_.size() >= 320) {
-        bytes_per_sample = 2;
-        required = 320;
-      }
+    return 2;
+  }
+  // resampled, the ring holds 16-bit samples
+  if (mic_resampler_)
+    return mic_ring_.read((uint8_t *)tx_frame_, n * 2) ? 2 : 0;
+  // the microphone delivers 24-bit samples in 32-bit containers or plain 16-bit samples
+  int bytes_per_sample = 4;
+  size_t required = n * 4;
+  size_t avail = mic_ring_.available();
+  if (avail < required && avail >= n * 2) {
+    bytes_per_sample = 2;
+    required = n * 2;
+  }
+  if (!mic_ring_.read((uint8_t *)tx_frame_, required)) {
+    return 0;
+  }
+  return bytes_per_sample;
+}
+
+void Voip::play_speaker(const int16_t *pcm, const int16_t *high, size_t n) {
+  if (speaker_merge_) {
+    // the QMF takes the lower band at the 15-bit level of the G.722 decoder
+    int16_t low[MIX_BLOCK_SAMPLES], silence[MIX_BLOCK_SAMPLES] = {};
+    while (n > 0) {
+      size_t m = n < MIX_BLOCK_SAMPLES ? n : MIX_BLOCK_SAMPLES;
+      for (size_t i = 0; i < m; i++)
+        low[i] = (int16_t)(pcm[i] >> 1);
+      g722::qmf_synthesis(&speaker_qmf_, low, high != nullptr ? high : silence, speaker_pcm_.get(), m);
+      speaker_->play((const uint8_t *)speaker_pcm_.get(), sizeof(int16_t) * 2 * m);
+      pcm += m;
+      if (high != nullptr)
+        high += m;
+      n -= m;
     }
-    if (mic_buffer_.size() >= required) {
-      for (int i = 0; i < 160; i++) {
-        SAMPLE_T sample = 0;
-        if (bytes_per_sample == 4) {
-          memcpy(&sample, &mic_buffer_[i * 4], sizeof(sample));
-        } else {
-          int16_t s16 = 0;
-          memcpy(&s16, &mic_buffer_[i * 2], sizeof(s16));
-          // scale 16-bit to SAMPLE_T (24-bit internal representation)
-          sample = ((SAMPLE_T)s16) << (SAMPLE_BITS - 16);
-        }
-        temp[i] = linear2ulaw(MIC_CONVERT(sample) * mic_gain_);
-      }
-      mic_buffer_.erase(mic_buffer_.begin(), mic_buffer_.begin() + required);
+    return;
+  }
+  if (!speaker_resampler_) {
+    speaker_->play((const uint8_t *)pcm, sizeof(int16_t) * n);
+    return;
+  }
+  while (n > 0) {
+    size_t m = n < MIX_BLOCK_SAMPLES ? n : MIX_BLOCK_SAMPLES;
+    size_t out = speaker_resampler_->process(pcm, m, speaker_pcm_.get());
+    speaker_->play((const uint8_t *)speaker_pcm_.get(), sizeof(int16_t) * out);
+    pcm += m;
+    n -= m;
+  }
+}
+
+void Voip::cancel_echo(int16_t *pcm, size_t n) {
+  uint64_t start = MediaTask::now_us();
+  aec_.capture(pcm, n);
+  // time per 10 ms, averaged over about eight frames so that a preemption now and then does not
+  // count; the filtering itself always runs, only the share of the tail adapted per sample moves
+  uint32_t block_us = (uint32_t)((MediaTask::now_us() - start) * MIX_BLOCK_SAMPLES / n);
+  aec_block_us_ = aec_block_us_ - aec_block_us_ / 8 + block_us / 8;
+  size_t segments = aec_.get_update_segments();
+  if (aec_block_us_ > aec_budget_us_ && segments > 1) {
+    aec_.set_update_segments(segments - 1 - segments / 8);
+  } else if (aec_block_us_ < aec_budget_us_ * 3 / 4 && segments < aec_.get_segments()) {
+    aec_.set_update_segments(segments + 1);
+  }
+}
+
+bool Voip::send_rtp_frame(MediaLeg &leg, uint64_t now_us) {
+  // one frame of the negotiated ptime
+  const size_t n = leg.frame_samples;
+  int bytes_per_sample = this->read_mic(n);
+  if (bytes_per_sample == 0) {
+    return false; // not enough data
+  }
+  uint8_t *payload = tx_packet_ + RTP_HEADER_SIZE;
+  size_t payload_len = n;
+  // 24-bit samples in 32-bit containers drop their low 8 bits first
+  int in_shift = bytes_per_sample == 4 ? SAMPLE_BITS - 16 : 0;
+  const int16_t *frame16 = (const int16_t *)tx_frame_;
+  bool marker = false;
+  if (codec_is_adpcm(leg.codec) || leg.codec == CODEC_G722 || leg.cn_payload_type != 0 || aec_enabled_ ||
+      ns_enabled_ || mic_agc_enabled_) {
+    // the encoder, the voice activity detector or the microphone processing needs the scaled samples
+    if (bytes_per_sample == 4) {
+      g711::scale_q15(tx_frame_, tx_pcm_, n, in_shift, tx_gain_);
     } else {
-      return; // not enough data
+      g711::scale_q15(frame16, tx_pcm_, n, in_shift, tx_gain_);
     }
-    uint8_t *rtp_header = packet_buffer;
-    rtp_header[0] = 0x80;
-    rtp_header[1] = 0;
-    uint16_t seq_net = htons(sequence_number++);
-    rtp_header[2] = (seq_net >> 8) & 0xFF;
-    rtp_header[3] = seq_net & 0xFF;
-    uint32_t ts_net = htonl(timestamp += 160);
-    rtp_header[4] = (ts_net >> 24) & 0xFF;
-    rtp_header[5] = (ts_net >> 16) & 0xFF;
-    rtp_header[6] = (ts_net >> 8) & 0xFF;
-    rtp_header[7] = ts_net & 0xFF;
-    uint32_t ssrc_net = htonl(ssrc);
-    rtp_header[8] = (ssrc_net >> 24) & 0xFF;
-    rtp_header[9] = (ssrc_net >> 16) & 0xFF;
-    rtp_header[10] = (ssrc_net >> 8) & 0xFF;
-    rtp_header[11] = ssrc_net & 0xFF;
-    memcpy(rtp_header + 12, temp, 160);
-    struct sockaddr_in remote = {};
-    remote.sin_family = AF_INET;
-    if (!sip_) {
-      ESP_LOGW(TAG, "tx_rtp: sip_ is null");
-      return;
+    int64_t before = mic_split_ ? band_energy(tx_pcm_, n) : 0;
+    if (aec_enabled_)
+      this->cancel_echo(tx_pcm_, n);
+    if (ns_enabled_) {
+      ns_.process(tx_pcm_, n);
+      // the detector would learn the noise the suppressor already knows, and later; the AGC's gain
+      // applies to it as well
+      leg.vad.set_noise_dbov(ns_.get_output_noise_dbov() + (mic_agc_enabled_ ? mic_agc_.get_gain_db() : 0.0f));
     }
-    int dest_port = atoi(sip_->audioport.c_str());
-    if (dest_port <= 0) {
-      ESP_LOGW(TAG, "Invalid audio port: %s", sip_->audioport.c_str());
-      return;
+    if (mic_agc_enabled_)
+      mic_agc_.process(tx_pcm_, n);
+    if (mic_split_) {
+      // the upper band goes around the processing: it gets the microphone gain, waits out the
+      // suppressor's delay and follows what the processing did to the level of the lower band
+      g711::scale_q15(tx_high_.get(), tx_high_.get(), n, 0, tx_gain_);
+      if (ns_enabled_)
+        delay_band(tx_high_.get(), n, tx_high_delay_, NoiseSuppressor::DELAY);
+      follow_gain(tx_high_.get(), n, before, band_energy(tx_pcm_, n));
     }
-    remote.sin_port = htons(dest_port);
-    if (sip_->get_sip_server_ip().empty()) {
-      ESP_LOGW(TAG, "tx_rtp: SIP server IP is empty!");
-      return;
-    }
-    inet_pton(AF_INET, sip_->get_sip_server_ip().c_str(), &remote.sin_addr);
-    this->rtp_udp_->sendto(packet_buffer, 12 + 160, 0, (struct sockaddr *)&remote, sizeof(remote));
-  } else if (codec_type_ == 1) {
-    if (!started_) return; // ensure started
-    // PCMA
-    uint8_t temp[160];
-    int bytes_per_sample = 4;
-    size_t required = 640; // 160 samples * 4 bytes
-    if (mic_buffer_.size() < required) {
-      if (mic_buffer_.size() >= 320) {
-        bytes_per_sample = 2;
-        required = 320;
-      }
-    }
-    if (mic_buffer_.size() >= required) {
-      for (int i = 0; i < 160; i++) {
-        SAMPLE_T sample = 0;
-        if (bytes_per_sample == 4) {
-          memcpy(&sample, &mic_buffer_[i * 4], sizeof(sample));
-        } else {
-          int16_t s16 = 0;
-          memcpy(&s16, &mic_buffer_[i * 2], sizeof(s16));
-          sample = ((SAMPLE_T)s16) << (SAMPLE_BITS - 16);
-        }
-        temp[i] = linear2alaw(MIC_CONVERT(sample) * mic_gain_);
-      }
-      mic_buffer_.erase(mic_buffer_.begin(), mic_buffer_.begin() + required);
+    if (this->send_silence(leg, tx_pcm_, n, now_us, &marker)) {
+      return true;
+    } else if (codec_is_adpcm(leg.codec)) {
+      payload_len = leg.adpcm.encode(tx_pcm_, n, payload);
+    } else if (leg.codec == CODEC_G722) {
+      payload_len = leg.g722.encode(tx_pcm_, mic_split_ ? tx_high_.get() : nullptr, n, payload);
+    } else if (leg.codec == CODEC_PCMU) {
+      g711::encode_ulaw(tx_pcm_, payload, n);
     } else {
-      return; // not enough data
-    }
-    uint8_t *rtp_header = packet_buffer;
-    rtp_header[0] = 0x80;
-    rtp_header[1] = 8;
-    uint16_t seq_net = htons(sequence_number++);
-    rtp_header[2] = (seq_net >> 8) & 0xFF;
-    rtp_header[3] = seq_net & 0xFF;
-    uint32_t ts_net = htonl(timestamp += 160);
-    rtp_header[4] = (ts_net >> 24) & 0xFF;
-    rtp_header[5] = (ts_net >> 16) & 0xFF;
-    rtp_header[6] = (ts_net >> 8) & 0xFF;
-    rtp_header[7] = ts_net & 0xFF;
-    uint32_t ssrc_net = htonl(ssrc);
-    rtp_header[8] = (ssrc_net >> 24) & 0xFF;
-    rtp_header[9] = (ssrc_net >> 16) & 0xFF;
-    rtp_header[10] = (ssrc_net >> 8) & 0xFF;
-    rtp_header[11] = ssrc_net & 0xFF;
-    memcpy(rtp_header + 12, temp, 160);
-    struct sockaddr_in remote = {};
-    remote.sin_family = AF_INET;
-    if (!sip_) {
-      ESP_LOGW(TAG, "tx_rtp: sip_ is null");
-      return;
+      g711::encode_alaw(tx_pcm_, payload, n);
     }
-    int dest_port = atoi(sip_->audioport.c_str());
-    if (dest_port <= 0) {
-      ESP_LOGW(TAG, "Invalid audio port: %s", sip_->audioport.c_str());
-      return;
+  } else if (bytes_per_sample == 4) {
+    // gain, saturation and G.711 encode in one pass straight into the packet
+    if (leg.codec == CODEC_PCMU) {
+      g711::encode_ulaw(tx_frame_, payload, n, in_shift, tx_gain_);
+    } else {
+      g711::encode_alaw(tx_frame_, payload, n, in_shift, tx_gain_);
     }
-    remote.sin_port = htons(dest_port);
-    if (sip_->get_sip_server_ip().empty()) {
-      ESP_LOGW(TAG, "tx_rtp: SIP server IP is empty!");
-      return;
+  } else {
+    if (leg.codec == CODEC_PCMU) {
+      g711::encode_ulaw(frame16, payload, n, in_shift, tx_gain_);
+    } else {
+      g711::encode_alaw(frame16, payload, n, in_shift, tx_gain_);
     }
-    inet_pton(AF_INET, sip_->get_sip_server_ip().c_str(), &remote.sin_addr);
-    this->rtp_udp_->sendto(packet_buffer, 12 + 160, 0, (struct sockaddr *)&remote, sizeof(remote));
+  }
+  this->send_rtp_packet(leg, leg.payload_type, marker, payload_len, now_us);
+  return true;
+}
+
+bool Voip::send_silence(MediaLeg &leg, const int16_t *pcm, size_t n, uint64_t now_us, bool *marker) {
+  if (leg.cn_payload_type == 0)
+    return false;
+  bool speech = leg.vad.process(pcm, n);
+  switch (leg.dtx.next(speech, leg.vad.get_noise_dbov(), (uint32_t)(n * 1000 / SAMPLE_RATE))) {
+    case DtxScheduler::SEND:
+      // the first packet after silence starts a talkspurt (RFC 3551 section 4.1)
+      *marker = leg.dtx.is_talkspurt_start();
+      return false;
+    case DtxScheduler::SEND_SID:
+      this->send_rtp_packet(leg, leg.cn_payload_type, false,
+                            write_cn_payload(tx_packet_ + RTP_HEADER_SIZE, leg.dtx.get_sid_level()), now_us);
+      return true;
+    case DtxScheduler::SKIP:
+    default:
+      // the timestamp moves on, so the far end plays the next talkspurt at the right time
+      leg.pacer.skip_frame();
+      return true;
   }
 }
 
+void Voip::send_rtp_packet(MediaLeg &leg, uint8_t payload_type, bool marker, size_t payload_len, uint64_t now_us) {
+  uint32_t timestamp = leg.pacer.get_timestamp();
+  leg.pacer.next_packet(now_us, payload_type, marker, tx_packet_);
+  leg.udp->sendto(tx_packet_, RTP_HEADER_SIZE + payload_len, 0, (struct sockaddr *)&leg.remote, sizeof(leg.remote));
+  leg.rtcp.on_rtp_sent(timestamp, payload_len, now_us);
+}
+
 void Voip::mic_data_callback(const std::vector<uint8_t> &data) {
-  mic_buffer_.insert(mic_buffer_.end(), data.begin(), data.end());
-  ESP_LOGD(TAG, "mic_data_callback: received %u bytes, mic_buffer=%u bytes", (unsigned)data.size(), (unsigned)mic_buffer_.size());
+  // may run on the microphone task: only the producer side of mic_ring_ is touched here
+  size_t stored = 0;
+  // to 16 bits the way scale_q15() takes 32-bit words
+  auto to_pcm16 = [this, &data](size_t at, size_t m, int16_t *out) {
+    if (mic_sample_bytes_ == 4) {
+      const int32_t *words = (const int32_t *)data.data() + at;
+      for (size_t i = 0; i < m; i++)
+        out[i] = (int16_t)(words[i] >> (SAMPLE_BITS - 16));
+    } else {
+      memcpy(out, (const int16_t *)data.data() + at, m * sizeof(int16_t));
+    }
+  };
+  if (mic_split_) {
+    // through the G.722 QMF: the lower band at the 16-bit level next to the upper band as it is
+    int16_t *in = mic_pcm_.get();
+    int16_t *bands = in + Resampler::CHUNK;
+    size_t samples = data.size() / mic_sample_bytes_;
+    for (size_t at = 0; at < samples;) {
+      size_t start = mic_has_odd_ ? 1 : 0;
+      in[0] = mic_odd_;
+      size_t m = samples - at < Resampler::CHUNK - start ? samples - at : Resampler::CHUNK - start;
+      to_pcm16(at, m, in + start);
+      size_t total = start + m, pairs = total / 2;
+      mic_has_odd_ = total % 2 != 0;
+      mic_odd_ = in[total - 1];
+      g722::qmf_analysis(&mic_qmf_, in, bands, bands + pairs, pairs);
+      for (size_t i = 0; i < pairs; i++) {
+        int32_t low = bands[i] * 2;
+        in[2 * i] = (int16_t)(low > 32767 ? 32767 : (low < -32768 ? -32768 : low));
+        in[2 * i + 1] = bands[pairs + i];
+      }
+      // whole pairs only, so that the ring stays aligned when it runs full
+      stored += mic_ring_.write((const uint8_t *)in, pairs * 4, 4);
+      at += m;
+    }
+  } else if (!mic_resampler_) {
+    stored = mic_ring_.write(data.data(), data.size());
+  } else {
+    // then to SAMPLE_RATE
+    int16_t *in = mic_pcm_.get();
+    int16_t *out = in + Resampler::CHUNK;
+    size_t samples = data.size() / mic_sample_bytes_;
+    for (size_t at = 0; at < samples;) {
+      size_t m = samples - at < Resampler::CHUNK ? samples - at : Resampler::CHUNK;
+      to_pcm16(at, m, in);
+      size_t k = mic_resampler_->process(in, m, out);
+      stored += mic_ring_.write((const uint8_t *)out, k * sizeof(int16_t));
+      at += m;
+    }
+  }
+  ESP_LOGV(TAG, "mic_data_callback: received %u bytes, stored %u, mic_ring=%u bytes", (unsigned)data.size(),
+           (unsigned)stored, (unsigned)mic_ring_.available());
   if (this->is_recording_) {
     this->record_buffer_.insert(this->record_buffer_.end(), data.begin(), data.end());
     ESP_LOGD(TAG, "mic_data_callback: appended to record_buffer, now %u bytes", (unsigned)this->record_buffer_.size());
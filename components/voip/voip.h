@@ -4,6 +4,30 @@
 #include "esphome.h"
 #include <driver/i2s_std.h>
 #include "g711.h"
+#include "g711_gain.h"
+#include "adpcm.h"
+#include "aec.h"
+#include "agc.h"
+#include "comfort_noise.h"
+#include "g722.h"
+#include "jitter_buffer.h"
+#include "media_task.h"
+#include "mixer.h"
+#include "noise_suppressor.h"
+#include "ring_buffer.h"
+#include "plc.h"
+#include "resampler.h"
+#include "rtcp.h"
+#include "rtp.h"
+#include "rtp_pacer.h"
+#include "sdp.h"
+#include "sip_dialog.h"
+#include "sip_digest.h"
+#include "sip_message.h"
+#include "sip_parser.h"
+#include "sip_registration.h"
+#include "sip_transaction.h"
+#include "vad.h"
 #include <memory>
 #include <string>
 #include <vector>
@@ -11,6 +35,9 @@
 #include "esphome/components/i2s_audio/microphone/i2s_audio_microphone.h"
 #include "esphome/components/i2s_audio/speaker/i2s_audio_speaker.h"
 #include "esphome/core/scheduler.h"
+#ifdef USE_SENSOR
+#include "esphome/components/sensor/sensor.h"
+#endif
 #include <chrono>
 #include "esphome/core/defines.h"
 // Removed include of automation.h here to avoid circular include - automation.h includes voip.h
@@ -20,6 +47,71 @@
 namespace esphome {
 namespace voip {
 
+// Values of the `codec` option
+enum VoipCodec : int {
+  CODEC_PCMU = 0,
+  CODEC_PCMA = 1,
+  CODEC_G726_32 = 2,  // G.721
+  CODEC_G726_24 = 3,
+  CODEC_G726_40 = 4,
+  // wideband; the media path carries its lower band at 8 kHz
+  CODEC_G722 = 5,
+};
+static const size_t CODEC_COUNT = 6;
+
+static inline bool codec_is_adpcm(int codec) { return codec >= CODEC_G726_32 && codec <= CODEC_G726_40; }
+// bits per ADPCM code word
+static inline uint8_t codec_adpcm_bits(int codec) {
+  return codec == CODEC_G726_24 ? 3 : (codec == CODEC_G726_40 ? 5 : 4);
+}
+// equipment impairment Ie of the E-model (ITU-T G.113 Appendix I); G.722 is rated on the wideband
+// scale only, and on the narrowband one takes the 0 of G.711
+static inline float codec_impairment(int codec) {
+  switch (codec) {
+    case CODEC_G726_32:
+      return 7.0f;
+    case CODEC_G726_24:
+      return 25.0f;
+    case CODEC_G726_40:
+      return 2.0f;
+    default:
+      return 0.0f;
+  }
+}
+// packet-loss robustness Bpl (G.113 Appendix I): G.711 with the Appendix I concealment; the G.726
+// rates and G.722, whose predictors lose track over a gap just the same, are not listed there and
+// keep the value of G.711 without concealment
+static inline float codec_loss_robustness(int codec) {
+  return codec_is_adpcm(codec) || codec == CODEC_G722 ? 4.3f : 25.1f;
+}
+// encoding name as used in the SDP rtpmap attribute (RFC 3551)
+static inline const char *codec_encoding_name(int codec) {
+  switch (codec) {
+    case CODEC_PCMU:
+      return "PCMU";
+    case CODEC_G726_32:
+      return "G726-32";
+    case CODEC_G726_24:
+      return "G726-24";
+    case CODEC_G726_40:
+      return "G726-40";
+    case CODEC_G722:
+      return "G722";
+    default:
+      return "PCMA";
+  }
+}
+
+// RTP payload type of a codec: the RFC 3551 static type for G.711 and G.722, else one of three
+// consecutive dynamic types starting at dynamic_pt
+static inline uint8_t codec_payload_type(int codec, uint8_t dynamic_pt) {
+  if (codec_is_adpcm(codec))
+    return (uint8_t)(dynamic_pt + (codec - CODEC_G726_32));
+  if (codec == CODEC_G722)
+    return 9;
+  return codec == CODEC_PCMU ? 0 : 8;
+}
+
 class Sip : public Component {
  public:
   Sip();
@@ -28,20 +120,52 @@ class Sip : public Component {
   void loop() override;
   void dump_config() override;
 
+  // Calls held at the same time and the range their local RTP ports come from; set before init()
+  void set_max_calls(size_t calls) { max_calls_ = calls; }
+  void set_rtp_ports(uint16_t first, uint16_t last) { rtp_ports_.configure(first, last); }
+  // my_ip may be empty: then the address of the interface that routes to the server is used
   void init(const std::string &sip_ip, int sip_port, const std::string &my_ip, int my_port, const std::string &sip_user, const std::string &sip_pass);
-  bool dial(const std::string &dial_nr, const std::string &dial_desc = "");
-  bool is_busy() { return i_ring_time_ != 0; }
-  void hangup();
+  // whether init() registers at the server, and the binding lifetime asked for in s
+  void set_registration(bool enabled, uint32_t expires_s) {
+    register_ = enabled;
+    register_expires_ = expires_s;
+  }
+  bool is_registered() const { return registration_.is_registered(); }
+  // Removes the registration, e.g. before the component stops
+  void unregister() { registration_.stop(millis()); }
+  // Calls dial_nr at the server; returns the id of the new call, 0 if no call slot or RTP port is free
+  uint32_t dial(const std::string &dial_nr, const std::string &dial_desc = "");
+  // some call is ringing, being set up or established
+  bool is_busy() const { return dialogs_.active() != 0; }
+  size_t get_call_count() const { return dialogs_.active(); }
+  // an incoming call is ringing and waits for answer() or hangup()
+  bool is_incoming() const { return dialogs_.oldest_ringing() != nullptr; }
+  // Accepts a ringing incoming call with a 200 and the SDP answer; call 0 is the one ringing longest
+  bool answer(uint32_t call = 0);
+  // Rejects a ringing incoming call (603), cancels an outgoing one or ends an established one; call 0
+  // ends them all
+  void hangup(uint32_t call = 0);
+  // Called with the id and caller of a new incoming call, and again if it hangs up before we answer
+  void set_incoming_call_callback(std::function<void(uint32_t call, const std::string &caller)> &&cb) {
+    on_incoming_call_ = std::move(cb);
+  }
+  void set_call_missed_callback(std::function<void(uint32_t call, const std::string &caller)> &&cb) {
+    on_call_missed_ = std::move(cb);
+  }
   const std::string &get_sip_server_ip() { return p_sip_ip_; }
-  void set_codec(int codec) { codec_ = codec; }
-  std::string audioport;
+  // Codecs offered in the INVITE in order of preference, the ptime we want to receive and whether
+  // comfort noise is offered and accepted (DTX)
+  void set_offer(const SdpCodec *codecs, size_t count, uint8_t ptime, bool comfort_noise = false);
+  // All calls, for the media path: each has its RTP port and, while media_valid, its audio stream
+  const SipDialogTable &get_calls() const { return dialogs_; }
+  const SipDialog *get_call(uint32_t call) const { return dialogs_.find(call); }
 
  protected:
   ::std::unique_ptr<socket::Socket> udp_;
   char packetBuffer[1024];
   char *p_buf_;
   size_t l_buf_;
-  char ca_read_[256];
+  SipMessage tx_;  // outgoing message, built in p_buf_
 
   std::string p_sip_ip_;
   int i_sip_port_;
@@ -49,40 +173,78 @@ class Sip : public Component {
   std::string p_sip_pass_;
   std::string p_my_ip_;
   int i_my_port_;
-  std::string p_dial_nr_;
-  std::string p_dial_desc_;
 
-  uint32_t callid_;
-  uint32_t tagid_;
   uint32_t branchid_;
 
-  int i_auth_cnt_;
-  // For qop=auth support
-  std::string cnonce_;
-  std::string last_nonce_;
-  uint32_t auth_nc_ = 0;
-  uint32_t i_ring_time_;
+  // HA1 per realm and the last nonce, shared by REGISTER, INVITE and BYE of all calls
+  SipDigestAuth auth_;
   uint32_t i_max_time_;
-  int i_dial_retries_;
   int i_last_cseq_;
-  int codec_;  // 0 = G711 PCMU, 1 = G711 PCMA, 2 = G.721
-
-  void add_sip_line(const char *const_format, ...);
-  bool add_copy_sip_line(const char *p, const char *psearch);
-  bool parse_parameter(std::string &dest, const char *name, const char *line, char cq = '\"');
-  bool parse_return_params(const char *p);
-  int grep_integer(const char *p, const char *psearch);
-  void ack(const char *p_in);
-  void cancel(int seqn);
-  void bye(int cseq);
-  void ok(const char *p_in);
-  void invite(const char *p_in = nullptr);
+  // retransmission and matching of everything sent and received, see sip_transaction.h
+  SipTransactionLayer txns_;
+  SipEndpoint server_{};
+  SipRegistration registration_;
+  bool register_ = true;
+  uint32_t register_expires_ = 600;
+  // one slot per call, allocated by init()
+  size_t max_calls_ = 1;
+  SipDialogTable dialogs_;
+  RtpPortPool rtp_ports_;
+  std::function<void(uint32_t call, const std::string &caller)> on_incoming_call_;
+  std::function<void(uint32_t call, const std::string &caller)> on_call_missed_;
+  SdpCodec offer_[CODEC_COUNT];
+  size_t offer_count_ = 0;
+  uint8_t ptime_ = 20;
+  bool comfort_noise_ = false;
+
+  // appends header of in as a complete line under its canonical name, nothing if missing
+  void copy_header(SipMessage &msg, const SipParser &in, SipHeader header);
+  // Via with a new branch for every request except CANCEL and the ACK of a failure response
+  void write_via(SipMessage &msg);
+  // keeps Call-ID, From and To of a response to our INVITE for the requests that follow in the dialog
+  bool parse_return_params(SipDialog *call, const SipParser &in);
+  // ACK for a 2xx to INVITE; failure responses are ACKed by the transaction layer
+  void ack(const SipParser &in);
+  void cancel(SipDialog *call);
+  void bye(SipDialog *call);
+  void in_dialog_request(SipDialog *call, const char *method, int cseq);
+  // answers a request through its server transaction (statelessly if txn is 0), to its source address
+  void respond(const SipParser &in, uint32_t txn, const SipEndpoint &from, int status, const char *reason);
+  // status line and the headers of a response to in; a To without tag gets to_tag unless provisional
+  void begin_response(const SipParser &in, int status, const char *reason, uint32_t to_tag);
+  // response to the INVITE in the call's server transaction, with the SDP answer for 18x/200 if sdp is set
+  void respond_incoming(SipDialog *call, int status, const char *reason, bool sdp);
+  // Authorization (401) or Proxy-Authorization (407) header answering challenge for method and uri;
+  // without a challenge the cached credentials if their nonce is still usable
+  bool write_authorization(const SipParser *challenge, const char *method, const char *uri, SipMessage &out);
+  // without a challenge the call's first INVITE, else the authenticated retry for a 401 or 407 response
+  void invite(SipDialog *call, const SipParser *challenge = nullptr);
   void handle_udp_packet();
+  void handle_response(SipDialog *call, const SipParser &msg);
+  void handle_invite(const SipParser &msg, uint32_t txn, const SipEndpoint &from);
+  void handle_cancel(const SipParser &msg, uint32_t txn, const SipEndpoint &from);
+  // frees the call's slot and RTP port; missed reports an incoming call that was never answered
+  void end_call(SipDialog *call, bool missed = false);
+  // negotiates the SDP answer in a 18x/200 response against offer_
+  void apply_answer(SipDialog *call, const SipParser &msg);
+  // negotiates the SDP offer of an incoming INVITE against offer_, false if there is none we support
+  bool negotiate_offer(const SipParser &msg, SdpNegotiation *out);
+  void use_media(SipDialog *call, const SdpNegotiation &result);
+  void clear_media(SipDialog *call);
+
+  void on_transaction_timeout(uint32_t txn, SipMethod method);
 
   uint32_t millis();
   uint32_t random();
+  // completes tx_; false if it did not fit
+  bool finish_tx();
+  // sends tx_ to the server in a new client transaction, returns its id or 0
+  uint32_t send_request();
+  // sends tx_ to the server once, for ACKs of 2xx responses
   int send_udp();
-  void make_md5_digest(char *p_out_hex33, char *p_in);
+  void send_to(const SipEndpoint &to, const char *data, size_t len);
+  // local address towards the SIP server, for Via, Contact and SDP when none is configured
+  std::string detect_local_ip();
 };
 
 #define MIC_BITS 24
@@ -91,9 +253,135 @@ class Sip : public Component {
 #define SAMPLE_RATE 8000
 #define SAMPLE_BITS 24
 #define SAMPLE_T int32_t
+// mic ring capacity in bytes: 128 ms of 32-bit samples at 8 kHz
+#define MIC_RING_SIZE 4096
+// largest TX frame, at the longest ptime the media path supports
+#define MAX_FRAME_SAMPLES (SDP_MAX_PTIME * SAMPLE_RATE / 1000)
+// conference mixing runs on 10 ms blocks, independent of the ptime of each call
+#define MIX_BLOCK_SAMPLES (SAMPLE_RATE / 100)
+#define MIX_BLOCK_US 10000
 #define MIC_CONVERT(s) ((s >> (SAMPLE_BITS - MIC_BITS)) / 2048)
 #define DAC_CONVERT(s) ((s >> (SAMPLE_BITS - MIC_BITS)) / 65536)
 
+// Media of one call: its RTP and RTCP sockets and the per-call stream and codec state, kept while the
+// call is not the one on the speaker and microphone. The main loop opens and closes the sockets and
+// owns the fields up to `stopping`; the rest belongs to the media context from the leg's RX_START
+// until it reports LEG_STOPPED.
+struct MediaLeg {
+  std::unique_ptr<socket::Socket> udp;
+  // RTP port + 1; the call goes on without RTCP if it cannot be bound
+  std::unique_ptr<socket::Socket> rtcp_udp;
+  // our SSRC, kept for the whole call
+  uint32_t ssrc = 0;
+  uint32_t call = 0;  // Sip call id, 0 while the leg is free
+  uint16_t port = 0;
+  // Sip media version the leg's TX was last started with
+  uint32_t media_version = 0;
+  bool tx_started = false;
+  // STOP posted, the socket is closed when the media context confirms
+  bool stopping = false;
+
+  bool rx_active = false;
+  bool tx_active = false;
+  struct sockaddr_in remote = {};
+  int codec = CODEC_PCMA;
+  uint8_t payload_type = 8;
+  uint32_t frame_samples = 160;
+  uint32_t rx_ssrc = 0;
+  bool rx_ssrc_valid = false;
+  JitterBuffer jitter;
+  AdpcmCodec adpcm;
+  G722Codec g722;
+  // fills the frames the jitter buffer reports missing
+  PacketLossConcealer plc;
+  // DTX (RFC 3389), 0 unless negotiated: silence goes out as SID packets of this payload type, and
+  // the far end's SIDs are played as comfort noise until its next talkspurt
+  uint8_t cn_payload_type = 0;
+  VoiceActivityDetector vad;
+  DtxScheduler dtx;
+  ComfortNoiseGenerator cn;
+  // the level of the last SID received, taken over when its frame is played
+  uint8_t cn_level = 127;
+  bool cn_active = false;
+  // while the jitter buffer has stopped between SIDs, comfort noise runs on this clock
+  uint32_t cn_next_ms = 0;
+  RtpPacer pacer;
+  RtcpSession rtcp;
+  // the far end's RTCP address, port 0 until TX_START
+  struct sockaddr_in rtcp_remote = {};
+  // conference only: the decoded frame the mixer takes its blocks from, and the mixed audio
+  // collected until a frame of the call's ptime is complete
+  std::unique_ptr<int16_t[]> rx_pcm;
+  uint16_t rx_pos = 0;
+  uint16_t rx_len = 0;
+  std::unique_ptr<int16_t[]> tx_pcm;
+  uint16_t tx_fill = 0;
+};
+
+// Call-state commands from the main loop to the media context
+struct MediaCommand {
+  // FOCUS: leg whose audio goes to the speaker and which gets the microphone. MIC_GAIN, AMP_GAIN,
+  // MIC_AGC and SPEAKER_LIMITER are settings for all legs and have none.
+  enum Type : uint8_t { RX_START, TX_START, STOP, FOCUS, MIC_GAIN, AMP_GAIN, MIC_AGC, SPEAKER_LIMITER } type;
+  uint8_t leg;
+  struct sockaddr_in remote;
+  // RX_START/TX_START: codec, payload type, comfort noise payload type (0 without DTX) and
+  // (TX_START) packetization of the call
+  int codec;
+  uint8_t payload_type;
+  uint8_t cn_payload_type;
+  uint8_t ptime;
+  // TX_START: the far end's RTCP port on the remote address
+  uint16_t rtcp_port;
+  // TX_START: false if the far end does not want our audio (hold, recvonly answer)
+  bool send;
+  // RX_START/TX_START: our SSRC; TX_START: initial RTP state of the new call
+  uint16_t seq;
+  uint32_t timestamp;
+  uint32_t ssrc;
+  // RX_START: the jitter buffer's delays
+  uint32_t jitter_min_ms;
+  uint32_t jitter_max_ms;
+  // MIC_GAIN, AMP_GAIN and (amp_gain) SPEAKER_LIMITER
+  int gain;
+  // MIC_AGC and SPEAKER_LIMITER: the arguments of set_mic_agc() and set_speaker_limiter()
+  float target_dbfs;
+  float max_gain_db;
+  float gate_dbfs;
+  float limit_dbfs;
+  uint32_t attack_ms;
+  uint32_t release_ms;
+};
+
+// Events from the media context back to the main loop
+struct MediaEvent {
+  // LEG_STOPPED: the media context let go of the leg, its socket may be closed
+  enum Type : uint8_t { RX_NEW_SSRC, TX_STOPPED, LEG_STOPPED } type;
+  uint8_t leg;
+  uint32_t value;
+};
+
+// Quality of a call over the last RTCP report interval
+struct CallQuality {
+  float loss_percent;         // the far end's packets lost on the way to us
+  float remote_loss_percent;  // ours lost on the way to the far end, NAN until its first report
+  float jitter_ms;            // interarrival jitter of the far end's stream
+  float rtt_ms;               // NAN until measured
+  float r_factor;             // E-model rating of what we hear
+  float mos;
+  float erle_db;              // the echo canceller's, NAN without one
+  // gain and output peak of the microphone's AGC and the speaker's limiter, NAN without them
+  float mic_gain_db;
+  float mic_peak_dbfs;
+  float speaker_gain_db;
+  float speaker_peak_dbfs;
+};
+
+struct MediaQuality {
+  uint8_t leg;
+  CallQuality quality;
+};
+
 class Voip : public Component {
  public:
   Voip();
@@ -103,15 +391,135 @@ class Voip : public Component {
   void dump_config() override;
 
   void init(const std::string &sip_ip, const std::string &sip_user, const std::string &sip_pass);
-  void dial(const std::string &number, const std::string &id);
+  // Returns the id of the new call, 0 if it could not be placed
+  uint32_t dial(const std::string &number, const std::string &id);
   bool is_busy();
-  void hangup();
+  size_t get_call_count() const { return sip_ != nullptr ? sip_->get_call_count() : 0; }
+  // Accepts a ringing incoming call, the one ringing longest for 0
+  void answer(uint32_t call = 0);
+  // Ends a call, all calls for 0
+  void hangup(uint32_t call = 0);
+  // Puts call on the speaker and microphone; the newest call gets them by default
+  void focus(uint32_t call);
   void set_codec(int codec);
   void start_component();
   void finish_start_component();
   void stop_component();
-  void set_mic_gain(int gain) { mic_gain_ = gain; }
-  void set_amp_gain(int gain) { amp_gain_ = gain; }
+  // payload type offered for the ADPCM codecs, which have no static assignment
+  void set_dynamic_payload_type(uint8_t pt) {
+    dynamic_payload_type_ = pt;
+    set_codec(codec_type_);
+  }
+  // local RTP ports of the calls: even ports from first to last
+  void set_rtp_ports(uint16_t first, uint16_t last) {
+    rtp_port_ = first;
+    rtp_port_max_ = last;
+  }
+  // calls held at the same time, each with its own RTP port and media state allocated at start
+  void set_max_calls(size_t calls) { max_calls_ = calls; }
+  // join all calls and the device in one conference instead of talking to one call at a time
+  void set_conference(bool conference) { conference_ = conference; }
+  // register at the SIP server so that calls can reach us; expiry asked for in s
+  void set_registration(bool enabled, uint32_t expires_s) {
+    register_ = enabled;
+    register_expires_s_ = expires_s;
+  }
+  // answer incoming calls right away instead of waiting for answer()
+  void set_auto_answer(bool auto_answer) { auto_answer_ = auto_answer; }
+  // packetization we ask the far end for, and use ourselves unless its answer asks for another
+  void set_ptime(uint32_t ms) { ptime_ms_ = ms; }
+  // offer comfort noise and stop sending while the microphone hears no speech, where the far end
+  // takes it
+  void set_dtx(bool dtx) {
+    dtx_ = dtx;
+    this->update_sip_offer();
+  }
+  // cancel the speaker's echo in the microphone: over tail_ms of echo path after delay_ms of
+  // speaker and microphone buffering, its adaptation held to cpu_budget of a core (0..1)
+  void set_echo_canceller(uint32_t tail_ms, uint32_t delay_ms, float cpu_budget, bool suppressor) {
+    aec_enabled_ = true;
+    aec_tail_ms_ = tail_ms;
+    aec_delay_ms_ = delay_ms;
+    aec_budget_us_ = (uint32_t)(cpu_budget * MIX_BLOCK_US);
+    aec_suppressor_ = suppressor;
+  }
+  // suppress steady background noise in the microphone by up to max_attenuation_db
+  void set_noise_suppression(float max_attenuation_db) {
+    ns_enabled_ = true;
+    ns_attenuation_db_ = max_attenuation_db;
+  }
+  // the rates the I2S microphone and speaker run at; anything but SAMPLE_RATE is resampled. A
+  // resampled microphone delivers 16-bit samples or 24-bit samples in 32-bit words (bits 32). With
+  // G.722 as the codec, 16 kHz goes through its QMF instead, and G.722 calls get the upper band.
+  void set_mic_sample_rate(uint32_t hz, uint8_t bits) {
+    mic_sample_rate_ = hz;
+    mic_sample_bytes_ = bits / 8;
+  }
+  void set_speaker_sample_rate(uint32_t hz) { speaker_sample_rate_ = hz; }
+  // the gains and the AGC are used by the media task, so it takes them over between frames
+  void set_mic_gain(int gain) {
+    mic_gain_ = gain;
+    MediaCommand cmd{};
+    cmd.type = MediaCommand::MIC_GAIN;
+    cmd.gain = gain;
+    this->post_media_command(cmd);
+  }
+  void set_amp_gain(int gain) {
+    amp_gain_ = gain;
+    MediaCommand cmd{};
+    cmd.type = MediaCommand::AMP_GAIN;
+    cmd.gain = gain;
+    this->post_media_command(cmd);
+  }
+  // automatic gain control on the microphone, after mic_gain: brings the peak envelope to
+  // target_dbfs with up to max_gain_db, holds the gain below gate_dbfs and limits at limit_dbfs
+  void set_mic_agc(float target_dbfs, float max_gain_db, float gate_dbfs, uint32_t attack_ms, uint32_t release_ms,
+                   float limit_dbfs) {
+    MediaCommand cmd{};
+    cmd.type = MediaCommand::MIC_AGC;
+    cmd.target_dbfs = target_dbfs;
+    cmd.max_gain_db = max_gain_db;
+    cmd.gate_dbfs = gate_dbfs;
+    cmd.attack_ms = attack_ms;
+    cmd.release_ms = release_ms;
+    cmd.limit_dbfs = limit_dbfs;
+    this->post_media_command(cmd);
+  }
+  // turn peaks of what the speaker plays down to limit_dbfs instead of clipping them
+  void set_speaker_limiter(float limit_dbfs, uint32_t release_ms) {
+    MediaCommand cmd{};
+    cmd.type = MediaCommand::SPEAKER_LIMITER;
+    cmd.gain = amp_gain_;
+    cmd.release_ms = release_ms;
+    cmd.limit_dbfs = limit_dbfs;
+    this->post_media_command(cmd);
+  }
+  // calls from now on get the new delays; calls in progress keep theirs
+  void set_jitter_buffer_delay(uint32_t min_ms, uint32_t max_ms) {
+    jitter_min_delay_ms_ = min_ms;
+    jitter_max_delay_ms_ = max_ms;
+  }
+  // Run RX decode and TX encode in a dedicated task instead of loop()/scheduler
+  void set_media_task(int core, int priority, uint32_t period_ms) {
+    use_media_task_ = true;
+    media_task_config_.core = core;
+    media_task_config_.priority = priority;
+    media_task_config_.period_us = period_ms * 1000;
+  }
+#ifdef USE_SENSOR
+  // call quality of the call on the speaker (the newest one in a conference), every RTCP interval
+  void set_packet_loss_sensor(sensor::Sensor *s) { packet_loss_sensor_ = s; }
+  void set_remote_packet_loss_sensor(sensor::Sensor *s) { remote_packet_loss_sensor_ = s; }
+  void set_jitter_sensor(sensor::Sensor *s) { jitter_sensor_ = s; }
+  void set_round_trip_time_sensor(sensor::Sensor *s) { round_trip_time_sensor_ = s; }
+  void set_r_factor_sensor(sensor::Sensor *s) { r_factor_sensor_ = s; }
+  void set_mos_sensor(sensor::Sensor *s) { mos_sensor_ = s; }
+  void set_echo_return_loss_enhancement_sensor(sensor::Sensor *s) { echo_return_loss_enhancement_sensor_ = s; }
+  void set_microphone_gain_sensor(sensor::Sensor *s) { microphone_gain_sensor_ = s; }
+  void set_microphone_peak_sensor(sensor::Sensor *s) { microphone_peak_sensor_ = s; }
+  void set_speaker_gain_sensor(sensor::Sensor *s) { speaker_gain_sensor_ = s; }
+  void set_speaker_peak_sensor(sensor::Sensor *s) { speaker_peak_sensor_ = s; }
+#endif
   void set_mic(i2s_audio::I2SAudioMicrophone *mic) { microphone_ = mic; }
   void set_speaker(i2s_audio::I2SAudioSpeaker *speaker) { speaker_ = speaker; }
   // ready sensor removed - use on_ready/on_not_ready automation events instead
@@ -121,6 +529,12 @@ class Voip : public Component {
   void add_on_call_ended_callback(std::function<void()> &&cb) { on_call_ended_callbacks_.push_back(std::move(cb)); }
   void add_on_ready_callback(std::function<void()> &&cb) { on_ready_callbacks_.push_back(std::move(cb)); }
   void add_on_not_ready_callback(std::function<void()> &&cb) { on_not_ready_callbacks_.push_back(std::move(cb)); }
+  void add_on_incoming_call_callback(std::function<void(const std::string &)> &&cb) {
+    on_incoming_call_callbacks_.push_back(std::move(cb));
+  }
+  void add_on_call_missed_callback(std::function<void(const std::string &)> &&cb) {
+    on_call_missed_callbacks_.push_back(std::move(cb));
+  }
   void set_start_on_boot(bool v) { start_on_boot_ = v; }
   void record_and_playback_1s();
   void play_beep_ms(int duration_ms, float volume_scale = 1.0f);
@@ -133,28 +547,129 @@ class Voip : public Component {
 
  protected:
   Sip *sip_ = nullptr;
-  ::std::unique_ptr<socket::Socket> rtp_udp_;
-  char rtpPacketBuffer[1024];
+  // some call transmits RTP
   bool tx_stream_is_running_ = false;
-  bool rx_stream_is_running_ = false;
-  int rtppkg_size_ = -1;
-  // signed on purpose: will be -1 on recv error; avoid unsigned which hides errors
-  int packet_size_;
+  // scheduler period of tx_rtp() without media task, 0 while it is not scheduled
+  uint32_t tx_interval_ms_ = 0;
   uint8_t rtp_buffer_[2048];
   int codec_type_ = 1;
   int mic_gain_ = MIC_GAIN_DEFAULT;
   int amp_gain_ = AMP_GAIN_DEFAULT;
+  g711::Q15Gain tx_gain_ = g711::q15_gain(MIC_GAIN_DEFAULT, 8);
+  // decode + amp gain + saturation tables, rebuilt by apply_amp_gain() in the media context
+  g711::GainDecoder rx_alaw_{g711::GainDecoder::ALAW, AMP_GAIN_DEFAULT};
+  g711::GainDecoder rx_ulaw_{g711::GainDecoder::ULAW, AMP_GAIN_DEFAULT};
+  // configured codec: offered first, and used for RX until an answer arrives
+  uint8_t payload_type_ = 8;
+  uint8_t dynamic_payload_type_ = 96;
+  uint16_t rtp_port_ = 1234;
+  uint16_t rtp_port_max_ = 1235;
+  size_t max_calls_ = 1;
+  bool conference_ = false;
+  uint32_t ptime_ms_ = 20;
+  bool dtx_ = false;
+  bool aec_enabled_ = false;
+  uint32_t aec_tail_ms_ = 64;
+  uint32_t aec_delay_ms_ = 0;
+  uint32_t aec_budget_us_ = 0;
+  bool aec_suppressor_ = true;
+  uint32_t jitter_min_delay_ms_ = 40;
+  uint32_t jitter_max_delay_ms_ = 200;
+  // one leg per call, allocated when the component starts; the leg on the speaker and microphone
+  std::unique_ptr<MediaLeg[]> legs_;
+  int focus_leg_ = -1;
+  // Media engine. Everything below is owned by the media context (the media task when enabled,
+  // otherwise loop()); the main loop talks to it only through the two queues.
+  bool use_media_task_ = false;
+  MediaTask::Config media_task_config_{};
+  MediaTask media_task_;
+  SpscRingBuffer<MediaCommand, 8> media_commands_;
+  SpscRingBuffer<MediaEvent, 16> media_events_;
+  // one report per call every few seconds
+  SpscRingBuffer<MediaQuality, 8> media_quality_;
+  // SDES CNAME of all our streams, random per boot (RFC 7022)
+  char rtcp_cname_[RTCP_CNAME_SIZE] = {};
+  // the media context's copy of focus_leg_
+  int media_focus_ = -1;
+  // conference: participant 0 is the device, participant 1 + i the call on leg i. The calls are
+  // decoded at unity gain; amp_gain only applies to what the speaker plays.
+  ConferenceMixer mixer_;
+  g711::Q15Gain speaker_gain_ = g711::q15_gain(AMP_GAIN_DEFAULT, 1);
+  // due time of the next block, 0 while no call is mixed
+  uint64_t mix_next_us_ = 0;
+  int16_t mix_speaker_[MIX_BLOCK_SAMPLES];
+  // fed with what the speaker plays, cleans what the microphone hears; the adaptation's share is
+  // tuned to aec_budget_us_ per 10 ms from the time measured, smoothed
+  EchoCanceller aec_;
+  uint32_t aec_block_us_ = 0;
+  // after the echo canceller, so it does not learn the echo as noise, and before the AGC
+  bool ns_enabled_ = false;
+  float ns_attenuation_db_ = 15.0f;
+  NoiseSuppressor ns_;
+  // after the noise suppressor on the microphone, and last before the speaker
+  bool mic_agc_enabled_ = false;
+  GainControl mic_agc_;
+  bool speaker_limiter_enabled_ = false;
+  GainControl speaker_limiter_;
+  // TX frame buffers, too large for the media task stack at 60 ms
+  int32_t tx_frame_[MAX_FRAME_SAMPLES];
+  int16_t tx_pcm_[MAX_FRAME_SAMPLES];
+  uint8_t tx_packet_[RTP_HEADER_SIZE + MAX_FRAME_SAMPLES];
   int sip_port_ = 5060;
   std::string my_ip_;
   std::string sip_ip_;
   std::string sip_user_;
   std::string sip_pass_;
-  std::vector<uint8_t> mic_buffer_;
+  // written by the microphone callback, read by tx_rtp(); lock-free and bounded
+  SpscRingBuffer<uint8_t, MIC_RING_SIZE> mic_ring_;
+  // a microphone at another rate goes into the ring at SAMPLE_RATE in 16-bit samples; the
+  // resampler and its buffer (CHUNK samples in, CHUNK out) belong to the microphone callback.
+  // Allocated when the component starts, only for rates other than SAMPLE_RATE.
+  uint32_t mic_sample_rate_ = SAMPLE_RATE;
+  size_t mic_sample_bytes_ = 2;
+  std::unique_ptr<Resampler> mic_resampler_;
+  std::unique_ptr<int16_t[]> mic_pcm_;
+  // what the speaker plays, on the media context's side; a block of MIX_BLOCK_SAMPLES at its rate
+  uint32_t speaker_sample_rate_ = SAMPLE_RATE;
+  std::unique_ptr<Resampler> speaker_resampler_;
+  std::unique_ptr<int16_t[]> speaker_pcm_;
+  // G.722 with a 16 kHz microphone: the QMF splits it, and the ring holds pairs of the lower band
+  // (for the 8 kHz media path) and the upper band (for the encoder). A sample left over from a
+  // callback waits for the next one.
+  bool mic_split_ = false;
+  g722::AnalysisQmf mic_qmf_;
+  int16_t mic_odd_ = 0;
+  bool mic_has_odd_ = false;
+  // the upper band of the frame read_mic() returned, and what the noise suppressor's delay still holds
+  std::unique_ptr<int16_t[]> tx_high_;
+  int16_t tx_high_delay_[NoiseSuppressor::DELAY];
+  // G.722 with a 16 kHz speaker: the QMF joins the lower band with the upper band of the call on the
+  // speaker, which waits in rx_high_ for its frame and is delayed like the concealer delays the lower
+  bool speaker_merge_ = false;
+  g722::SynthesisQmf speaker_qmf_;
+  std::unique_ptr<int16_t[]> rx_high_;
+  int16_t rx_high_delay_[PacketLossConcealer::DELAY];
+#ifdef USE_SENSOR
+  sensor::Sensor *packet_loss_sensor_ = nullptr;
+  sensor::Sensor *remote_packet_loss_sensor_ = nullptr;
+  sensor::Sensor *jitter_sensor_ = nullptr;
+  sensor::Sensor *round_trip_time_sensor_ = nullptr;
+  sensor::Sensor *r_factor_sensor_ = nullptr;
+  sensor::Sensor *mos_sensor_ = nullptr;
+  sensor::Sensor *echo_return_loss_enhancement_sensor_ = nullptr;
+  sensor::Sensor *microphone_gain_sensor_ = nullptr;
+  sensor::Sensor *microphone_peak_sensor_ = nullptr;
+  sensor::Sensor *speaker_gain_sensor_ = nullptr;
+  sensor::Sensor *speaker_peak_sensor_ = nullptr;
+#endif
   // default_dial_number_ removed
   bool started_ = false;
   bool start_pending_ = false;
   int start_retries_ = 0;
   bool start_on_boot_ = false;
+  bool register_ = true;
+  uint32_t register_expires_s_ = 600;
+  bool auto_answer_ = false;
   // internal state tracking for automations
   bool last_sip_busy_ = false;
   bool last_tx_stream_is_running_ = false;
@@ -167,10 +682,56 @@ class Voip : public Component {
   std::vector<std::function<void()>> on_call_ended_callbacks_{};
   std::vector<std::function<void()>> on_ready_callbacks_{};
   std::vector<std::function<void()>> on_not_ready_callbacks_{};
+  std::vector<std::function<void(const std::string &)>> on_incoming_call_callbacks_{};
+  std::vector<std::function<void(const std::string &)>> on_call_missed_callbacks_{};
   void mic_data_callback(const std::vector<uint8_t> &data);
   void handle_incoming_rtp();
-  void handle_outgoing_rtp();
+  // drains the leg's socket; only the focused leg's packets reach its jitter buffer
+  void receive_rtp(MediaLeg &leg, bool focused);
+  void play_rtp_frames(MediaLeg &leg);
+  // the call's next frame of audio (decoded, concealed or comfort noise) into pcm, at the speaker's
+  // gain or unity; 0 samples if none is due
+  size_t pop_rx_frame(MediaLeg &leg, int16_t *pcm, bool speaker);
+  // reads the far end's reports and sends ours when due
+  void service_rtcp(MediaLeg &leg, uint64_t now_us);
+  CallQuality measure_quality(const MediaLeg &leg) const;
+  void publish_quality(const CallQuality &quality);
+  // conference: mixes every block that is due
+  void mix_conference();
+  void mix_block(uint64_t now_us);
+  // next block of a call's audio into out, false if nothing was due
+  bool read_leg_block(MediaLeg &leg, int16_t *out, size_t n);
+  // adds a mixed block to the call's TX frame and sends the frame once it is complete
+  void send_leg_block(MediaLeg &leg, const int16_t *pcm, size_t n, uint64_t now_us);
+  void update_sip_offer();
+  void select_media_codec(MediaLeg &leg, int codec, uint8_t payload_type);
+  void post_media_command(const MediaCommand &cmd);
+  void apply_amp_gain(int gain);
+  // applies a MediaCommand that is a setting rather than about the call; false for the others
+  bool apply_media_setting(const MediaCommand &cmd);
+  void apply_media_command(const MediaCommand &cmd);
+  void media_tick();
+  void process_media_events();
+  // opens, starts, renegotiates and stops the legs to follow the calls Sip holds
+  void sync_media_legs();
+  int open_leg(const SipDialog &call);
+  void start_leg_tx(int leg, const SipDialog &call);
+  void stop_leg(int leg);
+  void set_focus(int leg);
   void tx_rtp();
+  bool send_rtp_frame(MediaLeg &leg, uint64_t now_us);
+  // DTX: true if the frame in pcm was silence and went out as a SID or not at all; otherwise marker
+  // tells whether it starts a talkspurt
+  bool send_silence(MediaLeg &leg, const int16_t *pcm, size_t n, uint64_t now_us, bool *marker);
+  // header and send of the payload in tx_packet_
+  void send_rtp_packet(MediaLeg &leg, uint8_t payload_type, bool marker, size_t payload_len, uint64_t now_us);
+  // reads n samples from the microphone ring into tx_frame_ (and their upper band into tx_high_);
+  // bytes per sample, 0 if not enough data
+  int read_mic(size_t n);
+  // converts to the speaker's rate and plays; high is the G.722 upper band or null
+  void play_speaker(const int16_t *pcm, const int16_t *high, size_t n);
+  // removes the speaker's echo from scaled microphone samples, within the CPU budget
+  void cancel_echo(int16_t *pcm, size_t n);
 
   // Duplicate automation registration methods removed (they are public now)
 
@@ -180,6 +741,8 @@ class Voip : public Component {
   void notify_call_ended();
   void notify_ready();
   void notify_not_ready();
+  void notify_incoming_call(const std::string &caller);
+  void notify_call_missed(const std::string &caller);
 
 };  // class Voip
 }  // namespace voip